@@ -40,3 +40,10 @@ ULONG cdecl DLL_DECIDER_ROUTINE_DEFAULT_NAME(PREQUEST_GENERAL Request, PDP_REQUE
 	DEBUG_EXIT_FUNCTION("%u", ret);
 	return ret;
 }
+
+
+/** The routine keeps no state, so several threads may call it at once. */
+ULONG cdecl DLL_DECIDER_FLAGS_ROUTINE_NAME(void)
+{
+	return DLL_DECIDER_FLAG_REENTRANT;
+}
@@ -37,12 +37,28 @@ IRPMON_DRIVER_COMM_INTERFACE DriverCommInterface = {
 DWORD DevConn_SynchronousOtherIOCTL(DWORD Code, PVOID InputBuffer, ULONG InputBufferLength, PVOID OutputBuffer, ULONG OutputBufferLength)
 {
 	DWORD dummy = 0;
+	OVERLAPPED o;
 	DWORD ret = ERROR_GEN_FAILURE;
 	DEBUG_ENTER_FUNCTION("Code=0x%x; InputBuffer=0x%p; InputBufferLength=%u; OutputBuffer=0x%p; OutputBufferLength=%u", Code, InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength);
 
-	if (DeviceIoControl(_deviceHandle, Code, InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, &dummy, NULL))
-		ret = ERROR_SUCCESS;
-	else ret = GetLastError();
+	// The device is opened for overlapped I/O, so requests issued by multiple
+	// threads are not serialized by the I/O manager.
+	memset(&o, 0, sizeof(o));
+	o.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (o.hEvent != NULL) {
+		if (DeviceIoControl(_deviceHandle, Code, InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, &dummy, &o))
+			ret = ERROR_SUCCESS;
+		else {
+			ret = GetLastError();
+			if (ret == ERROR_IO_PENDING) {
+				ret = ERROR_SUCCESS;
+				if (!GetOverlappedResult(_deviceHandle, &o, &dummy, TRUE))
+					ret = GetLastError();
+			}
+		}
+
+		CloseHandle(o.hEvent);
+	} else ret = GetLastError();
 
 	DEBUG_EXIT_FUNCTION("%u", ret);
 	return ret;
@@ -60,7 +76,7 @@ DWORD DevConn_Connect(const IRPMON_INIT_INFO *Info)
 	if (deviceName == NULL || *deviceName == L'\0')
 		deviceName = IRPMNDRV_USER_DEVICE_NAME;
 
-	_deviceHandle = CreateFileW(deviceName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	_deviceHandle = CreateFileW(deviceName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
 	if (_deviceHandle == INVALID_HANDLE_VALUE)
 		ret = GetLastError();
 
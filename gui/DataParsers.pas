@@ -9,6 +9,8 @@ Uses
 Const
   DATA_PARSER_INIT_ROUTINE     = 'DataParserInit';
   IRPMON_DATA_PARSER_VERSION_1 = 1;
+  IRPMON_DATA_PARSER_VERSION_3 = 3;
+  DP_OUTPUT_NO_NAME            = High(NativeUInt);
 
 Type
   _DP_REQUEST_EXTRA_INFO = Record
@@ -23,6 +25,30 @@ Type
   TDataParserParseRoutine = Function (AHeader:PREQUEST_HEADER; Var AExtraInfo:DP_REQUEST_EXTRA_INFO; Var AHandled:ByteBool; Var ANames:PPWideChar; Var AValues:PPWideChar; Var ARowCount:NativeUInt):Cardinal; Cdecl;
   TDataParserFreeRoutine = Procedure (ANames:PPWideChar; AValues:PPWideChar; ACount:NativeUInt); Cdecl;
 
+  _DP_OUTPUT_ROW = Record
+    NameOffset : NativeUInt;
+    ValueOffset : NativeUInt;
+    end;
+  DP_OUTPUT_ROW = _DP_OUTPUT_ROW;
+  PDP_OUTPUT_ROW = ^DP_OUTPUT_ROW;
+
+  PDP_OUTPUT = ^DP_OUTPUT;
+  TDataParserOutputGrowRoutine = Function (AOutput:PDP_OUTPUT; ACharCount:NativeUInt; ARowCount:NativeUInt):Cardinal; Cdecl;
+
+  _DP_OUTPUT = Record
+    Chars : PWideChar;
+    CharCount : NativeUInt;
+    CharCapacity : NativeUInt;
+    Rows : PDP_OUTPUT_ROW;
+    RowCount : NativeUInt;
+    RowCapacity : NativeUInt;
+    GrowRoutine : TDataParserOutputGrowRoutine;
+    Context : Pointer;
+    end;
+  DP_OUTPUT = _DP_OUTPUT;
+
+  TDataParserParseOutputRoutine = Function (AHeader:PREQUEST_HEADER; Var AExtraInfo:DP_REQUEST_EXTRA_INFO; Var AHandled:ByteBool; AOutput:PDP_OUTPUT):Cardinal; Cdecl;
+
   _IRPMON_DATA_PARSER = Record
     Version : Cardinal;
     Size : Cardinal;
@@ -34,6 +60,12 @@ Type
     Priority : Cardinal;
     ParseRoutine : TDataParserParseRoutine;
     FreeRoutine : TDataParserFreeRoutine;
+    OptionEnumRoutine : Pointer;
+    OptionEnumFreeRoutine : Pointer;
+    OptionQueryRoutine : Pointer;
+    OptionSetRoutine : Pointer;
+    Flags : Cardinal;
+    ParseOutputRoutine : TDataParserParseOutputRoutine;
     end;
   IRPMON_DATA_PARSER = _IRPMON_DATA_PARSER;
   PIRPMON_DATA_PARSER = ^IRPMON_DATA_PARSER;
@@ -48,6 +80,8 @@ Type
       FDescription : WideString;
       FParseRoutine : TDataParserParseRoutine;
       FFreeRoutine : TDataParserFreeRoutine;
+      FParseOutputRoutine : TDataParserParseOutputRoutine;
+      FOutput : DP_OUTPUT;
       FPriority : Cardinal;
       FMajorVersion : Cardinal;
       FMinorVersion : Cardinal;
@@ -76,11 +110,47 @@ Implementation
 Uses
   SysUtils, RequestListModel;
 
+Function DataParserOutputGrow(AOutput:PDP_OUTPUT; ACharCount:NativeUInt; ARowCount:NativeUInt):Cardinal; Cdecl;
+Var
+  newCapacity : NativeUInt;
+begin
+Result := ERROR_SUCCESS;
+Try
+  If AOutput.CharCapacity - AOutput.CharCount < ACharCount Then
+    begin
+    newCapacity := AOutput.CharCapacity*2;
+    If newCapacity < AOutput.CharCount + ACharCount Then
+      newCapacity := AOutput.CharCount + ACharCount;
+
+    ReallocMem(AOutput.Chars, newCapacity*SizeOf(WideChar));
+    AOutput.CharCapacity := newCapacity;
+    end;
+
+  If AOutput.RowCapacity - AOutput.RowCount < ARowCount Then
+    begin
+    newCapacity := AOutput.RowCapacity*2;
+    If newCapacity < AOutput.RowCount + ARowCount Then
+      newCapacity := AOutput.RowCount + ARowCount;
+
+    ReallocMem(AOutput.Rows, newCapacity*SizeOf(DP_OUTPUT_ROW));
+    AOutput.RowCapacity := newCapacity;
+    end;
+Except
+  Result := ERROR_NOT_ENOUGH_MEMORY;
+  end;
+end;
+
 Constructor TDataParser.Create(ALibraryHandle:THandle; ALibraryName:WideString; Var ARaw:IRPMON_DATA_PARSER);
 begin
 Inherited Create;
 FParseRoutine := ARaw.ParseRoutine;
 FFreeRoutine := ARaw.FreeRoutine;
+FParseOutputRoutine := Nil;
+If ARaw.Version >= IRPMON_DATA_PARSER_VERSION_3 Then
+  FParseOutputRoutine := ARaw.ParseOutputRoutine;
+
+FillChar(FOutput, SizeOf(FOutput), 0);
+FOutput.GrowRoutine := DataParserOutputGrow;
 FName := WideCharToString(ARaw.Name);
 FDescription := WideCharToString(ARaw.Description);
 FPriority := ARaw.Priority;
@@ -93,6 +163,12 @@ end;
 
 Destructor TDataParser.Destroy;
 begin
+If Assigned(FOutput.Chars) Then
+  FreeMem(FOutput.Chars);
+
+If Assigned(FOutput.Rows) Then
+  FreeMem(FOutput.Rows);
+
 If FLibraryHandle <> 0 Then
   FreeLibrary(FLibraryHandle);
 
@@ -108,6 +184,7 @@ Var
   _rsCount : NativeUInt;
   n : PPWideChar;
   v : PPWideChar;
+  r : PDP_OUTPUT_ROW;
   ei : DP_REQUEST_EXTRA_INFO;
 begin
 AHandled := False;
@@ -115,6 +192,29 @@ ei.DriverName := PWideChar(ARequest.DriverName);
 ei.DeviceName := PWideChar(ARequest.DeviceName);
 ei.FileName := PWideChar(ARequest.FileName);
 ei.ProcessName := PWideChar(ARequest.ProcessName);
+If Assigned(FParseOutputRoutine) Then
+  begin
+  FOutput.CharCount := 0;
+  FOutput.RowCount := 0;
+  _handled := False;
+  Result := FParseOutputRoutine(ARequest.Raw, ei, _handled, @FOutput);
+  If (Result = 0) And (_handled) Then
+    begin
+    AHandled := True;
+    r := FOutput.Rows;
+    For I := 0 To Integer(FOutput.RowCount) - 1 Do
+      begin
+      If r.NameOffset <> DP_OUTPUT_NO_NAME Then
+        ANames.Add(WideCharToString(FOutput.Chars + r.NameOffset));
+
+      AValues.Add(WideCharToString(FOutput.Chars + r.ValueOffset));
+      Inc(r);
+      end;
+    end;
+
+  Exit;
+  end;
+
 Result := FParseRoutine(ARequest.Raw, ei, _handled, _ns, _vs, _rsCount);
 If (Result = 0) And (_handled) Then
   begin
@@ -161,7 +261,10 @@ If Assigned(initRoutine) Then
     initRoutine := GetProcAddress(lh, DATA_PARSER_INIT_ROUTINE);
     If Assigned(initRoutine) Then
       begin
-      AError := initRoutine(IRPMON_DATA_PARSER_VERSION_1, p);
+      AError := initRoutine(IRPMON_DATA_PARSER_VERSION_3, p);
+      If AError <> ERROR_SUCCESS Then
+        AError := initRoutine(IRPMON_DATA_PARSER_VERSION_1, p);
+
       If AError = ERROR_SUCCESS Then
         begin
         Try
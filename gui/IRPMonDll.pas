@@ -387,7 +387,9 @@ Type
     ertFileObjectNameDeleted,
     ertProcessCreated,
     ertProcessExitted,
-    ertImageLoad
+    ertImageLoad,
+    (** Some events were dropped because the Event Queue reached its limits. **)
+    ertEventsDropped
   );
   ERequesttype = _ERequestType;
   PERequesttype = ^ERequesttype;
@@ -404,6 +406,11 @@ Type
   PERequestResultType = ^ERequestResultType;
 
 Const
+  REQUEST_BATCH_VERSION_1          = 1;
+  REQUEST_BATCH_FLAG_MORE_AVAILABLE = $1;
+
+  REQUEST_TYPE_COUNT               = Ord(ertEventsDropped) + 1;
+
   REQUEST_FLAG_EMULATED            = $1;
   REQUEST_FLAG_DATA_STRIPPED       = $2;
   REQUEST_FLAG_ADMIN               = $4;
@@ -673,6 +680,14 @@ Type
   REQUEST_IMAGE_LOAD = _REQUEST_IMAGE_LOAD;
   PREQUEST_IMAGE_LOAD = ^REQUEST_IMAGE_LOAD;
 
+  _REQUEST_EVENTS_DROPPED = Record
+    Header : REQUEST_HEADER;
+    DroppedCount : Cardinal;
+    DroppedByType : Array [0..REQUEST_TYPE_COUNT - 1] Of Cardinal;
+    end;
+  REQUEST_EVENTS_DROPPED = _REQUEST_EVENTS_DROPPED;
+  PREQUEST_EVENTS_DROPPED = ^REQUEST_EVENTS_DROPPED;
+
 
   _REQUEST_GENERAL = Record
     Case ERequestType Of
@@ -689,11 +704,39 @@ Type
       ertFileObjectNameDeleted : (FileObjectNameDeleted : REQUEST_FILE_OBJECT_NAME_DELETED);
       ertProcessCreated : (ProcessCreated : REQUEST_PROCESS_CREATED);
       ertProcessExitted : (ProcessExitted : REQUEST_PROCESS_EXITTED);
-      ertImageLoad : (ImageLoad : REQUEST_IMAGE_LOAD)
+      ertImageLoad : (ImageLoad : REQUEST_IMAGE_LOAD);
+      ertEventsDropped : (EventsDropped : REQUEST_EVENTS_DROPPED)
     end;
   REQUEST_GENERAL = _REQUEST_GENERAL;
   PREQUEST_GENERAL = ^REQUEST_GENERAL;
 
+  (** Describes a batch of requests retrieved by IRPMonDllGetRequestBatch. The requests
+    follow the header one after another. *)
+  _REQUEST_BATCH_HEADER = Record
+    Version : Cardinal;
+    HeaderSize : Cardinal;
+    RecordCount : Cardinal;
+    BytesUsed : Cardinal;
+    FirstId : Cardinal;
+    LastId : Cardinal;
+    DroppedCount : Cardinal;
+    Flags : Cardinal;
+    end;
+  REQUEST_BATCH_HEADER = _REQUEST_BATCH_HEADER;
+  PREQUEST_BATCH_HEADER = ^REQUEST_BATCH_HEADER;
+
+  (** Consumer's view of the ring filled by IRPMonDllConnectRing. *)
+  _EVENT_RING = Record
+    Header : Pointer;
+    Data : PByte;
+    DataSize : Cardinal;
+    Watermark : Cardinal;
+    WriteOffset : Int64;
+    ReadOffset : Int64;
+    end;
+  EVENT_RING = _EVENT_RING;
+  PEVENT_RING = ^EVENT_RING;
+
 
   TFastIoSettings = Packed Array [0..Ord(FastIoMax) - 1] Of Byte;
   PFastIoSettings = ^TFastIoSettings;
@@ -848,6 +891,15 @@ Type
   IRPMON_INIT_INFO = _IRPMON_INIT_INFO;
   PIRPMON_INIT_INFO = ^IRPMON_INIT_INFO;
 
+  _EReqQueueOverflowPolicy = (
+    rqopDropNewest,
+    rqopDropOldest,
+    rqopSample,
+    rqopMax
+  );
+  EReqQueueOverflowPolicy = _EReqQueueOverflowPolicy;
+  PEReqQueueOverflowPolicy = ^EReqQueueOverflowPolicy;
+
   _IRPMNDRV_SETTINGS = Record
     ReqQueueLastRequestId : UInt32;
 	  ReqQueueLength : UInt32;
@@ -863,6 +915,16 @@ Type
 	  DriverSnapshotOnConnect : ByteBool;
     DataStripThreshold : Cardinal;
     StripData : ByteBool;
+    ReqQueueMaxLength : Cardinal;
+    ReqQueueMaxSize : Cardinal;
+    ReqQueueOverflowPolicy : EReqQueueOverflowPolicy;
+    ReqQueueSampleRate : Cardinal;
+    ReqQueueSize : UInt32;
+    ReqQueueDroppedCount : UInt32;
+    ReqQueueDroppedByType : Array [0..REQUEST_TYPE_COUNT - 1] Of UInt32;
+    ReqAllocHits : UInt64;
+    ReqAllocMisses : UInt64;
+    ReqAllocOutstanding : Int64;
     end;
   IRPMNDRV_SETTINGS = _IRPMNDRV_SETTINGS;
   PIRPMNDRV_SETTINGS = ^IRPMNDRV_SETTINGS;
@@ -887,6 +949,40 @@ Type
     ffaPassToFilter
   );
 
+  TRequestFilterNameRoutine = Function(AContext:Pointer; AFileObject:Pointer; Var AName:PWideChar; Var ALength:NativeUInt):ByteBool; Cdecl;
+
+Const
+  IRPMON_REPROCESS_EXTRA_INFO_REENTRANT = $1;
+
+Type
+  _IRPMON_REPROCESS_SETTINGS = Record
+    ThreadCount : Cardinal;
+    Filter : Pointer;
+    Decider : Pointer;
+    DeciderFlags : Cardinal;
+    DeciderAction : EFilterAction;
+    DeciderHighlightColor : Cardinal;
+    Parsers : Pointer;
+    ParserCount : Cardinal;
+    ExtraInfoRoutine : Pointer;
+    Context : Pointer;
+    Flags : Cardinal;
+    end;
+  IRPMON_REPROCESS_SETTINGS = _IRPMON_REPROCESS_SETTINGS;
+  PIRPMON_REPROCESS_SETTINGS = ^IRPMON_REPROCESS_SETTINGS;
+
+  _IRPMON_REPROCESS_RESULT = Record
+    Selected : ByteBool;
+    Highlighted : ByteBool;
+    HighlightColor : Cardinal;
+    Parser : Cardinal;
+    Names : PPWideChar;
+    Values : PPWideChar;
+    RowCount : NativeUInt;
+    end;
+  IRPMON_REPROCESS_RESULT = _IRPMON_REPROCESS_RESULT;
+  PIRPMON_REPROCESS_RESULT = ^IRPMON_REPROCESS_RESULT;
+
 
 Function IRPMonDllDriverHooksEnumerate(Var AHookedDrivers:PHOOKED_DRIVER_UMINFO; Var ACount:Cardinal):Cardinal; StdCall;
 Procedure IRPMonDllDriverHooksFree(AHookedDrivers:PHOOKED_DRIVER_UMINFO; ACount:Cardinal); StdCall;
@@ -907,8 +1003,13 @@ Function IRPMonDllSnapshotRetrieve(Var ADriverInfo:PPIRPMON_DRIVER_INFO; Var ACo
 Procedure IRPMonDllSnapshotFree(ADriverInfo:PPIRPMON_DRIVER_INFO; ACount:Cardinal); StdCall;
 
 Function IRPMonDllConnect:Cardinal; StdCall;
+Function IRPMonDllConnectRing(ARingSize:Cardinal; AWatermark:Cardinal; AEventHandle:THandle; ARing:PEVENT_RING):Cardinal; StdCall;
+Function IRPMonDllRingPeek(ARing:PEVENT_RING; Var ASize:Cardinal):Pointer; StdCall;
+Procedure IRPMonDllRingRelease(ARing:PEVENT_RING); StdCall;
+Function IRPMonDllRingWaitPrepare(ARing:PEVENT_RING):ByteBool; StdCall;
 Function IRPMonDllDisconnect:Cardinal; StdCall;
 Function IRPMonDllGetRequest(ARequest:PREQUEST_HEADER; ASize:Cardinal):Cardinal; StdCall;
+Function IRPMonDllGetRequestBatch(ABatch:PREQUEST_BATCH_HEADER; ASize:Cardinal):Cardinal; StdCall;
 
 Function IRPMonDllOpenHookedDriver(AObjectId:Pointer; Var AHandle:THandle):Cardinal; StdCall;
 Function IRPMonDllCloseHookedDriverHandle(AHandle:THandle):Cardinal; StdCall;
@@ -930,6 +1031,14 @@ Function IRPMonDllEmulateProcesses:Cardinal; StdCall;
 
 Function IRPMonDllSettingsQuery(Var ASettings:IRPMNDRV_SETTINGS):Cardinal; StdCall;
 Function IRPMonDllSettingsSet(Var ASettings:IRPMNDRV_SETTINGS; ASave:ByteBool):Cardinal; StdCall;
+Function IRPMonDllRequestFilterSet(AFilter:Pointer; ASize:Cardinal):Cardinal; StdCall;
+Function IRPMonDllFilterProgramCompile(AFilter:Pointer; ASize:Cardinal; ANameRoutine:TRequestFilterNameRoutine; AContext:Pointer; Var AProgram:Pointer):Cardinal; StdCall;
+Function IRPMonDllFilterProgramLoad(AFileName:PWideChar; ANameRoutine:TRequestFilterNameRoutine; AContext:Pointer; Var AProgram:Pointer):Cardinal; StdCall;
+Function IRPMonDllFilterProgramMatch(AProgram:Pointer; ARequest:PREQUEST_HEADER):ByteBool; StdCall;
+Function IRPMonDllFilterProgramMatchBatch(AProgram:Pointer; ARequests:Pointer; ACount:Cardinal; AResults:Pointer):Cardinal; StdCall;
+Procedure IRPMonDllFilterProgramFree(AProgram:Pointer); StdCall;
+Function IRPMonDllReprocess(Var ASettings:IRPMON_REPROCESS_SETTINGS; ARequests:Pointer; ACount:Cardinal; AResults:PIRPMON_REPROCESS_RESULT; ASelected:PCardinal; ASelectedCount:PCardinal):Cardinal; StdCall;
+Procedure IRPMonDllReprocessFree(Var ASettings:IRPMON_REPROCESS_SETTINGS; AResults:PIRPMON_REPROCESS_RESULT; ACount:Cardinal); StdCall;
 
 Function RequestCopy(AHeader:PREQUEST_HEADER):PREQUEST_HEADER; Cdecl;
 Function RequestMemoryAlloc(ASize:NativeUInt):PREQUEST_HEADER; Cdecl;
@@ -966,8 +1075,13 @@ Function IRPMonDllSnapshotRetrieve(Var ADriverInfo:PPIRPMON_DRIVER_INFO; Var ACo
 Procedure IRPMonDllSnapshotFree(ADriverInfo:PPIRPMON_DRIVER_INFO; ACount:Cardinal); StdCall; External LibraryName;
 
 Function IRPMonDllConnect:Cardinal; StdCall; External LibraryName;
+Function IRPMonDllConnectRing(ARingSize:Cardinal; AWatermark:Cardinal; AEventHandle:THandle; ARing:PEVENT_RING):Cardinal; StdCall; External LibraryName;
+Function IRPMonDllRingPeek(ARing:PEVENT_RING; Var ASize:Cardinal):Pointer; StdCall; External LibraryName;
+Procedure IRPMonDllRingRelease(ARing:PEVENT_RING); StdCall; External LibraryName;
+Function IRPMonDllRingWaitPrepare(ARing:PEVENT_RING):ByteBool; StdCall; External LibraryName;
 Function IRPMonDllDisconnect:Cardinal; StdCall; External LibraryName;
 Function IRPMonDllGetRequest(ARequest:PREQUEST_HEADER; ASize:Cardinal):Cardinal; StdCall; External LibraryName;
+Function IRPMonDllGetRequestBatch(ABatch:PREQUEST_BATCH_HEADER; ASize:Cardinal):Cardinal; StdCall; External LibraryName;
 
 Function IRPMonDllOpenHookedDriver(AObjectId:Pointer; Var AHandle:THandle):Cardinal; StdCall; External LibraryName;
 Function IRPMonDllCloseHookedDriverHandle(AHandle:THandle):Cardinal; StdCall; External LibraryName;
@@ -989,6 +1103,14 @@ Function IRPMonDllEmulateProcesses:Cardinal; StdCall; External LibraryName;
 
 Function IRPMonDllSettingsQuery(Var ASettings:IRPMNDRV_SETTINGS):Cardinal; StdCall; External LibraryName;
 Function IRPMonDllSettingsSet(Var ASettings:IRPMNDRV_SETTINGS; ASave:ByteBool):Cardinal; StdCall; External LibraryName;
+Function IRPMonDllRequestFilterSet(AFilter:Pointer; ASize:Cardinal):Cardinal; StdCall; External LibraryName;
+Function IRPMonDllFilterProgramCompile(AFilter:Pointer; ASize:Cardinal; ANameRoutine:TRequestFilterNameRoutine; AContext:Pointer; Var AProgram:Pointer):Cardinal; StdCall; External LibraryName;
+Function IRPMonDllFilterProgramLoad(AFileName:PWideChar; ANameRoutine:TRequestFilterNameRoutine; AContext:Pointer; Var AProgram:Pointer):Cardinal; StdCall; External LibraryName;
+Function IRPMonDllFilterProgramMatch(AProgram:Pointer; ARequest:PREQUEST_HEADER):ByteBool; StdCall; External LibraryName;
+Function IRPMonDllFilterProgramMatchBatch(AProgram:Pointer; ARequests:Pointer; ACount:Cardinal; AResults:Pointer):Cardinal; StdCall; External LibraryName;
+Procedure IRPMonDllFilterProgramFree(AProgram:Pointer); StdCall; External LibraryName;
+Function IRPMonDllReprocess(Var ASettings:IRPMON_REPROCESS_SETTINGS; ARequests:Pointer; ACount:Cardinal; AResults:PIRPMON_REPROCESS_RESULT; ASelected:PCardinal; ASelectedCount:PCardinal):Cardinal; StdCall; External LibraryName;
+Procedure IRPMonDllReprocessFree(Var ASettings:IRPMON_REPROCESS_SETTINGS; AResults:PIRPMON_REPROCESS_RESULT; ACount:Cardinal); StdCall; External LibraryName;
 
 Function RequestCopy(AHeader:PREQUEST_HEADER):PREQUEST_HEADER; Cdecl; External RequestsLibraryName;
 Function RequestMemoryAlloc(ASize:NativeUInt):PREQUEST_HEADER; Cdecl; External RequestsLibraryName;
@@ -365,6 +365,7 @@ Case ARequestType Of
   ertProcessCreated : Result := 'ProcessCreate';
   ertProcessExitted : Result := 'ProcessExit';
   ertImageLoad : Result := 'ImageLoad';
+  ertEventsDropped : Result := 'EventsDropped';
   Else Result := Format('<unknown> (%u)', [Ord(ARequestType)]);
   end;
 end;
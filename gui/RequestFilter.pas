@@ -677,6 +677,7 @@ Case RequestListModelColumnValueTypes[Ord(FField)] Of
     AddMapping(ASources, ATargets, Ord(ertProcessCreated), 'ProcessCreate');
     AddMapping(ASources, ATargets, Ord(ertProcessExitted), 'ProcessExit');
     AddMapping(ASources, ATargets, Ord(ertImageLoad), 'ImageLoad');
+    AddMapping(ASources, ATargets, Ord(ertEventsDropped), 'EventsDropped');
     end;
   Else Result := False;
   end;
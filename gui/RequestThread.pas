@@ -17,6 +17,11 @@ Type
     FEvent : THandle;
     FMsgCode : Cardinal;
     FCurrentList : TList<PREQUEST_GENERAL>;
+    FBatch : PREQUEST_BATCH_HEADER;
+    FBatchSize : Cardinal;
+    // Number of requests in the list being filled; a list holds
+    // many batches, each of them a block of requests.
+    FRecordCount : Cardinal;
 {$IFDEF FPC}
     Procedure PortablePostMessage;
 {$ENDIF}
@@ -54,32 +59,42 @@ end;
 
 Function TRequestThread.ProcessRequest(AList:TList<PREQUEST_GENERAL>):Cardinal;
 Var
+  I : Integer;
   rq : PREQUEST_GENERAL;
-  bufSize : Cardinal;
+  tmp : PREQUEST_GENERAL;
+  reqSize : Cardinal;
 begin
-bufSize := 65536;
 Repeat
-rq := AllocMem(bufSize);
-If Assigned(rq) Then
+Result := IRPMonDllGetRequestBatch(FBatch, FBatchSize);
+If Result = ERROR_SUCCESS Then
   begin
-  Result := IRPMonDllGetRequest(@rq.Header, bufSize);
-  If Result = ERROR_SUCCESS Then
+  // Copy the whole batch into one block and chain the requests
+  // the way the request list model expects them.
+  rq := AllocMem(FBatch.BytesUsed);
+  Move(PByte(PByte(FBatch) + FBatch.HeaderSize)^, rq^, FBatch.BytesUsed);
+  tmp := rq;
+  For I := 0 To FBatch.RecordCount - 1 Do
     begin
-    AList.Add(rq);
-    If ((rq.Header.Flags And REQUEST_FLAG_NEXT_AVAILABLE) = 0) Or
-       (AList.Count >= 200) Then
-      Break;
-    end;
+    reqSize := RequestGetSize(@tmp.Header);
+    If I < FBatch.RecordCount - 1 Then
+      tmp.Header.Next := Pointer(PByte(tmp) + reqSize)
+    Else tmp.Header.Next := Nil;
 
-  If Result <> ERROR_SUCCESS Then
-    begin
-    FreeMem(rq);
-    If Result = ERROR_INSUFFICIENT_BUFFER Then
-      bufSize := bufSize * 2;
+    tmp := PREQUEST_GENERAL(tmp.Header.Next);
     end;
-  end
-Else Result := ERROR_NOT_ENOUGH_MEMORY;
 
+  AList.Add(rq);
+  Inc(FRecordCount, FBatch.RecordCount);
+  If ((FBatch.Flags And REQUEST_BATCH_FLAG_MORE_AVAILABLE) = 0) Or
+     (FRecordCount >= 200) Then
+    Break;
+  end
+Else If Result = ERROR_INSUFFICIENT_BUFFER Then
+  begin
+  FreeMem(FBatch);
+  FBatchSize := FBatchSize * 2;
+  FBatch := AllocMem(FBatchSize);
+  end;
 Until (Result <> ERROR_SUCCESS) And (Result <> ERROR_INSUFFICIENT_BUFFER);
 end;
 
@@ -93,11 +108,12 @@ l := TList<PREQUEST_GENERAL>.Create;
 While Not Terminated  Do
   begin
   ProcessRequest(l);
-  If l.Count >= 200 Then
+  If FRecordCount >= 200 Then
     begin
     FCurrentList := l;
     PostRequestList;
     l := TList<PREQUEST_GENERAL>.Create;
+    FRecordCount := 0;
     end;
 
   waitRes := WaitForSingleObject(FEvent, 1000);
@@ -108,6 +124,7 @@ While Not Terminated  Do
         FCurrentList := l;
         PostRequestList;
         l := TList<PREQUEST_GENERAL>.Create;
+        FRecordCount := 0;
         end;
       end;
     WAIT_OBJECT_0: Break;
@@ -133,7 +150,10 @@ Var
 begin
 FConnected := False;
 FEvent := 0;
+FRecordCount := 0;
 FMsgCode := AMsgCode;
+FBatchSize := 262144;
+FBatch := AllocMem(FBatchSize);
 FEvent := CreateEvent(Nil, False, False, Nil);
 If FEvent = 0 Then
   Raise Exception.Create(Format('CreateEvent: %u', [GetLastError]));
@@ -154,6 +174,7 @@ If FConnected Then
 If FEvent <> 0 Then
   CloseHandle(FEvent);
 
+FreeMem(FBatch);
 Inherited Destroy;
 end;
 
@@ -19,6 +19,42 @@ typedef struct _DP_REQUEST_EXTRA_INFO {
 typedef DWORD (cdecl DP_PARSE_ROUTINE)(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount);
 typedef void (cdecl DP_FREE_ROUTINE)(wchar_t **Names, wchar_t **Values, size_t Count);
 
+/** Marks rows of a parser output that have no name. */
+#define DP_OUTPUT_NO_NAME						((size_t)-1)
+
+/** Row of a parser output. The offsets point to null-terminated strings
+    inside the output character buffer. Offsets rather than pointers are
+    used since the buffer moves when it grows. */
+typedef struct _DP_OUTPUT_ROW {
+	size_t NameOffset;
+	size_t ValueOffset;
+} DP_OUTPUT_ROW, *PDP_OUTPUT_ROW;
+
+struct _DP_OUTPUT;
+
+/** Makes room for at least CharCount more characters and RowCount more rows. */
+typedef DWORD (cdecl DP_OUTPUT_GROW_ROUTINE)(struct _DP_OUTPUT *Output, size_t CharCount, size_t RowCount);
+
+/** Buffers the host lends to parsers of version 3. The parser appends its
+    strings to Chars and its rows to Rows and calls GrowRoutine when the
+    capacity does not suffice. The host resets the counts between requests
+    and so reuses the memory for all the requests it parses. */
+typedef struct _DP_OUTPUT {
+	wchar_t *Chars;
+	size_t CharCount;
+	size_t CharCapacity;
+	PDP_OUTPUT_ROW Rows;
+	size_t RowCount;
+	size_t RowCapacity;
+	DP_OUTPUT_GROW_ROUTINE *GrowRoutine;
+	void *Context;
+} DP_OUTPUT, *PDP_OUTPUT;
+
+/** Parses the request into an output borrowed from the host. On failure, the
+    rows the routine appended are discarded by the host, nothing needs to be
+    freed. */
+typedef DWORD (cdecl DP_PARSE_OUTPUT_ROUTINE)(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output);
+
 #define DP_OPTION_TYPE_BOOLEAN					0x1
 #define DP_OPTION_TYPE_STRING					0x2
 #define DP_OPTION_TYPE_BINARY					0x3
@@ -37,6 +73,12 @@ typedef void(cdecl DP_FREE_OPTION)(PDP_OPTION_RECORD Options, size_t Count);
 
 #define IRPMON_DATA_PARSER_VERSION_1			0x1
 #define IRPMON_DATA_PARSER_VERSION_2			0x2
+#define IRPMON_DATA_PARSER_VERSION_3			0x3
+
+/** The parse and free routines may be called from several threads at once,
+    also while the options are being queried. Parsers without the flag are
+    called by one thread at a time. */
+#define DP_FLAG_REENTRANT						0x1
 
 typedef struct _IRPMON_DATA_PARSER_V1 {
 	uint32_t Version;
@@ -51,6 +93,23 @@ typedef struct _IRPMON_DATA_PARSER_V1 {
 	DP_FREE_ROUTINE *FreeRoutine;
 } IRPMON_DATA_PARSER_V1, *PIRPMON_DATA_PARSER_V1;
 
+typedef struct _IRPMON_DATA_PARSER_V2 {
+	uint32_t Version;
+	uint32_t Size;
+	const wchar_t *Name;
+	const wchar_t *Description;
+	uint32_t MajorVersion;
+	uint32_t MinorVersion;
+	uint32_t BuildVersion;
+	uint32_t Priority;
+	DP_PARSE_ROUTINE *ParseRoutine;
+	DP_FREE_ROUTINE *FreeRoutine;
+	DP_ENUM_OPTION *OptionEnumRoutine;
+	DP_FREE_OPTION *OptionEnumFreeRoutine;
+	DP_QUERY_OPTION *OptionQueryRoutine;
+	DP_SET_OPTION *OptionSetRoutine;
+} IRPMON_DATA_PARSER_V2, *PIRPMON_DATA_PARSER_V2;
+
 typedef struct _IRPMON_DATA_PARSER {
 	uint32_t Version;
 	uint32_t Size;
@@ -66,9 +125,13 @@ typedef struct _IRPMON_DATA_PARSER {
 	DP_FREE_OPTION *OptionEnumFreeRoutine;
 	DP_QUERY_OPTION *OptionQueryRoutine;
 	DP_SET_OPTION *OptionSetRoutine;
+	/** DP_FLAG_XXX */
+	uint32_t Flags;
+	/** Preferred to ParseRoutine when present. */
+	DP_PARSE_OUTPUT_ROUTINE *ParseOutputRoutine;
 } IRPMON_DATA_PARSER, *PIRPMON_DATA_PARSER;
 
-typedef IRPMON_DATA_PARSER IRPMON_DATA_PARSER_V2, *PIRPMON_DATA_PARSER_V2;
+typedef IRPMON_DATA_PARSER IRPMON_DATA_PARSER_V3, *PIRPMON_DATA_PARSER_V3;
 
 typedef DWORD (cdecl DP_INIT_ROUTINE)(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
 
@@ -30,9 +30,16 @@ typedef struct _DLL_DECIDER_DECISION {
 
 
 #define DLL_DECIDER_ROUTINE_DEFAULT_NAME			DecideRoutine
+/** Optional export returning DLL_DECIDER_FLAG_XXX. Deciders that do not
+    export it are called by one thread at a time. */
+#define DLL_DECIDER_FLAGS_ROUTINE_NAME				DeciderFlags
+
+/** The decide routine may be called from several threads at once. */
+#define DLL_DECIDER_FLAG_REENTRANT					0x1
 
 
 typedef ULONG(cdecl DLL_DECIDER_DECIDE_ROUTINE)(PREQUEST_GENERAL Request, PDP_REQUEST_EXTRA_INFO ExtraInfo, PDLL_DECIDER_DECISION Decision);
+typedef ULONG(cdecl DLL_DECIDER_FLAGS_ROUTINE)(void);
 
 
 
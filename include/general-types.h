@@ -77,8 +77,14 @@ typedef enum _ERequestType {
 	ertProcessExitted,
 	/// A PE image (EXE, DLL or driver) was mapped into memory.
 	ertImageLoad,
+	/// The driver dropped some events because the Event Queue
+	/// reached its limits.
+	ertEventsDropped,
 } ERequesttype, *PERequestPype;
 
+/// Number of values defined by the <see cref="_ERequestType"/> enumeration.
+#define REQUEST_TYPE_COUNT				(ertEventsDropped + 1)
+
 /// Determines the type returned in the Result union of the @link(REQUEST_HEADER) structure.
 typedef enum _ERequestResultType {
 	/// The result value is either not yet initialized, or not defined for a given request type.
@@ -382,6 +388,15 @@ typedef struct _REQUEST_IMAGE_LOAD {
 	BOOLEAN PartialMap;
 } REQUEST_IMAGE_LOAD, *PREQUEST_IMAGE_LOAD;
 
+/// Reports events dropped since the previous record of this type.
+typedef struct _REQUEST_EVENTS_DROPPED {
+	REQUEST_HEADER Header;
+	/// Total number of dropped events.
+	ULONG DroppedCount;
+	/// Number of dropped events, indexed by their request types.
+	ULONG DroppedByType[REQUEST_TYPE_COUNT];
+} REQUEST_EVENTS_DROPPED, *PREQUEST_EVENTS_DROPPED;
+
 typedef struct _REQUEST_GENERAL {
 	union {
 		REQUEST_HEADER Other;
@@ -398,9 +413,45 @@ typedef struct _REQUEST_GENERAL {
 		REQUEST_FILE_OBJECT_NAME_ASSIGNED FileObjectNameAssigned;
 		REQUEST_FILE_OBJECT_NAME_DELETED FileObjectNameDeleted;
 		REQUEST_IMAGE_LOAD ImageLoad;
+		REQUEST_EVENTS_DROPPED EventsDropped;
 	} RequestTypes;
 } REQUEST_GENERAL, *PREQUEST_GENERAL;
 
+/// Current version of the <see cref="_REQUEST_BATCH_HEADER"/> structure.
+#define REQUEST_BATCH_VERSION_1				1
+
+/// Defines possible values for the <see cref="_REQUEST_BATCH_HEADER.Flags"/> field.
+typedef enum _ERequestBatchFlags {
+	/// The Event Queue still contained requests when the batch was retrieved.
+	REQUEST_BATCH_FLAG_MORE_AVAILABLE = 0x1,
+} ERequestBatchFlags, *PERequestBatchFlags;
+
+/// Describes a batch of requests retrieved from the IRPMon Event Queue by a single call.
+/// <remarks>
+/// The requests immediately follow the header and are stored one after another,
+/// ordered by their IDs. Their <c>Entry</c> members are zeroed. Use <see cref="RequestGetSize"/>
+/// to determine the offset of the next request.
+/// </remarks>
+typedef struct _REQUEST_BATCH_HEADER {
+	/// Version of the batch format (<see cref="REQUEST_BATCH_VERSION_1"/>).
+	ULONG Version;
+	/// Size of the batch header, in bytes. The first request starts at this offset.
+	ULONG HeaderSize;
+	/// Number of requests in the batch.
+	ULONG RecordCount;
+	/// Total size of the requests following the header, in bytes.
+	ULONG BytesUsed;
+	/// ID of the first request in the batch.
+	ULONG FirstId;
+	/// ID of the last request in the batch.
+	ULONG LastId;
+	/// Number of requests the driver dropped since the previous batch was retrieved.
+	ULONG DroppedCount;
+	/// Combination of <see cref="ERequestBatchFlags"/> values.
+	ULONG Flags;
+	// Requests
+} REQUEST_BATCH_HEADER, *PREQUEST_BATCH_HEADER;
+
 typedef struct _REQUEST_CREATE_IRP_ETRA_PARAMETERS {
 	BOOLEAN Admin;
 	BOOLEAN Impersonated;
@@ -492,6 +543,19 @@ typedef struct _HOOKED_DRIVER_UMINFO {
 /************************************************************************/
 
 
+/// Determines what the driver does with new events when the Event Queue
+/// reaches one of its limits.
+typedef enum _EReqQueueOverflowPolicy {
+	/// New events are dropped.
+	rqopDropNewest,
+	/// New events are stored and the oldest ones removed from the queue.
+	rqopDropOldest,
+	/// One of every <see cref="_IRPMNDRV_SETTINGS.ReqQueueSampleRate"/> new events is stored,
+	/// the rest is dropped.
+	rqopSample,
+	rqopMax,
+} EReqQueueOverflowPolicy, *PEReqQueueOverflowPolicy;
+
 /// Global IRPMon driver statistics and settings.
 typedef struct _IRPMNDRV_SETTINGS {
 	/// Specifies ID of the newest event/request generated by the driver.
@@ -545,6 +609,38 @@ typedef struct _IRPMNDRV_SETTINGS {
 	/// If set to <c>FALSE</c> the limit is not enforced. If set to <c>TRUE</c>,
 	/// data are stripped to match the limit, if necessary.
 	BOOLEAN StripData;
+	/// Maximum number of events stored in the Event Queue. Zero means no limit.
+	ULONG ReqQueueMaxLength;
+	/// Maximum total size of events stored in the Event Queue, in bytes.
+	/// Zero means no limit.
+	ULONG ReqQueueMaxSize;
+	/// Action taken when a limit is reached, one of the <see cref="_EReqQueueOverflowPolicy"/> values.
+	/// <remarks>
+	/// Whatever the policy, new events are always dropped when the queue grows
+	/// twice beyond a limit.
+	/// </remarks>
+	ULONG ReqQueueOverflowPolicy;
+	/// For the <c>rqopSample</c> policy, one of every N events is stored
+	/// while a limit is exceeded.
+	ULONG ReqQueueSampleRate;
+	/// Total size of events currently present in the Event Queue, in bytes.
+	/// This member is read-only.
+	volatile LONG ReqQueueSize;
+	/// Total number of events dropped because of the queue limits.
+	/// This member is read-only.
+	volatile LONG ReqQueueDroppedCount;
+	/// Number of dropped events, indexed by their request types.
+	/// This member is read-only.
+	volatile LONG ReqQueueDroppedByType[REQUEST_TYPE_COUNT];
+	/// Number of event records allocated from the lookaside caches
+	/// without touching the pool. This member is read-only.
+	ULONG64 ReqAllocHits;
+	/// Number of event records allocated directly from the pool.
+	/// This member is read-only.
+	ULONG64 ReqAllocMisses;
+	/// Number of event records currently allocated, either waiting
+	/// in the Event Queue or being processed. This member is read-only.
+	LONG64 ReqAllocOutstanding;
 } IRPMNDRV_SETTINGS, *PIRPMNDRV_SETTINGS;
 
 
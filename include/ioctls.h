@@ -34,12 +34,34 @@
 #define IOCTL_IRPMNDRV_QUEUE_CLEAR					   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x19, METHOD_NEITHER, FILE_WRITE_ACCESS)
 #define IOCTL_IRPMNDRV_SETTINGS_QUERY                  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x1a, METHOD_NEITHER, FILE_READ_ACCESS)
 #define IOCTL_IRPMNDRV_SETTINGS_SET					   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x1b, METHOD_NEITHER, FILE_WRITE_ACCESS)
+#define IOCTL_IRPMNDRV_GET_RECORDS					   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x1c, METHOD_NEITHER, FILE_WRITE_ACCESS)
+/** The input buffer is a filter in the request-filter.h format; an empty
+    buffer removes the filter. Requests the filter excludes are discarded
+    before they enter the Event Queue. The filter is removed when the queue
+    disconnects. */
+#define IOCTL_IRPMNDRV_REQUEST_FILTER_SET			   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x1d, METHOD_NEITHER, FILE_WRITE_ACCESS)
 
 
+/** Optional input of IOCTL_IRPMNDRV_CONNECT. When present, the events are
+ *  delivered through a ring shared between the driver and the caller (see
+ *  event-ring.h) instead of through the Event Queue. */
 typedef struct _IOCTL_IRPMNDRV_CONNECT_INPUT {
-	HANDLE SemaphoreHandle;
+	/** Size of the ring data area. Must be a power of two. */
+	ULONG RingSize;
+	/** Number of unread bytes that must be present in the ring before
+	    the event gets signalled. */
+	ULONG Watermark;
+	/** Handle to a notification or synchronization event. */
+	HANDLE EventHandle;
 } IOCTL_IRPMNDRV_CONNECT_INPUT, *PIOCTL_IRPMNDRV_CONNECT_INPUT;
 
+typedef struct _IOCTL_IRPMNDRV_CONNECT_OUTPUT {
+	/** Address of the ring within the caller's address space. */
+	PVOID RingAddress;
+	/** Size of the whole ring, including its header. */
+	ULONG RingLength;
+} IOCTL_IRPMNDRV_CONNECT_OUTPUT, *PIOCTL_IRPMNDRV_CONNECT_OUTPUT;
+
 typedef struct _IOCTL_IRPMNDRV_HOOK_DRIVER_INPUT {
 	DRIVER_MONITOR_SETTINGS MonitorSettings;
 	ULONG DriverNameLength;
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <windows.h>
 #include "general-types.h"
+#include "data-parser-types.h"
+#include "dll-decider-types.h"
 
 /************************************************************************/
 /*                         SNAPSHOT RETRIEVAL                           */
@@ -69,6 +71,63 @@ typedef struct _DRIVER_NAME_WATCH_RECORD {
 	PWCHAR DriverName;
 } DRIVER_NAME_WATCH_RECORD, *PDRIVER_NAME_WATCH_RECORD;
 
+/************************************************************************/
+/*                  REPROCESSING                                        */
+/************************************************************************/
+
+/// Fills the names of objects a request refers to, for DLL deciders
+/// and data parsers. Called by one thread at a time unless
+/// IRPMON_REPROCESS_EXTRA_INFO_REENTRANT is set.
+typedef void (WINAPI IRPMON_EXTRA_INFO_ROUTINE)(const REQUEST_HEADER *Request, PDP_REQUEST_EXTRA_INFO ExtraInfo, void *Context);
+
+/// The extra information routine can be called from several threads at once.
+#define IRPMON_REPROCESS_EXTRA_INFO_REENTRANT			0x1
+
+/// Describes what <see cref="IRPMonDllReprocess"/> does with each request.
+typedef struct _IRPMON_REPROCESS_SETTINGS {
+	/// Number of worker threads, zero for one per processor.
+	ULONG ThreadCount;
+	/// Compiled filter deciding requests the decider does not, NULL to select
+	/// all of them. Its name routine must be reentrant.
+	struct _REQUEST_FILTER_PROGRAM *Filter;
+	/// Optional DLL decider, consulted before the filter.
+	DLL_DECIDER_DECIDE_ROUTINE *Decider;
+	/// DLL_DECIDER_FLAG_XXX returned by the decider's DeciderFlags export.
+	ULONG DeciderFlags;
+	/// Action taken when the decider decides and does not override it,
+	/// as the action of the filter condition using the decider in the GUI.
+	EFilterAction DeciderAction;
+	/// Highlight color used with ffaHighlight when the decider does not
+	/// override the action.
+	ULONG DeciderHighlightColor;
+	/// Data parsers tried, in this order, for each selected request, until
+	/// one handles it. Parsers without the DP_FLAG_REENTRANT flag are called
+	/// by one thread at a time.
+	PIRPMON_DATA_PARSER *Parsers;
+	ULONG ParserCount;
+	/// Optional, extra information passed to the decider and parsers
+	/// is empty without it.
+	IRPMON_EXTRA_INFO_ROUTINE *ExtraInfoRoutine;
+	void *Context;
+	/// IRPMON_REPROCESS_XXX flags.
+	ULONG Flags;
+} IRPMON_REPROCESS_SETTINGS, *PIRPMON_REPROCESS_SETTINGS;
+
+/// Result of reprocessing one request.
+typedef struct _IRPMON_REPROCESS_RESULT {
+	/// The request passed the decider and the filter.
+	BOOLEAN Selected;
+	/// The decider asked for the request to be highlighted.
+	BOOLEAN Highlighted;
+	ULONG HighlightColor;
+	/// Index of the parser that handled the request, ParserCount if none.
+	ULONG Parser;
+	/// Output of the parser, freed by <see cref="IRPMonDllReprocessFree"/>.
+	wchar_t **Names;
+	wchar_t **Values;
+	size_t RowCount;
+} IRPMON_REPROCESS_RESULT, *PIRPMON_REPROCESS_RESULT;
+
 /************************************************************************/
 /*              LIBRARY INITIALIZATION DATA TYPES                       */
 /************************************************************************/
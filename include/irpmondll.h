@@ -4,6 +4,8 @@
 
 #include <windows.h>
 #include "irpmondll-types.h"
+#include "event-ring.h"
+#include "request-filter-program.h"
 
 
 
@@ -450,6 +452,92 @@ IRPMONDLL_API VOID WINAPI IRPMonDllSnapshotFree(PIRPMON_DRIVER_INFO *DriverInfo,
 /// </remarks>
 IRPMONDLL_API DWORD WINAPI IRPMonDllConnect(void);
 
+/// <summary>
+/// Connects the current process to the IRPMon driver and makes the driver
+/// deliver events through a ring mapped into the process address space.
+/// </summary>
+/// <param name="RingSize">
+/// Size of the ring data area, in bytes. Must be a power of two between
+/// 64 KB and 64 MB.
+/// </param>
+/// <param name="Watermark">
+/// Number of unread bytes that must be present in the ring before the driver signals
+/// the event.
+/// </param>
+/// <param name="EventHandle">
+/// Handle to an event object signalled when the consumer waits and the watermark is reached.
+/// </param>
+/// <param name="Ring">
+/// Receives the consumer's view of the ring. Pass it to <see cref="IRPMonDllRingPeek"/>,
+/// <see cref="IRPMonDllRingRelease"/> and <see cref="IRPMonDllRingWaitPrepare"/>.
+/// </param>
+/// <returns>
+/// The function returns one of the following error codes :
+/// <list type="table">
+/// <listheader>
+///   <term>Value</term>
+///   <description>Description</description>
+/// </listheader>
+/// <item>
+///   <term>ERROR_SUCCESS</term>
+///   <description>The process successfully connected to the driver.</description>
+/// </item>
+/// <item>
+///   <term>ERROR_NOT_SUPPORTED</term>
+///   <description>The library is connected to a remote IRPMon instance.</description>
+/// </item>
+/// <item>
+///   <term>Other</term>
+///   <description>An error occurred.</description>
+/// </item>
+/// </list>
+/// </returns>
+/// <remarks>
+/// The records in the ring have the same format as the ones returned by <see cref="IRPMonDllGetRequest"/>.
+/// They are ordered by the time the driver stored them, which may slightly differ from
+/// the order of their IDs. Use <see cref="IRPMonDllDisconnect"/> to unmap the ring.
+/// </remarks>
+IRPMONDLL_API DWORD WINAPI IRPMonDllConnectRing(DWORD RingSize, DWORD Watermark, HANDLE EventHandle, PEVENT_RING Ring);
+
+/// <summary>
+/// Returns the oldest unread record from the ring without removing it.
+/// </summary>
+/// <param name="Ring">
+/// The ring filled by <see cref="IRPMonDllConnectRing"/>.
+/// </param>
+/// <param name="Size">
+/// Receives size of the record, in bytes.
+/// </param>
+/// <returns>
+/// Returns address of the record, valid until <see cref="IRPMonDllRingRelease"/> is called.
+/// NULL is returned when the ring is empty.
+/// </returns>
+IRPMONDLL_API PVOID WINAPI IRPMonDllRingPeek(PEVENT_RING Ring, PULONG Size);
+
+/// <summary>
+/// Removes the record returned by the last <see cref="IRPMonDllRingPeek"/> call from the ring.
+/// </summary>
+/// <param name="Ring">
+/// The ring filled by <see cref="IRPMonDllConnectRing"/>.
+/// </param>
+IRPMONDLL_API VOID WINAPI IRPMonDllRingRelease(PEVENT_RING Ring);
+
+/// <summary>
+/// Tells the driver that the consumer is going to wait for the event.
+/// </summary>
+/// <param name="Ring">
+/// The ring filled by <see cref="IRPMonDllConnectRing"/>.
+/// </param>
+/// <returns>
+/// Returns TRUE if the ring is empty and the caller may wait for the event.
+/// FALSE means records arrived in the meantime.
+/// </returns>
+/// <remarks>
+/// The driver signals the event only after the watermark is reached, so the wait
+/// should use a timeout.
+/// </remarks>
+IRPMONDLL_API BOOLEAN WINAPI IRPMonDllRingWaitPrepare(PEVENT_RING Ring);
+
 /// <summary>Disconnects the current thread from the IRPMon Event Queue.
 /// </summary>
 /// <returns>
@@ -534,6 +622,54 @@ IRPMONDLL_API DWORD WINAPI IRPMonDllQueueClear(void);
 /// </remarks>
 IRPMONDLL_API DWORD WINAPI IRPMonDllGetRequest(PREQUEST_HEADER Request, DWORD Size);
 
+/// <summary>Removes as many requests from the IRPMon Event Queue as fit into a given buffer.
+/// </summary>
+/// <param name="Batch">
+/// Address of buffer that receives a <see cref="_REQUEST_BATCH_HEADER"/> structure
+/// immediately followed by the requests.
+/// </param>
+/// <param name="Size">
+/// Size of the buffer, in bytes.
+/// </param>
+/// <returns>
+/// The function returns one of the following error codes :
+/// <list type="table">
+/// <listheader>
+///   <term>Value</term>
+///   <description>Description</description>
+/// </listheader>
+/// <item>
+///   <term>ERROR_SUCCESS</term>
+///   <description>
+///   At least one request has been removed from the queue and copied to the buffer.
+///  </description>
+/// </item>
+/// <item>
+///   <term>ERROR_NO_MORE_ITEMS</term>
+///   <description>
+///   The queue is empty.
+///   </description>
+/// </item>
+/// <item>
+///   <term>ERROR_INSUFFICIENT_BUFFER</term>
+///   <description>
+///   The first request in the queue does not fit into the buffer. The caller needs to
+///   specify a larger buffer. The request remains in the queue.
+///   </description>
+/// </item>
+/// <item>
+///   <term>Other</term>
+///   <description>An error occurred.</description>
+/// </item>
+/// </list>
+/// </returns>
+/// <remarks>
+/// Unlike <see cref="IRPMonDllGetRequest"/>, the driver detaches the whole batch during
+/// a single access to the queue. The requests are stored one after another and contain
+/// no pointers to each other, so the batch can be freely copied or sent over the network.
+/// </remarks>
+IRPMONDLL_API DWORD WINAPI IRPMonDllGetRequestBatch(PREQUEST_BATCH_HEADER Batch, DWORD Size);
+
 /// <summary>Open a handle to a given driver monitored by the IRPMon driver.
 /// </summary>
 /// <param name="ObjectId">
@@ -895,6 +1031,137 @@ IRPMONDLL_API DWORD WINAPI IRPMonDllSettingsQuery(PIRPMNDRV_SETTINGS Settings);
 /// <returns></returns>
 IRPMONDLL_API DWORD WINAPI IRPMonDllSettingsSet(PIRPMNDRV_SETTINGS Settings, BOOLEAN Save);
 
+/// <summary>Sets a filter the requests must pass before they are stored
+/// in the Event Queue, or sent over the network when connected to a server.
+/// </summary>
+/// <param name="Filter">
+/// Filter in the format defined by request-filter.h, e.g. built by
+/// the RequestFilterCreate and RequestFilterAddCondition routines. NULL removes
+/// the current filter.
+/// </param>
+/// <param name="Size">
+/// Size of the filter, in bytes.
+/// </param>
+/// <returns>
+/// Returns ERROR_SUCCESS on success. ERROR_GEN_FAILURE or ERROR_INVALID_PARAMETER
+/// indicate a malformed filter.
+/// </returns>
+/// <remarks>
+/// When connected to the driver directly, the filter applies to all requests
+/// the driver collects and is removed when the library disconnects. A server
+/// keeps a separate filter for each of its clients.
+/// </remarks>
+IRPMONDLL_API DWORD WINAPI IRPMonDllRequestFilterSet(const void *Filter, ULONG Size);
+
+/// <summary>Compiles a filter into a program that decides about requests
+/// retrieved from the driver or read from a log.
+/// </summary>
+/// <param name="Filter">
+/// Filter in the format defined by request-filter.h.
+/// </param>
+/// <param name="Size">
+/// Size of the filter, in bytes.
+/// </param>
+/// <param name="NameRoutine">
+/// Optional routine that retrieves names of file objects for requests that
+/// do not carry them.
+/// </param>
+/// <param name="Context">
+/// Value passed to the name routine.
+/// </param>
+/// <param name="Program">
+/// Receives the compiled program. Free it by the <see cref="IRPMonDllFilterProgramFree"/>
+/// procedure when no longer needed.
+/// </param>
+/// <returns>
+/// Returns ERROR_SUCCESS on success. ERROR_GEN_FAILURE or ERROR_INVALID_PARAMETER
+/// indicate a malformed filter.
+/// </returns>
+IRPMONDLL_API DWORD WINAPI IRPMonDllFilterProgramCompile(const void *Filter, ULONG Size, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, PREQUEST_FILTER_PROGRAM *Program);
+
+/// <summary>Compiles a filter list saved by the GUI.
+/// </summary>
+/// <param name="FileName">
+/// Name of the INI file with the list.
+/// </param>
+/// <returns>
+/// Returns ERROR_SUCCESS on success. ERROR_NOT_SUPPORTED is returned when
+/// the list tests device, driver or process names, constant names of results
+/// or uses DLL deciders; such lists must be evaluated by the GUI.
+/// </returns>
+/// <remarks>
+/// The other parameters have the same meaning as for <see cref="IRPMonDllFilterProgramCompile"/>.
+/// </remarks>
+IRPMONDLL_API DWORD WINAPI IRPMonDllFilterProgramLoad(const wchar_t *FileName, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, PREQUEST_FILTER_PROGRAM *Program);
+
+/// <summary>Decides whether a request passes a compiled filter.
+/// </summary>
+/// <returns>
+/// Returns TRUE if the request should be stored (displayed).
+/// </returns>
+IRPMONDLL_API BOOLEAN WINAPI IRPMonDllFilterProgramMatch(PREQUEST_FILTER_PROGRAM Program, const REQUEST_HEADER *Request);
+
+/// <summary>Runs a compiled filter for an array of requests.
+/// </summary>
+/// <param name="Results">
+/// Array of Count elements that receives the decision for each request.
+/// </param>
+/// <returns>
+/// Returns the number of requests that pass the filter.
+/// </returns>
+IRPMONDLL_API ULONG WINAPI IRPMonDllFilterProgramMatchBatch(PREQUEST_FILTER_PROGRAM Program, const REQUEST_HEADER * const *Requests, ULONG Count, PBOOLEAN Results);
+
+/// <summary>Frees a program created by <see cref="IRPMonDllFilterProgramCompile"/>
+/// or <see cref="IRPMonDllFilterProgramLoad"/>.
+/// </summary>
+IRPMONDLL_API VOID WINAPI IRPMonDllFilterProgramFree(PREQUEST_FILTER_PROGRAM Program);
+
+/************************************************************************/
+/*                  REPROCESSING                                        */
+/************************************************************************/
+
+/// <summary>Applies a DLL decider, a compiled filter and data parsers to
+/// an array of requests, such as a loaded log, on several threads.
+/// </summary>
+/// <param name="Settings">
+/// What to do with the requests and how many threads to use.
+/// </param>
+/// <param name="Requests">
+/// Array of Count requests.
+/// </param>
+/// <param name="Results">
+/// Array of Count elements that receives the result for each request, in the
+/// order of the Requests array. Free the parser output by
+/// <see cref="IRPMonDllReprocessFree"/>.
+/// </param>
+/// <param name="Selected">
+/// Optional array of Count elements that receives indices of the selected
+/// requests, in ascending order. When the requests are sorted by their Id,
+/// so are the selected ones.
+/// </param>
+/// <param name="SelectedCount">
+/// Optionally receives the number of selected requests.
+/// </param>
+/// <returns>
+/// Returns ERROR_SUCCESS on success.
+/// </returns>
+/// <remarks>
+/// The decider is consulted first. If it decides with the Include or Exclude
+/// action, the filter is not run. The filter program and the reentrant
+/// decider, parsers and extra information routine are called from several
+/// threads at once. Those that do not declare themselves reentrant (see
+/// DLL_DECIDER_FLAG_REENTRANT, DP_FLAG_REENTRANT and
+/// IRPMON_REPROCESS_EXTRA_INFO_REENTRANT) are called by one thread at a time.
+/// </remarks>
+IRPMONDLL_API DWORD WINAPI IRPMonDllReprocess(const IRPMON_REPROCESS_SETTINGS *Settings, const REQUEST_HEADER * const *Requests, ULONG Count, PIRPMON_REPROCESS_RESULT Results, PULONG Selected, PULONG SelectedCount);
+
+/// <summary>Frees the parser output stored in results of <see cref="IRPMonDllReprocess"/>.
+/// </summary>
+/// <param name="Settings">
+/// The settings passed to <see cref="IRPMonDllReprocess"/>.
+/// </param>
+IRPMONDLL_API VOID WINAPI IRPMonDllReprocessFree(const IRPMON_REPROCESS_SETTINGS *Settings, PIRPMON_REPROCESS_RESULT Results, ULONG Count);
+
 /************************************************************************/
 /*           INITIALIZATION AND FINALIZATION                            */
 /************************************************************************/
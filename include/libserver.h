@@ -9,6 +9,7 @@
 
 
 DWORD IRPMonServerStart(const char *Address, const char *Port, HANDLE ExitEvent);
+void IRPMonServerSetFlushPolicy(ULONG Deadline, ULONG Size);
 
 
 
@@ -11,6 +11,55 @@
 #define IOCTL_IRPMON_SERVER_ARCH_32BIT				1
 #define IOCTL_IRPMON_SERVER_ARCH_64BIT				2
 
+/** Protocol versions. The server announces the highest version it supports
+    in the InputBufferSize field of its greeting; version 1 servers leave it
+    zero. Version 2 is used only after the client asks for it by sending
+    a NETWORK_CONTROL_PROTOCOL message (Result holds the requested version)
+    and the server confirms it. */
+#define NETWORK_PROTOCOL_VERSION_1					1
+#define NETWORK_PROTOCOL_VERSION_2					2
+
+/** Control code of keep-alive messages. */
+#define NETWORK_CONTROL_PING						0
+/** Control code of the protocol upgrade message. */
+#define NETWORK_CONTROL_PROTOCOL					0xffffffff
+
+/** Maximum number of requests the server executes at once for one client. */
+#define NETWORK_MAX_IN_FLIGHT						64
+
+/** Event streaming (version 2 protocol only).
+
+    Instead of polling IOCTL_IRPMNDRV_GET_RECORDS over the network, a client
+    may subscribe to the event stream. The server then keeps draining
+    the Event Queue and pushes each batch (a REQUEST_BATCH_HEADER followed by
+    the requests) as a NETWORK_CONTROL_RECORDS message carrying the request ID
+    of the subscription. Every pushed batch consumes one credit; when no
+    credit is left, the server stops reading the queue until the client
+    grants more by a NETWORK_CONTROL_CREDIT message. A slow client thus makes
+    the driver drop events rather than the server buffer them. A batch with
+    a nonzero Result and no data ends the stream.
+
+    The client may ask for the batches to be compressed by one of
+    the block-codec.h methods. The REQUEST_BATCH_HEADER is always sent as is,
+    the Encoding field of the message header tells how the rest of the batch
+    is stored. The server sends a batch uncompressed when compression does not
+    make it smaller, so every batch must be checked. The decompressed size
+    follows from the HeaderSize and BytesUsed fields of the batch header. */
+
+/** Subscribes to the event stream, the input buffer is NETWORK_SUBSCRIBE_INPUT. */
+#define NETWORK_CONTROL_SUBSCRIBE					0xfffffffe
+/** Grants credit to the subscription, Result holds the number of batches.
+    The server does not reply. */
+#define NETWORK_CONTROL_CREDIT						0xfffffffd
+/** Batch of requests pushed by the server. */
+#define NETWORK_CONTROL_RECORDS						0xfffffffc
+
+/** Number of batches the client lets the server push ahead. */
+#define NETWORK_STREAM_CREDIT						8
+#define NETWORK_STREAM_MAX_BATCH_SIZE				0x1000000
+/** How long the server waits before reading an empty Event Queue again. */
+#define NETWORK_STREAM_POLL_INTERVAL				20
+
 typedef struct _NETWORK_MSG_IOCTL {
 	uint32_t Result;
 	uint32_t ControlCode;
@@ -19,6 +68,31 @@ typedef struct _NETWORK_MSG_IOCTL {
 	// Input buffer
 } NETWORK_MSG_IOCTL, *PNETWORK_MSG_IOCTL;
 
+/** Message header of the version 2 protocol. Requests carry an ID chosen by
+    the client, the reply repeats it. Multiple requests may be in flight and
+    the server replies in the order they complete. Pings (RequestId zero)
+    are answered immediately. */
+typedef struct _NETWORK_MSG_IOCTL_V2 {
+	uint32_t Result;
+	uint32_t ControlCode;
+	uint32_t InputBufferSize;
+	uint32_t OutputBufferSize;
+	uint32_t RequestId;
+	/** EBlockCodecMethod of the data following the batch header of
+	    NETWORK_CONTROL_RECORDS messages, zero for other messages. */
+	uint32_t Encoding;
+	// Input buffer
+} NETWORK_MSG_IOCTL_V2, *PNETWORK_MSG_IOCTL_V2;
+
+typedef struct _NETWORK_SUBSCRIBE_INPUT {
+	/** Maximum size of a pushed batch, including its header. */
+	uint32_t BatchSize;
+	/** Initial credit. */
+	uint32_t Credit;
+	/** EBlockCodecMethod the client wants the batches compressed with. */
+	uint32_t Compression;
+} NETWORK_SUBSCRIBE_INPUT, *PNETWORK_SUBSCRIBE_INPUT;
+
 
 
 
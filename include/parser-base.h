@@ -13,8 +13,15 @@ typedef struct _NV_PAIR {
 	wchar_t **Names;
 	wchar_t **Values;
 	size_t Count;
+	/** When set, the pairs are appended to the output instead of the
+	    Names and Values arrays. */
+	PDP_OUTPUT Output;
 } NV_PAIR, *PNV_PAIR;
 
+/** Parse routine shared by both parser interfaces. The pbase adapters give
+    it a pair collecting either allocated strings or output rows. */
+typedef DWORD (PBASE_PARSE_ROUTINE)(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair);
+
 
 
 
@@ -24,6 +31,16 @@ DWORD PBaseAddBooleanValue(PNV_PAIR Pair, const wchar_t *Name, BOOLEAN Value, BO
 DWORD PBaseAddFlags(PNV_PAIR Pair, uint32_t Flags, const uint32_t *FlagBits, const wchar_t **FlagNames, size_t FlagCount, BOOLEAN HideZeroValues);
 void PBaseFreeNameValue(wchar_t **Names, wchar_t **Values, size_t Count);
 
+void PBaseOutputInit(PDP_OUTPUT Output);
+void PBaseOutputReset(PDP_OUTPUT Output);
+void PBaseOutputFree(PDP_OUTPUT Output);
+DWORD PBaseOutputAppend(PDP_OUTPUT Output, const wchar_t *Name, size_t NameLength, size_t ValueLength, wchar_t **Value);
+DWORD PBaseOutputAdd(PDP_OUTPUT Output, const wchar_t *Name, const wchar_t *Value);
+
+DWORD PBaseParseNameValue(PBASE_PARSE_ROUTINE *Routine, const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount);
+DWORD PBaseParseOutput(PBASE_PARSE_ROUTINE *Routine, const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output);
+DWORD PBaseDataParserRun(const IRPMON_DATA_PARSER *Parser, const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output);
+
 DWORD PBaseDataParserAlloc(uint32_t Version, PIRPMON_DATA_PARSER *Parser);
 void PBaseDataParserFree(PIRPMON_DATA_PARSER Parser);
 
@@ -20,14 +20,14 @@ static PDRIVER_OBJECT _driverObject = NULL;
 /************************************************************************/
 
 
-NTSTATUS ProxyDeviceCreate(PDEVICE_OBJECT TargetDevice, PDEVICE_OBJECT *ProxyDevice)
+NTSTATUS ProxyDeviceCreate(PDEVICE_OBJECT TargetDevice, struct _DEVICE_HOOK_RECORD *DeviceRecord, PDEVICE_OBJECT *ProxyDevice)
 {
 	PDEVICE_OBJECT *updatePlace = NULL;
 	PDEVICE_OBJECT tmpProxy = NULL;
 	PDEVICE_OBJECT upperDevice = NULL;
 	PPROXY_DEVICE_EXTENSION ext = NULL;
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
-	DEBUG_ENTER_FUNCTION("TargetDevice=0x%p; ProxyDevice=0x%p", TargetDevice, ProxyDevice);
+	DEBUG_ENTER_FUNCTION("TargetDevice=0x%p; DeviceRecord=0x%p; ProxyDevice=0x%p", TargetDevice, DeviceRecord, ProxyDevice);
 
 	upperDevice = TargetDevice->AttachedDevice;
 	if (upperDevice != NULL) {
@@ -40,6 +40,7 @@ NTSTATUS ProxyDeviceCreate(PDEVICE_OBJECT TargetDevice, PDEVICE_OBJECT *ProxyDev
 			ext = (PPROXY_DEVICE_EXTENSION)tmpProxy->DeviceExtension;
 			memset(ext, 0, sizeof(PROXY_DEVICE_EXTENSION));
 			ext->Type = detProxy;
+			ext->DeviceRecord = DeviceRecord;
 			ObReferenceObject(TargetDevice);
 			ext->TargetDevice = TargetDevice;
 			ObReferenceObject(upperDevice);
@@ -100,6 +101,24 @@ void ProxyDeviceDelete(PDEVICE_OBJECT ProxyDevice)
 }
 
 
+/** Clears the device hook record stored in the proxy extension. Requests
+ *  arriving later are looked up in the hook tables. The reference held
+ *  by the extension passes to the caller.
+ */
+struct _DEVICE_HOOK_RECORD *ProxyDeviceTakeRecord(PDEVICE_OBJECT ProxyDevice)
+{
+	PPROXY_DEVICE_EXTENSION ext = NULL;
+	struct _DEVICE_HOOK_RECORD *ret = NULL;
+	DEBUG_ENTER_FUNCTION("ProxyDevice=0x%p", ProxyDevice);
+
+	ext = (PPROXY_DEVICE_EXTENSION)ProxyDevice->DeviceExtension;
+	ret = (struct _DEVICE_HOOK_RECORD *)InterlockedExchangePointer((PVOID volatile *)&ext->DeviceRecord, NULL);
+
+	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	return ret;
+}
+
+
 /************************************************************************/
 /*                   INITIALIZATION AND FINALIZATION                    */
 /************************************************************************/
@@ -21,12 +21,18 @@ typedef struct _PROXY_DEVICE_EXTENSION {
 	size_t LowerDeviceOffset;
 	size_t UpperDeviceExtensionSize;
 	size_t LowerDevicePlaceCount;
+	/** Hook record of the target device, set before the proxy starts receiving
+	    requests. The hook handlers use it instead of looking the record up. The
+	    extension holds a reference to the record until ProxyDeviceTakeRecord
+	    clears the field. */
+	struct _DEVICE_HOOK_RECORD *DeviceRecord;
 } PROXY_DEVICE_EXTENSION, *PPROXY_DEVICE_EXTENSION;
 
 
 
-NTSTATUS ProxyDeviceCreate(PDEVICE_OBJECT TargetDevice, PDEVICE_OBJECT *ProxyDevice);
+NTSTATUS ProxyDeviceCreate(PDEVICE_OBJECT TargetDevice, struct _DEVICE_HOOK_RECORD *DeviceRecord, PDEVICE_OBJECT *ProxyDevice);
 void ProxyDeviceDelete(PDEVICE_OBJECT ProxyDevice);
+struct _DEVICE_HOOK_RECORD *ProxyDeviceTakeRecord(PDEVICE_OBJECT ProxyDevice);
 
 NTSTATUS DevExtHooksModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
 void DevExtHooksModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
@@ -83,9 +83,17 @@ static NTSTATUS _LoadFromRegistry(PUNICODE_STRING ServiceKey)
 			if (NT_SUCCESS(status)) {
 				const wchar_t *ulongValueNames[] = {
 					L"StripDataThreshold",
+					L"ReqQueueMaxLength",
+					L"ReqQueueMaxSize",
+					L"ReqQueueOverflowPolicy",
+					L"ReqQueueSampleRate",
 				};
 				ULONG *ulongSettingsValues[] = {
 					&_globalSettings.DataStripThreshold,
+					&_globalSettings.ReqQueueMaxLength,
+					&_globalSettings.ReqQueueMaxSize,
+					&_globalSettings.ReqQueueOverflowPolicy,
+					&_globalSettings.ReqQueueSampleRate,
 				};
 
 				for (size_t i = 0; i < sizeof(ulongValueNames) / sizeof(ulongValueNames[0]); ++i) {
@@ -111,6 +119,9 @@ static NTSTATUS _LoadFromRegistry(PUNICODE_STRING ServiceKey)
 				}
 			}
 
+			if (_globalSettings.ReqQueueOverflowPolicy >= rqopMax)
+				_globalSettings.ReqQueueOverflowPolicy = rqopDropNewest;
+
 			ZwClose(hParametersKey);
 		} else status = STATUS_SUCCESS;
 
@@ -162,9 +173,17 @@ static NTSTATUS _SaveToRegistry(PUNICODE_STRING ServiceKey)
 			};
 			const wchar_t *ulongValueNames[] = {
 				L"StripDataThreshold",
+				L"ReqQueueMaxLength",
+				L"ReqQueueMaxSize",
+				L"ReqQueueOverflowPolicy",
+				L"ReqQueueSampleRate",
 			};
 			ULONG *ulongSettingsValues[] = {
 				&_globalSettings.DataStripThreshold,
+				&_globalSettings.ReqQueueMaxLength,
+				&_globalSettings.ReqQueueMaxSize,
+				&_globalSettings.ReqQueueOverflowPolicy,
+				&_globalSettings.ReqQueueSampleRate,
 			};
 			ULONG regValue = 0;
 
@@ -219,18 +238,24 @@ NTSTATUS DriverSettingsSet(const IRPMNDRV_SETTINGS *Settings, BOOLEAN Save)
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("Settings=0x%p; Save=%u", Settings, Save);
 
-	status = STATUS_SUCCESS;
-	_globalSettings.DriverSnapshotEventsCollect = Settings->DriverSnapshotEventsCollect;
-	_globalSettings.DriverSnapshotOnConnect = Settings->DriverSnapshotOnConnect;
-	_globalSettings.FileObjectEventsCollect = Settings->FileObjectEventsCollect;
-	_globalSettings.ProcessEmulateOnConnect = Settings->ProcessEmulateOnConnect;
-	_globalSettings.ProcessEventsCollect = Settings->ProcessEventsCollect;
-	_globalSettings.ReqQueueClearOnDisconnect = Settings->ReqQueueClearOnDisconnect;
-	_globalSettings.ReqQueueCollectWhenDisconnected = Settings->ReqQueueCollectWhenDisconnected;
-	_globalSettings.DataStripThreshold = Settings->DataStripThreshold;
-	_globalSettings.StripData = Settings->StripData;
-	if (Save)
-		status = _SaveToRegistry(&_uServiceKey);
+	status = (Settings->ReqQueueOverflowPolicy < rqopMax) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+	if (NT_SUCCESS(status)) {
+		_globalSettings.DriverSnapshotEventsCollect = Settings->DriverSnapshotEventsCollect;
+		_globalSettings.DriverSnapshotOnConnect = Settings->DriverSnapshotOnConnect;
+		_globalSettings.FileObjectEventsCollect = Settings->FileObjectEventsCollect;
+		_globalSettings.ProcessEmulateOnConnect = Settings->ProcessEmulateOnConnect;
+		_globalSettings.ProcessEventsCollect = Settings->ProcessEventsCollect;
+		_globalSettings.ReqQueueClearOnDisconnect = Settings->ReqQueueClearOnDisconnect;
+		_globalSettings.ReqQueueCollectWhenDisconnected = Settings->ReqQueueCollectWhenDisconnected;
+		_globalSettings.DataStripThreshold = Settings->DataStripThreshold;
+		_globalSettings.StripData = Settings->StripData;
+		_globalSettings.ReqQueueMaxLength = Settings->ReqQueueMaxLength;
+		_globalSettings.ReqQueueMaxSize = Settings->ReqQueueMaxSize;
+		_globalSettings.ReqQueueOverflowPolicy = Settings->ReqQueueOverflowPolicy;
+		_globalSettings.ReqQueueSampleRate = Settings->ReqQueueSampleRate;
+		if (Save)
+			status = _SaveToRegistry(&_uServiceKey);
+	}
 
 	DEBUG_EXIT_FUNCTION("0x%x", status);
 	return status;
@@ -260,6 +285,10 @@ NTSTATUS DriverSettingsInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING Registr
 		_globalSettings.ReqQueueCollectWhenDisconnected = FALSE;
 		_globalSettings.StripData = TRUE;
 		_globalSettings.DataStripThreshold = 1024;
+		_globalSettings.ReqQueueMaxLength = 0;
+		_globalSettings.ReqQueueMaxSize = 64*1024*1024;
+		_globalSettings.ReqQueueOverflowPolicy = rqopDropNewest;
+		_globalSettings.ReqQueueSampleRate = 16;
 		status = _LoadFromRegistry(RegistryPath);
 		if (NT_SUCCESS(status))
 			status = _SaveToRegistry(RegistryPath);
@@ -8,6 +8,8 @@
 #include "kernel-shared.h"
 #include "ioctls.h"
 #include "modules.h"
+#include "request.h"
+#include "request-filter.h"
 #include "req-queue.h"
 #include "um-services.h"
 #include "pnp-driver-watch.h"
@@ -84,6 +86,8 @@ NTSTATUS DriverCreateCleanup(PDEVICE_OBJECT DeviceObject, PIRP Irp)
 		ExAcquireResourceExclusiveLite(&_createCloseLock, TRUE);
 		irpStack = IoGetCurrentIrpStackLocation(Irp);
 		if (irpStack->MajorFunction == IRP_MJ_CLEANUP) {
+			// Refused for a ring consumer when the handle is closed by another
+			// process; the ring then goes away when the consumer exits.
 			UMRequestQueueDisconnect();
 			UMDeleteHandlesForProcess(PsGetCurrentProcess());
 		}
@@ -116,19 +120,24 @@ static NTSTATUS _HandleCDORequest(ULONG ControlCode, PVOID InputBuffer, ULONG In
 
 	switch (ControlCode) {
 		case IOCTL_IRPMNDRV_CONNECT:
-			status = UMRequestQueueConnect();
+			status = UMRequestQueueConnect((PIOCTL_IRPMNDRV_CONNECT_INPUT)InputBuffer, InputBufferLength, (PIOCTL_IRPMNDRV_CONNECT_OUTPUT)OutputBuffer, OutputBufferLength, &IoStatus->Information);
 			break;
 		case IOCTL_IRPMNDRV_DISCONNECT:
-			UMRequestQueueDisconnect();
-			status = STATUS_SUCCESS;
+			status = UMRequestQueueDisconnect();
 			break;
 		case IOCTL_IRPMNDRV_QUEUE_CLEAR:
 			UMRequestQueueClear();
 			status = STATUS_SUCCESS;
 			break;
+		case IOCTL_IRPMNDRV_REQUEST_FILTER_SET:
+			status = UMRequestFilterSet(InputBuffer, InputBufferLength);
+			break;
 		case IOCTL_IRPMNDRV_GET_RECORD:
 			status = UMGetRequestRecord(OutputBuffer, OutputBufferLength, &IoStatus->Information);
 			break;
+		case IOCTL_IRPMNDRV_GET_RECORDS:
+			status = UMGetRequestBatch(OutputBuffer, OutputBufferLength, &IoStatus->Information);
+			break;
 		case IOCTL_IRPMNDRV_HOOK_DRIVER:
 			status = UMHookDriver((PIOCTL_IRPMNDRV_HOOK_DRIVER_INPUT)InputBuffer, InputBufferLength, (PIOCTL_IRPMNDRV_HOOK_DRIVER_OUTPUT)OutputBuffer, OutputBufferLength);
 			if (NT_SUCCESS(status))
@@ -417,6 +426,7 @@ VOID DriverFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOI
 
 static DRIVER_MODULE_ENTRY_PARAMETERS _moduleEntries[] = {
 	{DriverSettingsInit, DriverSettingsFinit, NULL},
+	{RequestMemoryModuleInit, RequestMemoryModuleFinit, NULL},
 	{RequestQueueModuleInit, RequestQueueModuleFinit, NULL},
 	{HookModuleInit, HookModuleFinit, NULL},
 	{HookHandlerModuleInit, HookHandlerModuleFinit, NULL},
@@ -426,6 +436,7 @@ static DRIVER_MODULE_ENTRY_PARAMETERS _moduleEntries[] = {
 	{ImageLoadModuleInit, ImageLoadModuleFinit, NULL},
 	{PWDModuleInit, PWDModuleFinit, NULL},
 	{DataLoggerModuleInit, DataLoggerModuleFinit, NULL},
+	{RequestFilterModuleInit, RequestFilterModuleFinit, NULL},
 	{DriverInit, DriverFinit, NULL},
 };
 
@@ -434,7 +445,7 @@ NTSTATUS DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath)
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"", DriverObject, RegistryPath);
 
-	_moduleEntries[3].Context = RegistryPath;
+	_moduleEntries[4].Context = RegistryPath;
 	status= ModuleFrameworkInit(DriverObject);
 	if (NT_SUCCESS(status)) {
 		status = ModuleFrameworkAddModules(_moduleEntries, sizeof(_moduleEntries) / sizeof(DRIVER_MODULE_ENTRY_PARAMETERS));
@@ -13,42 +13,18 @@
 /************************************************************************/
 
 
-static RTL_GENERIC_COMPARE_RESULTS _FoCompareRoutine(__in struct _RTL_GENERIC_TABLE *Table, __in PVOID FirstStruct, __in PVOID SecondStruct)
+static VOID _FoContextReference(_Inout_ PVOID Object)
 {
-	RTL_GENERIC_COMPARE_RESULTS ret = GenericEqual;
-	const FO_TABLE_ENTRY *a = (PFO_TABLE_ENTRY)FirstStruct;
-	const FO_TABLE_ENTRY *b = (PFO_TABLE_ENTRY)SecondStruct;
-	DEBUG_ENTER_FUNCTION("Table=0x%p; FirstStruct=0x%p; SecondScrut=0x%p", Table,FirstStruct, SecondStruct);
+	InterlockedIncrement(&((PFILE_OBJECT_CONTEXT)Object)->ReferenceCount);
 
-	if ((uintptr_t)a->FileObject > (uintptr_t)b->FileObject)
-		ret = GenericGreaterThan;
-	else if ((uintptr_t)a->FileObject < (uintptr_t)b->FileObject)
-		ret = GenericLessThan;
-
-	DEBUG_EXIT_FUNCTION("%u", ret);
-	return ret;
-}
-
-
-static PVOID _FoAllocRoutine(__in struct _RTL_GENERIC_TABLE  *Table, __in CLONG  ByteSize)
-{
-	PVOID ret = NULL;
-	DEBUG_ENTER_FUNCTION("Table=0x%p; ByteSize=%u", Table,ByteSize);
-
-	ret = HeapMemoryAllocNonPaged(ByteSize);
-
-	DEBUG_EXIT_FUNCTION("0x%p", ret);
-	return ret;
+	return;
 }
 
 
-static VOID _FoFreeRoutine(__in struct _RTL_GENERIC_TABLE *Table, __in PVOID  Buffer)
+static VOID _FoContextDereference(_Inout_ PVOID Object)
 {
-	DEBUG_ENTER_FUNCTION("Table=0x%p; Buffer=0x%p", Table, Buffer);
-
-	HeapMemoryFree(Buffer);
+	FoContextDereference((PFILE_OBJECT_CONTEXT)Object);
 
-	DEBUG_EXIT_FUNCTION_VOID();
 	return;
 }
 
@@ -58,31 +34,25 @@ static VOID _FoFreeRoutine(__in struct _RTL_GENERIC_TABLE *Table, __in PVOID  Bu
 /************************************************************************/
 
 
-void FoTableInit(PFO_CONTEXT_TABLE Table, FO_CONTEXT_FREE_ROUTINE *FOCFreeRoutine)
+NTSTATUS FoTableInit(PFO_CONTEXT_TABLE Table, FO_CONTEXT_FREE_ROUTINE *FOCFreeRoutine)
 {
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; FOCFreeRoutine=0x%p", Table, FOCFreeRoutine);
 
-	RtlInitializeGenericTable(&Table->Table, _FoCompareRoutine, _FoAllocRoutine, _FoFreeRoutine, NULL);
 	Table->FOCFreeRoutine = FOCFreeRoutine;
-	KeInitializeSpinLock(&Table->Lock);
+	Table->Generation = 0;
+	status = ShardedRefTableInit(FIELD_OFFSET(FILE_OBJECT_CONTEXT, FileObject), FIELD_OFFSET(FILE_OBJECT_CONTEXT, NextRetired), _FoContextReference, _FoContextDereference, &Table->Table);
 
-	DEBUG_EXIT_FUNCTION_VOID();
-	return;
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
 }
 
 
 void FoTableFinit(PFO_CONTEXT_TABLE Table)
 {
-	PFILE_OBJECT_CONTEXT foc = NULL;
-	PFO_TABLE_ENTRY entry = NULL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p", Table);
 
-	while (!RtlIsGenericTableEmpty(&Table->Table)) {
-		entry = RtlGetElementGenericTable(&Table->Table, 0);
-		foc = entry->FoContext;
-		RtlDeleteElementGenericTable(&Table->Table, entry);
-		FoContextDereference(foc);
-	}
+	ShardedRefTableFinit(&Table->Table);
 
 	DEBUG_EXIT_FUNCTION_VOID();
 	return;
@@ -91,10 +61,7 @@ void FoTableFinit(PFO_CONTEXT_TABLE Table)
 
 NTSTATUS FoTableInsert(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject, const void *Buffer, CLONG Length)
 {
-	KIRQL irql;
-	BOOLEAN inserted = FALSE;
 	PFILE_OBJECT_CONTEXT foc = NULL;
-	FO_TABLE_ENTRY entry;
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; FileObject=0x%p; Buffer=0x%p; Length=%u", Table, FileObject, Buffer, Length);
 
@@ -105,16 +72,15 @@ NTSTATUS FoTableInsert(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject, const v
 			InterlockedExchange(&foc->ReferenceCount, 1);
 			foc->FreeRoutine = Table->FOCFreeRoutine;
 			foc->DataSize = Length;
+			foc->FileObject = FileObject;
 			memcpy(foc + 1, Buffer, Length);
-			entry.FileObject = FileObject;
-			entry.FoContext = foc;
-			KeAcquireSpinLock(&Table->Lock, &irql);
-			RtlInsertElementGenericTable(&Table->Table, &entry, sizeof(entry), &inserted);
-			status = (inserted) ? STATUS_SUCCESS : STATUS_ALREADY_REGISTERED;
+			status = ShardedRefTableInsert(&Table->Table, foc);
+			if (status == STATUS_OBJECT_NAME_COLLISION)
+				status = STATUS_ALREADY_REGISTERED;
+
 			if (NT_SUCCESS(status))
-				InterlockedIncrement(&foc->ReferenceCount);
+				InterlockedIncrement(&Table->Generation);
 
-			KeReleaseSpinLock(&Table->Lock, irql);
 			FoContextDereference(foc);
 		} else status = STATUS_INSUFFICIENT_RESOURCES;
 	} else status = STATUS_INVALID_PARAMETER;
@@ -126,21 +92,12 @@ NTSTATUS FoTableInsert(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject, const v
 
 PFILE_OBJECT_CONTEXT FoTableDelete(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject)
 {
-	KIRQL irql;
-	FO_TABLE_ENTRY entry;
-	PFO_TABLE_ENTRY entry2 = NULL;
 	PFILE_OBJECT_CONTEXT ret = NULL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; FileObject=0x%p", Table, FileObject);
 
-	entry.FileObject = FileObject;
-	KeAcquireSpinLock(&Table->Lock, &irql);
-	entry2 = RtlLookupElementGenericTable(&Table->Table, &entry);
-	if (entry2 != NULL) {
-		ret = entry2->FoContext;
-		RtlDeleteElementGenericTable(&Table->Table, &entry);
-	}
-
-	KeReleaseSpinLock(&Table->Lock, irql);
+	ret = (PFILE_OBJECT_CONTEXT)ShardedRefTableDelete(&Table->Table, FileObject);
+	if (ret != NULL)
+		InterlockedIncrement(&Table->Generation);
 
 	DEBUG_EXIT_FUNCTION("0x%p", ret);
 	return ret;
@@ -163,21 +120,10 @@ void FoTableDeleteNoReturn(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject)
 
 PFILE_OBJECT_CONTEXT FoTableGet(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject)
 {
-	KIRQL irql;
-	FO_TABLE_ENTRY entry;
-	PFO_TABLE_ENTRY entry2 = NULL;
 	PFILE_OBJECT_CONTEXT ret = NULL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; FileObject=0x%p", Table, FileObject);
 
-	entry.FileObject = FileObject;
-	KeAcquireSpinLock(&Table->Lock, &irql);
-	entry2 = RtlLookupElementGenericTable(&Table->Table, &entry);
-	if (entry2 != NULL) {
-		ret = entry2->FoContext;
-		InterlockedIncrement(&ret->ReferenceCount);
-	}
-
-	KeReleaseSpinLock(&Table->Lock, irql);
+	ret = (PFILE_OBJECT_CONTEXT)ShardedRefTableGet(&Table->Table, FileObject);
 
 	DEBUG_EXIT_FUNCTION("0x%p", ret);
 	return ret;
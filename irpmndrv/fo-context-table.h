@@ -4,6 +4,7 @@
 
 
 #include <ntifs.h>
+#include "sharded-ref-table.h"
 
 
 typedef void (FO_CONTEXT_FREE_ROUTINE)(void *FoContext);
@@ -12,18 +13,19 @@ typedef struct _FILE_OBJECT_CONTEXT {
 	volatile LONG ReferenceCount;
 	CLONG DataSize;
 	FO_CONTEXT_FREE_ROUTINE *FreeRoutine;
+	/** Key of the context in the table. */
+	PFILE_OBJECT FileObject;
+	/** Used by the table to link deleted contexts. */
+	PVOID NextRetired;
 	// Data
 } FILE_OBJECT_CONTEXT, *PFILE_OBJECT_CONTEXT;
 
-typedef struct _FO_TABLE_ENTRY {
-	PFILE_OBJECT FileObject;
-	PFILE_OBJECT_CONTEXT FoContext;
-} FO_TABLE_ENTRY, *PFO_TABLE_ENTRY;
-
 typedef struct _FO_CONTEXT_TABLE  {
-	RTL_GENERIC_TABLE Table;
-	KSPIN_LOCK Lock;
+	SHARDED_REF_TABLE Table;
 	FO_CONTEXT_FREE_ROUTINE *FOCFreeRoutine;
+	/** Incremented by every insertion and deletion. Allows callers to cache
+	    lookup results and detect they are out of date. */
+	volatile LONG Generation;
 } FO_CONTEXT_TABLE, *PFO_CONTEXT_TABLE;
 
 
@@ -31,7 +33,7 @@ typedef struct _FO_CONTEXT_TABLE  {
 #define FO_CONTEXT_TO_DATA(aFOC)	(aFOC + 1)
 
 
-void FoTableInit(PFO_CONTEXT_TABLE Table, FO_CONTEXT_FREE_ROUTINE *FOCFreeRoutine);
+NTSTATUS FoTableInit(PFO_CONTEXT_TABLE Table, FO_CONTEXT_FREE_ROUTINE *FOCFreeRoutine);
 void FoTableFinit(PFO_CONTEXT_TABLE Table);
 NTSTATUS FoTableInsert(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject, const void *Buffer, CLONG Length);
 PFILE_OBJECT_CONTEXT FoTableDelete(PFO_CONTEXT_TABLE Table, PFILE_OBJECT FileObject);
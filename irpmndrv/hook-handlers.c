@@ -18,6 +18,11 @@
 #undef DEBUG_TRACE_ENABLED
 #define DEBUG_TRACE_ENABLED 0
 
+/** When defined, FastIo events are written into record slots preallocated
+    for each processor and the file object lookups are cached per processor.
+    Undefine to fall back to pool allocations and a table lookup per event. */
+#define FASTIO_RECORD_SLOTS
+
 /************************************************************************/
 /*                       GLOBAL VARIABLES                               */
 /************************************************************************/
@@ -26,19 +31,103 @@ static IO_REMOVE_LOCK _rundownLock;
 static FO_CONTEXT_TABLE _foTable;
 static PDRIVER_OBJECT _gDriverObject = NULL;
 
+#ifdef FASTIO_RECORD_SLOTS
+
+/** Result of the last file object table lookup performed by a FastIo
+    handler on one processor. */
+typedef struct _FASTIO_CPU_CACHE {
+	PVOID FileObject;
+	/** Generation of the file object table the result is valid for. */
+	LONG Generation;
+	BOOLEAN Found;
+	BASIC_CLIENT_INFO ClientInfo;
+} FASTIO_CPU_CACHE, *PFASTIO_CPU_CACHE;
+
+static PFASTIO_CPU_CACHE _fastIoCache = NULL;
+static ULONG _fastIoCacheCount = 0;
+
+#endif
+
 
 /************************************************************************/
 /*                        HELPER ROUTINES                               */
 /************************************************************************/
 
 
+#ifdef FASTIO_RECORD_SLOTS
+
+/** Retrieves information about the client that opened a file object. The
+ *  result of the last lookup is cached for every processor and reused until
+ *  the file object table changes, so repeated FastIo calls on the same file
+ *  do not walk the table again. A cache miss performs a regular table lookup;
+ *  it takes no lock either, since readers of the sharded table never do.
+ *
+ *  @return
+ *  TRUE if the file object is known, FALSE otherwise.
+ */
+static BOOLEAN _FastIoGetClientInfo(PVOID FileObject, PBASIC_CLIENT_INFO ClientInfo)
+{
+	KIRQL irql;
+	LONG generation = 0;
+	BOOLEAN ret = FALSE;
+	PFASTIO_CPU_CACHE cache = NULL;
+	PFILE_OBJECT_CONTEXT foc = NULL;
+
+	// Reading the generation before the lookup makes a concurrent table
+	// change invalidate the cached result rather than go unnoticed.
+	generation = _foTable.Generation;
+	KeRaiseIrql(DISPATCH_LEVEL, &irql);
+	if (_fastIoCache != NULL) {
+		cache = _fastIoCache + (KeGetCurrentProcessorNumberEx(NULL) % _fastIoCacheCount);
+		if (cache->FileObject == FileObject && cache->Generation == generation) {
+			ret = cache->Found;
+			if (ret)
+				*ClientInfo = cache->ClientInfo;
+
+			cache = NULL;
+		}
+	}
+
+	if (_fastIoCache == NULL || cache != NULL) {
+		foc = FoTableGet(&_foTable, FileObject);
+		ret = (foc != NULL);
+		if (ret) {
+			*ClientInfo = *(PBASIC_CLIENT_INFO)(foc + 1);
+			FoContextDereference(foc);
+		}
+
+		if (cache != NULL) {
+			cache->FileObject = FileObject;
+			cache->Generation = generation;
+			cache->Found = ret;
+			if (ret)
+				cache->ClientInfo = *ClientInfo;
+		}
+	}
+
+	KeLowerIrql(irql);
+
+	return ret;
+}
+
+#endif
+
+
 static PREQUEST_FASTIO _CreateFastIoRequest(EFastIoOperationType FastIoType, PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT DeviceObject, PVOID FileObject, PVOID Arg1, PVOID Arg2, PVOID Arg3, PVOID Arg4, PVOID Arg5, PVOID Arg6, PVOID Arg7)
 {
 	PREQUEST_FASTIO ret = NULL;
 	BASIC_CLIENT_INFO clientInfo;
+#ifdef FASTIO_RECORD_SLOTS
+
+	// The record stays private until the lower driver returns. Building it
+	// within the shared ring would hide every later record from the consumer
+	// for as long as a waiting call blocks.
+	ret = (PREQUEST_FASTIO)RequestMemoryAllocSlot(sizeof(REQUEST_FASTIO));
+#else
 	PFILE_OBJECT_CONTEXT foc = NULL;
 
 	ret = (PREQUEST_FASTIO)RequestMemoryAlloc(sizeof(REQUEST_FASTIO));
+#endif
 	if (ret != NULL) {
 		RequestHeaderInit(&ret->Header, DriverObject, DeviceObject, ertFastIo);
 		ret->FastIoType = FastIoType;
@@ -53,12 +142,17 @@ static PREQUEST_FASTIO _CreateFastIoRequest(EFastIoOperationType FastIoType, PDR
 		ret->Arg7 = Arg7;
 		ret->IOSBInformation = 0;
 		ret->IOSBStatus = STATUS_UNSUCCESSFUL;
+#ifdef FASTIO_RECORD_SLOTS
+		if (_FastIoGetClientInfo(FileObject, &clientInfo))
+			_SetRequestFlags(&ret->Header, &clientInfo);
+#else
 		foc = FoTableGet(&_foTable, FileObject);
 		if (foc != NULL) {
 			clientInfo = *(PBASIC_CLIENT_INFO)(foc + 1);
 			_SetRequestFlags(&ret->Header, &clientInfo);
 			FoContextDereference(foc);
 		}
+#endif
 	}
 
 	return ret;
@@ -105,14 +199,18 @@ static void _GetHookRecords(PDEVICE_OBJECT *DeviceObject, PDRIVER_HOOK_RECORD *D
 	if (tmpDriverObject == _gDriverObject && *DeviceObject != NULL) {
 		ext = (PPROXY_DEVICE_EXTENSION)((*DeviceObject)->DeviceExtension);
 		if (ext->Type == detProxy) {
+			// The proxy usually knows its device record, no lookup is needed.
+			tmpDeviceHookRecord = DeviceHookRecordGetByProxy(*DeviceObject, &tmpDriverRecord);
 			tmpDriverObject = ext->TargetDevice->DriverObject;
 			*DeviceObject = ext->TargetDevice;
 		}
 	}
 
-	tmpDriverRecord = DriverHookRecordGet(tmpDriverObject);
-	if (tmpDriverRecord != NULL)
-		tmpDeviceHookRecord = DriverHookRecordGetDevice(tmpDriverRecord, *DeviceObject);
+	if (tmpDriverRecord == NULL) {
+		tmpDriverRecord = DriverHookRecordGet(tmpDriverObject);
+		if (tmpDriverRecord != NULL)
+			tmpDeviceHookRecord = DriverHookRecordGetDevice(tmpDriverRecord, *DeviceObject);
+	}
 
 	*DriverRecord = tmpDriverRecord;
 	*DeviceRecord = tmpDeviceHookRecord;
@@ -1646,9 +1744,28 @@ NTSTATUS HookHandlerModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING Regi
 
 	ObReferenceObject(DriverObject);
 	_gDriverObject = DriverObject;
-	FoTableInit(&_foTable, NULL);
-	IoInitializeRemoveLock(&_rundownLock, 'LRHH', 0x7FFFFFFF, 0x7FFFFFFF);
-	status = IoAcquireRemoveLock(&_rundownLock, DriverObject);
+	status = FoTableInit(&_foTable, NULL);
+	if (NT_SUCCESS(status)) {
+#ifdef FASTIO_RECORD_SLOTS
+		// Without the cache, FastIo handlers just look up the table every time.
+		_fastIoCacheCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+		_fastIoCache = (PFASTIO_CPU_CACHE)HeapMemoryAllocNonPaged(_fastIoCacheCount*sizeof(FASTIO_CPU_CACHE));
+		if (_fastIoCache != NULL)
+			memset(_fastIoCache, 0, _fastIoCacheCount*sizeof(FASTIO_CPU_CACHE));
+#endif
+		IoInitializeRemoveLock(&_rundownLock, 'LRHH', 0x7FFFFFFF, 0x7FFFFFFF);
+		status = IoAcquireRemoveLock(&_rundownLock, DriverObject);
+		if (!NT_SUCCESS(status)) {
+#ifdef FASTIO_RECORD_SLOTS
+			if (_fastIoCache != NULL) {
+				HeapMemoryFree(_fastIoCache);
+				_fastIoCache = NULL;
+			}
+#endif
+			FoTableFinit(&_foTable);
+		}
+	}
+
 	if (!NT_SUCCESS(status)) {
 		ObDereferenceObject(_gDriverObject);
 		_gDriverObject = NULL;
@@ -1664,6 +1781,12 @@ void HookHandlerModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING Registr
 	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
 
 	IoReleaseRemoveLockAndWait(&_rundownLock, DriverObject);
+#ifdef FASTIO_RECORD_SLOTS
+	if (_fastIoCache != NULL) {
+		HeapMemoryFree(_fastIoCache);
+		_fastIoCache = NULL;
+	}
+#endif
 	FoTableFinit(&_foTable);
 	ObDereferenceObject(_gDriverObject);
 	_gDriverObject = NULL;
@@ -5,6 +5,7 @@
 #include "general-types.h"
 #include "utils.h"
 #include "hash_table.h"
+#include "open-hash-table.h"
 #include "hook-handlers.h"
 #include "devext-hooks.h"
 #include "hook.h"
@@ -21,10 +22,15 @@
 
 static PHASH_TABLE _driverTable = NULL;
 static KSPIN_LOCK _driverTableLock;
+/** Maps driver objects to the records in _driverTable without locking. Used
+    by the hook handlers to find the driver record for each request. */
+static SHARDED_REF_TABLE _driverLookup;
 
-static PHASH_TABLE _driverValidationTable = NULL;
+/** Sets of valid driver and device record addresses. The records are referenced
+    under the locks when found, so the tables need no synchronization of their own. */
+static POPEN_HASH_TABLE _driverValidationTable = NULL;
 static KSPIN_LOCK _driverValidationTableLock;
-static PHASH_TABLE _deviceValidationTable = NULL;
+static POPEN_HASH_TABLE _deviceValidationTable = NULL;
 static KSPIN_LOCK _deviceValidationTableLock;
 static IO_REMOVE_LOCK _rundownLock;
 static BOOLEAN _shutdownInProgress = FALSE;
@@ -59,18 +65,37 @@ static BOOLEAN _DeviceCompareFunction(PHASH_ITEM HashItem, PVOID Key)
 	return (Key == r->DeviceObject);
 }
 
-static BOOLEAN _DriverValidationCompareFunction(PHASH_ITEM HashItem, PVOID Key)
+static BOOLEAN _ValidationCompareFunction(PVOID Object, PVOID Key)
 {
-	PDRIVER_HOOK_RECORD r = CONTAINING_RECORD(HashItem, DRIVER_HOOK_RECORD, ValidationHashItem);
+	return (Key == Object);
+}
+
+static VOID _DriverLookupReference(PVOID Object)
+{
+	DriverHookRecordReference((PDRIVER_HOOK_RECORD)Object);
+
+	return;
+}
+
+static VOID _DriverLookupDereference(PVOID Object)
+{
+	DriverHookRecordDereference((PDRIVER_HOOK_RECORD)Object);
 
-	return (Key == r);
+	return;
+}
+
+static VOID _DeviceLookupReference(PVOID Object)
+{
+	DeviceHookRecordReference((PDEVICE_HOOK_RECORD)Object);
+
+	return;
 }
 
-static BOOLEAN _DeviceValidationCompareFunction(PHASH_ITEM HashItem, PVOID Key)
+static VOID _DeviceLookupDereference(PVOID Object)
 {
-	PDEVICE_HOOK_RECORD r = CONTAINING_RECORD(HashItem, DEVICE_HOOK_RECORD, ValidationHashItem);
+	DeviceHookRecordDereference((PDEVICE_HOOK_RECORD)Object);
 
-	return (Key == r);
+	return;
 }
 
 static VOID _DriverFreeFunction(PHASH_ITEM HashItem)
@@ -83,6 +108,9 @@ static VOID _DriverFreeFunction(PHASH_ITEM HashItem)
 		r->MonitoringEnabled = FALSE;
 	}
 
+	r->Unhooked = TRUE;
+	_DriverHookRecordReleaseProxies(r);
+	ShardedRefTableClear(&r->DeviceLookup);
 	HashTableClear(r->SelectedDevices, TRUE);
 	DriverHookRecordDereference(r);
 
@@ -105,18 +133,19 @@ static VOID _DeviceFreeFunction(PHASH_ITEM HashItem)
 /*                            VALIDATION                                */
 /************************************************************************/
 
-static VOID _MakeDriverHookRecordValid(PDRIVER_HOOK_RECORD DriverRecord)
+static NTSTATUS _MakeDriverHookRecordValid(PDRIVER_HOOK_RECORD DriverRecord)
 {
 	KIRQL irql;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("DriverRecord=0x%p", DriverRecord);
 
 	KeAcquireSpinLock(&_driverValidationTableLock, &irql);
-	ASSERT(HashTableGet(_driverValidationTable, DriverRecord) == NULL);
-	HashTableInsert(_driverValidationTable, &DriverRecord->ValidationHashItem, DriverRecord);
+	ASSERT(OpenHashTableGet(_driverValidationTable, DriverRecord) == NULL);
+	status = OpenHashTableInsert(_driverValidationTable, DriverRecord, DriverRecord);
 	KeReleaseSpinLock(&_driverValidationTableLock, irql);
 
-	DEBUG_EXIT_FUNCTION_VOID();
-	return;
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
 }
 
 static VOID _InvalidateDriverHookRecord(PDRIVER_HOOK_RECORD DriverRecord)
@@ -125,25 +154,31 @@ static VOID _InvalidateDriverHookRecord(PDRIVER_HOOK_RECORD DriverRecord)
 	DEBUG_ENTER_FUNCTION("DriverRecord=0x%p", DriverRecord);
 
 	KeAcquireSpinLock(&_driverValidationTableLock, &irql);
-	ASSERT(HashTableGet(_driverValidationTable, DriverRecord) != NULL);
-	HashTableDelete(_driverValidationTable, DriverRecord);
+	ASSERT(OpenHashTableGet(_driverValidationTable, DriverRecord) != NULL);
+	OpenHashTableDelete(_driverValidationTable, DriverRecord);
 	KeReleaseSpinLock(&_driverValidationTableLock, irql);
 
 	DEBUG_EXIT_FUNCTION_VOID();
 	return;
 }
 
-static VOID _MakeDeviceHookRecordValid(PDEVICE_HOOK_RECORD DeviceRecord)
+static NTSTATUS _MakeDeviceHookRecordValid(PDEVICE_HOOK_RECORD DeviceRecord)
 {
 	KIRQL irql;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("DeviceRecord=0x%p", DeviceRecord);
 
+	// The table does not check for duplicates, and a record made valid
+	// twice would survive its invalidation.
 	KeAcquireSpinLock(&_deviceValidationTableLock, &irql);
-	HashTableInsert(_deviceValidationTable, &DeviceRecord->ValidationHashItem, DeviceRecord);
+	status = STATUS_SUCCESS;
+	if (OpenHashTableGet(_deviceValidationTable, DeviceRecord) == NULL)
+		status = OpenHashTableInsert(_deviceValidationTable, DeviceRecord, DeviceRecord);
+
 	KeReleaseSpinLock(&_deviceValidationTableLock, irql);
 
-	DEBUG_EXIT_FUNCTION_VOID();
-	return;
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
 }
 
 static VOID _InvalidateDeviceHookRecord(PDEVICE_HOOK_RECORD DeviceRecord)
@@ -152,7 +187,7 @@ static VOID _InvalidateDeviceHookRecord(PDEVICE_HOOK_RECORD DeviceRecord)
 	DEBUG_ENTER_FUNCTION("DeviceRecord=0x%p", DeviceRecord);
 
 	KeAcquireSpinLock(&_deviceValidationTableLock, &irql);
-	HashTableDelete(_deviceValidationTable, DeviceRecord);
+	OpenHashTableDelete(_deviceValidationTable, DeviceRecord);
 	KeReleaseSpinLock(&_deviceValidationTableLock, irql);
 
 	DEBUG_EXIT_FUNCTION_VOID();
@@ -343,9 +378,15 @@ static NTSTATUS _DriverHookRecordCreate(PDRIVER_OBJECT DriverObject, PDRIVER_MON
 				memcpy(tmpRecord->IRPSettings, MonitorSettings->IRPSettings, sizeof(tmpRecord->IRPSettings));
 				memcpy(tmpRecord->FastIoSettings, MonitorSettings->FastIoSettings, sizeof(tmpRecord->FastIoSettings));
 				KeInitializeSpinLock(&tmpRecord->SelectedDevicesLock);
-				status = HashTableCreate(httNoSynchronization, 37, _HashFunction, _DeviceCompareFunction, _DeviceFreeFunction, &tmpRecord->SelectedDevices);
-				if (NT_SUCCESS(status))
-					*Record = tmpRecord;
+				status = ShardedRefTableInit(FIELD_OFFSET(DEVICE_HOOK_RECORD, DeviceObject), FIELD_OFFSET(DEVICE_HOOK_RECORD, NextRetired), _DeviceLookupReference, _DeviceLookupDereference, &tmpRecord->DeviceLookup);
+				if (NT_SUCCESS(status)) {
+					status = HashTableCreate(httNoSynchronization, 37, _HashFunction, _DeviceCompareFunction, _DeviceFreeFunction, &tmpRecord->SelectedDevices);
+					if (NT_SUCCESS(status))
+						*Record = tmpRecord;
+
+					if (!NT_SUCCESS(status))
+						ShardedRefTableFinit(&tmpRecord->DeviceLookup);
+				}
 
 				if (!NT_SUCCESS(status))
 					HeapMemoryFree(tmpRecord->DriverName.Buffer);
@@ -367,6 +408,7 @@ static VOID _DriverHookRecordFree(PDRIVER_HOOK_RECORD Record)
 {
 	DEBUG_ENTER_FUNCTION("Record=0x%p", Record);
 
+	ShardedRefTableFinit(&Record->DeviceLookup);
 	HashTableDestroy(Record->SelectedDevices);
 	HeapMemoryFree(Record->DriverName.Buffer);
 	IoReleaseRemoveLock(&_rundownLock, Record);
@@ -496,6 +538,88 @@ static VOID _FreeDeviceHookRecordArray(PDEVICE_HOOK_RECORD *Array, ULONG Count)
 	return;
 }
 
+/** Creates a proxy device for the device of the record. The proxy extension
+ *  keeps a referenced pointer to the record, so the hook handlers need not
+ *  look the record up.
+ */
+static NTSTATUS _DeviceHookRecordProxyCreate(PDEVICE_HOOK_RECORD Record)
+{
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Record=0x%p", Record);
+
+	DeviceHookRecordReference(Record);
+	status = ProxyDeviceCreate(Record->DeviceObject, Record, &Record->ProxyDevice);
+	if (!NT_SUCCESS(status))
+		DeviceHookRecordDereference(Record);
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+/** Deletes the proxy device of the record. The reference held by the proxy
+ *  extension is released after the hook handlers that might have read it are done.
+ *  Must be called at PASSIVE_LEVEL.
+ */
+static VOID _DeviceHookRecordProxyDelete(PDEVICE_HOOK_RECORD Record)
+{
+	PDEVICE_HOOK_RECORD proxyRecord = NULL;
+	DEBUG_ENTER_FUNCTION("Record=0x%p", Record);
+
+	proxyRecord = ProxyDeviceTakeRecord(Record->ProxyDevice);
+	ProxyDeviceDelete(Record->ProxyDevice);
+	Record->ProxyDevice = NULL;
+	if (proxyRecord != NULL) {
+		UtilsWaitForDispatchReaders();
+		DeviceHookRecordDereference(proxyRecord);
+	}
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+static VOID _ProxyRecordTakeCallback(PHASH_ITEM HashItem, PVOID Context)
+{
+	PDEVICE_HOOK_RECORD r = CONTAINING_RECORD(HashItem, DEVICE_HOOK_RECORD, HashItem);
+	PDEVICE_HOOK_RECORD *list = (PDEVICE_HOOK_RECORD *)Context;
+
+	if (r->ProxyDevice != NULL && ProxyDeviceTakeRecord(r->ProxyDevice) != NULL) {
+		r->NextProxyRelease = *list;
+		*list = r;
+	}
+
+	return;
+}
+
+/** Clears the device records stored in the proxy extensions of the driver's
+ *  devices and releases their references after the hook handlers that might
+ *  have read them are done. The proxies stay in the device stacks and their
+ *  requests are looked up in the hook tables from now on. Must be called
+ *  at PASSIVE_LEVEL.
+ */
+static VOID _DriverHookRecordReleaseProxies(PDRIVER_HOOK_RECORD DriverRecord)
+{
+	KIRQL irql;
+	PDEVICE_HOOK_RECORD r = NULL;
+	PDEVICE_HOOK_RECORD list = NULL;
+	DEBUG_ENTER_FUNCTION("DriverRecord=0x%p", DriverRecord);
+
+	KeAcquireSpinLock(&DriverRecord->SelectedDevicesLock, &irql);
+	HashTablePerform(DriverRecord->SelectedDevices, _ProxyRecordTakeCallback, &list);
+	KeReleaseSpinLock(&DriverRecord->SelectedDevicesLock, irql);
+	if (list != NULL) {
+		UtilsWaitForDispatchReaders();
+		while (list != NULL) {
+			r = list;
+			list = r->NextProxyRelease;
+			r->NextProxyRelease = NULL;
+			DeviceHookRecordDereference(r);
+		}
+	}
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
 /************************************************************************/
 /*                      PUBLIC FUNCTIONS                                */
 /************************************************************************/
@@ -545,34 +669,60 @@ NTSTATUS HookDriverObject(PDRIVER_OBJECT DriverObject, PDRIVER_MONITOR_SETTINGS
 	if (NT_SUCCESS(status)) {
 		status = _CreateRecordsForExistingDevices(record, &existingDevices, &existingDeviceCount);
 		if (NT_SUCCESS(status)) {
-			KeAcquireSpinLock(&_driverTableLock, &irql);
-			if (HashTableGet(_driverTable, DriverObject) == NULL) {
-				KIRQL irql2;
-				ULONG i = 0;
+			ULONG i = 0;
 
-				DriverHookRecordReference(record);
-				HashTableInsert(_driverTable, &record->HashItem, DriverObject);
-				KeAcquireSpinLock(&record->SelectedDevicesLock, &irql2);
-				for (i = 0; i < existingDeviceCount; ++i) {
-					PDEVICE_HOOK_RECORD deviceRecord = existingDevices[i];
+			// The record is not visible yet, so its devices can be looked up
+			// as soon as the record itself can.
+			for (i = 0; i < existingDeviceCount; ++i) {
+				status = ShardedRefTableInsert(&record->DeviceLookup, existingDevices[i]);
+				if (!NT_SUCCESS(status))
+					break;
+			}
+
+			// Nobody knows the record address yet, so the record may be
+			// valid before it is published.
+			if (NT_SUCCESS(status))
+				status = _MakeDriverHookRecordValid(record);
+
+			if (NT_SUCCESS(status)) {
+				KeAcquireSpinLock(&_driverTableLock, &irql);
+				if (HashTableGet(_driverTable, DriverObject) == NULL) {
+					status = ShardedRefTableInsert(&_driverLookup, record);
+					if (NT_SUCCESS(status)) {
+						KIRQL irql2;
+
+						DriverHookRecordReference(record);
+						HashTableInsert(_driverTable, &record->HashItem, DriverObject);
+						KeAcquireSpinLock(&record->SelectedDevicesLock, &irql2);
+						for (i = 0; i < existingDeviceCount; ++i) {
+							PDEVICE_HOOK_RECORD deviceRecord = existingDevices[i];
+
+							DeviceHookRecordReference(deviceRecord);
+							HashTableInsert(record->SelectedDevices, &deviceRecord->HashItem, deviceRecord->DeviceObject);
+						}
 
-					DeviceHookRecordReference(deviceRecord);
-					HashTableInsert(record->SelectedDevices, &deviceRecord->HashItem, deviceRecord->DeviceObject);
+						KeReleaseSpinLock(&record->SelectedDevicesLock, irql2);
+						KeReleaseSpinLock(&_driverTableLock, irql);
+						if (record->MonitoringEnabled)
+							_HookDriverObject(DriverObject, record);
+
+						DriverHookRecordReference(record);
+						*DriverRecord = record;
+					} else KeReleaseSpinLock(&_driverTableLock, irql);
+				} else {
+					KeReleaseSpinLock(&_driverTableLock, irql);
+					status = STATUS_ALREADY_REGISTERED;
 				}
 
-				KeReleaseSpinLock(&record->SelectedDevicesLock, irql2);
-				KeReleaseSpinLock(&_driverTableLock, irql);
-				_MakeDriverHookRecordValid(record);
-				if (record->MonitoringEnabled)
-					_HookDriverObject(DriverObject, record);
-
-				DriverHookRecordReference(record);
-				*DriverRecord = record;
-			} else {
-				KeReleaseSpinLock(&_driverTableLock, irql);
-				status = STATUS_ALREADY_REGISTERED;
+				if (!NT_SUCCESS(status))
+					_InvalidateDriverHookRecord(record);
 			}
 
+			// Device records reference the driver one, the cycle must be broken
+			// for the record to be freed.
+			if (!NT_SUCCESS(status))
+				ShardedRefTableClear(&record->DeviceLookup);
+
 			_FreeDeviceHookRecordArray(existingDevices, existingDeviceCount);
 		}
 
@@ -594,11 +744,15 @@ NTSTATUS UnhookDriverObject(PDRIVER_HOOK_RECORD DriverRecord)
 	h = HashTableDelete(_driverTable, DriverRecord->DriverObject);
 	if (h != NULL) {
 		KeReleaseSpinLock(&_driverTableLock, irql);
+		DriverRecord->Unhooked = TRUE;
+		ShardedRefTableDeleteDereference(&_driverLookup, DriverRecord->DriverObject);
 		if (DriverRecord->MonitoringEnabled) {
 			_UnhookDriverObject(DriverRecord);
 			DriverRecord->MonitoringEnabled = FALSE;
 		}
 		
+		_DriverHookRecordReleaseProxies(DriverRecord);
+		ShardedRefTableClear(&DriverRecord->DeviceLookup);
 		KeAcquireSpinLock(&DriverRecord->SelectedDevicesLock, &irql);
 		HashTableClear(DriverRecord->SelectedDevices, TRUE);
 		KeReleaseSpinLock(&DriverRecord->SelectedDevicesLock, irql);
@@ -615,25 +769,50 @@ NTSTATUS UnhookDriverObject(PDRIVER_HOOK_RECORD DriverRecord)
 	return status;
 }
 
+/** Finds the hook record of a driver. Called for every request the hook handlers
+ *  see, hence the lookup takes no lock.
+ */
 PDRIVER_HOOK_RECORD DriverHookRecordGet(PDRIVER_OBJECT DriverObject)
 {
-	KIRQL irql;
-	PHASH_ITEM h = NULL;
 	PDRIVER_HOOK_RECORD ret = NULL;
 	DEBUG_ENTER_FUNCTION("DriverObject=0x%p", DriverObject);
 
-	KeAcquireSpinLock(&_driverTableLock, &irql);
+	if (!_shutdownInProgress)
+		ret = (PDRIVER_HOOK_RECORD)ShardedRefTableGet(&_driverLookup, DriverObject);
+
+	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	return ret;
+}
+
+/** Returns the device hook record stored in the extension of a proxy device
+ *  and the record of its driver, both referenced. NULL is returned when the
+ *  proxy has no record, the driver is being unhooked or the monitor is
+ *  shutting down; the caller then looks the records up in the tables.
+ */
+PDEVICE_HOOK_RECORD DeviceHookRecordGetByProxy(PDEVICE_OBJECT ProxyDevice, PDRIVER_HOOK_RECORD *DriverRecord)
+{
+	KIRQL irql;
+	PPROXY_DEVICE_EXTENSION ext = NULL;
+	PDEVICE_HOOK_RECORD ret = NULL;
+	DEBUG_ENTER_FUNCTION("ProxyDevice=0x%p; DriverRecord=0x%p", ProxyDevice, DriverRecord);
+
+	*DriverRecord = NULL;
+	ext = (PPROXY_DEVICE_EXTENSION)ProxyDevice->DeviceExtension;
+	// The record is referenced at DISPATCH_LEVEL, so whoever takes it from
+	// the extension waits for us before dropping the extension's reference.
+	KeRaiseIrql(DISPATCH_LEVEL, &irql);
 	if (!_shutdownInProgress) {
-		h = HashTableGet(_driverTable, DriverObject);
-		if (h != NULL) {
-			ret = CONTAINING_RECORD(h, DRIVER_HOOK_RECORD, HashItem);
-			DriverHookRecordReference(ret);
-		}
+		ret = ext->DeviceRecord;
+		if (ret != NULL && !ret->DriverRecord->Unhooked) {
+			DeviceHookRecordReference(ret);
+			*DriverRecord = ret->DriverRecord;
+			DriverHookRecordReference(*DriverRecord);
+		} else ret = NULL;
 	}
 
-	KeReleaseSpinLock(&_driverTableLock, irql);
+	KeLowerIrql(irql);
 
-	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	DEBUG_EXIT_FUNCTION("0x%p, *DriverRecord=0x%p", ret, *DriverRecord);
 	return ret;
 }
 
@@ -720,26 +899,35 @@ NTSTATUS DriverHookRecordAddDevice(PDRIVER_HOOK_RECORD DriverRecord, PDEVICE_OBJ
 		KeAcquireSpinLock(&DriverRecord->SelectedDevicesLock, &irql);
 		h = HashTableGet(DriverRecord->SelectedDevices, DeviceObject);
 		if (h == NULL) {
-			// For the hash table
-			DeviceHookRecordReference(newDeviceRecord);
-			HashTableInsert(DriverRecord->SelectedDevices, &newDeviceRecord->HashItem, DeviceObject);
-			KeReleaseSpinLock(&DriverRecord->SelectedDevicesLock, irql);
-			if (DriverRecord->DeviceExtensionHook)
-				status = ProxyDeviceCreate(DeviceObject, &newDeviceRecord->ProxyDevice);
-			
+			status = ShardedRefTableInsert(&DriverRecord->DeviceLookup, newDeviceRecord);
 			if (NT_SUCCESS(status)) {
-				_MakeDeviceHookRecordValid(newDeviceRecord);
-				// For the reference going out of this routine
+				// For the hash table
 				DeviceHookRecordReference(newDeviceRecord);
-				*DeviceRecord = newDeviceRecord;
-			}
-
-			if (!NT_SUCCESS(status)) {
-				KeAcquireSpinLock(&DriverRecord->SelectedDevicesLock, &irql);
-				HashTableDelete(DriverRecord->SelectedDevices, DeviceObject);
+				HashTableInsert(DriverRecord->SelectedDevices, &newDeviceRecord->HashItem, DeviceObject);
 				KeReleaseSpinLock(&DriverRecord->SelectedDevicesLock, irql);
-				DeviceHookRecordDereference(newDeviceRecord);
-			}
+				if (DriverRecord->DeviceExtensionHook)
+					status = _DeviceHookRecordProxyCreate(newDeviceRecord);
+			
+				if (NT_SUCCESS(status)) {
+					status = _MakeDeviceHookRecordValid(newDeviceRecord);
+					if (!NT_SUCCESS(status) && newDeviceRecord->ProxyDevice != NULL)
+						_DeviceHookRecordProxyDelete(newDeviceRecord);
+				}
+
+				if (NT_SUCCESS(status)) {
+					// For the reference going out of this routine
+					DeviceHookRecordReference(newDeviceRecord);
+					*DeviceRecord = newDeviceRecord;
+				}
+
+				if (!NT_SUCCESS(status)) {
+					KeAcquireSpinLock(&DriverRecord->SelectedDevicesLock, &irql);
+					HashTableDelete(DriverRecord->SelectedDevices, DeviceObject);
+					KeReleaseSpinLock(&DriverRecord->SelectedDevicesLock, irql);
+					ShardedRefTableDeleteDereference(&DriverRecord->DeviceLookup, DeviceObject);
+					DeviceHookRecordDereference(newDeviceRecord);
+				}
+			} else KeReleaseSpinLock(&DriverRecord->SelectedDevicesLock, irql);
 		} else {
 			PDEVICE_HOOK_RECORD existingDeviceRecord = NULL;
 
@@ -748,7 +936,13 @@ NTSTATUS DriverHookRecordAddDevice(PDRIVER_HOOK_RECORD DriverRecord, PDEVICE_OBJ
 			KeReleaseSpinLock(&DriverRecord->SelectedDevicesLock, irql);
 			if (existingDeviceRecord->CreateReason == edrcrDriverHooked) {
 				if (DriverRecord->DeviceExtensionHook)
-					status = ProxyDeviceCreate(DeviceObject, &existingDeviceRecord->ProxyDevice);
+					status = _DeviceHookRecordProxyCreate(existingDeviceRecord);
+
+				if (NT_SUCCESS(status)) {
+					status = _MakeDeviceHookRecordValid(existingDeviceRecord);
+					if (!NT_SUCCESS(status) && existingDeviceRecord->ProxyDevice != NULL)
+						_DeviceHookRecordProxyDelete(existingDeviceRecord);
+				}
 
 				if (NT_SUCCESS(status)) {
 					memset(existingDeviceRecord->IRPMonitorSettings, TRUE, (IRP_MJ_MAXIMUM_FUNCTION + 1) * sizeof(UCHAR));
@@ -761,7 +955,6 @@ NTSTATUS DriverHookRecordAddDevice(PDRIVER_HOOK_RECORD DriverRecord, PDEVICE_OBJ
 
 					existingDeviceRecord->CreateReason = edrcrUserRequest;
 					existingDeviceRecord->MonitoringEnabled = MonitoringEnabled;
-					_MakeDeviceHookRecordValid(existingDeviceRecord);
 					DeviceHookRecordReference(existingDeviceRecord);
 					*DeviceRecord = existingDeviceRecord;
 				}
@@ -795,10 +988,8 @@ NTSTATUS DriverHookRecordDeleteDevice(PDEVICE_HOOK_RECORD DeviceRecord)
 		DeviceHookRecordReference(deviceRecord);
 		KeReleaseSpinLock(&driverRecord->SelectedDevicesLock, irql);
 		if (deviceRecord->CreateReason == edrcrUserRequest) {
-			if (deviceRecord->ProxyDevice != NULL) {
-				ProxyDeviceDelete(deviceRecord->ProxyDevice);
-				deviceRecord->ProxyDevice = NULL;
-			}
+			if (deviceRecord->ProxyDevice != NULL)
+				_DeviceHookRecordProxyDelete(deviceRecord);
 
 			deviceRecord->CreateReason = edrcrDriverHooked;
 			deviceRecord->MonitoringEnabled = FALSE;
@@ -820,19 +1011,10 @@ NTSTATUS DriverHookRecordDeleteDevice(PDEVICE_HOOK_RECORD DeviceRecord)
 
 PDEVICE_HOOK_RECORD DriverHookRecordGetDevice(PDRIVER_HOOK_RECORD Record, PDEVICE_OBJECT DeviceObject)
 {
-	KIRQL irql;
-	PHASH_ITEM h = NULL;
 	PDEVICE_HOOK_RECORD ret = NULL;
 	DEBUG_ENTER_FUNCTION("Record=0x%p; DeviceObject=0x%p", Record, DeviceObject);
 
-	KeAcquireSpinLock(&Record->SelectedDevicesLock, &irql);
-	h = HashTableGet(Record->SelectedDevices, DeviceObject);
-	if (h != NULL) {
-		ret = CONTAINING_RECORD(h, DEVICE_HOOK_RECORD, HashItem);
-		DeviceHookRecordReference(ret);
-	}
-
-	KeReleaseSpinLock(&Record->SelectedDevicesLock, irql);
+	ret = (PDEVICE_HOOK_RECORD)ShardedRefTableGet(&Record->DeviceLookup, DeviceObject);
 
 	DEBUG_EXIT_FUNCTION("0x%p", ret);
 	return ret;
@@ -994,7 +1176,7 @@ BOOLEAN DeviceHookRecordValid(PDEVICE_HOOK_RECORD DeviceRecord)
 	DEBUG_ENTER_FUNCTION("DeviceRecord=0x%p", DeviceRecord);
 
 	KeAcquireSpinLock(&_deviceValidationTableLock, &irql);
-	ret = HashTableGet(_deviceValidationTable, DeviceRecord) != NULL;
+	ret = OpenHashTableGet(_deviceValidationTable, DeviceRecord) != NULL;
 	if (ret)
 		DeviceHookRecordReference(DeviceRecord);
 
@@ -1012,7 +1194,7 @@ BOOLEAN DriverHookRecordValid(PDRIVER_HOOK_RECORD DriverRecord)
 	DEBUG_ENTER_FUNCTION("DriverRecord=0x%p", DriverRecord);
 
 	KeAcquireSpinLock(&_driverValidationTableLock, &irql);
-	ret = HashTableGet(_driverValidationTable, DriverRecord) != NULL;
+	ret = OpenHashTableGet(_driverValidationTable, DriverRecord) != NULL;
 	if (ret)
 		DriverHookRecordReference(DriverRecord);
 
@@ -1043,19 +1225,25 @@ NTSTATUS HookModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPat
 	status = IoAcquireRemoveLock(&_rundownLock, DriverObject);
 	if (NT_SUCCESS(status)) {
 		KeInitializeSpinLock(&_driverValidationTableLock);
-		status = HashTableCreate(httNoSynchronization, 37, _HashFunction, _DriverValidationCompareFunction, NULL, &_driverValidationTable);
+		status = OpenHashTableCreate(httNoSynchronization, 37, _HashFunction, _ValidationCompareFunction, NULL, &_driverValidationTable);
 		if (NT_SUCCESS(status)) {
 			KeInitializeSpinLock(&_deviceValidationTableLock);
-			status = HashTableCreate(httNoSynchronization, 37, _HashFunction, _DeviceValidationCompareFunction, NULL, &_deviceValidationTable);
+			status = OpenHashTableCreate(httNoSynchronization, 37, _HashFunction, _ValidationCompareFunction, NULL, &_deviceValidationTable);
 			if (NT_SUCCESS(status)) {
 				KeInitializeSpinLock(&_driverTableLock);
-				status = HashTableCreate(httNoSynchronization, 37, _HashFunction, _DriverCompareFunction, _DriverFreeFunction, &_driverTable);
+				status = ShardedRefTableInit(FIELD_OFFSET(DRIVER_HOOK_RECORD, DriverObject), FIELD_OFFSET(DRIVER_HOOK_RECORD, NextRetired), _DriverLookupReference, _DriverLookupDereference, &_driverLookup);
+				if (NT_SUCCESS(status)) {
+					status = HashTableCreate(httNoSynchronization, 37, _HashFunction, _DriverCompareFunction, _DriverFreeFunction, &_driverTable);
+					if (!NT_SUCCESS(status))
+						ShardedRefTableFinit(&_driverLookup);
+				}
+
 				if (!NT_SUCCESS(status))
-					HashTableDestroy(_deviceValidationTable);
+					OpenHashTableDestroy(_deviceValidationTable);
 			}
 
 			if (!NT_SUCCESS(status))
-				HashTableDestroy(_driverValidationTable);
+				OpenHashTableDestroy(_driverValidationTable);
 		}
 
 		if (!NT_SUCCESS(status))
@@ -1080,10 +1268,12 @@ VOID HookModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath,
 	KeAcquireSpinLock(&_driverTableLock, &irql);
 	_shutdownInProgress = TRUE;
 	KeReleaseSpinLock(&_driverTableLock, irql);
-	HashTableDestroy(_deviceValidationTable);
-	HashTableDestroy(_driverValidationTable);
+	ShardedRefTableClear(&_driverLookup);
+	OpenHashTableDestroy(_deviceValidationTable);
+	OpenHashTableDestroy(_driverValidationTable);
 	HashTableDestroy(_driverTable);
 	IoReleaseRemoveLockAndWait(&_rundownLock, DriverObject);
+	ShardedRefTableFinit(&_driverLookup);
 
 	DEBUG_EXIT_FUNCTION_VOID();
 	return;
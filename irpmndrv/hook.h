@@ -4,6 +4,7 @@
 
 #include <ntifs.h>
 #include "hash_table.h"
+#include "sharded-ref-table.h"
 #include "kernel-shared.h"
 
 typedef VOID (VOID_FUNCTION)(VOID);
@@ -28,10 +29,6 @@ typedef struct _DEVICE_HOOK_RECORD {
 	/** Links the record to the hash table (stored in driver monitoring
 	    settings). */
 	HASH_ITEM HashItem;
-	/** Links the record to the hash table mapping record addresses to them.
-	    The table is used to validate whether a given address is an address
-		of any device hook record. */
-	HASH_ITEM ValidationHashItem;
 	/** Address of the hook record for the driver owning the device */
 	struct _DRIVER_HOOK_RECORD *DriverRecord;
 	/** Address of device's DEVICE_OBJECT structure. */
@@ -48,6 +45,11 @@ typedef struct _DEVICE_HOOK_RECORD {
 	EDeviceRecordCreateReason CreateReason;
 	/** Proxy device object used to hook via device extension */
 	PDEVICE_OBJECT ProxyDevice;
+	/** Links records whose proxy extension references are being released. */
+	struct _DEVICE_HOOK_RECORD *NextProxyRelease;
+	/** Used by the DeviceLookup table of the driver record once the record
+	    is deleted from it. */
+	PVOID NextRetired;
 } DEVICE_HOOK_RECORD, *PDEVICE_HOOK_RECORD;
 
 /** Contains information about a hook done on a given driver. */
@@ -57,10 +59,6 @@ typedef struct _DRIVER_HOOK_RECORD {
 	/** Stores the record in a hash table mapping addresses of DRIVER_OBJECT structures 
 	    to these records. */
 	HASH_ITEM HashItem;
-	/** Links the record to the hash table mapping record addresses to them.
-	    The table is used to validate whether a given address is an address
-		of any driver hook record. */
-	HASH_ITEM ValidationHashItem;
 	/** Address of the driver's DRIVER_OBJECT structure. */
 	PDRIVER_OBJECT DriverObject;
 	/** Driver name, for enumeration purposes mainly. */
@@ -101,10 +99,18 @@ typedef struct _DRIVER_HOOK_RECORD {
 	UCHAR FastIoSettings[FastIoMax];
 	/** Indicates whether the driver actively monitors incoming requests. */
 	BOOLEAN MonitoringEnabled;
+	/** Set when the driver is being unhooked. The hook handlers then ignore
+	    the device records stored in proxy device extensions. */
+	volatile BOOLEAN Unhooked;
 	/** Synchronizes access to the device table. */
 	KSPIN_LOCK SelectedDevicesLock;
 	/** Contains information about monitoring of individual devices. */
 	PHASH_TABLE SelectedDevices;
+	/** Maps device objects to the records in SelectedDevices without locking. Used
+	    by the hook handlers to find the device record for each request. */
+	SHARDED_REF_TABLE DeviceLookup;
+	/** Used by the driver lookup table once the record is deleted from it. */
+	PVOID NextRetired;
 } DRIVER_HOOK_RECORD, *PDRIVER_HOOK_RECORD;
 
 VOID DriverHookRecordReference(PDRIVER_HOOK_RECORD Record);
@@ -120,6 +126,7 @@ NTSTATUS DriverHookRecordSetInfo(PDRIVER_HOOK_RECORD Record, PDRIVER_MONITOR_SET
 VOID DriverHookRecordGetInfo(PDRIVER_HOOK_RECORD Record, PDRIVER_MONITOR_SETTINGS DriverSettings, PBOOLEAN Enabled);
 NTSTATUS DriverHookRecordEnable(PDRIVER_HOOK_RECORD Record, BOOLEAN Enable);
 PDRIVER_HOOK_RECORD DriverHookRecordGet(PDRIVER_OBJECT DriverObject);
+PDEVICE_HOOK_RECORD DeviceHookRecordGetByProxy(PDEVICE_OBJECT ProxyDevice, PDRIVER_HOOK_RECORD *DriverRecord);
 
 NTSTATUS DriverHookRecordAddDevice(PDRIVER_HOOK_RECORD Record, PDEVICE_OBJECT DeviceObject, PUCHAR IRPSettings, PUCHAR FastIoSettings, BOOLEAN MonitoringEanbled, PDEVICE_HOOK_RECORD *DeviceRecord);
 NTSTATUS DriverHookRecordDeleteDevice(PDEVICE_HOOK_RECORD DeviceRecord);
@@ -11,42 +11,18 @@
 /************************************************************************/
 
 
-static RTL_GENERIC_COMPARE_RESULTS _PsCompareRoutine(__in struct _RTL_GENERIC_TABLE *Table, __in PVOID FirstStruct, __in PVOID SecondStruct)
+static VOID _PsContextReference(_Inout_ PVOID Object)
 {
-	RTL_GENERIC_COMPARE_RESULTS ret = GenericEqual;
-	const PS_TABLE_ENTRY *a = (PPS_TABLE_ENTRY)FirstStruct;
-	const PS_TABLE_ENTRY *b = (PPS_TABLE_ENTRY)SecondStruct;
-	DEBUG_ENTER_FUNCTION("Table=0x%p; FirstStruct=0x%p; SecondScrut=0x%p", Table, FirstStruct, SecondStruct);
+	InterlockedIncrement(&((PPROCESS_OBJECT_CONTEXT)Object)->ReferenceCount);
 
-	if ((uintptr_t)a->ProcessId > (uintptr_t)b->ProcessId)
-		ret = GenericGreaterThan;
-	else if ((uintptr_t)a->ProcessId < (uintptr_t)b->ProcessId)
-		ret = GenericLessThan;
-
-	DEBUG_EXIT_FUNCTION("%u", ret);
-	return ret;
-}
-
-
-static PVOID _PsAllocRoutine(__in struct _RTL_GENERIC_TABLE  *Table, __in CLONG  ByteSize)
-{
-	PVOID ret = NULL;
-	DEBUG_ENTER_FUNCTION("Table=0x%p; ByteSize=%u", Table, ByteSize);
-
-	ret = HeapMemoryAllocNonPaged(ByteSize);
-
-	DEBUG_EXIT_FUNCTION("0x%p", ret);
-	return ret;
+	return;
 }
 
 
-static VOID _PsFreeRoutine(__in struct _RTL_GENERIC_TABLE *Table, __in PVOID  Buffer)
+static VOID _PsContextDereference(_Inout_ PVOID Object)
 {
-	DEBUG_ENTER_FUNCTION("Table=0x%p; Buffer=0x%p", Table, Buffer);
-
-	HeapMemoryFree(Buffer);
+	PsContextDereference((PPROCESS_OBJECT_CONTEXT)Object);
 
-	DEBUG_EXIT_FUNCTION_VOID();
 	return;
 }
 
@@ -56,31 +32,24 @@ static VOID _PsFreeRoutine(__in struct _RTL_GENERIC_TABLE *Table, __in PVOID  Bu
 /************************************************************************/
 
 
-void PsTableInit(PPS_CONTEXT_TABLE Table, PS_CONTEXT_FREE_ROUTINE *PsCFreeRoutine)
+NTSTATUS PsTableInit(PPS_CONTEXT_TABLE Table, PS_CONTEXT_FREE_ROUTINE *PsCFreeRoutine)
 {
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; PsCFreeRoutine=0x%p", Table, PsCFreeRoutine);
 
-	RtlInitializeGenericTable(&Table->Table, _PsCompareRoutine, _PsAllocRoutine, _PsFreeRoutine, NULL);
 	Table->PsCFreeRoutine = PsCFreeRoutine;
-	KeInitializeSpinLock(&Table->Lock);
+	status = ShardedRefTableInit(FIELD_OFFSET(PROCESS_OBJECT_CONTEXT, ProcessId), FIELD_OFFSET(PROCESS_OBJECT_CONTEXT, NextRetired), _PsContextReference, _PsContextDereference, &Table->Table);
 
-	DEBUG_EXIT_FUNCTION_VOID();
-	return;
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
 }
 
 
 void PsTableFinit(PPS_CONTEXT_TABLE Table)
 {
-	PPS_TABLE_ENTRY entry = NULL;
-	PPROCESS_OBJECT_CONTEXT psc = NULL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p", Table);
 
-	while (!RtlIsGenericTableEmpty(&Table->Table)) {
-		entry = RtlGetElementGenericTable(&Table->Table, 0);
-		psc = entry->PsContext;
-		RtlDeleteElementGenericTable(&Table->Table, entry);
-		PsContextDereference(psc);
-	}
+	ShardedRefTableFinit(&Table->Table);
 
 	DEBUG_EXIT_FUNCTION_VOID();
 	return;
@@ -89,10 +58,7 @@ void PsTableFinit(PPS_CONTEXT_TABLE Table)
 
 NTSTATUS PsTableInsert(PPS_CONTEXT_TABLE Table, HANDLE ProcessId, const void *Buffer, CLONG Length)
 {
-	KIRQL irql;
-	BOOLEAN inserted = FALSE;
 	PPROCESS_OBJECT_CONTEXT psc = NULL;
-	PS_TABLE_ENTRY entry;
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; ProcessId=0x%p; Buffer=0x%p; Length=%u", Table, ProcessId, Buffer, Length);
 
@@ -103,16 +69,12 @@ NTSTATUS PsTableInsert(PPS_CONTEXT_TABLE Table, HANDLE ProcessId, const void *Bu
 			InterlockedExchange(&psc->ReferenceCount, 1);
 			psc->FreeRoutine = Table->PsCFreeRoutine;
 			psc->DataSize = Length;
+			psc->ProcessId = ProcessId;
 			memcpy(psc + 1, Buffer, Length);
-			entry.ProcessId = ProcessId;
-			entry.PsContext = psc;
-			KeAcquireSpinLock(&Table->Lock, &irql);
-			RtlInsertElementGenericTable(&Table->Table, &entry, sizeof(entry), &inserted);
-			status = (inserted) ? STATUS_SUCCESS : STATUS_ALREADY_REGISTERED;
-			if (NT_SUCCESS(status))
-				InterlockedIncrement(&psc->ReferenceCount);
-
-			KeReleaseSpinLock(&Table->Lock, irql);
+			status = ShardedRefTableInsert(&Table->Table, psc);
+			if (status == STATUS_OBJECT_NAME_COLLISION)
+				status = STATUS_ALREADY_REGISTERED;
+
 			PsContextDereference(psc);
 		} else status = STATUS_INSUFFICIENT_RESOURCES;
 	} else status = STATUS_INVALID_PARAMETER;
@@ -124,22 +86,10 @@ NTSTATUS PsTableInsert(PPS_CONTEXT_TABLE Table, HANDLE ProcessId, const void *Bu
 
 PPROCESS_OBJECT_CONTEXT PsTableDelete(PPS_CONTEXT_TABLE Table, HANDLE ProcessId)
 {
-	KIRQL irql;
-	PS_TABLE_ENTRY entry;
-	PPS_TABLE_ENTRY entry2 = NULL;
 	PPROCESS_OBJECT_CONTEXT ret = NULL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; ProcessId=0x%p", Table, ProcessId);
 
-	entry.ProcessId = ProcessId;
-	KeAcquireSpinLock(&Table->Lock, &irql);
-	entry2 = RtlLookupElementGenericTable(&Table->Table, &entry);
-	if (entry2 != NULL) {
-		ret = entry2->PsContext;
-		if (!RtlDeleteElementGenericTable(&Table->Table, &entry))
-			__debugbreak();
-	}
-
-	KeReleaseSpinLock(&Table->Lock, irql);
+	ret = (PPROCESS_OBJECT_CONTEXT)ShardedRefTableDelete(&Table->Table, ProcessId);
 
 	DEBUG_EXIT_FUNCTION("0x%p", ret);
 	return ret;
@@ -162,21 +112,10 @@ void PsTableDeleteNoReturn(PPS_CONTEXT_TABLE Table, HANDLE ProcessId)
 
 PPROCESS_OBJECT_CONTEXT PsTableGet(PPS_CONTEXT_TABLE Table, HANDLE ProcessId)
 {
-	KIRQL irql;
-	PS_TABLE_ENTRY entry;
-	PPS_TABLE_ENTRY entry2 = NULL;
 	PPROCESS_OBJECT_CONTEXT ret = NULL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; ProcessId=0x%p", Table, ProcessId);
 
-	entry.ProcessId = ProcessId;
-	KeAcquireSpinLock(&Table->Lock, &irql);
-	entry2 = RtlLookupElementGenericTable(&Table->Table, &entry);
-	if (entry2 != NULL) {
-		ret = entry2->PsContext;
-		InterlockedIncrement(&ret->ReferenceCount);
-	}
-
-	KeReleaseSpinLock(&Table->Lock, irql);
+	ret = (PPROCESS_OBJECT_CONTEXT)ShardedRefTableGet(&Table->Table, ProcessId);
 
 	DEBUG_EXIT_FUNCTION("0x%p", ret);
 	return ret;
@@ -185,35 +124,10 @@ PPROCESS_OBJECT_CONTEXT PsTableGet(PPS_CONTEXT_TABLE Table, HANDLE ProcessId)
 
 NTSTATUS PsTableEnum(PPS_CONTEXT_TABLE Table, PPROCESS_OBJECT_CONTEXT **PsContexts, PULONG Count)
 {
-	KIRQL irql;
-	ULONG elemCount = 0;
-	PPS_TABLE_ENTRY entry = NULL;
-	PPROCESS_OBJECT_CONTEXT psc = NULL;
-	PPROCESS_OBJECT_CONTEXT *tmpContexts = NULL;
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("Table=0x%p; PsContexts=0x%p; Count=0x%p", Table, PsContexts, Count);
 
-	*Count = 0;
-	*PsContexts = NULL;
-	status = STATUS_SUCCESS;
-	KeAcquireSpinLock(&Table->Lock, &irql);
-	if (!RtlIsGenericTableEmpty(&Table->Table)) {
-		elemCount = RtlNumberGenericTableElements(&Table->Table);
-		tmpContexts = HeapMemoryAllocNonPaged(elemCount*sizeof(PPROCESS_OBJECT_CONTEXT));
-		if (tmpContexts != NULL) {
-			for (ULONG i = 0; i < elemCount; ++i) {
-				entry = RtlGetElementGenericTable(&Table->Table, i);
-				psc = entry->PsContext;
-				InterlockedIncrement(&psc->ReferenceCount);
-				tmpContexts[i] = psc;
-			}
-
-			*PsContexts = tmpContexts;
-			*Count = elemCount;
-		} else status = STATUS_INSUFFICIENT_RESOURCES;
-	}
-
-	KeReleaseSpinLock(&Table->Lock, irql);
+	status = ShardedRefTableEnum(&Table->Table, (PVOID **)PsContexts, Count);
 
 	DEBUG_EXIT_FUNCTION("0x%x, *PsContects=0x%p, *Count=%u", status, *PsContexts, *Count);
 	return status;
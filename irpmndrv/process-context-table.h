@@ -4,6 +4,7 @@
 
 
 #include <ntifs.h>
+#include "sharded-ref-table.h"
 
 
 typedef void (PS_CONTEXT_FREE_ROUTINE)(void *PsContext);
@@ -12,17 +13,15 @@ typedef struct _PROCESS_OBJECT_CONTEXT {
 	volatile LONG ReferenceCount;
 	CLONG DataSize;
 	PS_CONTEXT_FREE_ROUTINE *FreeRoutine;
+	/** Key of the context in the table. */
+	HANDLE ProcessId;
+	/** Used by the table to link deleted contexts. */
+	PVOID NextRetired;
 	// Data
 } PROCESS_OBJECT_CONTEXT, *PPROCESS_OBJECT_CONTEXT;
 
-typedef struct _PS_TABLE_ENTRY {
-	HANDLE ProcessId;
-	PPROCESS_OBJECT_CONTEXT PsContext;
-} PS_TABLE_ENTRY, *PPS_TABLE_ENTRY;
-
 typedef struct _PS_CONTEXT_TABLE {
-	RTL_GENERIC_TABLE Table;
-	KSPIN_LOCK Lock;
+	SHARDED_REF_TABLE Table;
 	PS_CONTEXT_FREE_ROUTINE *PsCFreeRoutine;
 } PS_CONTEXT_TABLE, *PPS_CONTEXT_TABLE;
 
@@ -31,7 +30,7 @@ typedef struct _PS_CONTEXT_TABLE {
 #define PS_CONTEXT_TO_DATA(aPSC)	(aPSC + 1)
 
 
-void PsTableInit(PPS_CONTEXT_TABLE Table, PS_CONTEXT_FREE_ROUTINE *FOCFreeRoutine);
+NTSTATUS PsTableInit(PPS_CONTEXT_TABLE Table, PS_CONTEXT_FREE_ROUTINE *FOCFreeRoutine);
 void PsTableFinit(PPS_CONTEXT_TABLE Table);
 NTSTATUS PsTableInsert(PPS_CONTEXT_TABLE Table, HANDLE ProcessId, const void *Buffer, CLONG Length);
 PPROCESS_OBJECT_CONTEXT PsTableDelete(PPS_CONTEXT_TABLE Table, HANDLE ProcessId);
@@ -165,6 +165,7 @@ static void _ProcessNotifyEx(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOT
 		}
 
 		PsTableDeleteNoReturn(&_processTable, ProcessId);
+		RequestQueueProcessExitted(Process);
 	}
 
 	DEBUG_EXIT_FUNCTION_VOID();
@@ -292,20 +293,25 @@ NTSTATUS ProcessEventsModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING Re
 	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
 
 	_driverSettings = DriverSettingsGet();
-	PsTableInit(&_processTable, _PsRecordFree);
-	vi.dwOSVersionInfoSize = sizeof(vi);
-	status = RtlGetVersion(&vi);
+	status = PsTableInit(&_processTable, _PsRecordFree);
 	if (NT_SUCCESS(status)) {
-		status = _FillProcessTable();
+		vi.dwOSVersionInfoSize = sizeof(vi);
+		status = RtlGetVersion(&vi);
 		if (NT_SUCCESS(status)) {
-			if (vi.dwBuildNumber >= 6001) {
-				RtlInitUnicodeString(&uRoutineName, L"PsSetCreateProcessNotifyRoutineEx");
-				_PsSetCreateProcessNotifyROutineEx = (PSSETCREATEPROCESSNOTIFYROUTINEEX *)MmGetSystemRoutineAddress(&uRoutineName);
-				if (_PsSetCreateProcessNotifyROutineEx != NULL)
-					status = _PsSetCreateProcessNotifyROutineEx(_ProcessNotifyEx, FALSE);
-				else status = STATUS_NOT_FOUND;
+			status = _FillProcessTable();
+			if (NT_SUCCESS(status)) {
+				if (vi.dwBuildNumber >= 6001) {
+					RtlInitUnicodeString(&uRoutineName, L"PsSetCreateProcessNotifyRoutineEx");
+					_PsSetCreateProcessNotifyROutineEx = (PSSETCREATEPROCESSNOTIFYROUTINEEX *)MmGetSystemRoutineAddress(&uRoutineName);
+					if (_PsSetCreateProcessNotifyROutineEx != NULL)
+						status = _PsSetCreateProcessNotifyROutineEx(_ProcessNotifyEx, FALSE);
+					else status = STATUS_NOT_FOUND;
+				}
 			}
 		}
+
+		if (!NT_SUCCESS(status))
+			PsTableFinit(&_processTable);
 	}
 
 	DEBUG_EXIT_FUNCTION("0x%x", status);
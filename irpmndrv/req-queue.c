@@ -4,6 +4,9 @@
 #include "allocator.h"
 #include "utils.h"
 #include "request.h"
+#include "event-ring.h"
+#include "queue-policy.h"
+#include "request-filter.h"
 #include "process-events.h"
 #include "driver-settings.h"
 #include "req-queue.h"
@@ -12,119 +15,505 @@
 #define DEBUG_TRACE_ENABLED 0
 
 
+/************************************************************************/
+/*                            TYPE DEFINITIONS                          */
+/************************************************************************/
+
+/** Per-processor part of the Event Queue.
+ *
+ *  Producers push new requests to the @Pushed list without acquiring
+ *  any lock. The consumer moves them to the @Pending list, ordered by
+ *  the request ID, when it drains the queue. The @Pending list is accessed
+ *  only while holding the consumer lock.
+ */
+typedef struct DECLSPEC_CACHEALIGN _REQUEST_QUEUE_CPU {
+	/** Lock-free LIFO of newly inserted requests. */
+	SLIST_HEADER Pushed;
+	/** Requests already collected by the consumer, sorted by their IDs. */
+	LIST_ENTRY Pending;
+} REQUEST_QUEUE_CPU, *PREQUEST_QUEUE_CPU;
+
+/** Shared ring used instead of the Event Queue when the consumer
+ *  connects with IOCTL_IRPMNDRV_CONNECT_INPUT.
+ */
+typedef struct _REQUEST_QUEUE_RING {
+	/** Producer's view of the ring. */
+	EVENT_RING Ring;
+	/** Describes physical pages backing the ring. */
+	PMDL Mdl;
+	/** Length of the mapped memory. */
+	ULONG Length;
+	/** Address of the ring within the system address space. */
+	PVOID SystemAddress;
+	/** Address of the ring within the consumer's address space. */
+	PVOID UserAddress;
+	/** The consumer process. Only this process can disconnect the ring,
+	 *  and the ring is disconnected when the process exits. */
+	PEPROCESS Process;
+	/** Signalled when the consumer waits and the watermark is reached. */
+	PKEVENT Event;
+} REQUEST_QUEUE_RING, *PREQUEST_QUEUE_RING;
+
+/** Filter of new requests set by the consumer. Producers hold a reference
+ *  while they evaluate it, so it can be replaced at any time. The filter
+ *  follows the structure.
+ */
+typedef struct _REQUEST_QUEUE_FILTER {
+	volatile LONG ReferenceCount;
+	ULONG Size;
+} REQUEST_QUEUE_FILTER, *PREQUEST_QUEUE_FILTER;
+
+#define REQUEST_QUEUE_FILTER_DATA(aFilter)		((PREQUEST_FILTER_HEADER)((aFilter) + 1))
+
 /************************************************************************/
 /*                            GLOBAL VARIABLES                          */
 /************************************************************************/
 
-static KSPIN_LOCK _npagedRequestListLock;
-static LIST_ENTRY _npagedRequestListHead;
-static ERESOURCE _pagedRequestListLock;
-static LIST_ENTRY _pagedRequestListHead;
+static PREQUEST_QUEUE_CPU _cpuQueues = NULL;
+static ULONG _cpuQueueCount = 0;
+static ERESOURCE _consumerLock;
 static IO_REMOVE_LOCK _removeLock;
 static ERESOURCE _connectLock;
 static PIRPMNDRV_SETTINGS _driverSettings = NULL;
+static PREQUEST_QUEUE_RING _ring = NULL;
+/** Data area of the connected ring. Tells whether a ring is connected
+ *  without taking the connect lock. */
+static PUCHAR volatile _ringData = NULL;
+static volatile LONG _sampleCounter = 0;
+static PIO_WORKITEM _trimWorkItem = NULL;
+static volatile LONG _trimScheduled = 0;
+/** Drops not yet reported by an ertEventsDropped record. */
+static volatile LONG _dropsPending[REQUEST_TYPE_COUNT];
+static volatile LONG _dropsPendingFlag = 0;
+/** Drops not yet reported in a REQUEST_BATCH_HEADER. */
+static volatile LONG _dropsSinceBatch = 0;
+static PREQUEST_QUEUE_FILTER _filter = NULL;
+static KSPIN_LOCK _filterLock;
 
 /************************************************************************/
 /*                             HELPER FUNCTIONS                         */
 /************************************************************************/
 
 
-static void _RequestInsert(PREQUEST_HEADER Header, BOOLEAN Head)
+static void _RequestInsert(PREQUEST_HEADER Header)
 {
-	KIRQL irql = HIGH_LEVEL;
-	PLIST_ENTRY listHead = NULL;
-	DEBUG_ENTER_FUNCTION("Header=0x%p; Head=%u", Header, Head);
+	ULONG cpuIndex = 0;
+	SIZE_T reqSize = 0;
+	DEBUG_ENTER_FUNCTION("Header=0x%p", Header);
 
+	// The request cache hands out blocks aligned to MEMORY_ALLOCATION_ALIGNMENT,
+	// so the Entry member is aligned enough to serve as a SLIST_ENTRY.
+	ASSERT(((ULONG_PTR)&Header->Entry % MEMORY_ALLOCATION_ALIGNMENT) == 0);
+	cpuIndex = KeGetCurrentProcessorNumberEx(NULL) % _cpuQueueCount;
 	if (Header->Flags & REQUEST_FLAG_PAGED) {
 		ASSERT(KeGetCurrentIrql() < DISPATCH_LEVEL);
-		listHead = &_pagedRequestListHead;
-		KeEnterCriticalRegion();
-		ExAcquireResourceExclusiveLite(&_pagedRequestListLock, TRUE);
-	} else if (Header->Flags & REQUEST_FLAG_NONPAGED) {
-		listHead = &_npagedRequestListHead;
-		KeAcquireSpinLock(&_npagedRequestListLock, &irql);
-	} else __debugbreak();
-
-	if (Head)
-		InsertHeadList(listHead, &Header->Entry);
-	else InsertTailList(listHead, &Header->Entry);
-
-	if (Header->Flags & REQUEST_FLAG_PAGED) {
-		ExReleaseResourceLite(&_pagedRequestListLock);
-		KeLeaveCriticalRegion();
 		InterlockedIncrement(&_driverSettings->ReqQueuePagedLength);
 	} else if (Header->Flags & REQUEST_FLAG_NONPAGED) {
-		KeReleaseSpinLock(&_npagedRequestListLock, irql);
 		InterlockedIncrement(&_driverSettings->ReqQueueNonPagedLength);
 	} else __debugbreak();
 
+	reqSize = RequestGetSize(Header);
+	InterlockedExchangeAdd(&_driverSettings->ReqQueueSize, (LONG)reqSize);
 	InterlockedIncrement(&_driverSettings->ReqQueueLength);
+	InterlockedPushEntrySList(&_cpuQueues[cpuIndex].Pushed, (PSLIST_ENTRY)&Header->Entry);
 
 	DEBUG_EXIT_FUNCTION_VOID();
 	return;
 }
 
 
-static PREQUEST_HEADER _RequestRemove(PBOOLEAN NextAvailable)
+static void _PendingInsert(PLIST_ENTRY Pending, PREQUEST_HEADER Header)
 {
-	KIRQL irql;
-	ULONG pagedId = 0;
-	ULONG nonpagedId = 0;
-	PREQUEST_HEADER pagedRequest = NULL;
-	PREQUEST_HEADER npagedRequest = NULL;
-	PREQUEST_HEADER ret = NULL;
-	DEBUG_ENTER_FUNCTION("NextAvailable=0x%p", NextAvailable);
+	PLIST_ENTRY prev = NULL;
 
-	*NextAvailable = FALSE;
-	KeEnterCriticalRegion();
-	ExAcquireResourceExclusiveLite(&_pagedRequestListLock, TRUE);
-	if (!IsListEmpty(&_pagedRequestListHead)) {
-		pagedRequest = CONTAINING_RECORD(_pagedRequestListHead.Flink, REQUEST_HEADER, Entry);
-		pagedId = pagedRequest->Id;
+	// Requests come mostly in order, so the search from the tail
+	// usually stops at the first step.
+	prev = Pending->Blink;
+	while (prev != Pending && CONTAINING_RECORD(prev, REQUEST_HEADER, Entry)->Id > Header->Id)
+		prev = prev->Blink;
+
+	InsertHeadList(prev, &Header->Entry);
+
+	return;
+}
+
+
+static void _QueueCollect(PREQUEST_QUEUE_CPU Queue)
+{
+	PSLIST_ENTRY e = NULL;
+	PSLIST_ENTRY next = NULL;
+	PSLIST_ENTRY reversed = NULL;
+
+	if (ExQueryDepthSList(&Queue->Pushed) > 0) {
+		e = InterlockedFlushSList(&Queue->Pushed);
+		while (e != NULL) {
+			next = e->Next;
+			e->Next = reversed;
+			reversed = e;
+			e = next;
+		}
+
+		while (reversed != NULL) {
+			next = reversed->Next;
+			_PendingInsert(&Queue->Pending, CONTAINING_RECORD(reversed, REQUEST_HEADER, Entry));
+			reversed = next;
+		}
 	}
 
-	KeAcquireSpinLock(&_npagedRequestListLock, &irql);
-	if (!IsListEmpty(&_npagedRequestListHead)) {
-		npagedRequest = CONTAINING_RECORD(_npagedRequestListHead.Flink, REQUEST_HEADER, Entry);
-		nonpagedId = npagedRequest->Id;
-		if (pagedRequest == NULL || nonpagedId < pagedId) {
-			ret = npagedRequest;
-			RemoveEntryList(&ret->Entry);
-			InterlockedDecrement(&_driverSettings->ReqQueueNonPagedLength);
+	return;
+}
+
+
+static PREQUEST_HEADER _RequestPeek(BOOLEAN Collect)
+{
+	PREQUEST_HEADER tmp = NULL;
+	PREQUEST_HEADER ret = NULL;
+	PREQUEST_QUEUE_CPU q = NULL;
+	DEBUG_ENTER_FUNCTION("Collect=%u", Collect);
+
+	q = _cpuQueues;
+	for (ULONG i = 0; i < _cpuQueueCount; ++i) {
+		if (Collect)
+			_QueueCollect(q);
+
+		if (!IsListEmpty(&q->Pending)) {
+			tmp = CONTAINING_RECORD(q->Pending.Flink, REQUEST_HEADER, Entry);
+			if (ret == NULL || tmp->Id < ret->Id)
+				ret = tmp;
 		}
+
+		++q;
 	}
 
-	KeReleaseSpinLock(&_npagedRequestListLock, irql);
-	if (ret == NULL && pagedRequest != NULL) {
-		ret = pagedRequest;
-		RemoveEntryList(&ret->Entry);
+	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	return ret;
+}
+
+
+static void _RequestRemove(PREQUEST_HEADER Header, PBOOLEAN NextAvailable)
+{
+	SIZE_T reqSize = 0;
+	DEBUG_ENTER_FUNCTION("Header=0x%p; NextAvailable=0x%p", Header, NextAvailable);
+
+	RemoveEntryList(&Header->Entry);
+	reqSize = RequestGetSize(Header);
+	InterlockedExchangeAdd(&_driverSettings->ReqQueueSize, -(LONG)reqSize);
+	if (Header->Flags & REQUEST_FLAG_PAGED)
 		InterlockedDecrement(&_driverSettings->ReqQueuePagedLength);
+	else if (Header->Flags & REQUEST_FLAG_NONPAGED)
+		InterlockedDecrement(&_driverSettings->ReqQueueNonPagedLength);
+
+	*NextAvailable = (InterlockedDecrement(&_driverSettings->ReqQueueLength) > 0);
+
+	DEBUG_EXIT_FUNCTION("void, *NextAvailable=%u", *NextAvailable);
+	return;
+}
+
+
+static void _RequestDropped(ERequesttype Type)
+{
+	ULONG index = 0;
+
+	index = ((ULONG)Type < REQUEST_TYPE_COUNT) ? (ULONG)Type : erpUndefined;
+	InterlockedIncrement(&_driverSettings->ReqQueueDroppedCount);
+	InterlockedIncrement(&_driverSettings->ReqQueueDroppedByType[index]);
+	InterlockedIncrement(&_dropsSinceBatch);
+	InterlockedIncrement(&_dropsPending[index]);
+	InterlockedExchange(&_dropsPendingFlag, 1);
+
+	return;
+}
+
+
+static void _DropRecordReturn(const REQUEST_EVENTS_DROPPED *Record)
+{
+	for (ULONG i = 0; i < REQUEST_TYPE_COUNT; ++i) {
+		if (Record->DroppedByType[i] > 0)
+			InterlockedExchangeAdd(&_dropsPending[i], Record->DroppedByType[i]);
 	}
 
-	ExReleaseResourceLite(&_pagedRequestListLock);
-	KeLeaveCriticalRegion();
+	InterlockedExchange(&_dropsPendingFlag, 1);
+
+	return;
+}
+
+
+/** Creates an ertEventsDropped record describing drops not reported yet.
+ *  Every drop is reported exactly once; when the record cannot be created,
+ *  the drops stay pending.
+ */
+static PREQUEST_HEADER _DropRecordCreate(void)
+{
+	PREQUEST_EVENTS_DROPPED ret = NULL;
+	DEBUG_ENTER_FUNCTION_NO_ARGS();
+
+	ret = (PREQUEST_EVENTS_DROPPED)RequestMemoryAlloc(sizeof(REQUEST_EVENTS_DROPPED));
 	if (ret != NULL) {
-		InterlockedDecrement(&_driverSettings->ReqQueueLength);
-		*NextAvailable = (!IsListEmpty(&_pagedRequestListHead) || !IsListEmpty(&_npagedRequestListHead));
+		RequestHeaderInitNoId(&ret->Header, NULL, NULL, ertEventsDropped);
+		InterlockedExchange(&_dropsPendingFlag, 0);
+		ret->DroppedCount = 0;
+		for (ULONG i = 0; i < REQUEST_TYPE_COUNT; ++i) {
+			ret->DroppedByType[i] = InterlockedExchange(&_dropsPending[i], 0);
+			ret->DroppedCount += ret->DroppedByType[i];
+		}
+
+		if (ret->DroppedCount == 0) {
+			RequestMemoryFree(&ret->Header);
+			ret = NULL;
+		}
+	}
+
+	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	return (PREQUEST_HEADER)ret;
+}
+
+
+static void _RingDestroy(PREQUEST_QUEUE_RING Ring)
+{
+	KAPC_STATE apcState;
+	DEBUG_ENTER_FUNCTION("Ring=0x%p", Ring);
+	DEBUG_IRQL_LESS_OR_EQUAL(APC_LEVEL);
+
+	if (Ring->UserAddress != NULL) {
+		// The user view must be removed within the process it was created
+		// for. Disconnect requests of other processes are refused, so only
+		// the driver unload gets here from a different process.
+		if (Ring->Process != PsGetCurrentProcess()) {
+			KeStackAttachProcess(Ring->Process, &apcState);
+			MmUnmapLockedPages(Ring->UserAddress, Ring->Mdl);
+			KeUnstackDetachProcess(&apcState);
+		} else MmUnmapLockedPages(Ring->UserAddress, Ring->Mdl);
+	}
+
+	if (Ring->SystemAddress != NULL)
+		MmUnmapLockedPages(Ring->SystemAddress, Ring->Mdl);
+
+	if (Ring->Mdl != NULL) {
+		MmFreePagesFromMdl(Ring->Mdl);
+		ExFreePool(Ring->Mdl);
+	}
+
+	if (Ring->Event != NULL)
+		ObDereferenceObject(Ring->Event);
+
+	if (Ring->Process != NULL)
+		ObDereferenceObject(Ring->Process);
+
+	HeapMemoryFree(Ring);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+static NTSTATUS _RingCreate(ULONG DataSize, ULONG Watermark, HANDLE EventHandle, KPROCESSOR_MODE AccessMode, PREQUEST_QUEUE_RING *Ring)
+{
+	PHYSICAL_ADDRESS lowAddress;
+	PHYSICAL_ADDRESS highAddress;
+	PHYSICAL_ADDRESS skipBytes;
+	PREQUEST_QUEUE_RING tmpRing = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("DataSize=%u; Watermark=%u; EventHandle=0x%p; AccessMode=%u; Ring=0x%p", DataSize, Watermark, EventHandle, AccessMode, Ring);
+	DEBUG_IRQL_LESS_OR_EQUAL(PASSIVE_LEVEL);
+
+	tmpRing = (PREQUEST_QUEUE_RING)HeapMemoryAllocNonPaged(sizeof(REQUEST_QUEUE_RING));
+	if (tmpRing != NULL) {
+		memset(tmpRing, 0, sizeof(REQUEST_QUEUE_RING));
+		tmpRing->Length = EventRingMemorySize(DataSize);
+		status = (tmpRing->Length > 0) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+		if (NT_SUCCESS(status))
+			status = ObReferenceObjectByHandle(EventHandle, EVENT_MODIFY_STATE, *ExEventObjectType, AccessMode, (PVOID *)&tmpRing->Event, NULL);
+
+		if (NT_SUCCESS(status)) {
+			// Whole pages are allocated for the ring, so no other data
+			// become visible to the consumer. The pages come zeroed.
+			lowAddress.QuadPart = 0;
+			highAddress.QuadPart = (LONGLONG)-1;
+			skipBytes.QuadPart = 0;
+			tmpRing->Mdl = MmAllocatePagesForMdlEx(lowAddress, highAddress, skipBytes, tmpRing->Length, MmCached, MM_ALLOCATE_FULLY_REQUIRED);
+			if (tmpRing->Mdl == NULL)
+				status = STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		if (NT_SUCCESS(status)) {
+			tmpRing->SystemAddress = MmGetSystemAddressForMdlSafe(tmpRing->Mdl, NormalPagePriority | MdlMappingNoExecute);
+			if (tmpRing->SystemAddress == NULL)
+				status = STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		if (NT_SUCCESS(status)) {
+			if (!EventRingFormat(&tmpRing->Ring, tmpRing->SystemAddress, tmpRing->Length, Watermark))
+				status = STATUS_INVALID_PARAMETER;
+		}
+
+		if (NT_SUCCESS(status)) {
+			__try {
+				tmpRing->UserAddress = MmMapLockedPagesSpecifyCache(tmpRing->Mdl, UserMode, MmCached, NULL, FALSE, NormalPagePriority | MdlMappingNoExecute);
+				if (tmpRing->UserAddress == NULL)
+					status = STATUS_INSUFFICIENT_RESOURCES;
+			} __except (EXCEPTION_EXECUTE_HANDLER) {
+				status = GetExceptionCode();
+			}
+		}
+
+		if (NT_SUCCESS(status)) {
+			tmpRing->Process = PsGetCurrentProcess();
+			ObReferenceObject(tmpRing->Process);
+			*Ring = tmpRing;
+		}
+
+		if (!NT_SUCCESS(status))
+			_RingDestroy(tmpRing);
+	} else status = STATUS_INSUFFICIENT_RESOURCES;
+
+	DEBUG_EXIT_FUNCTION("0x%x, *Ring=0x%p", status, *Ring);
+	return status;
+}
+
+
+static BOOLEAN _RequestDeliver(PREQUEST_HEADER Header)
+{
+	BOOLEAN notify = FALSE;
+	BOOLEAN ret = FALSE;
+	DEBUG_ENTER_FUNCTION("Header=0x%p", Header);
+
+	if (_ring != NULL) {
+		Header->Entry.Flink = NULL;
+		Header->Entry.Blink = NULL;
+		ret = EventRingWrite(&_ring->Ring, Header, (ULONG)RequestGetSize(Header), &notify);
+		if (ret && notify)
+			KeSetEvent(_ring->Event, IO_NO_INCREMENT, FALSE);
+
+		if (!ret) {
+			if (Header->Type == ertEventsDropped)
+				_DropRecordReturn(CONTAINING_RECORD(Header, REQUEST_EVENTS_DROPPED, Header));
+			else _RequestDropped(Header->Type);
+		}
+
+		RequestMemoryFree(Header);
+	} else {
+		_RequestInsert(Header);
+		ret = TRUE;
 	}
 
-	DEBUG_EXIT_FUNCTION("0x%p, *NextAvailable=%u", ret, *NextAvailable);
+	DEBUG_EXIT_FUNCTION("%u", ret);
 	return ret;
 }
 
 
-/************************************************************************/
-/*                            PUBLIC ROUTINES                           */
-/************************************************************************/
+static PREQUEST_QUEUE_FILTER _FilterReference(void)
+{
+	KIRQL irql;
+	PREQUEST_QUEUE_FILTER ret = NULL;
+
+	KeAcquireSpinLock(&_filterLock, &irql);
+	ret = _filter;
+	if (ret != NULL)
+		InterlockedIncrement(&ret->ReferenceCount);
+
+	KeReleaseSpinLock(&_filterLock, irql);
+
+	return ret;
+}
+
+
+static void _FilterDereference(PREQUEST_QUEUE_FILTER Filter)
+{
+	if (InterlockedDecrement(&Filter->ReferenceCount) == 0)
+		HeapMemoryFree(Filter);
+
+	return;
+}
+
+
+static void _FilterReplace(PREQUEST_QUEUE_FILTER Filter)
+{
+	KIRQL irql;
+	PREQUEST_QUEUE_FILTER old = NULL;
+
+	KeAcquireSpinLock(&_filterLock, &irql);
+	old = _filter;
+	_filter = Filter;
+	KeReleaseSpinLock(&_filterLock, irql);
+	if (old != NULL)
+		_FilterDereference(old);
+
+	return;
+}
+
+
+/** Decides whether a new request passes the filter set by the consumer. */
+static BOOLEAN _RequestFilterPass(const REQUEST_HEADER *Header)
+{
+	PREQUEST_QUEUE_FILTER f = NULL;
+	BOOLEAN ret = TRUE;
+
+	// Most of the time there is no filter, do not touch the lock then.
+	if (_filter != NULL) {
+		f = _FilterReference();
+		if (f != NULL) {
+			ret = RequestFilterMatch(REQUEST_QUEUE_FILTER_DATA(f), Header, NULL, NULL);
+			_FilterDereference(f);
+		}
+	}
+
+	return ret;
+}
+
+
+static void _DropRecordDeliver(void)
+{
+	PREQUEST_HEADER h = NULL;
+
+	h = _DropRecordCreate();
+	if (h != NULL) {
+		h->Id = InterlockedIncrement(&_driverSettings->ReqQueueLastRequestId);
+		_RequestDeliver(h);
+	}
+
+	return;
+}
+
+
+static void _TrimRoutine(PVOID IoObject, PVOID Context, PIO_WORKITEM WorkItem)
+{
+	BOOLEAN dummy = FALSE;
+	PREQUEST_HEADER h = NULL;
+	DEBUG_ENTER_FUNCTION("IoObject=0x%p; Context=0x%p; WorkItem=0x%p", IoObject, Context, WorkItem);
+
+	UNREFERENCED_PARAMETER(IoObject);
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(WorkItem);
+
+	KeEnterCriticalRegion();
+	ExAcquireResourceExclusiveLite(&_consumerLock, TRUE);
+	h = _RequestPeek(TRUE);
+	while (h != NULL && QueuePolicyOverLimit(_driverSettings, _driverSettings->ReqQueueLength, _driverSettings->ReqQueueSize)) {
+		_RequestRemove(h, &dummy);
+		if (h->Type == ertEventsDropped)
+			_DropRecordReturn(CONTAINING_RECORD(h, REQUEST_EVENTS_DROPPED, Header));
+		else _RequestDropped(h->Type);
+
+		RequestMemoryFree(h);
+		h = _RequestPeek(FALSE);
+	}
+
+	ExReleaseResourceLite(&_consumerLock);
+	KeLeaveCriticalRegion();
+	InterlockedExchange(&_trimScheduled, 0);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
 
 
-NTSTATUS RequestQueueConnect()
+static NTSTATUS _QueueConnect(PREQUEST_QUEUE_RING Ring)
 {
 	PREQUEST_HEADER old = NULL;
 	PREQUEST_HEADER psRequest = NULL;
 	LIST_ENTRY psRequests;
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
-	DEBUG_ENTER_FUNCTION_NO_ARGS();
+	DEBUG_ENTER_FUNCTION("Ring=0x%p", Ring);
 	DEBUG_IRQL_LESS_OR_EQUAL(PASSIVE_LEVEL);
 
 	KeEnterCriticalRegion();
@@ -133,6 +522,10 @@ NTSTATUS RequestQueueConnect()
 		IoInitializeRemoveLock(&_removeLock, 0, 0, 0x7fffffff);
 		status = IoAcquireRemoveLock(&_removeLock, NULL);
 		if (NT_SUCCESS(status)) {
+			_ring = Ring;
+			if (Ring != NULL)
+				InterlockedExchangePointer((PVOID volatile *)&_ringData, Ring->Ring.Data);
+
 			InitializeListHead(&psRequests);
 			if (_driverSettings->ProcessEmulateOnConnect)
 				status = ListProcessesByEvents(&psRequests);
@@ -147,7 +540,7 @@ NTSTATUS RequestQueueConnect()
 					psRequest = CONTAINING_RECORD(psRequest->Entry.Flink, REQUEST_HEADER, Entry);
 					RemoveEntryList(&old->Entry);
 					old->Id = InterlockedIncrement(&_driverSettings->ReqQueueLastRequestId);
-					_RequestInsert(old, FALSE);
+					_RequestDeliver(old);
 				}
 
 				_driverSettings->ReqQueueConnected = TRUE;
@@ -162,6 +555,8 @@ NTSTATUS RequestQueueConnect()
 					RequestMemoryFree(old);
 				}
 
+				InterlockedExchangePointer((PVOID volatile *)&_ringData, NULL);
+				_ring = NULL;
 				IoReleaseRemoveLock(&_removeLock, NULL);
 			}
 		}
@@ -175,16 +570,44 @@ NTSTATUS RequestQueueConnect()
 }
 
 
-VOID RequestQueueDisconnect(VOID)
+/** Disconnects the consumer.
+ *
+ *  @param Process Process the ring consumer must be. NULL disconnects
+ *  the consumer regardless of the process.
+ *  @param RingOnly Disconnect only a consumer reading the shared ring.
+ */
+static NTSTATUS _QueueDisconnect(PEPROCESS Process, BOOLEAN RingOnly)
 {
-	DEBUG_ENTER_FUNCTION_NO_ARGS();
+	BOOLEAN disconnect = FALSE;
+	PREQUEST_QUEUE_RING ring = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Process=0x%p; RingOnly=%u", Process, RingOnly);
 	DEBUG_IRQL_LESS_OR_EQUAL(APC_LEVEL);
 
+	status = STATUS_SUCCESS;
 	KeEnterCriticalRegion();
 	ExAcquireResourceExclusiveLite(&_connectLock, TRUE);
-	if (_driverSettings->ReqQueueConnected) {
+	disconnect = _driverSettings->ReqQueueConnected;
+	if (disconnect && RingOnly)
+		disconnect = (_ring != NULL);
+
+	// The ring view belongs to the process that connected; another process
+	// sharing the device handle must not remove it.
+	if (disconnect && Process != NULL && _ring != NULL && _ring->Process != Process) {
+		disconnect = FALSE;
+		status = STATUS_ACCESS_DENIED;
+	}
+
+	if (disconnect) {
 		IoReleaseRemoveLockAndWait(&_removeLock, NULL);
+		InterlockedExchangePointer((PVOID volatile *)&_ringData, NULL);
+		ring = _ring;
+		_ring = NULL;
+		if (ring != NULL)
+			_RingDestroy(ring);
+
 		_driverSettings->ReqQueueConnected = FALSE;
+		_FilterReplace(NULL);
 		if (_driverSettings->ReqQueueClearOnDisconnect)
 			RequestQueueClear();
 	}
@@ -192,6 +615,96 @@ VOID RequestQueueDisconnect(VOID)
 	ExReleaseResourceLite(&_connectLock);
 	KeLeaveCriticalRegion();
 
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+
+/************************************************************************/
+/*                            PUBLIC ROUTINES                           */
+/************************************************************************/
+
+
+NTSTATUS RequestQueueConnect(void)
+{
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION_NO_ARGS();
+
+	status = _QueueConnect(NULL);
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+/** Connects the current process and makes the driver deliver events
+ *  through a ring mapped into its address space.
+ *
+ *  @param DataSize Size of the ring data area, a power of two.
+ *  @param Watermark Number of unread bytes that make the driver signal the event.
+ *  @param EventHandle Handle to the event signalled when the consumer waits
+ *  and enough data are available.
+ *  @param AccessMode Mode used to reference the event handle.
+ *  @param RingAddress Receives address of the ring in the current process.
+ *  @param RingLength Receives size of the ring mapping.
+ *
+ *  @remark
+ *  The mapping is removed on disconnect. The Event Queue stays empty while
+ *  the ring is connected.
+ */
+NTSTATUS RequestQueueConnectRing(ULONG DataSize, ULONG Watermark, HANDLE EventHandle, KPROCESSOR_MODE AccessMode, PVOID *RingAddress, PULONG RingLength)
+{
+	PREQUEST_QUEUE_RING ring = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("DataSize=%u; Watermark=%u; EventHandle=0x%p; AccessMode=%u; RingAddress=0x%p; RingLength=0x%p", DataSize, Watermark, EventHandle, AccessMode, RingAddress, RingLength);
+	DEBUG_IRQL_LESS_OR_EQUAL(PASSIVE_LEVEL);
+
+	status = _RingCreate(DataSize, Watermark, EventHandle, AccessMode, &ring);
+	if (NT_SUCCESS(status)) {
+		status = _QueueConnect(ring);
+		if (NT_SUCCESS(status)) {
+			*RingAddress = ring->UserAddress;
+			*RingLength = ring->Length;
+		}
+
+		if (!NT_SUCCESS(status))
+			_RingDestroy(ring);
+	}
+
+	DEBUG_EXIT_FUNCTION("0x%x, *RingAddress=0x%p, *RingLength=%u", status, *RingAddress, *RingLength);
+	return status;
+}
+
+
+/** Disconnects the consumer. A consumer reading the shared ring can be
+ *  disconnected only from the process that connected it.
+ */
+NTSTATUS RequestQueueDisconnect(VOID)
+{
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION_NO_ARGS();
+
+	status = _QueueDisconnect(PsGetCurrentProcess(), FALSE);
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+/** Disconnects the ring consumer when its process exits. Must be called
+ *  in the context of the exiting process, while its address space still
+ *  exists.
+ */
+VOID RequestQueueProcessExitted(PEPROCESS Process)
+{
+	DEBUG_ENTER_FUNCTION("Process=0x%p", Process);
+	DEBUG_IRQL_LESS_OR_EQUAL(PASSIVE_LEVEL);
+
+	// Most processes have nothing to do with the ring.
+	if (_ringData != NULL)
+		_QueueDisconnect(Process, TRUE);
+
 	DEBUG_EXIT_FUNCTION_VOID();
 	return;
 }
@@ -199,16 +712,38 @@ VOID RequestQueueDisconnect(VOID)
 
 VOID RequestQueueInsert(PREQUEST_HEADER Header)
 {
+	EQueuePolicyDecision decision = qpdAccept;
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("Header=0x%p", Header);
 	DEBUG_IRQL_LESS_OR_EQUAL(DISPATCH_LEVEL);
 
-	if (_driverSettings->ReqQueueConnected ||
+	if (!_RequestFilterPass(Header))
+		status = STATUS_REQUEST_NOT_ACCEPTED;
+	else if (_driverSettings->ReqQueueConnected ||
 		_driverSettings->ReqQueueCollectWhenDisconnected) {
 		status = IoAcquireRemoveLock(&_removeLock, NULL);
 		if (NT_SUCCESS(status)) {
-			Header->Id = InterlockedIncrement(&_driverSettings->ReqQueueLastRequestId);
-			_RequestInsert(Header, FALSE);
+			// The shared ring has a fixed size, so the limits apply
+			// only to the Event Queue.
+			if (_ring == NULL)
+				decision = QueuePolicyDecide(_driverSettings, _driverSettings->ReqQueueLength, _driverSettings->ReqQueueSize, (ULONG)RequestGetSize(Header), &_sampleCounter);
+
+			if (decision != qpdDrop) {
+				// Report the gap once the queue has room again, so the record
+				// precedes the first event stored after it.
+				if (decision == qpdAccept && _dropsPendingFlag)
+					_DropRecordDeliver();
+
+				Header->Id = InterlockedIncrement(&_driverSettings->ReqQueueLastRequestId);
+				_RequestDeliver(Header);
+				if (decision == qpdAcceptTrim &&
+					InterlockedCompareExchange(&_trimScheduled, 1, 0) == 0)
+					IoQueueWorkItemEx(_trimWorkItem, _TrimRoutine, DelayedWorkQueue, NULL);
+			} else {
+				_RequestDropped(Header->Type);
+				status = STATUS_QUOTA_EXCEEDED;
+			}
+
 			IoReleaseRemoveLock(&_removeLock, NULL);
 		}
 	} else status = STATUS_CONNECTION_DISCONNECTED;
@@ -221,6 +756,41 @@ VOID RequestQueueInsert(PREQUEST_HEADER Header)
 }
 
 
+/** Sets the filter new requests must pass to enter the queue.
+ *
+ *  @param Filter Filter in the request-filter.h format, NULL removes
+ *  the current filter.
+ */
+NTSTATUS RequestQueueFilterSet(const REQUEST_FILTER_HEADER *Filter, ULONG Size)
+{
+	PREQUEST_QUEUE_FILTER f = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Filter=0x%p; Size=%u", Filter, Size);
+	DEBUG_IRQL_LESS_OR_EQUAL(APC_LEVEL);
+
+	status = STATUS_SUCCESS;
+	if (Filter != NULL) {
+		f = (PREQUEST_QUEUE_FILTER)HeapMemoryAllocNonPaged(sizeof(REQUEST_QUEUE_FILTER) + Size);
+		if (f != NULL) {
+			f->ReferenceCount = 1;
+			f->Size = Size;
+			memcpy(REQUEST_QUEUE_FILTER_DATA(f), Filter, Size);
+			status = RequestFilterPrepare(REQUEST_QUEUE_FILTER_DATA(f), Size);
+			if (!NT_SUCCESS(status)) {
+				HeapMemoryFree(f);
+				status = STATUS_INVALID_PARAMETER;
+			}
+		} else status = STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	if (NT_SUCCESS(status))
+		_FilterReplace(f);
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
 VOID RequestHeaderInit(PREQUEST_HEADER Header, PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT DeviceObject, ERequesttype RequestType)
 {
 	RequestHeaderInitNoId(Header, DriverObject, DeviceObject, RequestType);
@@ -311,10 +881,13 @@ NTSTATUS RequestQueueGet(PREQUEST_HEADER *Buffer, PSIZE_T Length)
 	if (_driverSettings->ReqQueueConnected) {
 		status = IoAcquireRemoveLock(&_removeLock, NULL);
 		if (NT_SUCCESS(status)) {
-			h = _RequestRemove(&nextAvailable);
+			KeEnterCriticalRegion();
+			ExAcquireResourceExclusiveLite(&_consumerLock, TRUE);
+			h = _RequestPeek(TRUE);
 			if (h != NULL) {
 				reqSize = RequestGetSize(h);
 				if (reqSize <= *Length) {
+					_RequestRemove(h, &nextAvailable);
 					if (nextAvailable)
 						h->Flags |= REQUEST_FLAG_NEXT_AVAILABLE;
 
@@ -322,12 +895,11 @@ NTSTATUS RequestQueueGet(PREQUEST_HEADER *Buffer, PSIZE_T Length)
 					h->Entry.Blink = NULL;
 					*Buffer = h;
 					status = STATUS_SUCCESS;
-				} else {
-					_RequestInsert(h, TRUE);
-					status = STATUS_BUFFER_TOO_SMALL;
-				}
+				} else status = STATUS_BUFFER_TOO_SMALL;
 			} else status = STATUS_NO_MORE_ENTRIES;
 
+			ExReleaseResourceLite(&_consumerLock);
+			KeLeaveCriticalRegion();
 			*Length = reqSize;
 			IoReleaseRemoveLock(&_removeLock, NULL);
 		}
@@ -338,6 +910,125 @@ NTSTATUS RequestQueueGet(PREQUEST_HEADER *Buffer, PSIZE_T Length)
 }
 
 
+/** Removes as many requests from the Event Queue as fit into a given size
+ *  limit. The whole batch is detached during a single acquisition of the
+ *  consumer lock.
+ *
+ *  @param ListHead Head of a list that receives the removed requests, ordered
+ *  by their IDs. The caller is responsible for freeing them.
+ *  @param MaxLength Maximum total size of the removed requests, in bytes.
+ *  @param Length Receives total size of the removed requests. If the first request
+ *  does not fit, the variable receives its size.
+ *  @param Count Receives number of the removed requests.
+ *  @param DroppedCount Receives number of requests dropped since the previous call.
+ *  @param MoreAvailable Receives TRUE if the queue still contains requests.
+ *
+ *  @return
+ *  STATUS_SUCCESS if at least one request was removed, STATUS_BUFFER_TOO_SMALL
+ *  if the first request does not fit into the limit and STATUS_NO_MORE_ENTRIES
+ *  when the queue is empty.
+ */
+NTSTATUS RequestQueueGetBatch(PLIST_ENTRY ListHead, SIZE_T MaxLength, PSIZE_T Length, PULONG Count, PULONG DroppedCount, PBOOLEAN MoreAvailable)
+{
+	ULONG count = 0;
+	SIZE_T reqSize = 0;
+	SIZE_T totalSize = 0;
+	BOOLEAN nextAvailable = FALSE;
+	PREQUEST_HEADER h = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("ListHead=0x%p; MaxLength=%Iu; Length=0x%p; Count=0x%p; DroppedCount=0x%p; MoreAvailable=0x%p", ListHead, MaxLength, Length, Count, DroppedCount, MoreAvailable);
+	DEBUG_IRQL_LESS_OR_EQUAL(APC_LEVEL);
+
+	*Length = 0;
+	*Count = 0;
+	*DroppedCount = 0;
+	*MoreAvailable = FALSE;
+	if (_driverSettings->ReqQueueConnected) {
+		status = IoAcquireRemoveLock(&_removeLock, NULL);
+		if (NT_SUCCESS(status)) {
+			KeEnterCriticalRegion();
+			ExAcquireResourceExclusiveLite(&_consumerLock, TRUE);
+			h = _RequestPeek(TRUE);
+			while (h != NULL) {
+				reqSize = RequestGetSize(h);
+				if (totalSize + reqSize > MaxLength) {
+					if (count == 0)
+						totalSize = reqSize;
+
+					nextAvailable = TRUE;
+					break;
+				}
+
+				_RequestRemove(h, &nextAvailable);
+				h->Entry.Flink = NULL;
+				h->Entry.Blink = NULL;
+				InsertTailList(ListHead, &h->Entry);
+				totalSize += reqSize;
+				++count;
+				h = _RequestPeek(FALSE);
+			}
+
+			ExReleaseResourceLite(&_consumerLock);
+			KeLeaveCriticalRegion();
+			if (count > 0)
+				status = STATUS_SUCCESS;
+			else if (h != NULL)
+				status = STATUS_BUFFER_TOO_SMALL;
+			else status = STATUS_NO_MORE_ENTRIES;
+
+			*Length = totalSize;
+			*Count = count;
+			if (count > 0)
+				*DroppedCount = InterlockedExchange(&_dropsSinceBatch, 0);
+
+			*MoreAvailable = nextAvailable;
+			IoReleaseRemoveLock(&_removeLock, NULL);
+		}
+	} else status = STATUS_CONNECTION_DISCONNECTED;
+
+	DEBUG_EXIT_FUNCTION("0x%x, *Length=%Iu, *Count=%u, *DroppedCount=%u, *MoreAvailable=%u", status, *Length, *Count, *DroppedCount, *MoreAvailable);
+	return status;
+}
+
+
+/** Returns requests taken by RequestQueueGetBatch to the front of the queue
+ *  when they could not be passed to the consumer.
+ *
+ *  @param ListHead The requests, in the order they were taken.
+ *  @param DroppedCount Number of drops reported by RequestQueueGetBatch.
+ */
+VOID RequestQueueReturnBatch(PLIST_ENTRY ListHead, ULONG DroppedCount)
+{
+	PREQUEST_HEADER h = NULL;
+	DEBUG_ENTER_FUNCTION("ListHead=0x%p; DroppedCount=%u", ListHead, DroppedCount);
+	DEBUG_IRQL_LESS_OR_EQUAL(APC_LEVEL);
+
+	KeEnterCriticalRegion();
+	ExAcquireResourceExclusiveLite(&_consumerLock, TRUE);
+	// The requests are older than any request left in the queue,
+	// so they go before the others.
+	while (!IsListEmpty(ListHead)) {
+		h = CONTAINING_RECORD(RemoveTailList(ListHead), REQUEST_HEADER, Entry);
+		InsertHeadList(&_cpuQueues[0].Pending, &h->Entry);
+		if (h->Flags & REQUEST_FLAG_PAGED)
+			InterlockedIncrement(&_driverSettings->ReqQueuePagedLength);
+		else if (h->Flags & REQUEST_FLAG_NONPAGED)
+			InterlockedIncrement(&_driverSettings->ReqQueueNonPagedLength);
+
+		InterlockedExchangeAdd(&_driverSettings->ReqQueueSize, (LONG)RequestGetSize(h));
+		InterlockedIncrement(&_driverSettings->ReqQueueLength);
+	}
+
+	ExReleaseResourceLite(&_consumerLock);
+	KeLeaveCriticalRegion();
+	if (DroppedCount > 0)
+		InterlockedExchangeAdd(&_dropsSinceBatch, DroppedCount);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
 NTSTATUS ListDriversAndDevicesByEvents(PLIST_ENTRY ListHead)
 {
 	const wchar_t *dirNames[2] = {
@@ -388,51 +1079,27 @@ NTSTATUS ListDriversAndDevicesByEvents(PLIST_ENTRY ListHead)
 
 void RequestQueueClear(void)
 {
-	KIRQL irql;
-	LIST_ENTRY tmpList;
+	BOOLEAN dummy = FALSE;
 	PREQUEST_HEADER req = NULL;
-	PREQUEST_HEADER old = NULL;
+	PREQUEST_QUEUE_CPU q = NULL;
 	DEBUG_ENTER_FUNCTION_NO_ARGS();
 
-	InitializeListHead(&tmpList);
-	KeAcquireSpinLock(&_npagedRequestListLock, &irql);
-	if (!IsListEmpty(&_npagedRequestListHead)) {
-		tmpList = _npagedRequestListHead;
-		InitializeListHead(&_npagedRequestListHead);
-	}
-
-	KeReleaseSpinLock(&_npagedRequestListLock, irql);
-	tmpList.Flink->Blink = &tmpList;
-	tmpList.Blink->Flink = &tmpList;
-	req = CONTAINING_RECORD(tmpList.Flink, REQUEST_HEADER, Entry);
-	while (&req->Entry != &tmpList) {
-		old = req;
-		req = CONTAINING_RECORD(req->Entry.Flink, REQUEST_HEADER, Entry);
-		RequestMemoryFree(old);
-		InterlockedDecrement(&_driverSettings->ReqQueueNonPagedLength);
-		InterlockedDecrement(&_driverSettings->ReqQueueLength);
-	}
-
-	InitializeListHead(&tmpList);
 	KeEnterCriticalRegion();
-	ExAcquireResourceExclusiveLite(&_pagedRequestListLock, TRUE);
-	if (!IsListEmpty(&_pagedRequestListHead)) {
-		tmpList = _pagedRequestListHead;
-		InitializeListHead(&_pagedRequestListHead);
+	ExAcquireResourceExclusiveLite(&_consumerLock, TRUE);
+	q = _cpuQueues;
+	for (ULONG i = 0; i < _cpuQueueCount; ++i) {
+		_QueueCollect(q);
+		while (!IsListEmpty(&q->Pending)) {
+			req = CONTAINING_RECORD(q->Pending.Flink, REQUEST_HEADER, Entry);
+			_RequestRemove(req, &dummy);
+			RequestMemoryFree(req);
+		}
+
+		++q;
 	}
 
-	ExReleaseResourceLite(&_pagedRequestListLock);
+	ExReleaseResourceLite(&_consumerLock);
 	KeLeaveCriticalRegion();
-	tmpList.Flink->Blink = &tmpList;
-	tmpList.Blink->Flink = &tmpList;
-	req = CONTAINING_RECORD(tmpList.Flink, REQUEST_HEADER, Entry);
-	while (&req->Entry != &tmpList) {
-		old = req;
-		req = CONTAINING_RECORD(req->Entry.Flink, REQUEST_HEADER, Entry);
-		RequestMemoryFree(old);
-		InterlockedDecrement(&_driverSettings->ReqQueuePagedLength);
-		InterlockedDecrement(&_driverSettings->ReqQueueLength);
-	}
 
 	DEBUG_EXIT_FUNCTION_VOID();
 	return;
@@ -448,21 +1115,42 @@ NTSTATUS RequestQueueModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING Reg
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
 
-	UNREFERENCED_PARAMETER(DriverObject);
 	UNREFERENCED_PARAMETER(RegistryPath);
 	UNREFERENCED_PARAMETER(Context);
 	
 	_driverSettings = DriverSettingsGet();
-	status = ExInitializeResourceLite(&_pagedRequestListLock);
-	if (NT_SUCCESS(status)) {
-		InitializeListHead(&_npagedRequestListHead);
-		InitializeListHead(&_pagedRequestListHead);
-		KeInitializeSpinLock(&_npagedRequestListLock);
-		IoInitializeRemoveLock(&_removeLock, 0, 0, 0x7fffffff);
-		status = ExInitializeResourceLite(&_connectLock);
-		if (!NT_SUCCESS(status))
-			ExDeleteResourceLite(&_pagedRequestListLock);
-	}
+	KeInitializeSpinLock(&_filterLock);
+	_trimWorkItem = (PIO_WORKITEM)HeapMemoryAllocNonPaged(IoSizeofWorkItem());
+	if (_trimWorkItem != NULL) {
+		IoInitializeWorkItem(DriverObject, _trimWorkItem);
+		_cpuQueueCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+		_cpuQueues = (PREQUEST_QUEUE_CPU)HeapMemoryAllocNonPaged(_cpuQueueCount*sizeof(REQUEST_QUEUE_CPU));
+		if (_cpuQueues != NULL) {
+			for (ULONG i = 0; i < _cpuQueueCount; ++i) {
+				InitializeSListHead(&_cpuQueues[i].Pushed);
+				InitializeListHead(&_cpuQueues[i].Pending);
+			}
+
+			status = ExInitializeResourceLite(&_consumerLock);
+			if (NT_SUCCESS(status)) {
+				IoInitializeRemoveLock(&_removeLock, 0, 0, 0x7fffffff);
+				status = ExInitializeResourceLite(&_connectLock);
+				if (!NT_SUCCESS(status))
+					ExDeleteResourceLite(&_consumerLock);
+			}
+
+			if (!NT_SUCCESS(status)) {
+				HeapMemoryFree(_cpuQueues);
+				_cpuQueues = NULL;
+			}
+		} else status = STATUS_INSUFFICIENT_RESOURCES;
+
+		if (!NT_SUCCESS(status)) {
+			IoUninitializeWorkItem(_trimWorkItem);
+			HeapMemoryFree(_trimWorkItem);
+			_trimWorkItem = NULL;
+		}
+	} else status = STATUS_INSUFFICIENT_RESOURCES;
 
 	DEBUG_EXIT_FUNCTION("0x%x", status);
 	return status;
@@ -470,15 +1158,31 @@ NTSTATUS RequestQueueModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING Reg
 
 VOID RequestQueueModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context)
 {
+	LARGE_INTEGER timeout;
 	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
 
 	UNREFERENCED_PARAMETER(DriverObject);
 	UNREFERENCED_PARAMETER(RegistryPath);
 	UNREFERENCED_PARAMETER(Context);
 
+	// Wait for a pending trim of the queue.
+	timeout.QuadPart = -100000;
+	while (_trimScheduled)
+		KeDelayExecutionThread(KernelMode, FALSE, &timeout);
+
+	// The consumer process may still run if the last handle to the device
+	// has been closed by another one.
+	_QueueDisconnect(NULL, TRUE);
 	RequestQueueClear();
+	_FilterReplace(NULL);
+	IoUninitializeWorkItem(_trimWorkItem);
+	HeapMemoryFree(_trimWorkItem);
+	_trimWorkItem = NULL;
 	ExDeleteResourceLite(&_connectLock);
-	ExDeleteResourceLite(&_pagedRequestListLock);
+	ExDeleteResourceLite(&_consumerLock);
+	HeapMemoryFree(_cpuQueues);
+	_cpuQueues = NULL;
+	_cpuQueueCount = 0;
 	_driverSettings = NULL;
 
 	DEBUG_EXIT_FUNCTION_VOID();
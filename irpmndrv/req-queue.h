@@ -4,18 +4,24 @@
 
 #include <ntifs.h>
 #include "kernel-shared.h"
+#include "request-filter.h"
 
 
 VOID RequestHeaderInit(PREQUEST_HEADER Header, PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT DeviceObject, ERequesttype RequestType);
 VOID RequestHeaderInitNoId(PREQUEST_HEADER Header, PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT DeviceObject, ERequesttype RequestType);
 NTSTATUS RequestXXXDetectedCreate(ERequesttype Type, PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT DeviceObject, PREQUEST_HEADER *Header);
 NTSTATUS RequestQueueGet(PREQUEST_HEADER *Buffer, PSIZE_T Length);
+NTSTATUS RequestQueueGetBatch(PLIST_ENTRY ListHead, SIZE_T MaxLength, PSIZE_T Length, PULONG Count, PULONG DroppedCount, PBOOLEAN MoreAvailable);
+VOID RequestQueueReturnBatch(PLIST_ENTRY ListHead, ULONG DroppedCount);
 VOID RequestQueueInsert(PREQUEST_HEADER Header);
 NTSTATUS ListDriversAndDevicesByEvents(PLIST_ENTRY ListHead);
 void RequestQueueClear(void);
+NTSTATUS RequestQueueFilterSet(const REQUEST_FILTER_HEADER *Filter, ULONG Size);
 
 NTSTATUS RequestQueueConnect(void);
-VOID RequestQueueDisconnect(void);
+NTSTATUS RequestQueueConnectRing(ULONG DataSize, ULONG Watermark, HANDLE EventHandle, KPROCESSOR_MODE AccessMode, PVOID *RingAddress, PULONG RingLength);
+NTSTATUS RequestQueueDisconnect(void);
+VOID RequestQueueProcessExitted(PEPROCESS Process);
 
 NTSTATUS RequestQueueModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
 VOID RequestQueueModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
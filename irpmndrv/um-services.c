@@ -457,6 +457,107 @@ NTSTATUS UMGetRequestRecord(PVOID Buffer, ULONG BufferLength, PSIZE_T ReturnLeng
 	return status;
 }
 
+static void _BatchRecordCopy(unsigned char *Target, const REQUEST_HEADER *Request, SIZE_T Size, BOOLEAN NextAvailable)
+{
+	PREQUEST_HEADER h = (PREQUEST_HEADER)Target;
+
+	memcpy(h, Request, Size);
+	h->Entry.Flink = NULL;
+	h->Entry.Blink = NULL;
+	if (NextAvailable)
+		h->Flags |= REQUEST_FLAG_NEXT_AVAILABLE;
+
+	return;
+}
+
+NTSTATUS UMGetRequestBatch(PREQUEST_BATCH_HEADER Buffer, ULONG BufferLength, PSIZE_T ReturnLength)
+{
+	LIST_ENTRY batchList;
+	ULONG recordCount = 0;
+	ULONG droppedCount = 0;
+	SIZE_T batchSize = 0;
+	SIZE_T requestSize = 0;
+	BOOLEAN moreAvailable = FALSE;
+	PREQUEST_HEADER request = NULL;
+	PREQUEST_HEADER old = NULL;
+	unsigned char *target = NULL;
+	REQUEST_BATCH_HEADER header;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Buffer=0x%p; BufferLength=%u; ReturnLength=0x%p", Buffer, BufferLength, ReturnLength);
+
+	*ReturnLength = 0;
+	if (BufferLength >= sizeof(REQUEST_BATCH_HEADER) + sizeof(REQUEST_HEADER)) {
+		if (ExGetPreviousMode() == UserMode) {
+			__try {
+				ProbeForWrite(Buffer, BufferLength, 1);
+				status = STATUS_SUCCESS;
+			} __except (EXCEPTION_EXECUTE_HANDLER) {
+				status = GetExceptionCode();
+			}
+		} else status = STATUS_SUCCESS;
+
+		if (NT_SUCCESS(status)) {
+			InitializeListHead(&batchList);
+			status = RequestQueueGetBatch(&batchList, BufferLength - sizeof(REQUEST_BATCH_HEADER), &batchSize, &recordCount, &droppedCount, &moreAvailable);
+			if (NT_SUCCESS(status)) {
+				memset(&header, 0, sizeof(header));
+				header.Version = REQUEST_BATCH_VERSION_1;
+				header.HeaderSize = sizeof(REQUEST_BATCH_HEADER);
+				header.RecordCount = recordCount;
+				header.BytesUsed = (ULONG)batchSize;
+				header.FirstId = CONTAINING_RECORD(batchList.Flink, REQUEST_HEADER, Entry)->Id;
+				header.LastId = CONTAINING_RECORD(batchList.Blink, REQUEST_HEADER, Entry)->Id;
+				header.DroppedCount = droppedCount;
+				if (moreAvailable)
+					header.Flags |= REQUEST_BATCH_FLAG_MORE_AVAILABLE;
+
+				// The requests stay linked until the whole batch is copied, so
+				// they can be returned to the queue if the buffer turns out to be
+				// invalid. The copies get the list links cleared.
+				target = (unsigned char *)(Buffer + 1);
+				request = CONTAINING_RECORD(batchList.Flink, REQUEST_HEADER, Entry);
+				while (NT_SUCCESS(status) && &request->Entry != &batchList) {
+					requestSize = RequestGetSize(request);
+					if (ExGetPreviousMode() == UserMode) {
+						__try {
+							_BatchRecordCopy(target, request, requestSize, (request->Entry.Flink != &batchList));
+						} __except (EXCEPTION_EXECUTE_HANDLER) {
+							status = GetExceptionCode();
+						}
+					} else _BatchRecordCopy(target, request, requestSize, (request->Entry.Flink != &batchList));
+
+					target += requestSize;
+					request = CONTAINING_RECORD(request->Entry.Flink, REQUEST_HEADER, Entry);
+				}
+
+				if (NT_SUCCESS(status)) {
+					if (ExGetPreviousMode() == UserMode) {
+						__try {
+							*Buffer = header;
+						} __except (EXCEPTION_EXECUTE_HANDLER) {
+							status = GetExceptionCode();
+						}
+					} else *Buffer = header;
+				}
+
+				if (NT_SUCCESS(status)) {
+					request = CONTAINING_RECORD(batchList.Flink, REQUEST_HEADER, Entry);
+					while (&request->Entry != &batchList) {
+						old = request;
+						request = CONTAINING_RECORD(request->Entry.Flink, REQUEST_HEADER, Entry);
+						RequestMemoryFree(old);
+					}
+
+					*ReturnLength = sizeof(REQUEST_BATCH_HEADER) + batchSize;
+				} else RequestQueueReturnBatch(&batchList, droppedCount);
+			}
+		}
+	} else status = STATUS_BUFFER_TOO_SMALL;
+
+	DEBUG_EXIT_FUNCTION("0x%x, *ReturnLength=%Iu", status, *ReturnLength);
+	return status;
+}
+
 NTSTATUS UMEnumDriversDevices(PVOID OutputBuffer, ULONG OutputBufferLength, PULONG ReturnLength)
 {
 	PDRIVER_OBJECT *driverDir = NULL;
@@ -665,25 +766,65 @@ NTSTATUS UMEnumDriversDevices(PVOID OutputBuffer, ULONG OutputBufferLength, PULO
 	return status;
 }
 
-NTSTATUS UMRequestQueueConnect(void)
+NTSTATUS UMRequestQueueConnect(PIOCTL_IRPMNDRV_CONNECT_INPUT InputBuffer, ULONG InputBufferLength, PIOCTL_IRPMNDRV_CONNECT_OUTPUT OutputBuffer, ULONG OutputBufferLength, PSIZE_T ReturnLength)
 {
+	IOCTL_IRPMNDRV_CONNECT_INPUT input;
+	IOCTL_IRPMNDRV_CONNECT_OUTPUT output;
 	NTSTATUS status = STATUS_UNSUCCESSFUL;
-	DEBUG_ENTER_FUNCTION_NO_ARGS();
+	DEBUG_ENTER_FUNCTION("InputBuffer=0x%p; InputBufferLength=%u; OutputBuffer=0x%p; OutputBufferLength=%u; ReturnLength=0x%p", InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, ReturnLength);
+
+	*ReturnLength = 0;
+	if (InputBufferLength == 0)
+		status = RequestQueueConnect();
+	else if (InputBufferLength >= sizeof(input) && OutputBufferLength >= sizeof(output)) {
+		if (ExGetPreviousMode() == UserMode) {
+			__try {
+				ProbeForRead(InputBuffer, sizeof(input), 1);
+				input = *InputBuffer;
+				ProbeForWrite(OutputBuffer, sizeof(output), 1);
+				status = STATUS_SUCCESS;
+			} __except (EXCEPTION_EXECUTE_HANDLER) {
+				status = GetExceptionCode();
+			}
+		} else {
+			input = *InputBuffer;
+			status = STATUS_SUCCESS;
+		}
+
+		if (NT_SUCCESS(status)) {
+			memset(&output, 0, sizeof(output));
+			status = RequestQueueConnectRing(input.RingSize, input.Watermark, input.EventHandle, ExGetPreviousMode(), &output.RingAddress, &output.RingLength);
+			if (NT_SUCCESS(status)) {
+				if (ExGetPreviousMode() == UserMode) {
+					__try {
+						*OutputBuffer = output;
+					} __except (EXCEPTION_EXECUTE_HANDLER) {
+						status = GetExceptionCode();
+					}
+				} else *OutputBuffer = output;
 
-	status = RequestQueueConnect();
+				if (NT_SUCCESS(status))
+					*ReturnLength = sizeof(output);
 
-	DEBUG_EXIT_FUNCTION("0x%x", status);
+				if (!NT_SUCCESS(status))
+					RequestQueueDisconnect();
+			}
+		}
+	} else status = STATUS_INFO_LENGTH_MISMATCH;
+
+	DEBUG_EXIT_FUNCTION("0x%x, *ReturnLength=%Iu", status, *ReturnLength);
 	return status;
 }
 
-VOID UMRequestQueueDisconnect(VOID)
+NTSTATUS UMRequestQueueDisconnect(VOID)
 {
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
 	DEBUG_ENTER_FUNCTION_NO_ARGS();
 
-	RequestQueueDisconnect();
+	status = RequestQueueDisconnect();
 
-	DEBUG_EXIT_FUNCTION_VOID();
-	return;
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
 }
 
 void UMRequestQueueClear(void)
@@ -696,6 +837,39 @@ void UMRequestQueueClear(void)
 	return;
 }
 
+
+NTSTATUS UMRequestFilterSet(PVOID InputBuffer, ULONG InputBufferLength)
+{
+	PREQUEST_FILTER_HEADER filter = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("InputBuffer=0x%p; InputBufferLength=%u", InputBuffer, InputBufferLength);
+
+	if (InputBufferLength == 0)
+		status = RequestQueueFilterSet(NULL, 0);
+	else if (InputBufferLength >= sizeof(REQUEST_FILTER_HEADER) && InputBufferLength <= REQUEST_FILTER_MAX_SIZE) {
+		filter = (PREQUEST_FILTER_HEADER)HeapMemoryAllocPaged(InputBufferLength);
+		if (filter != NULL) {
+			status = STATUS_SUCCESS;
+			if (ExGetPreviousMode() == UserMode) {
+				__try {
+					ProbeForRead(InputBuffer, InputBufferLength, 1);
+					memcpy(filter, InputBuffer, InputBufferLength);
+				} __except (EXCEPTION_EXECUTE_HANDLER) {
+					status = GetExceptionCode();
+				}
+			} else memcpy(filter, InputBuffer, InputBufferLength);
+
+			if (NT_SUCCESS(status))
+				status = RequestQueueFilterSet(filter, InputBufferLength);
+
+			HeapMemoryFree(filter);
+		} else status = STATUS_INSUFFICIENT_RESOURCES;
+	} else status = STATUS_INFO_LENGTH_MISMATCH;
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
 NTSTATUS UMHookedDriverSetInfo(PIOCTL_IRPMNDRV_HOOK_DRIVER_SET_INFO_INPUT InputBuffer, ULONG InputBufferLength)
 {
 	IOCTL_IRPMNDRV_HOOK_DRIVER_SET_INFO_INPUT input = {0};
@@ -1329,6 +1503,7 @@ NTSTATUS UMDriverSettingsQuery(PIOCTL_IRPMNDRV_SETTINGS_QUERY_OUTPUT OutputBuffe
 	if (OutputBufferLength >= sizeof(IOCTL_IRPMNDRV_SETTINGS_QUERY_OUTPUT)) {
 		status = STATUS_SUCCESS;
 		settings = DriverSettingsGet();
+		RequestMemoryQueryStatistics(&settings->ReqAllocHits, &settings->ReqAllocMisses, &settings->ReqAllocOutstanding);
 		if (ExGetPreviousMode() == UserMode) {
 			__try {
 				ProbeForWrite(OutputBuffer, sizeof(OutputBuffer->Settings), 1);
@@ -25,10 +25,12 @@ NTSTATUS UMUnhookDriver(PIOCTL_IRPMNDRV_UNHOOK_DRIVER_INPUT InputBuffer, ULONG I
 NTSTATUS UMHookAddDevice(PIOCTL_IRPMNDRV_HOOK_ADD_DEVICE_INPUT InputBUffer, ULONG InputBufferLength, PIOCTL_IRPMNDRV_HOOK_ADD_DEVICE_OUTPUT OutputBuffer, ULONG OutputBufferLength);
 NTSTATUS UMHookDeleteDevice(PIOCTL_IRPMNDRV_HOOK_REMOVE_DEVICE_INPUT InputBuffer, ULONG InputBufferLength);
 NTSTATUS UMGetRequestRecord(PVOID Buffer, ULONG BufferLength, PSIZE_T ReturnLength);
+NTSTATUS UMGetRequestBatch(PREQUEST_BATCH_HEADER Buffer, ULONG BufferLength, PSIZE_T ReturnLength);
 NTSTATUS UMEnumDriversDevices(PVOID OutputBuffer, ULONG OutputBufferLength, PULONG ReturnLength);
-NTSTATUS UMRequestQueueConnect(void);
-VOID UMRequestQueueDisconnect(VOID);
+NTSTATUS UMRequestQueueConnect(PIOCTL_IRPMNDRV_CONNECT_INPUT InputBuffer, ULONG InputBufferLength, PIOCTL_IRPMNDRV_CONNECT_OUTPUT OutputBuffer, ULONG OutputBufferLength, PSIZE_T ReturnLength);
+NTSTATUS UMRequestQueueDisconnect(VOID);
 void UMRequestQueueClear(void);
+NTSTATUS UMRequestFilterSet(PVOID InputBuffer, ULONG InputBufferLength);
 
 NTSTATUS UMHookedDriverSetInfo(PIOCTL_IRPMNDRV_HOOK_DRIVER_SET_INFO_INPUT InputBuffer, ULONG InputBufferLength);
 NTSTATUS UMHookedDriverGetInfo(PIOCTL_IRPMNDRV_HOOK_DRIVER_GET_INFO_INPUT InputBuffer, ULONG InputBufferLength, PIOCTL_IRPMNDRV_HOOK_DRIVER_GET_INFO_OUTPUT OutputBuffer, ULONG OutputBufferLength);
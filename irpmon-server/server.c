@@ -15,12 +15,15 @@ int main(int argc, char **argv)
 {
 	int ret = 0;
 
-	if (argc != 3) {
+	if (argc < 3 || argc > 5) {
 		ret = -1;
-		fprintf(stderr, "Usage: %s <host> <port>\n", argv[0]);
+		fprintf(stderr, "Usage: %s <host> <port> [flush-deadline-ms [flush-size]]\n", argv[0]);
 		goto Exit;
 	}
 
+	if (argc >= 4)
+		IRPMonServerSetFlushPolicy(strtoul(argv[3], NULL, 0), (argc == 5) ? strtoul(argv[4], NULL, 0) : 0);
+
 	ret = IRPMonServerStart(argv[1], argv[2], NULL);
 	if (ret != 0) {
 		fprintf(stderr, "[ERROR]: Unable to start the server: %u\n", ret);
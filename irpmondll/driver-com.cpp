@@ -6,6 +6,7 @@
 #include "kernel-shared.h"
 #include "general-types.h"
 #include "irpmondll-types.h"
+#include "event-ring.h"
 #include "driver-com.h"
 
 
@@ -357,6 +358,35 @@ DWORD DriverComConnect(void)
 	return ret;
 }
 
+DWORD DriverComConnectRing(DWORD RingSize, DWORD Watermark, HANDLE EventHandle, PEVENT_RING Ring)
+{
+	IOCTL_IRPMNDRV_CONNECT_INPUT input;
+	IOCTL_IRPMNDRV_CONNECT_OUTPUT output;
+	DWORD ret = ERROR_GEN_FAILURE;
+	DEBUG_ENTER_FUNCTION("RingSize=%u; Watermark=%u; EventHandle=0x%p; Ring=0x%p", RingSize, Watermark, EventHandle, Ring);
+
+	// The ring is mapped into the address space of the process
+	// that sent the request, so it cannot work over the network.
+	ret = ERROR_NOT_SUPPORTED;
+	if (_dcInterface != NULL && _dcInterface->InterfaceType == ictDevice) {
+		memset(&input, 0, sizeof(input));
+		input.RingSize = RingSize;
+		input.Watermark = Watermark;
+		input.EventHandle = EventHandle;
+		memset(&output, 0, sizeof(output));
+		ret = _SynchronousOtherIOCTL(IOCTL_IRPMNDRV_CONNECT, &input, sizeof(input), &output, sizeof(output));
+		if (ret == ERROR_SUCCESS) {
+			if (!EventRingAttach(Ring, output.RingAddress, output.RingLength)) {
+				ret = ERROR_REVISION_MISMATCH;
+				DriverComDisconnect();
+			}
+		}
+	}
+
+	DEBUG_EXIT_FUNCTION("%u", ret);
+	return ret;
+}
+
 DWORD DriverComDisconnect(VOID)
 {
 	DWORD ret = ERROR_GEN_FAILURE;
@@ -379,6 +409,19 @@ DWORD DriverComGetRequest(PREQUEST_HEADER Request, DWORD Size)
 	return ret;
 }
 
+DWORD DriverComGetRequestBatch(PREQUEST_BATCH_HEADER Batch, DWORD Size)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	DEBUG_ENTER_FUNCTION("Batch=0x%p; Size=%u", Batch, Size);
+
+	ret = _SynchronousReadIOCTL(IOCTL_IRPMNDRV_GET_RECORDS, Batch, Size);
+	if (ret == ERROR_SUCCESS && Batch->Version != REQUEST_BATCH_VERSION_1)
+		ret = ERROR_REVISION_MISMATCH;
+
+	DEBUG_EXIT_FUNCTION("%u", ret);
+	return ret;
+}
+
 DWORD DriverComQueueClear(void)
 {
 	DWORD ret = ERROR_GEN_FAILURE;
@@ -1016,6 +1059,21 @@ DWORD DriverComSettingsSet(PIRPMNDRV_SETTINGS Settings, BOOLEAN Save)
 }
 
 
+DWORD DriverComRequestFilterSet(const void *Filter, ULONG Size)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	DEBUG_ENTER_FUNCTION("Filter=0x%p; Size=%u", Filter, Size);
+
+	if (Filter == NULL)
+		Size = 0;
+
+	ret = _SynchronousWriteIOCTL(IOCTL_IRPMNDRV_REQUEST_FILTER_SET, (PVOID)Filter, Size);
+
+	DEBUG_EXIT_FUNCTION("%u", ret);
+	return ret;
+}
+
+
 BOOL DriverComDeviceConnected(VOID)
 {
 	BOOL ret = FALSE;
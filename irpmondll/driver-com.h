@@ -6,6 +6,7 @@
 #include "general-types.h"
 #include "kernel-shared.h"
 #include "irpmondll-types.h"
+#include "event-ring.h"
 
 
 #ifdef __cplusplus
@@ -20,8 +21,10 @@ DWORD DriverComHookedDriverActivate(HANDLE DriverHandle, BOOLEAN Activate);
 DWORD DriverComUnhookDriver(HANDLE HookHandle);
 
 DWORD DriverComConnect(void);
+DWORD DriverComConnectRing(DWORD RingSize, DWORD Watermark, HANDLE EventHandle, PEVENT_RING Ring);
 DWORD DriverComDisconnect(VOID);
 DWORD DriverComGetRequest(PREQUEST_HEADER Request, DWORD Size);
+DWORD DriverComGetRequestBatch(PREQUEST_BATCH_HEADER Batch, DWORD Size);
 DWORD DriverComQueueClear(void);
 
 DWORD DriverComHookDeviceByName(PWCHAR DeviceName, PHANDLE HookHandle, PVOID *ObjectId);
@@ -62,6 +65,7 @@ DWORD DriverComEmulateProcesses(void);
 
 DWORD DriverComSettingsQuery(PIRPMNDRV_SETTINGS Settings);
 DWORD DriverComSettingsSet(PIRPMNDRV_SETTINGS Settings, BOOLEAN Save);
+DWORD DriverComRequestFilterSet(const void *Filter, ULONG Size);
 
 DWORD DriverComModuleInit(const IRPMON_INIT_INFO *Info);
 VOID DriverComModuleFinit(VOID);
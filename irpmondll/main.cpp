@@ -72,6 +72,9 @@
 #include "general-types.h"
 #include "irpmondll-types.h"
 #include "driver-com.h"
+#include "request-filter.h"
+#include "request-filter-program.h"
+#include "reprocess.h"
 #include "irpmondll.h"
 
 
@@ -87,12 +90,42 @@ IRPMONDLL_API DWORD WINAPI IRPMonDllGetRequest(PREQUEST_HEADER Request, DWORD Si
 }
 
 
+IRPMONDLL_API DWORD WINAPI IRPMonDllGetRequestBatch(PREQUEST_BATCH_HEADER Batch, DWORD Size)
+{
+	return DriverComGetRequestBatch(Batch, Size);
+}
+
+
 IRPMONDLL_API DWORD WINAPI IRPMonDllConnect(void)
 {
 	return DriverComConnect();
 }
 
 
+IRPMONDLL_API DWORD WINAPI IRPMonDllConnectRing(DWORD RingSize, DWORD Watermark, HANDLE EventHandle, PEVENT_RING Ring)
+{
+	return DriverComConnectRing(RingSize, Watermark, EventHandle, Ring);
+}
+
+
+IRPMONDLL_API PVOID WINAPI IRPMonDllRingPeek(PEVENT_RING Ring, PULONG Size)
+{
+	return (PVOID)EventRingPeek(Ring, Size);
+}
+
+
+IRPMONDLL_API VOID WINAPI IRPMonDllRingRelease(PEVENT_RING Ring)
+{
+	EventRingRelease(Ring);
+}
+
+
+IRPMONDLL_API BOOLEAN WINAPI IRPMonDllRingWaitPrepare(PEVENT_RING Ring)
+{
+	return EventRingWaitPrepare(Ring);
+}
+
+
 IRPMONDLL_API DWORD WINAPI IRPMonDllDisconnect(VOID)
 {
 	return DriverComDisconnect();
@@ -314,6 +347,97 @@ IRPMONDLL_API DWORD WINAPI IRPMonDllSettingsSet(PIRPMNDRV_SETTINGS Settings, BOO
 }
 
 
+IRPMONDLL_API DWORD WINAPI IRPMonDllRequestFilterSet(const void *Filter, ULONG Size)
+{
+	return DriverComRequestFilterSet(Filter, Size);
+}
+
+
+/************************************************************************/
+/*                  FILTER PROGRAMS                                     */
+/************************************************************************/
+
+
+IRPMONDLL_API DWORD WINAPI IRPMonDllFilterProgramCompile(const void *Filter, ULONG Size, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, PREQUEST_FILTER_PROGRAM *Program)
+{
+	PREQUEST_FILTER_HEADER tmpFilter = NULL;
+	DWORD ret = ERROR_GEN_FAILURE;
+	DEBUG_ENTER_FUNCTION("Filter=0x%p; Size=%u; NameRoutine=0x%p; Context=0x%p; Program=0x%p", Filter, Size, NameRoutine, Context, Program);
+
+	ret = ERROR_INVALID_PARAMETER;
+	if (Size >= sizeof(REQUEST_FILTER_HEADER) && Size <= REQUEST_FILTER_MAX_SIZE) {
+		tmpFilter = (PREQUEST_FILTER_HEADER)HeapAlloc(GetProcessHeap(), 0, Size);
+		if (tmpFilter != NULL) {
+			memcpy(tmpFilter, Filter, Size);
+			ret = RequestFilterPrepare(tmpFilter, Size);
+			if (ret == ERROR_SUCCESS)
+				ret = RequestFilterProgramCompile(tmpFilter, NameRoutine, Context, Program);
+
+			HeapFree(GetProcessHeap(), 0, tmpFilter);
+		} else ret = ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	DEBUG_EXIT_FUNCTION("%u, *Program=0x%p", ret, *Program);
+	return ret;
+}
+
+
+IRPMONDLL_API DWORD WINAPI IRPMonDllFilterProgramLoad(const wchar_t *FileName, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, PREQUEST_FILTER_PROGRAM *Program)
+{
+	PREQUEST_FILTER_HEADER filter = NULL;
+	DWORD ret = ERROR_GEN_FAILURE;
+	DEBUG_ENTER_FUNCTION("FileName=\"%S\"; NameRoutine=0x%p; Context=0x%p; Program=0x%p", FileName, NameRoutine, Context, Program);
+
+	ret = RequestFilterLoadList(FileName, &filter);
+	if (ret == ERROR_SUCCESS) {
+		ret = RequestFilterProgramCompile(filter, NameRoutine, Context, Program);
+		RequestFilterFree(filter);
+	}
+
+	DEBUG_EXIT_FUNCTION("%u, *Program=0x%p", ret, *Program);
+	return ret;
+}
+
+
+IRPMONDLL_API BOOLEAN WINAPI IRPMonDllFilterProgramMatch(PREQUEST_FILTER_PROGRAM Program, const REQUEST_HEADER *Request)
+{
+	return RequestFilterProgramRun(Program, Request);
+}
+
+
+IRPMONDLL_API ULONG WINAPI IRPMonDllFilterProgramMatchBatch(PREQUEST_FILTER_PROGRAM Program, const REQUEST_HEADER * const *Requests, ULONG Count, PBOOLEAN Results)
+{
+	return (ULONG)RequestFilterProgramRunBatch(Program, Requests, Count, Results);
+}
+
+
+IRPMONDLL_API VOID WINAPI IRPMonDllFilterProgramFree(PREQUEST_FILTER_PROGRAM Program)
+{
+	RequestFilterProgramFree(Program);
+
+	return;
+}
+
+
+/************************************************************************/
+/*                  REPROCESSING                                        */
+/************************************************************************/
+
+
+IRPMONDLL_API DWORD WINAPI IRPMonDllReprocess(const IRPMON_REPROCESS_SETTINGS *Settings, const REQUEST_HEADER * const *Requests, ULONG Count, PIRPMON_REPROCESS_RESULT Results, PULONG Selected, PULONG SelectedCount)
+{
+	return ReprocessRun(Settings, Requests, Count, Results, Selected, SelectedCount);
+}
+
+
+IRPMONDLL_API VOID WINAPI IRPMonDllReprocessFree(const IRPMON_REPROCESS_SETTINGS *Settings, PIRPMON_REPROCESS_RESULT Results, ULONG Count)
+{
+	ReprocessFree(Settings, Results, Count);
+
+	return;
+}
+
+
 /************************************************************************/
 /*                          INITIALIZATION AND FINALIZATION             */
 /************************************************************************/
@@ -0,0 +1,312 @@
+
+#include <windows.h>
+#include "debug.h"
+#include "general-types.h"
+#include "data-parser-types.h"
+#include "dll-decider-types.h"
+#include "irpmondll-types.h"
+#include "request-filter-program.h"
+#include "reprocess.h"
+
+
+/************************************************************************/
+/*               TYPE DEFINITIONS                                       */
+/************************************************************************/
+
+/** Requests are handed out to the workers in chunks of this size. */
+#define REPROCESS_CHUNK_SIZE				1024
+
+typedef struct _REPROCESS_JOB {
+	const IRPMON_REPROCESS_SETTINGS *Settings;
+	const REQUEST_HEADER * const *Requests;
+	ULONG Count;
+	PIRPMON_REPROCESS_RESULT Results;
+	ULONG ChunkCount;
+	volatile LONG NextChunk;
+	/** Serializes calls to a decider that is not reentrant. */
+	CRITICAL_SECTION DeciderLock;
+	/** Serializes calls to an extra information routine that is not
+	    reentrant. */
+	CRITICAL_SECTION ExtraInfoLock;
+	/** One lock for each parser, taken only for parsers that are not
+	    reentrant. */
+	PCRITICAL_SECTION ParserLocks;
+} REPROCESS_JOB, *PREPROCESS_JOB;
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+static BOOLEAN _ParserReentrant(const IRPMON_DATA_PARSER *Parser)
+{
+	return (Parser->Version >= IRPMON_DATA_PARSER_VERSION_3 && (Parser->Flags & DP_FLAG_REENTRANT) != 0);
+}
+
+
+/** Decides about the request as the GUI does when the decider is the first
+ *  condition of its filter list.
+ *
+ *  @return
+ *  Returns TRUE if the decider included or excluded the request.
+ */
+static BOOLEAN _Decide(PREPROCESS_JOB Job, const REQUEST_HEADER *Request, PDP_REQUEST_EXTRA_INFO ExtraInfo, PIRPMON_REPROCESS_RESULT Result)
+{
+	DWORD err = ERROR_GEN_FAILURE;
+	EFilterAction action = ffaPassToFilter;
+	ULONG color = 0;
+	DLL_DECIDER_DECISION decision;
+	const IRPMON_REPROCESS_SETTINGS *s = Job->Settings;
+	BOOLEAN ret = FALSE;
+
+	memset(&decision, 0, sizeof(decision));
+	decision.Action = s->DeciderAction;
+	decision.HighlightColor = s->DeciderHighlightColor;
+	if ((s->DeciderFlags & DLL_DECIDER_FLAG_REENTRANT) == 0)
+		EnterCriticalSection(&Job->DeciderLock);
+
+	err = s->Decider((PREQUEST_GENERAL)Request, ExtraInfo, &decision);
+	if ((s->DeciderFlags & DLL_DECIDER_FLAG_REENTRANT) == 0)
+		LeaveCriticalSection(&Job->DeciderLock);
+
+	if (err == ERROR_SUCCESS && decision.Decided) {
+		action = s->DeciderAction;
+		color = s->DeciderHighlightColor;
+		if (decision.OverrideFilter) {
+			action = decision.Action;
+			color = decision.HighlightColor;
+		}
+
+		switch (action) {
+			case ffaInclude:
+				Result->Selected = TRUE;
+				ret = TRUE;
+				break;
+			case ffaExclude:
+				ret = TRUE;
+				break;
+			case ffaHighlight:
+				Result->Highlighted = TRUE;
+				Result->HighlightColor = color;
+				break;
+			default:
+				break;
+		}
+	}
+
+	return ret;
+}
+
+
+static void _Parse(PREPROCESS_JOB Job, const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PIRPMON_REPROCESS_RESULT Result)
+{
+	ULONG i = 0;
+	DWORD err = ERROR_GEN_FAILURE;
+	BOOLEAN handled = FALSE;
+	BOOLEAN reentrant = FALSE;
+	wchar_t **names = NULL;
+	wchar_t **values = NULL;
+	size_t rowCount = 0;
+	const IRPMON_DATA_PARSER *p = NULL;
+	const IRPMON_REPROCESS_SETTINGS *s = Job->Settings;
+
+	for (i = 0; i < s->ParserCount; ++i) {
+		p = s->Parsers[i];
+		reentrant = _ParserReentrant(p);
+		handled = FALSE;
+		if (!reentrant)
+			EnterCriticalSection(Job->ParserLocks + i);
+
+		err = p->ParseRoutine(Request, ExtraInfo, &handled, &names, &values, &rowCount);
+		if (!reentrant)
+			LeaveCriticalSection(Job->ParserLocks + i);
+
+		if (err == ERROR_SUCCESS && handled) {
+			Result->Parser = i;
+			Result->Names = names;
+			Result->Values = values;
+			Result->RowCount = rowCount;
+			break;
+		}
+	}
+
+	return;
+}
+
+
+static void _ProcessRequest(PREPROCESS_JOB Job, const REQUEST_HEADER *Request, PIRPMON_REPROCESS_RESULT Result)
+{
+	BOOLEAN decided = FALSE;
+	DP_REQUEST_EXTRA_INFO extraInfo;
+	const IRPMON_REPROCESS_SETTINGS *s = Job->Settings;
+
+	memset(Result, 0, sizeof(IRPMON_REPROCESS_RESULT));
+	Result->Parser = s->ParserCount;
+	memset(&extraInfo, 0, sizeof(extraInfo));
+	if (s->ExtraInfoRoutine != NULL) {
+		if ((s->Flags & IRPMON_REPROCESS_EXTRA_INFO_REENTRANT) == 0)
+			EnterCriticalSection(&Job->ExtraInfoLock);
+
+		s->ExtraInfoRoutine(Request, &extraInfo, s->Context);
+		if ((s->Flags & IRPMON_REPROCESS_EXTRA_INFO_REENTRANT) == 0)
+			LeaveCriticalSection(&Job->ExtraInfoLock);
+	}
+
+	if (s->Decider != NULL)
+		decided = _Decide(Job, Request, &extraInfo, Result);
+
+	if (!decided)
+		Result->Selected = (s->Filter == NULL || RequestFilterProgramRun(s->Filter, Request));
+
+	if (Result->Selected && s->ParserCount > 0)
+		_Parse(Job, Request, &extraInfo, Result);
+
+	return;
+}
+
+
+/** Takes chunks of requests until none is left. The chunks follow each
+ *  other in memory, the results need no merging besides collecting
+ *  the selected indices in order.
+ */
+static DWORD WINAPI _WorkerThread(PVOID Context)
+{
+	ULONG i = 0;
+	ULONG chunk = 0;
+	ULONG end = 0;
+	PREPROCESS_JOB job = (PREPROCESS_JOB)Context;
+
+	chunk = (ULONG)(InterlockedIncrement(&job->NextChunk) - 1);
+	while (chunk < job->ChunkCount) {
+		end = (chunk + 1)*REPROCESS_CHUNK_SIZE;
+		if (end > job->Count)
+			end = job->Count;
+
+		for (i = chunk*REPROCESS_CHUNK_SIZE; i < end; ++i)
+			_ProcessRequest(job, job->Requests[i], job->Results + i);
+
+		chunk = (ULONG)(InterlockedIncrement(&job->NextChunk) - 1);
+	}
+
+	return ERROR_SUCCESS;
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** Runs the decider, the filter and the parsers for an array of requests
+ *  on a pool of worker threads. The calling thread works as well, so
+ *  the requests are processed even if no worker can be started.
+ */
+DWORD ReprocessRun(const IRPMON_REPROCESS_SETTINGS *Settings, const REQUEST_HEADER * const *Requests, ULONG Count, PIRPMON_REPROCESS_RESULT Results, PULONG Selected, PULONG SelectedCount)
+{
+	ULONG i = 0;
+	ULONG threadCount = 0;
+	ULONG workerCount = 0;
+	ULONG selectedCount = 0;
+	HANDLE workers[MAXIMUM_WAIT_OBJECTS];
+	PREPROCESS_JOB job = NULL;
+	SYSTEM_INFO si;
+	DWORD ret = ERROR_GEN_FAILURE;
+	DEBUG_ENTER_FUNCTION("Settings=0x%p; Requests=0x%p; Count=%u; Results=0x%p; Selected=0x%p; SelectedCount=0x%p", Settings, Requests, Count, Results, Selected, SelectedCount);
+
+	ret = ERROR_NOT_ENOUGH_MEMORY;
+	job = (PREPROCESS_JOB)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(REPROCESS_JOB));
+	if (job != NULL) {
+		job->Settings = Settings;
+		job->Requests = Requests;
+		job->Count = Count;
+		job->Results = Results;
+		job->ChunkCount = (ULONG)(((ULONG64)Count + REPROCESS_CHUNK_SIZE - 1) / REPROCESS_CHUNK_SIZE);
+		ret = ERROR_SUCCESS;
+		if (Settings->ParserCount > 0) {
+			job->ParserLocks = (PCRITICAL_SECTION)HeapAlloc(GetProcessHeap(), 0, Settings->ParserCount*sizeof(CRITICAL_SECTION));
+			if (job->ParserLocks == NULL)
+				ret = ERROR_NOT_ENOUGH_MEMORY;
+		}
+
+		if (ret == ERROR_SUCCESS) {
+			InitializeCriticalSection(&job->DeciderLock);
+			InitializeCriticalSection(&job->ExtraInfoLock);
+			for (i = 0; i < Settings->ParserCount; ++i)
+				InitializeCriticalSection(job->ParserLocks + i);
+
+			threadCount = Settings->ThreadCount;
+			if (threadCount == 0) {
+				GetSystemInfo(&si);
+				threadCount = si.dwNumberOfProcessors;
+			}
+
+			if (threadCount > job->ChunkCount)
+				threadCount = job->ChunkCount;
+
+			if (threadCount > MAXIMUM_WAIT_OBJECTS + 1)
+				threadCount = MAXIMUM_WAIT_OBJECTS + 1;
+
+			for (i = 1; i < threadCount; ++i) {
+				workers[workerCount] = CreateThread(NULL, 0, _WorkerThread, job, 0, NULL);
+				if (workers[workerCount] == NULL)
+					break;
+
+				++workerCount;
+			}
+
+			_WorkerThread(job);
+			if (workerCount > 0)
+				WaitForMultipleObjects(workerCount, workers, TRUE, INFINITE);
+
+			for (i = 0; i < workerCount; ++i)
+				CloseHandle(workers[i]);
+
+			for (i = 0; i < Count; ++i) {
+				if (Results[i].Selected) {
+					if (Selected != NULL)
+						Selected[selectedCount] = i;
+
+					++selectedCount;
+				}
+			}
+
+			if (SelectedCount != NULL)
+				*SelectedCount = selectedCount;
+
+			for (i = 0; i < Settings->ParserCount; ++i)
+				DeleteCriticalSection(job->ParserLocks + i);
+
+			DeleteCriticalSection(&job->ExtraInfoLock);
+			DeleteCriticalSection(&job->DeciderLock);
+		}
+
+		if (job->ParserLocks != NULL)
+			HeapFree(GetProcessHeap(), 0, job->ParserLocks);
+
+		HeapFree(GetProcessHeap(), 0, job);
+	}
+
+	DEBUG_EXIT_FUNCTION("%u", ret);
+	return ret;
+}
+
+
+VOID ReprocessFree(const IRPMON_REPROCESS_SETTINGS *Settings, PIRPMON_REPROCESS_RESULT Results, ULONG Count)
+{
+	ULONG i = 0;
+	DEBUG_ENTER_FUNCTION("Settings=0x%p; Results=0x%p; Count=%u", Settings, Results, Count);
+
+	for (i = 0; i < Count; ++i) {
+		if (Results[i].Parser < Settings->ParserCount) {
+			Settings->Parsers[Results[i].Parser]->FreeRoutine(Results[i].Names, Results[i].Values, Results[i].RowCount);
+			Results[i].Parser = Settings->ParserCount;
+			Results[i].Names = NULL;
+			Results[i].Values = NULL;
+			Results[i].RowCount = 0;
+		}
+	}
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
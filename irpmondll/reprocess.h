@@ -0,0 +1,25 @@
+
+#ifndef __IRPMONDLL_REPROCESS_H__
+#define __IRPMONDLL_REPROCESS_H__
+
+#include <windows.h>
+#include "general-types.h"
+#include "irpmondll-types.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+DWORD ReprocessRun(const IRPMON_REPROCESS_SETTINGS *Settings, const REQUEST_HEADER * const *Requests, ULONG Count, PIRPMON_REPROCESS_RESULT Results, PULONG Selected, PULONG SelectedCount);
+VOID ReprocessFree(const IRPMON_REPROCESS_SETTINGS *Settings, PIRPMON_REPROCESS_RESULT Results, ULONG Count);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
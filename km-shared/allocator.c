@@ -401,3 +401,267 @@ VOID DebugAllocatorModuleFinit(VOID)
    DEBUG_EXIT_FUNCTION_VOID();
    return;
 }
+
+
+/************************************************************************/
+/*                        SIZE-CLASS CACHES                             */
+/************************************************************************/
+
+/*
+ * A size-class cache keeps one lookaside list per size class and processor.
+ * Blocks are allocated from the lists of the current processor and always
+ * returned to the list they came from, so a consumer running on another
+ * processor does not drain the lists used by the producers. Every block is
+ * preceded by a small header recording its origin; the header keeps the block
+ * aligned to MEMORY_ALLOCATION_ALIGNMENT. Requests too large for the biggest
+ * class go directly to the pool.
+ */
+
+/** Value of the ClassIndex member of a block allocated directly from the pool. */
+#define SIZE_CLASS_DIRECT                  ((ULONG)-1)
+
+/** Header preceding every block returned by a size-class cache. */
+typedef union _SIZE_CLASS_BLOCK_HEADER {
+   struct {
+      /** Index of the size class, or SIZE_CLASS_DIRECT. */
+      ULONG ClassIndex;
+      /** Index of the processor whose list the block belongs to. */
+      ULONG CpuIndex;
+   } Origin;
+   UCHAR Alignment[MEMORY_ALLOCATION_ALIGNMENT];
+} SIZE_CLASS_BLOCK_HEADER, *PSIZE_CLASS_BLOCK_HEADER;
+
+C_ASSERT(sizeof(SIZE_CLASS_BLOCK_HEADER) == MEMORY_ALLOCATION_ALIGNMENT);
+
+/** Lookaside list for one size class on one processor. */
+typedef struct _SIZE_CLASS_LIST {
+   LOOKASIDE_LIST_EX Lookaside;
+   /** Number of blocks allocated from the list. */
+   volatile LONG64 Allocations;
+   /** Number of allocations the list could not serve from its free blocks. */
+   volatile LONG64 Misses;
+   /** Number of blocks returned to the list. */
+   volatile LONG64 Frees;
+} SIZE_CLASS_LIST, *PSIZE_CLASS_LIST;
+
+struct _SIZE_CLASS_CACHE {
+   POOL_TYPE PoolType;
+   ULONG ClassCount;
+   /** Usable sizes of the classes, in ascending order. */
+   ULONG ClassSizes[SIZE_CLASS_CACHE_MAX_CLASSES];
+   ULONG CpuCount;
+   /** Lists of all processors; ClassCount lists per processor. */
+   PSIZE_CLASS_LIST Lists;
+   /** Number of blocks allocated directly from the pool. */
+   volatile LONG64 DirectAllocations;
+   /** Number of directly allocated blocks freed. */
+   volatile LONG64 DirectFrees;
+};
+
+
+static ALLOCATE_FUNCTION_EX _SizeClassListAllocate;
+
+/** Called by a lookaside list that has no free block to give. Counts the miss.
+ */
+static PVOID _SizeClassListAllocate(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag, PLOOKASIDE_LIST_EX Lookaside)
+{
+   PVOID ret = NULL;
+   PSIZE_CLASS_LIST list = CONTAINING_RECORD(Lookaside, SIZE_CLASS_LIST, Lookaside);
+
+   ret = ExAllocatePoolWithTag(PoolType, NumberOfBytes, Tag);
+   if (ret != NULL)
+      InterlockedIncrement64(&list->Misses);
+
+   return ret;
+}
+
+
+/** Creates a size-class cache.
+ *
+ *  @param PoolType Memory pool the blocks are allocated from.
+ *  @param ClassSizes Block sizes served by the cache, in ascending order.
+ *  @param ClassCount Number of the size classes. Must not exceed SIZE_CLASS_CACHE_MAX_CLASSES.
+ *  @param Cache Receives address of the new cache.
+ *
+ *  @return
+ *  Returns NTSTATUS value indicating success or failure of the operation.
+ */
+NTSTATUS SizeClassCacheCreate(POOL_TYPE PoolType, const ULONG *ClassSizes, ULONG ClassCount, PSIZE_CLASS_CACHE *Cache)
+{
+   ULONG i = 0;
+   ULONG listCount = 0;
+   PSIZE_CLASS_CACHE tmpCache = NULL;
+   NTSTATUS status = STATUS_UNSUCCESSFUL;
+   DEBUG_ENTER_FUNCTION("PoolType=%u; ClassSizes=0x%p; ClassCount=%u; Cache=0x%p", PoolType, ClassSizes, ClassCount, Cache);
+
+   status = STATUS_INVALID_PARAMETER;
+   if (ClassCount > 0 && ClassCount <= SIZE_CLASS_CACHE_MAX_CLASSES) {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      tmpCache = (PSIZE_CLASS_CACHE)HeapMemoryAllocNonPaged(sizeof(SIZE_CLASS_CACHE));
+      if (tmpCache != NULL) {
+         memset(tmpCache, 0, sizeof(SIZE_CLASS_CACHE));
+         tmpCache->PoolType = PoolType;
+         tmpCache->ClassCount = ClassCount;
+         memcpy(tmpCache->ClassSizes, ClassSizes, ClassCount*sizeof(ULONG));
+         tmpCache->CpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+         listCount = tmpCache->CpuCount*ClassCount;
+         tmpCache->Lists = (PSIZE_CLASS_LIST)HeapMemoryAllocNonPaged(listCount*sizeof(SIZE_CLASS_LIST));
+         if (tmpCache->Lists != NULL) {
+            memset(tmpCache->Lists, 0, listCount*sizeof(SIZE_CLASS_LIST));
+            status = STATUS_SUCCESS;
+            for (i = 0; i < listCount; ++i) {
+               status = ExInitializeLookasideListEx(&tmpCache->Lists[i].Lookaside, _SizeClassListAllocate, NULL, PoolType, 0, sizeof(SIZE_CLASS_BLOCK_HEADER) + ClassSizes[i % ClassCount], _poolTag, 0);
+               if (!NT_SUCCESS(status))
+                  break;
+            }
+
+            if (NT_SUCCESS(status))
+               *Cache = tmpCache;
+
+            if (!NT_SUCCESS(status)) {
+               while (i > 0) {
+                  --i;
+                  ExDeleteLookasideListEx(&tmpCache->Lists[i].Lookaside);
+               }
+
+               HeapMemoryFree(tmpCache->Lists);
+            }
+         }
+
+         if (!NT_SUCCESS(status))
+            HeapMemoryFree(tmpCache);
+      }
+   }
+
+   DEBUG_EXIT_FUNCTION("0x%x, *Cache=0x%p", status, *Cache);
+   return status;
+}
+
+
+/** Destroys a size-class cache. All blocks allocated from the cache must
+ *  already be freed.
+ */
+VOID SizeClassCacheDestroy(PSIZE_CLASS_CACHE Cache)
+{
+   ULONG i = 0;
+   DEBUG_ENTER_FUNCTION("Cache=0x%p", Cache);
+
+   ASSERT(Cache->DirectAllocations == Cache->DirectFrees);
+   for (i = 0; i < Cache->CpuCount*Cache->ClassCount; ++i) {
+      ASSERT(Cache->Lists[i].Allocations == Cache->Lists[i].Frees);
+      ExDeleteLookasideListEx(&Cache->Lists[i].Lookaside);
+   }
+
+   HeapMemoryFree(Cache->Lists);
+   HeapMemoryFree(Cache);
+
+   DEBUG_EXIT_FUNCTION_VOID();
+   return;
+}
+
+
+/** Allocates a block from a size-class cache.
+ *
+ *  @param Cache The cache.
+ *  @param NumberOfBytes Size of the block, in bytes.
+ *
+ *  @return
+ *  Returns address of the block, aligned to MEMORY_ALLOCATION_ALIGNMENT,
+ *  or NULL on failure. The block is not zeroed.
+ *
+ *  @remark
+ *  When MEMORY_LEAK_DETECTION is defined, all blocks go directly through
+ *  HeapMemoryAlloc so the debug allocator can track them.
+ */
+PVOID SizeClassCacheAlloc(PSIZE_CLASS_CACHE Cache, SIZE_T NumberOfBytes)
+{
+   ULONG i = 0;
+   ULONG classIndex = 0;
+   ULONG cpuIndex = 0;
+   PSIZE_CLASS_LIST list = NULL;
+   PSIZE_CLASS_BLOCK_HEADER header = NULL;
+
+   classIndex = SIZE_CLASS_DIRECT;
+#ifndef MEMORY_LEAK_DETECTION
+   for (i = 0; i < Cache->ClassCount; ++i) {
+      if (NumberOfBytes <= Cache->ClassSizes[i]) {
+         classIndex = i;
+         break;
+      }
+   }
+#endif
+
+   if (classIndex != SIZE_CLASS_DIRECT) {
+      cpuIndex = KeGetCurrentProcessorNumberEx(NULL) % Cache->CpuCount;
+      list = &Cache->Lists[cpuIndex*Cache->ClassCount + classIndex];
+      header = (PSIZE_CLASS_BLOCK_HEADER)ExAllocateFromLookasideListEx(&list->Lookaside);
+      if (header != NULL)
+         InterlockedIncrement64(&list->Allocations);
+   } else {
+      header = (PSIZE_CLASS_BLOCK_HEADER)HeapMemoryAlloc(Cache->PoolType, sizeof(SIZE_CLASS_BLOCK_HEADER) + NumberOfBytes);
+      if (header != NULL)
+         InterlockedIncrement64(&Cache->DirectAllocations);
+   }
+
+   if (header != NULL) {
+      header->Origin.ClassIndex = classIndex;
+      header->Origin.CpuIndex = cpuIndex;
+      ++header;
+   }
+
+   return header;
+}
+
+
+/** Returns a block to the cache it was allocated from.
+ *
+ *  @param Cache The cache that allocated the block.
+ *  @param Address Address of the block, returned by SizeClassCacheAlloc.
+ */
+VOID SizeClassCacheFree(PSIZE_CLASS_CACHE Cache, PVOID Address)
+{
+   PSIZE_CLASS_LIST list = NULL;
+   PSIZE_CLASS_BLOCK_HEADER header = (PSIZE_CLASS_BLOCK_HEADER)Address - 1;
+
+   if (header->Origin.ClassIndex != SIZE_CLASS_DIRECT) {
+      ASSERT(header->Origin.ClassIndex < Cache->ClassCount);
+      ASSERT(header->Origin.CpuIndex < Cache->CpuCount);
+      list = &Cache->Lists[header->Origin.CpuIndex*Cache->ClassCount + header->Origin.ClassIndex];
+      InterlockedIncrement64(&list->Frees);
+      ExFreeToLookasideListEx(&list->Lookaside, header);
+   } else {
+      InterlockedIncrement64(&Cache->DirectFrees);
+      HeapMemoryFree(header);
+   }
+
+   return;
+}
+
+
+/** Sums the counters of all lists of a size-class cache. The result is only
+ *  approximate when other threads use the cache at the same time.
+ */
+VOID SizeClassCacheQueryStatistics(PSIZE_CLASS_CACHE Cache, PSIZE_CLASS_CACHE_STATISTICS Statistics)
+{
+   ULONG i = 0;
+   LONG64 allocations = 0;
+   LONG64 misses = 0;
+   LONG64 frees = 0;
+   PSIZE_CLASS_LIST list = NULL;
+
+   allocations = Cache->DirectAllocations;
+   misses = Cache->DirectAllocations;
+   frees = Cache->DirectFrees;
+   for (i = 0; i < Cache->CpuCount*Cache->ClassCount; ++i) {
+      list = &Cache->Lists[i];
+      allocations += list->Allocations;
+      misses += list->Misses;
+      frees += list->Frees;
+   }
+
+   Statistics->Misses = misses;
+   Statistics->Hits = (allocations > misses) ? allocations - misses : 0;
+   Statistics->Outstanding = allocations - frees;
+
+   return;
+}
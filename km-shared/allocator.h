@@ -3,7 +3,8 @@
  * @file
  *
  * Header file exporting routines of our special memory allocator capable of
- * detecting memory leaks and buffer overflows.
+ * detecting memory leaks and buffer overflows, and of the size-class caches
+ * built on top of lookaside lists.
  */
 
 #ifndef __PNPMON_ALLOCATOR_H__
@@ -41,6 +42,10 @@ typedef struct {
 } DEBUG_BLOCK_FOOTER, *PDEBUG_BLOCK_FOOTER;
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 PVOID DebugAllocatorAlloc(POOL_TYPE PoolType, SIZE_T NumberOfBytes, PCHAR Function, ULONG Line);
 VOID DebugAllocatorFree(PVOID Address);
 
@@ -69,4 +74,31 @@ NTSTATUS DebugAllocatorModuleInit(VOID);
 VOID DebugAllocatorModuleFinit(VOID);
 
 
+/// Maximum number of size classes a size-class cache can serve.
+#define SIZE_CLASS_CACHE_MAX_CLASSES           8
+
+/// Counters describing the efficiency of a size-class cache.
+typedef struct _SIZE_CLASS_CACHE_STATISTICS {
+   /// Number of allocations served by a lookaside list without touching the pool.
+   ULONG64 Hits;
+   /// Number of allocations that had to be satisfied by the pool, including
+   /// those too large for any size class.
+   ULONG64 Misses;
+   /// Number of blocks allocated but not yet freed.
+   LONG64 Outstanding;
+} SIZE_CLASS_CACHE_STATISTICS, *PSIZE_CLASS_CACHE_STATISTICS;
+
+typedef struct _SIZE_CLASS_CACHE SIZE_CLASS_CACHE, *PSIZE_CLASS_CACHE;
+
+NTSTATUS SizeClassCacheCreate(POOL_TYPE PoolType, const ULONG *ClassSizes, ULONG ClassCount, PSIZE_CLASS_CACHE *Cache);
+VOID SizeClassCacheDestroy(PSIZE_CLASS_CACHE Cache);
+PVOID SizeClassCacheAlloc(PSIZE_CLASS_CACHE Cache, SIZE_T NumberOfBytes);
+VOID SizeClassCacheFree(PSIZE_CLASS_CACHE Cache, PVOID Address);
+VOID SizeClassCacheQueryStatistics(PSIZE_CLASS_CACHE Cache, PSIZE_CLASS_CACHE_STATISTICS Statistics);
+
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif
@@ -8,7 +8,7 @@
  * can be used to store any kind of data and use any data type as a key.
  *
  * When creating a general hash table, the user specifies four parameters:
- * 1) number of buckets of the table,
+ * 1) initial number of buckets of the table,
  * 2) a hash function used to convert values of the key to hashes,
  * 3) a compare function that is used to determine whether a table item
  *    corresponds to a given key,
@@ -17,6 +17,23 @@
  *
  * General hash tables solves collisions by chaining.
  *
+ * When the table contains more items than buckets, it allocates a bucket
+ * array twice as large and migrates the items into it gradually, so no
+ * single operation needs to rehash the whole table. Buckets are guarded
+ * by a fixed number of locks (equal to the initial number of buckets),
+ * the item always stays under the same lock, so each lock can migrate its
+ * own buckets independently. Insertions and deletions migrate buckets of
+ * the lock they work with, and every insertion and deletion migrates buckets
+ * of one more lock. Lookups never migrate anything, they take their lock in
+ * shared mode only. Only switching the bucket arrays needs all the locks,
+ * and no items are touched while they are held.
+ *
+ * Resizing allocates and frees nonpaged memory, so it is done only by
+ * insertions and deletions running at IRQL <= DISPATCH_LEVEL. Above that
+ * IRQL (possible for no-synchronization tables only), the table keeps its
+ * size and the operations just use the bucket array their lock currently
+ * points to.
+ *
  * Probably the most interesting feature is that no memory allocations
  * are needed when inserting items to the table because table contents
  * is linked together using spare fields in the data (the data records
@@ -104,6 +121,16 @@
 
 #endif
 
+/** Computes index of the lock guarding items with a given hash. */
+#define HASH_TABLE_LOCK_INDEX(aTable, aHash)      ((aHash) % (aTable)->LockCount)
+
+/** Determines whether the current IRQL allows to allocate and free memory
+ *  needed to resize a table. */
+#define HASH_TABLE_RESIZABLE()                    (KeGetCurrentIrql() <= DISPATCH_LEVEL)
+
+/** The table does not grow beyond this number of buckets. */
+#define HASH_TABLE_MAX_SIZE                       0x10000000
+
 /************************************************************************/
 /*                           HELPER FUNCTIONS                           */
 /************************************************************************/
@@ -111,7 +138,7 @@
 /** Locks a given table bucket for shared access.
  *
  *  @param Table Table which bucket is about to be locked.
- *  @param Index A zero-based index of the bucket to lock.
+ *  @param Index A zero-based index of the lock guarding the bucket.
  *  @param Irql Address of variable. If the table is not a dispatch IRQL
  *  one, this parameter is ignored. Otherwise, the variable is filled with
  *  the current IRQL value just before the locking in shared mode is performed.
@@ -125,7 +152,7 @@
 static VOID HashTableLockShared(PHASH_TABLE Table, ULONG32 Index, PKIRQL Irql)
 {
    HASH_TABLE_IRQL_VALIDATE(Table);
-   ASSERT(Index < Table->Size);
+   ASSERT(Index < Table->LockCount);
 
    switch (Table->Type) {
       case httPassiveLevel:
@@ -148,7 +175,7 @@ static VOID HashTableLockShared(PHASH_TABLE Table, ULONG32 Index, PKIRQL Irql)
 /** Locks a given table bucket for exclusive access.
  *
  *  @param Table Table which bucket is about to be locked.
- *  @param Index A zero-based index of the bucket to lock.
+ *  @param Index A zero-based index of the lock guarding the bucket.
  *  @param Irql Address of variable. If the table is not a dispatch IRQL
  *  one, this parameter is ignored. Otherwise, the variable is filled with
  *  the current IRQL value just before the locking in exclusive mode is performed.
@@ -162,7 +189,7 @@ static VOID HashTableLockShared(PHASH_TABLE Table, ULONG32 Index, PKIRQL Irql)
 static VOID HashTableLockExclusive(PHASH_TABLE Table, ULONG32 Index, PKIRQL Irql)
 {
    HASH_TABLE_IRQL_VALIDATE(Table);
-   ASSERT(Index < Table->Size);
+   ASSERT(Index < Table->LockCount);
 
    switch (Table->Type) {
       case httPassiveLevel:
@@ -186,7 +213,7 @@ static VOID HashTableLockExclusive(PHASH_TABLE Table, ULONG32 Index, PKIRQL Irql
 /** Unlocks a given bucket of a general hash table.
  *
  *  @param Table A hash table the bucket of which is to be unlocked.
- *  @param Index A zero-based index of the bucked to unlock.
+ *  @param Index A zero-based index of the lock guarding the bucket.
  *  @param Irql A value of IRQL the caller had been running before the table
  *  was locked. The parameter is ignored for passive IRQL tables and tables access
  *  to whom is not synchronized.
@@ -200,7 +227,7 @@ static VOID HashTableLockExclusive(PHASH_TABLE Table, ULONG32 Index, PKIRQL Irql
 static VOID HashTableUnlock(PHASH_TABLE Table, ULONG32 Index, KIRQL Irql)
 {
    HASH_TABLE_IRQL_VALIDATE(Table);
-   ASSERT(Index < Table->Size);
+   ASSERT(Index < Table->LockCount);
 
    switch (Table->Type) {
       case httPassiveLevel:
@@ -245,9 +272,9 @@ static NTSTATUS _HashTableSynchronizationAlloc(PHASH_TABLE Table)
 
    switch (Table->Type) {
       case httPassiveLevel:
-         Table->Locks = (PERESOURCE)HeapMemoryAlloc(NonPagedPool, Table->Size * sizeof(ERESOURCE));
+         Table->Locks = (PERESOURCE)HeapMemoryAlloc(NonPagedPool, Table->LockCount * sizeof(ERESOURCE));
          if (Table->Locks != NULL) {
-            for (i = 0; i < (LONG)Table->Size; ++i) {
+            for (i = 0; i < (LONG)Table->LockCount; ++i) {
                status = ExInitializeResourceLite(&Table->Locks[i]);
                if (!NT_SUCCESS(status)) {
                   for (j = i - 1; j >= 0; --j) {
@@ -265,11 +292,11 @@ static NTSTATUS _HashTableSynchronizationAlloc(PHASH_TABLE Table)
          } else status = STATUS_INSUFFICIENT_RESOURCES;
          break;
       case httDispatchLevel:
-         Table->DispatchLockExclusive = (PBOOLEAN)HeapMemoryAlloc(NonPagedPool, Table->Size * sizeof(BOOLEAN));
+         Table->DispatchLockExclusive = (PBOOLEAN)HeapMemoryAlloc(NonPagedPool, Table->LockCount * sizeof(BOOLEAN));
          if (Table->DispatchLockExclusive != NULL) {
-            Table->DispatchLocks = (PKSPIN_LOCK)HeapMemoryAlloc(NonPagedPool, Table->Size * sizeof(KSPIN_LOCK));
+            Table->DispatchLocks = (PKSPIN_LOCK)HeapMemoryAlloc(NonPagedPool, Table->LockCount * sizeof(KSPIN_LOCK));
             if (Table->DispatchLocks != NULL) {
-               for (i = 0; i < (LONG)Table->Size; ++i) {
+               for (i = 0; i < (LONG)Table->LockCount; ++i) {
                   Table->DispatchLockExclusive[i] = FALSE;
                   KeInitializeSpinLock(&Table->DispatchLocks[i]);
                }
@@ -312,7 +339,7 @@ static VOID _HashTableSynchronizationFree(PHASH_TABLE Table)
 
    switch (Table->Type) {
       case httPassiveLevel:
-         for (i = (LONG)Table->Size - 1; i >= 0; --i) {
+         for (i = (LONG)Table->LockCount - 1; i >= 0; --i) {
             ExDeleteResourceLite(&Table->Locks[i]);
          }
 
@@ -336,6 +363,243 @@ static VOID _HashTableSynchronizationFree(PHASH_TABLE Table)
    return;
 }
 
+/** Locks all locks of a given table for exclusive access, in the order
+ *  of their indices.
+ *
+ *  @param Table The table to lock.
+ *  @param Irql Address of variable that receives the IRQL value before
+ *  the first lock was acquired. Used by dispatch IRQL tables only.
+ */
+static VOID _HashTableLockAll(PHASH_TABLE Table, PKIRQL Irql)
+{
+   KIRQL irql;
+   ULONG32 i = 0;
+
+   for (i = 0; i < Table->LockCount; ++i) {
+      HashTableLockExclusive(Table, i, (i == 0) ? Irql : &irql);
+   }
+
+   return;
+}
+
+/** Releases all locks of a given table acquired by @link(_HashTableLockAll).
+ *
+ *  @param Table The table to unlock.
+ *  @param Irql The IRQL value returned by the _HashTableLockAll call.
+ */
+static VOID _HashTableUnlockAll(PHASH_TABLE Table, KIRQL Irql)
+{
+   LONG i = 0;
+
+   for (i = (LONG)Table->LockCount - 1; i >= 0; --i) {
+      HashTableUnlock(Table, i, (i == 0) ? Irql : DISPATCH_LEVEL);
+   }
+
+   return;
+}
+
+/** Retrieves the bucket array holding items guarded by a given lock.
+ *
+ *  @param Table The table in question.
+ *  @param Lock Index of the lock. The caller must hold it.
+ *  @param Size Address of variable that receives number of buckets of
+ *  the array.
+ *
+ *  @return
+ *  Returns the old bucket array if the table is being resized and the buckets
+ *  of the lock have not been migrated yet. Otherwise, the current bucket
+ *  array is returned.
+ */
+static PHASH_ITEM *_HashTableLockBuckets(PHASH_TABLE Table, ULONG32 Lock, PULONG32 Size)
+{
+   PHASH_ITEM *ret = NULL;
+
+   ret = Table->Buckets;
+   *Size = Table->Size;
+   if (Table->OldBuckets != NULL && !Table->Migrated[Lock]) {
+      ret = Table->OldBuckets;
+      *Size = Table->OldSize;
+   }
+
+   return ret;
+}
+
+/** Moves items guarded by a given lock from the old bucket array to the
+ *  current one.
+ *
+ *  @param Table The table being resized.
+ *  @param Lock Index of the lock. The caller must hold it exclusively.
+ *
+ *  @return
+ *  Returns the old bucket array if buckets of all locks are migrated now.
+ *  The array is detached from the table and the caller must free it after
+ *  releasing the lock. Otherwise, NULL is returned.
+ *
+ *  @remark
+ *  If the table is not being resized, or the buckets have already been migrated,
+ *  the routine does nothing.
+ *
+ *  The old array is detached while the lock is held, so a new resize cannot
+ *  start before it is gone.
+ */
+static PHASH_ITEM *_HashTableMigrate(PHASH_TABLE Table, ULONG32 Lock)
+{
+   ULONG32 i = 0;
+   ULONG32 index = 0;
+   PHASH_ITEM item = NULL;
+   PHASH_ITEM next = NULL;
+   PHASH_ITEM *ret = NULL;
+
+   if (Table->OldBuckets != NULL && !Table->Migrated[Lock]) {
+      for (i = Lock; i < Table->OldSize; i += Table->LockCount) {
+         item = Table->OldBuckets[i];
+         while (item != NULL) {
+            next = item->Next;
+            index = item->Hash % Table->Size;
+            item->Next = Table->Buckets[index];
+            Table->Buckets[index] = item;
+            item = next;
+         }
+
+         Table->OldBuckets[i] = NULL;
+      }
+
+      Table->Migrated[Lock] = TRUE;
+      if ((ULONG32)InterlockedIncrement(&Table->MigratedCount) == Table->LockCount) {
+         ret = (PHASH_ITEM *)InterlockedExchangePointer((PVOID volatile *)&Table->OldBuckets, NULL);
+      }
+   }
+
+   return ret;
+}
+
+/** Migrates buckets of the lock the migration cursor points to, in order
+ *  to finish the resize even if the operations keep using only a few locks.
+ *
+ *  @param Table The table in question.
+ *
+ *  @remark
+ *  The caller must not hold any lock of the table and must run at
+ *  IRQL <= DISPATCH_LEVEL.
+ */
+static VOID _HashTableMigrationStep(PHASH_TABLE Table)
+{
+   KIRQL irql;
+   ULONG32 lock = 0;
+   PHASH_ITEM *old = NULL;
+
+   if (Table->OldBuckets != NULL) {
+      lock = (ULONG32)(InterlockedIncrement(&Table->MigrationCursor) - 1);
+      if (lock < Table->LockCount) {
+         HashTableLockExclusive(Table, lock, &irql);
+         old = _HashTableMigrate(Table, lock);
+         HashTableUnlock(Table, lock, irql);
+         if (old != NULL) {
+            HeapMemoryFree(old);
+         }
+      }
+   }
+
+   return;
+}
+
+/** Starts resizing of a given table. Allocates a bucket array twice as large
+ *  as the current one and makes it current, the items are migrated later.
+ *
+ *  @param Table The table to resize.
+ *  @param Size Number of buckets the caller found the table to have. If
+ *  another thread has resized the table meanwhile, the routine does nothing.
+ *
+ *  @remark
+ *  All locks are held while the bucket arrays are being switched. The work
+ *  done under them does not depend on number of items in the table.
+ *
+ *  If there is not enough memory, the table just keeps its size.
+ *
+ *  The caller must not hold any lock of the table.
+ */
+static VOID _HashTableResizeStart(PHASH_TABLE Table, ULONG32 Size)
+{
+   KIRQL irql;
+   ULONG32 i = 0;
+   PHASH_ITEM *buckets = NULL;
+   DEBUG_ENTER_FUNCTION("Table=0x%p; Size=%u", Table, Size);
+
+   buckets = (PHASH_ITEM *)HeapMemoryAlloc(NonPagedPool, Size * 2 * sizeof(PHASH_ITEM));
+   if (buckets != NULL) {
+      RtlZeroMemory(buckets, Size * 2 * sizeof(PHASH_ITEM));
+      _HashTableLockAll(Table, &irql);
+      if (Table->OldBuckets == NULL && Table->Size == Size) {
+         for (i = 0; i < Table->LockCount; ++i) {
+            Table->Migrated[i] = FALSE;
+         }
+
+         Table->MigratedCount = 0;
+         Table->MigrationCursor = 0;
+         Table->OldSize = Size;
+         Table->OldBuckets = Table->Buckets;
+         Table->Size = Size * 2;
+         Table->Buckets = buckets;
+         Table->NumberOfResizes++;
+         buckets = NULL;
+      }
+
+      _HashTableUnlockAll(Table, irql);
+      if (buckets != NULL) {
+         HeapMemoryFree(buckets);
+      }
+   }
+
+   DEBUG_EXIT_FUNCTION_VOID();
+   return;
+}
+
+/** Finds the first item guarded by a given lock, or by one of the locks
+ *  following it, and makes the iterator to represent it.
+ *
+ *  @param Table The table being iterated.
+ *  @param FirstLock Index of the first lock to search.
+ *  @param Iterator The iterator to fill.
+ *
+ *  @return
+ *  Returns TRUE if an item was found. Its lock is held in shared mode.
+ *  Otherwise, no lock is held.
+ */
+static BOOLEAN _HashTableIteratorFind(PHASH_TABLE Table, ULONG32 FirstLock, PHASH_TABLE_ITERATOR Iterator)
+{
+   KIRQL irql;
+   ULONG32 i = 0;
+   ULONG32 j = 0;
+   ULONG32 size = 0;
+   PHASH_ITEM *buckets = NULL;
+   BOOLEAN ret = FALSE;
+
+   for (i = FirstLock; i < Table->LockCount; ++i) {
+      HashTableLockShared(Table, i, &irql);
+      buckets = _HashTableLockBuckets(Table, i, &size);
+      for (j = i; j < size; j += Table->LockCount) {
+         ret = buckets[j] != NULL;
+         if (ret) {
+            Iterator->PointsToEnd = FALSE;
+            Iterator->CurrentLock = i;
+            Iterator->CurrentIndex = j;
+            Iterator->CurrentItem = buckets[j];
+            Iterator->Irql = irql;
+            Iterator->Table = Table;
+            break;
+         }
+      }
+
+      if (ret) {
+         break;
+      }
+
+      HashTableUnlock(Table, i, irql);
+   }
+
+   return ret;
+}
+
 /************************************************************************/
 /*                   PUBLIC FUNCTIONS                                   */
 /************************************************************************/
@@ -348,8 +612,10 @@ static VOID _HashTableSynchronizationFree(PHASH_TABLE Table)
  *    @value httDispatchLevel A dispatch IRQL table, accessible at IRQL <= DISPATCH_LEVEL
  *    and synchronized via a reader-writer spin lock.
  *    @value httNoSynchronization A table accessible at any IRQL and with no synchronization
- *    employed.
- *  @param Size Number of buckets of the new table.
+ *    employed. The table grows only when modified at IRQL <= DISPATCH_LEVEL.
+ *  @param Size Initial number of buckets of the new table. The table grows
+ *  automatically, however, the value also determines number of locks
+ *  guarding the buckets.
  *  @param HashFunction Address of a hash function for the new table.
  *  @param CompareFunction Address of a compare function for the new table.
  *  @param FreeFunction Address of a free function for the new table. If this
@@ -374,24 +640,36 @@ NTSTATUS HashTableCreate(EHashTableType Type, ULONG32 Size, IN HASH_FUNCTION Has
 {
    PHASH_TABLE tmpTable = NULL;
    NTSTATUS status = STATUS_UNSUCCESSFUL;
-   SIZE_T tableLength = sizeof(HASH_TABLE) + Size * sizeof(PHASH_ITEM);
+   SIZE_T tableLength = sizeof(HASH_TABLE) + Size * sizeof(BOOLEAN);
    DEBUG_ENTER_FUNCTION("Type=%u; Size=%u; HashFunction=0x%p; CompareFunction=0x%p; FreeFunction=0x%p; Table=0x%p", Type, Size, HashFunction, CompareFunction, FreeFunction, Table);
    DEBUG_IRQL_LESS_OR_EQUAL(DISPATCH_LEVEL);
 
    if ((Type == httPassiveLevel || Type == httDispatchLevel || Type == httNoSynchronization) && 
-       Size > 0 && HashFunction != NULL && CompareFunction != NULL) {
+       Size > 0 && Size <= HASH_TABLE_MAX_SIZE && HashFunction != NULL && CompareFunction != NULL) {
       tmpTable = (PHASH_TABLE)HeapMemoryAlloc(NonPagedPool, tableLength);
       if (tmpTable != NULL) {
          RtlZeroMemory(tmpTable, tableLength);
          tmpTable->Type = Type;
          tmpTable->Size = Size;
+         tmpTable->LockCount = Size;
+         tmpTable->Migrated = (PBOOLEAN)(tmpTable + 1);
          tmpTable->HashFunction = HashFunction;
          tmpTable->CompareFunction = CompareFunction;
          tmpTable->FreeFunction = FreeFunction;
          tmpTable->NumberOfItems = 0;
-         status = _HashTableSynchronizationAlloc(tmpTable);
-         if (NT_SUCCESS(status)) {
-            *Table = tmpTable;
+         tmpTable->Buckets = (PHASH_ITEM *)HeapMemoryAlloc(NonPagedPool, Size * sizeof(PHASH_ITEM));
+         if (tmpTable->Buckets != NULL) {
+            RtlZeroMemory(tmpTable->Buckets, Size * sizeof(PHASH_ITEM));
+            status = _HashTableSynchronizationAlloc(tmpTable);
+            if (NT_SUCCESS(status)) {
+               *Table = tmpTable;
+            }
+
+            if (!NT_SUCCESS(status)) {
+               HeapMemoryFree(tmpTable->Buckets);
+            }
+         } else {
+            status = STATUS_INSUFFICIENT_RESOURCES;
          }
 
          if (!NT_SUCCESS(status)) {
@@ -406,7 +684,7 @@ NTSTATUS HashTableCreate(EHashTableType Type, ULONG32 Size, IN HASH_FUNCTION Has
       if (Type != httPassiveLevel && Type != httDispatchLevel &&
           Type != httNoSynchronization) {
          status = STATUS_INVALID_PARAMETER_1;
-      } else if (Size == 0) {
+      } else if (Size == 0 || Size > HASH_TABLE_MAX_SIZE) {
          status = STATUS_INVALID_PARAMETER_2;
       } else if (HashFunction == NULL) {
          status = STATUS_INVALID_PARAMETER_3;
@@ -429,26 +707,38 @@ NTSTATUS HashTableCreate(EHashTableType Type, ULONG32 Size, IN HASH_FUNCTION Has
  */
 VOID HashTableDestroy(PHASH_TABLE Table)
 {
-   LONG i = 0;
+   ULONG32 i = 0;
+   ULONG32 j = 0;
+   ULONG32 size = 0;
+   PHASH_ITEM *buckets = NULL;
    PHASH_ITEM Tmp = NULL;
    PHASH_ITEM Bucket = NULL;
    DEBUG_ENTER_FUNCTION("Table=%p", Table);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
    _HashTableSynchronizationFree(Table);
-   for (i = 0; i < (LONG)Table->Size; i++) {
-      Bucket = Table->Buckets[i];
-      if (Bucket != NULL) {
-         do {
-            Tmp = Bucket;
-            Bucket = Bucket->Next;
-            if (Table->FreeFunction != NULL) {
-               Table->FreeFunction(Tmp);
-            }
-         } while (Bucket != NULL);
+   for (i = 0; i < Table->LockCount; i++) {
+      buckets = _HashTableLockBuckets(Table, i, &size);
+      for (j = i; j < size; j += Table->LockCount) {
+         Bucket = buckets[j];
+         if (Bucket != NULL) {
+            do {
+               Tmp = Bucket;
+               Bucket = Bucket->Next;
+               if (Table->FreeFunction != NULL) {
+                  Table->FreeFunction(Tmp);
+               }
+            } while (Bucket != NULL);
+         }
       }
    }
 
+   if (Table->OldBuckets != NULL) {
+      HeapMemoryFree(Table->OldBuckets);
+   }
+
+   HeapMemoryFree(Table->Buckets);
+
    HeapMemoryFree(Table);
 
    DEBUG_EXIT_FUNCTION_VOID();
@@ -466,21 +756,52 @@ VOID HashTableDestroy(PHASH_TABLE Table)
  *  @remark
  *  The routine uses the given HASH_ITEM structure to link the data into itself.
  *
+ *  If the table contains more items than buckets afterwards, the routine
+ *  starts to resize it. The routine also performs a part of a resize
+ *  in progress. Both is done only at IRQL <= DISPATCH_LEVEL, above it
+ *  the item is just linked into the current bucket array of its lock.
+ *
  *  The @link(HASH_TABLE_IRQL_VALIDATE) macro is used to check whether
  *  the caller runs at valid IRQL.
  */
 VOID HashTableInsert(PHASH_TABLE Table, PHASH_ITEM Object, PVOID Key)
 {
    KIRQL Irql;
-   ULONG32 Index = 0;
+   ULONG32 Hash = 0;
+   ULONG32 Lock = 0;
+   ULONG32 Size = 0;
+   PHASH_ITEM *Buckets = NULL;
+   PHASH_ITEM *Old = NULL;
+   BOOLEAN Resizable = FALSE;
    DEBUG_ENTER_FUNCTION("Table=0x%p; Object=0x%p; Key=0x%p", Table, Object, Key);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
-   Index = Table->HashFunction(Key) % Table->Size;
-   HashTableLockExclusive(Table, Index, &Irql);
-   Object->Next = InterlockedExchangePointer(&Table->Buckets[Index], Object);
-   HashTableUnlock(Table, Index, Irql);
-   Table->NumberOfItems++;
+   Resizable = HASH_TABLE_RESIZABLE();
+   Hash = Table->HashFunction(Key);
+   Lock = HASH_TABLE_LOCK_INDEX(Table, Hash);
+   Object->Hash = Hash;
+   HashTableLockExclusive(Table, Lock, &Irql);
+   if (Resizable) {
+      Old = _HashTableMigrate(Table, Lock);
+   }
+
+   Buckets = _HashTableLockBuckets(Table, Lock, &Size);
+   Object->Next = Buckets[Hash % Size];
+   Buckets[Hash % Size] = Object;
+   HashTableUnlock(Table, Lock, Irql);
+   InterlockedIncrement((volatile LONG *)&Table->NumberOfItems);
+   if (Resizable) {
+      if (Old != NULL) {
+         HeapMemoryFree(Old);
+      } else {
+         _HashTableMigrationStep(Table);
+      }
+
+      Size = Table->Size;
+      if (Table->OldBuckets == NULL && Table->NumberOfItems > Size && Size <= HASH_TABLE_MAX_SIZE / 2) {
+         _HashTableResizeStart(Table, Size);
+      }
+   }
 
    DEBUG_EXIT_FUNCTION_VOID();
    return;
@@ -497,33 +818,49 @@ VOID HashTableInsert(PHASH_TABLE Table, PHASH_ITEM Object, PVOID Key)
  *  by the given key, it returns its address. Otherwise, NULL is returned.
  *
  *  @remark
+ *  At IRQL <= DISPATCH_LEVEL, the routine performs a part of a resize in progress.
+ *
  *  The @link(HASH_TABLE_IRQL_VALIDATE) macro is used to check whether
  *  the caller runs at valid IRQL.
  */
 PHASH_ITEM HashTableDelete(PHASH_TABLE Table, PVOID Key)
 {
    KIRQL Irql;
+   ULONG32 Hash = 0;
+   ULONG32 Lock = 0;
    ULONG32 Index = 0;
+   ULONG32 Size = 0;
+   PHASH_ITEM *Buckets = NULL;
+   PHASH_ITEM *Old = NULL;
    PHASH_ITEM Akt = NULL;
    PHASH_ITEM Prev = NULL;
    BOOLEAN Ret = FALSE;
+   BOOLEAN Resizable = FALSE;
    DEBUG_ENTER_FUNCTION("Table=0x%p; Key=0x%p", Table, Key);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
-   Index = Table->HashFunction(Key) % Table->Size;
-   HashTableLockExclusive(Table, Index, &Irql);
-   Akt = Table->Buckets[Index];
+   Resizable = HASH_TABLE_RESIZABLE();
+   Hash = Table->HashFunction(Key);
+   Lock = HASH_TABLE_LOCK_INDEX(Table, Hash);
+   HashTableLockExclusive(Table, Lock, &Irql);
+   if (Resizable) {
+      Old = _HashTableMigrate(Table, Lock);
+   }
+
+   Buckets = _HashTableLockBuckets(Table, Lock, &Size);
+   Index = Hash % Size;
+   Akt = Buckets[Index];
    Prev = NULL;
    while (Akt != NULL) {
-      Ret = Table->CompareFunction(Akt, Key);
+      Ret = (Akt->Hash == Hash && Table->CompareFunction(Akt, Key));
       if (Ret) {
          if (Prev != NULL) {
             Prev->Next = Akt->Next;
          } else {
-            Table->Buckets[Index] = Akt->Next;
+            Buckets[Index] = Akt->Next;
          }
 
-         Table->NumberOfItems--;
+         InterlockedDecrement((volatile LONG *)&Table->NumberOfItems);
 
          break;
       }
@@ -532,7 +869,14 @@ PHASH_ITEM HashTableDelete(PHASH_TABLE Table, PVOID Key)
       Akt = Akt->Next;
    }
 
-   HashTableUnlock(Table, Index, Irql);
+   HashTableUnlock(Table, Lock, Irql);
+   if (Resizable) {
+      if (Old != NULL) {
+         HeapMemoryFree(Old);
+      } else {
+         _HashTableMigrationStep(Table);
+      }
+   }
 
    DEBUG_EXIT_FUNCTION("0x%p", Akt);
    return Akt;
@@ -548,6 +892,10 @@ PHASH_ITEM HashTableDelete(PHASH_TABLE Table, PVOID Key)
  *  NULL is returned.
  *
  *  @remark
+ *  The routine holds only the lock of the key in shared mode and never modifies
+ *  the table, so lookups run in parallel with each other (and lookups in
+ *  no-synchronization tables can be done under an external shared lock).
+ *
  *  The @link(HASH_TABLE_IRQL_VALIDATE) macro is used to check whether
  *  the caller runs at valid IRQL.
  */
@@ -555,16 +903,21 @@ PHASH_ITEM HashTableGet(PHASH_TABLE Table, PVOID Key)
 {
    KIRQL Irql;
    BOOLEAN Ret = FALSE;
-   ULONG32 Index = 0;
+   ULONG32 Hash = 0;
+   ULONG32 Lock = 0;
+   ULONG32 Size = 0;
+   PHASH_ITEM *Buckets = NULL;
    PHASH_ITEM Akt = NULL;
    DEBUG_ENTER_FUNCTION("Table=0x%p; Key=0x%p", Table, Key);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
-   Index = Table->HashFunction(Key) % Table->Size;
-   HashTableLockShared(Table, Index, &Irql);
-   Akt = Table->Buckets[Index];
+   Hash = Table->HashFunction(Key);
+   Lock = HASH_TABLE_LOCK_INDEX(Table, Hash);
+   HashTableLockShared(Table, Lock, &Irql);
+   Buckets = _HashTableLockBuckets(Table, Lock, &Size);
+   Akt = Buckets[Hash % Size];
    while (Akt != NULL) {
-      Ret = Table->CompareFunction(Akt, Key);
+      Ret = (Akt->Hash == Hash && Table->CompareFunction(Akt, Key));
       if (Ret) {
          break;
       }
@@ -572,7 +925,7 @@ PHASH_ITEM HashTableGet(PHASH_TABLE Table, PVOID Key)
       Akt = Akt->Next;
    }
 
-   HashTableUnlock(Table, Index, Irql);
+   HashTableUnlock(Table, Lock, Irql);
 
    DEBUG_EXIT_FUNCTION("0x%p", Akt);
    return Akt;
@@ -600,19 +953,25 @@ PHASH_ITEM HashTableGet(PHASH_TABLE Table, PVOID Key)
 VOID HashTablePerform(PHASH_TABLE Table, HASH_ITEM_CALLBACK Callback, PVOID Context)
 {
    KIRQL Irql;
-   ULONG i = 0;
+   ULONG32 i = 0;
+   ULONG32 j = 0;
+   ULONG32 size = 0;
+   PHASH_ITEM *buckets = NULL;
    PHASH_ITEM tmp = NULL;
    PHASH_ITEM old = NULL;
    DEBUG_ENTER_FUNCTION("Table=0x%p; Callback=0x%p; Context=0x%p", Table, Callback, Context);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
-   for (i = 0; i < Table->Size; ++i) {
+   for (i = 0; i < Table->LockCount; ++i) {
       HashTableLockExclusive(Table, i, &Irql);
-      tmp = Table->Buckets[i];
-      while (tmp != NULL) {
-         old = tmp;
-         tmp = tmp->Next;
-         Callback(old, Context);
+      buckets = _HashTableLockBuckets(Table, i, &size);
+      for (j = i; j < size; j += Table->LockCount) {
+         tmp = buckets[j];
+         while (tmp != NULL) {
+            old = tmp;
+            tmp = tmp->Next;
+            Callback(old, Context);
+         }
       }
 
       HashTableUnlock(Table, i, Irql);
@@ -646,20 +1005,26 @@ VOID HashTablePerformWithFeedback(PHASH_TABLE Table, HASH_ITEM_CALLBACK_WITH_FEE
 {
 
    KIRQL Irql;
-   ULONG i = 0;
+   ULONG32 i = 0;
+   ULONG32 j = 0;
+   ULONG32 size = 0;
+   PHASH_ITEM *buckets = NULL;
    PHASH_ITEM tmp = NULL;
    PHASH_ITEM old = NULL;
    BOOLEAN cancelled = FALSE;
    DEBUG_ENTER_FUNCTION("Table=0x%p; Callback=0x%p; Context=0x%p", Table, Callback, Context);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
-   for (i = 0; i < Table->Size; ++i) {
+   for (i = 0; i < Table->LockCount; ++i) {
       HashTableLockExclusive(Table, i, &Irql);
-      tmp = Table->Buckets[i];
-      while (!cancelled && tmp != NULL) {
-         old = tmp;
-         tmp = tmp->Next;
-         cancelled = !Callback(old, Context);
+      buckets = _HashTableLockBuckets(Table, i, &size);
+      for (j = i; !cancelled && j < size; j += Table->LockCount) {
+         tmp = buckets[j];
+         while (!cancelled && tmp != NULL) {
+            old = tmp;
+            tmp = tmp->Next;
+            cancelled = !Callback(old, Context);
+         }
       }
 
       HashTableUnlock(Table, i, Irql);
@@ -685,24 +1050,31 @@ VOID HashTablePerformWithFeedback(PHASH_TABLE Table, HASH_ITEM_CALLBACK_WITH_FEE
 VOID HashTableClear(PHASH_TABLE Table, BOOLEAN CallFreeFunction)
 {
    KIRQL Irql;
-   ULONG i = 0;
+   ULONG32 i = 0;
+   ULONG32 j = 0;
+   ULONG32 size = 0;
+   PHASH_ITEM *buckets = NULL;
    PHASH_ITEM old = NULL;
    PHASH_ITEM akt = NULL;
    DEBUG_ENTER_FUNCTION("Table=0x%p; CallFreeFunction=%u", Table, CallFreeFunction);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
-   for (i = 0; i < Table->Size; ++i) {
+   for (i = 0; i < Table->LockCount; ++i) {
       HashTableLockExclusive(Table, i, &Irql);
-      if (CallFreeFunction && Table->FreeFunction != NULL) {
-         akt = Table->Buckets[i];
-         while (akt != NULL) {
-            old = akt;
-            akt = akt->Next;
-            Table->FreeFunction(old);
+      buckets = _HashTableLockBuckets(Table, i, &size);
+      for (j = i; j < size; j += Table->LockCount) {
+         if (CallFreeFunction && Table->FreeFunction != NULL) {
+            akt = buckets[j];
+            while (akt != NULL) {
+               old = akt;
+               akt = akt->Next;
+               Table->FreeFunction(old);
+            }
          }
+
+         buckets[j] = NULL;
       }
 
-      Table->Buckets[i] = NULL;
       HashTableUnlock(Table, i, Irql);
    }
 
@@ -735,6 +1107,69 @@ ULONG HashTableGetItemCount(PHASH_TABLE Table)
    return ret;
 }
 
+/** Computes chain length and load factor statistics of a given general
+ *  hash table.
+ *
+ *  @param Table The table in question.
+ *  @param Statistics Address of structure that receives the statistics.
+ *
+ *  @remark
+ *  Locks of the table are acquired in shared mode one after another, so
+ *  the result need not reflect a single moment if the table is being modified
+ *  concurrently.
+ *
+ *  The @link(HASH_TABLE_IRQL_VALIDATE) macro is used to check whether
+ *  the caller runs at valid IRQL.
+ */
+VOID HashTableGetStatistics(PHASH_TABLE Table, PHASH_TABLE_STATISTICS Statistics)
+{
+   KIRQL Irql;
+   ULONG32 i = 0;
+   ULONG32 j = 0;
+   ULONG32 size = 0;
+   ULONG length = 0;
+   PHASH_ITEM *buckets = NULL;
+   PHASH_ITEM akt = NULL;
+   DEBUG_ENTER_FUNCTION("Table=0x%p; Statistics=0x%p", Table, Statistics);
+   HASH_TABLE_IRQL_VALIDATE(Table);
+
+   RtlZeroMemory(Statistics, sizeof(HASH_TABLE_STATISTICS));
+   for (i = 0; i < Table->LockCount; ++i) {
+      HashTableLockShared(Table, i, &Irql);
+      buckets = _HashTableLockBuckets(Table, i, &size);
+      for (j = i; j < size; j += Table->LockCount) {
+         length = 0;
+         akt = buckets[j];
+         while (akt != NULL) {
+            ++length;
+            akt = akt->Next;
+         }
+
+         if (length > 0) {
+            Statistics->UsedBuckets++;
+         }
+
+         if (length > Statistics->MaxChainLength) {
+            Statistics->MaxChainLength = length;
+         }
+      }
+
+      if (i == 0) {
+         Statistics->NumberOfBuckets = Table->Size;
+         Statistics->NumberOfResizes = Table->NumberOfResizes;
+         Statistics->ResizeInProgress = (Table->OldBuckets != NULL);
+      }
+
+      HashTableUnlock(Table, i, Irql);
+   }
+
+   Statistics->NumberOfItems = Table->NumberOfItems;
+   Statistics->LoadFactor = (ULONG)((ULONG64)Statistics->NumberOfItems * 100 / Statistics->NumberOfBuckets);
+
+   DEBUG_EXIT_FUNCTION_VOID();
+   return;
+}
+
 /************************************************************************/
 /*                         ITERATOR FUNCTIONS                           */
 /************************************************************************/
@@ -759,26 +1194,11 @@ ULONG HashTableGetItemCount(PHASH_TABLE Table)
  */
 BOOLEAN HashTableGetFirst(PHASH_TABLE Table, PHASH_TABLE_ITERATOR Iterator)
 {
-   KIRQL irql;
-   ULONG i = 0;
    BOOLEAN ret = FALSE;
    DEBUG_ENTER_FUNCTION("Table=0x%p; Iterator=0x%p", Table, Iterator);
    HASH_TABLE_IRQL_VALIDATE(Table);
 
-   for (i = 0; i < Table->Size; ++i) {
-      HashTableLockShared(Table, i, &irql);
-      ret = Table->Buckets[i] != NULL;
-      if (ret) {
-         Iterator->PointsToEnd = FALSE;
-         Iterator->CurrentIndex = i;
-         Iterator->CurrentItem = Table->Buckets[i];
-         Iterator->Irql = irql;
-         Iterator->Table = Table;
-         break;
-      }
-
-      HashTableUnlock(Table, i, irql);
-   }
+   ret = _HashTableIteratorFind(Table, 0, Iterator);
 
    DEBUG_EXIT_FUNCTION("%u", ret);
    return ret;
@@ -808,27 +1228,31 @@ BOOLEAN HashTableGetFirst(PHASH_TABLE Table, PHASH_TABLE_ITERATOR Iterator)
  */
 BOOLEAN HashTableGetNext(PHASH_TABLE_ITERATOR Iterator)
 {
-   ULONG i = 0;
+   ULONG32 i = 0;
+   ULONG32 size = 0;
+   PHASH_ITEM *buckets = NULL;
    PHASH_TABLE table = NULL;
    BOOLEAN ret = FALSE;
    DEBUG_ENTER_FUNCTION("Iterator=0x%p", Iterator);
 
    table = Iterator->Table;
-   for (i = Iterator->CurrentIndex; i < table->Size; ++i) {
-      if (i != Iterator->CurrentIndex) {
-         HashTableLockShared(table, i, &Iterator->Irql);
-         Iterator->CurrentItem = table->Buckets[i];
-         Iterator->CurrentIndex = i;
-      } else {
-         Iterator->CurrentItem = Iterator->CurrentItem->Next;
-      }
-
-      ret = (Iterator->CurrentItem != NULL);
-      if (ret) {
-         break;
+   Iterator->CurrentItem = Iterator->CurrentItem->Next;
+   ret = (Iterator->CurrentItem != NULL);
+   if (!ret) {
+      buckets = _HashTableLockBuckets(table, Iterator->CurrentLock, &size);
+      for (i = Iterator->CurrentIndex + table->LockCount; i < size; i += table->LockCount) {
+         ret = (buckets[i] != NULL);
+         if (ret) {
+            Iterator->CurrentIndex = i;
+            Iterator->CurrentItem = buckets[i];
+            break;
+         }
       }
+   }
 
-      HashTableUnlock(table, i, Iterator->Irql);
+   if (!ret) {
+      HashTableUnlock(table, Iterator->CurrentLock, Iterator->Irql);
+      ret = _HashTableIteratorFind(table, Iterator->CurrentLock + 1, Iterator);
    }
 
    Iterator->PointsToEnd = !ret;
@@ -852,7 +1276,7 @@ VOID HashTableIteratorFinit(PHASH_TABLE_ITERATOR Iterator)
    DEBUG_ENTER_FUNCTION("Iterator=0x%p", Iterator);
 
    if (!Iterator->PointsToEnd) {
-      HashTableUnlock(Iterator->Table, Iterator->CurrentIndex, Iterator->Irql);
+      HashTableUnlock(Iterator->Table, Iterator->CurrentLock, Iterator->Irql);
    }
 
    DEBUG_EXIT_FUNCTION_VOID();
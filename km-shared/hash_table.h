@@ -19,6 +19,9 @@
 typedef struct _HASH_ITEM {
    /** Address of the next item in the bucket. */
    struct _HASH_ITEM *Next;
+   /** Value the hash function returned for the key the item was inserted
+       under. Allows to move the item to another bucket when the table grows. */
+   ULONG32 Hash;
 } HASH_ITEM, *PHASH_ITEM;
 
 
@@ -137,13 +140,16 @@ typedef enum {
        be allocated from nonpaged pool. */
    httDispatchLevel,
    /** A no-synchronization table. Access to the table is not synchronized, no
-      limitations to IRQL and memory pool for table items are placed. */
+      limitations to IRQL and memory pool for table items are placed. Insertions
+      and deletions above DISPATCH_LEVEL never allocate nor free memory, the table
+      keeps its size until it is modified at a lower IRQL again. */
    httNoSynchronization
 } EHashTableType, *PEHashTableType;
 
 /** Represents a general hash table. */
 typedef struct _HASH_TABLE {
-   /** Number of buckets (slots). */
+   /** Number of buckets (slots). When the table is being resized, number of
+       buckets of the new bucket array. */
    ULONG32 Size;
    /** type of the table. */
    EHashTableType Type;
@@ -153,6 +159,11 @@ typedef struct _HASH_TABLE {
    COMPARE_FUNCTION CompareFunction;
    /** Address of the free function. */
    FREE_ITEM_FUNCTION FreeFunction;
+   /** Number of bucket locks, equal to the initial number of buckets. A lock
+       guards all buckets with indices congruent to its own index modulo
+       LockCount. The number of buckets is always LockCount multiplied by a power
+       of two, so an item is guarded by the same lock in both the bucket arrays. */
+   ULONG32 LockCount;
    /** Array of executive resources used to synchronize access to individual
        buckets. For passive IRQL tables only. */
    PERESOURCE Locks;
@@ -165,12 +176,49 @@ typedef struct _HASH_TABLE {
    /** Number of entries stored in the hash table. */
    volatile ULONG NumberOfItems;
    /** The buckets. */
-   PHASH_ITEM Buckets[1];
+   PHASH_ITEM *Buckets;
+   /** Bucket array the items are being migrated from, NULL if the table
+       is not being resized. */
+   PHASH_ITEM * volatile OldBuckets;
+   /** Number of buckets of the OldBuckets array. */
+   ULONG32 OldSize;
+   /** For every lock, indicates whether items of its buckets were already
+       migrated from the OldBuckets array. */
+   PBOOLEAN Migrated;
+   /** Number of locks the buckets of which were migrated. */
+   volatile LONG MigratedCount;
+   /** Index of the next lock the buckets of which should be migrated by
+       an operation working with another lock. */
+   volatile LONG MigrationCursor;
+   /** Number of times the table has grown. */
+   ULONG NumberOfResizes;
 } HASH_TABLE, *PHASH_TABLE;
 
+/** Describes how well the items are distributed over the buckets of a general
+    hash table. */
+typedef struct _HASH_TABLE_STATISTICS {
+   /** Number of items stored in the table. */
+   ULONG NumberOfItems;
+   /** Number of buckets. If the table is being resized, number of buckets
+       of the new bucket array. */
+   ULONG NumberOfBuckets;
+   /** Number of buckets containing at least one item. */
+   ULONG UsedBuckets;
+   /** Length of the longest chain. */
+   ULONG MaxChainLength;
+   /** Number of items per 100 buckets. */
+   ULONG LoadFactor;
+   /** Number of times the table has grown. */
+   ULONG NumberOfResizes;
+   /** Indicates whether the items are being migrated to a larger bucket array. */
+   BOOLEAN ResizeInProgress;
+} HASH_TABLE_STATISTICS, *PHASH_TABLE_STATISTICS;
+
 /** Represents a general hash table iterator. The iterator can represent
     one table item. */
 typedef struct {
+   /** Index of the lock guarding the bucket of the item. */
+   ULONG CurrentLock;
    /** Bucket index of the item represented by the iterator. */
    ULONG CurrentIndex;
    /** Pointer to the item associated with the iterator. */
@@ -195,6 +243,7 @@ VOID HashTablePerform(PHASH_TABLE Table, HASH_ITEM_CALLBACK Callback, PVOID Cont
 VOID HashTablePerformWithFeedback(PHASH_TABLE Table, HASH_ITEM_CALLBACK_WITH_FEEDBACK *Callback, PVOID Context);
 VOID HashTableClear(PHASH_TABLE Table, BOOLEAN CallFreeFunction);
 ULONG HashTableGetItemCount(PHASH_TABLE Table);
+VOID HashTableGetStatistics(PHASH_TABLE Table, PHASH_TABLE_STATISTICS Statistics);
 
 BOOLEAN HashTableGetFirst(PHASH_TABLE HashTable, PHASH_TABLE_ITERATOR Iterator);
 BOOLEAN HashTableGetNext(PHASH_TABLE_ITERATOR Iterator);
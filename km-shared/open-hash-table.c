@@ -0,0 +1,777 @@
+/**
+ * @file
+ *
+ * OPEN HASH TABLE
+ *
+ * An open hash table stores (hash, object) pairs directly in its buckets,
+ * each bucket fills exactly one cache line. An object is placed to the first
+ * free slot found when probing the buckets linearly from its home bucket, so
+ * a lookup usually touches just one cache line and never follows pointers
+ * to other objects. Deletion moves objects from the following buckets back
+ * to keep the probe sequences unbroken, no deletion markers are needed. The
+ * buckets do not wrap around: a few spare buckets follow the last home bucket,
+ * and the table grows when an insertion runs out of them or when the load
+ * factor gets too high.
+ *
+ * The API mirrors the one of general hash tables (hash_table.c), including
+ * the table types. Passive and dispatch IRQL tables are synchronized by a fixed
+ * number of stripe locks, each guarding a range of consecutive buckets, instead
+ * of one lock per bucket. Stripes are always locked in increasing order, as
+ * a probe moves forward, growing the table locks all of them.
+ *
+ * Unlike general hash tables, an insertion may fail, since the table may
+ * need to allocate a larger bucket array. NULL cannot be stored in the table.
+ */
+
+#include <ntifs.h>
+#include "preprocessor.h"
+#include "allocator.h"
+#include "open-hash-table.h"
+
+
+#undef DEBUG_TRACE_ENABLED
+#define DEBUG_TRACE_ENABLED 0
+
+/************************************************************************/
+/*                     HELPER MACROS AND TYPES                          */
+/************************************************************************/
+
+/** Spreads hashes of poor quality (such as pointers divided by four)
+    over the buckets, 2^32 divided by the golden ratio. */
+#define OPEN_HASH_MULTIPLIER				0x9E3779B1
+/** Number of buckets following the last home bucket. */
+#define OPEN_HASH_OVERFLOW_BUCKETS			8
+/** Number of stripe locks of a synchronized table. */
+#define OPEN_HASH_STRIPE_COUNT				64
+/** The table grows when more than this percentage of its slots is used. */
+#define OPEN_HASH_MAX_LOAD					75
+
+C_ASSERT(sizeof(OPEN_HASH_BUCKET) == OPEN_HASH_BUCKET_SIZE);
+
+/** Records stripe locks held by an operation. The locks form a continuous
+    range, they are acquired in increasing order as the operation moves
+    forward through the buckets. */
+typedef struct _OPEN_HASH_LOCK_STATE {
+	/** The bucket array the operation works with. */
+	POPEN_HASH_ARRAY Array;
+	/** Index of the first stripe locked. */
+	ULONG First;
+	/** Number of stripes locked. */
+	ULONG Count;
+	/** IRQL before the first stripe was locked (dispatch IRQL tables only). */
+	KIRQL Irql;
+	BOOLEAN Exclusive;
+} OPEN_HASH_LOCK_STATE, *POPEN_HASH_LOCK_STATE;
+
+/************************************************************************/
+/*                           HELPER FUNCTIONS                           */
+/************************************************************************/
+
+static PVOID _AllocAligned(SIZE_T Size, PVOID *Allocation)
+{
+	PVOID ret = NULL;
+
+	*Allocation = HeapMemoryAllocNonPaged(Size + OPEN_HASH_BUCKET_SIZE - 1);
+	if (*Allocation != NULL) {
+		memset(*Allocation, 0, Size + OPEN_HASH_BUCKET_SIZE - 1);
+		ret = (PVOID)(((ULONG_PTR)*Allocation + OPEN_HASH_BUCKET_SIZE - 1) & ~((ULONG_PTR)OPEN_HASH_BUCKET_SIZE - 1));
+	}
+
+	return ret;
+}
+
+
+static ULONG _Log2(ULONG Value)
+{
+	ULONG ret = 0;
+
+	while (((ULONG)1 << ret) < Value)
+		++ret;
+
+	return ret;
+}
+
+
+/** Allocates a bucket array with a given number of home buckets (a power of two).
+ *  The array header and the buckets share one allocation.
+ */
+static POPEN_HASH_ARRAY _ArrayAlloc(ULONG BucketCount)
+{
+	ULONG log = 0;
+	POPEN_HASH_ARRAY ret = NULL;
+
+	ret = (POPEN_HASH_ARRAY)HeapMemoryAllocNonPaged(sizeof(OPEN_HASH_ARRAY) + OPEN_HASH_BUCKET_SIZE - 1 + (BucketCount + OPEN_HASH_OVERFLOW_BUCKETS)*sizeof(OPEN_HASH_BUCKET));
+	if (ret != NULL) {
+		memset(ret, 0, sizeof(OPEN_HASH_ARRAY) + OPEN_HASH_BUCKET_SIZE - 1 + (BucketCount + OPEN_HASH_OVERFLOW_BUCKETS)*sizeof(OPEN_HASH_BUCKET));
+		log = _Log2(BucketCount);
+		ret->BucketCount = BucketCount;
+		ret->Shift = 32 - log;
+		ret->StripeShift = (log > _Log2(OPEN_HASH_STRIPE_COUNT)) ? log - _Log2(OPEN_HASH_STRIPE_COUNT) : 0;
+		ret->Buckets = (POPEN_HASH_BUCKET)(((ULONG_PTR)(ret + 1) + OPEN_HASH_BUCKET_SIZE - 1) & ~((ULONG_PTR)OPEN_HASH_BUCKET_SIZE - 1));
+	}
+
+	return ret;
+}
+
+
+static ULONG _HomeBucket(const OPEN_HASH_ARRAY *Array, ULONG32 Hash)
+{
+	return (ULONG)((ULONG64)(ULONG32)(Hash*OPEN_HASH_MULTIPLIER) >> Array->Shift);
+}
+
+
+static ULONG _BucketStripe(const OPEN_HASH_TABLE *Table, const OPEN_HASH_ARRAY *Array, ULONG Bucket)
+{
+	ULONG ret = 0;
+
+	ret = Bucket >> Array->StripeShift;
+	if (ret >= Table->StripeCount)
+		ret = Table->StripeCount - 1;
+
+	return ret;
+}
+
+
+static VOID _StripeLock(POPEN_HASH_TABLE Table, ULONG Stripe, BOOLEAN Exclusive, BOOLEAN First, PKIRQL Irql)
+{
+	switch (Table->Type) {
+		case httPassiveLevel:
+			KeEnterCriticalRegion();
+			if (Exclusive)
+				ExAcquireResourceExclusiveLite(Table->Locks + Stripe, TRUE);
+			else ExAcquireResourceSharedLite(Table->Locks + Stripe, TRUE);
+			break;
+		case httDispatchLevel:
+			if (First) {
+				*Irql = (Exclusive) ?
+					ExAcquireSpinLockExclusive(&Table->Stripes[Stripe].Lock) :
+					ExAcquireSpinLockShared(&Table->Stripes[Stripe].Lock);
+			} else if (Exclusive)
+				ExAcquireSpinLockExclusiveAtDpcLevel(&Table->Stripes[Stripe].Lock);
+			else ExAcquireSpinLockSharedAtDpcLevel(&Table->Stripes[Stripe].Lock);
+			break;
+		default:
+			break;
+	}
+
+	return;
+}
+
+
+static VOID _StripeUnlock(POPEN_HASH_TABLE Table, ULONG Stripe, BOOLEAN Exclusive, BOOLEAN First, KIRQL Irql)
+{
+	switch (Table->Type) {
+		case httPassiveLevel:
+			ExReleaseResourceLite(Table->Locks + Stripe);
+			KeLeaveCriticalRegion();
+			break;
+		case httDispatchLevel:
+			if (First) {
+				if (Exclusive)
+					ExReleaseSpinLockExclusive(&Table->Stripes[Stripe].Lock, Irql);
+				else ExReleaseSpinLockShared(&Table->Stripes[Stripe].Lock, Irql);
+			} else if (Exclusive)
+				ExReleaseSpinLockExclusiveFromDpcLevel(&Table->Stripes[Stripe].Lock);
+			else ExReleaseSpinLockSharedFromDpcLevel(&Table->Stripes[Stripe].Lock);
+			break;
+		default:
+			break;
+	}
+
+	return;
+}
+
+
+/** Makes sure the stripe of a given bucket, and all the stripes between it
+ *  and the first stripe locked, are locked.
+ */
+static VOID _LockExtend(POPEN_HASH_TABLE Table, POPEN_HASH_LOCK_STATE State, ULONG Bucket)
+{
+	ULONG stripe = 0;
+
+	stripe = _BucketStripe(Table, State->Array, Bucket);
+	while (State->First + State->Count <= stripe) {
+		_StripeLock(Table, State->First + State->Count, State->Exclusive, State->Count == 0, &State->Irql);
+		++State->Count;
+	}
+
+	return;
+}
+
+
+static VOID _Unlock(POPEN_HASH_TABLE Table, POPEN_HASH_LOCK_STATE State)
+{
+	while (State->Count > 0) {
+		--State->Count;
+		_StripeUnlock(Table, State->First + State->Count, State->Exclusive, State->Count == 0, State->Irql);
+	}
+
+	return;
+}
+
+
+/** Locks the stripe of the home bucket of a given hash. The bucket array
+ *  might have been replaced before the lock was acquired, the routine tries
+ *  again in such a case.
+ */
+static ULONG _LockHome(POPEN_HASH_TABLE Table, ULONG32 Hash, BOOLEAN Exclusive, POPEN_HASH_LOCK_STATE State)
+{
+	ULONG ret = 0;
+	POPEN_HASH_ARRAY array = NULL;
+
+	do {
+		array = Table->Array;
+		ret = _HomeBucket(array, Hash);
+		State->Array = array;
+		State->First = _BucketStripe(Table, array, ret);
+		State->Count = 0;
+		State->Exclusive = Exclusive;
+		_LockExtend(Table, State, ret);
+		if (Table->Array != array)
+			_Unlock(Table, State);
+	} while (State->Count == 0);
+
+	return ret;
+}
+
+
+static VOID _LockAll(POPEN_HASH_TABLE Table, POPEN_HASH_LOCK_STATE State)
+{
+	ULONG i = 0;
+
+	State->First = 0;
+	State->Count = 0;
+	State->Exclusive = TRUE;
+	for (i = 0; i < Table->StripeCount; ++i) {
+		_StripeLock(Table, i, TRUE, i == 0, &State->Irql);
+		++State->Count;
+	}
+
+	State->Array = Table->Array;
+
+	return;
+}
+
+
+/** Puts an object to the first free slot at or after its home bucket.
+ *
+ *  @return
+ *  Returns FALSE if no free slot is left before the end of the array.
+ */
+static BOOLEAN _SlotPut(POPEN_HASH_TABLE Table, POPEN_HASH_LOCK_STATE State, POPEN_HASH_ARRAY Array, ULONG Home, ULONG32 Hash, PVOID Object)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	POPEN_HASH_BUCKET bucket = NULL;
+	BOOLEAN ret = FALSE;
+
+	for (b = Home; b < Array->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+		if (State != NULL)
+			_LockExtend(Table, State, b);
+
+		bucket = Array->Buckets + b;
+		for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+			if (bucket->Objects[i] == NULL) {
+				bucket->Hashes[i] = Hash;
+				bucket->Objects[i] = Object;
+				ret = TRUE;
+				break;
+			}
+		}
+
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+
+/** Finds the slot holding an object with a given key. The search stops
+ *  at the first bucket having a free slot, since no object stored further
+ *  could have been placed there by probing over it.
+ */
+static BOOLEAN _SlotFind(POPEN_HASH_TABLE Table, POPEN_HASH_LOCK_STATE State, ULONG Home, ULONG32 Hash, PVOID Key, PULONG Bucket, PULONG Slot)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	PVOID obj = NULL;
+	BOOLEAN full = FALSE;
+	POPEN_HASH_BUCKET bucket = NULL;
+	POPEN_HASH_ARRAY array = State->Array;
+	BOOLEAN ret = FALSE;
+
+	for (b = Home; b < array->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+		_LockExtend(Table, State, b);
+		bucket = array->Buckets + b;
+		// Free slots may keep stale hashes, the hashes are only a filter.
+		full = TRUE;
+		for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+			obj = bucket->Objects[i];
+			full &= (obj != NULL);
+			if (bucket->Hashes[i] == Hash && obj != NULL && Table->CompareFunction(obj, Key)) {
+				*Bucket = b;
+				*Slot = i;
+				ret = TRUE;
+				break;
+			}
+		}
+
+		if (ret || !full)
+			break;
+	}
+
+	return ret;
+}
+
+
+/** Fills a slot freed by a deletion with an object from the following
+ *  buckets the probe sequence of which passes the slot. That frees another
+ *  slot, so the process repeats until a bucket that was not full is reached.
+ */
+static VOID _SlotsShiftBack(POPEN_HASH_TABLE Table, POPEN_HASH_LOCK_STATE State, ULONG HoleBucket, ULONG HoleSlot)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	BOOLEAN full = FALSE;
+	POPEN_HASH_BUCKET bucket = NULL;
+	POPEN_HASH_BUCKET hole = NULL;
+	POPEN_HASH_ARRAY array = State->Array;
+
+	for (b = HoleBucket + 1; b < array->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+		_LockExtend(Table, State, b);
+		bucket = array->Buckets + b;
+		full = TRUE;
+		for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+			if (bucket->Objects[i] == NULL) {
+				full = FALSE;
+				break;
+			}
+		}
+
+		for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+			if (bucket->Objects[i] != NULL && _HomeBucket(array, bucket->Hashes[i]) <= HoleBucket) {
+				hole = array->Buckets + HoleBucket;
+				hole->Hashes[HoleSlot] = bucket->Hashes[i];
+				hole->Objects[HoleSlot] = bucket->Objects[i];
+				bucket->Objects[i] = NULL;
+				HoleBucket = b;
+				HoleSlot = i;
+				break;
+			}
+		}
+
+		if (!full)
+			break;
+	}
+
+	return;
+}
+
+
+/** Replaces the bucket array by a larger one, unless another thread
+ *  already did that.
+ *
+ *  @param Old The array the caller found too small.
+ */
+static NTSTATUS _Grow(POPEN_HASH_TABLE Table, POPEN_HASH_ARRAY Old)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	PVOID obj = NULL;
+	ULONG32 hash = 0;
+	ULONG bucketCount = 0;
+	BOOLEAN filled = FALSE;
+	POPEN_HASH_ARRAY newArray = NULL;
+	OPEN_HASH_LOCK_STATE state;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Old=0x%p", Table, Old);
+
+	_LockAll(Table, &state);
+	status = STATUS_SUCCESS;
+	if (state.Array == Old) {
+		bucketCount = Old->BucketCount;
+		do {
+			bucketCount *= 2;
+			newArray = _ArrayAlloc(bucketCount);
+			if (newArray == NULL) {
+				status = STATUS_INSUFFICIENT_RESOURCES;
+				break;
+			}
+
+			filled = TRUE;
+			for (b = 0; filled && b < Old->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+				for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+					obj = Old->Buckets[b].Objects[i];
+					if (obj != NULL) {
+						hash = Old->Buckets[b].Hashes[i];
+						filled = _SlotPut(Table, NULL, newArray, _HomeBucket(newArray, hash), hash, obj);
+						if (!filled)
+							break;
+					}
+				}
+			}
+
+			if (!filled)
+				HeapMemoryFree(newArray);
+		} while (!filled);
+
+		if (NT_SUCCESS(status)) {
+			Table->Array = newArray;
+			HeapMemoryFree(Old);
+		}
+	}
+
+	_Unlock(Table, &state);
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+static BOOLEAN _LoadAllowsInsert(POPEN_HASH_TABLE Table, const OPEN_HASH_ARRAY *Array)
+{
+	return ((ULONG64)Table->NumberOfItems + 1)*100 <= (ULONG64)Array->BucketCount*OPEN_HASH_BUCKET_SLOTS*OPEN_HASH_MAX_LOAD;
+}
+
+/************************************************************************/
+/*                   PUBLIC FUNCTIONS                                   */
+/************************************************************************/
+
+/** Creates a new open hash table.
+ *
+ *  @param Type Type of the table, the same values as for general hash tables
+ *  are accepted.
+ *  @param Size Number of objects the table should hold without growing.
+ *  @param HashFunction Address of a hash function for the new table.
+ *  @param CompareFunction Address of a compare function for the new table.
+ *  @param FreeFunction Address of a free function for the new table. If this
+ *  parameter is NULL, the new table will have no free function.
+ *  @param Table Address of variable that receives the newly created table.
+ *
+ *  @return
+ *  Returns the same NTSTATUS values as @link(HashTableCreate).
+ *
+ *  @remark
+ *  The routine can be called at IRQL <= DISPATCH_LEVEL.
+ */
+NTSTATUS OpenHashTableCreate(EHashTableType Type, ULONG32 Size, HASH_FUNCTION HashFunction, OPEN_HASH_COMPARE_FUNCTION CompareFunction, OPEN_HASH_FREE_FUNCTION FreeFunction, POPEN_HASH_TABLE *Table)
+{
+	LONG i = 0;
+	ULONG bucketCount = 1;
+	POPEN_HASH_TABLE tmpTable = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Type=%u; Size=%u; HashFunction=0x%p; CompareFunction=0x%p; FreeFunction=0x%p; Table=0x%p", Type, Size, HashFunction, CompareFunction, FreeFunction, Table);
+	DEBUG_IRQL_LESS_OR_EQUAL(DISPATCH_LEVEL);
+
+	if ((Type == httPassiveLevel || Type == httDispatchLevel || Type == httNoSynchronization) &&
+		Size > 0 && HashFunction != NULL && CompareFunction != NULL) {
+		while ((ULONG64)bucketCount*OPEN_HASH_BUCKET_SLOTS*OPEN_HASH_MAX_LOAD < (ULONG64)Size*100)
+			bucketCount *= 2;
+
+		tmpTable = (POPEN_HASH_TABLE)HeapMemoryAllocNonPaged(sizeof(OPEN_HASH_TABLE));
+		if (tmpTable != NULL) {
+			memset(tmpTable, 0, sizeof(OPEN_HASH_TABLE));
+			tmpTable->Type = Type;
+			tmpTable->HashFunction = HashFunction;
+			tmpTable->CompareFunction = CompareFunction;
+			tmpTable->FreeFunction = FreeFunction;
+			tmpTable->StripeCount = (Type != httNoSynchronization) ? OPEN_HASH_STRIPE_COUNT : 1;
+			status = STATUS_SUCCESS;
+			switch (Type) {
+				case httPassiveLevel:
+					tmpTable->Locks = (PERESOURCE)HeapMemoryAllocNonPaged(tmpTable->StripeCount*sizeof(ERESOURCE));
+					if (tmpTable->Locks != NULL) {
+						for (i = 0; i < (LONG)tmpTable->StripeCount; ++i) {
+							status = ExInitializeResourceLite(tmpTable->Locks + i);
+							if (!NT_SUCCESS(status)) {
+								while (i > 0) {
+									--i;
+									ExDeleteResourceLite(tmpTable->Locks + i);
+								}
+
+								HeapMemoryFree(tmpTable->Locks);
+								break;
+							}
+						}
+					} else status = STATUS_INSUFFICIENT_RESOURCES;
+					break;
+				case httDispatchLevel:
+					tmpTable->Stripes = (POPEN_HASH_STRIPE)_AllocAligned(tmpTable->StripeCount*sizeof(OPEN_HASH_STRIPE), &tmpTable->StripesAllocation);
+					if (tmpTable->Stripes == NULL)
+						status = STATUS_INSUFFICIENT_RESOURCES;
+					break;
+				default:
+					break;
+			}
+
+			if (NT_SUCCESS(status)) {
+				tmpTable->Array = _ArrayAlloc(bucketCount);
+				if (tmpTable->Array != NULL)
+					*Table = tmpTable;
+				else status = STATUS_INSUFFICIENT_RESOURCES;
+
+				if (!NT_SUCCESS(status)) {
+					if (tmpTable->Locks != NULL) {
+						for (i = 0; i < (LONG)tmpTable->StripeCount; ++i)
+							ExDeleteResourceLite(tmpTable->Locks + i);
+
+						HeapMemoryFree(tmpTable->Locks);
+					}
+
+					if (tmpTable->StripesAllocation != NULL)
+						HeapMemoryFree(tmpTable->StripesAllocation);
+				}
+			}
+
+			if (!NT_SUCCESS(status))
+				HeapMemoryFree(tmpTable);
+		} else status = STATUS_INSUFFICIENT_RESOURCES;
+	} else {
+		status = STATUS_INVALID_PARAMETER;
+		if (Type != httPassiveLevel && Type != httDispatchLevel && Type != httNoSynchronization)
+			status = STATUS_INVALID_PARAMETER_1;
+		else if (Size == 0)
+			status = STATUS_INVALID_PARAMETER_2;
+		else if (HashFunction == NULL)
+			status = STATUS_INVALID_PARAMETER_3;
+		else if (CompareFunction == NULL)
+			status = STATUS_INVALID_PARAMETER_4;
+	}
+
+	DEBUG_EXIT_FUNCTION("0x%x, *Table=0x%p", status, *Table);
+	return status;
+}
+
+
+/** Destroys a given open hash table, calling the free function for every
+ *  object stored in it.
+ */
+VOID OpenHashTableDestroy(POPEN_HASH_TABLE Table)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	PVOID obj = NULL;
+	POPEN_HASH_ARRAY array = NULL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p", Table);
+
+	array = Table->Array;
+	if (Table->FreeFunction != NULL) {
+		for (b = 0; b < array->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+			for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+				obj = array->Buckets[b].Objects[i];
+				if (obj != NULL)
+					Table->FreeFunction(obj);
+			}
+		}
+	}
+
+	HeapMemoryFree(array);
+	if (Table->Locks != NULL) {
+		for (i = 0; i < Table->StripeCount; ++i)
+			ExDeleteResourceLite(Table->Locks + i);
+
+		HeapMemoryFree(Table->Locks);
+	}
+
+	if (Table->StripesAllocation != NULL)
+		HeapMemoryFree(Table->StripesAllocation);
+
+	HeapMemoryFree(Table);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+/** Inserts an object into a given open hash table. The table does not check
+ *  for duplicates.
+ *
+ *  @return
+ *  Returns STATUS_INSUFFICIENT_RESOURCES if the table needed to grow and
+ *  there is not enough memory.
+ */
+NTSTATUS OpenHashTableInsert(POPEN_HASH_TABLE Table, PVOID Object, PVOID Key)
+{
+	ULONG home = 0;
+	ULONG32 hash = 0;
+	BOOLEAN inserted = FALSE;
+	POPEN_HASH_ARRAY array = NULL;
+	OPEN_HASH_LOCK_STATE state;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Object=0x%p; Key=0x%p", Table, Object, Key);
+
+	hash = Table->HashFunction(Key);
+	status = STATUS_SUCCESS;
+	do {
+		home = _LockHome(Table, hash, TRUE, &state);
+		array = state.Array;
+		if (_LoadAllowsInsert(Table, array)) {
+			inserted = _SlotPut(Table, &state, array, home, hash, Object);
+			if (inserted)
+				InterlockedIncrement(&Table->NumberOfItems);
+		}
+
+		_Unlock(Table, &state);
+		if (!inserted)
+			status = _Grow(Table, array);
+	} while (NT_SUCCESS(status) && !inserted);
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+/** Deletes an object stored under a given key.
+ *
+ *  @return
+ *  Returns the object deleted, or NULL if no object with the key exists.
+ */
+PVOID OpenHashTableDelete(POPEN_HASH_TABLE Table, PVOID Key)
+{
+	ULONG home = 0;
+	ULONG slot = 0;
+	ULONG bucket = 0;
+	ULONG32 hash = 0;
+	OPEN_HASH_LOCK_STATE state;
+	PVOID ret = NULL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Key=0x%p", Table, Key);
+
+	hash = Table->HashFunction(Key);
+	home = _LockHome(Table, hash, TRUE, &state);
+	if (_SlotFind(Table, &state, home, hash, Key, &bucket, &slot)) {
+		ret = state.Array->Buckets[bucket].Objects[slot];
+		state.Array->Buckets[bucket].Objects[slot] = NULL;
+		_SlotsShiftBack(Table, &state, bucket, slot);
+		InterlockedDecrement(&Table->NumberOfItems);
+	}
+
+	_Unlock(Table, &state);
+
+	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	return ret;
+}
+
+
+/** Retrieves an object stored under a given key, or NULL if there is none. */
+PVOID OpenHashTableGet(POPEN_HASH_TABLE Table, PVOID Key)
+{
+	ULONG home = 0;
+	ULONG slot = 0;
+	ULONG bucket = 0;
+	ULONG32 hash = 0;
+	OPEN_HASH_LOCK_STATE state;
+	PVOID ret = NULL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Key=0x%p", Table, Key);
+
+	hash = Table->HashFunction(Key);
+	home = _LockHome(Table, hash, FALSE, &state);
+	if (_SlotFind(Table, &state, home, hash, Key, &bucket, &slot))
+		ret = state.Array->Buckets[bucket].Objects[slot];
+
+	_Unlock(Table, &state);
+
+	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	return ret;
+}
+
+
+/** Invokes a callback for every object in the table. The whole table is
+ *  locked exclusively meanwhile, the callback must not alter its contents.
+ */
+VOID OpenHashTablePerform(POPEN_HASH_TABLE Table, OPEN_HASH_CALLBACK Callback, PVOID Context)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	PVOID obj = NULL;
+	OPEN_HASH_LOCK_STATE state;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Callback=0x%p; Context=0x%p", Table, Callback, Context);
+
+	_LockAll(Table, &state);
+	for (b = 0; b < state.Array->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+		for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+			obj = state.Array->Buckets[b].Objects[i];
+			if (obj != NULL)
+				Callback(obj, Context);
+		}
+	}
+
+	_Unlock(Table, &state);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+/** Invokes a callback for every object in the table until the callback
+ *  returns FALSE. The whole table is locked exclusively meanwhile.
+ */
+VOID OpenHashTablePerformWithFeedback(POPEN_HASH_TABLE Table, OPEN_HASH_CALLBACK_WITH_FEEDBACK *Callback, PVOID Context)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	PVOID obj = NULL;
+	BOOLEAN cancelled = FALSE;
+	OPEN_HASH_LOCK_STATE state;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Callback=0x%p; Context=0x%p", Table, Callback, Context);
+
+	_LockAll(Table, &state);
+	for (b = 0; !cancelled && b < state.Array->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+		for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+			obj = state.Array->Buckets[b].Objects[i];
+			if (obj != NULL) {
+				cancelled = !Callback(obj, Context);
+				if (cancelled)
+					break;
+			}
+		}
+	}
+
+	_Unlock(Table, &state);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+/** Removes all objects from the table, optionally calling the free function
+ *  for each of them. The bucket array keeps its size.
+ */
+VOID OpenHashTableClear(POPEN_HASH_TABLE Table, BOOLEAN CallFreeFunction)
+{
+	ULONG i = 0;
+	ULONG b = 0;
+	PVOID obj = NULL;
+	OPEN_HASH_LOCK_STATE state;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; CallFreeFunction=%u", Table, CallFreeFunction);
+
+	_LockAll(Table, &state);
+	for (b = 0; b < state.Array->BucketCount + OPEN_HASH_OVERFLOW_BUCKETS; ++b) {
+		for (i = 0; i < OPEN_HASH_BUCKET_SLOTS; ++i) {
+			obj = state.Array->Buckets[b].Objects[i];
+			if (obj != NULL) {
+				state.Array->Buckets[b].Objects[i] = NULL;
+				if (CallFreeFunction && Table->FreeFunction != NULL)
+					Table->FreeFunction(obj);
+			}
+		}
+	}
+
+	Table->NumberOfItems = 0;
+	_Unlock(Table, &state);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+ULONG OpenHashTableGetItemCount(POPEN_HASH_TABLE Table)
+{
+	ULONG ret = 0;
+	DEBUG_ENTER_FUNCTION("Table=0x%p", Table);
+
+	ret = (ULONG)Table->NumberOfItems;
+
+	DEBUG_EXIT_FUNCTION("%u", ret);
+	return ret;
+}
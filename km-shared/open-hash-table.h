@@ -0,0 +1,100 @@
+/**
+ * @file:
+ *
+ * Exposes data types and routine definitions for open-addressing hash tables.
+ */
+
+#ifndef __OPEN_HASH_TABLE_H__
+#define __OPEN_HASH_TABLE_H__
+
+#include <ntifs.h>
+#include "hash_table.h"
+
+
+/** Size of one bucket, equal to the size of a cache line. */
+#define OPEN_HASH_BUCKET_SIZE				64
+/** Number of (hash, object) pairs stored in one bucket. */
+#define OPEN_HASH_BUCKET_SLOTS				(OPEN_HASH_BUCKET_SIZE / (sizeof(ULONG32) + sizeof(PVOID)))
+
+
+/** Prototype of an open hash table compare function. Determines whether
+ *  an object stored in the table matches a given key. Called only for
+ *  objects the hash of which matches the hash of the key.
+ */
+typedef BOOLEAN (*OPEN_HASH_COMPARE_FUNCTION)(PVOID Object, PVOID Key);
+
+/** Prototype of an open hash table free function, invoked for every object
+ *  in the table when the table is destroyed or cleared.
+ */
+typedef VOID (*OPEN_HASH_FREE_FUNCTION)(PVOID Object);
+
+/** Prototype of a callback invoked for every object by @link(OpenHashTablePerform). */
+typedef VOID (*OPEN_HASH_CALLBACK)(PVOID Object, PVOID Context);
+
+/** Prototype of a callback invoked for every object by @link(OpenHashTablePerformWithFeedback).
+ *  Returning FALSE stops the traversal.
+ */
+typedef BOOLEAN (OPEN_HASH_CALLBACK_WITH_FEEDBACK)(PVOID Object, PVOID Context);
+
+/** One cache line of the table. A slot is free when its object is NULL. */
+typedef struct _OPEN_HASH_BUCKET {
+	/** Hashes of the objects, returned by the hash function of the table. */
+	ULONG32 Hashes[OPEN_HASH_BUCKET_SLOTS];
+	/** The objects. */
+	PVOID Objects[OPEN_HASH_BUCKET_SLOTS];
+} OPEN_HASH_BUCKET, *POPEN_HASH_BUCKET;
+
+/** Bucket array of an open hash table. Replaced as a whole when the table grows. */
+typedef struct _OPEN_HASH_ARRAY {
+	/** Number of buckets an object can hash to, always a power of two. The array
+	    contains a few more buckets at its end, so the probing never wraps around. */
+	ULONG BucketCount;
+	/** Shift extracting a bucket index from a spread hash. */
+	ULONG Shift;
+	/** Shift converting a bucket index to a stripe index. */
+	ULONG StripeShift;
+	/** Address of the first bucket, aligned to OPEN_HASH_BUCKET_SIZE. */
+	POPEN_HASH_BUCKET Buckets;
+} OPEN_HASH_ARRAY, *POPEN_HASH_ARRAY;
+
+/** A stripe lock of a dispatch IRQL table, padded to a cache line. */
+typedef struct _OPEN_HASH_STRIPE {
+	EX_SPIN_LOCK Lock;
+	UCHAR Reserved[OPEN_HASH_BUCKET_SIZE - sizeof(EX_SPIN_LOCK)];
+} OPEN_HASH_STRIPE, *POPEN_HASH_STRIPE;
+
+/** Represents an open hash table. */
+typedef struct _OPEN_HASH_TABLE {
+	/** Type of the table, determines the synchronization. */
+	EHashTableType Type;
+	HASH_FUNCTION HashFunction;
+	OPEN_HASH_COMPARE_FUNCTION CompareFunction;
+	OPEN_HASH_FREE_FUNCTION FreeFunction;
+	/** Number of stripe locks. Each lock protects a range of consecutive
+	    buckets. */
+	ULONG StripeCount;
+	/** Stripe locks of a passive IRQL table. */
+	PERESOURCE Locks;
+	/** Stripe locks of a dispatch IRQL table. */
+	POPEN_HASH_STRIPE Stripes;
+	PVOID StripesAllocation;
+	/** The current bucket array. */
+	POPEN_HASH_ARRAY volatile Array;
+	/** Number of objects stored in the table. */
+	volatile LONG NumberOfItems;
+} OPEN_HASH_TABLE, *POPEN_HASH_TABLE;
+
+
+NTSTATUS OpenHashTableCreate(EHashTableType Type, ULONG32 Size, HASH_FUNCTION HashFunction, OPEN_HASH_COMPARE_FUNCTION CompareFunction, OPEN_HASH_FREE_FUNCTION FreeFunction, POPEN_HASH_TABLE *Table);
+VOID OpenHashTableDestroy(POPEN_HASH_TABLE Table);
+NTSTATUS OpenHashTableInsert(POPEN_HASH_TABLE Table, PVOID Object, PVOID Key);
+PVOID OpenHashTableDelete(POPEN_HASH_TABLE Table, PVOID Key);
+PVOID OpenHashTableGet(POPEN_HASH_TABLE Table, PVOID Key);
+VOID OpenHashTablePerform(POPEN_HASH_TABLE Table, OPEN_HASH_CALLBACK Callback, PVOID Context);
+VOID OpenHashTablePerformWithFeedback(POPEN_HASH_TABLE Table, OPEN_HASH_CALLBACK_WITH_FEEDBACK *Callback, PVOID Context);
+VOID OpenHashTableClear(POPEN_HASH_TABLE Table, BOOLEAN CallFreeFunction);
+ULONG OpenHashTableGetItemCount(POPEN_HASH_TABLE Table);
+
+
+
+#endif
@@ -0,0 +1,774 @@
+
+#include <ntifs.h>
+#include "preprocessor.h"
+#include "allocator.h"
+#include "sharded-ref-table.h"
+
+
+/** Marks a slot of a deleted object. Readers walk over such slots, the writers
+    may reuse them. */
+#define SHARDED_REF_DELETED					((PVOID)1)
+
+/** Size of the slot array allocated for the first object of a shard. */
+#define SHARDED_REF_MIN_SIZE				16
+
+/** Bounds of the shard count. The table uses twice as many shards as there
+    are processors, within these limits. */
+#define SHARDED_REF_MIN_SHARDS				8
+#define SHARDED_REF_MAX_SHARDS				64
+
+C_ASSERT(sizeof(SHARDED_REF_SHARD) <= sizeof(SHARDED_REF_SHARD_PADDED));
+
+
+/************************************************************************/
+/*                 HELPER FUNCTIONS                                     */
+/************************************************************************/
+
+static SIZE_T _Hash(_In_ PVOID Key)
+{
+	ULONG_PTR k = (ULONG_PTR)Key >> 3;
+
+	k ^= (k >> 15);
+	k *= 0x9E3779B1;
+	k ^= (k >> 13);
+
+	return k;
+}
+
+
+static PVOID _ObjectKey(_In_ const SHARDED_REF_TABLE *Table, _In_ PVOID Object)
+{
+	return *(PVOID *)((PUCHAR)Object + Table->ObjectKeyOffset);
+}
+
+
+static PVOID *_ObjectLink(_In_ const SHARDED_REF_TABLE *Table, _In_ PVOID Object)
+{
+	return (PVOID *)((PUCHAR)Object + Table->ObjectLinkOffset);
+}
+
+
+static PSHARDED_REF_SHARD _ShardGet(_In_ const SHARDED_REF_TABLE *Table, _In_ SIZE_T Hash)
+{
+	return &Table->Shards[Hash & (Table->ShardCount - 1)].Shard;
+}
+
+
+static SIZE_T _SlotIndex(_In_ const SHARDED_REF_TABLE *Table, _In_ SIZE_T Hash, _In_ SIZE_T Mask)
+{
+	return (Hash >> Table->ShardShift) & Mask;
+}
+
+
+static VOID _NOPRoutine(_Inout_ PVOID Object)
+{
+	UNREFERENCED_PARAMETER(Object);
+
+	return;
+}
+
+
+static PVOID _AllocAligned(_In_ SIZE_T Size, _Out_ PVOID *Allocation)
+{
+	PVOID ret = NULL;
+
+	*Allocation = HeapMemoryAllocNonPaged(Size + SHARDED_REF_CACHE_LINE - 1);
+	if (*Allocation != NULL) {
+		memset(*Allocation, 0, Size + SHARDED_REF_CACHE_LINE - 1);
+		ret = (PVOID)(((ULONG_PTR)*Allocation + SHARDED_REF_CACHE_LINE - 1) & ~((ULONG_PTR)SHARDED_REF_CACHE_LINE - 1));
+	}
+
+	return ret;
+}
+
+
+/** Announces a reader running on the current processor. The epoch is published
+ *  before any slot is read, so the writers do not advance the epoch past it until
+ *  the reader leaves.
+ *
+ *  @remark
+ *  The caller must run at DISPATCH_LEVEL.
+ */
+static PSHARDED_REF_READER _ReaderEnter(_In_ PSHARDED_REF_TABLE Table)
+{
+	ULONG index = 0;
+	PSHARDED_REF_READER ret = NULL;
+
+	index = KeGetCurrentProcessorNumberEx(NULL);
+	ASSERT(index < Table->ReaderCount);
+	ret = Table->Readers + index;
+	ret->State.Epoch = (ULONG)ReadAcquire((volatile LONG *)&Table->Epoch);
+	InterlockedExchange(&ret->State.Active, TRUE);
+
+	return ret;
+}
+
+
+static VOID _ReaderLeave(_Inout_ PSHARDED_REF_READER Reader)
+{
+	InterlockedExchange(&Reader->State.Active, FALSE);
+
+	return;
+}
+
+
+/** Advances the table epoch if every running reader started in the current one,
+ *  so memory retired two epochs ago cannot be seen by any reader.
+ */
+static VOID _EpochTryAdvance(_Inout_ PSHARDED_REF_TABLE Table)
+{
+	ULONG i = 0;
+	ULONG epoch = 0;
+	BOOLEAN advance = TRUE;
+	PSHARDED_REF_READER r = NULL;
+
+	// The unlinking interlocked operations of the writer fence these loads
+	// against the reader publishing its state, the acquire loads keep their
+	// order on weakly ordered processors.
+	epoch = (ULONG)ReadAcquire((volatile LONG *)&Table->Epoch);
+	for (i = 0; i < Table->ReaderCount; ++i) {
+		r = Table->Readers + i;
+		if (ReadAcquire(&r->State.Active) && (ULONG)ReadAcquire((volatile LONG *)&r->State.Epoch) != epoch) {
+			advance = FALSE;
+			break;
+		}
+	}
+
+	if (advance)
+		InterlockedCompareExchange((volatile LONG *)&Table->Epoch, (LONG)(epoch + 1), (LONG)epoch);
+
+	return;
+}
+
+
+/** Dereferences retired objects and frees retired slot arrays. */
+static VOID _RetiredFree(_In_ PSHARDED_REF_TABLE Table, _Inout_ PSHARDED_REF_RETIRED Retired)
+{
+	PVOID obj = NULL;
+	PSHARDED_REF_SLOTS old = NULL;
+
+	while (Retired->Objects != NULL) {
+		obj = Retired->Objects;
+		Retired->Objects = *_ObjectLink(Table, obj);
+		Table->Dereference(obj);
+	}
+
+	while (Retired->Slots != NULL) {
+		old = Retired->Slots;
+		Retired->Slots = old->NextRetired;
+		HeapMemoryFree(old);
+	}
+
+	return;
+}
+
+
+/** Detaches the memory of the shard retired at least two epochs ago into
+ *  Reclaimed (an array of SHARDED_REF_EPOCHS entries) and retires the objects
+ *  and the slot array given, if any. The epoch is read only after the caller
+ *  unlinked them, so every reader able to see them started in the epoch or
+ *  in an older one.
+ *
+ *  @param Objects Objects to retire, linked through the pointers at ObjectLinkOffset.
+ *
+ *  @return
+ *  Returns TRUE if the shard still holds retired memory, so the epoch should
+ *  advance.
+ *
+ *  @remark
+ *  The shard lock must be held by the caller.
+ */
+static BOOLEAN _ShardRetire(_In_ PSHARDED_REF_TABLE Table, _Inout_ PSHARDED_REF_SHARD Shard, _In_opt_ PVOID Objects, _In_opt_ PSHARDED_REF_SLOTS Slots, _Out_ PSHARDED_REF_RETIRED Reclaimed)
+{
+	ULONG i = 0;
+	ULONG epoch = 0;
+	PVOID last = NULL;
+	PSHARDED_REF_RETIRED r = NULL;
+	BOOLEAN ret = FALSE;
+
+	epoch = (ULONG)ReadAcquire((volatile LONG *)&Table->Epoch);
+	for (i = 0; i < SHARDED_REF_EPOCHS; ++i) {
+		r = Shard->Retired + i;
+		Reclaimed[i] = *r;
+		if ((r->Objects != NULL || r->Slots != NULL) && (LONG)(epoch - r->Epoch) >= 2) {
+			r->Objects = NULL;
+			r->Slots = NULL;
+		} else {
+			Reclaimed[i].Objects = NULL;
+			Reclaimed[i].Slots = NULL;
+		}
+	}
+
+	r = Shard->Retired + (epoch % SHARDED_REF_EPOCHS);
+	if (Objects != NULL || Slots != NULL) {
+		ASSERT((r->Objects == NULL && r->Slots == NULL) || r->Epoch == epoch);
+		r->Epoch = epoch;
+		if (Objects != NULL) {
+			last = Objects;
+			while (*_ObjectLink(Table, last) != NULL)
+				last = *_ObjectLink(Table, last);
+
+			*_ObjectLink(Table, last) = r->Objects;
+			r->Objects = Objects;
+		}
+
+		if (Slots != NULL) {
+			Slots->NextRetired = r->Slots;
+			r->Slots = Slots;
+		}
+	}
+
+	for (i = 0; i < SHARDED_REF_EPOCHS; ++i) {
+		r = Shard->Retired + i;
+		if (r->Objects != NULL || r->Slots != NULL) {
+			ret = TRUE;
+			break;
+		}
+	}
+
+	Shard->Pending = ret;
+
+	return ret;
+}
+
+
+/** Replaces the slot array of a shard by a new one large enough to take at
+ *  least one more object and free of deleted slots. The old array is returned
+ *  to the caller to be retired since readers may still walk it.
+ *
+ *  @remark
+ *  The shard lock must be held by the caller.
+ */
+static NTSTATUS _SlotsRebuild(_In_ PSHARDED_REF_TABLE Table, _Inout_ PSHARDED_REF_SHARD Shard, _Out_ PSHARDED_REF_SLOTS *Old)
+{
+	SIZE_T i = 0;
+	SIZE_T index = 0;
+	SIZE_T size = SHARDED_REF_MIN_SIZE;
+	PVOID obj = NULL;
+	PSHARDED_REF_SLOTS old = NULL;
+	PSHARDED_REF_SLOTS slots = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Shard=0x%p; Old=0x%p", Table, Shard, Old);
+
+	*Old = NULL;
+	while (size < (Shard->ItemCount + 1)*2)
+		size *= 2;
+
+	slots = (PSHARDED_REF_SLOTS)HeapMemoryAllocNonPaged(FIELD_OFFSET(SHARDED_REF_SLOTS, Objects) + size*sizeof(PVOID));
+	if (slots != NULL) {
+		memset(slots, 0, FIELD_OFFSET(SHARDED_REF_SLOTS, Objects) + size*sizeof(PVOID));
+		slots->Size = size;
+		old = Shard->Slots;
+		if (old != NULL) {
+			for (i = 0; i < old->Size; ++i) {
+				obj = old->Objects[i];
+				if (obj != NULL && obj != SHARDED_REF_DELETED) {
+					index = _SlotIndex(Table, _Hash(_ObjectKey(Table, obj)), size - 1);
+					while (slots->Objects[index] != NULL)
+						index = (index + 1) & (size - 1);
+
+					slots->Objects[index] = obj;
+				}
+			}
+		}
+
+		Shard->UsedCount = Shard->ItemCount;
+		InterlockedExchangePointer((PVOID volatile *)&Shard->Slots, slots);
+		*Old = old;
+		status = STATUS_SUCCESS;
+	} else status = STATUS_INSUFFICIENT_RESOURCES;
+
+	DEBUG_EXIT_FUNCTION("0x%x, *Old=0x%p", status, *Old);
+	return status;
+}
+
+
+/** Releases the memory reclaimed by a writer and, if there is still some retired
+ *  memory in the shard, tries to move the epoch further so the next writer can
+ *  release it.
+ */
+static VOID _WriterFinish(_In_ PSHARDED_REF_TABLE Table, _Inout_ PSHARDED_REF_RETIRED Reclaimed, _In_ BOOLEAN Pending)
+{
+	ULONG i = 0;
+
+	for (i = 0; i < SHARDED_REF_EPOCHS; ++i)
+		_RetiredFree(Table, Reclaimed + i);
+
+	if (Pending)
+		_EpochTryAdvance(Table);
+
+	return;
+}
+
+
+/** Releases the memory of a shard retired at least two epochs ago, if the shard
+ *  lock is free. Lets the readers and enumerations release the memory retired
+ *  by the writers, so it does not wait for the next writer of the shard.
+ *
+ *  @remark
+ *  The caller must run at DISPATCH_LEVEL and must not be a reader.
+ */
+static VOID _ShardTryReclaim(_In_ PSHARDED_REF_TABLE Table, _Inout_ PSHARDED_REF_SHARD Shard)
+{
+	BOOLEAN pending = FALSE;
+	SHARDED_REF_RETIRED reclaimed[SHARDED_REF_EPOCHS];
+
+	if (KeTryToAcquireSpinLockAtDpcLevel(&Shard->Lock)) {
+		pending = _ShardRetire(Table, Shard, NULL, NULL, reclaimed);
+		KeReleaseSpinLockFromDpcLevel(&Shard->Lock);
+		_WriterFinish(Table, reclaimed, pending);
+	}
+
+	return;
+}
+
+
+/************************************************************************/
+/*                   PUBLIC FUNCTIONS                                   */
+/************************************************************************/
+
+/** Initializes a sharded reference table. The number of shards depends on
+ *  the number of active processors. ObjectLinkOffset is the offset of a pointer
+ *  field of the objects, owned by the table from the moment an object is deleted
+ *  until the table releases its reference to it.
+ */
+NTSTATUS ShardedRefTableInit(_In_ SIZE_T ObjectKeyOffset, _In_ SIZE_T ObjectLinkOffset, _In_opt_ SHARDED_REF_REFERENCE *Reference, _In_opt_ SHARDED_REF_DEREFERENCE *Dereference, _Out_ PSHARDED_REF_TABLE Table)
+{
+	ULONG i = 0;
+	ULONG cpuCount = 0;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("ObjectKeyOffset=%Iu; ObjectLinkOffset=%Iu; Reference=0x%p; Dereference=0x%p; Table=0x%p", ObjectKeyOffset, ObjectLinkOffset, Reference, Dereference, Table);
+
+	memset(Table, 0, sizeof(SHARDED_REF_TABLE));
+	Table->ObjectKeyOffset = ObjectKeyOffset;
+	Table->ObjectLinkOffset = ObjectLinkOffset;
+	Table->Reference = (Reference != NULL) ? Reference : _NOPRoutine;
+	Table->Dereference = (Dereference != NULL) ? Dereference : _NOPRoutine;
+	cpuCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	Table->ShardCount = SHARDED_REF_MIN_SHARDS;
+	while (Table->ShardCount < cpuCount*2 && Table->ShardCount < SHARDED_REF_MAX_SHARDS)
+		Table->ShardCount *= 2;
+
+	while (((ULONG)1 << Table->ShardShift) < Table->ShardCount)
+		++Table->ShardShift;
+
+	Table->Shards = (PSHARDED_REF_SHARD_PADDED)_AllocAligned(Table->ShardCount*sizeof(SHARDED_REF_SHARD_PADDED), &Table->ShardsAllocation);
+	if (Table->Shards != NULL) {
+		for (i = 0; i < Table->ShardCount; ++i)
+			KeInitializeSpinLock(&Table->Shards[i].Shard.Lock);
+
+		Table->ReaderCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+		Table->Readers = (PSHARDED_REF_READER)_AllocAligned(Table->ReaderCount*sizeof(SHARDED_REF_READER), &Table->ReadersAllocation);
+		if (Table->Readers != NULL)
+			status = STATUS_SUCCESS;
+		else status = STATUS_INSUFFICIENT_RESOURCES;
+
+		if (!NT_SUCCESS(status)) {
+			HeapMemoryFree(Table->ShardsAllocation);
+			Table->ShardsAllocation = NULL;
+			Table->Shards = NULL;
+		}
+	} else status = STATUS_INSUFFICIENT_RESOURCES;
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+/** Dereferences all objects, including the retired ones, and frees the table memory.
+ *
+ *  @remark
+ *  The caller must ensure no reader or writer can access the table anymore.
+ *  The routine can be called at IRQL <= DISPATCH_LEVEL.
+ */
+VOID ShardedRefTableFinit(_In_ PSHARDED_REF_TABLE Table)
+{
+	ULONG i = 0;
+	ULONG j = 0;
+	SIZE_T k = 0;
+	PVOID obj = NULL;
+	PSHARDED_REF_SHARD shard = NULL;
+	PSHARDED_REF_SLOTS slots = NULL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p", Table);
+
+	for (i = 0; i < Table->ShardCount; ++i) {
+		shard = &Table->Shards[i].Shard;
+		slots = shard->Slots;
+		shard->Slots = NULL;
+		if (slots != NULL) {
+			for (k = 0; k < slots->Size; ++k) {
+				obj = slots->Objects[k];
+				if (obj != NULL && obj != SHARDED_REF_DELETED)
+					Table->Dereference(obj);
+			}
+
+			HeapMemoryFree(slots);
+		}
+
+		for (j = 0; j < SHARDED_REF_EPOCHS; ++j)
+			_RetiredFree(Table, shard->Retired + j);
+
+		shard->ItemCount = 0;
+		shard->UsedCount = 0;
+	}
+
+	if (Table->ReadersAllocation != NULL)
+		HeapMemoryFree(Table->ReadersAllocation);
+
+	if (Table->ShardsAllocation != NULL)
+		HeapMemoryFree(Table->ShardsAllocation);
+
+	memset(Table, 0, sizeof(SHARDED_REF_TABLE));
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+/** Removes all objects from the table and dereferences them, together with
+ *  everything retired before. Unlike the other routines, it waits for the readers
+ *  that might still see the objects, so the references are released when it returns.
+ *
+ *  @remark
+ *  The routine can be called at IRQL <= DISPATCH_LEVEL. The readers run
+ *  at DISPATCH_LEVEL and never wait, so the wait is short.
+ */
+VOID ShardedRefTableClear(_In_ PSHARDED_REF_TABLE Table)
+{
+	KIRQL irql;
+	ULONG i = 0;
+	ULONG epoch = 0;
+	SIZE_T k = 0;
+	PVOID obj = NULL;
+	PVOID objects = NULL;
+	BOOLEAN pending = FALSE;
+	PSHARDED_REF_SHARD shard = NULL;
+	PSHARDED_REF_SLOTS slots = NULL;
+	SHARDED_REF_RETIRED reclaimed[SHARDED_REF_EPOCHS];
+	DEBUG_ENTER_FUNCTION("Table=0x%p", Table);
+
+	for (i = 0; i < Table->ShardCount; ++i) {
+		shard = &Table->Shards[i].Shard;
+		objects = NULL;
+		KeAcquireSpinLock(&shard->Lock, &irql);
+		slots = shard->Slots;
+		if (slots != NULL) {
+			InterlockedExchangePointer((PVOID volatile *)&shard->Slots, NULL);
+			for (k = 0; k < slots->Size; ++k) {
+				obj = slots->Objects[k];
+				if (obj != NULL && obj != SHARDED_REF_DELETED) {
+					*_ObjectLink(Table, obj) = objects;
+					objects = obj;
+				}
+			}
+
+			shard->ItemCount = 0;
+			shard->UsedCount = 0;
+		}
+
+		_ShardRetire(Table, shard, objects, slots, reclaimed);
+		KeReleaseSpinLock(&shard->Lock, irql);
+		_WriterFinish(Table, reclaimed, FALSE);
+	}
+
+	// Everything is unlinked now, wait until readers that started before
+	// cannot be running anymore.
+	epoch = (ULONG)ReadAcquire((volatile LONG *)&Table->Epoch);
+	while ((LONG)((ULONG)ReadAcquire((volatile LONG *)&Table->Epoch) - epoch) < 2) {
+		_EpochTryAdvance(Table);
+		YieldProcessor();
+	}
+
+	for (i = 0; i < Table->ShardCount; ++i) {
+		shard = &Table->Shards[i].Shard;
+		KeAcquireSpinLock(&shard->Lock, &irql);
+		pending = _ShardRetire(Table, shard, NULL, NULL, reclaimed);
+		KeReleaseSpinLock(&shard->Lock, irql);
+		_WriterFinish(Table, reclaimed, pending);
+	}
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+/** Inserts a new object into the table and references it. Only the shard
+ *  the key hashes to is locked. Can be called at IRQL <= DISPATCH_LEVEL.
+ *
+ *  @return
+ *  STATUS_OBJECT_NAME_COLLISION is returned if an object with the same key is
+ *  already present.
+ *
+ *  @remark
+ *  An object deleted from the table must not be inserted again, since the table
+ *  may still use its link field.
+ */
+NTSTATUS ShardedRefTableInsert(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Object)
+{
+	KIRQL irql;
+	SIZE_T hash = 0;
+	SIZE_T mask = 0;
+	SIZE_T index = 0;
+	SIZE_T freeIndex = 0;
+	PVOID key = NULL;
+	PVOID current = NULL;
+	BOOLEAN pending = FALSE;
+	PSHARDED_REF_SHARD shard = NULL;
+	PSHARDED_REF_SLOTS slots = NULL;
+	PSHARDED_REF_SLOTS old = NULL;
+	SHARDED_REF_RETIRED reclaimed[SHARDED_REF_EPOCHS];
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Object=0x%p", Table, Object);
+
+	key = _ObjectKey(Table, Object);
+	hash = _Hash(key);
+	shard = _ShardGet(Table, hash);
+	status = STATUS_SUCCESS;
+	KeAcquireSpinLock(&shard->Lock, &irql);
+	slots = shard->Slots;
+	if (slots == NULL || (shard->UsedCount + 1)*4 > slots->Size*3) {
+		status = _SlotsRebuild(Table, shard, &old);
+		slots = shard->Slots;
+	}
+
+	if (NT_SUCCESS(status)) {
+		mask = slots->Size - 1;
+		freeIndex = slots->Size;
+		index = _SlotIndex(Table, hash, mask);
+		current = slots->Objects[index];
+		while (current != NULL) {
+			if (current == SHARDED_REF_DELETED) {
+				if (freeIndex == slots->Size)
+					freeIndex = index;
+			} else if (_ObjectKey(Table, current) == key) {
+				status = STATUS_OBJECT_NAME_COLLISION;
+				break;
+			}
+
+			index = (index + 1) & mask;
+			current = slots->Objects[index];
+		}
+
+		if (NT_SUCCESS(status)) {
+			if (freeIndex == slots->Size) {
+				freeIndex = index;
+				++shard->UsedCount;
+			}
+
+			Table->Reference(Object);
+			InterlockedExchangePointer(slots->Objects + freeIndex, Object);
+			++shard->ItemCount;
+		}
+	}
+
+	pending = _ShardRetire(Table, shard, NULL, old, reclaimed);
+	KeReleaseSpinLock(&shard->Lock, irql);
+	_WriterFinish(Table, reclaimed, pending);
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+/** Removes an object from the table and returns it referenced for the caller.
+ *  Readers may still be using the object, so the reference held by the table
+ *  is released only after they leave. Can be called at IRQL <= DISPATCH_LEVEL,
+ *  it never waits for the readers.
+ */
+PVOID ShardedRefTableDelete(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Key)
+{
+	KIRQL irql;
+	SIZE_T hash = 0;
+	SIZE_T mask = 0;
+	SIZE_T index = 0;
+	PVOID current = NULL;
+	BOOLEAN pending = FALSE;
+	PSHARDED_REF_SHARD shard = NULL;
+	PSHARDED_REF_SLOTS slots = NULL;
+	SHARDED_REF_RETIRED reclaimed[SHARDED_REF_EPOCHS];
+	PVOID ret = NULL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Key=0x%p", Table, Key);
+
+	hash = _Hash(Key);
+	shard = _ShardGet(Table, hash);
+	KeAcquireSpinLock(&shard->Lock, &irql);
+	slots = shard->Slots;
+	if (slots != NULL) {
+		mask = slots->Size - 1;
+		index = _SlotIndex(Table, hash, mask);
+		current = slots->Objects[index];
+		while (current != NULL) {
+			if (current != SHARDED_REF_DELETED && _ObjectKey(Table, current) == Key) {
+				ret = current;
+				*_ObjectLink(Table, ret) = NULL;
+				InterlockedExchangePointer(slots->Objects + index, SHARDED_REF_DELETED);
+				--shard->ItemCount;
+				Table->Reference(ret);
+				break;
+			}
+
+			index = (index + 1) & mask;
+			current = slots->Objects[index];
+		}
+	}
+
+	pending = _ShardRetire(Table, shard, ret, NULL, reclaimed);
+	KeReleaseSpinLock(&shard->Lock, irql);
+	_WriterFinish(Table, reclaimed, pending);
+
+	DEBUG_EXIT_FUNCTION("0x%p", ret);
+	return ret;
+}
+
+
+VOID ShardedRefTableDeleteDereference(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Key)
+{
+	PVOID obj = NULL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Key=0x%p", Table, Key);
+
+	obj = ShardedRefTableDelete(Table, Key);
+	if (obj != NULL)
+		Table->Dereference(obj);
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+/** Finds an object by its key and references it. The routine takes no lock,
+ *  it only announces itself in the reader record of the current processor
+ *  while walking the slots. Can be called at IRQL <= DISPATCH_LEVEL.
+ *
+ *  @remark
+ *  If the shard holds retired memory and its lock is free, the routine releases
+ *  what the readers cannot see anymore, so the dereference routine may be
+ *  called from it at DISPATCH_LEVEL.
+ */
+PVOID ShardedRefTableGet(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Key)
+{
+	KIRQL irql;
+	SIZE_T hash = 0;
+	SIZE_T mask = 0;
+	SIZE_T index = 0;
+	PVOID current = NULL;
+	PSHARDED_REF_READER reader = NULL;
+	PSHARDED_REF_SHARD shard = NULL;
+	PSHARDED_REF_SLOTS slots = NULL;
+	PVOID ret = NULL;
+
+	hash = _Hash(Key);
+	KeRaiseIrql(DISPATCH_LEVEL, &irql);
+	reader = _ReaderEnter(Table);
+	slots = _ShardGet(Table, hash)->Slots;
+	if (slots != NULL) {
+		mask = slots->Size - 1;
+		index = _SlotIndex(Table, hash, mask);
+		current = *(PVOID volatile *)(slots->Objects + index);
+		while (current != NULL) {
+			if (current != SHARDED_REF_DELETED && _ObjectKey(Table, current) == Key) {
+				Table->Reference(current);
+				ret = current;
+				break;
+			}
+
+			index = (index + 1) & mask;
+			current = *(PVOID volatile *)(slots->Objects + index);
+		}
+	}
+
+	_ReaderLeave(reader);
+	shard = _ShardGet(Table, hash);
+	if (shard->Pending)
+		_ShardTryReclaim(Table, shard);
+
+	KeLowerIrql(irql);
+
+	return ret;
+}
+
+
+/** Returns an array of all objects in the table, each of them referenced.
+ *  All shards are locked while the array is filled, so it is a consistent
+ *  snapshot. The caller must dereference the objects and free the array
+ *  by HeapMemoryFree. Can be called at IRQL <= DISPATCH_LEVEL.
+ *
+ *  @remark
+ *  The routine also releases the memory retired by all shards that the readers
+ *  cannot see anymore.
+ */
+NTSTATUS ShardedRefTableEnum(_In_ PSHARDED_REF_TABLE Table, _Out_ PVOID **Objects, _Out_ PULONG Count)
+{
+	KIRQL irql;
+	ULONG i = 0;
+	SIZE_T j = 0;
+	SIZE_T count = 0;
+	PVOID obj = NULL;
+	PVOID *tmpObjects = NULL;
+	BOOLEAN pending = FALSE;
+	PSHARDED_REF_SHARD shard = NULL;
+	PSHARDED_REF_SLOTS slots = NULL;
+	PSHARDED_REF_RETIRED reclaimed = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("Table=0x%p; Objects=0x%p; Count=0x%p", Table, Objects, Count);
+
+	*Objects = NULL;
+	*Count = 0;
+	status = STATUS_SUCCESS;
+	// Memory retired by the shards is released on the way, if there is a place
+	// to put it into.
+	reclaimed = (PSHARDED_REF_RETIRED)HeapMemoryAllocNonPaged(Table->ShardCount*SHARDED_REF_EPOCHS*sizeof(SHARDED_REF_RETIRED));
+	if (reclaimed != NULL)
+		memset(reclaimed, 0, Table->ShardCount*SHARDED_REF_EPOCHS*sizeof(SHARDED_REF_RETIRED));
+
+	KeRaiseIrql(DISPATCH_LEVEL, &irql);
+	for (i = 0; i < Table->ShardCount; ++i) {
+		shard = &Table->Shards[i].Shard;
+		KeAcquireSpinLockAtDpcLevel(&shard->Lock);
+		count += shard->ItemCount;
+	}
+
+	if (count > 0) {
+		tmpObjects = (PVOID *)HeapMemoryAllocNonPaged(count*sizeof(PVOID));
+		if (tmpObjects != NULL) {
+			count = 0;
+			for (i = 0; i < Table->ShardCount; ++i) {
+				slots = Table->Shards[i].Shard.Slots;
+				if (slots != NULL) {
+					for (j = 0; j < slots->Size; ++j) {
+						obj = slots->Objects[j];
+						if (obj != NULL && obj != SHARDED_REF_DELETED) {
+							Table->Reference(obj);
+							tmpObjects[count] = obj;
+							++count;
+						}
+					}
+				}
+			}
+
+			*Objects = tmpObjects;
+			*Count = (ULONG)count;
+		} else status = STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	for (i = Table->ShardCount; i > 0; --i) {
+		shard = &Table->Shards[i - 1].Shard;
+		if (reclaimed != NULL && shard->Pending)
+			pending |= _ShardRetire(Table, shard, NULL, NULL, reclaimed + (i - 1)*SHARDED_REF_EPOCHS);
+
+		KeReleaseSpinLockFromDpcLevel(&shard->Lock);
+	}
+
+	KeLowerIrql(irql);
+	if (reclaimed != NULL) {
+		for (i = 0; i < Table->ShardCount; ++i)
+			_WriterFinish(Table, reclaimed + i*SHARDED_REF_EPOCHS, FALSE);
+
+		HeapMemoryFree(reclaimed);
+	}
+
+	if (pending)
+		_EpochTryAdvance(Table);
+
+	DEBUG_EXIT_FUNCTION("0x%x, *Objects=0x%p, *Count=%u", status, *Objects, *Count);
+	return status;
+}
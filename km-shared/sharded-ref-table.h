@@ -0,0 +1,120 @@
+
+#ifndef __SHARDED_REF_TABLE_H__
+#define __SHARDED_REF_TABLE_H__
+
+/** Tables mapping pointer-sized keys (such as addresses of DRIVER_OBJECT, DEVICE_OBJECT
+ *  and FILE_OBJECT structures, or process IDs)
+ *  to reference-counted objects, built for frequent lookups and frequent changes
+ *  from many processors at once.
+ *
+ *  The key is stored inside the object at ObjectKeyOffset. The table is split
+ *  to shards by the key hash, each shard being an open-addressed array of slots
+ *  guarded by its own spin lock, so writers working with different shards
+ *  do not contend. Readers take no lock at all.
+ *
+ *  Writers other than ShardedRefTableClear never wait for readers, and all routines
+ *  can be called at IRQL <= DISPATCH_LEVEL. Deleted objects (and slot arrays replaced
+ *  by larger ones) are retired instead. A reader announces the epoch it started in
+ *  through a record of its processor, the table epoch advances only when no reader
+ *  from an older epoch is running, and retired memory is released two epochs after
+ *  its retirement. Releasing is done by later writers and readers of the same shard
+ *  and by enumerations, ShardedRefTableClear waits until it can release everything
+ *  it removed. The rest is released when the table is finalized.
+ */
+
+#include <ntifs.h>
+
+
+typedef VOID(SHARDED_REF_REFERENCE)(_Inout_ PVOID Object);
+typedef VOID(SHARDED_REF_DEREFERENCE)(_Inout_ PVOID Object);
+
+
+/** Size of the cache line the shards and reader records are aligned to. */
+#define SHARDED_REF_CACHE_LINE			64
+/** Number of lists of retired memory kept by each shard. */
+#define SHARDED_REF_EPOCHS				3
+
+
+typedef struct _SHARDED_REF_SLOTS {
+	/** Links arrays retired in the same epoch. */
+	struct _SHARDED_REF_SLOTS *NextRetired;
+	/** Number of slots, always a power of two. */
+	SIZE_T Size;
+	PVOID Objects[1];
+} SHARDED_REF_SLOTS, *PSHARDED_REF_SLOTS;
+
+
+/** Memory retired by a shard in one epoch. */
+typedef struct _SHARDED_REF_RETIRED {
+	/** Objects, linked through the pointers at ObjectLinkOffset. */
+	PVOID Objects;
+	PSHARDED_REF_SLOTS Slots;
+	ULONG Epoch;
+} SHARDED_REF_RETIRED, *PSHARDED_REF_RETIRED;
+
+
+typedef struct _SHARDED_REF_SHARD {
+	/** Serializes writers of the shard, readers do not take it. */
+	KSPIN_LOCK Lock;
+	/** Number of objects in the shard. */
+	SIZE_T ItemCount;
+	/** Number of slots not free, including the ones of deleted objects. */
+	SIZE_T UsedCount;
+	/** The slots readers walk. NULL if nothing was inserted yet. */
+	PSHARDED_REF_SLOTS volatile Slots;
+	/** Retired memory, indexed by the epoch modulo SHARDED_REF_EPOCHS. */
+	SHARDED_REF_RETIRED Retired[SHARDED_REF_EPOCHS];
+	/** Set while Retired holds some memory. Tells the readers to try to release it. */
+	volatile BOOLEAN Pending;
+} SHARDED_REF_SHARD, *PSHARDED_REF_SHARD;
+
+typedef union _SHARDED_REF_SHARD_PADDED {
+	SHARDED_REF_SHARD Shard;
+	UCHAR Padding[2*SHARDED_REF_CACHE_LINE];
+} SHARDED_REF_SHARD_PADDED, *PSHARDED_REF_SHARD_PADDED;
+
+
+/** Announces readers running on one processor. */
+typedef union _SHARDED_REF_READER {
+	struct {
+		/** Nonzero while a reader runs on the processor. */
+		volatile LONG Active;
+		/** Table epoch the reader started in. */
+		volatile ULONG Epoch;
+	} State;
+	UCHAR Padding[SHARDED_REF_CACHE_LINE];
+} SHARDED_REF_READER, *PSHARDED_REF_READER;
+
+
+typedef struct _SHARDED_REF_TABLE {
+	SHARDED_REF_REFERENCE *Reference;
+	SHARDED_REF_DEREFERENCE *Dereference;
+	SIZE_T ObjectKeyOffset;
+	/** Offset of a pointer field the table uses to link retired objects. */
+	SIZE_T ObjectLinkOffset;
+	/** Number of shards, always a power of two. */
+	ULONG ShardCount;
+	/** Shift extracting a slot index from the key hash. */
+	ULONG ShardShift;
+	PSHARDED_REF_SHARD_PADDED Shards;
+	PVOID ShardsAllocation;
+	/** One record for every processor that can ever be present. */
+	ULONG ReaderCount;
+	PSHARDED_REF_READER Readers;
+	PVOID ReadersAllocation;
+	volatile ULONG Epoch;
+} SHARDED_REF_TABLE, *PSHARDED_REF_TABLE;
+
+
+NTSTATUS ShardedRefTableInit(_In_ SIZE_T ObjectKeyOffset, _In_ SIZE_T ObjectLinkOffset, _In_opt_ SHARDED_REF_REFERENCE *Reference, _In_opt_ SHARDED_REF_DEREFERENCE *Dereference, _Out_ PSHARDED_REF_TABLE Table);
+VOID ShardedRefTableFinit(_In_ PSHARDED_REF_TABLE Table);
+VOID ShardedRefTableClear(_In_ PSHARDED_REF_TABLE Table);
+NTSTATUS ShardedRefTableInsert(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Object);
+PVOID ShardedRefTableDelete(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Key);
+VOID ShardedRefTableDeleteDereference(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Key);
+PVOID ShardedRefTableGet(_In_ PSHARDED_REF_TABLE Table, _In_ PVOID Key);
+NTSTATUS ShardedRefTableEnum(_In_ PSHARDED_REF_TABLE Table, _Out_ PVOID **Objects, _Out_ PULONG Count);
+
+
+
+#endif
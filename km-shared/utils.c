@@ -523,6 +523,36 @@ NTSTATUS UtilsCopyUnicodeString(POOL_TYPE PoolType, PUNICODE_STRING Target, cons
 }
 
 
+/** Returns after every processor left DISPATCH_LEVEL at least once since
+ *  the call, so no code that read a pointer at DISPATCH_LEVEL before the call
+ *  is still using it. The current thread is just scheduled on each processor
+ *  in turn. Must be called at PASSIVE_LEVEL.
+ */
+VOID UtilsWaitForDispatchReaders(VOID)
+{
+	ULONG i = 0;
+	ULONG count = 0;
+	PROCESSOR_NUMBER pn;
+	GROUP_AFFINITY affinity;
+	GROUP_AFFINITY oldAffinity;
+	DEBUG_ENTER_FUNCTION_NO_ARGS();
+
+	count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	for (i = 0; i < count; ++i) {
+		if (NT_SUCCESS(KeGetProcessorNumberFromIndex(i, &pn))) {
+			memset(&affinity, 0, sizeof(affinity));
+			affinity.Group = pn.Group;
+			affinity.Mask = (KAFFINITY)1 << pn.Number;
+			KeSetSystemGroupAffinityThread(&affinity, &oldAffinity);
+			KeRevertToUserGroupAffinityThread(&oldAffinity);
+		}
+	}
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
 void QueryClientBasicInformation(PBASIC_CLIENT_INFO Info)
 {
 	PACCESS_TOKEN token = NULL;
@@ -70,6 +70,7 @@ NTSTATUS QueryTokenInfo(PACCESS_TOKEN Token, PCLIENT_TOKEN_INFORMATION Info);
 NTSTATUS QueryClientInformation(PCLIENT_INFORMATION Client);
 void QueryClientBasicInformation(PBASIC_CLIENT_INFO Info);
 NTSTATUS UtilsCopyUnicodeString(POOL_TYPE PoolType, PUNICODE_STRING Target, const UNICODE_STRING *Source);
+VOID UtilsWaitForDispatchReaders(VOID);
 
 NTSTATUS ProcessEnumerate(PSYSTEM_PROCESS_INFORMATION_REAL *Processes);
 VOID ProcessEnumerationFree(PSYSTEM_PROCESS_INFORMATION_REAL Processes);
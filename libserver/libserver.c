@@ -4,178 +4,1266 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <windows.h>
+#include "ioctls.h"
 #include "irpmondll-types.h"
 #include "network-connector.h"
 #include "device-connector.h"
+#include "request.h"
+#include "block-codec.h"
+#include "request-filter.h"
 #include "libserver.h"
 
 
+/************************************************************************/
+/*              TYPES AND MACROS                                        */
+/************************************************************************/
+
+/** The server is a single reactor thread multiplexing all client sockets
+ *  by WSAPoll. Sockets are non-blocking, so a slow or dead client never
+ *  stalls the others. IOCTLs run on the thread pool; their replies, as well
+ *  as event batches produced by the drain thread, are appended to the output
+ *  queues of the clients and written by the reactor when the sockets become
+ *  writable. One drain of the Event Queue is shared by all subscribed
+ *  clients: a batch is read into a reference-counted buffer and only its
+ *  header is copied for each client.
+ *
+ *  Nagle's algorithm is disabled on client sockets. Replies are sent as soon
+ *  as possible, while event batches may wait in the queue until the flush
+ *  deadline passes or enough data accumulate; all queued outputs are then
+ *  gathered into a single send.
+ *
+ *  A streaming client may set a filter by IOCTL_IRPMNDRV_REQUEST_FILTER_SET.
+ *  The server keeps it for that client instead of passing it to the driver
+ *  and sends the client only the requests the filter lets through, copied
+ *  into a batch of its own.
+ */
+
+#define LS_MAX_CLIENTS					32
+/** Clients silent for this long (milliseconds) are disconnected; connected
+    clients ping the server every second. */
+#define LS_CLIENT_TIMEOUT				10000
+#define LS_POLL_TIMEOUT					1000
+#define LS_MAX_MESSAGE_SIZE				0x1000000
+#define LS_MAX_STREAM_CREDIT			64
+#define LS_DEFAULT_FLUSH_DEADLINE		5
+#define LS_DEFAULT_FLUSH_SIZE			0x10000
+/** Maximum number of buffers passed to one send. */
+#define LS_FLUSH_BUFFERS				48
+
+/** Batch of requests read from the Event Queue, shared by all clients it is
+    sent to. The batch data follow the structure. */
+typedef struct _LS_BATCH {
+	volatile LONG ReferenceCount;
+	ULONG Size;
+	/** The batch without its header compressed by the individual methods;
+	    NULL if nobody asked for the method or the data did not shrink. */
+	void *Encoded[bcmMax];
+	ULONG EncodedSizes[bcmMax];
+} LS_BATCH, *PLS_BATCH;
+
+/** Filter of a streaming client. The drain thread holds a reference while
+    it uses the filter, so the client may replace it at any time. The filter
+    follows the structure. */
+typedef struct _LS_FILTER {
+	volatile LONG ReferenceCount;
+	ULONG Size;
+} LS_FILTER, *PLS_FILTER;
+
+#define LS_FILTER_DATA(aFilter)			((PREQUEST_FILTER_HEADER)((aFilter) + 1))
+
+/** Copy of a batch made for a client with a filter. */
+typedef struct _LS_FILTERED_BATCH {
+	struct _LS_CLIENT *Client;
+	PLS_FILTER Filter;
+	EBlockCodecMethod Compression;
+	/** NULL if the copy could not be made. */
+	PLS_BATCH Batch;
+} LS_FILTERED_BATCH, *PLS_FILTERED_BATCH;
+
+/** Data waiting to be sent to a client. The data are described by up to
+    three parts sent one after another. */
+typedef struct _LS_OUTPUT {
+	struct _LS_OUTPUT *Next;
+	const unsigned char *Data[3];
+	ULONG Sizes[3];
+	/** Number of bytes already sent. */
+	ULONG Offset;
+	/** Shared batch referenced by the output, may be NULL. */
+	PLS_BATCH Batch;
+	/** Memory to free after the output is sent, may be NULL. */
+	void *Memory;
+	/** The output may wait for the flush deadline. */
+	BOOLEAN Deferred;
+} LS_OUTPUT, *PLS_OUTPUT;
+
+/** Reply to a control message. */
+typedef struct _LS_CONTROL_OUTPUT {
+	LS_OUTPUT Output;
+	NETWORK_MSG_IOCTL_V2 Msg;
+} LS_CONTROL_OUTPUT, *PLS_CONTROL_OUTPUT;
+
+/** Event batch sent to one client. */
+typedef struct _LS_BATCH_OUTPUT {
+	LS_OUTPUT Output;
+	NETWORK_MSG_IOCTL_V2 Msg;
+	REQUEST_BATCH_HEADER Header;
+} LS_BATCH_OUTPUT, *PLS_BATCH_OUTPUT;
+
+typedef struct _LS_SERVER LS_SERVER, *PLS_SERVER;
+
+typedef struct _LS_CLIENT {
+	PLS_SERVER Server;
+	SOCKET Socket;
+	/** The reactor holds one reference, each request being executed
+	    another one. */
+	volatile LONG ReferenceCount;
+	DWORD LastActivity;
+	/** The protocol is switched by the reactor only, after the client
+	    stopped sending. */
+	uint32_t ProtocolVersion;
+	/** Incoming message: the header is read first, then the input buffer
+	    into Item. */
+	unsigned char Header[sizeof(NETWORK_MSG_IOCTL_V2)];
+	ULONG HeaderReceived;
+	struct _LS_WORK_ITEM *Item;
+	ULONG InputReceived;
+	/** The following fields are protected by the server lock. */
+	BOOLEAN Closed;
+	BOOLEAN CloseAfterFlush;
+	PLS_OUTPUT OutputHead;
+	PLS_OUTPUT OutputTail;
+	/** Bytes of the output queue not sent yet. */
+	ULONG OutputPending;
+	/** The queue is sent as soon as the socket accepts data. Cleared when
+	    the queue becomes empty. */
+	BOOLEAN FlushNow;
+	/** When the oldest deferred output must be sent (_TimeMs), zero if
+	    none waits. */
+	ULONG64 FlushDeadline;
+	ULONG InFlight;
+	BOOLEAN Subscribed;
+	uint32_t StreamId;
+	uint32_t StreamBatchSize;
+	EBlockCodecMethod StreamCompression;
+	ULONG StreamCredit;
+	/** Records the client missed for lack of credit, reported in
+	    the DroppedCount of the next batch it receives. */
+	ULONG StreamSkipped;
+	/** May be NULL. */
+	PLS_FILTER StreamFilter;
+} LS_CLIENT, *PLS_CLIENT;
+
+/** A request executed on the thread pool. The output and input buffers
+    follow the structure. */
+typedef struct _LS_WORK_ITEM {
+	LS_OUTPUT Output;
+	PLS_CLIENT Client;
+	uint32_t ProtocolVersion;
+	NETWORK_MSG_IOCTL_V2 Msg;
+	void *InputBuffer;
+	void *OutputBuffer;
+} LS_WORK_ITEM, *PLS_WORK_ITEM;
+
+struct _LS_SERVER {
+	SOCKET ListenSocket;
+	/** Loopback datagram socket connected to itself; other threads write to
+	    it to interrupt WSAPoll. */
+	SOCKET WakeSocket;
+	volatile LONG WakePending;
+	CRITICAL_SECTION Lock;
+	/** Signalled on changes of credit, subscriptions and requests being
+	    executed. */
+	CONDITION_VARIABLE Changed;
+	/** Owned by the reactor, modified under the lock. */
+	PLS_CLIENT Clients[LS_MAX_CLIENTS];
+	ULONG ClientCount;
+	ULONG InFlight;
+	BOOLEAN DeviceConnected;
+	HANDLE DrainThread;
+	BOOLEAN DrainStop;
+};
+
+
 /************************************************************************/
 /*              GLOBAL VARIABLES                                        */
 /************************************************************************/
 
 
 static IRPMON_INIT_INFO _initInfo;
+static LARGE_INTEGER _performanceFrequency;
+static ULONG _flushDeadline = LS_DEFAULT_FLUSH_DEADLINE;
+static ULONG _flushSize = LS_DEFAULT_FLUSH_SIZE;
 
 
 /************************************************************************/
 /*                 HELPER FUNCTIONS                                     */
 /************************************************************************/
 
-static int _Listener(const ADDRINFOA *Address, HANDLE ExitEvent)
+
+static ULONG64 _TimeMs(void)
+{
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter(&counter);
+
+	return (ULONG64)counter.QuadPart * 1000 / _performanceFrequency.QuadPart;
+}
+
+
+static void _ServerWake(PLS_SERVER Server)
+{
+	char c = 0;
+
+	if (InterlockedExchange(&Server->WakePending, 1) == 0)
+		send(Server->WakeSocket, &c, sizeof(c), 0);
+
+	return;
+}
+
+
+static int _WakeSocketCreate(PLS_SERVER Server)
 {
 	int ret = 0;
-	uint32_t timeout = 10000;
-	NETWORK_MSG_IOCTL msg;
-	void *inputBuffer = NULL;
-	void *outputBuffer = NULL;
-	int bytesReceived = 0;
-	SOCKET acceptSocket = INVALID_SOCKET;
-	SOCKET listenSocket = INVALID_SOCKET;
-	WSAPOLLFD fds;
-	BOOLEAN terminated = FALSE;
-
-	listenSocket = socket(Address->ai_family, SOCK_STREAM, IPPROTO_TCP);
-	if (listenSocket == INVALID_SOCKET) {
+	int addrLen = 0;
+	u_long nonBlocking = 1;
+	struct sockaddr_in addr;
+
+	Server->WakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (Server->WakeSocket == INVALID_SOCKET) {
 		ret = WSAGetLastError();
 		goto Exit;
 	}
 
-	ret = bind(listenSocket, Address->ai_addr, (int)Address->ai_addrlen);
-	if (ret != 0) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addrLen = sizeof(addr);
+	if (bind(Server->WakeSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+		getsockname(Server->WakeSocket, (struct sockaddr *)&addr, &addrLen) != 0 ||
+		connect(Server->WakeSocket, (struct sockaddr *)&addr, addrLen) != 0 ||
+		ioctlsocket(Server->WakeSocket, FIONBIO, &nonBlocking) != 0) {
 		ret = WSAGetLastError();
-		goto DestroySocket;
+		closesocket(Server->WakeSocket);
+		Server->WakeSocket = INVALID_SOCKET;
 	}
 
-	ret = listen(listenSocket, 0);
-	if (ret != 0) {
-		ret = WSAGetLastError();
-		goto DestroySocket;
+Exit:
+	return ret;
+}
+
+
+static void _BatchRelease(PLS_BATCH Batch)
+{
+	ULONG i = 0;
+
+	if (InterlockedDecrement(&Batch->ReferenceCount) == 0) {
+		for (i = 0; i < bcmMax; ++i) {
+			if (Batch->Encoded[i] != NULL)
+				HeapFree(GetProcessHeap(), 0, Batch->Encoded[i]);
+		}
+
+		HeapFree(GetProcessHeap(), 0, Batch);
+	}
+
+	return;
+}
+
+
+/** Copies the requests that pass the filter into a new batch. */
+static PLS_BATCH _BatchFilter(const REQUEST_BATCH_HEADER *Source, const REQUEST_FILTER_HEADER *Filter)
+{
+	ULONG i = 0;
+	size_t size = 0;
+	const unsigned char *src = NULL;
+	unsigned char *dest = NULL;
+	const REQUEST_HEADER *r = NULL;
+	PREQUEST_HEADER last = NULL;
+	PREQUEST_BATCH_HEADER header = NULL;
+	PLS_BATCH ret = NULL;
+
+	ret = (PLS_BATCH)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LS_BATCH) + Source->HeaderSize + Source->BytesUsed);
+	if (ret != NULL) {
+		ret->ReferenceCount = 1;
+		ret->Size = Source->HeaderSize + Source->BytesUsed;
+		header = (PREQUEST_BATCH_HEADER)(ret + 1);
+		memcpy(header, Source, Source->HeaderSize);
+		header->RecordCount = 0;
+		header->BytesUsed = 0;
+		src = (const unsigned char *)Source + Source->HeaderSize;
+		dest = (unsigned char *)header + header->HeaderSize;
+		for (i = 0; i < Source->RecordCount; ++i) {
+			r = (const REQUEST_HEADER *)src;
+			size = RequestGetSize(r);
+			if (RequestFilterMatch(Filter, r, NULL, NULL)) {
+				memcpy(dest, src, size);
+				last = (PREQUEST_HEADER)dest;
+				last->Flags |= REQUEST_FLAG_NEXT_AVAILABLE;
+				if (header->RecordCount == 0)
+					header->FirstId = r->Id;
+
+				header->LastId = r->Id;
+				++header->RecordCount;
+				header->BytesUsed += (ULONG)size;
+				dest += size;
+			}
+
+			src += size;
+		}
+
+		if (last != NULL)
+			last->Flags &= ~REQUEST_FLAG_NEXT_AVAILABLE;
+	}
+
+	return ret;
+}
+
+
+static void _FilterRelease(PLS_FILTER Filter)
+{
+	if (InterlockedDecrement(&Filter->ReferenceCount) == 0)
+		HeapFree(GetProcessHeap(), 0, Filter);
+
+	return;
+}
+
+
+/** Compresses the batch by each method in the Methods mask. The batch header
+ *  stays uncompressed, the client needs it to learn the decompressed size.
+ */
+static void _BatchEncode(PLS_BATCH Batch, ULONG Methods)
+{
+	ULONG i = 0;
+	size_t written = 0;
+	ULONG dataSize = 0;
+	const unsigned char *data = NULL;
+	const REQUEST_BATCH_HEADER *header = (PREQUEST_BATCH_HEADER)(Batch + 1);
+
+	data = (unsigned char *)header + sizeof(REQUEST_BATCH_HEADER);
+	dataSize = header->HeaderSize + header->BytesUsed - sizeof(REQUEST_BATCH_HEADER);
+	for (i = bcmNone + 1; i < bcmMax; ++i) {
+		if ((Methods & (1 << i)) == 0 || !BlockCodecSupported((EBlockCodecMethod)i) || dataSize == 0)
+			continue;
+
+		Batch->Encoded[i] = HeapAlloc(GetProcessHeap(), 0, dataSize);
+		if (Batch->Encoded[i] == NULL)
+			continue;
+
+		// Data that do not shrink are sent as they are.
+		if (BlockCodecCompress((EBlockCodecMethod)i, data, dataSize, Batch->Encoded[i], dataSize, &written) == ERROR_VALUE_SUCCESS &&
+			written < dataSize)
+			Batch->EncodedSizes[i] = (ULONG)written;
+		else {
+			HeapFree(GetProcessHeap(), 0, Batch->Encoded[i]);
+			Batch->Encoded[i] = NULL;
+		}
+	}
+
+	return;
+}
+
+
+static void _OutputFree(PLS_OUTPUT Output)
+{
+	if (Output->Batch != NULL)
+		_BatchRelease(Output->Batch);
+
+	if (Output->Memory != NULL)
+		HeapFree(GetProcessHeap(), 0, Output->Memory);
+
+	return;
+}
+
+
+/** Appends data to the output queue of a client; the server lock must be
+ *  held. Output for closed clients is freed.
+ */
+static void _ClientQueueOutput(PLS_CLIENT Client, PLS_OUTPUT Output)
+{
+	Output->Next = NULL;
+	Output->Offset = 0;
+	if (!Client->Closed) {
+		if (Client->OutputTail != NULL)
+			Client->OutputTail->Next = Output;
+		else Client->OutputHead = Output;
+
+		Client->OutputTail = Output;
+		Client->OutputPending += Output->Sizes[0] + Output->Sizes[1] + Output->Sizes[2];
+		if (!Output->Deferred || Client->OutputPending >= _flushSize)
+			Client->FlushNow = TRUE;
+		else if (Client->FlushDeadline == 0)
+			Client->FlushDeadline = _TimeMs() + _flushDeadline;
+	} else _OutputFree(Output);
+
+	return;
+}
+
+
+/** Decides whether the output queue should be sent now; the server lock
+ *  must be held.
+ */
+static BOOLEAN _ClientFlushDue(PLS_CLIENT Client, ULONG64 Now)
+{
+	if (!Client->FlushNow && Client->OutputHead != NULL &&
+		(Client->CloseAfterFlush || Now >= Client->FlushDeadline))
+		Client->FlushNow = TRUE;
+
+	return (Client->FlushNow && Client->OutputHead != NULL);
+}
+
+
+static int _ClientQueueControl(PLS_CLIENT Client, const NETWORK_MSG_IOCTL_V2 *Msg, uint32_t ProtocolVersion)
+{
+	int ret = 0;
+	PLS_CONTROL_OUTPUT o = NULL;
+
+	o = (PLS_CONTROL_OUTPUT)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LS_CONTROL_OUTPUT));
+	if (o != NULL) {
+		o->Msg = *Msg;
+		o->Msg.OutputBufferSize = 0;
+		o->Output.Data[0] = (unsigned char *)&o->Msg;
+		o->Output.Sizes[0] = (ProtocolVersion == NETWORK_PROTOCOL_VERSION_2) ? sizeof(NETWORK_MSG_IOCTL_V2) : sizeof(NETWORK_MSG_IOCTL);
+		o->Output.Memory = o;
+		EnterCriticalSection(&Client->Server->Lock);
+		_ClientQueueOutput(Client, &o->Output);
+		LeaveCriticalSection(&Client->Server->Lock);
+	} else ret = ERROR_NOT_ENOUGH_MEMORY;
+
+	return ret;
+}
+
+
+static void _ClientRelease(PLS_CLIENT Client)
+{
+	if (InterlockedDecrement(&Client->ReferenceCount) == 0) {
+		if (Client->StreamFilter != NULL)
+			_FilterRelease(Client->StreamFilter);
+
+		HeapFree(GetProcessHeap(), 0, Client);
 	}
 
-	fds.events = POLLIN;
-	fds.revents = 0;
-	fds.fd = listenSocket;
+	return;
+}
+
+
+static VOID CALLBACK _WorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+{
+	PLS_WORK_ITEM item = (PLS_WORK_ITEM)Context;
+	PLS_CLIENT client = item->Client;
+	PLS_SERVER server = client->Server;
+
+	item->Msg.Result = DevConn_SynchronousOtherIOCTL(item->Msg.ControlCode, item->InputBuffer, item->Msg.InputBufferSize, item->OutputBuffer, item->Msg.OutputBufferSize);
+	item->Msg.InputBufferSize = 0;
+	item->Output.Data[0] = (unsigned char *)&item->Msg;
+	item->Output.Sizes[0] = (item->ProtocolVersion == NETWORK_PROTOCOL_VERSION_2) ? sizeof(NETWORK_MSG_IOCTL_V2) : sizeof(NETWORK_MSG_IOCTL);
+	item->Output.Data[1] = (unsigned char *)item->OutputBuffer;
+	item->Output.Sizes[1] = item->Msg.OutputBufferSize;
+	item->Output.Memory = item;
+	EnterCriticalSection(&server->Lock);
+	_ClientQueueOutput(client, &item->Output);
+	--client->InFlight;
+	LeaveCriticalSection(&server->Lock);
+	// The server may go away as soon as the last request finishes,
+	// so wake the reactor while this one still counts.
+	_ServerWake(server);
+	EnterCriticalSection(&server->Lock);
+	--server->InFlight;
+	WakeAllConditionVariable(&server->Changed);
+	LeaveCriticalSection(&server->Lock);
+	_ClientRelease(client);
+
+	return;
+}
+
+
+/** Drains the Event Queue for all subscribed clients. The queue is read while
+ *  at least one of them has credit; clients without credit miss the batch.
+ *  Clients with a filter get their own copies of the batches; a filter set
+ *  while a batch is being read applies from the next batch on.
+ */
+static DWORD WINAPI _DrainThread(PVOID Context)
+{
+	ULONG i = 0;
+	ULONG j = 0;
+	BOOLEAN anyCredit = FALSE;
+	BOOLEAN wake = FALSE;
+	ULONG batchSize = 0;
+	ULONG methods = 0;
+	ULONG filteredCount = 0;
+	LS_FILTERED_BATCH filtered[LS_MAX_CLIENTS];
+	DWORD err = ERROR_SUCCESS;
+	PLS_CLIENT c = NULL;
+	PLS_BATCH batch = NULL;
+	PLS_BATCH b = NULL;
+	PREQUEST_BATCH_HEADER header = NULL;
+	PREQUEST_BATCH_HEADER h = NULL;
+	PLS_BATCH_OUTPUT o = NULL;
+	PLS_SERVER server = (PLS_SERVER)Context;
+
+	EnterCriticalSection(&server->Lock);
+	while (!server->DrainStop) {
+		anyCredit = FALSE;
+		methods = 0;
+		filteredCount = 0;
+		batchSize = NETWORK_STREAM_MAX_BATCH_SIZE;
+		for (i = 0; i < server->ClientCount; ++i) {
+			c = server->Clients[i];
+			if (c->Subscribed) {
+				if (c->StreamCredit > 0) {
+					anyCredit = TRUE;
+					if (c->StreamFilter != NULL) {
+						filtered[filteredCount].Client = c;
+						filtered[filteredCount].Filter = c->StreamFilter;
+						filtered[filteredCount].Compression = c->StreamCompression;
+						filtered[filteredCount].Batch = NULL;
+						InterlockedIncrement(&c->ReferenceCount);
+						InterlockedIncrement(&c->StreamFilter->ReferenceCount);
+						++filteredCount;
+					} else methods |= (1 << c->StreamCompression);
+				}
+
+				if (c->StreamBatchSize < batchSize)
+					batchSize = c->StreamBatchSize;
+			}
+		}
+
+		if (!anyCredit) {
+			SleepConditionVariableCS(&server->Changed, &server->Lock, INFINITE);
+			continue;
+		}
+
+		LeaveCriticalSection(&server->Lock);
+		err = ERROR_NOT_ENOUGH_MEMORY;
+		batch = (PLS_BATCH)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LS_BATCH) + batchSize);
+		if (batch != NULL) {
+			batch->ReferenceCount = 1;
+			batch->Size = batchSize;
+			header = (PREQUEST_BATCH_HEADER)(batch + 1);
+			err = DevConn_SynchronousOtherIOCTL(IOCTL_IRPMNDRV_GET_RECORDS, NULL, 0, header, batchSize);
+			if (err == ERROR_SUCCESS) {
+				_BatchEncode(batch, methods);
+				for (j = 0; j < filteredCount; ++j) {
+					filtered[j].Batch = _BatchFilter(header, LS_FILTER_DATA(filtered[j].Filter));
+					if (filtered[j].Batch != NULL)
+						_BatchEncode(filtered[j].Batch, 1 << filtered[j].Compression);
+				}
+			}
+		}
+
+		EnterCriticalSection(&server->Lock);
+		if (err == ERROR_NO_MORE_ITEMS) {
+			if (!server->DrainStop)
+				SleepConditionVariableCS(&server->Changed, &server->Lock, NETWORK_STREAM_POLL_INTERVAL);
+		} else {
+			for (i = 0; i < server->ClientCount; ++i) {
+				c = server->Clients[i];
+				if (!c->Subscribed)
+					continue;
+
+				b = batch;
+				for (j = 0; j < filteredCount; ++j) {
+					if (filtered[j].Client == c) {
+						b = filtered[j].Batch;
+						break;
+					}
+				}
+
+				// The filter was set after the batch had been read, the client
+				// must not see the requests it does not want.
+				if (j == filteredCount && c->StreamFilter != NULL)
+					b = NULL;
+
+				h =(b != NULL) ? (PREQUEST_BATCH_HEADER)(b + 1) : NULL;
+				if (err == ERROR_SUCCESS) {
+					// Batches the client has no credit or room for are counted
+					// as dropped.
+					if (h == NULL) {
+						c->StreamSkipped += header->RecordCount;
+						continue;
+					}
+
+					if (c->StreamCredit == 0 || h->HeaderSize + h->BytesUsed > c->StreamBatchSize) {
+						c->StreamSkipped += h->RecordCount;
+						continue;
+					}
+
+					// Nothing passed the filter, only the drops need to be
+					// reported.
+					if (h->RecordCount == 0) {
+						c->StreamSkipped += h->DroppedCount;
+						continue;
+					}
+				}
+
+				o = (PLS_BATCH_OUTPUT)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LS_BATCH_OUTPUT));
+				if (o == NULL) {
+					if (err == ERROR_SUCCESS)
+						c->StreamSkipped += h->RecordCount;
+
+					continue;
+				}
+
+				o->Msg.Result = err;
+				o->Msg.ControlCode = NETWORK_CONTROL_RECORDS;
+				o->Msg.RequestId = c->StreamId;
+				o->Output.Data[0] = (unsigned char *)&o->Msg;
+				o->Output.Sizes[0] = sizeof(o->Msg);
+				o->Output.Memory = o;
+				if (err == ERROR_SUCCESS) {
+					o->Msg.OutputBufferSize = h->HeaderSize + h->BytesUsed;
+					o->Header = *h;
+					o->Header.DroppedCount += c->StreamSkipped;
+					c->StreamSkipped = 0;
+					o->Output.Data[1] = (unsigned char *)&o->Header;
+					o->Output.Sizes[1] = sizeof(o->Header);
+					o->Output.Data[2] = (unsigned char *)h + sizeof(o->Header);
+					o->Output.Sizes[2] = o->Msg.OutputBufferSize - sizeof(o->Header);
+					if (b->Encoded[c->StreamCompression] != NULL) {
+						o->Msg.Encoding = c->StreamCompression;
+						o->Output.Data[2] = (unsigned char *)b->Encoded[c->StreamCompression];
+						o->Output.Sizes[2] = b->EncodedSizes[c->StreamCompression];
+						o->Msg.OutputBufferSize = sizeof(o->Header) + o->Output.Sizes[2];
+					}
+
+					o->Output.Deferred = TRUE;
+					o->Output.Batch = b;
+					InterlockedIncrement(&b->ReferenceCount);
+					--c->StreamCredit;
+				} else c->Subscribed = FALSE;
+
+				_ClientQueueOutput(c, &o->Output);
+			}
+
+			wake = TRUE;
+		}
+
+		for (j = 0; j < filteredCount; ++j) {
+			if (filtered[j].Batch != NULL)
+				_BatchRelease(filtered[j].Batch);
+
+			_FilterRelease(filtered[j].Filter);
+			_ClientRelease(filtered[j].Client);
+		}
+
+		if (batch != NULL) {
+			_BatchRelease(batch);
+			batch = NULL;
+		}
+
+		if (wake) {
+			LeaveCriticalSection(&server->Lock);
+			_ServerWake(server);
+			wake = FALSE;
+			EnterCriticalSection(&server->Lock);
+		}
+	}
+
+	LeaveCriticalSection(&server->Lock);
+
+	return 0;
+}
+
+
+static int _ClientSetFilter(PLS_CLIENT Client, PLS_WORK_ITEM Item)
+{
+	PLS_FILTER f = NULL;
+	PLS_FILTER old = NULL;
+	PLS_SERVER server = Client->Server;
+
+	Item->Msg.Result = ERROR_SUCCESS;
+	if (Item->Msg.InputBufferSize > 0) {
+		f = (PLS_FILTER)HeapAlloc(GetProcessHeap(), 0, sizeof(LS_FILTER) + Item->Msg.InputBufferSize);
+		if (f != NULL) {
+			f->ReferenceCount = 1;
+			f->Size = Item->Msg.InputBufferSize;
+			memcpy(LS_FILTER_DATA(f), Item->InputBuffer, f->Size);
+			Item->Msg.Result = RequestFilterPrepare(LS_FILTER_DATA(f), f->Size);
+			if (Item->Msg.Result != ERROR_SUCCESS) {
+				HeapFree(GetProcessHeap(), 0, f);
+				f = NULL;
+			}
+		} else Item->Msg.Result = ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	if (Item->Msg.Result == ERROR_SUCCESS) {
+		EnterCriticalSection(&server->Lock);
+		old = Client->StreamFilter;
+		Client->StreamFilter = f;
+		LeaveCriticalSection(&server->Lock);
+		if (old != NULL)
+			_FilterRelease(old);
+	}
+
+	Item->Msg.InputBufferSize = 0;
+
+	return _ClientQueueControl(Client, &Item->Msg, NETWORK_PROTOCOL_VERSION_2);
+}
+
+
+static int _ClientSubscribe(PLS_CLIENT Client, PLS_WORK_ITEM Item)
+{
+	int ret = 0;
+	NETWORK_SUBSCRIBE_INPUT input;
+	PLS_SERVER server = Client->Server;
+
+	Item->Msg.Result = ERROR_SUCCESS;
+	memset(&input, 0, sizeof(input));
+	if (Item->Msg.InputBufferSize == sizeof(input)) {
+		memcpy(&input, Item->InputBuffer, sizeof(input));
+		if (input.BatchSize < sizeof(REQUEST_BATCH_HEADER) + sizeof(REQUEST_HEADER) ||
+			input.BatchSize > NETWORK_STREAM_MAX_BATCH_SIZE)
+			Item->Msg.Result = ERROR_INVALID_PARAMETER;
+	} else Item->Msg.Result = ERROR_INVALID_PARAMETER;
+
+	EnterCriticalSection(&server->Lock);
+	if (Item->Msg.Result == ERROR_SUCCESS && Client->Subscribed)
+		Item->Msg.Result = ERROR_ALREADY_EXISTS;
+
+	LeaveCriticalSection(&server->Lock);
+	// The reply must precede the first batch.
+	Item->Msg.InputBufferSize = 0;
+	ret = _ClientQueueControl(Client, &Item->Msg, NETWORK_PROTOCOL_VERSION_2);
+	if (ret == 0 && Item->Msg.Result == ERROR_SUCCESS) {
+		EnterCriticalSection(&server->Lock);
+		if (server->DrainThread == NULL) {
+			server->DrainStop = FALSE;
+			server->DrainThread = CreateThread(NULL, 0, _DrainThread, server, 0, NULL);
+			if (server->DrainThread == NULL)
+				ret = GetLastError();
+		}
+
+		if (ret == 0) {
+			Client->Subscribed = TRUE;
+			Client->StreamId = Item->Msg.RequestId;
+			Client->StreamBatchSize = input.BatchSize;
+			// Methods the server does not know are ignored, every batch
+			// tells how it is encoded.
+			Client->StreamCompression = bcmNone;
+			if (input.Compression < bcmMax && BlockCodecSupported((EBlockCodecMethod)input.Compression))
+				Client->StreamCompression = (EBlockCodecMethod)input.Compression;
+
+			Client->StreamCredit = (input.Credit < LS_MAX_STREAM_CREDIT) ? input.Credit : LS_MAX_STREAM_CREDIT;
+			Client->StreamSkipped = 0;
+			WakeAllConditionVariable(&server->Changed);
+		}
+
+		LeaveCriticalSection(&server->Lock);
+	}
+
+	return ret;
+}
+
+
+/** Handles a message whose input buffer has been received completely. */
+static int _ClientSubmit(PLS_CLIENT Client)
+{
+	int ret = 0;
+	PLS_WORK_ITEM item = Client->Item;
+	PLS_SERVER server = Client->Server;
+
+	Client->Item = NULL;
+	if (item->ProtocolVersion == NETWORK_PROTOCOL_VERSION_2 &&
+		item->Msg.ControlCode == NETWORK_CONTROL_SUBSCRIBE) {
+		ret = _ClientSubscribe(Client, item);
+		HeapFree(GetProcessHeap(), 0, item);
+		goto Exit;
+	}
+
+	if (item->ProtocolVersion == NETWORK_PROTOCOL_VERSION_2 &&
+		item->Msg.ControlCode == IOCTL_IRPMNDRV_REQUEST_FILTER_SET) {
+		ret = _ClientSetFilter(Client, item);
+		HeapFree(GetProcessHeap(), 0, item);
+		goto Exit;
+	}
+
+	EnterCriticalSection(&server->Lock);
+	++Client->InFlight;
+	++server->InFlight;
+	LeaveCriticalSection(&server->Lock);
+	InterlockedIncrement(&Client->ReferenceCount);
+	if (!TrySubmitThreadpoolCallback(_WorkCallback, item, NULL)) {
+		ret = GetLastError();
+		EnterCriticalSection(&server->Lock);
+		--Client->InFlight;
+		--server->InFlight;
+		LeaveCriticalSection(&server->Lock);
+		_ClientRelease(Client);
+		HeapFree(GetProcessHeap(), 0, item);
+	}
+
+Exit:
+	return ret;
+}
+
+
+/** Handles a complete message header. */
+static int _ClientMessage(PLS_CLIENT Client)
+{
+	int ret = 0;
+	NETWORK_MSG_IOCTL_V2 msg;
+	PLS_WORK_ITEM item = NULL;
+	uint32_t requestedVersion = 0;
+	PLS_SERVER server = Client->Server;
+
+	memset(&msg, 0, sizeof(msg));
+	memcpy(&msg, Client->Header, (Client->ProtocolVersion == NETWORK_PROTOCOL_VERSION_2) ? sizeof(NETWORK_MSG_IOCTL_V2) : sizeof(NETWORK_MSG_IOCTL));
+	if (Client->ProtocolVersion == NETWORK_PROTOCOL_VERSION_1) {
+		if (msg.ControlCode == NETWORK_CONTROL_PING) {
+			ret = _ClientQueueControl(Client, &msg, NETWORK_PROTOCOL_VERSION_1);
+			goto Exit;
+		}
+
+		if (msg.ControlCode == NETWORK_CONTROL_PROTOCOL) {
+			requestedVersion = msg.Result;
+			msg.Result = (requestedVersion == NETWORK_PROTOCOL_VERSION_2) ? ERROR_SUCCESS : ERROR_NOT_SUPPORTED;
+			ret = _ClientQueueControl(Client, &msg, NETWORK_PROTOCOL_VERSION_1);
+			if (ret == 0 && msg.Result == ERROR_SUCCESS)
+				Client->ProtocolVersion = NETWORK_PROTOCOL_VERSION_2;
+
+			goto Exit;
+		}
+	} else {
+		if (msg.RequestId == 0) {
+			ret = _ClientQueueControl(Client, &msg, NETWORK_PROTOCOL_VERSION_2);
+			goto Exit;
+		}
+
+		if (msg.ControlCode == NETWORK_CONTROL_CREDIT) {
+			EnterCriticalSection(&server->Lock);
+			if (Client->Subscribed && msg.RequestId == Client->StreamId) {
+				// Clamp before adding, a huge grant must not wrap the counter.
+				if (msg.Result > LS_MAX_STREAM_CREDIT - Client->StreamCredit)
+					Client->StreamCredit = LS_MAX_STREAM_CREDIT;
+				else Client->StreamCredit += msg.Result;
+
+				WakeAllConditionVariable(&server->Changed);
+			}
+
+			LeaveCriticalSection(&server->Lock);
+			goto Exit;
+		}
+	}
+
+	if (msg.InputBufferSize > LS_MAX_MESSAGE_SIZE || msg.OutputBufferSize > LS_MAX_MESSAGE_SIZE) {
+		ret = ERROR_INVALID_MESSAGE;
+		goto Exit;
+	}
+
+	item = (PLS_WORK_ITEM)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LS_WORK_ITEM) + (SIZE_T)msg.OutputBufferSize + msg.InputBufferSize);
+	if (item == NULL) {
+		ret = ERROR_NOT_ENOUGH_MEMORY;
+		goto Exit;
+	}
+
+	item->Client = Client;
+	item->ProtocolVersion = Client->ProtocolVersion;
+	item->Msg = msg;
+	item->OutputBuffer = item + 1;
+	item->InputBuffer = (unsigned char *)item->OutputBuffer + msg.OutputBufferSize;
+	Client->Item = item;
+	Client->InputReceived = 0;
+	if (msg.InputBufferSize == 0)
+		ret = _ClientSubmit(Client);
+
+Exit:
+	return ret;
+}
+
+
+/** Reads whatever the client has sent. Returns nonzero when the client
+ *  should be disconnected.
+ */
+static int _ClientRead(PLS_CLIENT Client)
+{
+	int ret = 0;
+	int n = 0;
+	ULONG headerSize = 0;
+	BOOLEAN canSubmit = FALSE;
+	PLS_SERVER server = Client->Server;
+
 	do {
-		acceptSocket = INVALID_SOCKET;
-		if (ExitEvent != NULL) {
-			ret = WaitForSingleObject(ExitEvent, 0);
-			if (ret == WAIT_OBJECT_0) {
-				terminated = TRUE;
+		EnterCriticalSection(&server->Lock);
+		canSubmit = (Client->InFlight < NETWORK_MAX_IN_FLIGHT);
+		LeaveCriticalSection(&server->Lock);
+		if (!canSubmit)
+			break;
+
+		headerSize = (Client->ProtocolVersion == NETWORK_PROTOCOL_VERSION_2) ? sizeof(NETWORK_MSG_IOCTL_V2) : sizeof(NETWORK_MSG_IOCTL);
+		if (Client->Item == NULL)
+			n = recv(Client->Socket, (char *)Client->Header + Client->HeaderReceived, headerSize - Client->HeaderReceived, 0);
+		else n = recv(Client->Socket, (char *)Client->Item->InputBuffer + Client->InputReceived, Client->Item->Msg.InputBufferSize - Client->InputReceived, 0);
+
+		if (n == 0) {
+			ret = ERROR_GRACEFUL_DISCONNECT;
+			break;
+		}
+
+		if (n == SOCKET_ERROR) {
+			ret = WSAGetLastError();
+			if (ret == WSAEWOULDBLOCK)
+				ret = 0;
+
+			break;
+		}
+
+		Client->LastActivity = GetTickCount();
+		if (Client->Item == NULL) {
+			Client->HeaderReceived += n;
+			if (Client->HeaderReceived == headerSize) {
+				Client->HeaderReceived = 0;
+				ret = _ClientMessage(Client);
+			}
+		} else {
+			Client->InputReceived += n;
+			if (Client->InputReceived == Client->Item->Msg.InputBufferSize)
+				ret = _ClientSubmit(Client);
+		}
+	} while (ret == 0);
+
+	return ret;
+}
+
+
+/** Sends as much of the output queue as the socket takes, provided it is
+ *  due. Queued outputs are gathered into as few sends as possible.
+ */
+static int _ClientFlush(PLS_CLIENT Client)
+{
+	int ret = 0;
+	ULONG i = 0;
+	ULONG count = 0;
+	ULONG skip = 0;
+	ULONG total = 0;
+	ULONG size = 0;
+	DWORD bytesSent = 0;
+	DWORD remaining = 0;
+	WSABUF bufs[LS_FLUSH_BUFFERS];
+	PLS_OUTPUT o = NULL;
+	PLS_OUTPUT sent = NULL;
+	PLS_SERVER server = Client->Server;
+
+	EnterCriticalSection(&server->Lock);
+	while (ret == 0 && _ClientFlushDue(Client, _TimeMs())) {
+		count = 0;
+		total = 0;
+		o = Client->OutputHead;
+		skip = o->Offset;
+		while (o != NULL && count + sizeof(o->Data) / sizeof(o->Data[0]) <= LS_FLUSH_BUFFERS && total < _flushSize) {
+			for (i = 0; i < sizeof(o->Data) / sizeof(o->Data[0]); ++i) {
+				if (skip >= o->Sizes[i]) {
+					skip -= o->Sizes[i];
+					continue;
+				}
+
+				bufs[count].buf = (char *)o->Data[i] + skip;
+				bufs[count].len = o->Sizes[i] - skip;
+				total += bufs[count].len;
+				skip = 0;
+				++count;
+			}
+
+			o = o->Next;
+		}
+
+		LeaveCriticalSection(&server->Lock);
+		bytesSent = 0;
+		if (WSASend(Client->Socket, bufs, count, &bytesSent, 0, NULL, NULL) != 0) {
+			ret = WSAGetLastError();
+			bytesSent = 0;
+		}
+
+		EnterCriticalSection(&server->Lock);
+		Client->OutputPending -= bytesSent;
+		remaining = bytesSent;
+		while (Client->OutputHead != NULL) {
+			o = Client->OutputHead;
+			size = o->Sizes[0] + o->Sizes[1] + o->Sizes[2];
+			if (o->Offset + remaining < size) {
+				o->Offset += remaining;
 				break;
 			}
+
+			remaining -= size - o->Offset;
+			Client->OutputHead = o->Next;
+			o->Next = sent;
+			sent = o;
 		}
 
-		ret = WSAPoll(&fds, 1, 1000);
-		if (ret > 0) {
-			if (fds.revents & POLLERR)
-				ret = WSAGetLastError();
-			else if (fds.revents & POLLIN)
-				acceptSocket = accept(listenSocket, NULL, NULL);
-		
-			fds.revents = 0;
-		}
-
-		if (acceptSocket != INVALID_SOCKET) {
-			terminated = FALSE;
-			ret = setsockopt(acceptSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-			if (ret == 0) {
-				memset(&_initInfo, 0, sizeof(_initInfo));
-				_initInfo.ConnectorType = ictDevice;
-				ret = DevConn_Connect(&_initInfo);
-				memset(&msg, 0, sizeof(msg));
-				msg.Result = ret;
-				if (ret == 0) {
+		if (Client->OutputHead == NULL) {
+			Client->OutputTail = NULL;
+			Client->FlushNow = FALSE;
+			Client->FlushDeadline = 0;
+		}
+
+		// The socket buffer is full.
+		if (ret == 0 && bytesSent < total)
+			break;
+	}
+
+	LeaveCriticalSection(&server->Lock);
+	if (ret == WSAEWOULDBLOCK)
+		ret = 0;
+
+	while (sent != NULL) {
+		o = sent;
+		sent = o->Next;
+		_OutputFree(o);
+	}
+
+	return ret;
+}
+
+
+/** Stops the drain and disconnects from the device once the last client
+ *  leaves, so the driver can be used locally again.
+ */
+static void _ServerIdle(PLS_SERVER Server)
+{
+	HANDLE drainThread = NULL;
+
+	EnterCriticalSection(&Server->Lock);
+	drainThread = Server->DrainThread;
+	Server->DrainThread = NULL;
+	Server->DrainStop = TRUE;
+	WakeAllConditionVariable(&Server->Changed);
+	LeaveCriticalSection(&Server->Lock);
+	if (drainThread != NULL) {
+		WaitForSingleObject(drainThread, INFINITE);
+		CloseHandle(drainThread);
+	}
+
+	EnterCriticalSection(&Server->Lock);
+	while (Server->InFlight > 0)
+		SleepConditionVariableCS(&Server->Changed, &Server->Lock, INFINITE);
+
+	LeaveCriticalSection(&Server->Lock);
+	if (Server->DeviceConnected) {
+		DevConn_Disconnect();
+		Server->DeviceConnected = FALSE;
+	}
+
+	return;
+}
+
+
+static void _ClientClose(PLS_SERVER Server, ULONG Index)
+{
+	PLS_OUTPUT o = NULL;
+	PLS_CLIENT client = Server->Clients[Index];
+
+	EnterCriticalSection(&Server->Lock);
+	client->Closed = TRUE;
+	client->Subscribed = FALSE;
+	while (client->OutputHead != NULL) {
+		o = client->OutputHead;
+		client->OutputHead = o->Next;
+		_OutputFree(o);
+	}
+
+	client->OutputTail = NULL;
+	Server->Clients[Index] = Server->Clients[Server->ClientCount - 1];
+	--Server->ClientCount;
+	LeaveCriticalSection(&Server->Lock);
+	if (client->Item != NULL) {
+		HeapFree(GetProcessHeap(), 0, client->Item);
+		client->Item = NULL;
+	}
+
+	shutdown(client->Socket, SD_BOTH);
+	closesocket(client->Socket);
+	_ClientRelease(client);
+	if (Server->ClientCount == 0)
+		_ServerIdle(Server);
+
+	return;
+}
+
+
+static void _ServerAccept(PLS_SERVER Server)
+{
+	int ret = 0;
+	SOCKET s = INVALID_SOCKET;
+	u_long nonBlocking = 1;
+	BOOL noDelay = TRUE;
+	PLS_CLIENT client = NULL;
+	NETWORK_MSG_IOCTL_V2 msg;
+
+	s = accept(Server->ListenSocket, NULL, NULL);
+	if (s == INVALID_SOCKET)
+		goto Exit;
+
+	if (Server->ClientCount == LS_MAX_CLIENTS || ioctlsocket(s, FIONBIO, &nonBlocking) != 0)
+		goto CloseSocket;
+
+	// Small messages are coalesced by the server itself.
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&noDelay, sizeof(noDelay));
+
+	client = (PLS_CLIENT)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LS_CLIENT));
+	if (client == NULL)
+		goto CloseSocket;
+
+	client->Server = Server;
+	client->Socket = s;
+	client->ReferenceCount = 1;
+	client->ProtocolVersion = NETWORK_PROTOCOL_VERSION_1;
+	client->LastActivity = GetTickCount();
+	memset(&msg, 0, sizeof(msg));
+	if (!Server->DeviceConnected) {
+		memset(&_initInfo, 0, sizeof(_initInfo));
+		_initInfo.ConnectorType = ictDevice;
+		ret = DevConn_Connect(&_initInfo);
+		Server->DeviceConnected = (ret == 0);
+	}
+
+	msg.Result = ret;
+	if (ret == 0) {
 #if defined(_AMD64_)
-					msg.ControlCode = IOCTL_IRPMON_SERVER_ARCH_64BIT;
+		msg.ControlCode = IOCTL_IRPMON_SERVER_ARCH_64BIT;
 #elif defined(_X86_)
-					msg.ControlCode = IOCTL_IRPMON_SERVER_ARCH_32BIT;
+		msg.ControlCode = IOCTL_IRPMON_SERVER_ARCH_32BIT;
 #else
 #error Unsupported architecture
 #endif
-				}
+		msg.InputBufferSize = NETWORK_PROTOCOL_VERSION_2;
+	} else client->CloseAfterFlush = TRUE;
 
-				bytesReceived = send(acceptSocket, (char *)&msg, sizeof(msg), 0);
-				if (bytesReceived != sizeof(msg))
-					ret = WSAGetLastError();
-
-				if (ret == ERROR_SUCCESS) {
-					do {
-						bytesReceived = recv(acceptSocket, (char *)&msg, sizeof(msg), MSG_WAITALL);
-						if (bytesReceived == sizeof(msg)) {
-							if (msg.ControlCode == 0) {
-								bytesReceived = send(acceptSocket, (char *)&msg, sizeof(msg), 0);
-								if (bytesReceived != sizeof(msg))
-									ret = WSAGetLastError();
-
-								continue;
-							}
-
-							inputBuffer = NULL;
-							if (msg.InputBufferSize > 0)
-								inputBuffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, msg.InputBufferSize);
-
-							if (inputBuffer != NULL || msg.InputBufferSize == 0) {
-								outputBuffer = NULL;
-								if (msg.OutputBufferSize > 0)
-									outputBuffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, msg.OutputBufferSize);
-
-								if (outputBuffer != NULL || msg.OutputBufferSize == 0) {
-									bytesReceived = msg.InputBufferSize;
-									if (msg.InputBufferSize > 0)
-										bytesReceived = recv(acceptSocket, inputBuffer, msg.InputBufferSize, MSG_WAITALL);
-
-									if (bytesReceived != msg.InputBufferSize)
-										ret = WSAGetLastError();
-
-									if (ret == 0) {
-										msg.Result = DevConn_SynchronousOtherIOCTL(msg.ControlCode, inputBuffer, msg.InputBufferSize, outputBuffer, msg.OutputBufferSize);
-										bytesReceived = send(acceptSocket, (char *)&msg, sizeof(msg), 0);
-										if (bytesReceived != sizeof(msg))
-											ret = WSAGetLastError();
-
-										if (ret == 0 && msg.OutputBufferSize > 0) {
-											bytesReceived = send(acceptSocket, (char *)outputBuffer, msg.OutputBufferSize, 0);
-											if (bytesReceived != msg.OutputBufferSize)
-												ret = WSAGetLastError();
-										}
-									}
-
-									if (outputBuffer != NULL)
-										HeapFree(GetProcessHeap(), 0, outputBuffer);
-								} else ret = GetLastError();
-
-								if (inputBuffer != NULL)
-									HeapFree(GetProcessHeap(), 0, inputBuffer);
-							} else ret = GetLastError();
-						} else {
-							ret = WSAGetLastError();
-							if (ret == ERROR_SUCCESS)
-								break;
-						}
-
-						if (ret == 0 && ExitEvent != NULL) {
-							ret = WaitForSingleObject(ExitEvent, 0);
-							if (ret == WAIT_OBJECT_0)
-								terminated = TRUE;
-
-							ret = 0;
-						}
-
-					} while (ret == 0 && !terminated);
-
-					DevConn_Disconnect();
-				}
-			} else ret = WSAGetLastError();
+	EnterCriticalSection(&Server->Lock);
+	Server->Clients[Server->ClientCount] = client;
+	++Server->ClientCount;
+	LeaveCriticalSection(&Server->Lock);
+	if (_ClientQueueControl(client, &msg, NETWORK_PROTOCOL_VERSION_1) != 0)
+		client->CloseAfterFlush = TRUE;
+
+	goto Exit;
+CloseSocket:
+	closesocket(s);
+Exit:
+	return;
+}
+
+
+static int _Listener(const ADDRINFOA *Address, HANDLE ExitEvent)
+{
+	int ret = 0;
+	ULONG i = 0;
+	ULONG count = 0;
+	int timeout = 0;
+	ULONG64 now = 0;
+	char wakeBuffer[16];
+	PLS_CLIENT c = NULL;
+	BOOLEAN closeClient = FALSE;
+	LS_SERVER server;
+	WSAPOLLFD fds[LS_MAX_CLIENTS + 2];
+	PLS_CLIENT polled[LS_MAX_CLIENTS];
+
+	memset(&server, 0, sizeof(server));
+	server.WakeSocket = INVALID_SOCKET;
+	InitializeCriticalSection(&server.Lock);
+	InitializeConditionVariable(&server.Changed);
+	server.ListenSocket = socket(Address->ai_family, SOCK_STREAM, IPPROTO_TCP);
+	if (server.ListenSocket == INVALID_SOCKET) {
+		ret = WSAGetLastError();
+		goto DeleteLock;
+	}
+
+	ret = bind(server.ListenSocket, Address->ai_addr, (int)Address->ai_addrlen);
+	if (ret != 0) {
+		ret = WSAGetLastError();
+		goto DestroySocket;
+	}
 
-			shutdown(acceptSocket, SD_BOTH);
-			closesocket(acceptSocket);
+	ret = listen(server.ListenSocket, SOMAXCONN);
+	if (ret != 0) {
+		ret = WSAGetLastError();
+		goto DestroySocket;
+	}
+
+	ret = _WakeSocketCreate(&server);
+	if (ret != 0)
+		goto DestroySocket;
+
+	do {
+		if (ExitEvent != NULL && WaitForSingleObject(ExitEvent, 0) == WAIT_OBJECT_0)
+			break;
+
+		fds[0].fd = server.ListenSocket;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = server.WakeSocket;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		count = server.ClientCount;
+		timeout = LS_POLL_TIMEOUT;
+		now = _TimeMs();
+		EnterCriticalSection(&server.Lock);
+		for (i = 0; i < count; ++i) {
+			c = server.Clients[i];
+			polled[i] = c;
+			fds[i + 2].fd = c->Socket;
+			fds[i + 2].events = 0;
+			fds[i + 2].revents = 0;
+			if (!c->CloseAfterFlush && c->InFlight < NETWORK_MAX_IN_FLIGHT)
+				fds[i + 2].events |= POLLIN;
+
+			if (_ClientFlushDue(c, now))
+				fds[i + 2].events |= POLLOUT;
+			else if (c->OutputHead != NULL && c->FlushDeadline - now < (ULONG64)timeout)
+				timeout = (int)(c->FlushDeadline - now);
 		}
-	} while (!terminated);
 
+		LeaveCriticalSection(&server.Lock);
+		ret = WSAPoll(fds, count + 2, timeout);
+		if (ret == SOCKET_ERROR) {
+			ret = WSAGetLastError();
+			break;
+		}
+
+		ret = 0;
+		// Drain the wake socket before clearing the flag, otherwise a wake
+		// arriving in between could be swallowed while the flag stays set.
+		if (fds[1].revents & POLLIN) {
+			while (recv(server.WakeSocket, wakeBuffer, sizeof(wakeBuffer), 0) > 0)
+				;
+
+			InterlockedExchange(&server.WakePending, 0);
+		}
+
+		// Walk the clients backwards; closing one moves the last client
+		// into its slot.
+		for (i = count; i > 0; --i) {
+			c = polled[i - 1];
+			closeClient = ((fds[i + 1].revents & (POLLERR | POLLNVAL)) != 0);
+			if (!closeClient && (fds[i + 1].revents & (POLLIN | POLLHUP)))
+				closeClient = (_ClientRead(c) != 0);
+
+			if (!closeClient)
+				closeClient = (_ClientFlush(c) != 0);
+
+			if (!closeClient) {
+				EnterCriticalSection(&server.Lock);
+				closeClient = (c->CloseAfterFlush && c->OutputHead == NULL);
+				LeaveCriticalSection(&server.Lock);
+			}
+
+			if (!closeClient)
+				closeClient = (GetTickCount() - c->LastActivity > LS_CLIENT_TIMEOUT);
+
+			if (closeClient)
+				_ClientClose(&server, i - 1);
+		}
+
+		if (fds[0].revents & POLLIN)
+			_ServerAccept(&server);
+	} while (TRUE);
+
+	while (server.ClientCount > 0)
+		_ClientClose(&server, server.ClientCount - 1);
+
+	closesocket(server.WakeSocket);
 DestroySocket:
-	closesocket(listenSocket);
-Exit:
+	closesocket(server.ListenSocket);
+DeleteLock:
+	DeleteCriticalSection(&server.Lock);
+
 	return ret;
 }
 
@@ -199,6 +1287,8 @@ DWORD IRPMonServerStart(const char *Address, const char *Port, HANDLE ExitEvent)
 		goto Exit;
 	}
 
+	QueryPerformanceFrequency(&_performanceFrequency);
+
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
@@ -216,3 +1306,16 @@ Cleanup:
 Exit:
 	return ret;
 }
+
+
+/** Sets how long event batches may wait in the output queue of a client
+ *  (milliseconds) and how many bytes may accumulate there before they are
+ *  sent; zero Size selects the default. Affects servers started afterwards.
+ */
+void IRPMonServerSetFlushPolicy(ULONG Deadline, ULONG Size)
+{
+	_flushDeadline = Deadline;
+	_flushSize = (Size > 0) ? Size : LS_DEFAULT_FLUSH_SIZE;
+
+	return;
+}
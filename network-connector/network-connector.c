@@ -1,21 +1,66 @@
 
-#include <WinSock2.h>
+#include <winsock2.h>
 #include <ws2tcpip.h>
 #include <windows.h>
 #include <winternl.h>
 #include "debug.h"
+#include "ioctls.h"
+#include "block-codec.h"
 #include "network-connector.h"
 
 
 
+/************************************************************************/
+/*                   TYPES AND MACROS                                   */
+/************************************************************************/
+
+/** A request waiting for its reply (version 2 protocol). */
+typedef struct _NETCONN_PENDING {
+	struct _NETCONN_PENDING *Next;
+	uint32_t RequestId;
+	PVOID OutputBuffer;
+	ULONG OutputBufferLength;
+	BOOL Done;
+	DWORD Result;
+} NETCONN_PENDING, *PNETCONN_PENDING;
+
+/** A batch of requests pushed by the server, the data follow the structure. */
+typedef struct _NETCONN_BATCH {
+	struct _NETCONN_BATCH *Next;
+	DWORD Result;
+	ULONG Size;
+} NETCONN_BATCH, *PNETCONN_BATCH;
+
+typedef enum _ENetConnStreamState {
+	ncssNone,
+	ncssSubscribing,
+	ncssActive,
+} ENetConnStreamState, *PENetConnStreamState;
+
+
 /************************************************************************/
 /*                   GLOBAL VARIABLES                                   */
 /************************************************************************/
 
 static SOCKET _socket = INVALID_SOCKET;
+/** Serializes whole round trips with version 1 servers, only sending with
+    version 2 ones. */
 static CRITICAL_SECTION _ioctlLock;
 static HANDLE _pingingThreadHandle = NULL;
 static volatile BOOL _pindingThreadTerminate = FALSE;
+static uint32_t _protocolVersion = NETWORK_PROTOCOL_VERSION_1;
+static HANDLE _receiverThreadHandle = NULL;
+static volatile LONG _lastRequestId = 0;
+/** Protects the list of pending requests and the connection error. */
+static CRITICAL_SECTION _pendingLock;
+static CONDITION_VARIABLE _pendingDone;
+static PNETCONN_PENDING _pendingList = NULL;
+static DWORD _connectionError = ERROR_SUCCESS;
+/** Event stream, the batches are protected by _pendingLock. */
+static volatile LONG _streamState = ncssNone;
+static uint32_t _streamId = 0;
+static PNETCONN_BATCH _streamHead = NULL;
+static PNETCONN_BATCH _streamTail = NULL;
 
 IRPMON_DRIVER_COMM_INTERFACE DriverCommInterface = {
 	ictNetwork,
@@ -30,16 +75,421 @@ IRPMON_DRIVER_COMM_INTERFACE DriverCommInterface = {
 /*                  HELPER FUNCTIONS                                    */
 /************************************************************************/
 
+static DWORD _SendFrame(SOCKET Socket, const void *Header, ULONG HeaderSize, const void *Data, ULONG DataSize)
+{
+	WSABUF bufs[2];
+	DWORD bytesSent = 0;
+	DWORD ret = ERROR_SUCCESS;
+
+	bufs[0].buf = (char *)Header;
+	bufs[0].len = HeaderSize;
+	bufs[1].buf = (char *)Data;
+	bufs[1].len = DataSize;
+	if (WSASend(Socket, bufs, (DataSize > 0) ? 2 : 1, &bytesSent, 0, NULL, NULL) == 0) {
+		if (bytesSent != HeaderSize + DataSize)
+			ret = ERROR_CONNECTION_ABORTED;
+	} else ret = WSAGetLastError();
+
+	return ret;
+}
+
+
+static DWORD _Receive(SOCKET Socket, void *Buffer, ULONG Length)
+{
+	int bytesReceived = 0;
+	DWORD ret = ERROR_SUCCESS;
+
+	if (Length > 0) {
+		bytesReceived = recv(Socket, (char *)Buffer, Length, MSG_WAITALL);
+		if (bytesReceived != (int)Length) {
+			ret = WSAGetLastError();
+			if (ret == ERROR_SUCCESS)
+				ret = ERROR_CONNECTION_ABORTED;
+		}
+	}
+
+	return ret;
+}
+
+
+/** Reads and throws away data of a reply nobody waits for. */
+static DWORD _ReceiveDiscard(SOCKET Socket, ULONG Length)
+{
+	ULONG chunk = 0;
+	char buffer[4096];
+	DWORD ret = ERROR_SUCCESS;
+
+	while (ret == ERROR_SUCCESS && Length > 0) {
+		chunk = (Length < sizeof(buffer)) ? Length : sizeof(buffer);
+		ret = _Receive(Socket, buffer, chunk);
+		Length -= chunk;
+	}
+
+	return ret;
+}
+
+
+/** Receives compressed data and decompresses them into the buffer. */
+static DWORD _ReceiveDecompress(SOCKET Socket, EBlockCodecMethod Method, ULONG Length, void *Buffer, ULONG BufferLength)
+{
+	void *tmp = NULL;
+	DWORD ret = ERROR_SUCCESS;
+
+	tmp = HeapAlloc(GetProcessHeap(), 0, (Length > 0) ? Length : 1);
+	if (tmp != NULL) {
+		ret = _Receive(Socket, tmp, Length);
+		if (ret == ERROR_SUCCESS && BlockCodecDecompress(Method, tmp, Length, Buffer, BufferLength) != ERROR_VALUE_SUCCESS)
+			ret = ERROR_INVALID_MESSAGE;
+
+		HeapFree(GetProcessHeap(), 0, tmp);
+	} else ret = ERROR_NOT_ENOUGH_MEMORY;
+
+	return ret;
+}
+
+
+/** Marks the connection as broken and completes all pending requests with
+ *  the error. The socket is shut down, so the receiver thread terminates.
+ */
+static void _ConnectionFail(DWORD Error)
+{
+	PNETCONN_PENDING p = NULL;
+
+	EnterCriticalSection(&_pendingLock);
+	if (_connectionError == ERROR_SUCCESS) {
+		_connectionError = Error;
+		shutdown(_socket, SD_BOTH);
+	}
+
+	while (_pendingList != NULL) {
+		p = _pendingList;
+		_pendingList = p->Next;
+		p->Result = _connectionError;
+		p->Done = TRUE;
+	}
+
+	WakeAllConditionVariable(&_pendingDone);
+	LeaveCriticalSection(&_pendingLock);
+
+	return;
+}
+
+
+/** Queues a batch pushed by the server until NetConn_SynchronousOtherIOCTL
+ *  picks it up.
+ */
+static DWORD _StreamReceive(SOCKET Socket, const NETWORK_MSG_IOCTL_V2 *Msg)
+{
+	ULONG size = 0;
+	PNETCONN_BATCH b = NULL;
+	REQUEST_BATCH_HEADER header;
+	DWORD ret = ERROR_SUCCESS;
+
+	size = Msg->OutputBufferSize;
+	if (Msg->Encoding != bcmNone) {
+		// Only the requests are compressed, the batch header tells their
+		// size.
+		ret = ERROR_INVALID_MESSAGE;
+		if (Msg->Encoding < bcmMax && BlockCodecSupported((EBlockCodecMethod)Msg->Encoding) &&
+			Msg->OutputBufferSize >= sizeof(header) && Msg->OutputBufferSize <= NETWORK_STREAM_MAX_BATCH_SIZE)
+			ret = _Receive(Socket, &header, sizeof(header));
+
+		if (ret == ERROR_SUCCESS) {
+			if (header.HeaderSize >= sizeof(header) && header.HeaderSize <= NETWORK_STREAM_MAX_BATCH_SIZE &&
+				header.BytesUsed <= NETWORK_STREAM_MAX_BATCH_SIZE - header.HeaderSize)
+				size = header.HeaderSize + header.BytesUsed;
+			else ret = ERROR_INVALID_MESSAGE;
+		}
+	} else if (size > NETWORK_STREAM_MAX_BATCH_SIZE)
+		ret = ERROR_INVALID_MESSAGE;
+
+	if (ret == ERROR_SUCCESS) {
+		b = (PNETCONN_BATCH)HeapAlloc(GetProcessHeap(), 0, sizeof(NETCONN_BATCH) + size);
+		if (b != NULL) {
+			b->Next = NULL;
+			b->Result = Msg->Result;
+			b->Size = size;
+			if (Msg->Encoding != bcmNone) {
+				memcpy(b + 1, &header, sizeof(header));
+				ret = _ReceiveDecompress(Socket, (EBlockCodecMethod)Msg->Encoding, Msg->OutputBufferSize - sizeof(header), (unsigned char *)(b + 1) + sizeof(header), size - sizeof(header));
+			} else ret = _Receive(Socket, b + 1, b->Size);
+
+			if (ret == ERROR_SUCCESS) {
+				EnterCriticalSection(&_pendingLock);
+				if (Msg->RequestId == _streamId) {
+					if (_streamTail != NULL)
+						_streamTail->Next = b;
+					else _streamHead = b;
+
+					_streamTail = b;
+					b = NULL;
+				}
+
+				LeaveCriticalSection(&_pendingLock);
+			}
+
+			if (b != NULL)
+				HeapFree(GetProcessHeap(), 0, b);
+		} else ret = ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	return ret;
+}
+
+
+static DWORD WINAPI _ReceiverThread(PVOID Context)
+{
+	DWORD ret = ERROR_SUCCESS;
+	SOCKET s = (SOCKET)Context;
+	NETWORK_MSG_IOCTL_V2 msg;
+	PNETCONN_PENDING p = NULL;
+	PNETCONN_PENDING *prev = NULL;
+	DEBUG_ENTER_FUNCTION("Context=0x%p", Context);
+
+	while (ret == ERROR_SUCCESS) {
+		ret = _Receive(s, &msg, sizeof(msg));
+		if (ret != ERROR_SUCCESS)
+			break;
+
+		if (msg.ControlCode == NETWORK_CONTROL_RECORDS && msg.RequestId != 0) {
+			ret = _StreamReceive(s, &msg);
+			continue;
+		}
+
+		p = NULL;
+		if (msg.RequestId != 0) {
+			EnterCriticalSection(&_pendingLock);
+			prev = &_pendingList;
+			while (*prev != NULL && (*prev)->RequestId != msg.RequestId)
+				prev = &(*prev)->Next;
+
+			p = *prev;
+			if (p != NULL)
+				*prev = p->Next;
+
+			LeaveCriticalSection(&_pendingLock);
+		}
+
+		// The caller is blocked until its request is marked as done, so its
+		// output buffer can be filled outside the lock.
+		if (p != NULL && msg.OutputBufferSize <= p->OutputBufferLength) {
+			ret = _Receive(s, p->OutputBuffer, msg.OutputBufferSize);
+			p->Result = (ret == ERROR_SUCCESS) ? msg.Result : ret;
+		} else {
+			ret = _ReceiveDiscard(s, msg.OutputBufferSize);
+			if (p != NULL)
+				p->Result = (ret == ERROR_SUCCESS) ? ERROR_INSUFFICIENT_BUFFER : ret;
+		}
+
+		if (p != NULL) {
+			EnterCriticalSection(&_pendingLock);
+			p->Done = TRUE;
+			WakeAllConditionVariable(&_pendingDone);
+			LeaveCriticalSection(&_pendingLock);
+		}
+	}
+
+	_ConnectionFail(ret);
+
+	DEBUG_EXIT_FUNCTION("%u", ret);
+	return ret;
+}
+
+
+static uint32_t _NewRequestId(void)
+{
+	uint32_t ret = 0;
+
+	do {
+		ret = (uint32_t)InterlockedIncrement(&_lastRequestId);
+	} while (ret == 0);
+
+	return ret;
+}
+
+
+static DWORD _SynchronousIOCTLV2(DWORD Code, uint32_t RequestId, PVOID InputBuffer, ULONG InputBufferLength, PVOID OutputBuffer, ULONG OutputBufferLength)
+{
+	NETWORK_MSG_IOCTL_V2 msg;
+	NETCONN_PENDING pending;
+	DWORD ret = ERROR_GEN_FAILURE;
+
+	memset(&pending, 0, sizeof(pending));
+	pending.RequestId = RequestId;
+	pending.OutputBuffer = OutputBuffer;
+	pending.OutputBufferLength = OutputBufferLength;
+	memset(&msg, 0, sizeof(msg));
+	msg.Result = ERROR_IO_PENDING;
+	msg.ControlCode = Code;
+	msg.InputBufferSize = InputBufferLength;
+	msg.OutputBufferSize = OutputBufferLength;
+	msg.RequestId = pending.RequestId;
+	EnterCriticalSection(&_pendingLock);
+	ret = _connectionError;
+	if (ret == ERROR_SUCCESS) {
+		pending.Next = _pendingList;
+		_pendingList = &pending;
+	}
+
+	LeaveCriticalSection(&_pendingLock);
+	if (ret == ERROR_SUCCESS) {
+		EnterCriticalSection(&_ioctlLock);
+		ret = _SendFrame(_socket, &msg, sizeof(msg), InputBuffer, InputBufferLength);
+		LeaveCriticalSection(&_ioctlLock);
+		// A partially sent message breaks the stream for everybody.
+		if (ret != ERROR_SUCCESS)
+			_ConnectionFail(ret);
+
+		EnterCriticalSection(&_pendingLock);
+		while (!pending.Done)
+			SleepConditionVariableCS(&_pendingDone, &_pendingLock, INFINITE);
+
+		LeaveCriticalSection(&_pendingLock);
+		ret = pending.Result;
+	}
+
+	return ret;
+}
+
+
+/** Serves IOCTL_IRPMNDRV_GET_RECORDS from the batches pushed by the server.
+ *  The first call subscribes to the event stream with the size of its
+ *  buffer as the batch size. Each consumed batch gives the server credit for
+ *  another one.
+ */
+static DWORD _StreamGetBatch(PVOID OutputBuffer, ULONG OutputBufferLength)
+{
+	BOOL more = FALSE;
+	uint32_t id = 0;
+	DWORD err = ERROR_SUCCESS;
+	PNETCONN_BATCH b = NULL;
+	NETWORK_MSG_IOCTL_V2 msg;
+	NETWORK_SUBSCRIBE_INPUT input;
+	DWORD ret = ERROR_SUCCESS;
+
+	if (InterlockedCompareExchange(&_streamState, ncssSubscribing, ncssNone) == ncssNone) {
+		id = _NewRequestId();
+		EnterCriticalSection(&_pendingLock);
+		_streamId = id;
+		LeaveCriticalSection(&_pendingLock);
+		input.BatchSize = (OutputBufferLength < NETWORK_STREAM_MAX_BATCH_SIZE) ? OutputBufferLength : NETWORK_STREAM_MAX_BATCH_SIZE;
+		input.Credit = NETWORK_STREAM_CREDIT;
+		input.Compression = bcmFast;
+		ret = _SynchronousIOCTLV2(NETWORK_CONTROL_SUBSCRIBE, id, &input, sizeof(input), NULL, 0);
+		if (ret != ERROR_SUCCESS) {
+			EnterCriticalSection(&_pendingLock);
+			_streamId = 0;
+			LeaveCriticalSection(&_pendingLock);
+		}
+
+		InterlockedExchange(&_streamState, (ret == ERROR_SUCCESS) ? ncssActive : ncssNone);
+	}
+
+	if (ret == ERROR_SUCCESS) {
+		ret = ERROR_NO_MORE_ITEMS;
+		EnterCriticalSection(&_pendingLock);
+		b = _streamHead;
+		if (b != NULL) {
+			ret = b->Result;
+			if (ret == ERROR_SUCCESS && b->Size > OutputBufferLength) {
+				ret = ERROR_INSUFFICIENT_BUFFER;
+				b = NULL;
+			} else {
+				_streamHead = b->Next;
+				if (_streamHead == NULL)
+					_streamTail = NULL;
+			}
+
+			id = _streamId;
+			// The server ends the stream by a failed batch, the next call
+			// subscribes again.
+			if (b != NULL && ret != ERROR_SUCCESS) {
+				_streamId = 0;
+				InterlockedExchange(&_streamState, ncssNone);
+			}
+		} else if (_connectionError != ERROR_SUCCESS)
+			ret = _connectionError;
+
+		more = (_streamHead != NULL);
+		LeaveCriticalSection(&_pendingLock);
+		if (b != NULL) {
+			if (ret == ERROR_SUCCESS) {
+				memcpy(OutputBuffer, b + 1, b->Size);
+				if (more && b->Size >= sizeof(REQUEST_BATCH_HEADER))
+					((PREQUEST_BATCH_HEADER)OutputBuffer)->Flags |= REQUEST_BATCH_FLAG_MORE_AVAILABLE;
+
+				memset(&msg, 0, sizeof(msg));
+				msg.Result = 1;
+				msg.ControlCode = NETWORK_CONTROL_CREDIT;
+				msg.RequestId = id;
+				EnterCriticalSection(&_ioctlLock);
+				err = _SendFrame(_socket, &msg, sizeof(msg), NULL, 0);
+				LeaveCriticalSection(&_ioctlLock);
+				if (err != ERROR_SUCCESS)
+					_ConnectionFail(err);
+			}
+
+			HeapFree(GetProcessHeap(), 0, b);
+		}
+	}
+
+	return ret;
+}
+
+
+/** Asks a server that supports the version 2 protocol to switch to it. */
+static DWORD _ProtocolUpgrade(SOCKET Socket)
+{
+	NETWORK_MSG_IOCTL msg;
+	DWORD ret = ERROR_GEN_FAILURE;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.Result = NETWORK_PROTOCOL_VERSION_2;
+	msg.ControlCode = NETWORK_CONTROL_PROTOCOL;
+	ret = _SendFrame(Socket, &msg, sizeof(msg), NULL, 0);
+	if (ret == ERROR_SUCCESS)
+		ret = _Receive(Socket, &msg, sizeof(msg));
+
+	if (ret == ERROR_SUCCESS) {
+		ret = msg.Result;
+		if (ret == ERROR_SUCCESS) {
+			_protocolVersion = NETWORK_PROTOCOL_VERSION_2;
+			_connectionError = ERROR_SUCCESS;
+			_pendingList = NULL;
+			_receiverThreadHandle = CreateThread(NULL, 0, _ReceiverThread, (PVOID)Socket, 0, NULL);
+			if (_receiverThreadHandle == NULL)
+				ret = GetLastError();
+		}
+	}
+
+	return ret;
+}
+
+
 static DWORD WINAPI _PingingThread(PVOID Context)
 {
 	int ret = ERROR_SUCCESS;
 	int bytesTransferred = 0;
 	SOCKET s = (SOCKET)Context;
 	NETWORK_MSG_IOCTL msg;
+	NETWORK_MSG_IOCTL_V2 msgV2;
 	DEBUG_ENTER_FUNCTION("Context=0x%p", Context);
 
 	while (!_pindingThreadTerminate) {
 		Sleep(1000);
+		if (_protocolVersion == NETWORK_PROTOCOL_VERSION_2) {
+			memset(&msgV2, 0, sizeof(msgV2));
+			EnterCriticalSection(&_ioctlLock);
+			ret = _SendFrame(s, &msgV2, sizeof(msgV2), NULL, 0);
+			LeaveCriticalSection(&_ioctlLock);
+			if (ret != ERROR_SUCCESS) {
+				_ConnectionFail(ret);
+				_pindingThreadTerminate = TRUE;
+			}
+
+			continue;
+		}
+
 		memset(&msg, 0, sizeof(msg));
 		EnterCriticalSection(&_ioctlLock);
 		bytesTransferred = send(s, (char *)&msg, sizeof(msg), 0);
@@ -79,6 +529,15 @@ DWORD NetConn_SynchronousOtherIOCTL(DWORD Code, PVOID InputBuffer, ULONG InputBu
 	DWORD ret = ERROR_GEN_FAILURE;
 	DEBUG_ENTER_FUNCTION("Code=0x%x; InputBuffer=0x%p; InputBufferLength=%u; OutputBuffer=0x%p; OutputBufferLength=%u", Code, InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength);
 
+	if (_protocolVersion == NETWORK_PROTOCOL_VERSION_2) {
+		if (Code == IOCTL_IRPMNDRV_GET_RECORDS)
+			ret = _StreamGetBatch(OutputBuffer, OutputBufferLength);
+		else ret = _SynchronousIOCTLV2(Code, _NewRequestId(), InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength);
+
+		DEBUG_EXIT_FUNCTION("%u", ret);
+		return ret;
+	}
+
 	memset(&msg, 0, sizeof(msg));
 	msg.Result = ERROR_IO_PENDING;
 	msg.ControlCode = Code;
@@ -124,6 +583,7 @@ DWORD NetConn_SynchronousOtherIOCTL(DWORD Code, PVOID InputBuffer, ULONG InputBu
 DWORD NetConn_Connect(const IRPMON_INIT_INFO *Info)
 {
 	uint32_t timeout;
+	BOOL noDelay = TRUE;
 	uint32_t wVersionRequested = MAKEWORD(2, 2);
 	ADDRINFOW hints;
 	PADDRINFOW tmp = NULL;
@@ -135,7 +595,9 @@ DWORD NetConn_Connect(const IRPMON_INIT_INFO *Info)
 	DEBUG_ENTER_FUNCTION("Info=0x%p", Info);
 	
 	if (_socket == INVALID_SOCKET) {
-		if (InitializeCriticalSectionAndSpinCount(&_ioctlLock, 0x1000)) {
+		if (InitializeCriticalSectionAndSpinCount(&_ioctlLock, 0x1000) &&
+			InitializeCriticalSectionAndSpinCount(&_pendingLock, 0x1000)) {
+			InitializeConditionVariable(&_pendingDone);
 			ret = WSAStartup(wVersionRequested, &wsaData);
 			if (ret == 0) {
 				memset(&hints, 0, sizeof(hints));
@@ -148,6 +610,9 @@ DWORD NetConn_Connect(const IRPMON_INIT_INFO *Info)
 						if (_socket != INVALID_SOCKET) {
 							ret = connect(_socket, tmp->ai_addr, (int)tmp->ai_addrlen);
 							if (ret == 0) {
+								// Credits and requests are small and must not wait for
+								// acknowledgements of the previous ones.
+								setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (char *)&noDelay, sizeof(noDelay));
 								timeout = 10000;
 								ret = setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
 								if (ret == 0) {
@@ -172,12 +637,25 @@ DWORD NetConn_Connect(const IRPMON_INIT_INFO *Info)
 													break;
 											}
 											
+											// Older servers do not advertise the protocol version
+											// and keep the field zero.
+											_protocolVersion = NETWORK_PROTOCOL_VERSION_1;
+											if (ret == ERROR_SUCCESS && msg.InputBufferSize >= NETWORK_PROTOCOL_VERSION_2)
+												ret = _ProtocolUpgrade(_socket);
+
 											if (ret == ERROR_SUCCESS) {
 												_pindingThreadTerminate = FALSE;
 												_pingingThreadHandle = CreateThread(NULL, 0, _PingingThread, (PVOID)_socket, 0, NULL);
 												if (_pingingThreadHandle == NULL)
 													ret = GetLastError();
 											}
+
+											if (ret != ERROR_SUCCESS && _receiverThreadHandle != NULL) {
+												shutdown(_socket, SD_BOTH);
+												WaitForSingleObject(_receiverThreadHandle, INFINITE);
+												CloseHandle(_receiverThreadHandle);
+												_receiverThreadHandle = NULL;
+											}
 										}
 
 										break;
@@ -204,8 +682,10 @@ DWORD NetConn_Connect(const IRPMON_INIT_INFO *Info)
 					WSACleanup();
 			} else ret = WSAGetLastError();
 
-			if (ret != 0)
+			if (ret != 0) {
+				DeleteCriticalSection(&_pendingLock);
 				DeleteCriticalSection(&_ioctlLock);
+			}
 		} else ret = GetLastError();
 	} else ret = ERROR_ALREADY_EXISTS;
 
@@ -216,6 +696,7 @@ DWORD NetConn_Connect(const IRPMON_INIT_INFO *Info)
 
 void NetConn_Disconnect(void)
 {
+	PNETCONN_BATCH b = NULL;
 	DEBUG_ENTER_FUNCTION_NO_ARGS();
 
 	if (_socket != INVALID_SOCKET) {
@@ -223,9 +704,26 @@ void NetConn_Disconnect(void)
 		WaitForSingleObject(_pingingThreadHandle, INFINITE);
 		CloseHandle(_pingingThreadHandle);
 		shutdown(_socket, SD_BOTH);
+		if (_receiverThreadHandle != NULL) {
+			WaitForSingleObject(_receiverThreadHandle, INFINITE);
+			CloseHandle(_receiverThreadHandle);
+			_receiverThreadHandle = NULL;
+		}
+
+		while (_streamHead != NULL) {
+			b = _streamHead;
+			_streamHead = b->Next;
+			HeapFree(GetProcessHeap(), 0, b);
+		}
+
+		_streamTail = NULL;
+		_streamId = 0;
+		_streamState = ncssNone;
 		closesocket(_socket);
 		_socket = INVALID_SOCKET;
+		_protocolVersion = NETWORK_PROTOCOL_VERSION_1;
 		WSACleanup();
+		DeleteCriticalSection(&_pendingLock);
 		DeleteCriticalSection(&_ioctlLock);
 	}
 
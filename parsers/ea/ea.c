@@ -85,9 +85,8 @@ static DWORD _ProcessEAList(PNV_PAIR Pair, const FILE_GET_EA_INFORMATION *EAList
 }
 
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+static DWORD _Parse(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair)
 {
-	NV_PAIR p;
 	BOOLEAN parsed = FALSE;
 	DWORD ret = ERROR_GEN_FAILURE;
 	const REQUEST_IRP *irp = NULL;
@@ -95,7 +94,6 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 	const FILE_FULL_EA_INFORMATION *eaBuffer = NULL;
 	const FILE_GET_EA_INFORMATION *eaList = NULL;
 
-	memset(&p, 0, sizeof(p));
 	ret = ERROR_SUCCESS;
 	switch (Request->Type) {
 		case ertIRP:
@@ -104,12 +102,12 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 				switch (irp->MajorFunction) {
 					case IRP_MJ_SET_EA:
 						eaBuffer = (FILE_FULL_EA_INFORMATION *)(irp + 1);
-						ret = _ProcessEABuffer(&p, eaBuffer);
+						ret = _ProcessEABuffer(Pair, eaBuffer);
 						parsed = TRUE;
 						break;
 					case IRP_MJ_QUERY_EA:
 						eaList = (FILE_GET_EA_INFORMATION *)(irp + 1);
-						ret = _ProcessEAList(&p, eaList);
+						ret = _ProcessEAList(Pair, eaList);
 						parsed = TRUE;
 						break;
 				}
@@ -120,30 +118,28 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 			if (irpComp->MajorFunction == IRP_MJ_QUERY_EA &&
 				irpComp->DataSize > 0) {
 				eaBuffer = (FILE_FULL_EA_INFORMATION *)(irpComp + 1);
-				ret = _ProcessEABuffer(&p, eaBuffer);
+				ret = _ProcessEABuffer(Pair, eaBuffer);
 				parsed = TRUE;
 			}
 			break;
 	}
 
-	*RowCount = 0;
-	*Names = NULL;
-	*Values = NULL;
-	if (ret == ERROR_SUCCESS) {
+	if (ret == ERROR_SUCCESS)
 		*Handled = parsed;
-		*RowCount = p.Count;
-		*Names = p.Names;
-		*Values = p.Values;
-	}
 
-	if (ret != ERROR_SUCCESS) {
-		for (size_t i = 0; i < p.Count; ++i)
-			HeapFree(GetProcessHeap(), 0, p.Names[i]);
+	return ret;
+}
 
-		HeapFree(GetProcessHeap(), 0, p.Names);
-	}
 
-	return ret;
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	return PBaseParseNameValue(_Parse, Request, ExtraInfo, Handled, Names, Values, RowCount);
+}
+
+
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	return PBaseParseOutput(_Parse, Request, ExtraInfo, Handled, Output);
 }
 
 
@@ -162,7 +158,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -172,6 +168,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	}
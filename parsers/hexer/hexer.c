@@ -1,128 +1,291 @@
-
 #include <stdint.h>
 #include <windows.h>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
 #include "general-types.h"
 #include "parser-base.h"
 #include "hexer.h"
 
 
 
+/************************************************************************/
+/*                     TYPES AND GLOBALS                                */
+/************************************************************************/
+
+
+/** Positions of the line parts. Every line of a dump has the same length,
+    the address width depends on the size of the whole data. */
+typedef struct _HEXER_LAYOUT {
+	size_t LineCount;
+	size_t AddressSize;
+	size_t HexStart;
+	size_t CharStart;
+	size_t LineChars;
+	const char *Digits;
+} HEXER_LAYOUT, *PHEXER_LAYOUT;
+
+/** Renders the hexadecimal and character columns of a full line. */
+typedef void (HEXER_BYTES_ROUTINE)(wchar_t *Hex, wchar_t *Chars, const unsigned char *Data, const char *Digits);
 
 static BOOLEAN _displayAddress = TRUE;
 static BOOLEAN _displayCharValues = TRUE;
 static BOOLEAN _displayUpperDigits = FALSE;
+static HEXER_BYTES_ROUTINE *_bytesRoutine = NULL;
 
 
+/************************************************************************/
+/*                     LINE RENDERING                                   */
+/************************************************************************/
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+
+static void _RenderBytesScalar(wchar_t *Hex, wchar_t *Chars, const unsigned char *Data, const char *Digits)
 {
-	DWORD ret = ERROR_GEN_FAILURE;
+	for (size_t j = 0; j < 16; ++j) {
+		Hex[j * 3] = Digits[Data[j] >> 4];
+		Hex[j * 3 + 1] = Digits[Data[j] & 0xf];
+		Hex[j * 3 + 2] = L' ';
+		if (Chars != NULL)
+			Chars[j] = (Data[j] >= ' ') ? Data[j] : L'.';
+	}
+
+	return;
+}
+
+
+#if defined(_M_X64) || defined(_M_IX86)
+
+#if defined(_MSC_VER)
+#define HEXER_SSSE3_ROUTINE
+#else
+#define HEXER_SSSE3_ROUTINE				__attribute__((target("ssse3")))
+#endif
+
+/** Both nibbles of all 16 bytes are translated by a single table lookup
+ *  each. The digit pairs are then spread into three-character groups and
+ *  widened to UTF-16.
+ */
+static HEXER_SSSE3_ROUTINE void _RenderBytesSsse3(wchar_t *Hex, wchar_t *Chars, const unsigned char *Data, const char *Digits)
+{
+	__m128i data, hi, lo, pairs0, pairs1, a, b, c;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i digits = _mm_loadu_si128((const __m128i *)Digits);
+	const __m128i spread0 = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+	const __m128i spread1a = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i spread1b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 1, -1, 2, 3, -1, 4, 5);
+	const __m128i spread2 = _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13, -1, 14, 15, -1);
+	const __m128i spaces0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+	const __m128i spaces1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0);
+	const __m128i spaces2 = _mm_setr_epi8(' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i dot = _mm_set1_epi8('.');
+	__m128i printable;
+
+	data = _mm_loadu_si128((const __m128i *)Data);
+	hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(data, 4), nibble));
+	lo = _mm_shuffle_epi8(digits, _mm_and_si128(data, nibble));
+	pairs0 = _mm_unpacklo_epi8(hi, lo);
+	pairs1 = _mm_unpackhi_epi8(hi, lo);
+	a = _mm_or_si128(_mm_shuffle_epi8(pairs0, spread0), spaces0);
+	b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(pairs0, spread1a), _mm_shuffle_epi8(pairs1, spread1b)), spaces1);
+	c = _mm_or_si128(_mm_shuffle_epi8(pairs1, spread2), spaces2);
+	_mm_storeu_si128((__m128i *)Hex, _mm_unpacklo_epi8(a, zero));
+	_mm_storeu_si128((__m128i *)(Hex + 8), _mm_unpackhi_epi8(a, zero));
+	_mm_storeu_si128((__m128i *)(Hex + 16), _mm_unpacklo_epi8(b, zero));
+	_mm_storeu_si128((__m128i *)(Hex + 24), _mm_unpackhi_epi8(b, zero));
+	_mm_storeu_si128((__m128i *)(Hex + 32), _mm_unpacklo_epi8(c, zero));
+	_mm_storeu_si128((__m128i *)(Hex + 40), _mm_unpackhi_epi8(c, zero));
+	if (Chars != NULL) {
+		// Unsigned data >= ' ' exactly when max(data, ' ') == data.
+		printable = _mm_cmpeq_epi8(_mm_max_epu8(data, space), data);
+		a = _mm_or_si128(_mm_and_si128(printable, data), _mm_andnot_si128(printable, dot));
+		_mm_storeu_si128((__m128i *)Chars, _mm_unpacklo_epi8(a, zero));
+		_mm_storeu_si128((__m128i *)(Chars + 8), _mm_unpackhi_epi8(a, zero));
+	}
+
+	return;
+}
+
+
+static HEXER_BYTES_ROUTINE *_BytesRoutineSelect(void)
+{
+	int info[4];
+	HEXER_BYTES_ROUTINE *ret = _RenderBytesScalar;
+
+	// The vector routine writes UTF-16 characters.
+	if (sizeof(wchar_t) == 2) {
+		__cpuid(info, 0);
+		if (info[0] >= 1) {
+			__cpuid(info, 1);
+			// SSSE3
+			if (info[2] & (1 << 9))
+				ret = _RenderBytesSsse3;
+		}
+	}
+
+	return ret;
+}
+
+#else
+
+static HEXER_BYTES_ROUTINE *_BytesRoutineSelect(void)
+{
+	return _RenderBytesScalar;
+}
+
+#endif
+
+
+static void _GetLayout(size_t DataLength, PHEXER_LAYOUT Layout)
+{
+	size_t addressSize = 0;
+
+	memset(Layout, 0, sizeof(HEXER_LAYOUT));
+	Layout->LineCount = (DataLength + 15) / 16;
+	Layout->Digits = (_displayUpperDigits) ? "0123456789ABCDEF" : "0123456789abcdef";
+	if (_displayAddress) {
+		addressSize = 31;
+		while (addressSize > 0 && ((size_t)1 << addressSize) >= Layout->LineCount * 16)
+			--addressSize;
+
+		++addressSize;
+		Layout->AddressSize = (addressSize + 3) / 4;
+		Layout->HexStart = Layout->AddressSize + 2;
+	}
+
+	Layout->CharStart = Layout->HexStart + 16 * 3;
+	Layout->LineChars = Layout->HexStart + 16 * 3 - 1;
+	if (_displayCharValues)
+		Layout->LineChars += (16 + 1);
+
+	return;
+}
+
+
+/** Renders lines of a dump into one buffer, each line followed by a null
+ *  character. Data and DataLength describe the whole dump, so the lines
+ *  get the same address width and content no matter which range of them
+ *  is rendered.
+ */
+static void _RenderLines(const HEXER_LAYOUT *Layout, const unsigned char *Data, size_t DataLength, size_t FirstLine, size_t LineCount, wchar_t *Buffer)
+{
+	size_t addr = 0;
+	size_t bytesToDo = 0;
+	wchar_t *line = NULL;
+	wchar_t *chars = NULL;
 	const unsigned char *data = NULL;
-	size_t dataLen = 0;
+	const char *digits = Layout->Digits;
+
+	if (_bytesRoutine == NULL)
+		_bytesRoutine = _BytesRoutineSelect();
+
+	line = Buffer;
+	for (size_t i = FirstLine; i < FirstLine + LineCount; ++i) {
+		addr = i * 16;
+		data = Data + addr;
+		bytesToDo = DataLength - addr;
+		if (bytesToDo > 16)
+			bytesToDo = 16;
+
+		if (_displayAddress) {
+			for (size_t j = 0; j < Layout->AddressSize; ++j)
+				line[j] = digits[((addr >> ((Layout->AddressSize - j - 1) * 4)) & 0xf)];
+
+			line[Layout->AddressSize] = L':';
+			line[Layout->AddressSize + 1] = L'\t';
+		}
+
+		chars = (_displayCharValues) ? line + Layout->CharStart : NULL;
+		if (bytesToDo == 16)
+			_bytesRoutine(line + Layout->HexStart, chars, data, digits);
+		else {
+			for (size_t j = Layout->HexStart; j < Layout->LineChars; ++j)
+				line[j] = L' ';
+
+			for (size_t j = 0; j < bytesToDo; ++j) {
+				line[Layout->HexStart + j * 3] = digits[data[j] >> 4];
+				line[Layout->HexStart + j * 3 + 1] = digits[data[j] & 0xf];
+				if (chars != NULL)
+					chars[j] = (data[j] >= ' ') ? data[j] : L'.';
+			}
+		}
+
+		if (_displayCharValues)
+			line[Layout->CharStart - 1] = L'\t';
+
+		line[Layout->LineChars] = L'\0';
+		line += (Layout->LineChars + 1);
+	}
+
+	return;
+}
+
+
+/************************************************************************/
+/*                     PARSER ROUTINES                                  */
+/************************************************************************/
+
+
+static DWORD _GetData(const REQUEST_HEADER *Request, const unsigned char **Data, size_t *DataLength)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
 	const REQUEST_IRP *irp = NULL;
 	const REQUEST_STARTIO *startIo = NULL;
 	const REQUEST_IRP_COMPLETION *irpComp = NULL;
-	wchar_t lowers[] = {L"0123456789abcdef"};
-	wchar_t uppers[] = { L"0123456789ABCDEF" };
-	const wchar_t *digits[] = {lowers, uppers};
-	size_t lineCount = 0;
-	size_t addressSize = 0;
-	size_t totalLineChars = 0;
-	wchar_t **tmpLines = NULL;
-	wchar_t *line = NULL;
-	size_t addr = 0;
 
 	ret = ERROR_SUCCESS;
 	switch (Request->Type) {
 		case ertIRP:
 			irp = CONTAINING_RECORD(Request, REQUEST_IRP, Header);
-			data = (unsigned char *)(irp + 1);
-			dataLen = irp->DataSize;
+			*Data = (unsigned char *)(irp + 1);
+			*DataLength = irp->DataSize;
 			break;
 		case ertIRPCompletion:
 			irpComp = CONTAINING_RECORD(Request, REQUEST_IRP_COMPLETION, Header);
-			data = (unsigned char *)(irpComp + 1);
-			dataLen = irpComp->DataSize;
+			*Data = (unsigned char *)(irpComp + 1);
+			*DataLength = irpComp->DataSize;
 			break;
 		case ertStartIo:
 			startIo = CONTAINING_RECORD(Request, REQUEST_STARTIO, Header);
-			data = (unsigned char *)(startIo + 1);
-			dataLen = startIo->DataSize;
+			*Data = (unsigned char *)(startIo + 1);
+			*DataLength = startIo->DataSize;
 			break;
 		default:
 			ret = ERROR_NOT_SUPPORTED;
 			break;
 	}
 
-	if (ret == ERROR_SUCCESS) {
-		lineCount = (dataLen + 15) / 16;
-		if (_displayAddress) {
-			addressSize = 31;
-			while (addressSize > 0 && (size_t)(1 << addressSize) >= lineCount * 16)
-				--addressSize;
+	return ret;
+}
 
-			++addressSize;
-			addressSize = (addressSize + 3) / 4;
-			totalLineChars += (addressSize + 2);
-		}
 
-		totalLineChars += (16 * 3 - 1);
-		if (_displayCharValues)
-			totalLineChars += (16 + 1);
+/** The line pointers and all the lines live in a single allocation. */
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	const unsigned char *data = NULL;
+	size_t dataLen = 0;
+	HEXER_LAYOUT layout;
+	wchar_t **tmpLines = NULL;
+	wchar_t *lines = NULL;
 
-		tmpLines = (wchar_t **)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, lineCount*sizeof(wchar_t *));
+	ret = _GetData(Request, &data, &dataLen);
+	if (ret == ERROR_SUCCESS) {
+		_GetLayout(dataLen, &layout);
+		tmpLines = (wchar_t **)HeapAlloc(GetProcessHeap(), 0, layout.LineCount*(sizeof(wchar_t *) + (layout.LineChars + 1)*sizeof(wchar_t)));
 		if (tmpLines != NULL) {
-			size_t bytesToDo = 0;
-
-			for (size_t i = 0; i < lineCount; ++i) {
-				line = (wchar_t *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (totalLineChars + 1) * sizeof(wchar_t));
-				if (line != NULL) {
-					for (size_t j = 0; j < totalLineChars; ++j)
-						line[j] = L' ';
-
-					if (_displayAddress) {
-						line[addressSize] = L':';
-						line[addressSize + 1] = L'\t';
-						for (size_t j = 0; j < addressSize; ++j)
-							line[j] = digits[_displayUpperDigits][((addr >> ((addressSize - j - 1) * 4)) & 0xf)];
-					}
-
-					bytesToDo = (dataLen >= 16) ? 16 : dataLen;
-					for (size_t j = 0; j < bytesToDo; ++j) {
-						line[addressSize + 2 + j * 3] = digits[_displayUpperDigits][(data[j] >> 4)];
-						line[addressSize + 2 + j * 3 + 1] = digits[_displayUpperDigits][(data[j] & 0xf)];
-						line[addressSize + 2 + j * 3 + 2] = L' ';
-						if (_displayCharValues)
-							line[addressSize + 2 + 16 * 3 + j] = (data[j] >= L' ') ? data[j] : L'.';
-					}
-
-					if (_displayCharValues)
-						line[addressSize + 2 + 16 * 3 - 1] = L'\t';
-				
-					tmpLines[i] = line;
-				} else ret = GetLastError();
-
-				if (ret != ERROR_SUCCESS) {
-					for (size_t j = 0; j < i; ++j)
-						HeapFree(GetProcessHeap(), 0, tmpLines[j]);
-				
-					break;
-				}
-
-				data += 16;
-				dataLen -= 16;
-				addr += 16;
-			}
-
-			if (ret == ERROR_SUCCESS) {
-				*Names = NULL;
-				*Values = tmpLines;
-				*RowCount = lineCount;
-				*Handled = TRUE;
-			}
+			lines = (wchar_t *)(tmpLines + layout.LineCount);
+			_RenderLines(&layout, data, dataLen, 0, layout.LineCount, lines);
+			for (size_t i = 0; i < layout.LineCount; ++i)
+				tmpLines[i] = lines + i*(layout.LineChars + 1);
 
-			if (ret != ERROR_SUCCESS)
-				HeapFree(GetProcessHeap(), 0, tmpLines);
+			*Names = NULL;
+			*Values = tmpLines;
+			*RowCount = layout.LineCount;
+			*Handled = TRUE;
 		} else ret = GetLastError();
 	} else if (ret == ERROR_NOT_SUPPORTED) {
 		*Handled = TRUE;
@@ -133,18 +296,101 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 }
 
 
-static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
+/** Appends the rows first and renders all the lines at once into the
+ *  characters they reserved, which follow each other.
+ */
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
 {
-	for (size_t i = 0; i < Count; ++i)
-		HeapFree(GetProcessHeap(), 0, Values[i]);
+	DWORD ret = ERROR_GEN_FAILURE;
+	const unsigned char *data = NULL;
+	size_t dataLen = 0;
+	size_t firstRow = 0;
+	HEXER_LAYOUT layout;
+	wchar_t *line = NULL;
 
-	HeapFree(GetProcessHeap(), 0, Values);
+	ret = _GetData(Request, &data, &dataLen);
+	if (ret == ERROR_SUCCESS) {
+		_GetLayout(dataLen, &layout);
+		if (Output->CharCapacity - Output->CharCount < layout.LineCount*(layout.LineChars + 1) ||
+			Output->RowCapacity - Output->RowCount < layout.LineCount)
+			ret = Output->GrowRoutine(Output, layout.LineCount*(layout.LineChars + 1), layout.LineCount);
 
+		firstRow = Output->RowCount;
+		for (size_t i = 0; ret == ERROR_SUCCESS && i < layout.LineCount; ++i)
+			ret = PBaseOutputAppend(Output, NULL, 0, layout.LineChars, &line);
+
+		if (ret == ERROR_SUCCESS) {
+			if (layout.LineCount > 0)
+				_RenderLines(&layout, data, dataLen, 0, layout.LineCount, Output->Chars + Output->Rows[firstRow].ValueOffset);
+
+			*Handled = TRUE;
+		}
+	} else if (ret == ERROR_NOT_SUPPORTED) {
+		*Handled = TRUE;
+		ret = ERROR_SUCCESS;
+	}
+
+	return ret;
+}
+
+
+static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
+{
+	HeapFree(GetProcessHeap(), 0, Values);
 
 	return;
 }
 
 
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** Returns the number of lines the dump of the data has. */
+size_t cdecl HexerLineCount(size_t DataLength)
+{
+	return (DataLength + 15) / 16;
+}
+
+
+/** Returns the number of characters of each line of the dump, without the
+ *  terminating null character.
+ */
+size_t cdecl HexerLineLength(size_t DataLength)
+{
+	HEXER_LAYOUT layout;
+
+	_GetLayout(DataLength, &layout);
+
+	return layout.LineChars;
+}
+
+
+/** Renders a range of lines of the dump, so a viewer of large buffers can
+ *  render only the lines it displays. The buffer receives LineCount lines
+ *  of HexerLineLength + 1 characters, each terminated by a null character.
+ */
+DWORD cdecl HexerRenderLines(const void *Data, size_t DataLength, size_t FirstLine, size_t LineCount, wchar_t *Buffer, size_t BufferLength)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	HEXER_LAYOUT layout;
+
+	_GetLayout(DataLength, &layout);
+	ret = ERROR_SUCCESS;
+	if (FirstLine > layout.LineCount || LineCount > layout.LineCount - FirstLine)
+		ret = ERROR_INVALID_PARAMETER;
+
+	if (ret == ERROR_SUCCESS && BufferLength / (layout.LineChars + 1) < LineCount)
+		ret = ERROR_INSUFFICIENT_BUFFER;
+
+	if (ret == ERROR_SUCCESS)
+		_RenderLines(&layout, (const unsigned char *)Data, DataLength, FirstLine, LineCount, Buffer);
+
+	return ret;
+}
+
+
 DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser)
 {
 	DWORD ret = ERROR_GEN_FAILURE;
@@ -152,7 +398,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -162,6 +408,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	} else ret = ERROR_NOT_SUPPORTED;
@@ -22,6 +22,15 @@
 HEXER_API
 DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
 
+HEXER_API
+size_t cdecl HexerLineCount(size_t DataLength);
+
+HEXER_API
+size_t cdecl HexerLineLength(size_t DataLength);
+
+HEXER_API
+DWORD cdecl HexerRenderLines(const void *Data, size_t DataLength, size_t FirstLine, size_t LineCount, wchar_t *Buffer, size_t BufferLength);
+
 
 
 #endif
@@ -30,9 +30,8 @@ static BOOLEAN _hideZeroValues = TRUE;
 
 
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+static DWORD _Parse(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair)
 {
-	NV_PAIR p;
 	const wchar_t *driverName = L"\\Driver\\kbdclass";
 	const wchar_t *deviceName = L"\\Device\\KeyboardClass0";
 	DWORD ret = ERROR_GEN_FAILURE;
@@ -54,35 +53,34 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 	}
 
 	if (kbdInput != NULL) {
-		memset(&p, 0, sizeof(p));
 		for (size_t i = 0; i < inputCount; ++i) {
-			ret = PBaseAddNameFormat(&p, L"Record ", L"%zu", i);
+			ret = PBaseAddNameFormat(Pair, L"Record ", L"%zu", i);
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"  Device", L"%u", kbdInput->UnitId);
+				ret = PBaseAddNameFormat(Pair, L"  Device", L"%u", kbdInput->UnitId);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"  Scan code", L"%u", kbdInput->MakeCode);
+				ret = PBaseAddNameFormat(Pair, L"  Scan code", L"%u", kbdInput->MakeCode);
 
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || kbdInput->Flags))
-				ret = PBaseAddNameFormat(&p, L"  Flags", L"0x%x", kbdInput->Flags);
+				ret = PBaseAddNameFormat(Pair, L"  Flags", L"0x%x", kbdInput->Flags);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddBooleanValue(&p, L"  Pressed", (kbdInput->Flags & KEY_MAKE) != 0, _hideZeroValues);
+				ret = PBaseAddBooleanValue(Pair, L"  Pressed", (kbdInput->Flags & KEY_MAKE) != 0, _hideZeroValues);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddBooleanValue(&p, L"  Release", (kbdInput->Flags & KEY_BREAK) != 0, _hideZeroValues);
+				ret = PBaseAddBooleanValue(Pair, L"  Release", (kbdInput->Flags & KEY_BREAK) != 0, _hideZeroValues);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddBooleanValue(&p, L"  Extended #0", (kbdInput->Flags & KEY_E0) != 0, _hideZeroValues);
+				ret = PBaseAddBooleanValue(Pair, L"  Extended #0", (kbdInput->Flags & KEY_E0) != 0, _hideZeroValues);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddBooleanValue(&p, L"  Extended #1", (kbdInput->Flags & KEY_E1) != 0, _hideZeroValues);
+				ret = PBaseAddBooleanValue(Pair, L"  Extended #1", (kbdInput->Flags & KEY_E1) != 0, _hideZeroValues);
 
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || kbdInput->ExtraInformation != 0))
-				ret = PBaseAddNameFormat(&p, L"  Extra", L"0x%x (%u)", kbdInput->ExtraInformation, kbdInput->ExtraInformation);
+				ret = PBaseAddNameFormat(Pair, L"  Extra", L"0x%x (%u)", kbdInput->ExtraInformation, kbdInput->ExtraInformation);
 
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || kbdInput->Reserved != 0))
-				ret = PBaseAddNameFormat(&p, L"  Reserved", L"0x%x (%u)", kbdInput->Reserved, kbdInput->Reserved);
+				ret = PBaseAddNameFormat(Pair, L"  Reserved", L"0x%x (%u)", kbdInput->Reserved, kbdInput->Reserved);
 
 			if (ret != ERROR_SUCCESS)
 				break;
@@ -90,30 +88,26 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 			++kbdInput;
 		}
 
-		if (ret == ERROR_SUCCESS) {
+		if (ret == ERROR_SUCCESS)
 			*Handled = TRUE;
-			*RowCount = p.Count;
-			*Names = p.Names;
-			*Values = p.Values;
-		}
-
-		if (ret != ERROR_SUCCESS) {
-			for (size_t i = 0; i < p.Count; ++i)
-				HeapFree(GetProcessHeap(), 0, p.Names[i]);
-
-			HeapFree(GetProcessHeap(), 0, p.Names);
-		}
-	} else {
-		*Names = NULL;
-		*Values = NULL;
-		*RowCount = 0;
-		*Handled = FALSE;
 	}
 
 	return ret;
 }
 
 
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	return PBaseParseNameValue(_Parse, Request, ExtraInfo, Handled, Names, Values, RowCount);
+}
+
+
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	return PBaseParseOutput(_Parse, Request, ExtraInfo, Handled, Output);
+}
+
+
 static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
 {
 	PBaseFreeNameValue(Names, Values, Count);
@@ -129,7 +123,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -139,6 +133,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	} else ret = ERROR_NOT_SUPPORTED;
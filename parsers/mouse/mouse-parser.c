@@ -64,9 +64,8 @@ static BOOLEAN _hideZeroValues = TRUE;
 
 
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+static DWORD _Parse(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair)
 {
-	NV_PAIR p;
 	const wchar_t *driverName = L"\\Driver\\mouclass";
 	const wchar_t *deviceName = L"\\Device\\PointerdClass0";
 	DWORD ret = ERROR_GEN_FAILURE;
@@ -130,38 +129,37 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 	}
 
 	if (mouInput != NULL) {
-		memset(&p, 0, sizeof(p));
 		for (size_t i = 0; i < inputCount; ++i) {
-			ret = PBaseAddNameFormat(&p, L"Record ", L"%zu", i);
+			ret = PBaseAddNameFormat(Pair, L"Record ", L"%zu", i);
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"  Device", L"%u", mouInput->UnitId);
+				ret = PBaseAddNameFormat(Pair, L"  Device", L"%u", mouInput->UnitId);
 
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || mouInput->Flags))
-				ret = PBaseAddNameFormat(&p, L"  Flags", L"0x%x", mouInput->Flags);
+				ret = PBaseAddNameFormat(Pair, L"  Flags", L"0x%x", mouInput->Flags);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddFlags(&p, mouInput->Flags, flagBits, flagNames, sizeof(flagBits) / sizeof(flagBits[0]), _hideZeroValues);
+				ret = PBaseAddFlags(Pair, mouInput->Flags, flagBits, flagNames, sizeof(flagBits) / sizeof(flagBits[0]), _hideZeroValues);
 
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || mouInput->Flags))
-				ret = PBaseAddNameFormat(&p, L"  Buttons", L"0x%x", mouInput->ButtonFlags);
+				ret = PBaseAddNameFormat(Pair, L"  Buttons", L"0x%x", mouInput->ButtonFlags);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddFlags(&p, mouInput->ButtonFlags, buttonBits, buttonNames, sizeof(buttonBits) / sizeof(buttonBits[0]), _hideZeroValues);
+				ret = PBaseAddFlags(Pair, mouInput->ButtonFlags, buttonBits, buttonNames, sizeof(buttonBits) / sizeof(buttonBits[0]), _hideZeroValues);
 
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || mouInput->ButtonData != 0))
-				ret = PBaseAddNameFormat(&p, L"  Wheel data", L"0x%x", mouInput->ButtonData);
+				ret = PBaseAddNameFormat(Pair, L"  Wheel data", L"0x%x", mouInput->ButtonData);
 
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || mouInput->RawButtons != 0))
-				ret = PBaseAddNameFormat(&p, L"  Raw buttons", L"0x%x", mouInput->RawButtons);
+				ret = PBaseAddNameFormat(Pair, L"  Raw buttons", L"0x%x", mouInput->RawButtons);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"  X", L"%i", mouInput->LastX);
+				ret = PBaseAddNameFormat(Pair, L"  X", L"%i", mouInput->LastX);
 
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"  Y", L"%i", mouInput->LastY);
+				ret = PBaseAddNameFormat(Pair, L"  Y", L"%i", mouInput->LastY);
 					
 			if (ret == ERROR_SUCCESS && (!_hideZeroValues || mouInput->ExtraInformation != 0))
-				ret = PBaseAddNameFormat(&p, L"  Extra", L"0x%x", mouInput->ExtraInformation);
+				ret = PBaseAddNameFormat(Pair, L"  Extra", L"0x%x", mouInput->ExtraInformation);
 
 			if (ret != ERROR_SUCCESS)
 				break;
@@ -169,31 +167,26 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 			++mouInput;
 		}
 
-		if (ret == ERROR_SUCCESS) {
+		if (ret == ERROR_SUCCESS)
 			*Handled = TRUE;
-			*RowCount = p.Count;
-			*Names = p.Names;
-			*Values = p.Values;
-		}
-
-		if (ret != ERROR_SUCCESS) {
-			for (size_t i = 0; i < p.Count; ++i)
-				HeapFree(GetProcessHeap(), 0, p.Names[i]);
-
-			HeapFree(GetProcessHeap(), 0, p.Names);
-		}
-	}
-	else {
-		*Names = NULL;
-		*Values = NULL;
-		*RowCount = 0;
-		*Handled = FALSE;
 	}
 
 	return ret;
 }
 
 
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	return PBaseParseNameValue(_Parse, Request, ExtraInfo, Handled, Names, Values, RowCount);
+}
+
+
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	return PBaseParseOutput(_Parse, Request, ExtraInfo, Handled, Output);
+}
+
+
 static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
 {
 	PBaseFreeNameValue(Names, Values, Count);
@@ -209,7 +202,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -219,6 +212,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	} else ret = ERROR_NOT_SUPPORTED;
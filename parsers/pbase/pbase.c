@@ -8,7 +8,7 @@
 
 
 
-DWORD PBaseAddNameValue(PNV_PAIR Pair, const wchar_t *Name, const wchar_t *Value)
+static DWORD _AddNameValueAlloc(PNV_PAIR Pair, const wchar_t *Name, const wchar_t *Value)
 {
 	DWORD ret = ERROR_GEN_FAILURE;
 	wchar_t *tmpName = NULL;
@@ -18,9 +18,9 @@ DWORD PBaseAddNameValue(PNV_PAIR Pair, const wchar_t *Name, const wchar_t *Value
 	size_t totalLen = 0;
 	wchar_t **tmp = NULL;
 
-	ret = StringCbLengthW(Name, STRSAFE_MAX_CCH, &nameLen);
+	ret = StringCchLengthW(Name, STRSAFE_MAX_CCH, &nameLen);
 	if (ret == S_OK) {
-		ret = StringCbLengthW(Value, STRSAFE_MAX_CCH, &valueLen);
+		ret = StringCchLengthW(Value, STRSAFE_MAX_CCH, &valueLen);
 		if (ret == S_OK) {
 			totalLen = nameLen + 1 + valueLen;
 			tmpName = (wchar_t *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (totalLen + 1) * sizeof(wchar_t));
@@ -54,6 +54,20 @@ DWORD PBaseAddNameValue(PNV_PAIR Pair, const wchar_t *Name, const wchar_t *Value
 }
 
 
+DWORD PBaseAddNameValue(PNV_PAIR Pair, const wchar_t *Name, const wchar_t *Value)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+
+	if (Pair->Output != NULL) {
+		ret = PBaseOutputAdd(Pair->Output, Name, Value);
+		if (ret == ERROR_SUCCESS)
+			++Pair->Count;
+	} else ret = _AddNameValueAlloc(Pair, Name, Value);
+
+	return ret;
+}
+
+
 DWORD PBaseAddNameFormat(PNV_PAIR Pair, const wchar_t *Name, const wchar_t *Format, ...)
 {
 	wchar_t buf[1024];
@@ -114,6 +128,247 @@ void PBaseFreeNameValue(wchar_t **Names, wchar_t **Values, size_t Count)
 
 
 
+/************************************************************************/
+/*                     PARSER OUTPUT                                    */
+/************************************************************************/
+
+
+static DWORD cdecl _OutputGrow(PDP_OUTPUT Output, size_t CharCount, size_t RowCount)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	size_t newCapacity = 0;
+	wchar_t *newChars = NULL;
+	PDP_OUTPUT_ROW newRows = NULL;
+
+	ret = ERROR_SUCCESS;
+	if (Output->CharCapacity - Output->CharCount < CharCount) {
+		newCapacity = Output->CharCapacity * 2;
+		if (newCapacity < Output->CharCount + CharCount)
+			newCapacity = Output->CharCount + CharCount;
+
+		if (newCapacity < 1024)
+			newCapacity = 1024;
+
+		if (Output->Chars != NULL)
+			newChars = (wchar_t *)HeapReAlloc(GetProcessHeap(), 0, Output->Chars, newCapacity * sizeof(wchar_t));
+		else newChars = (wchar_t *)HeapAlloc(GetProcessHeap(), 0, newCapacity * sizeof(wchar_t));
+
+		if (newChars != NULL) {
+			Output->Chars = newChars;
+			Output->CharCapacity = newCapacity;
+		} else ret = ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	if (ret == ERROR_SUCCESS && Output->RowCapacity - Output->RowCount < RowCount) {
+		newCapacity = Output->RowCapacity * 2;
+		if (newCapacity < Output->RowCount + RowCount)
+			newCapacity = Output->RowCount + RowCount;
+
+		if (newCapacity < 64)
+			newCapacity = 64;
+
+		if (Output->Rows != NULL)
+			newRows = (PDP_OUTPUT_ROW)HeapReAlloc(GetProcessHeap(), 0, Output->Rows, newCapacity * sizeof(DP_OUTPUT_ROW));
+		else newRows = (PDP_OUTPUT_ROW)HeapAlloc(GetProcessHeap(), 0, newCapacity * sizeof(DP_OUTPUT_ROW));
+
+		if (newRows != NULL) {
+			Output->Rows = newRows;
+			Output->RowCapacity = newCapacity;
+		} else ret = ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	return ret;
+}
+
+
+/** Initializes an empty output growing on the process heap. */
+void PBaseOutputInit(PDP_OUTPUT Output)
+{
+	memset(Output, 0, sizeof(DP_OUTPUT));
+	Output->GrowRoutine = _OutputGrow;
+
+	return;
+}
+
+
+/** Discards the rows, the memory is kept for the next request. */
+void PBaseOutputReset(PDP_OUTPUT Output)
+{
+	Output->CharCount = 0;
+	Output->RowCount = 0;
+
+	return;
+}
+
+
+/** Frees the memory of an output initialized by PBaseOutputInit. */
+void PBaseOutputFree(PDP_OUTPUT Output)
+{
+	if (Output->Rows != NULL)
+		HeapFree(GetProcessHeap(), 0, Output->Rows);
+
+	if (Output->Chars != NULL)
+		HeapFree(GetProcessHeap(), 0, Output->Chars);
+
+	PBaseOutputInit(Output);
+
+	return;
+}
+
+
+/** Appends a row and reserves space for its value, so the caller can write
+ *  the value in place. The terminating null character is already written.
+ *  Name may be NULL for rows without a name.
+ *
+ *  @remark
+ *  The value address is valid only until the next row is appended.
+ */
+DWORD PBaseOutputAppend(PDP_OUTPUT Output, const wchar_t *Name, size_t NameLength, size_t ValueLength, wchar_t **Value)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	size_t charCount = 0;
+	PDP_OUTPUT_ROW row = NULL;
+
+	charCount = ValueLength + 1;
+	if (Name != NULL)
+		charCount += (NameLength + 1);
+
+	ret = ERROR_SUCCESS;
+	if (Output->CharCapacity - Output->CharCount < charCount ||
+		Output->RowCapacity == Output->RowCount)
+		ret = Output->GrowRoutine(Output, charCount, 1);
+
+	if (ret == ERROR_SUCCESS) {
+		row = Output->Rows + Output->RowCount;
+		row->NameOffset = DP_OUTPUT_NO_NAME;
+		if (Name != NULL) {
+			row->NameOffset = Output->CharCount;
+			CopyMemory(Output->Chars + Output->CharCount, Name, NameLength * sizeof(wchar_t));
+			Output->Chars[Output->CharCount + NameLength] = L'\0';
+			Output->CharCount += (NameLength + 1);
+		}
+
+		row->ValueOffset = Output->CharCount;
+		Output->Chars[Output->CharCount + ValueLength] = L'\0';
+		*Value = Output->Chars + Output->CharCount;
+		Output->CharCount += (ValueLength + 1);
+		++Output->RowCount;
+	}
+
+	return ret;
+}
+
+
+DWORD PBaseOutputAdd(PDP_OUTPUT Output, const wchar_t *Name, const wchar_t *Value)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	size_t nameLen = 0;
+	size_t valueLen = 0;
+	wchar_t *tmpValue = NULL;
+
+	if (Name != NULL)
+		nameLen = wcslen(Name);
+
+	valueLen = wcslen(Value);
+	ret = PBaseOutputAppend(Output, Name, nameLen, valueLen, &tmpValue);
+	if (ret == ERROR_SUCCESS)
+		CopyMemory(tmpValue, Value, valueLen * sizeof(wchar_t));
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     PARSE ROUTINE ADAPTERS                           */
+/************************************************************************/
+
+
+/** Runs a parse routine for the DP_PARSE_ROUTINE interface. */
+DWORD PBaseParseNameValue(PBASE_PARSE_ROUTINE *Routine, const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	NV_PAIR p;
+	DWORD ret = ERROR_GEN_FAILURE;
+
+	memset(&p, 0, sizeof(p));
+	*Handled = FALSE;
+	ret = Routine(Request, ExtraInfo, Handled, &p);
+	if (ret == ERROR_SUCCESS) {
+		*Names = p.Names;
+		*Values = p.Values;
+		*RowCount = p.Count;
+	}
+
+	if (ret != ERROR_SUCCESS && p.Count > 0)
+		PBaseFreeNameValue(p.Names, p.Values, p.Count);
+
+	return ret;
+}
+
+
+/** Runs a parse routine for the DP_PARSE_OUTPUT_ROUTINE interface. */
+DWORD PBaseParseOutput(PBASE_PARSE_ROUTINE *Routine, const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	NV_PAIR p;
+	DWORD ret = ERROR_GEN_FAILURE;
+	size_t charCount = 0;
+	size_t rowCount = 0;
+
+	charCount = Output->CharCount;
+	rowCount = Output->RowCount;
+	memset(&p, 0, sizeof(p));
+	p.Output = Output;
+	*Handled = FALSE;
+	ret = Routine(Request, ExtraInfo, Handled, &p);
+	if (ret != ERROR_SUCCESS) {
+		Output->CharCount = charCount;
+		Output->RowCount = rowCount;
+	}
+
+	return ret;
+}
+
+
+/** Parses a request by a parser of any version into an output. Parsers
+ *  without the output interface are called through their ParseRoutine and
+ *  their rows are copied to the output before being freed.
+ */
+DWORD PBaseDataParserRun(const IRPMON_DATA_PARSER *Parser, const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	DWORD ret = ERROR_GEN_FAILURE;
+	wchar_t **names = NULL;
+	wchar_t **values = NULL;
+	size_t count = 0;
+	size_t charCount = 0;
+	size_t rowCount = 0;
+
+	charCount = Output->CharCount;
+	rowCount = Output->RowCount;
+	*Handled = FALSE;
+	if (Parser->Version >= IRPMON_DATA_PARSER_VERSION_3 && Parser->ParseOutputRoutine != NULL)
+		ret = Parser->ParseOutputRoutine(Request, ExtraInfo, Handled, Output);
+	else {
+		ret = Parser->ParseRoutine(Request, ExtraInfo, Handled, &names, &values, &count);
+		if (ret == ERROR_SUCCESS && *Handled) {
+			for (size_t i = 0; i < count; ++i) {
+				ret = PBaseOutputAdd(Output, (names != NULL) ? names[i] : NULL, values[i]);
+				if (ret != ERROR_SUCCESS)
+					break;
+			}
+
+			Parser->FreeRoutine(names, values, count);
+		}
+	}
+
+	if (ret != ERROR_SUCCESS) {
+		Output->CharCount = charCount;
+		Output->RowCount = rowCount;
+	}
+
+	return ret;
+}
+
+
+
 DWORD PBaseDataParserAlloc(uint32_t Version, PIRPMON_DATA_PARSER *Parser)
 {
 	uint32_t parserSize = 0;
@@ -129,6 +384,10 @@ DWORD PBaseDataParserAlloc(uint32_t Version, PIRPMON_DATA_PARSER *Parser)
 			parserSize = sizeof(IRPMON_DATA_PARSER_V2);
 			ret = ERROR_SUCCESS;
 			break;
+		case IRPMON_DATA_PARSER_VERSION_3:
+			parserSize = sizeof(IRPMON_DATA_PARSER_V3);
+			ret = ERROR_SUCCESS;
+			break;
 		default:
 			ret = ERROR_INVALID_PARAMETER;
 			break;
@@ -109,9 +109,8 @@ static DWORD _AddSystemPowerStateValue(PNV_PAIR Pair, const wchar_t *Name, SYSTE
 }
 
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+static DWORD _Parse(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair)
 {
-	NV_PAIR p;
 	DWORD ret = ERROR_GEN_FAILURE;
 	const REQUEST_IRP_COMPLETION *irpComp = NULL;
 	const DEVICE_CAPABILITIES *devCaps = NULL;
@@ -126,136 +125,131 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 	}
 
 	if (devCaps != NULL) {
-		memset(&p, 0, sizeof(p));
-		ret = PBaseAddNameFormat(&p, L"Version", L"%u", devCaps->Version);
+		ret = PBaseAddNameFormat(Pair, L"Version", L"%u", devCaps->Version);
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddNameFormat(&p, L"Size", L"%u", devCaps->Size);
+			ret = PBaseAddNameFormat(Pair, L"Size", L"%u", devCaps->Size);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"DeviceD1", devCaps->DeviceD1 != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"DeviceD1", devCaps->DeviceD1 != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"DeviceD2", devCaps->DeviceD2 != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"DeviceD2", devCaps->DeviceD2 != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"LockSupported", devCaps->LockSupported != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"LockSupported", devCaps->LockSupported != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"EjectSupported", devCaps->EjectSupported != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"EjectSupported", devCaps->EjectSupported != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"Removable", devCaps->Removable != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"Removable", devCaps->Removable != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"DockDevice", devCaps->DockDevice != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"DockDevice", devCaps->DockDevice != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"UniqueID", devCaps->UniqueID != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"UniqueID", devCaps->UniqueID != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"SilentInstall", devCaps->SilentInstall != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"SilentInstall", devCaps->SilentInstall != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"RawDeviceOK", devCaps->RawDeviceOK != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"RawDeviceOK", devCaps->RawDeviceOK != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"SurpriseRemovalOK", devCaps->SurpriseRemovalOK != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"SurpriseRemovalOK", devCaps->SurpriseRemovalOK != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"WakeFromD0", devCaps->WakeFromD0 != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"WakeFromD0", devCaps->WakeFromD0 != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"WakeFromD1", devCaps->WakeFromD1 != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"WakeFromD1", devCaps->WakeFromD1 != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"WakeFromD2", devCaps->WakeFromD2 != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"WakeFromD2", devCaps->WakeFromD2 != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"WakeFromD3", devCaps->WakeFromD3 != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"WakeFromD3", devCaps->WakeFromD3 != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"HardwareDisabled", devCaps->HardwareDisabled != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"HardwareDisabled", devCaps->HardwareDisabled != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"NonDynamic", devCaps->NonDynamic != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"NonDynamic", devCaps->NonDynamic != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"WarmEjectSupported", devCaps->WarmEjectSupported != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"WarmEjectSupported", devCaps->WarmEjectSupported != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"NoDisplayInUI", devCaps->NoDisplayInUI != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"NoDisplayInUI", devCaps->NoDisplayInUI != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"Reserved1", devCaps->Reserved1 != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"Reserved1", devCaps->Reserved1 != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"WakeFromInterrupt", devCaps->WakeFromInterrupt != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"WakeFromInterrupt", devCaps->WakeFromInterrupt != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"SecureDevice", devCaps->SecureDevice != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"SecureDevice", devCaps->SecureDevice != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"ChildOfVgaEnabledBridge", devCaps->ChildOfVgaEnabledBridge != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"ChildOfVgaEnabledBridge", devCaps->ChildOfVgaEnabledBridge != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddBooleanValue(&p, L"DecodeIoOnBoot", devCaps->DecodeIoOnBoot != 0, _hideZeroValues);
+			ret = PBaseAddBooleanValue(Pair, L"DecodeIoOnBoot", devCaps->DecodeIoOnBoot != 0, _hideZeroValues);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddNameFormat(&p, L"Reserved", L"%u", devCaps->Reserved);
+			ret = PBaseAddNameFormat(Pair, L"Reserved", L"%u", devCaps->Reserved);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddNameFormat(&p, L"Address", L"%u", devCaps->Address);
+			ret = PBaseAddNameFormat(Pair, L"Address", L"%u", devCaps->Address);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddNameFormat(&p, L"UI Number", L"0x%x", devCaps->UINumber);
+			ret = PBaseAddNameFormat(Pair, L"UI Number", L"0x%x", devCaps->UINumber);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddNameFormat(&p, L"D1 Latency", L"%u ms", devCaps->D1Latency);
+			ret = PBaseAddNameFormat(Pair, L"D1 Latency", L"%u ms", devCaps->D1Latency);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddNameFormat(&p, L"D2 Latency", L"%u ms", devCaps->D2Latency);
+			ret = PBaseAddNameFormat(Pair, L"D2 Latency", L"%u ms", devCaps->D2Latency);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = PBaseAddNameFormat(&p, L"D3 Latency", L"%u ms", devCaps->D3Latency);
+			ret = PBaseAddNameFormat(Pair, L"D3 Latency", L"%u ms", devCaps->D3Latency);
 		
 		if (ret == ERROR_SUCCESS) {
 			for (size_t i = 0; i < sizeof(devCaps->DeviceState) / sizeof(devCaps->DeviceState[0]); ++i) {
-				ret = _AddDevicePowerStateValue(&p, L"  Device state", devCaps->DeviceState[i]);
+				ret = _AddDevicePowerStateValue(Pair, L"  Device state", devCaps->DeviceState[i]);
 				if (ret != ERROR_SUCCESS)
 					break;
 			}
 		}
 
 		if (ret == ERROR_SUCCESS)
-			ret = _AddDevicePowerStateValue(&p, L"Device wake", devCaps->DeviceWake);
+			ret = _AddDevicePowerStateValue(Pair, L"Device wake", devCaps->DeviceWake);
 		
 		if (ret == ERROR_SUCCESS)
-			ret = _AddSystemPowerStateValue(&p, L"System wake", devCaps->SystemWake);
+			ret = _AddSystemPowerStateValue(Pair, L"System wake", devCaps->SystemWake);
 		
-		if (ret == ERROR_SUCCESS) {
+		if (ret == ERROR_SUCCESS)
 			*Handled = TRUE;
-			*RowCount = p.Count;
-			*Names = p.Names;
-			*Values = p.Values;
-		}
-		
-		if (ret != ERROR_SUCCESS) {
-			for (size_t i = 0; i < p.Count; ++i)
-				HeapFree(GetProcessHeap(), 0, p.Names[i]);
-
-			HeapFree(GetProcessHeap(), 0, p.Names);
-		}
-	} else {
-		*Names = NULL;
-		*Values = NULL;
-		*RowCount = 0;
-		*Handled = FALSE;
 	}
 
 	return ret;
 }
 
 
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	return PBaseParseNameValue(_Parse, Request, ExtraInfo, Handled, Names, Values, RowCount);
+}
+
+
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	return PBaseParseOutput(_Parse, Request, ExtraInfo, Handled, Output);
+}
+
+
 static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
 {
 	PBaseFreeNameValue(Names, Values, Count);
@@ -271,7 +265,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -281,6 +275,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	} else ret = ERROR_NOT_SUPPORTED;
@@ -20,12 +20,8 @@ typedef enum {
 
 
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+static DWORD _Parse(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair)
 {
-	size_t idCount = 0;
-	size_t tmpLen = 0;
-	size_t index = 0;
-	wchar_t **tmpOutput = NULL;
 	const wchar_t *tmp = NULL;
 	DWORD ret = ERROR_GEN_FAILURE;
 	const wchar_t *ids = NULL;
@@ -67,62 +63,35 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 	if (ids != NULL) {
 		if (irpComp->DataSize > 0) {
 			tmp = ids;
-			while (*tmp != L'\0') {
-				tmpLen = wcslen(tmp);
-				++idCount;
-				tmp += (tmpLen + 1);
+			while (ret == ERROR_SUCCESS && *tmp != L'\0') {
+				ret = PBaseAddNameValue(Pair, idName, tmp);
+				tmp += (wcslen(tmp) + 1);
 			}
+		}
 
-			tmpOutput = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, idCount*2*sizeof(wchar_t *));
-			if (tmpOutput != NULL) {
-				tmp = ids;
-				while (ret == ERROR_SUCCESS && *tmp != L'\0') {
-					tmpLen = wcslen(tmp);
-					tmpOutput[index] = (wchar_t *)idName;
-					tmpOutput[index + idCount] = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (tmpLen + 1)*sizeof(wchar_t));
-					if (tmpOutput[index + idCount] != NULL) {
-						memcpy(tmpOutput[index + idCount], tmp, tmpLen*sizeof(wchar_t));
-						++index;
-						tmp += (tmpLen + 1);
-					} else ret = GetLastError();
-				}
-
-				if (ret == ERROR_SUCCESS) {
-					*Handled = TRUE;
-					*Names = tmpOutput;
-					*Values = tmpOutput + idCount;
-					*RowCount = idCount;
-				}
-
-				if (ret != ERROR_SUCCESS) {
-					while (index > 0) {
-						HeapFree(GetProcessHeap(), 0, tmpOutput[idCount + index - 1]);
-						--index;
-					}
-
-					HeapFree(GetProcessHeap(), 0, tmpOutput);
-				}
-			} else ret = GetLastError();
-		} else {
+		if (ret == ERROR_SUCCESS)
 			*Handled = TRUE;
-			*RowCount = 0;
-			*Names = NULL;
-			*Values = NULL;
-		}
 	} else *Handled = FALSE;
 
 	return ret;
 }
 
 
-static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
 {
-	if (Count > 0) {
-		for (size_t i = 0; i < Count; ++i)
-			HeapFree(GetProcessHeap(), 0, Values[i]);
+	return PBaseParseNameValue(_Parse, Request, ExtraInfo, Handled, Names, Values, RowCount);
+}
 
-		HeapFree(GetProcessHeap(), 0, Names);
-	}
+
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	return PBaseParseOutput(_Parse, Request, ExtraInfo, Handled, Output);
+}
+
+
+static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
+{
+	PBaseFreeNameValue(Names, Values, Count);
 
 	return;
 }
@@ -135,7 +104,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -145,6 +114,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	} else ret = ERROR_NOT_SUPPORTED;
@@ -107,9 +107,8 @@ static INTERFACE_TABLE_ENTRY _interfaceTable[] = {
 };
 
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+static DWORD _Parse(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair)
 {
-	NV_PAIR p;
 	DWORD ret = ERROR_GEN_FAILURE;
 	const REQUEST_IRP *irp = NULL;
 	const PNP_INTERFACE *intfc = NULL;
@@ -138,26 +137,25 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 	}
 
 	if (intfc != NULL || interfaceType != NULL) {
-		memset(&p, 0, sizeof(p));
 		if (intfc != NULL) {
-			ret = PBaseAddNameFormat(&p, L"Size", L"%u", intfc->Size);
+			ret = PBaseAddNameFormat(Pair, L"Size", L"%u", intfc->Size);
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"Version", L"%u", intfc->Version);
+				ret = PBaseAddNameFormat(Pair, L"Version", L"%u", intfc->Version);
 			
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"Reference", L"0x%p", intfc->InterfaceReference);
+				ret = PBaseAddNameFormat(Pair, L"Reference", L"0x%p", intfc->InterfaceReference);
 			
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"Dereference", L"0x%p", intfc->InterfaceDereference);
+				ret = PBaseAddNameFormat(Pair, L"Dereference", L"0x%p", intfc->InterfaceDereference);
 		} else {
 			memset(guidString, 0, sizeof(guidString));
 			StringFromGUID2(interfaceType, guidString, sizeof(guidString) / sizeof(guidString[0]));
-			ret = PBaseAddNameValue(&p, L"Interface type", guidString);
+			ret = PBaseAddNameValue(Pair, L"Interface type", guidString);
 			if (ret == ERROR_SUCCESS) {
 				entry = _interfaceTable;
 				for (size_t i = 0; i < sizeof(_interfaceTable) / sizeof(_interfaceTable[0]); ++i) {
 					if (memcmp(entry->InterfaceGuid, interfaceType, sizeof(GUID)) == 0) {
-						ret = PBaseAddNameValue(&p, L"Interface name", entry->Name);
+						ret = PBaseAddNameValue(Pair, L"Interface name", entry->Name);
 						break;
 					}
 
@@ -166,30 +164,26 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 			}
 		}
 
-		if (ret == ERROR_SUCCESS) {
+		if (ret == ERROR_SUCCESS)
 			*Handled = TRUE;
-			*RowCount = p.Count;
-			*Names = p.Names;
-			*Values = p.Values;
-		}
-
-		if (ret != ERROR_SUCCESS) {
-			for (size_t i = 0; i < p.Count; ++i)
-				HeapFree(GetProcessHeap(), 0, p.Names[i]);
-
-			HeapFree(GetProcessHeap(), 0, p.Names);
-		}
-	}  else {
-		*Names = NULL;
-		*Values = NULL;
-		*RowCount = 0;
-		*Handled = FALSE;
 	}
 
 	return ret;
 }
 
 
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	return PBaseParseNameValue(_Parse, Request, ExtraInfo, Handled, Names, Values, RowCount);
+}
+
+
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	return PBaseParseOutput(_Parse, Request, ExtraInfo, Handled, Output);
+}
+
+
 static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
 {
 	PBaseFreeNameValue(Names, Values, Count);
@@ -205,7 +199,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -215,6 +209,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	} else ret = ERROR_NOT_SUPPORTED;
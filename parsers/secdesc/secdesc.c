@@ -157,9 +157,8 @@ static DWORD _PrintACL(PNV_PAIR Pair, const wchar_t *Name, const ACL *Acl)
 }
 
 
-static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+static DWORD _Parse(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PNV_PAIR Pair)
 {
-	NV_PAIR p;
 	DWORD ret = ERROR_GEN_FAILURE;
 	size_t length = 0;
 	const SECURITY_DESCRIPTOR *data = NULL;
@@ -172,7 +171,6 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 	PSID binarySid = NULL;
 
 	ret = ERROR_NOT_SUPPORTED;
-	RtlSecureZeroMemory(&p, sizeof(p));
 	switch (Request->Type) {
 		case ertIRP:
 			irp = CONTAINING_RECORD(Request, REQUEST_IRP, Header);
@@ -198,36 +196,25 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 
 	if (ret == ERROR_SUCCESS) {
 		if (IsValidSecurityDescriptor((PSECURITY_DESCRIPTOR)data)) {
-			ret = PBaseAddNameFormat(&p, L"Revision", L"%u", data->Revision);
+			ret = PBaseAddNameFormat(Pair, L"Revision", L"%u", data->Revision);
 			if (ret == ERROR_SUCCESS)
-				ret = PBaseAddNameFormat(&p, L"Control", L"%u", data->Control);
+				ret = PBaseAddNameFormat(Pair, L"Control", L"%u", data->Control);
 
 			if (ret == ERROR_SUCCESS && GetSecurityDescriptorOwner((PSECURITY_DESCRIPTOR)data, &binarySid, &defaulted))
-				ret = _PrintSid(&p, L"Owner", FALSE, binarySid);
+				ret = _PrintSid(Pair, L"Owner", FALSE, binarySid);
 			
 			if (ret == ERROR_SUCCESS && GetSecurityDescriptorGroup((PSECURITY_DESCRIPTOR)data, &binarySid, &defaulted))
-				ret = _PrintSid(&p, L"Group", FALSE, binarySid);
+				ret = _PrintSid(Pair, L"Group", FALSE, binarySid);
 
 			if (ret == ERROR_SUCCESS && GetSecurityDescriptorDacl((PSECURITY_DESCRIPTOR)data, &present, &acl, &defaulted) && present)
-				ret = _PrintACL(&p, L"DACL", acl);
+				ret = _PrintACL(Pair, L"DACL", acl);
 
 			if (ret == ERROR_SUCCESS && GetSecurityDescriptorSacl((PSECURITY_DESCRIPTOR)data, &present, &acl, &defaulted) && present)
-				ret = _PrintACL(&p, L"SACL", acl);
+				ret = _PrintACL(Pair, L"SACL", acl);
 		} else ret = ERROR_INVALID_PARAMETER;
 
-		if (ret == ERROR_SUCCESS) {
-			*Names = p.Names;
-			*Values = p.Values;
-			*RowCount = p.Count;
+		if (ret == ERROR_SUCCESS)
 			*Handled = TRUE;
-		}
-
-		if (ret != ERROR_SUCCESS) {
-			for (size_t i = 0; i < p.Count; ++i)
-				HeapFree(GetProcessHeap(), 0, p.Names[i]);
-
-			HeapFree(GetProcessHeap(), 0, p.Names);
-		}
 	} else if (ret == ERROR_NOT_SUPPORTED) {
 		*Handled = FALSE;
 		ret = ERROR_SUCCESS;
@@ -237,6 +224,18 @@ static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST
 }
 
 
+static DWORD cdecl _ParseRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, wchar_t ***Names, wchar_t ***Values, size_t *RowCount)
+{
+	return PBaseParseNameValue(_Parse, Request, ExtraInfo, Handled, Names, Values, RowCount);
+}
+
+
+static DWORD cdecl _ParseOutputRoutine(const REQUEST_HEADER *Request, const DP_REQUEST_EXTRA_INFO *ExtraInfo, PBOOLEAN Handled, PDP_OUTPUT Output)
+{
+	return PBaseParseOutput(_Parse, Request, ExtraInfo, Handled, Output);
+}
+
+
 static void cdecl _FreeRoutine(wchar_t **Names, wchar_t **Values, size_t Count)
 {
 	PBaseFreeNameValue(Names, Values, Count);
@@ -252,7 +251,7 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 
 	ret = ERROR_SUCCESS;
 	if (RequestedVersion >= IRPMON_DATA_PARSER_VERSION_1) {
-		ret = PBaseDataParserAlloc(IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
+		ret = PBaseDataParserAlloc((RequestedVersion >= IRPMON_DATA_PARSER_VERSION_3) ? IRPMON_DATA_PARSER_VERSION_3 : IRPMON_DATA_PARSER_VERSION_1, &tmpParser);
 		if (ret == ERROR_SUCCESS) {
 			tmpParser->MajorVersion = 1;
 			tmpParser->MinorVersion = 0;
@@ -262,6 +261,11 @@ DWORD cdecl DP_INIT_ROUTINE_NAME(uint32_t RequestedVersion, PIRPMON_DATA_PARSER
 			tmpParser->Priority = 1;
 			tmpParser->ParseRoutine = _ParseRoutine;
 			tmpParser->FreeRoutine = _FreeRoutine;
+			if (tmpParser->Version >= IRPMON_DATA_PARSER_VERSION_3) {
+				tmpParser->Flags = DP_FLAG_REENTRANT;
+				tmpParser->ParseOutputRoutine = _ParseOutputRoutine;
+			}
+
 			*Parser = tmpParser;
 		}
 	} else ret = ERROR_NOT_SUPPORTED;
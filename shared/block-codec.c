@@ -0,0 +1,378 @@
+
+#include <windows.h>
+#include <compressapi.h>
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "block-codec.h"
+
+
+
+/************************************************************************/
+/*                     TYPES AND MACROS                                 */
+/************************************************************************/
+
+
+#define BC_MIN_MATCH					4
+/** The last bytes of a block are always stored as literals; this keeps the
+    match search from reading past the end of the source. */
+#define BC_LAST_LITERALS				5
+#define BC_MAX_OFFSET					0xffff
+#define BC_HASH_BITS					14
+#define BC_HASH_SIZE					(1 << BC_HASH_BITS)
+
+#define _Hash(aValue)					(((aValue)*2654435761U) >> (32 - BC_HASH_BITS))
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+static ULONG _Read32(const UCHAR *Address)
+{
+	ULONG ret = 0;
+
+	memcpy(&ret, Address, sizeof(ret));
+
+	return ret;
+}
+
+
+/** Stores the part of a length that does not fit into the token nibble. */
+static BOOLEAN _PutLength(PUCHAR *Position, const UCHAR *End, size_t Length)
+{
+	BOOLEAN ret = TRUE;
+
+	while (ret && Length >= 0xff) {
+		ret = (*Position < End);
+		if (ret) {
+			**Position = 0xff;
+			++*Position;
+			Length -= 0xff;
+		}
+	}
+
+	if (ret) {
+		ret = (*Position < End);
+		if (ret) {
+			**Position = (UCHAR)Length;
+			++*Position;
+		}
+	}
+
+	return ret;
+}
+
+
+static BOOLEAN _GetLength(const UCHAR **Position, const UCHAR *End, size_t *Length)
+{
+	UCHAR b = 0xff;
+	BOOLEAN ret = TRUE;
+
+	while (ret && b == 0xff) {
+		ret = (*Position < End);
+		if (ret) {
+			b = **Position;
+			++*Position;
+			*Length += b;
+		}
+	}
+
+	return ret;
+}
+
+
+/** Emits one sequence: a token, the literals and, if MatchLength is nonzero,
+ *  the back-reference.
+ */
+static BOOLEAN _PutSequence(PUCHAR *Position, const UCHAR *End, const UCHAR *Literals, size_t LiteralCount, size_t Offset, size_t MatchLength)
+{
+	PUCHAR token = NULL;
+	BOOLEAN ret = FALSE;
+
+	if (*Position < End) {
+		token = *Position;
+		++*Position;
+		*token = (UCHAR)(((LiteralCount < 15) ? LiteralCount : 15) << 4);
+		ret = (LiteralCount < 15 || _PutLength(Position, End, LiteralCount - 15));
+		if (ret) {
+			ret = ((size_t)(End - *Position) >= LiteralCount);
+			if (ret) {
+				memcpy(*Position, Literals, LiteralCount);
+				*Position += LiteralCount;
+				if (MatchLength > 0) {
+					MatchLength -= BC_MIN_MATCH;
+					*token |= (UCHAR)((MatchLength < 15) ? MatchLength : 15);
+					ret = (End - *Position >= 2);
+					if (ret) {
+						(*Position)[0] = (UCHAR)Offset;
+						(*Position)[1] = (UCHAR)(Offset >> 8);
+						*Position += 2;
+						ret = (MatchLength < 15 || _PutLength(Position, End, MatchLength - 15));
+					}
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+static ERROR_TYPE _FastCompress(const UCHAR *Source, size_t SourceSize, PUCHAR Dest, size_t DestSize, size_t *Written)
+{
+	size_t ip = 0;
+	size_t anchor = 0;
+	size_t ref = 0;
+	size_t len = 0;
+	size_t limit = 0;
+	ULONG h = 0;
+	PUCHAR op = Dest;
+	const UCHAR *oend = Dest + DestSize;
+	ULONG table[BC_HASH_SIZE];
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	memset(table, 0, sizeof(table));
+	if (SourceSize > BC_LAST_LITERALS + BC_MIN_MATCH) {
+		limit = SourceSize - BC_LAST_LITERALS;
+		ip = 1;
+		while (ip + BC_MIN_MATCH <= limit) {
+			h = _Hash(_Read32(Source + ip));
+			ref = table[h];
+			table[h] = (ULONG)ip;
+			if (ip - ref > BC_MAX_OFFSET || _Read32(Source + ref) != _Read32(Source + ip)) {
+				// Skip faster through data that do not compress.
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			len = BC_MIN_MATCH;
+			while (ip + len < limit && Source[ref + len] == Source[ip + len])
+				++len;
+
+			if (!_PutSequence(&op, oend, Source + anchor, ip - anchor, ip - ref, len)) {
+				ret = ERROR_VALUE_BUFFER_TOO_SMALL;
+				break;
+			}
+
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	if (ret == ERROR_VALUE_SUCCESS) {
+		if (_PutSequence(&op, oend, Source + anchor, SourceSize - anchor, 0, 0))
+			*Written = op - Dest;
+		else ret = ERROR_VALUE_BUFFER_TOO_SMALL;
+	}
+
+	return ret;
+}
+
+
+static ERROR_TYPE _FastDecompress(const UCHAR *Source, size_t SourceSize, PUCHAR Dest, size_t DestSize)
+{
+	UCHAR token = 0;
+	size_t len = 0;
+	size_t offset = 0;
+	const UCHAR *ip = Source;
+	const UCHAR *iend = Source + SourceSize;
+	PUCHAR op = Dest;
+	const UCHAR *oend = Dest + DestSize;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	while (ip < iend) {
+		token = *ip++;
+		len = token >> 4;
+		if (len == 15 && !_GetLength(&ip, iend, &len))
+			break;
+
+		if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+			break;
+
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		if (ip == iend) {
+			if (op == oend)
+				ret = ERROR_VALUE_SUCCESS;
+
+			break;
+		}
+
+		if (iend - ip < 2)
+			break;
+
+		offset = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		len = token & 0xf;
+		if (len == 15 && !_GetLength(&ip, iend, &len))
+			break;
+
+		len += BC_MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(op - Dest) || (size_t)(oend - op) < len)
+			break;
+
+		if (offset >= len) {
+			memcpy(op, op - offset, len);
+			op += len;
+		} else {
+			// The match overlaps its own output (a repeated pattern).
+			while (len > 0) {
+				*op = *(op - offset);
+				++op;
+				--len;
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+/** cabinet.dll is delay-loaded, so a missing library must be detected before
+    the first call into it instead of faulting inside the delay-load helper. */
+static volatile LONG _highState = 0;
+
+#define HIGH_STATE_UNKNOWN				0
+#define HIGH_STATE_AVAILABLE			1
+#define HIGH_STATE_UNAVAILABLE			2
+
+
+static BOOLEAN _HighAvailable(void)
+{
+	LONG state = HIGH_STATE_UNKNOWN;
+
+	state = _highState;
+	if (state == HIGH_STATE_UNKNOWN) {
+		// The module stays loaded; the delay-load helper binds to it.
+		state = (LoadLibraryExW(L"cabinet.dll", NULL, LOAD_LIBRARY_SEARCH_SYSTEM32) != NULL) ? HIGH_STATE_AVAILABLE : HIGH_STATE_UNAVAILABLE;
+		InterlockedExchange(&_highState, state);
+	}
+
+	return (state == HIGH_STATE_AVAILABLE);
+}
+
+
+static ERROR_TYPE _HighCompress(const void *Source, size_t SourceSize, void *Dest, size_t DestSize, size_t *Written)
+{
+	COMPRESSOR_HANDLE h = NULL;
+	SIZE_T written = 0;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (!_HighAvailable())
+		ret = ERROR_MOD_NOT_FOUND;
+	else if (CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF | COMPRESS_RAW, NULL, &h)) {
+		if (Compress(h, Source, SourceSize, Dest, DestSize, &written))
+			*Written = written;
+		else ret = GetLastError();
+
+		CloseCompressor(h);
+	} else ret = GetLastError();
+
+	return ret;
+}
+
+
+static ERROR_TYPE _HighDecompress(const void *Source, size_t SourceSize, void *Dest, size_t DestSize)
+{
+	DECOMPRESSOR_HANDLE h = NULL;
+	SIZE_T written = 0;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (!_HighAvailable())
+		ret = ERROR_MOD_NOT_FOUND;
+	else if (CreateDecompressor(COMPRESS_ALGORITHM_XPRESS_HUFF | COMPRESS_RAW, NULL, &h)) {
+		if (Decompress(h, Source, SourceSize, Dest, DestSize, &written)) {
+			if (written != DestSize)
+				ret = ERROR_VALUE_INVAL;
+		} else ret = GetLastError();
+
+		CloseDecompressor(h);
+	} else ret = GetLastError();
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+BOOLEAN BlockCodecSupported(EBlockCodecMethod Method)
+{
+	BOOLEAN ret = FALSE;
+
+	ret = (Method < bcmHigh || (Method < bcmMax && _HighAvailable()));
+
+	return ret;
+}
+
+
+/** Compresses one block.
+ *
+ *  @return
+ *  ERROR_VALUE_BUFFER_TOO_SMALL is returned when the compressed data do not
+ *  fit into the destination buffer. Pass a buffer of the source size to learn
+ *  whether compression pays off at all.
+ */
+ERROR_TYPE BlockCodecCompress(EBlockCodecMethod Method, const void *Source, size_t SourceSize, void *Dest, size_t DestSize, size_t *Written)
+{
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	switch (Method) {
+		case bcmNone:
+			ret = ERROR_VALUE_BUFFER_TOO_SMALL;
+			if (DestSize >= SourceSize) {
+				memcpy(Dest, Source, SourceSize);
+				*Written = SourceSize;
+				ret = ERROR_VALUE_SUCCESS;
+			}
+			break;
+		case bcmFast:
+			ret = _FastCompress((const UCHAR *)Source, SourceSize, (PUCHAR)Dest, DestSize, Written);
+			break;
+		case bcmHigh:
+			ret = _HighCompress(Source, SourceSize, Dest, DestSize, Written);
+			break;
+		default:
+			break;
+	}
+
+	return ret;
+}
+
+
+/** Decompresses one block.
+ *
+ *  @param DestSize Exact size of the decompressed data.
+ *
+ *  @return
+ *  ERROR_VALUE_INVAL is returned when the data are malformed or do not
+ *  decompress to DestSize bytes.
+ */
+ERROR_TYPE BlockCodecDecompress(EBlockCodecMethod Method, const void *Source, size_t SourceSize, void *Dest, size_t DestSize)
+{
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	switch (Method) {
+		case bcmNone:
+			if (SourceSize == DestSize) {
+				memcpy(Dest, Source, SourceSize);
+				ret = ERROR_VALUE_SUCCESS;
+			}
+			break;
+		case bcmFast:
+			ret = _FastDecompress((const UCHAR *)Source, SourceSize, (PUCHAR)Dest, DestSize);
+			break;
+		case bcmHigh:
+			ret = _HighDecompress(Source, SourceSize, Dest, DestSize);
+			break;
+		default:
+			break;
+	}
+
+	return ret;
+}
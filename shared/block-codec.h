@@ -0,0 +1,44 @@
+
+#ifndef __SHARED_BLOCK_CODEC_H__
+#define __SHARED_BLOCK_CODEC_H__
+
+/** Compression of independent blocks of data.
+ *
+ *  The fast method is a byte-oriented LZ77 variant: the data are a sequence
+ *  of literal runs, each optionally followed by a back-reference into
+ *  the previous 64 KB. It needs no entropy coding and decompresses at memory
+ *  speed. The high-ratio method uses the XPRESS Huffman compressor of
+ *  the Windows Compression API and is not available elsewhere.
+ *
+ *  Every block is compressed on its own, the size of the decompressed data
+ *  must be stored by the caller.
+ */
+
+#include "general-types.h"
+#include "request.h"
+
+
+
+typedef enum _EBlockCodecMethod {
+	bcmNone,
+	bcmFast,
+	bcmHigh,
+	bcmMax,
+} EBlockCodecMethod, *PEBlockCodecMethod;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BOOLEAN BlockCodecSupported(EBlockCodecMethod Method);
+ERROR_TYPE BlockCodecCompress(EBlockCodecMethod Method, const void *Source, size_t SourceSize, void *Dest, size_t DestSize, size_t *Written);
+ERROR_TYPE BlockCodecDecompress(EBlockCodecMethod Method, const void *Source, size_t SourceSize, void *Dest, size_t DestSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
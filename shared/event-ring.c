@@ -0,0 +1,328 @@
+
+#include <string.h>
+#include "event-ring.h"
+
+
+
+/************************************************************************/
+/*              HELPER FUNCTIONS                                        */
+/************************************************************************/
+
+
+#ifdef _WIN32
+
+#define _RingLoad32(Address)							InterlockedCompareExchange((Address), 0, 0)
+#define _RingLoad64(Address)							InterlockedCompareExchange64((Address), 0, 0)
+#define _RingStore32(Address, Value)					InterlockedExchange((Address), (Value))
+#define _RingStore64(Address, Value)					InterlockedExchange64((Address), (Value))
+#define _RingCompareExchange64(Address, New, Old)		InterlockedCompareExchange64((Address), (New), (Old))
+#define _RingIncrement32(Address)						InterlockedIncrement((Address))
+
+#else
+
+#define _RingLoad32(Address)							__atomic_load_n((Address), __ATOMIC_ACQUIRE)
+#define _RingLoad64(Address)							__atomic_load_n((Address), __ATOMIC_ACQUIRE)
+#define _RingStore32(Address, Value)					__atomic_exchange_n((Address), (Value), __ATOMIC_SEQ_CST)
+#define _RingStore64(Address, Value)					__atomic_exchange_n((Address), (Value), __ATOMIC_SEQ_CST)
+#define _RingCompareExchange64(Address, New, Old)		__sync_val_compare_and_swap((Address), (Old), (New))
+#define _RingIncrement32(Address)						__atomic_add_fetch((Address), 1, __ATOMIC_SEQ_CST)
+
+#endif
+
+#define _RingAlign(Value)								(((Value) + EVENT_RING_ALIGNMENT - 1) & ~(EVENT_RING_ALIGNMENT - 1))
+
+
+static BOOLEAN _DataSizeValid(ULONG DataSize)
+{
+	return (DataSize >= EVENT_RING_MIN_DATA_SIZE &&
+		DataSize <= EVENT_RING_MAX_DATA_SIZE &&
+		(DataSize & (DataSize - 1)) == 0);
+}
+
+
+/************************************************************************/
+/*                  PUBLIC FUNCTIONS                                    */
+/************************************************************************/
+
+
+/** Computes size of the shared memory required by a ring with a given data area.
+ *
+ *  @return Returns the size in bytes, or zero if the data area size is not
+ *  supported.
+ */
+ULONG EventRingMemorySize(ULONG DataSize)
+{
+	ULONG ret = 0;
+
+	if (_DataSizeValid(DataSize))
+		ret = sizeof(EVENT_RING_HEADER) + DataSize;
+
+	return ret;
+}
+
+
+/** Initializes a ring within zeroed shared memory. Used by the producer side.
+ *
+ *  @param Ring Receives the producer's view of the ring.
+ *  @param Memory The shared memory. Must be zeroed.
+ *  @param MemorySize Size of the memory, as returned by EventRingMemorySize.
+ *  @param Watermark Number of unread bytes that trigger the consumer notification.
+ */
+BOOLEAN EventRingFormat(PEVENT_RING Ring, void *Memory, ULONG MemorySize, ULONG Watermark)
+{
+	BOOLEAN ret = FALSE;
+	PEVENT_RING_HEADER h = (PEVENT_RING_HEADER)Memory;
+
+	ret = (MemorySize > sizeof(EVENT_RING_HEADER) && _DataSizeValid(MemorySize - sizeof(EVENT_RING_HEADER)));
+	if (ret) {
+		memset(Ring, 0, sizeof(EVENT_RING));
+		Ring->Header = h;
+		Ring->Data = (PUCHAR)(h + 1);
+		Ring->DataSize = MemorySize - sizeof(EVENT_RING_HEADER);
+		Ring->Watermark = Watermark;
+		if (Ring->Watermark > Ring->DataSize / 2)
+			Ring->Watermark = Ring->DataSize / 2;
+
+		h->HeaderSize = sizeof(EVENT_RING_HEADER);
+		h->DataSize = Ring->DataSize;
+		h->Watermark = Ring->Watermark;
+		h->Version = EVENT_RING_VERSION_1;
+		_RingStore32((volatile LONG *)&h->Signature, EVENT_RING_SIGNATURE);
+	}
+
+	return ret;
+}
+
+
+/** Reserves space for one record. Safe to call concurrently from multiple
+ *  producers.
+ *
+ *  @param Ring The producer's view of the ring.
+ *  @param Size Size of the record payload, in bytes.
+ *
+ *  @return
+ *  Address where the payload should be written. The record becomes visible
+ *  to the consumer after it is passed to EventRingCommit. NULL is returned,
+ *  and the drop counter incremented, when the ring is full.
+ */
+void *EventRingReserve(PEVENT_RING Ring, ULONG Size)
+{
+	LONG64 read = 0;
+	LONG64 write = 0;
+	ULONG pos = 0;
+	ULONG total = 0;
+	ULONG recordSize = 0;
+	PEVENT_RING_RECORD r = NULL;
+	void *ret = NULL;
+
+	if (Size <= Ring->DataSize / 2) {
+		recordSize = _RingAlign(sizeof(EVENT_RING_RECORD) + Size);
+		do {
+			write = _RingLoad64(&Ring->WriteOffset);
+			read = _RingLoad64(&Ring->Header->ReadOffset);
+			pos = (ULONG)(write & (Ring->DataSize - 1));
+			total = recordSize;
+			if (pos + recordSize > Ring->DataSize)
+				total += (Ring->DataSize - pos);
+
+			// A consumer cursor in front of the producer one is a consumer bug;
+			// just refuse to write anything in such a case.
+			if (read > write || write + total - read > Ring->DataSize) {
+				write = -1;
+				break;
+			}
+		} while (_RingCompareExchange64(&Ring->WriteOffset, write + total, write) != write);
+
+		if (write != -1) {
+			r = (PEVENT_RING_RECORD)(Ring->Data + pos);
+			if (total != recordSize) {
+				r->Size = Ring->DataSize - pos;
+				_RingStore32(&r->Flags, EVENT_RING_RECORD_COMMITTED | EVENT_RING_RECORD_WRAP);
+				r = (PEVENT_RING_RECORD)Ring->Data;
+			}
+
+			r->Size = recordSize;
+			ret = r + 1;
+		}
+	}
+
+	if (ret == NULL)
+		_RingIncrement32(&Ring->Header->DroppedCount);
+
+	return ret;
+}
+
+
+/** Publishes a record reserved by EventRingReserve.
+ *
+ *  @return
+ *  TRUE if the consumer waits for data and the watermark has been reached.
+ *  The caller is then responsible for signalling the consumer.
+ */
+BOOLEAN EventRingCommit(PEVENT_RING Ring, void *Payload)
+{
+	LONG64 used = 0;
+	BOOLEAN ret = FALSE;
+	PEVENT_RING_RECORD r = (PEVENT_RING_RECORD)Payload - 1;
+
+	_RingStore32(&r->Flags, EVENT_RING_RECORD_COMMITTED);
+	used = _RingLoad64(&Ring->WriteOffset) - _RingLoad64(&Ring->Header->ReadOffset);
+	if (used >= (LONG64)Ring->Watermark &&
+		_RingLoad32(&Ring->Header->ConsumerWaiting) &&
+		_RingStore32(&Ring->Header->ConsumerWaiting, 0) != 0)
+		ret = TRUE;
+
+	return ret;
+}
+
+
+/** Gives up a record reserved by EventRingReserve. The space is returned
+ *  to the producers once the consumer skips the record; the consumer is
+ *  never notified about it.
+ */
+void EventRingDiscard(PEVENT_RING Ring, void *Payload)
+{
+	PEVENT_RING_RECORD r = (PEVENT_RING_RECORD)Payload - 1;
+
+	(void)Ring;
+	_RingStore32(&r->Flags, EVENT_RING_RECORD_COMMITTED | EVENT_RING_RECORD_DISCARDED);
+
+	return;
+}
+
+
+/** Copies one record into the ring.
+ *
+ *  @param Notify Receives TRUE if the consumer needs to be signalled.
+ *
+ *  @return TRUE if the record has been written, FALSE when the ring was full.
+ */
+BOOLEAN EventRingWrite(PEVENT_RING Ring, const void *Buffer, ULONG Size, PBOOLEAN Notify)
+{
+	void *payload = NULL;
+	BOOLEAN ret = FALSE;
+
+	*Notify = FALSE;
+	payload = EventRingReserve(Ring, Size);
+	ret = (payload != NULL);
+	if (ret) {
+		memcpy(payload, Buffer, Size);
+		*Notify = EventRingCommit(Ring, payload);
+	}
+
+	return ret;
+}
+
+
+/** Validates a ring formatted by the producer and initializes the consumer's
+ *  view of it.
+ */
+BOOLEAN EventRingAttach(PEVENT_RING Ring, void *Memory, ULONG MemorySize)
+{
+	BOOLEAN ret = FALSE;
+	PEVENT_RING_HEADER h = (PEVENT_RING_HEADER)Memory;
+
+	ret = (MemorySize >= sizeof(EVENT_RING_HEADER) &&
+		(ULONG)_RingLoad32((volatile LONG *)&h->Signature) == EVENT_RING_SIGNATURE &&
+		h->Version == EVENT_RING_VERSION_1 &&
+		h->HeaderSize == sizeof(EVENT_RING_HEADER) &&
+		_DataSizeValid(h->DataSize) &&
+		MemorySize - sizeof(EVENT_RING_HEADER) >= h->DataSize);
+	if (ret) {
+		memset(Ring, 0, sizeof(EVENT_RING));
+		Ring->Header = h;
+		Ring->Data = (PUCHAR)(h + 1);
+		Ring->DataSize = h->DataSize;
+		Ring->Watermark = h->Watermark;
+		Ring->ReadOffset = _RingLoad64(&h->ReadOffset);
+	}
+
+	return ret;
+}
+
+
+/** Returns the oldest unread record without removing it from the ring.
+ *
+ *  @param Size Receives size of the record payload.
+ *
+ *  @return
+ *  Address of the payload, valid until EventRingRelease is called.
+ *  NULL means that no committed record is available.
+ */
+const void *EventRingPeek(PEVENT_RING Ring, PULONG Size)
+{
+	LONG flags = 0;
+	ULONG pos = 0;
+	ULONG recordSize = 0;
+	PEVENT_RING_RECORD r = NULL;
+	const void *ret = NULL;
+
+	do {
+		pos = (ULONG)(Ring->ReadOffset & (Ring->DataSize - 1));
+		r = (PEVENT_RING_RECORD)(Ring->Data + pos);
+		flags = _RingLoad32(&r->Flags);
+		if ((flags & EVENT_RING_RECORD_COMMITTED) == 0)
+			break;
+
+		recordSize = r->Size;
+		if (recordSize < sizeof(EVENT_RING_RECORD) ||
+			recordSize % EVENT_RING_ALIGNMENT != 0 ||
+			recordSize > Ring->DataSize - pos)
+			break;
+
+		if (flags & (EVENT_RING_RECORD_WRAP | EVENT_RING_RECORD_DISCARDED)) {
+			EventRingRelease(Ring);
+			continue;
+		}
+
+		*Size = recordSize - sizeof(EVENT_RING_RECORD);
+		ret = r + 1;
+	} while (ret == NULL);
+
+	return ret;
+}
+
+
+/** Removes the record returned by the last EventRingPeek call and returns
+ *  its space to the producers.
+ */
+void EventRingRelease(PEVENT_RING Ring)
+{
+	ULONG pos = 0;
+	ULONG recordSize = 0;
+	PEVENT_RING_RECORD r = NULL;
+
+	pos = (ULONG)(Ring->ReadOffset & (Ring->DataSize - 1));
+	r = (PEVENT_RING_RECORD)(Ring->Data + pos);
+	recordSize = r->Size;
+	memset(r, 0, recordSize);
+	Ring->ReadOffset += recordSize;
+	_RingStore64(&Ring->Header->ReadOffset, Ring->ReadOffset);
+
+	return;
+}
+
+
+/** Announces that the consumer is going to wait for the notification.
+ *
+ *  @return
+ *  TRUE if the ring is still empty and the consumer may go to sleep.
+ *  FALSE means new records arrived meanwhile and should be processed first.
+ *
+ *  @remark
+ *  The producers signal the consumer only after the watermark is reached,
+ *  so the consumer should wait with a timeout to pick up records that stay
+ *  below it.
+ */
+BOOLEAN EventRingWaitPrepare(PEVENT_RING Ring)
+{
+	ULONG dummy = 0;
+	BOOLEAN ret = FALSE;
+
+	_RingStore32(&Ring->Header->ConsumerWaiting, 1);
+	ret = (EventRingPeek(Ring, &dummy) == NULL);
+	if (!ret)
+		_RingStore32(&Ring->Header->ConsumerWaiting, 0);
+
+	return ret;
+}
@@ -0,0 +1,135 @@
+
+#ifndef __SHARED_EVENT_RING_H__
+#define __SHARED_EVENT_RING_H__
+
+/** Single-consumer, multi-producer ring of variable-length records living in
+ *  memory shared by the IRPMon driver and the connected process.
+ *
+ *  The memory starts with an EVENT_RING_HEADER followed by the data area, which
+ *  size is a power of two. Every record is prefixed by an EVENT_RING_RECORD
+ *  and aligned to EVENT_RING_ALIGNMENT bytes. Producers reserve space by advancing
+ *  their private write cursor and publish a record by setting its COMMITTED flag.
+ *  A record that would cross the end of the data area is preceded by a wrap marker
+ *  filling the rest of the area. A reserved record the producer decides not to
+ *  publish is committed as discarded and skipped by the consumer. The consumer zeroes every record it releases, so
+ *  a zero Flags member always means "not yet committed".
+ *
+ *  Cursors are 64-bit byte offsets that never wrap; the position within the data
+ *  area is the cursor modulo the data area size. The producer trusts nothing it
+ *  reads from the shared memory except the consumer cursor, and even that one only
+ *  to compute free space.
+ *
+ *  The code depends only on the compiler, so it can be built outside Windows.
+ */
+
+#ifdef _WIN32
+#ifdef _KERNEL_MODE
+#include <ntifs.h>
+#else
+#include <windows.h>
+#endif
+#else
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t UCHAR, *PUCHAR;
+typedef uint8_t BOOLEAN, *PBOOLEAN;
+typedef int32_t LONG, *PLONG;
+typedef uint32_t ULONG, *PULONG;
+typedef int64_t LONG64, *PLONG64;
+
+#ifndef TRUE
+#define TRUE	1
+#define FALSE	0
+#endif
+#endif
+
+
+
+#define EVENT_RING_SIGNATURE			0x474e5249	// 'IRNG'
+#define EVENT_RING_VERSION_1			1
+#define EVENT_RING_ALIGNMENT			8
+#define EVENT_RING_MIN_DATA_SIZE		0x10000
+#define EVENT_RING_MAX_DATA_SIZE		0x4000000
+
+/** Flags stored in the record headers. */
+typedef enum _EEventRingRecordFlags {
+	/** The record is complete and can be read by the consumer. */
+	EVENT_RING_RECORD_COMMITTED = 0x1,
+	/** The record only fills space up to the end of the data area
+	    and carries no payload. */
+	EVENT_RING_RECORD_WRAP = 0x2,
+	/** The producer gave the reserved space up; the record carries
+	    no payload. */
+	EVENT_RING_RECORD_DISCARDED = 0x4,
+} EEventRingRecordFlags, *PEEventRingRecordFlags;
+
+/** Start of the shared memory. The cursors reside on separate cache
+ *  lines to avoid false sharing between the driver and the consumer. */
+typedef struct _EVENT_RING_HEADER {
+	ULONG Signature;
+	ULONG Version;
+	/** Offset of the data area from the start of the header. */
+	ULONG HeaderSize;
+	/** Size of the data area, a power of two. */
+	ULONG DataSize;
+	/** Number of unread bytes that must be present in the ring before
+	    a waiting consumer is notified. */
+	ULONG Watermark;
+	/** Set by the consumer before it goes to sleep; cleared by the producer
+	    that decides to notify it. */
+	volatile LONG ConsumerWaiting;
+	/** Number of records not written because the ring was full. */
+	volatile LONG DroppedCount;
+	ULONG Reserved;
+	UCHAR Padding1[32];
+	/** Total number of bytes released by the consumer. */
+	volatile LONG64 ReadOffset;
+	UCHAR Padding2[56];
+} EVENT_RING_HEADER, *PEVENT_RING_HEADER;
+
+/** Header of a single record within the data area. */
+typedef struct _EVENT_RING_RECORD {
+	/** Size of the record, including this header, in bytes. */
+	ULONG Size;
+	/** Combination of EEventRingRecordFlags. */
+	volatile LONG Flags;
+} EVENT_RING_RECORD, *PEVENT_RING_RECORD;
+
+/** Private view of the ring. Each side keeps its own instance. */
+typedef struct _EVENT_RING {
+	PEVENT_RING_HEADER Header;
+	PUCHAR Data;
+	ULONG DataSize;
+	ULONG Watermark;
+	/** Producers only: total number of bytes reserved. */
+	volatile LONG64 WriteOffset;
+	/** Consumer only: total number of bytes released. */
+	LONG64 ReadOffset;
+} EVENT_RING, *PEVENT_RING;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ULONG EventRingMemorySize(ULONG DataSize);
+
+BOOLEAN EventRingFormat(PEVENT_RING Ring, void *Memory, ULONG MemorySize, ULONG Watermark);
+void *EventRingReserve(PEVENT_RING Ring, ULONG Size);
+BOOLEAN EventRingCommit(PEVENT_RING Ring, void *Payload);
+void EventRingDiscard(PEVENT_RING Ring, void *Payload);
+BOOLEAN EventRingWrite(PEVENT_RING Ring, const void *Buffer, ULONG Size, PBOOLEAN Notify);
+
+BOOLEAN EventRingAttach(PEVENT_RING Ring, void *Memory, ULONG MemorySize);
+const void *EventRingPeek(PEVENT_RING Ring, PULONG Size);
+void EventRingRelease(PEVENT_RING Ring);
+BOOLEAN EventRingWaitPrepare(PEVENT_RING Ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
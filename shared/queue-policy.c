@@ -0,0 +1,81 @@
+
+#ifdef _KERNEL_MODE
+#include <ntifs.h>
+#else
+#include <windows.h>
+#endif
+#include "general-types.h"
+#include "queue-policy.h"
+
+
+
+/************************************************************************/
+/*              HELPER FUNCTIONS                                        */
+/************************************************************************/
+
+
+static BOOLEAN _Exceeds(const IRPMNDRV_SETTINGS *Settings, ULONG64 Length, ULONG64 Size, ULONG Factor)
+{
+	return ((Settings->ReqQueueMaxLength > 0 && Length > (ULONG64)Settings->ReqQueueMaxLength*Factor) ||
+		(Settings->ReqQueueMaxSize > 0 && Size > (ULONG64)Settings->ReqQueueMaxSize*Factor));
+}
+
+
+/************************************************************************/
+/*                  PUBLIC FUNCTIONS                                    */
+/************************************************************************/
+
+
+/** Checks whether the Event Queue exceeds its limits.
+ *
+ *  @param Settings Driver settings defining the limits.
+ *  @param Length Number of events in the queue.
+ *  @param Size Total size of events in the queue, in bytes.
+ */
+BOOLEAN QueuePolicyOverLimit(const IRPMNDRV_SETTINGS *Settings, LONG Length, LONG Size)
+{
+	return _Exceeds(Settings, (ULONG)Length, (ULONG)Size, 1);
+}
+
+
+/** Decides what to do with a new event.
+ *
+ *  @param Settings Driver settings defining the limits and the policy.
+ *  @param Length Number of events in the queue.
+ *  @param Size Total size of events in the queue, in bytes.
+ *  @param RequestSize Size of the new event, in bytes.
+ *  @param SampleCounter Counter shared by all callers, used by the sampling policy.
+ *
+ *  @remark
+ *  The routine has no side effects apart from the sample counter, so it can
+ *  be driven by a simulated producer and consumer.
+ */
+EQueuePolicyDecision QueuePolicyDecide(const IRPMNDRV_SETTINGS *Settings, LONG Length, LONG Size, ULONG RequestSize, volatile LONG *SampleCounter)
+{
+	ULONG rate = 0;
+	ULONG64 newLength = (ULONG64)(ULONG)Length + 1;
+	ULONG64 newSize = (ULONG64)(ULONG)Size + RequestSize;
+	EQueuePolicyDecision ret = qpdDrop;
+
+	if (_Exceeds(Settings, newLength, newSize, 1)) {
+		if (!_Exceeds(Settings, newLength, newSize, 2)) {
+			switch (Settings->ReqQueueOverflowPolicy) {
+				case rqopDropOldest:
+					ret = qpdAcceptTrim;
+					break;
+				case rqopSample:
+					rate = Settings->ReqQueueSampleRate;
+					if (rate == 0)
+						rate = 1;
+
+					if ((ULONG)InterlockedIncrement(SampleCounter) % rate == 0)
+						ret = qpdAcceptOverLimit;
+					break;
+				default:
+					break;
+			}
+		}
+	} else ret = qpdAccept;
+
+	return ret;
+}
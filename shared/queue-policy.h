@@ -0,0 +1,36 @@
+
+#ifndef __SHARED_QUEUE_POLICY_H__
+#define __SHARED_QUEUE_POLICY_H__
+
+
+#include "general-types.h"
+
+
+/** Outcome of the overflow policy for one new event. */
+typedef enum _EQueuePolicyDecision {
+	/** The queue is within its limits, store the event. */
+	qpdAccept,
+	/** A limit is exceeded but the policy keeps the event. */
+	qpdAcceptOverLimit,
+	/** Store the event and remove the oldest ones until the queue
+	    fits its limits again. */
+	qpdAcceptTrim,
+	/** Drop the event. */
+	qpdDrop,
+} EQueuePolicyDecision, *PEQueuePolicyDecision;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BOOLEAN QueuePolicyOverLimit(const IRPMNDRV_SETTINGS *Settings, LONG Length, LONG Size);
+EQueuePolicyDecision QueuePolicyDecide(const IRPMNDRV_SETTINGS *Settings, LONG Length, LONG Size, ULONG RequestSize, volatile LONG *SampleCounter);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
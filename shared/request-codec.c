@@ -0,0 +1,620 @@
+
+#ifdef _KERNEL_MODE
+#include <ntifs.h>
+#else
+#include <windows.h>
+#endif
+#include <stddef.h>
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-codec.h"
+
+
+
+/************************************************************************/
+/*                     FIELD DESCRIPTIONS                               */
+/************************************************************************/
+
+
+/** How a field is encoded. */
+typedef enum _ERequestCodecFieldKind {
+	/** Unsigned varint of the field value. */
+	rcfkInteger,
+	/** Dictionary-coded pointer. */
+	rcfkPointer,
+} ERequestCodecFieldKind, *PERequestCodecFieldKind;
+
+/** Describes one type-specific field (or an array of fields) of a request. */
+typedef struct _REQUEST_CODEC_FIELD {
+	USHORT Offset;
+	UCHAR Size;
+	UCHAR Count;
+	ERequestCodecFieldKind Kind;
+} REQUEST_CODEC_FIELD, *PREQUEST_CODEC_FIELD;
+
+#define RC_FIELD_SIZE(aType, aMember)				sizeof(((aType *)0)->aMember)
+#define RC_INT(aType, aMember)						{offsetof(aType, aMember), RC_FIELD_SIZE(aType, aMember), 1, rcfkInteger}
+#define RC_PTR(aType, aMember)						{offsetof(aType, aMember), RC_FIELD_SIZE(aType, aMember), 1, rcfkPointer}
+#define RC_ARRAY(aType, aMember)					{offsetof(aType, aMember), RC_FIELD_SIZE(aType, aMember[0]), RC_FIELD_SIZE(aType, aMember) / RC_FIELD_SIZE(aType, aMember[0]), rcfkInteger}
+
+static const REQUEST_CODEC_FIELD _irpFields[] = {
+	RC_INT(REQUEST_IRP, MajorFunction),
+	RC_INT(REQUEST_IRP, MinorFunction),
+	RC_INT(REQUEST_IRP, PreviousMode),
+	RC_INT(REQUEST_IRP, RequestorMode),
+	RC_PTR(REQUEST_IRP, IRPAddress),
+	RC_INT(REQUEST_IRP, IrpFlags),
+	RC_PTR(REQUEST_IRP, FileObject),
+	RC_INT(REQUEST_IRP, Arg1),
+	RC_INT(REQUEST_IRP, Arg2),
+	RC_INT(REQUEST_IRP, Arg3),
+	RC_INT(REQUEST_IRP, Arg4),
+	RC_INT(REQUEST_IRP, IOSBStatus),
+	RC_INT(REQUEST_IRP, IOSBInformation),
+	RC_INT(REQUEST_IRP, RequestorProcessId),
+	RC_INT(REQUEST_IRP, DataSize),
+};
+
+static const REQUEST_CODEC_FIELD _irpCompletionFields[] = {
+	RC_PTR(REQUEST_IRP_COMPLETION, IRPAddress),
+	RC_INT(REQUEST_IRP_COMPLETION, CompletionStatus),
+	RC_INT(REQUEST_IRP_COMPLETION, CompletionInformation),
+	RC_INT(REQUEST_IRP_COMPLETION, MajorFunction),
+	RC_INT(REQUEST_IRP_COMPLETION, MinorFunction),
+	RC_ARRAY(REQUEST_IRP_COMPLETION, Arguments),
+	RC_PTR(REQUEST_IRP_COMPLETION, FileObject),
+	RC_INT(REQUEST_IRP_COMPLETION, RequestorProcessId),
+	RC_INT(REQUEST_IRP_COMPLETION, PreviousMode),
+	RC_INT(REQUEST_IRP_COMPLETION, RequestorMode),
+	RC_INT(REQUEST_IRP_COMPLETION, DataSize),
+};
+
+static const REQUEST_CODEC_FIELD _fastIoFields[] = {
+	RC_INT(REQUEST_FASTIO, FastIoType),
+	RC_INT(REQUEST_FASTIO, PreviousMode),
+	RC_INT(REQUEST_FASTIO, Arg1),
+	RC_INT(REQUEST_FASTIO, Arg2),
+	RC_INT(REQUEST_FASTIO, Arg3),
+	RC_INT(REQUEST_FASTIO, Arg4),
+	RC_INT(REQUEST_FASTIO, Arg5),
+	RC_INT(REQUEST_FASTIO, Arg6),
+	RC_INT(REQUEST_FASTIO, Arg7),
+	RC_INT(REQUEST_FASTIO, Arg8),
+	RC_INT(REQUEST_FASTIO, Arg9),
+	RC_PTR(REQUEST_FASTIO, FileObject),
+	RC_INT(REQUEST_FASTIO, IOSBStatus),
+	RC_INT(REQUEST_FASTIO, IOSBInformation),
+};
+
+static const REQUEST_CODEC_FIELD _startIoFields[] = {
+	RC_PTR(REQUEST_STARTIO, IRPAddress),
+	RC_INT(REQUEST_STARTIO, MajorFunction),
+	RC_INT(REQUEST_STARTIO, MinorFunction),
+	RC_INT(REQUEST_STARTIO, Arg1),
+	RC_INT(REQUEST_STARTIO, Arg2),
+	RC_INT(REQUEST_STARTIO, Arg3),
+	RC_INT(REQUEST_STARTIO, Arg4),
+	RC_INT(REQUEST_STARTIO, IrpFlags),
+	RC_PTR(REQUEST_STARTIO, FileObject),
+	RC_INT(REQUEST_STARTIO, Information),
+	RC_INT(REQUEST_STARTIO, Status),
+	RC_INT(REQUEST_STARTIO, DataSize),
+};
+
+static const REQUEST_CODEC_FIELD _driverDetectedFields[] = {
+	RC_INT(REQUEST_DRIVER_DETECTED, DriverNameLength),
+};
+
+static const REQUEST_CODEC_FIELD _deviceDetectedFields[] = {
+	RC_INT(REQUEST_DEVICE_DETECTED, DeviceNameLength),
+};
+
+static const REQUEST_CODEC_FIELD _fileNameAssignedFields[] = {
+	RC_PTR(REQUEST_FILE_OBJECT_NAME_ASSIGNED, FileObject),
+	RC_INT(REQUEST_FILE_OBJECT_NAME_ASSIGNED, NameLength),
+};
+
+static const REQUEST_CODEC_FIELD _fileNameDeletedFields[] = {
+	RC_PTR(REQUEST_FILE_OBJECT_NAME_DELETED, FileObject),
+};
+
+static const REQUEST_CODEC_FIELD _processCreatedFields[] = {
+	RC_INT(REQUEST_PROCESS_CREATED, ProcessId),
+	RC_INT(REQUEST_PROCESS_CREATED, ParentId),
+	RC_INT(REQUEST_PROCESS_CREATED, CreatorId),
+	RC_INT(REQUEST_PROCESS_CREATED, ImageNameLength),
+	RC_INT(REQUEST_PROCESS_CREATED, CommandLineLength),
+};
+
+static const REQUEST_CODEC_FIELD _processExittedFields[] = {
+	RC_INT(REQUEST_PROCESS_EXITTED, ProcessId),
+};
+
+static const REQUEST_CODEC_FIELD _imageLoadFields[] = {
+	RC_PTR(REQUEST_IMAGE_LOAD, ImageBase),
+	RC_INT(REQUEST_IMAGE_LOAD, ImageSize),
+	RC_PTR(REQUEST_IMAGE_LOAD, FileObject),
+	RC_INT(REQUEST_IMAGE_LOAD, SignatureLevel),
+	RC_INT(REQUEST_IMAGE_LOAD, SignatureType),
+	RC_INT(REQUEST_IMAGE_LOAD, DataSize),
+	RC_INT(REQUEST_IMAGE_LOAD, KernelDriver),
+	RC_INT(REQUEST_IMAGE_LOAD, MappedToAllPids),
+	RC_INT(REQUEST_IMAGE_LOAD, ExtraInfo),
+	RC_INT(REQUEST_IMAGE_LOAD, PartialMap),
+};
+
+static const REQUEST_CODEC_FIELD _eventsDroppedFields[] = {
+	RC_INT(REQUEST_EVENTS_DROPPED, DroppedCount),
+	RC_ARRAY(REQUEST_EVENTS_DROPPED, DroppedByType),
+};
+
+/** Layout of one request type. */
+typedef struct _REQUEST_CODEC_TYPE {
+	/** Size of the fixed part of the request, without the trailing data. */
+	size_t FixedSize;
+	const REQUEST_CODEC_FIELD *Fields;
+	size_t FieldCount;
+} REQUEST_CODEC_TYPE, *PREQUEST_CODEC_TYPE;
+
+#define RC_TYPE(aType, aFields)						{sizeof(aType), aFields, sizeof(aFields) / sizeof(aFields[0])}
+#define RC_TYPE_NO_FIELDS(aType)					{sizeof(aType), NULL, 0}
+
+/** Request layouts indexed by the request type. */
+static const REQUEST_CODEC_TYPE _types[REQUEST_TYPE_COUNT] = {
+	{0, NULL, 0},
+	RC_TYPE(REQUEST_IRP, _irpFields),
+	RC_TYPE(REQUEST_IRP_COMPLETION, _irpCompletionFields),
+	RC_TYPE_NO_FIELDS(REQUEST_ADDDEVICE),
+	RC_TYPE_NO_FIELDS(REQUEST_UNLOAD),
+	RC_TYPE(REQUEST_FASTIO, _fastIoFields),
+	RC_TYPE(REQUEST_STARTIO, _startIoFields),
+	RC_TYPE(REQUEST_DRIVER_DETECTED, _driverDetectedFields),
+	RC_TYPE(REQUEST_DEVICE_DETECTED, _deviceDetectedFields),
+	RC_TYPE(REQUEST_FILE_OBJECT_NAME_ASSIGNED, _fileNameAssignedFields),
+	RC_TYPE(REQUEST_FILE_OBJECT_NAME_DELETED, _fileNameDeletedFields),
+	RC_TYPE(REQUEST_PROCESS_CREATED, _processCreatedFields),
+	RC_TYPE(REQUEST_PROCESS_EXITTED, _processExittedFields),
+	RC_TYPE(REQUEST_IMAGE_LOAD, _imageLoadFields),
+	RC_TYPE(REQUEST_EVENTS_DROPPED, _eventsDroppedFields),
+};
+
+/** Maximum length of a varint holding a 64-bit value. */
+#define RC_VARINT_MAX						10
+/** Number of header values stored as varints, including the two dictionary pointers. */
+#define RC_HEADER_VARINTS					8
+/** Maximum number of dictionary-coded pointers a request can contain. */
+#define RC_POINTERS_MAX						8
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** Dictionary updates of one record. They are applied only after the whole
+ *  record is processed, so a failure leaves the state intact. */
+typedef struct _REQUEST_CODEC_PENDING {
+	size_t Count;
+	ULONG Index[RC_POINTERS_MAX];
+	ULONG_PTR Value[RC_POINTERS_MAX];
+} REQUEST_CODEC_PENDING, *PREQUEST_CODEC_PENDING;
+
+typedef struct _REQUEST_CODEC_STREAM {
+	unsigned char *Position;
+	const unsigned char *End;
+	BOOLEAN Error;
+} REQUEST_CODEC_STREAM, *PREQUEST_CODEC_STREAM;
+
+
+static ULONG64 _ZigZag(LONG64 Value)
+{
+	return ((ULONG64)Value << 1) ^ (ULONG64)(Value >> 63);
+}
+
+
+static LONG64 _UnZigZag(ULONG64 Value)
+{
+	return (LONG64)(Value >> 1) ^ -(LONG64)(Value & 1);
+}
+
+
+static ULONG _DictionaryIndex(ULONG_PTR Value)
+{
+	ULONG64 v = (ULONG64)Value;
+
+	return (ULONG)((((ULONG)(v >> 4) ^ (ULONG)(v >> 32)) * 2654435761U) >> 24) & (REQUEST_CODEC_DICTIONARY_SIZE - 1);
+}
+
+
+static void _PutByte(PREQUEST_CODEC_STREAM Stream, UCHAR Value)
+{
+	if (Stream->Position < Stream->End)
+		*Stream->Position++ = Value;
+	else Stream->Error = TRUE;
+
+	return;
+}
+
+
+static void _PutVarint(PREQUEST_CODEC_STREAM Stream, ULONG64 Value)
+{
+	while (Value >= 0x80) {
+		_PutByte(Stream, (UCHAR)(Value | 0x80));
+		Value >>= 7;
+	}
+
+	_PutByte(Stream, (UCHAR)Value);
+
+	return;
+}
+
+
+static UCHAR _GetByte(PREQUEST_CODEC_STREAM Stream)
+{
+	UCHAR ret = 0;
+
+	if (Stream->Position < Stream->End)
+		ret = *Stream->Position++;
+	else Stream->Error = TRUE;
+
+	return ret;
+}
+
+
+static ULONG64 _GetVarint(PREQUEST_CODEC_STREAM Stream)
+{
+	UCHAR b = 0;
+	ULONG shift = 0;
+	ULONG64 ret = 0;
+
+	do {
+		b = _GetByte(Stream);
+		if (shift == 63 && b > 1)
+			Stream->Error = TRUE;
+
+		ret |= ((ULONG64)(b & 0x7f) << shift);
+		shift += 7;
+	} while (!Stream->Error && (b & 0x80) != 0 && shift < 70);
+
+	if (b & 0x80)
+		Stream->Error = TRUE;
+
+	return ret;
+}
+
+
+static void _PutPointer(PREQUEST_CODEC_STREAM Stream, const REQUEST_CODEC_STATE *State, PREQUEST_CODEC_PENDING Pending, ULONG_PTR Value)
+{
+	ULONG index = 0;
+
+	index = _DictionaryIndex(Value);
+	if (State->Dictionary[index] != Value) {
+		_PutByte(Stream, 0);
+		_PutVarint(Stream, Value);
+		Pending->Index[Pending->Count] = index;
+		Pending->Value[Pending->Count] = Value;
+		++Pending->Count;
+	} else _PutVarint(Stream, ((ULONG64)index << 1) | 1);
+
+	return;
+}
+
+
+static ULONG_PTR _GetPointer(PREQUEST_CODEC_STREAM Stream, const REQUEST_CODEC_STATE *State, PREQUEST_CODEC_PENDING Pending)
+{
+	ULONG64 tag = 0;
+	ULONG64 value = 0;
+	ULONG_PTR ret = 0;
+
+	tag = _GetVarint(Stream);
+	if (tag == 0) {
+		value = _GetVarint(Stream);
+		ret = (ULONG_PTR)value;
+		if (ret != value || Pending->Count == RC_POINTERS_MAX)
+			Stream->Error = TRUE;
+
+		if (!Stream->Error) {
+			Pending->Index[Pending->Count] = _DictionaryIndex(ret);
+			Pending->Value[Pending->Count] = ret;
+			++Pending->Count;
+		}
+	} else if ((tag & 1) != 0 && (tag >> 1) < REQUEST_CODEC_DICTIONARY_SIZE) {
+		ret = State->Dictionary[tag >> 1];
+	} else Stream->Error = TRUE;
+
+	return ret;
+}
+
+
+static ULONG64 _FieldRead(const void *Address, size_t Size)
+{
+	ULONG64 ret = 0;
+
+	memcpy(&ret, Address, Size);
+
+	return ret;
+}
+
+
+static BOOLEAN _FieldWrite(void *Address, size_t Size, ULONG64 Value)
+{
+	BOOLEAN ret = FALSE;
+
+	ret = (Size == sizeof(ULONG64) || (Value >> (Size * 8)) == 0);
+	if (ret)
+		memcpy(Address, &Value, Size);
+
+	return ret;
+}
+
+
+static void _PendingApply(PREQUEST_CODEC_STATE State, const REQUEST_CODEC_PENDING *Pending)
+{
+	size_t i = 0;
+
+	for (i = 0; i < Pending->Count; ++i)
+		State->Dictionary[Pending->Index[i]] = Pending->Value[i];
+
+	return;
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** Initializes state of the encoder or decoder. Must be called before the first
+ *  record of a stream is processed.
+ */
+void RequestCodecInit(PREQUEST_CODEC_STATE State)
+{
+	memset(State, 0, sizeof(REQUEST_CODEC_STATE));
+
+	return;
+}
+
+
+/** Computes an upper bound of the encoded size of a request.
+ *
+ *  @return
+ *  Returns the number of bytes, or zero if the request type is not supported.
+ */
+size_t RequestCodecEncodedSizeMax(const REQUEST_HEADER *Request)
+{
+	size_t i = 0;
+	size_t ret = 0;
+	size_t size = 0;
+	const REQUEST_CODEC_TYPE *t = NULL;
+
+	if ((ULONG)Request->Type < REQUEST_TYPE_COUNT) {
+		t = _types + Request->Type;
+		size = RequestGetSize(Request);
+		if (t->FixedSize > 0 && size >= t->FixedSize) {
+			// Type, IRQL, result
+			ret = 2 + (RC_VARINT_MAX + 1);
+			ret += RC_HEADER_VARINTS*(RC_VARINT_MAX + 1);
+			for (i = 0; i < t->FieldCount; ++i)
+				ret += t->Fields[i].Count*(RC_VARINT_MAX + 1);
+
+			ret += RC_VARINT_MAX + (size - t->FixedSize);
+		}
+	}
+
+	return ret;
+}
+
+
+/** Encodes one request.
+ *
+ *  @param State State of the encoded stream.
+ *  @param Request The request to encode. Its Entry member is not encoded.
+ *  @param Buffer Buffer receiving the encoded record.
+ *  @param Length Length of the buffer, in bytes.
+ *  @param Written Receives number of bytes written to the buffer.
+ *
+ *  @return
+ *  Returns ERROR_VALUE_BUFFER_TOO_SMALL if the record does not fit into the buffer.
+ *  The state is then not changed, so the call can be retried with a larger buffer.
+ */
+ERROR_TYPE RequestCodecEncode(PREQUEST_CODEC_STATE State, const REQUEST_HEADER *Request, void *Buffer, size_t Length, size_t *Written)
+{
+	size_t i = 0;
+	size_t j = 0;
+	size_t size = 0;
+	const unsigned char *field = NULL;
+	const REQUEST_CODEC_FIELD *f = NULL;
+	const REQUEST_CODEC_TYPE *t = NULL;
+	REQUEST_CODEC_STREAM s;
+	REQUEST_CODEC_PENDING pending;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	if ((ULONG)Request->Type < REQUEST_TYPE_COUNT) {
+		t = _types + Request->Type;
+		size = RequestGetSize(Request);
+		if (t->FixedSize > 0 && size >= t->FixedSize) {
+			s.Position = (unsigned char *)Buffer;
+			s.End = s.Position + Length;
+			s.Error = FALSE;
+			pending.Count = 0;
+			_PutByte(&s, (UCHAR)Request->Type);
+			_PutVarint(&s, _ZigZag((LONG)(Request->Id - State->LastId)));
+			_PutVarint(&s, _ZigZag((LONG64)((ULONG64)Request->Time.QuadPart - (ULONG64)State->LastTime)));
+			_PutPointer(&s, State, &pending, (ULONG_PTR)Request->Device);
+			_PutPointer(&s, State, &pending, (ULONG_PTR)Request->Driver);
+			_PutVarint(&s, _ZigZag((LONG64)((ULONG64)(LONG_PTR)Request->ProcessId - (ULONG64)State->LastProcessId)));
+			_PutVarint(&s, _ZigZag((LONG64)((ULONG64)(LONG_PTR)Request->ThreadId - (ULONG64)State->LastThreadId)));
+			_PutVarint(&s, Request->Flags);
+			_PutByte(&s, Request->Irql);
+			_PutVarint(&s, Request->ResultType);
+			switch (Request->ResultType) {
+				case rrtNTSTATUS:
+					_PutVarint(&s, (ULONG)Request->Result.NTSTATUSValue);
+					break;
+				case rrtBOOLEAN:
+					_PutByte(&s, Request->Result.BOOLEANValue);
+					break;
+				default:
+					_PutVarint(&s, (ULONG_PTR)Request->Result.Other);
+					break;
+			}
+
+			for (i = 0; i < t->FieldCount; ++i) {
+				f = t->Fields + i;
+				field = (const unsigned char *)Request + f->Offset;
+				for (j = 0; j < f->Count; ++j) {
+					if (f->Kind == rcfkPointer)
+						_PutPointer(&s, State, &pending, (ULONG_PTR)_FieldRead(field, f->Size));
+					else _PutVarint(&s, _FieldRead(field, f->Size));
+
+					field += f->Size;
+				}
+			}
+
+			_PutVarint(&s, size - t->FixedSize);
+			if (!s.Error && (size_t)(s.End - s.Position) >= size - t->FixedSize) {
+				memcpy(s.Position, (const unsigned char *)Request + t->FixedSize, size - t->FixedSize);
+				s.Position += (size - t->FixedSize);
+			} else s.Error = TRUE;
+
+			ret = ERROR_VALUE_BUFFER_TOO_SMALL;
+			if (!s.Error) {
+				_PendingApply(State, &pending);
+				State->LastId = Request->Id;
+				State->LastTime = Request->Time.QuadPart;
+				State->LastProcessId = (LONG_PTR)Request->ProcessId;
+				State->LastThreadId = (LONG_PTR)Request->ThreadId;
+				*Written = s.Position - (unsigned char *)Buffer;
+				ret = ERROR_VALUE_SUCCESS;
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+/** Decodes one request.
+ *
+ *  @param State State of the decoded stream.
+ *  @param Buffer Encoded data.
+ *  @param Length Length of the encoded data, in bytes.
+ *  @param Consumed Receives number of bytes occupied by the record.
+ *  @param Request Receives the decoded request, allocated by RequestMemoryAlloc.
+ *
+ *  @return
+ *  Returns ERROR_VALUE_BUFFER_TOO_SMALL when the buffer does not contain
+ *  the whole record. The state is then not changed, so the call can be
+ *  repeated when more data arrive. ERROR_VALUE_INVAL indicates malformed data.
+ */
+ERROR_TYPE RequestCodecDecode(PREQUEST_CODEC_STATE State, const void *Buffer, size_t Length, size_t *Consumed, PREQUEST_HEADER *Request)
+{
+	size_t i = 0;
+	size_t j = 0;
+	ULONG type = 0;
+	ULONG64 value = 0;
+	ULONG64 dataSize = 0;
+	unsigned char *field = NULL;
+	const REQUEST_CODEC_FIELD *f = NULL;
+	const REQUEST_CODEC_TYPE *t = NULL;
+	REQUEST_GENERAL tmp;
+	PREQUEST_HEADER h = &tmp.RequestTypes.Other;
+	PREQUEST_HEADER tmpRequest = NULL;
+	REQUEST_CODEC_STREAM s;
+	REQUEST_CODEC_PENDING pending;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	s.Position = (unsigned char *)Buffer;
+	s.End = s.Position + Length;
+	s.Error = FALSE;
+	pending.Count = 0;
+	memset(&tmp, 0, sizeof(tmp));
+	type = _GetByte(&s);
+	if (s.Error)
+		ret = ERROR_VALUE_BUFFER_TOO_SMALL;
+
+	if (!s.Error && type < REQUEST_TYPE_COUNT && _types[type].FixedSize > 0) {
+		t = _types + type;
+		h->Type = (ERequesttype)type;
+		h->Id = State->LastId + (ULONG)_UnZigZag(_GetVarint(&s));
+		h->Time.QuadPart = (LONG64)((ULONG64)State->LastTime + (ULONG64)_UnZigZag(_GetVarint(&s)));
+		h->Device = (PVOID)_GetPointer(&s, State, &pending);
+		h->Driver = (PVOID)_GetPointer(&s, State, &pending);
+		h->ProcessId = (HANDLE)(LONG_PTR)((ULONG64)State->LastProcessId + (ULONG64)_UnZigZag(_GetVarint(&s)));
+		h->ThreadId = (HANDLE)(LONG_PTR)((ULONG64)State->LastThreadId + (ULONG64)_UnZigZag(_GetVarint(&s)));
+		value = _GetVarint(&s);
+		if (!_FieldWrite(&h->Flags, sizeof(h->Flags), value))
+			s.Error = TRUE;
+
+		h->Irql = _GetByte(&s);
+		value = _GetVarint(&s);
+		h->ResultType = (ERequestResultType)value;
+		if (value > rrtBOOLEAN)
+			s.Error = TRUE;
+
+		switch (h->ResultType) {
+			case rrtNTSTATUS:
+				value = _GetVarint(&s);
+				if (!_FieldWrite(&h->Result.NTSTATUSValue, sizeof(h->Result.NTSTATUSValue), value))
+					s.Error = TRUE;
+				break;
+			case rrtBOOLEAN:
+				h->Result.BOOLEANValue = _GetByte(&s);
+				break;
+			default:
+				value = _GetVarint(&s);
+				if (!_FieldWrite(&h->Result.Other, sizeof(h->Result.Other), value))
+					s.Error = TRUE;
+				break;
+		}
+
+		for (i = 0; i < t->FieldCount && !s.Error; ++i) {
+			f = t->Fields + i;
+			field = (unsigned char *)h + f->Offset;
+			for (j = 0; j < f->Count && !s.Error; ++j) {
+				if (f->Kind == rcfkPointer)
+					value = _GetPointer(&s, State, &pending);
+				else value = _GetVarint(&s);
+
+				if (!_FieldWrite(field, f->Size, value))
+					s.Error = TRUE;
+
+				field += f->Size;
+			}
+		}
+
+		dataSize = _GetVarint(&s);
+		if (!s.Error) {
+			if (dataSize <= (size_t)(s.End - s.Position)) {
+				// The length fields decoded above must describe exactly the trailing data.
+				if (RequestGetSize(h) == t->FixedSize + dataSize) {
+					ret = ERROR_VALUE_NOMEM;
+					tmpRequest = RequestMemoryAlloc((size_t)(t->FixedSize + dataSize));
+					if (tmpRequest != NULL) {
+#ifdef _KERNEL_MODE
+						// The memory flags must describe the new allocation.
+						h->Flags &= ~(REQUEST_FLAG_PAGED | REQUEST_FLAG_NONPAGED);
+						h->Flags |= (tmpRequest->Flags & (REQUEST_FLAG_PAGED | REQUEST_FLAG_NONPAGED));
+#endif
+						memcpy(tmpRequest, h, t->FixedSize);
+						memcpy((unsigned char *)tmpRequest + t->FixedSize, s.Position, (size_t)dataSize);
+						s.Position += dataSize;
+						_PendingApply(State, &pending);
+						State->LastId = h->Id;
+						State->LastTime = h->Time.QuadPart;
+						State->LastProcessId = (LONG_PTR)h->ProcessId;
+						State->LastThreadId = (LONG_PTR)h->ThreadId;
+						*Consumed = s.Position - (unsigned char *)Buffer;
+						*Request = tmpRequest;
+						ret = ERROR_VALUE_SUCCESS;
+					}
+				}
+			} else ret = ERROR_VALUE_BUFFER_TOO_SMALL;
+		} else if (s.Position == s.End) {
+			ret = ERROR_VALUE_BUFFER_TOO_SMALL;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,54 @@
+
+#ifndef __SHARED_REQUEST_CODEC_H__
+#define __SHARED_REQUEST_CODEC_H__
+
+/** Compact encoding of request records.
+ *
+ *  Every record starts with its type byte, followed by the header and the
+ *  type-specific fields, and ends with the length of the trailing data
+ *  and the data themselves. Integers are stored as LEB128 varints. The ID,
+ *  time, process ID and thread ID are stored as zigzag-encoded differences
+ *  from the previous record. Driver, device, file object and IRP addresses
+ *  go through a small direct-mapped dictionary of recently seen pointers,
+ *  so a repeated address usually takes one or two bytes.
+ *
+ *  The encoder and the decoder keep the same state, updated by every record,
+ *  so records must be decoded in the order they were encoded, starting with
+ *  freshly initialized states. After a decoding error the state is no
+ *  longer usable.
+ */
+
+#include "general-types.h"
+#include "request.h"
+
+
+
+/** Number of entries in the pointer dictionary. Must be a power of two not greater than 256. */
+#define REQUEST_CODEC_DICTIONARY_SIZE			256
+
+/** State shared by consecutive records of one encoded stream. */
+typedef struct _REQUEST_CODEC_STATE {
+	ULONG LastId;
+	LONG64 LastTime;
+	LONG64 LastProcessId;
+	LONG64 LastThreadId;
+	ULONG_PTR Dictionary[REQUEST_CODEC_DICTIONARY_SIZE];
+} REQUEST_CODEC_STATE, *PREQUEST_CODEC_STATE;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void RequestCodecInit(PREQUEST_CODEC_STATE State);
+size_t RequestCodecEncodedSizeMax(const REQUEST_HEADER *Request);
+ERROR_TYPE RequestCodecEncode(PREQUEST_CODEC_STATE State, const REQUEST_HEADER *Request, void *Buffer, size_t Length, size_t *Written);
+ERROR_TYPE RequestCodecDecode(PREQUEST_CODEC_STATE State, const void *Buffer, size_t Length, size_t *Consumed, PREQUEST_HEADER *Request);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
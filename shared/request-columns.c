@@ -0,0 +1,835 @@
+
+#include <windows.h>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+#include "request-log-view.h"
+#include "request-columns.h"
+
+
+
+/************************************************************************/
+/*                     TYPES AND MACROS                                 */
+/************************************************************************/
+
+
+/** Maps driver and device addresses to identifiers; open addressing with
+    linear probing, kept at most half full. */
+typedef struct _REQUEST_COLUMNS_DICTIONARY {
+	ULONG64 *Keys;
+	PULONG Ids;
+	size_t Capacity;
+	size_t Count;
+} REQUEST_COLUMNS_DICTIONARY, *PREQUEST_COLUMNS_DICTIONARY;
+
+struct _REQUEST_COLUMNS {
+	size_t Count;
+	size_t Capacity;
+	PULONG Data[rcMax];
+	REQUEST_COLUMNS_DICTIONARY Addresses;
+};
+
+typedef enum _ERequestColumnsTestKind {
+	rctkNever,
+	rctkAlways,
+	/** Lower <= value <= Lower + Range */
+	rctkRange,
+} ERequestColumnsTestKind, *PERequestColumnsTestKind;
+
+/** A condition translated to column comparisons. */
+typedef struct _REQUEST_COLUMNS_TEST {
+	ERequestColumnsTestKind Kind;
+	ERequestColumn Column;
+	ULONG Lower;
+	ULONG Range;
+	/** Type the condition applies to, erpUndefined for all types. */
+	ULONG RequestType;
+	/** Bit of the rcPresence column the row must have, zero if every
+	    request has the field. */
+	ULONG Presence;
+	ULONG Action;
+	BOOLEAN Negate;
+	BOOLEAN Disabled;
+} REQUEST_COLUMNS_TEST, *PREQUEST_COLUMNS_TEST;
+
+/** Sets bit i of Bits[i / 64] when ((Values[i] & Mask) - Lower) <= Range,
+    for Count values. */
+typedef void (REQUEST_COLUMNS_SCAN_ROUTINE)(const ULONG *Values, size_t Count, ULONG Lower, ULONG Range, ULONG Mask, PULONG64 Bits);
+
+/** Rows evaluated at once, the working bitmaps stay in the L1 cache. */
+#define RC_CHUNK_ROWS					4096
+#define RC_CHUNK_WORDS					(RC_CHUNK_ROWS / 64)
+#define RC_INITIAL_CAPACITY				1024
+
+#define _ColumnsAlloc(aSize)			HeapAlloc(GetProcessHeap(), 0, (aSize))
+#define _ColumnsReAlloc(aBuffer, aSize)	(((aBuffer) != NULL) ? HeapReAlloc(GetProcessHeap(), 0, (aBuffer), (aSize)) : HeapAlloc(GetProcessHeap(), 0, (aSize)))
+#define _ColumnsFree(aBuffer)			HeapFree(GetProcessHeap(), 0, (aBuffer))
+
+
+/************************************************************************/
+/*                     GLOBAL VARIABLES                                 */
+/************************************************************************/
+
+
+static REQUEST_COLUMNS_SCAN_ROUTINE *_scanRoutine = NULL;
+
+
+/************************************************************************/
+/*                     SCANNING                                         */
+/************************************************************************/
+
+
+static void _ScanScalar(const ULONG *Values, size_t Count, ULONG Lower, ULONG Range, ULONG Mask, PULONG64 Bits)
+{
+	size_t i = 0;
+	ULONG64 word = 0;
+
+	for (i = 0; i < Count; ++i) {
+		if (((Values[i] & Mask) - Lower) <= Range)
+			word |= ((ULONG64)1 << (i % 64));
+
+		if (i % 64 == 63) {
+			Bits[i / 64] = word;
+			word = 0;
+		}
+	}
+
+	if (Count % 64 != 0)
+		Bits[Count / 64] = word;
+
+	return;
+}
+
+
+#if defined(_M_X64) || defined(_M_IX86)
+
+/** Unsigned comparisons are done as signed ones with flipped sign bits.
+ *  Four vectors of "out of range" lanes are packed into 16 bytes so one
+ *  movemask yields the bits of 16 rows.
+ */
+static void _ScanSse2(const ULONG *Values, size_t Count, ULONG Lower, ULONG Range, ULONG Mask, PULONG64 Bits)
+{
+	size_t i = 0;
+	size_t j = 0;
+	size_t words = Count / 64;
+	ULONG64 word = 0;
+	__m128i a, b, c, d;
+	const __m128i *p = NULL;
+	const __m128i lower = _mm_set1_epi32((int)Lower);
+	const __m128i limit = _mm_set1_epi32((int)(Range ^ 0x80000000));
+	const __m128i sign = _mm_set1_epi32((int)0x80000000);
+	const __m128i mask = _mm_set1_epi32((int)Mask);
+
+	p = (const __m128i *)Values;
+	for (i = 0; i < words; ++i) {
+		word = 0;
+		for (j = 0; j < 4; ++j) {
+			a = _mm_cmpgt_epi32(_mm_xor_si128(_mm_sub_epi32(_mm_and_si128(_mm_loadu_si128(p), mask), lower), sign), limit);
+			b = _mm_cmpgt_epi32(_mm_xor_si128(_mm_sub_epi32(_mm_and_si128(_mm_loadu_si128(p + 1), mask), lower), sign), limit);
+			c = _mm_cmpgt_epi32(_mm_xor_si128(_mm_sub_epi32(_mm_and_si128(_mm_loadu_si128(p + 2), mask), lower), sign), limit);
+			d = _mm_cmpgt_epi32(_mm_xor_si128(_mm_sub_epi32(_mm_and_si128(_mm_loadu_si128(p + 3), mask), lower), sign), limit);
+			a = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+			word |= ((ULONG64)(USHORT)_mm_movemask_epi8(a) << (j * 16));
+			p += 4;
+		}
+
+		Bits[i] = ~word;
+	}
+
+	if (Count % 64 != 0)
+		_ScanScalar(Values + words * 64, Count % 64, Lower, Range, Mask, Bits + words);
+
+	return;
+}
+
+
+#if defined(_MSC_VER)
+#define RC_AVX2_ROUTINE
+#else
+#define RC_AVX2_ROUTINE					__attribute__((target("avx2")))
+#endif
+
+/** The packing works within 128-bit lanes, a permutation puts the rows
+ *  back in order before the movemask.
+ */
+static RC_AVX2_ROUTINE void _ScanAvx2(const ULONG *Values, size_t Count, ULONG Lower, ULONG Range, ULONG Mask, PULONG64 Bits)
+{
+	size_t i = 0;
+	size_t j = 0;
+	size_t words = Count / 64;
+	ULONG64 word = 0;
+	__m256i a, b, c, d;
+	const __m256i *p = NULL;
+	const __m256i lower = _mm256_set1_epi32((int)Lower);
+	const __m256i limit = _mm256_set1_epi32((int)(Range ^ 0x80000000));
+	const __m256i sign = _mm256_set1_epi32((int)0x80000000);
+	const __m256i mask = _mm256_set1_epi32((int)Mask);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	p = (const __m256i *)Values;
+	for (i = 0; i < words; ++i) {
+		word = 0;
+		for (j = 0; j < 2; ++j) {
+			a = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_sub_epi32(_mm256_and_si256(_mm256_loadu_si256(p), mask), lower), sign), limit);
+			b = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_sub_epi32(_mm256_and_si256(_mm256_loadu_si256(p + 1), mask), lower), sign), limit);
+			c = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_sub_epi32(_mm256_and_si256(_mm256_loadu_si256(p + 2), mask), lower), sign), limit);
+			d = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_sub_epi32(_mm256_and_si256(_mm256_loadu_si256(p + 3), mask), lower), sign), limit);
+			a = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+			a = _mm256_permutevar8x32_epi32(a, order);
+			word |= ((ULONG64)(ULONG)_mm256_movemask_epi8(a) << (j * 32));
+			p += 4;
+		}
+
+		Bits[i] = ~word;
+	}
+
+	if (Count % 64 != 0)
+		_ScanScalar(Values + words * 64, Count % 64, Lower, Range, Mask, Bits + words);
+
+	return;
+}
+
+
+static REQUEST_COLUMNS_SCAN_ROUTINE *_ScanSelect(void)
+{
+	int info[4];
+	REQUEST_COLUMNS_SCAN_ROUTINE *ret = _ScanScalar;
+
+	__cpuid(info, 0);
+	if (info[0] >= 1) {
+		__cpuid(info, 1);
+		// SSE2
+		if (info[3] & (1 << 26))
+			ret = _ScanSse2;
+
+		// AVX needs both the OSXSAVE and AVX bits and the OS
+		// saving the YMM registers.
+		if ((info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+			(_xgetbv(0) & 6) == 6) {
+			__cpuid(info, 0);
+			if (info[0] >= 7) {
+				__cpuidex(info, 7, 0);
+				if (info[1] & (1 << 5))
+					ret = _ScanAvx2;
+			}
+		}
+	}
+
+	return ret;
+}
+
+#else
+
+static REQUEST_COLUMNS_SCAN_ROUTINE *_ScanSelect(void)
+{
+	return _ScanScalar;
+}
+
+#endif
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+static ULONG _AddressHash(ULONG64 Address, size_t Capacity)
+{
+	return (ULONG)(((Address * 0x9E3779B97F4A7C15ULL) >> 32) & (Capacity - 1));
+}
+
+
+static BOOLEAN _AddressFind(const REQUEST_COLUMNS_DICTIONARY *Dictionary, ULONG64 Address, PULONG Id)
+{
+	size_t i = 0;
+	BOOLEAN ret = FALSE;
+
+	if (Address == 0) {
+		*Id = 0;
+		ret = TRUE;
+	} else if (Dictionary->Capacity > 0) {
+		i = _AddressHash(Address, Dictionary->Capacity);
+		while (Dictionary->Keys[i] != 0) {
+			if (Dictionary->Keys[i] == Address) {
+				*Id = Dictionary->Ids[i];
+				ret = TRUE;
+				break;
+			}
+
+			i = (i + 1) & (Dictionary->Capacity - 1);
+		}
+	}
+
+	return ret;
+}
+
+
+static ERROR_TYPE _AddressInsert(PREQUEST_COLUMNS_DICTIONARY Dictionary, ULONG64 Address, PULONG Id)
+{
+	size_t i = 0;
+	size_t j = 0;
+	size_t newCapacity = 0;
+	ULONG64 *newKeys = NULL;
+	PULONG newIds = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (!_AddressFind(Dictionary, Address, Id)) {
+		if ((Dictionary->Count + 1) * 2 > Dictionary->Capacity) {
+			newCapacity = (Dictionary->Capacity > 0) ? Dictionary->Capacity * 2 : 64;
+			newKeys = (ULONG64 *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, newCapacity*sizeof(ULONG64));
+			newIds = (PULONG)_ColumnsAlloc(newCapacity*sizeof(ULONG));
+			if (newKeys != NULL && newIds != NULL) {
+				for (i = 0; i < Dictionary->Capacity; ++i) {
+					if (Dictionary->Keys[i] != 0) {
+						j = _AddressHash(Dictionary->Keys[i], newCapacity);
+						while (newKeys[j] != 0)
+							j = (j + 1) & (newCapacity - 1);
+
+						newKeys[j] = Dictionary->Keys[i];
+						newIds[j] = Dictionary->Ids[i];
+					}
+				}
+
+				if (Dictionary->Capacity > 0) {
+					_ColumnsFree(Dictionary->Ids);
+					_ColumnsFree(Dictionary->Keys);
+				}
+
+				Dictionary->Keys = newKeys;
+				Dictionary->Ids = newIds;
+				Dictionary->Capacity = newCapacity;
+			} else {
+				ret = ERROR_VALUE_NOMEM;
+				if (newIds != NULL)
+					_ColumnsFree(newIds);
+
+				if (newKeys != NULL)
+					_ColumnsFree(newKeys);
+			}
+		}
+
+		if (ret == ERROR_VALUE_SUCCESS) {
+			i = _AddressHash(Address, Dictionary->Capacity);
+			while (Dictionary->Keys[i] != 0)
+				i = (i + 1) & (Dictionary->Capacity - 1);
+
+			++Dictionary->Count;
+			Dictionary->Keys[i] = Address;
+			Dictionary->Ids[i] = (ULONG)Dictionary->Count;
+			*Id = Dictionary->Ids[i];
+		}
+	}
+
+	return ret;
+}
+
+
+static ERROR_TYPE _ColumnsGrow(PREQUEST_COLUMNS Columns, size_t Capacity)
+{
+	size_t i = 0;
+	PULONG tmp = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	for (i = 0; i < rcMax; ++i) {
+		tmp = (PULONG)_ColumnsReAlloc(Columns->Data[i], Capacity*sizeof(ULONG));
+		if (tmp == NULL) {
+			ret = ERROR_VALUE_NOMEM;
+			break;
+		}
+
+		Columns->Data[i] = tmp;
+	}
+
+	// Columns that did grow are fine, they are just larger than needed.
+	if (ret == ERROR_VALUE_SUCCESS)
+		Columns->Capacity = Capacity;
+
+	return ret;
+}
+
+
+/** Returns the value of a type-specific field, FALSE if the request type
+    does not have it. */
+static BOOLEAN _TypedField(const REQUEST_HEADER *Request, ERequestFilterField Field, PULONG Value)
+{
+	const unsigned char *p = NULL;
+	REQUEST_FILTER_FIELD_LOCATION location;
+	BOOLEAN ret = FALSE;
+
+	*Value = 0;
+	ret = RequestFilterFieldLocation(Request->Type, Field, &location);
+	if (ret) {
+		p = (const unsigned char *)Request + location.Offset;
+		switch (location.Size) {
+			case sizeof(UCHAR):
+				*Value = *p;
+				break;
+			case sizeof(USHORT):
+				*Value = *(const USHORT *)p;
+				break;
+			default:
+				*Value = *(const ULONG *)p;
+				break;
+		}
+	}
+
+	return ret;
+}
+
+
+/** Translates a condition to a test. Returns ERROR_NOT_SUPPORTED for
+ *  conditions that cannot be evaluated over the columns.
+ */
+static ERROR_TYPE _TestCompile(const REQUEST_COLUMNS *Columns, const REQUEST_FILTER_CONDITION *Condition, PREQUEST_COLUMNS_TEST Test)
+{
+	ULONG id = 0;
+	ULONG64 lower = 0;
+	ULONG64 upper = 0;
+	BOOLEAN address = FALSE;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	memset(Test, 0, sizeof(REQUEST_COLUMNS_TEST));
+	Test->Kind = rctkNever;
+	Test->RequestType = Condition->RequestType;
+	Test->Action = Condition->Action;
+	Test->Negate = ((Condition->Flags & REQUEST_FILTER_CONDITION_NEGATE) != 0);
+	Test->Disabled = ((Condition->Flags & REQUEST_FILTER_CONDITION_DISABLED) != 0);
+	switch (Condition->Field) {
+		case rffType:
+			Test->Column = rcType;
+			break;
+		case rffMajor:
+			Test->Column = rcMajor;
+			break;
+		case rffMinor:
+			Test->Column = rcMinor;
+			break;
+		case rffProcessId:
+			Test->Column = rcProcessId;
+			break;
+		case rffThreadId:
+			Test->Column = rcThreadId;
+			break;
+		case rffResult:
+			Test->Column = rcResult;
+			break;
+		case rffDriver:
+			Test->Column = rcDriver;
+			address = TRUE;
+			break;
+		case rffDevice:
+			Test->Column = rcDevice;
+			address = TRUE;
+			break;
+		default:
+			// Disabled conditions never match, whatever they test.
+			if (!Test->Disabled)
+				ret = ERROR_NOT_SUPPORTED;
+			break;
+	}
+
+	if (ret == ERROR_VALUE_SUCCESS &&
+		(Condition->Field == rffMajor || Condition->Field == rffMinor || Condition->Field == rffResult))
+		Test->Presence = (1UL << Condition->Field);
+
+	if (ret == ERROR_VALUE_SUCCESS && !Test->Disabled && address) {
+		// Identifiers do not keep the order of the addresses.
+		switch (Condition->Operator) {
+			case rfoEquals:
+				if (_AddressFind(&Columns->Addresses, Condition->Value, &id)) {
+					Test->Kind = rctkRange;
+					Test->Lower = id;
+				}
+				break;
+			case rfoAlwaysTrue:
+				Test->Kind = rctkAlways;
+				break;
+			case rfoLowerEquals:
+			case rfoGreaterEquals:
+			case rfoLower:
+			case rfoGreater:
+			case rfoInRange:
+				ret = ERROR_NOT_SUPPORTED;
+				break;
+			default:
+				// Never matches, as in RequestFilterMatch.
+				break;
+		}
+	} else if (ret == ERROR_VALUE_SUCCESS && !Test->Disabled) {
+		// Only the ranges of the 32-bit values are compared, values beyond
+		// them are folded into constant tests.
+		lower = 1;
+		upper = 0;
+		switch (Condition->Operator) {
+			case rfoEquals:
+				lower = Condition->Value;
+				upper = Condition->Value;
+				break;
+			case rfoLowerEquals:
+				lower = 0;
+				upper = Condition->Value;
+				break;
+			case rfoGreaterEquals:
+				lower = Condition->Value;
+				upper = MAXULONG;
+				break;
+			case rfoLower:
+				if (Condition->Value > 0) {
+					lower = 0;
+					upper = Condition->Value - 1;
+				}
+				break;
+			case rfoGreater:
+				if (Condition->Value < MAXULONG) {
+					lower = Condition->Value + 1;
+					upper = MAXULONG;
+				}
+				break;
+			case rfoInRange:
+				lower = Condition->Value;
+				upper = Condition->ValueHigh;
+				break;
+			case rfoAlwaysTrue:
+				lower = 0;
+				upper = MAXULONG;
+				break;
+			default:
+				// Never matches, as in RequestFilterMatch.
+				break;
+		}
+
+		if (upper > MAXULONG)
+			upper = MAXULONG;
+
+		if (lower == 0 && upper == MAXULONG)
+			Test->Kind = rctkAlways;
+		else if (lower <= upper) {
+			Test->Kind = rctkRange;
+			Test->Lower = (ULONG)lower;
+			Test->Range = (ULONG)(upper - lower);
+		}
+	}
+
+	return ret;
+}
+
+
+/** ANDs the rows matching the test into Chain. Returns FALSE if no row of
+ *  the chain remains.
+ */
+static BOOLEAN _TestApply(const REQUEST_COLUMNS *Columns, const REQUEST_COLUMNS_TEST *Test, size_t Start, size_t Rows, PULONG64 Chain, PULONG64 Bits)
+{
+	size_t i = 0;
+	size_t words = (Rows + 63) / 64;
+	ULONG64 any = 0;
+
+	if (Test->Disabled || (Test->Kind == rctkAlways && Test->Negate) ||
+		(Test->Kind == rctkNever && !Test->Negate)) {
+		memset(Chain, 0, words*sizeof(ULONG64));
+	} else {
+		if (Test->RequestType != erpUndefined) {
+			_scanRoutine(Columns->Data[rcType] + Start, Rows, Test->RequestType, 0, MAXULONG, Bits);
+			for (i = 0; i < words; ++i)
+				Chain[i] &= Bits[i];
+		}
+
+		if (Test->Presence != 0) {
+			_scanRoutine(Columns->Data[rcPresence] + Start, Rows, Test->Presence, 0, Test->Presence, Bits);
+			for (i = 0; i < words; ++i)
+				Chain[i] &= Bits[i];
+		}
+
+		if (Test->Kind == rctkRange) {
+			_scanRoutine(Columns->Data[Test->Column] + Start, Rows, Test->Lower, Test->Range, MAXULONG, Bits);
+			if (Test->Negate) {
+				for (i = 0; i < words; ++i)
+					Chain[i] &= ~Bits[i];
+			} else {
+				for (i = 0; i < words; ++i)
+					Chain[i] &= Bits[i];
+			}
+		}
+	}
+
+	for (i = 0; i < words; ++i)
+		any |= Chain[i];
+
+	return (any != 0);
+}
+
+
+static size_t _BitCount(ULONG64 Value)
+{
+	Value = Value - ((Value >> 1) & 0x5555555555555555ULL);
+	Value = (Value & 0x3333333333333333ULL) + ((Value >> 2) & 0x3333333333333333ULL);
+	Value = (Value + (Value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+	return (size_t)((Value * 0x0101010101010101ULL) >> 56);
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+ERROR_TYPE RequestColumnsCreate(size_t Capacity, PREQUEST_COLUMNS *Columns)
+{
+	PREQUEST_COLUMNS tmpColumns = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (_scanRoutine == NULL)
+		_scanRoutine = _ScanSelect();
+
+	if (Capacity == 0)
+		Capacity = RC_INITIAL_CAPACITY;
+
+	tmpColumns = (PREQUEST_COLUMNS)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(REQUEST_COLUMNS));
+	if (tmpColumns != NULL) {
+		ret = _ColumnsGrow(tmpColumns, Capacity);
+		if (ret == ERROR_VALUE_SUCCESS)
+			*Columns = tmpColumns;
+		else RequestColumnsFree(tmpColumns);
+	} else ret = ERROR_VALUE_NOMEM;
+
+	return ret;
+}
+
+
+ERROR_TYPE RequestColumnsAppend(PREQUEST_COLUMNS Columns, const REQUEST_HEADER *Request)
+{
+	size_t i = 0;
+	ULONG presence = 0;
+	ULONG value = 0;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (Columns->Count == Columns->Capacity)
+		ret = _ColumnsGrow(Columns, Columns->Capacity * 2);
+
+	if (ret == ERROR_VALUE_SUCCESS) {
+		i = Columns->Count;
+		ret = _AddressInsert(&Columns->Addresses, (ULONG64)(ULONG_PTR)Request->Driver, Columns->Data[rcDriver] + i);
+		if (ret == ERROR_VALUE_SUCCESS)
+			ret = _AddressInsert(&Columns->Addresses, (ULONG64)(ULONG_PTR)Request->Device, Columns->Data[rcDevice] + i);
+	}
+
+	if (ret == ERROR_VALUE_SUCCESS) {
+		presence = (1UL << rffType) | (1UL << rffProcessId) | (1UL << rffThreadId) | (1UL << rffDriver) | (1UL << rffDevice);
+		Columns->Data[rcType][i] = Request->Type;
+		Columns->Data[rcProcessId][i] = (ULONG)(ULONG_PTR)Request->ProcessId;
+		Columns->Data[rcThreadId][i] = (ULONG)(ULONG_PTR)Request->ThreadId;
+		if (_TypedField(Request, rffMajor, &value))
+			presence |= (1UL << rffMajor);
+
+		Columns->Data[rcMajor][i] = value;
+		if (_TypedField(Request, rffMinor, &value))
+			presence |= (1UL << rffMinor);
+
+		Columns->Data[rcMinor][i] = value;
+		value = 0;
+		switch (Request->ResultType) {
+			case rrtNTSTATUS:
+				value = (ULONG)Request->Result.NTSTATUSValue;
+				presence |= (1UL << rffResult);
+				break;
+			case rrtBOOLEAN:
+				value = Request->Result.BOOLEANValue;
+				presence |= (1UL << rffResult);
+				break;
+			default:
+				break;
+		}
+
+		Columns->Data[rcResult][i] = value;
+		Columns->Data[rcPresence][i] = presence;
+		++Columns->Count;
+	}
+
+	return ret;
+}
+
+
+/** Appends all records of a flat log. */
+ERROR_TYPE RequestColumnsAppendView(PREQUEST_COLUMNS Columns, const REQUEST_LOG_VIEW *View)
+{
+	const REQUEST_HEADER *r = NULL;
+	REQUEST_LOG_VIEW_CURSOR cursor;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	ret = RequestLogViewSeek(View, 0, &cursor);
+	if (ret == ERROR_VALUE_SUCCESS) {
+		r = RequestLogViewNext(View, &cursor);
+		while (ret == ERROR_VALUE_SUCCESS && r != NULL) {
+			ret = RequestColumnsAppend(Columns, r);
+			r = RequestLogViewNext(View, &cursor);
+		}
+	}
+
+	return ret;
+}
+
+
+size_t RequestColumnsCount(const REQUEST_COLUMNS *Columns)
+{
+	return Columns->Count;
+}
+
+
+const ULONG *RequestColumnsData(const REQUEST_COLUMNS *Columns, ERequestColumn Column)
+{
+	return Columns->Data[Column];
+}
+
+
+/** Removes all rows, the memory and address identifiers are kept. */
+void RequestColumnsClear(PREQUEST_COLUMNS Columns)
+{
+	Columns->Count = 0;
+
+	return;
+}
+
+
+void RequestColumnsFree(PREQUEST_COLUMNS Columns)
+{
+	size_t i = 0;
+
+	if (Columns->Addresses.Capacity > 0) {
+		_ColumnsFree(Columns->Addresses.Ids);
+		_ColumnsFree(Columns->Addresses.Keys);
+	}
+
+	for (i = 0; i < rcMax; ++i) {
+		if (Columns->Data[i] != NULL)
+			_ColumnsFree(Columns->Data[i]);
+	}
+
+	_ColumnsFree(Columns);
+
+	return;
+}
+
+
+/** Evaluates a filter over a range of rows.
+ *
+ *  @param Start Index of the first row.
+ *  @param Count Number of rows to evaluate.
+ *  @param Bitmap Receives (Count + 63) / 64 words, bit i % 64 of word i / 64
+ *  is set if row Start + i passes the filter.
+ *  @param Selected Optionally receives the number of rows passing the filter.
+ *
+ *  @return
+ *  ERROR_NOT_SUPPORTED is returned when the filter tests fields that
+ *  have no column.
+ */
+ERROR_TYPE RequestColumnsFilter(const REQUEST_COLUMNS *Columns, const REQUEST_FILTER_HEADER *Filter, size_t Start, size_t Count, PULONG64 Bitmap, size_t *Selected)
+{
+	ULONG i = 0;
+	size_t w = 0;
+	size_t base = 0;
+	size_t rows = 0;
+	size_t words = 0;
+	size_t selected = 0;
+	BOOLEAN allInclusive = TRUE;
+	BOOLEAN allExclusive = TRUE;
+	BOOLEAN fallback = FALSE;
+	BOOLEAN chainStart = TRUE;
+	BOOLEAN chainLive = FALSE;
+	BOOLEAN undecided = FALSE;
+	PREQUEST_COLUMNS_TEST tests = NULL;
+	const REQUEST_FILTER_CONDITION *c = NULL;
+	ULONG64 left[RC_CHUNK_WORDS];
+	ULONG64 result[RC_CHUNK_WORDS];
+	ULONG64 chain[RC_CHUNK_WORDS];
+	ULONG64 bits[RC_CHUNK_WORDS];
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (Start <= Columns->Count && Count <= Columns->Count - Start) {
+		if (Filter->ConditionCount > 0) {
+			tests = (PREQUEST_COLUMNS_TEST)_ColumnsAlloc(Filter->ConditionCount*sizeof(REQUEST_COLUMNS_TEST));
+			if (tests == NULL)
+				ret = ERROR_VALUE_NOMEM;
+		}
+
+		c = (const REQUEST_FILTER_CONDITION *)(Filter + 1);
+		for (i = 0; i < Filter->ConditionCount && ret == ERROR_VALUE_SUCCESS; ++i) {
+			if (c->Action == rfaInclude)
+				allExclusive = FALSE;
+			else if (c->Action == rfaExclude)
+				allInclusive = FALSE;
+
+			ret = _TestCompile(Columns, c, tests + i);
+			c = (const REQUEST_FILTER_CONDITION *)((const unsigned char *)c + c->Size);
+		}
+
+		// The decision for rows no chain decides, as in RequestFilterMatch.
+		fallback = (Filter->ConditionCount == 0);
+		if (allInclusive)
+			fallback = FALSE;
+
+		if (allExclusive)
+			fallback = TRUE;
+
+		for (base = 0; base < Count && ret == ERROR_VALUE_SUCCESS; base += RC_CHUNK_ROWS) {
+			rows = Count - base;
+			if (rows > RC_CHUNK_ROWS)
+				rows = RC_CHUNK_ROWS;
+
+			words = (rows + 63) / 64;
+			for (w = 0; w < words; ++w) {
+				left[w] = ~(ULONG64)0;
+				result[w] = 0;
+			}
+
+			if (rows % 64 != 0)
+				left[words - 1] = ((ULONG64)1 << (rows % 64)) - 1;
+
+			chainStart = TRUE;
+			undecided = TRUE;
+			for (i = 0; i < Filter->ConditionCount && undecided; ++i) {
+				if (chainStart) {
+					memcpy(chain, left, words*sizeof(ULONG64));
+					chainLive = TRUE;
+				}
+
+				if (chainLive)
+					chainLive = _TestApply(Columns, tests + i, Start + base, rows, chain, bits);
+
+				chainStart = (tests[i].Action != rfaPass);
+				if (chainLive && (tests[i].Action == rfaInclude || tests[i].Action == rfaExclude)) {
+					undecided = FALSE;
+					for (w = 0; w < words; ++w) {
+						if (tests[i].Action == rfaInclude)
+							result[w] |= chain[w];
+
+						left[w] &= ~chain[w];
+						if (left[w] != 0)
+							undecided = TRUE;
+					}
+				}
+			}
+
+			for (w = 0; w < words; ++w) {
+				if (fallback)
+					result[w] |= left[w];
+
+				Bitmap[base / 64 + w] = result[w];
+				selected += _BitCount(result[w]);
+			}
+		}
+
+		if (ret == ERROR_VALUE_SUCCESS && Selected != NULL)
+			*Selected = selected;
+
+		if (tests != NULL)
+			_ColumnsFree(tests);
+	} else ret = ERROR_VALUE_INVAL;
+
+	return ret;
+}
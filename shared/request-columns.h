@@ -0,0 +1,65 @@
+
+#ifndef __SHARED_REQUEST_COLUMNS_H__
+#define __SHARED_REQUEST_COLUMNS_H__
+
+/** Columnar copies of requests.
+ *
+ *  A column store keeps the fields filters test most often in separate arrays
+ *  of 32-bit values, one element (row) per request, so a filter can be
+ *  evaluated over thousands of requests at once with SIMD comparisons. The
+ *  requests themselves are not kept, the caller relates rows to its requests
+ *  by their order. Driver and device addresses are replaced by identifiers
+ *  assigned in the order the addresses are seen (NULL gets zero), process and
+ *  thread IDs are stored in 32 bits.
+ *
+ *  RequestColumnsFilter sets a bit for every row that passes a filter in the
+ *  request-filter.h format, with the same decisions RequestFilterMatch makes.
+ *  Filters testing fields without a column, or comparing driver and device
+ *  addresses other than for equality, are refused with ERROR_NOT_SUPPORTED;
+ *  the caller then matches the requests one by one.
+ */
+
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+#include "request-log-view.h"
+
+
+
+typedef enum _ERequestColumn {
+	rcType,
+	rcMajor,
+	rcMinor,
+	rcProcessId,
+	rcThreadId,
+	rcResult,
+	rcDriver,
+	rcDevice,
+	/** Bit (1 << ERequestFilterField) is set when the request has the field. */
+	rcPresence,
+	rcMax,
+} ERequestColumn, *PERequestColumn;
+
+typedef struct _REQUEST_COLUMNS REQUEST_COLUMNS, *PREQUEST_COLUMNS;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ERROR_TYPE RequestColumnsCreate(size_t Capacity, PREQUEST_COLUMNS *Columns);
+ERROR_TYPE RequestColumnsAppend(PREQUEST_COLUMNS Columns, const REQUEST_HEADER *Request);
+ERROR_TYPE RequestColumnsAppendView(PREQUEST_COLUMNS Columns, const REQUEST_LOG_VIEW *View);
+size_t RequestColumnsCount(const REQUEST_COLUMNS *Columns);
+const ULONG *RequestColumnsData(const REQUEST_COLUMNS *Columns, ERequestColumn Column);
+void RequestColumnsClear(PREQUEST_COLUMNS Columns);
+void RequestColumnsFree(PREQUEST_COLUMNS Columns);
+ERROR_TYPE RequestColumnsFilter(const REQUEST_COLUMNS *Columns, const REQUEST_FILTER_HEADER *Filter, size_t Start, size_t Count, PULONG64 Bitmap, size_t *Selected);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
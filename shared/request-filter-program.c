@@ -0,0 +1,530 @@
+
+#include <windows.h>
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+#include "request-filter-program.h"
+
+
+
+/************************************************************************/
+/*                     TYPES AND MACROS                                 */
+/************************************************************************/
+
+
+/** Instructions of compiled filters. Loads place a value into the register
+ *  of the program, comparisons test it. An instruction that fails a test
+ *  jumps to its Target, all jumps lead forward.
+ */
+typedef enum _ERequestFilterOpcode {
+	/** Fails unless the request is of the Value type. */
+	rfopType,
+	/** Load fields stored at Offset in requests of any type. */
+	rfopLoad8,
+	rfopLoad16,
+	rfopLoad32,
+	rfopLoad64,
+	/** Loads 1 if any of the Value bits is set in the USHORT at Offset. */
+	rfopLoadFlag,
+	/** Loads a field found in the Offset table of type-specific locations.
+	    Fails if the request type does not have the field. */
+	rfopLoadTyped,
+	/** Fails if the request has no result. */
+	rfopLoadResult,
+	/** Fails if the file name is not known. */
+	rfopLoadName,
+	/** Integer comparisons, fail if the result equals Negate. */
+	rfopEquals,
+	rfopLowerEquals,
+	rfopGreaterEquals,
+	rfopLower,
+	rfopGreater,
+	rfopInRange,
+	/** String comparisons with the loaded name, Value is the offset
+	    of the pattern in the string area, ValueHigh its length. */
+	rfopStringEquals,
+	rfopContains,
+	rfopBegins,
+	rfopEnds,
+	/** Returns Value. */
+	rfopDecide,
+} ERequestFilterOpcode, *PERequestFilterOpcode;
+
+typedef struct _REQUEST_FILTER_INSTRUCTION {
+	UCHAR Opcode;
+	BOOLEAN Negate;
+	USHORT Offset;
+	ULONG Target;
+	ULONG64 Value;
+	ULONG64 ValueHigh;
+} REQUEST_FILTER_INSTRUCTION, *PREQUEST_FILTER_INSTRUCTION;
+
+struct _REQUEST_FILTER_PROGRAM {
+	REQUEST_FILTER_NAME_ROUTINE *NameRoutine;
+	void *Context;
+	ULONG InstructionCount;
+	ULONG TableCount;
+	PREQUEST_FILTER_INSTRUCTION Instructions;
+	/** Tables of REQUEST_TYPE_COUNT field locations, indexed by the request
+	    type. Types without the field have zero sizes. */
+	PREQUEST_FILTER_FIELD_LOCATION Tables;
+	wchar_t *Strings;
+};
+
+typedef struct _REQUEST_FILTER_COMPILER {
+	PREQUEST_FILTER_PROGRAM Program;
+	size_t StringCount;
+	/** Type checked by the chain being compiled, erpUndefined if none. */
+	ERequesttype ChainType;
+} REQUEST_FILTER_COMPILER, *PREQUEST_FILTER_COMPILER;
+
+#define _ConditionString(aCondition)	((const wchar_t *)((aCondition) + 1))
+#define _ConditionNext(aCondition)		((const REQUEST_FILTER_CONDITION *)((const unsigned char *)(aCondition) + (aCondition)->Size))
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+static PREQUEST_FILTER_INSTRUCTION _Emit(PREQUEST_FILTER_COMPILER Compiler, ERequestFilterOpcode Opcode)
+{
+	PREQUEST_FILTER_INSTRUCTION ret = NULL;
+
+	ret = Compiler->Program->Instructions + Compiler->Program->InstructionCount;
+	memset(ret, 0, sizeof(REQUEST_FILTER_INSTRUCTION));
+	ret->Opcode = (UCHAR)Opcode;
+	++Compiler->Program->InstructionCount;
+
+	return ret;
+}
+
+
+static void _EmitLoad(PREQUEST_FILTER_COMPILER Compiler, const REQUEST_FILTER_FIELD_LOCATION *Location)
+{
+	PREQUEST_FILTER_INSTRUCTION i = NULL;
+
+	if (Location->Mask != 0) {
+		i = _Emit(Compiler, rfopLoadFlag);
+		i->Value = Location->Mask;
+	} else {
+		switch (Location->Size) {
+			case sizeof(UCHAR):
+				i = _Emit(Compiler, rfopLoad8);
+				break;
+			case sizeof(USHORT):
+				i = _Emit(Compiler, rfopLoad16);
+				break;
+			case sizeof(ULONG):
+				i = _Emit(Compiler, rfopLoad32);
+				break;
+			default:
+				i = _Emit(Compiler, rfopLoad64);
+				break;
+		}
+	}
+
+	i->Offset = Location->Offset;
+
+	return;
+}
+
+
+/** Compiles one member of a chain. Returns FALSE if the member can never
+ *  match, and so neither can the chain.
+ */
+static BOOLEAN _CompileCondition(PREQUEST_FILTER_COMPILER Compiler, const REQUEST_FILTER_CONDITION *Condition)
+{
+	ULONG t = 0;
+	BOOLEAN negate = FALSE;
+	BOOLEAN compare = TRUE;
+	BOOLEAN stringOperator = FALSE;
+	BOOLEAN integerOperator = FALSE;
+	REQUEST_FILTER_FIELD_LOCATION location;
+	PREQUEST_FILTER_FIELD_LOCATION table = NULL;
+	PREQUEST_FILTER_INSTRUCTION i = NULL;
+	PREQUEST_FILTER_PROGRAM p = Compiler->Program;
+	ERequestFilterField field = (ERequestFilterField)Condition->Field;
+	BOOLEAN ret = TRUE;
+
+	negate = ((Condition->Flags & REQUEST_FILTER_CONDITION_NEGATE) != 0);
+	ret = ((Condition->Flags & REQUEST_FILTER_CONDITION_DISABLED) == 0);
+	if (ret && Condition->RequestType != erpUndefined) {
+		if (Compiler->ChainType == erpUndefined) {
+			i = _Emit(Compiler, rfopType);
+			i->Value = Condition->RequestType;
+			Compiler->ChainType = (ERequesttype)Condition->RequestType;
+		} else ret = (Compiler->ChainType == (ERequesttype)Condition->RequestType);
+	}
+
+	if (ret) {
+		switch (Condition->Operator) {
+			case rfoEquals:
+				stringOperator = TRUE;
+				integerOperator = TRUE;
+				break;
+			case rfoContains:
+			case rfoBegins:
+			case rfoEnds:
+				stringOperator = TRUE;
+				break;
+			case rfoAlwaysTrue:
+				compare = FALSE;
+				break;
+			default:
+				integerOperator = TRUE;
+				break;
+		}
+
+		// An operator the field does not support never matches, negated
+		// it matches whenever the field is present.
+		if ((field == rffFileName && compare && !stringOperator) ||
+			(field != rffFileName && compare && !integerOperator)) {
+			ret = negate;
+			compare = FALSE;
+		} else if (!compare)
+			ret = !negate;
+	}
+
+	if (ret) {
+		if (field == rffFileName)
+			_Emit(Compiler, rfopLoadName);
+		else if (field == rffResult)
+			_Emit(Compiler, rfopLoadResult);
+		else if (RequestFilterFieldLocation(Compiler->ChainType, field, &location)) {
+			// The field is always present, load it only to compare it.
+			if (compare)
+				_EmitLoad(Compiler, &location);
+		} else if (Compiler->ChainType == erpUndefined) {
+			ret = FALSE;
+			table = p->Tables + p->TableCount*REQUEST_TYPE_COUNT;
+			memset(table, 0, REQUEST_TYPE_COUNT*sizeof(REQUEST_FILTER_FIELD_LOCATION));
+			for (t = 0; t < REQUEST_TYPE_COUNT; ++t) {
+				if (RequestFilterFieldLocation((ERequesttype)t, field, table + t))
+					ret = TRUE;
+			}
+
+			if (ret) {
+				i = _Emit(Compiler, rfopLoadTyped);
+				i->Offset = (USHORT)p->TableCount;
+				++p->TableCount;
+			}
+		} else ret = FALSE;
+	}
+
+	if (ret && compare) {
+		if (field == rffFileName) {
+			switch (Condition->Operator) {
+				case rfoEquals:
+					i = _Emit(Compiler, rfopStringEquals);
+					break;
+				case rfoContains:
+					i = _Emit(Compiler, rfopContains);
+					break;
+				case rfoBegins:
+					i = _Emit(Compiler, rfopBegins);
+					break;
+				default:
+					i = _Emit(Compiler, rfopEnds);
+					break;
+			}
+
+			i->Value = Compiler->StringCount;
+			i->ValueHigh = Condition->StringLength;
+			memcpy(p->Strings + Compiler->StringCount, _ConditionString(Condition), Condition->StringLength*sizeof(wchar_t));
+			Compiler->StringCount += Condition->StringLength;
+		} else {
+			i = _Emit(Compiler, (ERequestFilterOpcode)(rfopEquals + Condition->Operator - rfoEquals));
+			if (Condition->Operator == rfoInRange)
+				i->Opcode = rfopInRange;
+
+			i->Value = Condition->Value;
+			i->ValueHigh = Condition->ValueHigh;
+		}
+
+		i->Negate = negate;
+	}
+
+	return ret;
+}
+
+
+static ULONG64 _Load(const unsigned char *Request, const REQUEST_FILTER_FIELD_LOCATION *Location)
+{
+	ULONG64 ret = 0;
+
+	switch (Location->Size) {
+		case sizeof(UCHAR):
+			ret = Request[Location->Offset];
+			break;
+		case sizeof(USHORT):
+			ret = *(const USHORT *)(Request + Location->Offset);
+			break;
+		case sizeof(ULONG):
+			ret = *(const ULONG *)(Request + Location->Offset);
+			break;
+		default:
+			ret = *(const ULONG64 *)(Request + Location->Offset);
+			break;
+	}
+
+	if (Location->Mask != 0)
+		ret = ((ret & Location->Mask) != 0);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** Compiles a filter prepared by RequestFilterPrepare (or built by
+ *  RequestFilterCreate and RequestFilterAddCondition).
+ *
+ *  @param NameRoutine Optional, retrieves file names of requests that do not
+ *  carry them when the program runs.
+ */
+ERROR_TYPE RequestFilterProgramCompile(const REQUEST_FILTER_HEADER *Filter, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, PREQUEST_FILTER_PROGRAM *Program)
+{
+	ULONG i = 0;
+	ULONG j = 0;
+	ULONG chainStart = 0;
+	ULONG tableStart = 0;
+	size_t stringStart = 0;
+	size_t size = 0;
+	BOOLEAN allInclusive = TRUE;
+	BOOLEAN allExclusive = TRUE;
+	BOOLEAN matchAll = FALSE;
+	BOOLEAN chainMatch = FALSE;
+	BOOLEAN unconditional = FALSE;
+	const REQUEST_FILTER_CONDITION *c = NULL;
+	const REQUEST_FILTER_CONDITION *last = NULL;
+	REQUEST_FILTER_COMPILER compiler;
+	PREQUEST_FILTER_INSTRUCTION instruction = NULL;
+	PREQUEST_FILTER_PROGRAM tmpProgram = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	if (Filter->Prepared) {
+		// Every condition needs at most a type test, a load and
+		// a comparison, every chain a decision.
+		size = sizeof(REQUEST_FILTER_PROGRAM) +
+			(Filter->ConditionCount*4 + 1)*sizeof(REQUEST_FILTER_INSTRUCTION) +
+			Filter->ConditionCount*REQUEST_TYPE_COUNT*sizeof(REQUEST_FILTER_FIELD_LOCATION) +
+			Filter->Size;
+		tmpProgram = (PREQUEST_FILTER_PROGRAM)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size);
+		if (tmpProgram != NULL) {
+			tmpProgram->NameRoutine = NameRoutine;
+			tmpProgram->Context = Context;
+			tmpProgram->Instructions = (PREQUEST_FILTER_INSTRUCTION)(tmpProgram + 1);
+			tmpProgram->Tables = (PREQUEST_FILTER_FIELD_LOCATION)(tmpProgram->Instructions + Filter->ConditionCount*4 + 1);
+			tmpProgram->Strings = (wchar_t *)(tmpProgram->Tables + Filter->ConditionCount*REQUEST_TYPE_COUNT);
+			memset(&compiler, 0, sizeof(compiler));
+			compiler.Program = tmpProgram;
+			c = (const REQUEST_FILTER_CONDITION *)(Filter + 1);
+			for (i = 0; i < Filter->ConditionCount; ++i) {
+				if (c->Action == rfaInclude)
+					allExclusive = FALSE;
+				else if (c->Action == rfaExclude)
+					allInclusive = FALSE;
+
+				c = _ConditionNext(c);
+			}
+
+			matchAll = (Filter->ConditionCount == 0);
+			if (allInclusive)
+				matchAll = FALSE;
+
+			if (allExclusive)
+				matchAll = TRUE;
+
+			i = 0;
+			c = (const REQUEST_FILTER_CONDITION *)(Filter + 1);
+			while (i < Filter->ConditionCount && !unconditional) {
+				chainStart = tmpProgram->InstructionCount;
+				tableStart = tmpProgram->TableCount;
+				stringStart = compiler.StringCount;
+				compiler.ChainType = erpUndefined;
+				chainMatch = TRUE;
+				do {
+					if (chainMatch)
+						chainMatch = _CompileCondition(&compiler, c);
+
+					last = c;
+					c = _ConditionNext(c);
+					++i;
+				} while (i < Filter->ConditionCount && last->Action == rfaPass);
+
+				if (chainMatch && (last->Action == rfaInclude || last->Action == rfaExclude)) {
+					// Nothing to test, the chain always decides and the rest
+					// of the filter is never reached.
+					unconditional = (tmpProgram->InstructionCount == chainStart);
+					instruction = _Emit(&compiler, rfopDecide);
+					instruction->Value = (last->Action == rfaInclude);
+					for (j = chainStart; j < tmpProgram->InstructionCount; ++j)
+						tmpProgram->Instructions[j].Target = tmpProgram->InstructionCount;
+				} else {
+					tmpProgram->InstructionCount = chainStart;
+					tmpProgram->TableCount = tableStart;
+					compiler.StringCount = stringStart;
+				}
+			}
+
+			if (!unconditional) {
+				instruction = _Emit(&compiler, rfopDecide);
+				instruction->Value = matchAll;
+			}
+
+			*Program = tmpProgram;
+			ret = ERROR_VALUE_SUCCESS;
+		} else ret = ERROR_VALUE_NOMEM;
+	}
+
+	return ret;
+}
+
+
+/** Decides whether a request passes the filter the program was compiled
+ *  from.
+ */
+BOOLEAN RequestFilterProgramRun(const REQUEST_FILTER_PROGRAM *Program, const REQUEST_HEADER *Request)
+{
+	ULONG64 value = 0;
+	size_t nameLength = 0;
+	const wchar_t *name = NULL;
+	BOOLEAN nameLoaded = FALSE;
+	BOOLEAN nameKnown = FALSE;
+	BOOLEAN test = FALSE;
+	BOOLEAN done = FALSE;
+	const REQUEST_FILTER_FIELD_LOCATION *l = NULL;
+	const unsigned char *r = (const unsigned char *)Request;
+	const REQUEST_FILTER_INSTRUCTION *i = Program->Instructions;
+	BOOLEAN ret = FALSE;
+
+	while (!done) {
+		test = TRUE;
+		switch (i->Opcode) {
+			case rfopType:
+				test = ((ULONG)Request->Type == i->Value);
+				break;
+			case rfopLoad8:
+				value = r[i->Offset];
+				break;
+			case rfopLoad16:
+				value = *(const USHORT *)(r + i->Offset);
+				break;
+			case rfopLoad32:
+				value = *(const ULONG *)(r + i->Offset);
+				break;
+			case rfopLoad64:
+				value = *(const ULONG64 *)(r + i->Offset);
+				break;
+			case rfopLoadFlag:
+				value = ((*(const USHORT *)(r + i->Offset) & i->Value) != 0);
+				break;
+			case rfopLoadTyped:
+				test = ((ULONG)Request->Type < REQUEST_TYPE_COUNT);
+				if (test) {
+					l = Program->Tables + i->Offset*REQUEST_TYPE_COUNT + Request->Type;
+					test = (l->Size != 0);
+					if (test)
+						value = _Load(r, l);
+				}
+				break;
+			case rfopLoadResult:
+				switch (Request->ResultType) {
+					case rrtNTSTATUS:
+						value = (ULONG)Request->Result.NTSTATUSValue;
+						break;
+					case rrtBOOLEAN:
+						value = Request->Result.BOOLEANValue;
+						break;
+					default:
+						test = FALSE;
+						break;
+				}
+				break;
+			case rfopLoadName:
+				// Several conditions may test the name, look it up once.
+				if (!nameLoaded) {
+					nameKnown = RequestFilterNameField(Request, Program->NameRoutine, Program->Context, &name, &nameLength);
+					nameLoaded = TRUE;
+				}
+
+				test = nameKnown;
+				break;
+			case rfopEquals:
+				test = ((value == i->Value) != i->Negate);
+				break;
+			case rfopLowerEquals:
+				test = ((value <= i->Value) != i->Negate);
+				break;
+			case rfopGreaterEquals:
+				test = ((value >= i->Value) != i->Negate);
+				break;
+			case rfopLower:
+				test = ((value < i->Value) != i->Negate);
+				break;
+			case rfopGreater:
+				test = ((value > i->Value) != i->Negate);
+				break;
+			case rfopInRange:
+				test = ((value >= i->Value && value <= i->ValueHigh) != i->Negate);
+				break;
+			case rfopStringEquals:
+				test = (RequestFilterStringMatch(rfoEquals, name, nameLength, Program->Strings + i->Value, (size_t)i->ValueHigh) != i->Negate);
+				break;
+			case rfopContains:
+				test = (RequestFilterStringMatch(rfoContains, name, nameLength, Program->Strings + i->Value, (size_t)i->ValueHigh) != i->Negate);
+				break;
+			case rfopBegins:
+				test = (RequestFilterStringMatch(rfoBegins, name, nameLength, Program->Strings + i->Value, (size_t)i->ValueHigh) != i->Negate);
+				break;
+			case rfopEnds:
+				test = (RequestFilterStringMatch(rfoEnds, name, nameLength, Program->Strings + i->Value, (size_t)i->ValueHigh) != i->Negate);
+				break;
+			case rfopDecide:
+				ret = (BOOLEAN)i->Value;
+				done = TRUE;
+				break;
+		}
+
+		if (test)
+			++i;
+		else i = Program->Instructions + i->Target;
+	}
+
+	return ret;
+}
+
+
+/** Runs the program for an array of requests.
+ *
+ *  @param Results Receives the decision for each request.
+ *
+ *  @return
+ *  Returns the number of requests that pass the filter.
+ */
+size_t RequestFilterProgramRunBatch(const REQUEST_FILTER_PROGRAM *Program, const REQUEST_HEADER * const *Requests, size_t Count, PBOOLEAN Results)
+{
+	size_t i = 0;
+	size_t ret = 0;
+
+	for (i = 0; i < Count; ++i) {
+		Results[i] = RequestFilterProgramRun(Program, Requests[i]);
+		if (Results[i])
+			++ret;
+	}
+
+	return ret;
+}
+
+
+void RequestFilterProgramFree(PREQUEST_FILTER_PROGRAM Program)
+{
+	HeapFree(GetProcessHeap(), 0, Program);
+
+	return;
+}
@@ -0,0 +1,42 @@
+
+#ifndef __SHARED_REQUEST_FILTER_PROGRAM_H__
+#define __SHARED_REQUEST_FILTER_PROGRAM_H__
+
+/** Compiled request filters.
+ *
+ *  A filter in the request-filter.h format is translated into a flat array
+ *  of instructions. Every chain becomes a run of loads and comparisons that
+ *  jump past the chain when a test fails, followed by an instruction that
+ *  decides. The locations of fields are resolved during the compilation,
+ *  chains that can never match or decide are left out and the evaluation
+ *  stops at the first chain that decides unconditionally.
+ *
+ *  The program decides exactly as RequestFilterMatch does with the filter
+ *  it was compiled from.
+ */
+
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+
+
+
+typedef struct _REQUEST_FILTER_PROGRAM REQUEST_FILTER_PROGRAM, *PREQUEST_FILTER_PROGRAM;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ERROR_TYPE RequestFilterProgramCompile(const REQUEST_FILTER_HEADER *Filter, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, PREQUEST_FILTER_PROGRAM *Program);
+BOOLEAN RequestFilterProgramRun(const REQUEST_FILTER_PROGRAM *Program, const REQUEST_HEADER *Request);
+size_t RequestFilterProgramRunBatch(const REQUEST_FILTER_PROGRAM *Program, const REQUEST_HEADER * const *Requests, size_t Count, PBOOLEAN Results);
+void RequestFilterProgramFree(PREQUEST_FILTER_PROGRAM Program);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
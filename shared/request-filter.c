@@ -0,0 +1,972 @@
+
+#ifdef _KERNEL_MODE
+#include <ntifs.h>
+#include "preprocessor.h"
+#include "allocator.h"
+#else
+#include <windows.h>
+#include <wctype.h>
+#endif
+#include <stddef.h>
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+
+
+
+/************************************************************************/
+/*                     TYPES AND MACROS                                 */
+/************************************************************************/
+
+
+#ifdef _KERNEL_MODE
+
+/** Number of characters sharing one block of the upcase table. */
+#define RF_UPCASE_BLOCK					0x100
+#define RF_UPCASE_BLOCK_COUNT			(0x10000 / RF_UPCASE_BLOCK)
+
+#else
+#define _Upcase(aChar)					((wchar_t)towupper(aChar))
+#endif
+
+#define _ConditionString(aCondition)	((wchar_t *)((aCondition) + 1))
+#define _ConditionNext(aCondition)		((PREQUEST_FILTER_CONDITION)((unsigned char *)(aCondition) + (aCondition)->Size))
+#define _ConditionSize(aLength)			((sizeof(REQUEST_FILTER_CONDITION) + (aLength)*sizeof(wchar_t) + 7) & ~(size_t)7)
+
+
+/************************************************************************/
+/*                     FIELD DESCRIPTIONS                               */
+/************************************************************************/
+
+
+typedef struct _REQUEST_FILTER_FIELD {
+	ERequestFilterField Field;
+	REQUEST_FILTER_FIELD_LOCATION Location;
+} REQUEST_FILTER_FIELD, *PREQUEST_FILTER_FIELD;
+
+#define RF_FIELD_SIZE(aType, aMember)				sizeof(((aType *)0)->aMember)
+#define RF_FIELD(aField, aType, aMember)			{aField, {offsetof(aType, aMember), RF_FIELD_SIZE(aType, aMember), 0}}
+#define RF_FLAG(aField, aMask)						{aField, {offsetof(REQUEST_HEADER, Flags), RF_FIELD_SIZE(REQUEST_HEADER, Flags), aMask}}
+
+static const REQUEST_FILTER_FIELD _headerFields[] = {
+	RF_FIELD(rffType, REQUEST_HEADER, Type),
+	RF_FIELD(rffId, REQUEST_HEADER, Id),
+	RF_FIELD(rffTime, REQUEST_HEADER, Time),
+	RF_FIELD(rffDriver, REQUEST_HEADER, Driver),
+	RF_FIELD(rffDevice, REQUEST_HEADER, Device),
+	RF_FIELD(rffProcessId, REQUEST_HEADER, ProcessId),
+	RF_FIELD(rffThreadId, REQUEST_HEADER, ThreadId),
+	RF_FIELD(rffIrql, REQUEST_HEADER, Irql),
+	RF_FLAG(rffEmulated, REQUEST_FLAG_EMULATED),
+	RF_FLAG(rffDataStripped, REQUEST_FLAG_DATA_STRIPPED),
+	RF_FLAG(rffAdmin, REQUEST_FLAG_ADMIN),
+	RF_FLAG(rffImpersonated, REQUEST_FLAG_IMPERSONATED),
+	RF_FLAG(rffImpersonatedAdmin, REQUEST_FLAG_IMPERSONATED_ADMIN),
+};
+
+static const REQUEST_FILTER_FIELD _irpFields[] = {
+	RF_FIELD(rffMajor, REQUEST_IRP, MajorFunction),
+	RF_FIELD(rffMinor, REQUEST_IRP, MinorFunction),
+	RF_FIELD(rffFileObject, REQUEST_IRP, FileObject),
+	RF_FIELD(rffIrpAddress, REQUEST_IRP, IRPAddress),
+	RF_FIELD(rffIrpFlags, REQUEST_IRP, IrpFlags),
+	RF_FIELD(rffPreviousMode, REQUEST_IRP, PreviousMode),
+	RF_FIELD(rffRequestorMode, REQUEST_IRP, RequestorMode),
+	RF_FIELD(rffRequestorPid, REQUEST_IRP, RequestorProcessId),
+	RF_FIELD(rffIosbStatus, REQUEST_IRP, IOSBStatus),
+	RF_FIELD(rffIosbInformation, REQUEST_IRP, IOSBInformation),
+	RF_FIELD(rffArg1, REQUEST_IRP, Arg1),
+	RF_FIELD(rffArg2, REQUEST_IRP, Arg2),
+	RF_FIELD(rffArg3, REQUEST_IRP, Arg3),
+	RF_FIELD(rffArg4, REQUEST_IRP, Arg4),
+};
+
+static const REQUEST_FILTER_FIELD _irpCompletionFields[] = {
+	RF_FIELD(rffMajor, REQUEST_IRP_COMPLETION, MajorFunction),
+	RF_FIELD(rffMinor, REQUEST_IRP_COMPLETION, MinorFunction),
+	RF_FIELD(rffFileObject, REQUEST_IRP_COMPLETION, FileObject),
+	RF_FIELD(rffPreviousMode, REQUEST_IRP_COMPLETION, PreviousMode),
+	RF_FIELD(rffRequestorMode, REQUEST_IRP_COMPLETION, RequestorMode),
+	RF_FIELD(rffRequestorPid, REQUEST_IRP_COMPLETION, RequestorProcessId),
+};
+
+static const REQUEST_FILTER_FIELD _startIoFields[] = {
+	RF_FIELD(rffMajor, REQUEST_STARTIO, MajorFunction),
+	RF_FIELD(rffMinor, REQUEST_STARTIO, MinorFunction),
+	RF_FIELD(rffFileObject, REQUEST_STARTIO, FileObject),
+};
+
+static const REQUEST_FILTER_FIELD _fastIoFields[] = {
+	RF_FIELD(rffMajor, REQUEST_FASTIO, FastIoType),
+	RF_FIELD(rffFileObject, REQUEST_FASTIO, FileObject),
+};
+
+static const REQUEST_FILTER_FIELD _fileNameAssignedFields[] = {
+	RF_FIELD(rffFileObject, REQUEST_FILE_OBJECT_NAME_ASSIGNED, FileObject),
+};
+
+static const REQUEST_FILTER_FIELD _fileNameDeletedFields[] = {
+	RF_FIELD(rffFileObject, REQUEST_FILE_OBJECT_NAME_DELETED, FileObject),
+};
+
+static const REQUEST_FILTER_FIELD _imageLoadFields[] = {
+	RF_FIELD(rffFileObject, REQUEST_IMAGE_LOAD, FileObject),
+	RF_FIELD(rffArg1, REQUEST_IMAGE_LOAD, ImageBase),
+	RF_FIELD(rffArg2, REQUEST_IMAGE_LOAD, ImageSize),
+	RF_FIELD(rffArg3, REQUEST_IMAGE_LOAD, SignatureType),
+	RF_FIELD(rffArg4, REQUEST_IMAGE_LOAD, SignatureLevel),
+};
+
+#define RF_FIELDS(aArray)							{aArray, sizeof(aArray) / sizeof(aArray[0])}
+
+typedef struct _REQUEST_FILTER_FIELD_LIST {
+	const REQUEST_FILTER_FIELD *Fields;
+	size_t Count;
+} REQUEST_FILTER_FIELD_LIST, *PREQUEST_FILTER_FIELD_LIST;
+
+/** Type-specific fields, indexed by ERequesttype. */
+static const REQUEST_FILTER_FIELD_LIST _typeFields[REQUEST_TYPE_COUNT] = {
+	{NULL, 0},
+	RF_FIELDS(_irpFields),
+	RF_FIELDS(_irpCompletionFields),
+	{NULL, 0},
+	{NULL, 0},
+	RF_FIELDS(_fastIoFields),
+	RF_FIELDS(_startIoFields),
+	{NULL, 0},
+	{NULL, 0},
+	RF_FIELDS(_fileNameAssignedFields),
+	RF_FIELDS(_fileNameDeletedFields),
+	{NULL, 0},
+	{NULL, 0},
+	RF_FIELDS(_imageLoadFields),
+	{NULL, 0},
+};
+
+
+#ifdef _KERNEL_MODE
+
+/** Upper-case forms of all characters, split to blocks by the high byte.
+ *  Blocks in which every character is its own upper-case form are not
+ *  stored. Filters are matched at DISPATCH_LEVEL where RtlUpcaseUnicodeChar
+ *  must not be called, so the table is filled in advance and kept in
+ *  nonpaged memory.
+ */
+static PWCHAR _upcaseBlocks[RF_UPCASE_BLOCK_COUNT];
+static PWCHAR _upcaseMemory = NULL;
+
+#endif
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+#ifdef _KERNEL_MODE
+
+static WCHAR _Upcase(WCHAR Char)
+{
+	WCHAR ret = Char;
+	const WCHAR *block = NULL;
+
+	block = _upcaseBlocks[Char / RF_UPCASE_BLOCK];
+	if (block != NULL)
+		ret = block[Char % RF_UPCASE_BLOCK];
+
+	return ret;
+}
+
+
+static BOOLEAN _UpcaseBlockIdentity(ULONG Block)
+{
+	WCHAR c = 0;
+	BOOLEAN ret = TRUE;
+
+	for (ULONG i = 0; i < RF_UPCASE_BLOCK; ++i) {
+		c = (WCHAR)(Block*RF_UPCASE_BLOCK + i);
+		if (RtlUpcaseUnicodeChar(c) != c) {
+			ret = FALSE;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+#endif
+
+
+static BOOLEAN _FieldFind(const REQUEST_FILTER_FIELD *Fields, size_t Count, ERequestFilterField Field, PREQUEST_FILTER_FIELD_LOCATION Location)
+{
+	size_t i = 0;
+	BOOLEAN ret = FALSE;
+
+	for (i = 0; i < Count; ++i) {
+		if (Fields[i].Field == Field) {
+			*Location = Fields[i].Location;
+			ret = TRUE;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+
+static ULONG64 _FieldLoad(const REQUEST_HEADER *Request, const REQUEST_FILTER_FIELD_LOCATION *Location)
+{
+	ULONG64 ret = 0;
+	const unsigned char *p = (const unsigned char *)Request + Location->Offset;
+
+	switch (Location->Size) {
+		case sizeof(UCHAR):
+			ret = *p;
+			break;
+		case sizeof(USHORT):
+			ret = *(const USHORT *)p;
+			break;
+		case sizeof(ULONG):
+			ret = *(const ULONG *)p;
+			break;
+		case sizeof(ULONG64):
+			ret = *(const ULONG64 *)p;
+			break;
+	}
+
+	if (Location->Mask != 0)
+		ret = ((ret & Location->Mask) != 0);
+
+	return ret;
+}
+
+
+/** Retrieves an integer field of the request. Returns FALSE if the request
+ *  does not have the field.
+ */
+static BOOLEAN _IntegerField(const REQUEST_HEADER *Request, ERequestFilterField Field, PULONG64 Value)
+{
+	REQUEST_FILTER_FIELD_LOCATION location;
+	BOOLEAN ret = FALSE;
+
+	*Value = 0;
+	if (Field == rffResult) {
+		ret = TRUE;
+		switch (Request->ResultType) {
+			case rrtNTSTATUS:
+				*Value = (ULONG)Request->Result.NTSTATUSValue;
+				break;
+			case rrtBOOLEAN:
+				*Value = Request->Result.BOOLEANValue;
+				break;
+			default:
+				ret = FALSE;
+				break;
+		}
+	} else if (RequestFilterFieldLocation(Request->Type, Field, &location)) {
+		*Value = _FieldLoad(Request, &location);
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
+
+/** Compares a part of a name with an upper-case pattern, ignoring case. */
+static BOOLEAN _StringEqual(const wchar_t *Name, const wchar_t *Pattern, size_t Length)
+{
+	size_t i = 0;
+	BOOLEAN ret = TRUE;
+
+	for (i = 0; i < Length; ++i) {
+		if (_Upcase(Name[i]) != Pattern[i]) {
+			ret = FALSE;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+
+static BOOLEAN _ConditionMatch(const REQUEST_FILTER_CONDITION *Condition, const REQUEST_HEADER *Request, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context)
+{
+	ULONG64 value = 0;
+	size_t length = 0;
+	const wchar_t *name = NULL;
+	BOOLEAN ret = FALSE;
+
+	if ((Condition->Flags & REQUEST_FILTER_CONDITION_DISABLED) == 0 &&
+		(Condition->RequestType == erpUndefined || Condition->RequestType == (ULONG)Request->Type)) {
+		if (Condition->Field == rffFileName) {
+			if (RequestFilterNameField(Request, NameRoutine, Context, &name, &length)) {
+				ret = RequestFilterStringMatch((ERequestFilterOperator)Condition->Operator, name, length, _ConditionString(Condition), Condition->StringLength);
+				if (Condition->Flags & REQUEST_FILTER_CONDITION_NEGATE)
+					ret = !ret;
+			}
+		} else if (_IntegerField(Request, (ERequestFilterField)Condition->Field, &value)) {
+			switch (Condition->Operator) {
+				case rfoEquals:
+					ret = (value == Condition->Value);
+					break;
+				case rfoLowerEquals:
+					ret = (value <= Condition->Value);
+					break;
+				case rfoGreaterEquals:
+					ret = (value >= Condition->Value);
+					break;
+				case rfoLower:
+					ret = (value < Condition->Value);
+					break;
+				case rfoGreater:
+					ret = (value > Condition->Value);
+					break;
+				case rfoInRange:
+					ret = (value >= Condition->Value && value <= Condition->ValueHigh);
+					break;
+				case rfoAlwaysTrue:
+					ret = TRUE;
+					break;
+				default:
+					break;
+			}
+
+			if (Condition->Flags & REQUEST_FILTER_CONDITION_NEGATE)
+				ret = !ret;
+		}
+	}
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** Checks a filter received from an untrusted source and converts its string
+ *  values to upper case, so the matching does not need to do it for every
+ *  request. Preparing a filter twice does no harm.
+ *
+ *  @return
+ *  ERROR_VALUE_INVAL is returned when the filter is malformed.
+ */
+ERROR_TYPE RequestFilterPrepare(PREQUEST_FILTER_HEADER Filter, size_t Size)
+{
+	ULONG i = 0;
+	ULONG j = 0;
+	size_t offset = 0;
+	PREQUEST_FILTER_CONDITION c = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	if (Size >= sizeof(REQUEST_FILTER_HEADER) && Size <= REQUEST_FILTER_MAX_SIZE &&
+		Filter->Signature == REQUEST_FILTER_SIGNATURE && Filter->Version == REQUEST_FILTER_VERSION_1 &&
+		Filter->Size == Size) {
+		ret = ERROR_VALUE_SUCCESS;
+		offset = sizeof(REQUEST_FILTER_HEADER);
+		c = (PREQUEST_FILTER_CONDITION)(Filter + 1);
+		for (i = 0; i < Filter->ConditionCount; ++i) {
+			if (Size - offset < sizeof(REQUEST_FILTER_CONDITION) ||
+				c->Size > Size - offset || c->Size % 8 != 0 ||
+				c->StringLength > REQUEST_FILTER_MAX_STRING ||
+				c->Size < _ConditionSize(c->StringLength) ||
+				c->RequestType >= REQUEST_TYPE_COUNT ||
+				c->Field >= rffMax || c->Action >= rfaMax ||
+				c->Operator >= rfoMax || c->Operator == rfoDLLDecider) {
+				ret = ERROR_VALUE_INVAL;
+				break;
+			}
+
+			if (Filter->Prepared == 0) {
+				for (j = 0; j < c->StringLength; ++j)
+					_ConditionString(c)[j] = _Upcase(_ConditionString(c)[j]);
+			}
+
+			offset += c->Size;
+			c = _ConditionNext(c);
+		}
+
+		if (ret == ERROR_VALUE_SUCCESS && offset != Size)
+			ret = ERROR_VALUE_INVAL;
+
+		if (ret == ERROR_VALUE_SUCCESS)
+			Filter->Prepared = TRUE;
+	}
+
+	return ret;
+}
+
+
+/** Finds where an integer field is stored in requests of the given type.
+ *  The result of requests (rffResult) and file names have no fixed location.
+ *
+ *  @return
+ *  Returns FALSE if requests of the type do not have the field.
+ */
+BOOLEAN RequestFilterFieldLocation(ERequesttype Type, ERequestFilterField Field, PREQUEST_FILTER_FIELD_LOCATION Location)
+{
+	BOOLEAN ret = FALSE;
+
+	ret = _FieldFind(_headerFields, sizeof(_headerFields) / sizeof(_headerFields[0]), Field, Location);
+	if (!ret && (ULONG)Type < REQUEST_TYPE_COUNT)
+		ret = _FieldFind(_typeFields[Type].Fields, _typeFields[Type].Count, Field, Location);
+
+	return ret;
+}
+
+
+/** Retrieves the file name of the request, either stored in the request
+ *  itself or provided by the name routine.
+ */
+BOOLEAN RequestFilterNameField(const REQUEST_HEADER *Request, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, const wchar_t **Name, size_t *Length)
+{
+	ULONG64 fileObject = 0;
+	BOOLEAN ret = FALSE;
+	const REQUEST_GENERAL *rg = (const REQUEST_GENERAL *)Request;
+
+	switch (Request->Type) {
+		case ertFileObjectNameAssigned:
+			*Name = (const wchar_t *)(&rg->RequestTypes.FileObjectNameAssigned + 1);
+			*Length = rg->RequestTypes.FileObjectNameAssigned.NameLength / sizeof(wchar_t);
+			ret = TRUE;
+			break;
+		case ertImageLoad:
+			*Name = (const wchar_t *)(&rg->RequestTypes.ImageLoad + 1);
+			*Length = rg->RequestTypes.ImageLoad.DataSize / sizeof(wchar_t);
+			ret = TRUE;
+			break;
+		default:
+			if (NameRoutine != NULL && _IntegerField(Request, rffFileObject, &fileObject))
+				ret = NameRoutine(Context, (const void *)(ULONG_PTR)fileObject, Name, Length);
+			break;
+	}
+
+	return ret;
+}
+
+
+/** Compares a name with an upper-case pattern, ignoring case. */
+BOOLEAN RequestFilterStringMatch(ERequestFilterOperator Operator, const wchar_t *Name, size_t Length, const wchar_t *Pattern, size_t PatternLength)
+{
+	size_t i = 0;
+	BOOLEAN ret = FALSE;
+
+	// Empty patterns match nothing but the equality with an empty name,
+	// as in the GUI.
+	switch (Operator) {
+		case rfoEquals:
+			ret = (Length == PatternLength && _StringEqual(Name, Pattern, Length));
+			break;
+		case rfoBegins:
+			ret = (PatternLength > 0 && Length >= PatternLength && _StringEqual(Name, Pattern, PatternLength));
+			break;
+		case rfoEnds:
+			ret = (PatternLength > 0 && Length >= PatternLength && _StringEqual(Name + Length - PatternLength, Pattern, PatternLength));
+			break;
+		case rfoContains:
+			if (PatternLength > 0 && Length >= PatternLength) {
+				for (i = 0; i <= Length - PatternLength; ++i) {
+					ret = _StringEqual(Name + i, Pattern, PatternLength);
+					if (ret)
+						break;
+				}
+			}
+			break;
+		case rfoAlwaysTrue:
+			ret = TRUE;
+			break;
+		default:
+			break;
+	}
+
+	return ret;
+}
+
+
+/** Decides whether a request passes a filter prepared by RequestFilterPrepare.
+ *
+ *  @param NameRoutine Optional, retrieves file names of requests that do not
+ *  carry them.
+ */
+BOOLEAN RequestFilterMatch(const REQUEST_FILTER_HEADER *Filter, const REQUEST_HEADER *Request, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context)
+{
+	ULONG i = 0;
+	BOOLEAN allInclusive = TRUE;
+	BOOLEAN allExclusive = TRUE;
+	BOOLEAN chainStart = TRUE;
+	BOOLEAN chainMatch = TRUE;
+	BOOLEAN decided = FALSE;
+	const REQUEST_FILTER_CONDITION *c = NULL;
+	BOOLEAN ret = FALSE;
+
+	ret = (Filter->ConditionCount == 0);
+	c = (const REQUEST_FILTER_CONDITION *)(Filter + 1);
+	for (i = 0; i < Filter->ConditionCount; ++i) {
+		if (c->Action == rfaInclude)
+			allExclusive = FALSE;
+		else if (c->Action == rfaExclude)
+			allInclusive = FALSE;
+
+		// A chain is evaluated member by member; once a member fails,
+		// the rest of the chain is only counted.
+		if (chainStart)
+			chainMatch = TRUE;
+
+		if (chainMatch)
+			chainMatch = _ConditionMatch(c, Request, NameRoutine, Context);
+
+		chainStart = (c->Action != rfaPass);
+		if (chainMatch && (c->Action == rfaInclude || c->Action == rfaExclude)) {
+			decided = TRUE;
+			ret = (c->Action == rfaInclude);
+			break;
+		}
+
+		c = (const REQUEST_FILTER_CONDITION *)((const unsigned char *)c + c->Size);
+	}
+
+	if (!decided) {
+		if (allInclusive)
+			ret = FALSE;
+
+		if (allExclusive)
+			ret = TRUE;
+	}
+
+	return ret;
+}
+
+
+#ifdef _KERNEL_MODE
+
+/** Builds the upcase table filters are matched with. */
+NTSTATUS RequestFilterModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context)
+{
+	ULONG blockCount = 0;
+	PWCHAR block = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
+	DEBUG_IRQL_LESS_OR_EQUAL(APC_LEVEL);
+
+	UNREFERENCED_PARAMETER(DriverObject);
+	UNREFERENCED_PARAMETER(RegistryPath);
+	UNREFERENCED_PARAMETER(Context);
+
+	for (ULONG i = 0; i < RF_UPCASE_BLOCK_COUNT; ++i) {
+		if (!_UpcaseBlockIdentity(i))
+			++blockCount;
+	}
+
+	status = STATUS_SUCCESS;
+	if (blockCount > 0) {
+		_upcaseMemory = (PWCHAR)HeapMemoryAllocNonPaged(blockCount*RF_UPCASE_BLOCK*sizeof(WCHAR));
+		if (_upcaseMemory != NULL) {
+			block = _upcaseMemory;
+			for (ULONG i = 0; i < RF_UPCASE_BLOCK_COUNT; ++i) {
+				if (!_UpcaseBlockIdentity(i)) {
+					for (ULONG j = 0; j < RF_UPCASE_BLOCK; ++j)
+						block[j] = RtlUpcaseUnicodeChar((WCHAR)(i*RF_UPCASE_BLOCK + j));
+
+					_upcaseBlocks[i] = block;
+					block += RF_UPCASE_BLOCK;
+				}
+			}
+		} else status = STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	DEBUG_EXIT_FUNCTION("0x%x, blockCount=%u", status, blockCount);
+	return status;
+}
+
+
+VOID RequestFilterModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context)
+{
+	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
+
+	UNREFERENCED_PARAMETER(DriverObject);
+	UNREFERENCED_PARAMETER(RegistryPath);
+	UNREFERENCED_PARAMETER(Context);
+
+	memset(_upcaseBlocks, 0, sizeof(_upcaseBlocks));
+	if (_upcaseMemory != NULL) {
+		HeapMemoryFree(_upcaseMemory);
+		_upcaseMemory = NULL;
+	}
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+#else
+
+ERROR_TYPE RequestFilterCreate(PREQUEST_FILTER_HEADER *Filter)
+{
+	PREQUEST_FILTER_HEADER tmpFilter = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	tmpFilter = (PREQUEST_FILTER_HEADER)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(REQUEST_FILTER_HEADER));
+	if (tmpFilter != NULL) {
+		tmpFilter->Signature = REQUEST_FILTER_SIGNATURE;
+		tmpFilter->Version = REQUEST_FILTER_VERSION_1;
+		tmpFilter->Size = sizeof(REQUEST_FILTER_HEADER);
+		tmpFilter->Prepared = TRUE;
+		*Filter = tmpFilter;
+	} else ret = ERROR_VALUE_NOMEM;
+
+	return ret;
+}
+
+
+/** Appends a condition to a filter created by RequestFilterCreate. The filter
+ *  is reallocated, so the address stored in Filter may change.
+ *
+ *  @param String Value of rffFileName conditions, NULL for other fields.
+ */
+ERROR_TYPE RequestFilterAddCondition(PREQUEST_FILTER_HEADER *Filter, ERequesttype RequestType, ERequestFilterField Field, ERequestFilterOperator Operator, ULONG64 Value, ULONG64 ValueHigh, const wchar_t *String, ERequestFilterAction Action, ULONG Flags)
+{
+	size_t i = 0;
+	size_t len = 0;
+	size_t conditionSize = 0;
+	PREQUEST_FILTER_CONDITION c = NULL;
+	PREQUEST_FILTER_HEADER old = *Filter;
+	PREQUEST_FILTER_HEADER tmpFilter = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	if (String != NULL)
+		len = wcslen(String);
+
+	conditionSize = _ConditionSize(len);
+	if (len <= REQUEST_FILTER_MAX_STRING && old->Size + conditionSize <= REQUEST_FILTER_MAX_SIZE &&
+		RequestType < REQUEST_TYPE_COUNT && Field < rffMax && Action < rfaMax &&
+		Operator < rfoMax && Operator != rfoDLLDecider) {
+		tmpFilter = (PREQUEST_FILTER_HEADER)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, old->Size + conditionSize);
+		if (tmpFilter != NULL) {
+			memcpy(tmpFilter, old, old->Size);
+			c = (PREQUEST_FILTER_CONDITION)((unsigned char *)tmpFilter + old->Size);
+			c->Size = (ULONG)conditionSize;
+			c->RequestType = RequestType;
+			c->Field = Field;
+			c->Operator = Operator;
+			c->Action = Action;
+			c->Flags = Flags;
+			c->Value = Value;
+			c->ValueHigh = ValueHigh;
+			c->StringLength = (ULONG)len;
+			for (i = 0; i < len; ++i)
+				_ConditionString(c)[i] = _Upcase(String[i]);
+
+			tmpFilter->Size += (ULONG)conditionSize;
+			++tmpFilter->ConditionCount;
+			HeapFree(GetProcessHeap(), 0, old);
+			*Filter = tmpFilter;
+			ret = ERROR_VALUE_SUCCESS;
+		} else ret = ERROR_VALUE_NOMEM;
+	}
+
+	return ret;
+}
+
+
+void RequestFilterFree(PREQUEST_FILTER_HEADER Filter)
+{
+	HeapFree(GetProcessHeap(), 0, Filter);
+
+	return;
+}
+
+
+/** Fields tested by the GUI filters, indexed by ERequestListModelColumnType.
+    rffMax marks columns holding names resolved by the GUI. */
+static const ERequestFilterField _listColumnFields[] = {
+	rffId,
+	rffTime,
+	rffType,
+	rffDevice,
+	rffMax,
+	rffDriver,
+	rffMax,
+	rffResult,
+	rffMax,
+	rffMajor,
+	rffMinor,
+	rffIrpAddress,
+	rffFileObject,
+	rffFileName,
+	rffIrpFlags,
+	rffArg1,
+	rffArg2,
+	rffArg3,
+	rffArg4,
+	rffThreadId,
+	rffProcessId,
+	rffMax,
+	rffIrql,
+	rffPreviousMode,
+	rffRequestorMode,
+	rffIosbStatus,
+	rffMax,
+	rffIosbInformation,
+	rffRequestorPid,
+	rffEmulated,
+	rffMax,
+	rffDataStripped,
+	rffMax,
+	rffAdmin,
+	rffImpersonated,
+	rffImpersonatedAdmin,
+};
+
+#define RF_LIST_NONE								((size_t)-1)
+
+/** One section of a filter list saved by the GUI. */
+typedef struct _REQUEST_FILTER_LIST_ENTRY {
+	const wchar_t *Name;
+	ULONG RequestType;
+	ULONG Column;
+	ULONG Operator;
+	ULONG Action;
+	BOOLEAN Enabled;
+	BOOLEAN Negate;
+	BOOLEAN Emitted;
+	size_t Previous;
+	size_t Next;
+	wchar_t Value[REQUEST_FILTER_MAX_STRING + 1];
+	wchar_t NextName[REQUEST_FILTER_MAX_STRING + 1];
+} REQUEST_FILTER_LIST_ENTRY, *PREQUEST_FILTER_LIST_ENTRY;
+
+
+/** Parses an integer the way StrToInt64 of the GUI does. */
+static BOOLEAN _ListValueParse(const wchar_t *String, PULONG64 Value)
+{
+	int base = 10;
+	BOOLEAN negative = FALSE;
+	wchar_t *end = NULL;
+	BOOLEAN ret = FALSE;
+
+	while (*String == L' ')
+		++String;
+
+	if (*String == L'-' || *String == L'+') {
+		negative = (*String == L'-');
+		++String;
+	}
+
+	if (*String == L'$') {
+		base = 16;
+		++String;
+	} else if (String[0] == L'0' && (String[1] == L'x' || String[1] == L'X')) {
+		base = 16;
+		String += 2;
+	}
+
+	if (iswxdigit(*String)) {
+		*Value = _wcstoui64(String, &end, base);
+		ret = (*end == L'\0');
+		if (negative)
+			*Value = (ULONG64)(-(LONG64)*Value);
+	}
+
+	return ret;
+}
+
+
+static ERROR_TYPE _ListEntryAppend(PREQUEST_FILTER_HEADER *Filter, const REQUEST_FILTER_LIST_ENTRY *Entry, ERequestFilterAction Action)
+{
+	ULONG flags = 0;
+	ULONG64 value = 0;
+	const wchar_t *string = NULL;
+	ERequestFilterField field = rffMax;
+	ERROR_TYPE ret = ERROR_NOT_SUPPORTED;
+
+	if (Entry->Column < sizeof(_listColumnFields) / sizeof(_listColumnFields[0]))
+		field = _listColumnFields[Entry->Column];
+
+	if (field != rffMax && Entry->Operator != rfoDLLDecider) {
+		ret = ERROR_VALUE_SUCCESS;
+		if (field == rffFileName) {
+			string = Entry->Value;
+			switch (Entry->Operator) {
+				case rfoEquals:
+				case rfoContains:
+				case rfoBegins:
+				case rfoEnds:
+				case rfoAlwaysTrue:
+					break;
+				default:
+					ret = ERROR_VALUE_INVAL;
+					break;
+			}
+		} else {
+			switch (Entry->Operator) {
+				case rfoEquals:
+				case rfoLowerEquals:
+				case rfoGreaterEquals:
+				case rfoLower:
+				case rfoGreater:
+				case rfoAlwaysTrue:
+					if (!_ListValueParse(Entry->Value, &value))
+						ret = ERROR_VALUE_INVAL;
+					break;
+				default:
+					ret = ERROR_VALUE_INVAL;
+					break;
+			}
+		}
+
+		if (ret == ERROR_VALUE_SUCCESS) {
+			if (Entry->Negate)
+				flags |= REQUEST_FILTER_CONDITION_NEGATE;
+
+			if (!Entry->Enabled)
+				flags |= REQUEST_FILTER_CONDITION_DISABLED;
+
+			ret = RequestFilterAddCondition(Filter, (ERequesttype)Entry->RequestType, field, (ERequestFilterOperator)Entry->Operator, value, 0, string, Action, flags);
+		}
+	}
+
+	return ret;
+}
+
+
+/** Converts a filter list saved by the GUI (filters.ini) into a filter.
+ *  Chains are stored at the position of their first member, in the order
+ *  the GUI evaluates them. A Pass condition without a successor decides
+ *  nothing and is stored as a Highlight one.
+ *
+ *  @return
+ *  ERROR_NOT_SUPPORTED is returned when the list tests columns holding names
+ *  resolved by the GUI (except file names) or uses DLL deciders.
+ */
+ERROR_TYPE RequestFilterLoadList(const wchar_t *FileName, PREQUEST_FILTER_HEADER *Filter)
+{
+	size_t i = 0;
+	size_t j = 0;
+	size_t count = 0;
+	DWORD namesSize = 0x1000;
+	DWORD namesLength = 0;
+	wchar_t *names = NULL;
+	const wchar_t *name = NULL;
+	PREQUEST_FILTER_LIST_ENTRY entries = NULL;
+	PREQUEST_FILTER_LIST_ENTRY e = NULL;
+	PREQUEST_FILTER_HEADER tmpFilter = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	do {
+		if (names != NULL) {
+			HeapFree(GetProcessHeap(), 0, names);
+			namesSize *= 2;
+		}
+
+		names = (wchar_t *)HeapAlloc(GetProcessHeap(), 0, namesSize*sizeof(wchar_t));
+		if (names == NULL) {
+			ret = ERROR_VALUE_NOMEM;
+			break;
+		}
+
+		namesLength = GetPrivateProfileSectionNamesW(names, namesSize, FileName);
+	} while (namesLength == namesSize - 2);
+
+	if (ret == ERROR_VALUE_SUCCESS) {
+		for (name = names; *name != L'\0'; name += wcslen(name) + 1)
+			++count;
+
+		if (count > 0) {
+			entries = (PREQUEST_FILTER_LIST_ENTRY)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, count*sizeof(REQUEST_FILTER_LIST_ENTRY));
+			if (entries == NULL)
+				ret = ERROR_VALUE_NOMEM;
+		}
+	}
+
+	if (ret == ERROR_VALUE_SUCCESS) {
+		e = entries;
+		for (name = names; *name != L'\0'; name += wcslen(name) + 1) {
+			e->Name = name;
+			e->RequestType = GetPrivateProfileIntW(name, L"RequestType", -1, FileName);
+			e->Column = GetPrivateProfileIntW(name, L"Column", -1, FileName);
+			e->Operator = GetPrivateProfileIntW(name, L"Operator", -1, FileName);
+			e->Action = GetPrivateProfileIntW(name, L"Action", -1, FileName);
+			e->Enabled = (GetPrivateProfileIntW(name, L"Enabled", 1, FileName) != 0);
+			e->Negate = (GetPrivateProfileIntW(name, L"Negate", 0, FileName) != 0);
+			GetPrivateProfileStringW(name, L"Value", L"", e->Value, sizeof(e->Value) / sizeof(e->Value[0]), FileName);
+			GetPrivateProfileStringW(name, L"Next", L"", e->NextName, sizeof(e->NextName) / sizeof(e->NextName[0]), FileName);
+			e->Previous = RF_LIST_NONE;
+			e->Next = RF_LIST_NONE;
+			if (e->RequestType >= REQUEST_TYPE_COUNT || e->Operator >= rfoMax ||
+				e->Action >= rfaMax) {
+				ret = ERROR_VALUE_INVAL;
+				break;
+			}
+
+			++e;
+		}
+	}
+
+	// Link the chains as TRequestFilter.AddNext does, a filter linked later
+	// takes the successor over.
+	if (ret == ERROR_VALUE_SUCCESS) {
+		for (i = 0; i < count; ++i) {
+			e = entries + i;
+			if (e->Action != rfaPass || e->NextName[0] == L'\0')
+				continue;
+
+			for (j = 0; j < count; ++j) {
+				if (wcscmp(entries[j].Name, e->NextName) == 0)
+					break;
+			}
+
+			if (j < count && (e->RequestType == erpUndefined || e->RequestType == entries[j].RequestType)) {
+				if (entries[j].Previous != RF_LIST_NONE)
+					entries[entries[j].Previous].Next = RF_LIST_NONE;
+
+				entries[j].Previous = i;
+				e->Next = j;
+			}
+		}
+	}
+
+	if (ret == ERROR_VALUE_SUCCESS)
+		ret = RequestFilterCreate(&tmpFilter);
+
+	if (ret == ERROR_VALUE_SUCCESS) {
+		// Filters with a predecessor are evaluated only as parts of their
+		// chains, those in cycles never.
+		for (i = 0; i < count; ++i) {
+			if (entries[i].Previous != RF_LIST_NONE)
+				continue;
+
+			j = i;
+			do {
+				e = entries + j;
+				e->Emitted = TRUE;
+				j = e->Next;
+				if (j != RF_LIST_NONE && entries[j].Emitted)
+					j = RF_LIST_NONE;
+
+				if (j != RF_LIST_NONE)
+					ret = _ListEntryAppend(&tmpFilter, e, rfaPass);
+				else ret = _ListEntryAppend(&tmpFilter, e, (e->Action == rfaPass) ? rfaHighlight : (ERequestFilterAction)e->Action);
+			} while (ret == ERROR_VALUE_SUCCESS && j != RF_LIST_NONE);
+
+			if (ret != ERROR_VALUE_SUCCESS)
+				break;
+		}
+
+		if (ret == ERROR_VALUE_SUCCESS)
+			*Filter = tmpFilter;
+
+		if (ret != ERROR_VALUE_SUCCESS)
+			RequestFilterFree(tmpFilter);
+	}
+
+	if (entries != NULL)
+		HeapFree(GetProcessHeap(), 0, entries);
+
+	if (names != NULL)
+		HeapFree(GetProcessHeap(), 0, names);
+
+	return ret;
+}
+
+#endif
@@ -0,0 +1,190 @@
+
+#ifndef __SHARED_REQUEST_FILTER_H__
+#define __SHARED_REQUEST_FILTER_H__
+
+/** Serialized request filters.
+ *
+ *  A filter is a REQUEST_FILTER_HEADER followed by a list of conditions, each
+ *  one a REQUEST_FILTER_CONDITION followed by its string value. The filter
+ *  decides whether a request is stored the same way the filters of the GUI do:
+ *
+ *  - conditions are tried in order, the first one that matches and has
+ *    the Include or Exclude action decides,
+ *  - a condition with the Pass action is chained to the one following it,
+ *    the chain matches only if all its members match and its action is
+ *    the action of the last member,
+ *  - when nothing decides, the request is excluded if the filter has only
+ *    Include conditions and included if it has only Exclude conditions
+ *    (and so also if it has none at all), otherwise excluded,
+ *  - a condition never matches a request that does not have the field it
+ *    tests, not even when it is negated.
+ *
+ *  The format does not depend on the pointer size, so the filter can be
+ *  passed to the driver as well as over the network. Call RequestFilterPrepare
+ *  on every filter received from elsewhere before matching requests
+ *  against it.
+ */
+
+#include "general-types.h"
+#include "request.h"
+
+
+
+#define REQUEST_FILTER_SIGNATURE				0x544c4652		// 'RFLT'
+#define REQUEST_FILTER_VERSION_1				1
+#define REQUEST_FILTER_MAX_SIZE					0x10000
+/** Maximum length of a string value, in characters. */
+#define REQUEST_FILTER_MAX_STRING				1024
+
+/** Values tested by conditions. */
+typedef enum _ERequestFilterField {
+	/** ERequesttype of the request. */
+	rffType,
+	/** Major function of IRPs, type of fast I/O operations. */
+	rffMajor,
+	/** Minor function of IRPs. */
+	rffMinor,
+	rffDriver,
+	rffDevice,
+	rffFileObject,
+	rffProcessId,
+	rffThreadId,
+	rffIrql,
+	/** Result stored in the request header (NTSTATUS or BOOLEAN). */
+	rffResult,
+	/** File name carried by the request itself (ertFileObjectNameAssigned,
+	    ertImageLoad) or provided by the name routine passed to
+	    RequestFilterMatch. */
+	rffFileName,
+	rffId,
+	rffTime,
+	rffIrpAddress,
+	rffIrpFlags,
+	rffPreviousMode,
+	rffRequestorMode,
+	rffRequestorPid,
+	rffIosbStatus,
+	rffIosbInformation,
+	/** Arguments of IRPs; base, size, signature type and signing level
+	    of loaded images. */
+	rffArg1,
+	rffArg2,
+	rffArg3,
+	rffArg4,
+	/** Flags of the request header, 1 if set, 0 otherwise. */
+	rffEmulated,
+	rffDataStripped,
+	rffAdmin,
+	rffImpersonated,
+	rffImpersonatedAdmin,
+	rffMax,
+} ERequestFilterField, *PERequestFilterField;
+
+/** Comparison operators, the values match ERequestFilterOperator
+    of the GUI. */
+typedef enum _ERequestFilterOperator {
+	rfoEquals,
+	rfoLowerEquals,
+	rfoGreaterEquals,
+	rfoLower,
+	rfoGreater,
+	rfoContains,
+	rfoBegins,
+	rfoEnds,
+	rfoAlwaysTrue,
+	/** Reserved for DLL deciders, which cannot be serialized. */
+	rfoDLLDecider,
+	/** Value <= field <= ValueHigh. */
+	rfoInRange,
+	rfoMax,
+} ERequestFilterOperator, *PERequestFilterOperator;
+
+/** Actions of conditions, the values match EFilterAction. */
+typedef enum _ERequestFilterAction {
+	/** Does not decide anything, kept for compatibility with the GUI. */
+	rfaHighlight,
+	rfaInclude,
+	rfaExclude,
+	/** Chains the condition to the next one. */
+	rfaPass,
+	rfaMax,
+} ERequestFilterAction, *PERequestFilterAction;
+
+/** Flags of REQUEST_FILTER_CONDITION. */
+#define REQUEST_FILTER_CONDITION_NEGATE			0x1
+#define REQUEST_FILTER_CONDITION_DISABLED		0x2
+
+typedef struct _REQUEST_FILTER_HEADER {
+	ULONG Signature;
+	ULONG Version;
+	/** Size of the whole filter, including this header. */
+	ULONG Size;
+	ULONG ConditionCount;
+	/** Set by RequestFilterPrepare. */
+	ULONG Prepared;
+	ULONG Reserved;
+} REQUEST_FILTER_HEADER, *PREQUEST_FILTER_HEADER;
+
+typedef struct _REQUEST_FILTER_CONDITION {
+	/** Size of the condition including its string, a multiple of 8. */
+	ULONG Size;
+	/** ERequesttype the condition applies to, erpUndefined for all types. */
+	ULONG RequestType;
+	/** ERequestFilterField */
+	ULONG Field;
+	/** ERequestFilterOperator */
+	ULONG Operator;
+	/** ERequestFilterAction */
+	ULONG Action;
+	/** REQUEST_FILTER_CONDITION_XXX */
+	ULONG Flags;
+	ULONG64 Value;
+	ULONG64 ValueHigh;
+	/** Length of the string value in characters. The string follows
+	    the structure and is not terminated. */
+	ULONG StringLength;
+	ULONG Reserved;
+} REQUEST_FILTER_CONDITION, *PREQUEST_FILTER_CONDITION;
+
+/** Where an integer field is stored in requests of a given type. */
+typedef struct _REQUEST_FILTER_FIELD_LOCATION {
+	/** Offset from the start of the request. */
+	USHORT Offset;
+	/** Size of the field in bytes: 1, 2, 4 or 8. */
+	USHORT Size;
+	/** For flag fields, the value is 1 if any of these bits is set. */
+	ULONG Mask;
+} REQUEST_FILTER_FIELD_LOCATION, *PREQUEST_FILTER_FIELD_LOCATION;
+
+/** Looks up the name of a file object for rffFileName conditions. Returns
+    FALSE when the name is not known. */
+typedef BOOLEAN (REQUEST_FILTER_NAME_ROUTINE)(void *Context, const void *FileObject, const wchar_t **Name, size_t *Length);
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ERROR_TYPE RequestFilterPrepare(PREQUEST_FILTER_HEADER Filter, size_t Size);
+BOOLEAN RequestFilterMatch(const REQUEST_FILTER_HEADER *Filter, const REQUEST_HEADER *Request, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context);
+BOOLEAN RequestFilterFieldLocation(ERequesttype Type, ERequestFilterField Field, PREQUEST_FILTER_FIELD_LOCATION Location);
+BOOLEAN RequestFilterNameField(const REQUEST_HEADER *Request, REQUEST_FILTER_NAME_ROUTINE *NameRoutine, void *Context, const wchar_t **Name, size_t *Length);
+BOOLEAN RequestFilterStringMatch(ERequestFilterOperator Operator, const wchar_t *Name, size_t Length, const wchar_t *Pattern, size_t PatternLength);
+
+#ifdef _KERNEL_MODE
+NTSTATUS RequestFilterModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
+VOID RequestFilterModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
+#else
+ERROR_TYPE RequestFilterCreate(PREQUEST_FILTER_HEADER *Filter);
+ERROR_TYPE RequestFilterAddCondition(PREQUEST_FILTER_HEADER *Filter, ERequesttype RequestType, ERequestFilterField Field, ERequestFilterOperator Operator, ULONG64 Value, ULONG64 ValueHigh, const wchar_t *String, ERequestFilterAction Action, ULONG Flags);
+void RequestFilterFree(PREQUEST_FILTER_HEADER Filter);
+ERROR_TYPE RequestFilterLoadList(const wchar_t *FileName, PREQUEST_FILTER_HEADER *Filter);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
@@ -0,0 +1,258 @@
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-log.h"
+#include "request-log-view.h"
+
+
+
+/************************************************************************/
+/*                     TYPES AND MACROS                                 */
+/************************************************************************/
+
+
+#define _ViewAlloc(aSize)					HeapAlloc(GetProcessHeap(), 0, (aSize))
+#define _ViewReAlloc(aBuffer, aSize)		(((aBuffer) != NULL) ? HeapReAlloc(GetProcessHeap(), 0, (aBuffer), (aSize)) : HeapAlloc(GetProcessHeap(), 0, (aSize)))
+#define _ViewFree(aBuffer)					HeapFree(GetProcessHeap(), 0, (aBuffer))
+
+struct _REQUEST_LOG_VIEW {
+	HANDLE FileHandle;
+	HANDLE MappingHandle;
+	const unsigned char *Data;
+	ULONG64 Size;
+	ULONG IndexStride;
+	ULONG64 RecordCount;
+	/** Offsets of every IndexStride-th record. */
+	ULONG64 *Offsets;
+	size_t OffsetCapacity;
+};
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+static ERROR_TYPE _ViewMap(PREQUEST_LOG_VIEW View, const wchar_t *FileName)
+{
+	LARGE_INTEGER fileSize;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	View->FileHandle = CreateFileW(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (View->FileHandle != INVALID_HANDLE_VALUE) {
+		if (GetFileSizeEx(View->FileHandle, &fileSize)) {
+			View->Size = fileSize.QuadPart;
+			ret = ERROR_VALUE_INVAL;
+			if (View->Size > 0 && (ULONG64)(SIZE_T)View->Size == View->Size) {
+				View->MappingHandle = CreateFileMappingW(View->FileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (View->MappingHandle != NULL) {
+					View->Data = (const unsigned char *)MapViewOfFile(View->MappingHandle, FILE_MAP_READ, 0, 0, 0);
+					ret = (View->Data != NULL) ? ERROR_VALUE_SUCCESS : GetLastError();
+					if (ret != ERROR_VALUE_SUCCESS)
+						CloseHandle(View->MappingHandle);
+				} else ret = GetLastError();
+			}
+		} else ret = GetLastError();
+
+		if (ret != ERROR_VALUE_SUCCESS)
+			CloseHandle(View->FileHandle);
+	} else ret = GetLastError();
+
+	return ret;
+}
+
+
+static void _ViewUnmap(PREQUEST_LOG_VIEW View)
+{
+	UnmapViewOfFile(View->Data);
+	CloseHandle(View->MappingHandle);
+	CloseHandle(View->FileHandle);
+
+	return;
+}
+
+
+/** Walks all records of the mapped file, validates them and fills the offset
+ *  index. Logs without the header are accepted, as the GUI writes them when
+ *  saving selected requests only.
+ */
+static ERROR_TYPE _ViewIndex(PREQUEST_LOG_VIEW View)
+{
+	ULONG recordSize = 0;
+	ULONG64 offset = 0;
+	size_t newCapacity = 0;
+	void *tmp = NULL;
+	REQUEST_LOG_HEADER_V1 header;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (View->Size >= sizeof(header)) {
+		memcpy(&header, View->Data, sizeof(header));
+		if (header.Signature == REQUEST_LOG_SIGNATURE) {
+			offset = sizeof(header);
+			if (header.Version != REQUEST_LOG_VERSION_1 ||
+				header.Architecture != REQUEST_LOG_ARCHITECTURE)
+				ret = ERROR_VALUE_INVAL;
+		}
+	}
+
+	while (ret == ERROR_VALUE_SUCCESS && offset < View->Size) {
+		ret = ERROR_VALUE_INVAL;
+		if (View->Size - offset < sizeof(recordSize))
+			break;
+
+		memcpy(&recordSize, View->Data + offset, sizeof(recordSize));
+		offset += sizeof(recordSize);
+		if (recordSize > View->Size - offset ||
+			!RequestValidate((const REQUEST_HEADER *)(View->Data + offset), recordSize))
+			break;
+
+		ret = ERROR_VALUE_SUCCESS;
+		if (View->RecordCount % View->IndexStride == 0) {
+			if (View->RecordCount / View->IndexStride == View->OffsetCapacity) {
+				newCapacity = (View->OffsetCapacity > 0) ? View->OffsetCapacity * 2 : 1024;
+				tmp = _ViewReAlloc(View->Offsets, newCapacity*sizeof(ULONG64));
+				if (tmp == NULL) {
+					ret = ERROR_VALUE_NOMEM;
+					break;
+				}
+
+				View->Offsets = (ULONG64 *)tmp;
+				View->OffsetCapacity = newCapacity;
+			}
+
+			View->Offsets[View->RecordCount / View->IndexStride] = offset - sizeof(recordSize);
+		}
+
+		++View->RecordCount;
+		offset += recordSize;
+	}
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** Maps a flat log file and indexes its records.
+ *
+ *  @param FileName Name of the log file.
+ *  @param IndexStride Every how many records an offset is stored in the index.
+ *  Zero means one, i.e. the offset of each record is stored.
+ *  @param View Receives the view.
+ *
+ *  @return
+ *  ERROR_VALUE_INVAL is returned when the file is not a version 1 log
+ *  of the current architecture, or contains a malformed record.
+ */
+ERROR_TYPE RequestLogViewOpen(const wchar_t *FileName, ULONG IndexStride, PREQUEST_LOG_VIEW *View)
+{
+	PREQUEST_LOG_VIEW tmpView = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_NOMEM;
+
+	tmpView = (PREQUEST_LOG_VIEW)_ViewAlloc(sizeof(REQUEST_LOG_VIEW));
+	if (tmpView != NULL) {
+		memset(tmpView, 0, sizeof(REQUEST_LOG_VIEW));
+		tmpView->IndexStride = (IndexStride > 0) ? IndexStride : 1;
+		ret = _ViewMap(tmpView, FileName);
+		if (ret == ERROR_VALUE_SUCCESS) {
+			ret = _ViewIndex(tmpView);
+			if (ret == ERROR_VALUE_SUCCESS)
+				*View = tmpView;
+
+			if (ret != ERROR_VALUE_SUCCESS) {
+				if (tmpView->Offsets != NULL)
+					_ViewFree(tmpView->Offsets);
+
+				_ViewUnmap(tmpView);
+			}
+		}
+
+		if (ret != ERROR_VALUE_SUCCESS)
+			_ViewFree(tmpView);
+	}
+
+	return ret;
+}
+
+
+/** Unmaps the log. Requests returned by the view must not be used afterwards. */
+void RequestLogViewClose(PREQUEST_LOG_VIEW View)
+{
+	if (View->Offsets != NULL)
+		_ViewFree(View->Offsets);
+
+	_ViewUnmap(View);
+	_ViewFree(View);
+
+	return;
+}
+
+
+ULONG64 RequestLogViewCount(const REQUEST_LOG_VIEW *View)
+{
+	return View->RecordCount;
+}
+
+
+/** Positions a cursor at a given record. */
+ERROR_TYPE RequestLogViewSeek(const REQUEST_LOG_VIEW *View, ULONG64 Index, PREQUEST_LOG_VIEW_CURSOR Cursor)
+{
+	ULONG recordSize = 0;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	if (Index < View->RecordCount) {
+		Cursor->Index = Index - (Index % View->IndexStride);
+		Cursor->Offset = View->Offsets[Index / View->IndexStride];
+		while (Cursor->Index < Index) {
+			memcpy(&recordSize, View->Data + Cursor->Offset, sizeof(recordSize));
+			Cursor->Offset += sizeof(recordSize) + recordSize;
+			++Cursor->Index;
+		}
+
+		ret = ERROR_VALUE_SUCCESS;
+	}
+
+	return ret;
+}
+
+
+/** Returns the record at the cursor and moves the cursor to the next one.
+ *
+ *  @return
+ *  Address of the request within the mapped file, or NULL when the cursor
+ *  is past the last record. The request is not necessarily aligned to the
+ *  natural alignment of its fields.
+ */
+const REQUEST_HEADER *RequestLogViewNext(const REQUEST_LOG_VIEW *View, PREQUEST_LOG_VIEW_CURSOR Cursor)
+{
+	ULONG recordSize = 0;
+	const REQUEST_HEADER *ret = NULL;
+
+	if (Cursor->Index < View->RecordCount) {
+		memcpy(&recordSize, View->Data + Cursor->Offset, sizeof(recordSize));
+		ret = (const REQUEST_HEADER *)(View->Data + Cursor->Offset + sizeof(recordSize));
+		Cursor->Offset += sizeof(recordSize) + recordSize;
+		++Cursor->Index;
+	}
+
+	return ret;
+}
+
+
+/** Returns a record by its index, or NULL if the index is out of range. */
+const REQUEST_HEADER *RequestLogViewGet(const REQUEST_LOG_VIEW *View, ULONG64 Index)
+{
+	REQUEST_LOG_VIEW_CURSOR cursor;
+	const REQUEST_HEADER *ret = NULL;
+
+	if (RequestLogViewSeek(View, Index, &cursor) == ERROR_VALUE_SUCCESS)
+		ret = RequestLogViewNext(View, &cursor);
+
+	return ret;
+}
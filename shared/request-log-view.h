@@ -0,0 +1,51 @@
+
+#ifndef __SHARED_REQUEST_LOG_VIEW_H__
+#define __SHARED_REQUEST_LOG_VIEW_H__
+
+/** Random access to flat (version 1) logs.
+ *
+ *  The log file is mapped into memory and an index of record offsets is built
+ *  when the view is opened. Records are returned as pointers into the mapping,
+ *  nothing is copied, so even very large logs can be browsed with a small
+ *  working set. The index keeps the offset of every IndexStride-th record;
+ *  a stride of one gives constant-time access at the cost of 8 bytes per
+ *  record, larger strides trade memory for a short forward walk.
+ *
+ *  The whole file is mapped at once, so 32-bit processes can open only logs
+ *  that fit into their address space.
+ */
+
+#include "general-types.h"
+#include "request.h"
+
+
+
+typedef struct _REQUEST_LOG_VIEW REQUEST_LOG_VIEW, *PREQUEST_LOG_VIEW;
+
+/** Position within a view, used for sequential reading. */
+typedef struct _REQUEST_LOG_VIEW_CURSOR {
+	/** Index of the record returned by the next RequestLogViewNext call. */
+	ULONG64 Index;
+	/** Offset of that record within the file. */
+	ULONG64 Offset;
+} REQUEST_LOG_VIEW_CURSOR, *PREQUEST_LOG_VIEW_CURSOR;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ERROR_TYPE RequestLogViewOpen(const wchar_t *FileName, ULONG IndexStride, PREQUEST_LOG_VIEW *View);
+void RequestLogViewClose(PREQUEST_LOG_VIEW View);
+ULONG64 RequestLogViewCount(const REQUEST_LOG_VIEW *View);
+ERROR_TYPE RequestLogViewSeek(const REQUEST_LOG_VIEW *View, ULONG64 Index, PREQUEST_LOG_VIEW_CURSOR Cursor);
+const REQUEST_HEADER *RequestLogViewNext(const REQUEST_LOG_VIEW *View, PREQUEST_LOG_VIEW_CURSOR Cursor);
+const REQUEST_HEADER *RequestLogViewGet(const REQUEST_LOG_VIEW *View, ULONG64 Index);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
@@ -0,0 +1,964 @@
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-codec.h"
+#include "request-log.h"
+
+
+
+/************************************************************************/
+/*                     TYPES AND MACROS                                 */
+/************************************************************************/
+
+
+#define _LogAlloc(aSize)					HeapAlloc(GetProcessHeap(), 0, (aSize))
+#define _LogReAlloc(aBuffer, aSize)			(((aBuffer) != NULL) ? HeapReAlloc(GetProcessHeap(), 0, (aBuffer), (aSize)) : HeapAlloc(GetProcessHeap(), 0, (aSize)))
+#define _LogFree(aBuffer)					HeapFree(GetProcessHeap(), 0, (aBuffer))
+#define _LogSeek(aFile, aOffset, aOrigin)	_fseeki64((aFile), (aOffset), (aOrigin))
+#define _LogTell(aFile)						_ftelli64((aFile))
+
+/** Width of the column values, indexed by ERequestLogColumn. */
+static const ULONG _columnWidths[rlcMax] = {
+	sizeof(ULONG64),
+	sizeof(ULONG64),
+	sizeof(ULONG64),
+	sizeof(ULONG),
+	sizeof(UCHAR),
+	sizeof(UCHAR),
+	sizeof(UCHAR),
+};
+
+/** Upper bound of the decompressed block size accepted by the reader; protects
+    against huge allocations requested by corrupted files. */
+#define REQUEST_LOG_MAX_BLOCK_IMAGE_SIZE	0x40000000
+
+/** One full block on its way to the file. */
+typedef struct _REQUEST_LOG_JOB {
+	/** Decompressed image of the block, starting with its header. */
+	unsigned char *Image;
+	size_t ImageSize;
+	size_t ImageCapacity;
+	/** Compressed image of the block. */
+	unsigned char *Stored;
+	size_t StoredCapacity;
+	/** Points either to Image or to Stored. */
+	const unsigned char *Output;
+	size_t OutputSize;
+	REQUEST_LOG_INDEX_ENTRY Entry;
+	BOOLEAN Done;
+	ERROR_TYPE Result;
+} REQUEST_LOG_JOB, *PREQUEST_LOG_JOB;
+
+struct _REQUEST_LOG_WRITER {
+	FILE *File;
+	ULONG BlockSize;
+	EBlockCodecMethod Compression;
+	/** File offset of the next block. */
+	ULONG64 Offset;
+	ULONG64 TotalRecords;
+	REQUEST_CODEC_STATE Codec;
+	/** Column arrays of the current block, indexed by ERequestLogColumn. */
+	unsigned char *Columns[rlcMax];
+	size_t ColumnCapacity;
+	ULONG RecordCount;
+	ULONG FirstId;
+	ULONG LastId;
+	LONG64 MinTime;
+	LONG64 MaxTime;
+	unsigned char *Records;
+	size_t RecordsSize;
+	size_t RecordsCapacity;
+	PREQUEST_LOG_INDEX_ENTRY Index;
+	ULONG IndexCount;
+	size_t IndexCapacity;
+	/** Ring of blocks being compressed. Blocks are submitted at Tail, taken by
+	    the workers at Next and written to the file, in order, at Head. */
+	PREQUEST_LOG_JOB Jobs;
+	ULONG JobCount;
+	ULONG64 Head;
+	ULONG64 Next;
+	ULONG64 Tail;
+	ULONG WorkerCount;
+	HANDLE *Workers;
+	BOOLEAN Terminate;
+	CRITICAL_SECTION Lock;
+	CONDITION_VARIABLE WorkAvailable;
+	CONDITION_VARIABLE JobDone;
+	/** First failure of writing a block; the writer is unusable after it. */
+	ERROR_TYPE Error;
+};
+
+struct _REQUEST_LOG_READER {
+	FILE *File;
+	REQUEST_LOG_HEADER Header;
+	REQUEST_LOG_FOOTER Footer;
+	PREQUEST_LOG_INDEX_ENTRY Index;
+	/** Running maximum of the block MaxTime values; makes the search by time
+	    work even when records of neighbouring blocks overlap in time. */
+	LONG64 *MaxTimes;
+};
+
+/** Memory backing a block loaded by the reader. The block data follow. */
+typedef struct _REQUEST_LOG_BLOCK_CONTEXT {
+	REQUEST_CODEC_STATE Codec;
+	size_t Position;
+	ULONG Decoded;
+	ULONG Reserved;
+} REQUEST_LOG_BLOCK_CONTEXT, *PREQUEST_LOG_BLOCK_CONTEXT;
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+static FILE *_FileOpen(const wchar_t *FileName, BOOLEAN Write)
+{
+	FILE *ret = NULL;
+
+	ret = _wfopen(FileName, (Write) ? L"wb" : L"rb");
+
+	return ret;
+}
+
+
+static BOOLEAN _FileWrite(FILE *File, const void *Buffer, size_t Size)
+{
+	return (fwrite(Buffer, 1, Size, File) == Size);
+}
+
+
+static BOOLEAN _FileRead(FILE *File, ULONG64 Offset, void *Buffer, size_t Size)
+{
+	return (_LogSeek(File, (LONG64)Offset, SEEK_SET) == 0 && fread(Buffer, 1, Size, File) == Size);
+}
+
+
+static BOOLEAN _Grow(void **Buffer, size_t ElementSize, size_t Required, size_t *Capacity)
+{
+	size_t newCapacity = 0;
+	void *tmp = NULL;
+	BOOLEAN ret = TRUE;
+
+	if (Required > *Capacity) {
+		newCapacity = (*Capacity > 0) ? *Capacity * 2 : 64;
+		if (newCapacity < Required)
+			newCapacity = Required;
+
+		tmp = _LogReAlloc(*Buffer, newCapacity*ElementSize);
+		ret = (tmp != NULL);
+		if (ret) {
+			*Buffer = tmp;
+			*Capacity = newCapacity;
+		}
+	}
+
+	return ret;
+}
+
+
+static void _RequestColumns(const REQUEST_HEADER *Request, PULONG Status, PUCHAR Major, PUCHAR Minor)
+{
+	const REQUEST_GENERAL *rg = (const REQUEST_GENERAL *)Request;
+
+	*Status = 0;
+	*Major = 0;
+	*Minor = 0;
+	if (Request->ResultType == rrtNTSTATUS)
+		*Status = (ULONG)Request->Result.NTSTATUSValue;
+
+	switch (Request->Type) {
+		case ertIRP:
+			*Major = rg->RequestTypes.Irp.MajorFunction;
+			*Minor = rg->RequestTypes.Irp.MinorFunction;
+			break;
+		case ertIRPCompletion:
+			*Status = (ULONG)rg->RequestTypes.IrpComplete.CompletionStatus;
+			*Major = (UCHAR)rg->RequestTypes.IrpComplete.MajorFunction;
+			*Minor = (UCHAR)rg->RequestTypes.IrpComplete.MinorFunction;
+			break;
+		case ertStartIo:
+			*Major = rg->RequestTypes.StartIo.MajorFunction;
+			*Minor = rg->RequestTypes.StartIo.MinorFunction;
+			break;
+		case ertFastIo:
+			*Major = (UCHAR)rg->RequestTypes.FastIo.FastIoType;
+			break;
+		default:
+			break;
+	}
+
+	return;
+}
+
+
+/** Compresses the image of a block. The block is stored uncompressed
+ *  when compression does not make it smaller.
+ */
+static void _JobCompress(EBlockCodecMethod Method, PREQUEST_LOG_JOB Job)
+{
+	size_t written = 0;
+	PREQUEST_LOG_BLOCK_HEADER h = (PREQUEST_LOG_BLOCK_HEADER)Job->Image;
+	ERROR_TYPE err = ERROR_VALUE_INVAL;
+
+	Job->Result = ERROR_VALUE_SUCCESS;
+	Job->Output = Job->Image;
+	Job->OutputSize = Job->ImageSize;
+	h->Compression = bcmNone;
+	h->StoredSize = (ULONG)Job->ImageSize;
+	if (Method != bcmNone) {
+		if (_Grow((void **)&Job->Stored, 1, Job->ImageSize, &Job->StoredCapacity)) {
+			err = BlockCodecCompress(Method, Job->Image + sizeof(REQUEST_LOG_BLOCK_HEADER), Job->ImageSize - sizeof(REQUEST_LOG_BLOCK_HEADER), Job->Stored + sizeof(REQUEST_LOG_BLOCK_HEADER), Job->ImageSize - sizeof(REQUEST_LOG_BLOCK_HEADER) - 1, &written);
+			if (err == ERROR_VALUE_SUCCESS) {
+				memcpy(Job->Stored, h, sizeof(REQUEST_LOG_BLOCK_HEADER));
+				h = (PREQUEST_LOG_BLOCK_HEADER)Job->Stored;
+				h->Compression = Method;
+				h->StoredSize = (ULONG)(sizeof(REQUEST_LOG_BLOCK_HEADER) + written);
+				Job->Output = Job->Stored;
+				Job->OutputSize = h->StoredSize;
+			} else if (err != ERROR_VALUE_BUFFER_TOO_SMALL)
+				Job->Result = err;
+		} else Job->Result = ERROR_VALUE_NOMEM;
+	}
+
+	return;
+}
+
+
+static DWORD WINAPI _WorkerThread(PVOID Context)
+{
+	PREQUEST_LOG_JOB job = NULL;
+	PREQUEST_LOG_WRITER writer = (PREQUEST_LOG_WRITER)Context;
+
+	EnterCriticalSection(&writer->Lock);
+	while (!writer->Terminate || writer->Next != writer->Tail) {
+		if (writer->Next == writer->Tail) {
+			SleepConditionVariableCS(&writer->WorkAvailable, &writer->Lock, INFINITE);
+			continue;
+		}
+
+		job = writer->Jobs + (writer->Next % writer->JobCount);
+		++writer->Next;
+		LeaveCriticalSection(&writer->Lock);
+		_JobCompress(writer->Compression, job);
+		EnterCriticalSection(&writer->Lock);
+		job->Done = TRUE;
+		WakeAllConditionVariable(&writer->JobDone);
+	}
+
+	LeaveCriticalSection(&writer->Lock);
+
+	return 0;
+}
+
+
+/** Writes finished blocks to the file, in the order they were submitted.
+ *
+ *  @param Wait Whether to wait for the oldest block to be compressed.
+ *  Blocks that are not yet done are otherwise left for a later call.
+ */
+static ERROR_TYPE _WriterRetire(PREQUEST_LOG_WRITER Writer, BOOLEAN Wait)
+{
+	BOOLEAN done = FALSE;
+	PREQUEST_LOG_JOB job = NULL;
+	PREQUEST_LOG_INDEX_ENTRY entry = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	while (ret == ERROR_VALUE_SUCCESS && Writer->Head != Writer->Tail) {
+		job = Writer->Jobs + (Writer->Head % Writer->JobCount);
+		done = TRUE;
+		if (Writer->WorkerCount > 0) {
+			EnterCriticalSection(&Writer->Lock);
+			while (Wait && !job->Done)
+				SleepConditionVariableCS(&Writer->JobDone, &Writer->Lock, INFINITE);
+
+			done = job->Done;
+			LeaveCriticalSection(&Writer->Lock);
+		}
+
+		if (!done)
+			break;
+
+		ret = job->Result;
+		if (ret == ERROR_VALUE_SUCCESS) {
+			ret = ERROR_VALUE_NOMEM;
+			if (_Grow((void **)&Writer->Index, sizeof(REQUEST_LOG_INDEX_ENTRY), Writer->IndexCount + 1, &Writer->IndexCapacity)) {
+				ret = ERROR_VALUE_IO;
+				if (_FileWrite(Writer->File, job->Output, job->OutputSize)) {
+					entry = Writer->Index + Writer->IndexCount;
+					*entry = job->Entry;
+					entry->Offset = Writer->Offset;
+					entry->Size = (ULONG)job->OutputSize;
+					++Writer->IndexCount;
+					Writer->Offset += job->OutputSize;
+					ret = ERROR_VALUE_SUCCESS;
+				}
+			}
+		}
+
+		++Writer->Head;
+		Wait = FALSE;
+	}
+
+	if (ret != ERROR_VALUE_SUCCESS && Writer->Error == ERROR_VALUE_SUCCESS)
+		Writer->Error = ret;
+
+	return ret;
+}
+
+
+/** Turns the collected records into a block image and passes it to
+ *  the workers, or compresses it right away when there are none.
+ */
+static ERROR_TYPE _WriterFlushBlock(PREQUEST_LOG_WRITER Writer)
+{
+	ULONG i = 0;
+	ULONG offset = 0;
+	ULONG padding = 0;
+	PREQUEST_LOG_JOB job = NULL;
+	PREQUEST_LOG_BLOCK_HEADER h = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	if (Writer->RecordCount > 0) {
+		if (Writer->Tail - Writer->Head == Writer->JobCount)
+			ret = _WriterRetire(Writer, TRUE);
+
+		if (ret == ERROR_VALUE_SUCCESS) {
+			job = Writer->Jobs + (Writer->Tail % Writer->JobCount);
+			offset = sizeof(REQUEST_LOG_BLOCK_HEADER);
+			for (i = 0; i < rlcMax; ++i)
+				offset += Writer->RecordCount*_columnWidths[i];
+
+			padding = ((offset + 7) & ~7) - offset;
+			ret = ERROR_VALUE_NOMEM;
+			if (_Grow((void **)&job->Image, 1, offset + padding + Writer->RecordsSize, &job->ImageCapacity)) {
+				job->ImageSize = offset + padding + Writer->RecordsSize;
+				h = (PREQUEST_LOG_BLOCK_HEADER)job->Image;
+				memset(h, 0, sizeof(REQUEST_LOG_BLOCK_HEADER));
+				h->Signature = REQUEST_LOG_BLOCK_SIGNATURE;
+				h->HeaderSize = sizeof(REQUEST_LOG_BLOCK_HEADER);
+				h->BlockSize = (ULONG)job->ImageSize;
+				h->RecordCount = Writer->RecordCount;
+				h->FirstId = Writer->FirstId;
+				h->LastId = Writer->LastId;
+				h->MinTime = Writer->MinTime;
+				h->MaxTime = Writer->MaxTime;
+				offset = sizeof(REQUEST_LOG_BLOCK_HEADER);
+				for (i = 0; i < rlcMax; ++i) {
+					h->ColumnOffsets[i] = offset;
+					memcpy(job->Image + offset, Writer->Columns[i], Writer->RecordCount*_columnWidths[i]);
+					offset += Writer->RecordCount*_columnWidths[i];
+				}
+
+				memset(job->Image + offset, 0, padding);
+				h->RecordsOffset = offset + padding;
+				h->RecordsSize = (ULONG)Writer->RecordsSize;
+				memcpy(job->Image + h->RecordsOffset, Writer->Records, Writer->RecordsSize);
+				memset(&job->Entry, 0, sizeof(job->Entry));
+				job->Entry.RecordCount = h->RecordCount;
+				job->Entry.FirstId = h->FirstId;
+				job->Entry.LastId = h->LastId;
+				job->Entry.MinTime = h->MinTime;
+				job->Entry.MaxTime = h->MaxTime;
+				Writer->RecordCount = 0;
+				Writer->RecordsSize = 0;
+				if (Writer->WorkerCount > 0) {
+					EnterCriticalSection(&Writer->Lock);
+					job->Done = FALSE;
+					++Writer->Tail;
+					WakeConditionVariable(&Writer->WorkAvailable);
+					LeaveCriticalSection(&Writer->Lock);
+				} else {
+					_JobCompress(Writer->Compression, job);
+					++Writer->Tail;
+				}
+
+				ret = _WriterRetire(Writer, FALSE);
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     WRITER                                           */
+/************************************************************************/
+
+
+/** Stops the worker threads after they compress all submitted blocks. */
+static void _WriterStopWorkers(PREQUEST_LOG_WRITER Writer, ULONG Count)
+{
+	ULONG i = 0;
+
+	EnterCriticalSection(&Writer->Lock);
+	Writer->Terminate = TRUE;
+	WakeAllConditionVariable(&Writer->WorkAvailable);
+	LeaveCriticalSection(&Writer->Lock);
+	for (i = 0; i < Count; ++i) {
+		WaitForSingleObject(Writer->Workers[i], INFINITE);
+		CloseHandle(Writer->Workers[i]);
+	}
+
+	return;
+}
+
+
+static void _WriterFree(PREQUEST_LOG_WRITER Writer)
+{
+	ULONG i = 0;
+
+	if (Writer->WorkerCount > 0) {
+		DeleteCriticalSection(&Writer->Lock);
+		_LogFree(Writer->Workers);
+	}
+
+	for (i = 0; i < Writer->JobCount; ++i) {
+		if (Writer->Jobs[i].Image != NULL)
+			_LogFree(Writer->Jobs[i].Image);
+
+		if (Writer->Jobs[i].Stored != NULL)
+			_LogFree(Writer->Jobs[i].Stored);
+	}
+
+	for (i = 0; i < rlcMax; ++i) {
+		if (Writer->Columns[i] != NULL)
+			_LogFree(Writer->Columns[i]);
+	}
+
+	if (Writer->Records != NULL)
+		_LogFree(Writer->Records);
+
+	if (Writer->Index != NULL)
+		_LogFree(Writer->Index);
+
+	_LogFree(Writer->Jobs);
+	_LogFree(Writer);
+
+	return;
+}
+
+
+/** Creates a new log file.
+ *
+ *  @param FileName Name of the file. An existing file is overwritten.
+ *  @param BlockSize Amount of encoded record data collected into one block,
+ *  zero selects the default.
+ *  @param Compression Method used to compress the blocks.
+ *  @param WorkerCount Number of threads compressing full blocks. When zero,
+ *  blocks are compressed by the thread calling RequestLogWriterAppend.
+ *  @param Writer Receives the writer.
+ */
+ERROR_TYPE RequestLogWriterOpen(const wchar_t *FileName, ULONG BlockSize, EBlockCodecMethod Compression, ULONG WorkerCount, PREQUEST_LOG_WRITER *Writer)
+{
+	ULONG i = 0;
+	REQUEST_LOG_HEADER header;
+	PREQUEST_LOG_WRITER tmpWriter = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	if (BlockSize == 0)
+		BlockSize = REQUEST_LOG_DEFAULT_BLOCK_SIZE;
+
+	if (BlockSize >= REQUEST_LOG_MIN_BLOCK_SIZE && BlockSize <= REQUEST_LOG_MAX_BLOCK_SIZE &&
+		BlockCodecSupported(Compression) && WorkerCount <= REQUEST_LOG_MAX_WORKERS) {
+		ret = ERROR_VALUE_NOMEM;
+		tmpWriter = (PREQUEST_LOG_WRITER)_LogAlloc(sizeof(REQUEST_LOG_WRITER));
+		if (tmpWriter != NULL) {
+			memset(tmpWriter, 0, sizeof(REQUEST_LOG_WRITER));
+			tmpWriter->BlockSize = BlockSize;
+			tmpWriter->Compression = Compression;
+			tmpWriter->JobCount = (WorkerCount > 0) ? 2 * WorkerCount : 1;
+			tmpWriter->Jobs = (PREQUEST_LOG_JOB)_LogAlloc(tmpWriter->JobCount*sizeof(REQUEST_LOG_JOB));
+			if (tmpWriter->Jobs != NULL) {
+				memset(tmpWriter->Jobs, 0, tmpWriter->JobCount*sizeof(REQUEST_LOG_JOB));
+				ret = ERROR_VALUE_SUCCESS;
+				if (WorkerCount > 0) {
+					ret = ERROR_VALUE_NOMEM;
+					tmpWriter->Workers = (HANDLE *)_LogAlloc(WorkerCount*sizeof(HANDLE));
+					if (tmpWriter->Workers != NULL) {
+						tmpWriter->WorkerCount = WorkerCount;
+						InitializeCriticalSection(&tmpWriter->Lock);
+						InitializeConditionVariable(&tmpWriter->WorkAvailable);
+						InitializeConditionVariable(&tmpWriter->JobDone);
+						ret = ERROR_VALUE_SUCCESS;
+						for (i = 0; i < WorkerCount; ++i) {
+							tmpWriter->Workers[i] = CreateThread(NULL, 0, _WorkerThread, tmpWriter, 0, NULL);
+							if (tmpWriter->Workers[i] == NULL) {
+								ret = GetLastError();
+								_WriterStopWorkers(tmpWriter, i);
+								break;
+							}
+						}
+					}
+				}
+
+				if (ret == ERROR_VALUE_SUCCESS) {
+					ret = ERROR_VALUE_IO;
+					tmpWriter->File = _FileOpen(FileName, TRUE);
+					if (tmpWriter->File != NULL) {
+						memset(&header, 0, sizeof(header));
+						header.Signature = REQUEST_LOG_SIGNATURE;
+						header.Version = REQUEST_LOG_VERSION_2;
+						header.Architecture = REQUEST_LOG_ARCHITECTURE;
+						header.HeaderSize = sizeof(header);
+						header.BlockSize = BlockSize;
+						if (_FileWrite(tmpWriter->File, &header, sizeof(header))) {
+							tmpWriter->Offset = sizeof(header);
+							*Writer = tmpWriter;
+							ret = ERROR_VALUE_SUCCESS;
+						}
+
+						if (ret != ERROR_VALUE_SUCCESS)
+							fclose(tmpWriter->File);
+					}
+
+					if (ret != ERROR_VALUE_SUCCESS && tmpWriter->WorkerCount > 0)
+						_WriterStopWorkers(tmpWriter, tmpWriter->WorkerCount);
+				}
+			}
+
+			if (ret != ERROR_VALUE_SUCCESS)
+				_WriterFree(tmpWriter);
+		}
+	}
+
+	return ret;
+}
+
+
+/** Appends one request to the log. The request is copied, so the caller
+ *  may free it when the routine returns.
+ */
+ERROR_TYPE RequestLogWriterAppend(PREQUEST_LOG_WRITER Writer, const REQUEST_HEADER *Request)
+{
+	ULONG i = 0;
+	size_t maxSize = 0;
+	size_t written = 0;
+	size_t capacity = 0;
+	void *tmp = NULL;
+	ULONG64 value64 = 0;
+	ULONG status = 0;
+	UCHAR major = 0;
+	UCHAR minor = 0;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	ret = Writer->Error;
+	if (ret == ERROR_VALUE_SUCCESS) {
+		ret = ERROR_VALUE_INVAL;
+		maxSize = RequestCodecEncodedSizeMax(Request);
+		if (maxSize > 0) {
+			ret = ERROR_VALUE_NOMEM;
+			if (_Grow((void **)&Writer->Records, 1, Writer->RecordsSize + maxSize, &Writer->RecordsCapacity)) {
+				ret = ERROR_VALUE_SUCCESS;
+				if (Writer->RecordCount == Writer->ColumnCapacity) {
+					capacity = (Writer->ColumnCapacity > 0) ? Writer->ColumnCapacity * 2 : 64;
+					for (i = 0; i < rlcMax; ++i) {
+						tmp = _LogReAlloc(Writer->Columns[i], capacity*_columnWidths[i]);
+						if (tmp == NULL) {
+							ret = ERROR_VALUE_NOMEM;
+							break;
+						}
+
+						Writer->Columns[i] = (unsigned char *)tmp;
+					}
+
+					if (ret == ERROR_VALUE_SUCCESS)
+						Writer->ColumnCapacity = capacity;
+				}
+
+				if (ret == ERROR_VALUE_SUCCESS) {
+					if (Writer->RecordCount == 0) {
+						RequestCodecInit(&Writer->Codec);
+						Writer->FirstId = Request->Id;
+						Writer->MinTime = Request->Time.QuadPart;
+						Writer->MaxTime = Request->Time.QuadPart;
+					}
+
+					ret = RequestCodecEncode(&Writer->Codec, Request, Writer->Records + Writer->RecordsSize, Writer->RecordsCapacity - Writer->RecordsSize, &written);
+					if (ret == ERROR_VALUE_SUCCESS) {
+						Writer->RecordsSize += written;
+						i = Writer->RecordCount;
+						value64 = (ULONG_PTR)Request->Driver;
+						memcpy(Writer->Columns[rlcDriver] + i*sizeof(ULONG64), &value64, sizeof(value64));
+						value64 = (ULONG_PTR)Request->Device;
+						memcpy(Writer->Columns[rlcDevice] + i*sizeof(ULONG64), &value64, sizeof(value64));
+						value64 = (ULONG_PTR)Request->ProcessId;
+						memcpy(Writer->Columns[rlcProcessId] + i*sizeof(ULONG64), &value64, sizeof(value64));
+						_RequestColumns(Request, &status, &major, &minor);
+						memcpy(Writer->Columns[rlcStatus] + i*sizeof(ULONG), &status, sizeof(status));
+						Writer->Columns[rlcType][i] = (UCHAR)Request->Type;
+						Writer->Columns[rlcMajor][i] = major;
+						Writer->Columns[rlcMinor][i] = minor;
+						Writer->LastId = Request->Id;
+						if (Request->Time.QuadPart < Writer->MinTime)
+							Writer->MinTime = Request->Time.QuadPart;
+
+						if (Request->Time.QuadPart > Writer->MaxTime)
+							Writer->MaxTime = Request->Time.QuadPart;
+
+						++Writer->RecordCount;
+						++Writer->TotalRecords;
+						if (Writer->RecordsSize >= Writer->BlockSize)
+							ret = _WriterFlushBlock(Writer);
+					}
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+/** Writes the remaining records and the index, closes the file and frees
+ *  the writer. The writer is freed even if the routine fails.
+ */
+ERROR_TYPE RequestLogWriterClose(PREQUEST_LOG_WRITER Writer)
+{
+	REQUEST_LOG_FOOTER footer;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	ret = Writer->Error;
+	if (ret == ERROR_VALUE_SUCCESS)
+		ret = _WriterFlushBlock(Writer);
+
+	while (ret == ERROR_VALUE_SUCCESS && Writer->Head != Writer->Tail)
+		ret = _WriterRetire(Writer, TRUE);
+
+	if (Writer->WorkerCount > 0)
+		_WriterStopWorkers(Writer, Writer->WorkerCount);
+
+	if (ret == ERROR_VALUE_SUCCESS) {
+		memset(&footer, 0, sizeof(footer));
+		footer.Signature = REQUEST_LOG_FOOTER_SIGNATURE;
+		footer.EntryCount = Writer->IndexCount;
+		footer.IndexOffset = Writer->Offset;
+		footer.RecordCount = Writer->TotalRecords;
+		if (!_FileWrite(Writer->File, Writer->Index, Writer->IndexCount*sizeof(REQUEST_LOG_INDEX_ENTRY)) ||
+			!_FileWrite(Writer->File, &footer, sizeof(footer)))
+			ret = ERROR_VALUE_IO;
+	}
+
+	if (fclose(Writer->File) != 0 && ret == ERROR_VALUE_SUCCESS)
+		ret = ERROR_VALUE_IO;
+
+	_WriterFree(Writer);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     READER                                           */
+/************************************************************************/
+
+
+/** Opens a log file. Only the header and the block index are read. */
+ERROR_TYPE RequestLogReaderOpen(const wchar_t *FileName, PREQUEST_LOG_READER *Reader)
+{
+	ULONG i = 0;
+	LONG64 fileSize = 0;
+	LONG64 maxTime = 0;
+	const REQUEST_LOG_INDEX_ENTRY *entry = NULL;
+	PREQUEST_LOG_READER tmpReader = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_NOMEM;
+
+	tmpReader = (PREQUEST_LOG_READER)_LogAlloc(sizeof(REQUEST_LOG_READER));
+	if (tmpReader != NULL) {
+		memset(tmpReader, 0, sizeof(REQUEST_LOG_READER));
+		ret = ERROR_VALUE_IO;
+		tmpReader->File = _FileOpen(FileName, FALSE);
+		if (tmpReader->File != NULL) {
+			if (_LogSeek(tmpReader->File, 0, SEEK_END) == 0)
+				fileSize = _LogTell(tmpReader->File);
+
+			if (fileSize >= (LONG64)(sizeof(REQUEST_LOG_HEADER) + sizeof(REQUEST_LOG_FOOTER)) &&
+				_FileRead(tmpReader->File, 0, &tmpReader->Header, sizeof(tmpReader->Header)) &&
+				_FileRead(tmpReader->File, fileSize - sizeof(REQUEST_LOG_FOOTER), &tmpReader->Footer, sizeof(tmpReader->Footer))) {
+				ret = ERROR_VALUE_INVAL;
+				if (tmpReader->Header.Signature == REQUEST_LOG_SIGNATURE &&
+					tmpReader->Header.Version == REQUEST_LOG_VERSION_2 &&
+					tmpReader->Header.Architecture == REQUEST_LOG_ARCHITECTURE &&
+					tmpReader->Header.HeaderSize >= sizeof(REQUEST_LOG_HEADER) &&
+					tmpReader->Footer.Signature == REQUEST_LOG_FOOTER_SIGNATURE &&
+					tmpReader->Footer.IndexOffset >= tmpReader->Header.HeaderSize &&
+					tmpReader->Footer.IndexOffset + (ULONG64)tmpReader->Footer.EntryCount*sizeof(REQUEST_LOG_INDEX_ENTRY) + sizeof(REQUEST_LOG_FOOTER) == (ULONG64)fileSize) {
+					ret = ERROR_VALUE_NOMEM;
+					tmpReader->Index = (PREQUEST_LOG_INDEX_ENTRY)_LogAlloc(tmpReader->Footer.EntryCount*sizeof(REQUEST_LOG_INDEX_ENTRY) + 1);
+					tmpReader->MaxTimes = (LONG64 *)_LogAlloc(tmpReader->Footer.EntryCount*sizeof(LONG64) + 1);
+					if (tmpReader->Index != NULL && tmpReader->MaxTimes != NULL) {
+						ret = ERROR_VALUE_IO;
+						if (_FileRead(tmpReader->File, tmpReader->Footer.IndexOffset, tmpReader->Index, tmpReader->Footer.EntryCount*sizeof(REQUEST_LOG_INDEX_ENTRY))) {
+							ret = ERROR_VALUE_SUCCESS;
+							for (i = 0; i < tmpReader->Footer.EntryCount; ++i) {
+								entry = tmpReader->Index + i;
+								if (entry->Offset < tmpReader->Header.HeaderSize ||
+									entry->Size < sizeof(REQUEST_LOG_BLOCK_HEADER) ||
+									entry->Offset + entry->Size > tmpReader->Footer.IndexOffset) {
+									ret = ERROR_VALUE_INVAL;
+									break;
+								}
+
+								if (i == 0 || entry->MaxTime > maxTime)
+									maxTime = entry->MaxTime;
+
+								tmpReader->MaxTimes[i] = maxTime;
+							}
+
+							if (ret == ERROR_VALUE_SUCCESS)
+								*Reader = tmpReader;
+						}
+					}
+
+					if (ret != ERROR_VALUE_SUCCESS) {
+						if (tmpReader->MaxTimes != NULL)
+							_LogFree(tmpReader->MaxTimes);
+
+						if (tmpReader->Index != NULL)
+							_LogFree(tmpReader->Index);
+					}
+				}
+			}
+
+			if (ret != ERROR_VALUE_SUCCESS)
+				fclose(tmpReader->File);
+		}
+
+		if (ret != ERROR_VALUE_SUCCESS)
+			_LogFree(tmpReader);
+	}
+
+	return ret;
+}
+
+
+void RequestLogReaderClose(PREQUEST_LOG_READER Reader)
+{
+	fclose(Reader->File);
+	_LogFree(Reader->MaxTimes);
+	_LogFree(Reader->Index);
+	_LogFree(Reader);
+
+	return;
+}
+
+
+ULONG RequestLogReaderBlockCount(const REQUEST_LOG_READER *Reader)
+{
+	return Reader->Footer.EntryCount;
+}
+
+
+ULONG64 RequestLogReaderRecordCount(const REQUEST_LOG_READER *Reader)
+{
+	return Reader->Footer.RecordCount;
+}
+
+
+const REQUEST_LOG_INDEX_ENTRY *RequestLogReaderBlockInfo(const REQUEST_LOG_READER *Reader, ULONG Index)
+{
+	const REQUEST_LOG_INDEX_ENTRY *ret = NULL;
+
+	if (Index < Reader->Footer.EntryCount)
+		ret = Reader->Index + Index;
+
+	return ret;
+}
+
+
+/** Finds the first block that may contain records at or after a given time.
+ *
+ *  @return
+ *  Returns index of the block, or the number of blocks when all records
+ *  are older.
+ */
+ULONG RequestLogReaderFindByTime(const REQUEST_LOG_READER *Reader, LONG64 Time)
+{
+	ULONG lo = 0;
+	ULONG hi = Reader->Footer.EntryCount;
+	ULONG mid = 0;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (Reader->MaxTimes[mid] < Time)
+			lo = mid + 1;
+		else hi = mid;
+	}
+
+	return lo;
+}
+
+
+/** Finds the block containing a request with a given ID. Request IDs grow
+ *  through the log, so the blocks are ordered by them.
+ *
+ *  @return
+ *  Returns index of the block, or the number of blocks when the ID is greater
+ *  than IDs of all stored requests.
+ */
+ULONG RequestLogReaderFindById(const REQUEST_LOG_READER *Reader, ULONG Id)
+{
+	ULONG lo = 0;
+	ULONG hi = Reader->Footer.EntryCount;
+	ULONG mid = 0;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (Reader->Index[mid].LastId < Id)
+			lo = mid + 1;
+		else hi = mid;
+	}
+
+	return lo;
+}
+
+
+/** Reads a block from the file and decompresses it when necessary.
+ *
+ *  @param Context Receives the block context, followed by the decompressed
+ *  image of the block. The context itself is not initialized.
+ */
+static ERROR_TYPE _ReaderReadBlock(PREQUEST_LOG_READER Reader, const REQUEST_LOG_INDEX_ENTRY *Entry, PREQUEST_LOG_BLOCK_CONTEXT *Context)
+{
+	const REQUEST_LOG_BLOCK_HEADER *h = NULL;
+	PREQUEST_LOG_BLOCK_CONTEXT stored = NULL;
+	PREQUEST_LOG_BLOCK_CONTEXT ctx = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_NOMEM;
+
+	stored = (PREQUEST_LOG_BLOCK_CONTEXT)_LogAlloc(sizeof(REQUEST_LOG_BLOCK_CONTEXT) + Entry->Size);
+	if (stored != NULL) {
+		h = (const REQUEST_LOG_BLOCK_HEADER *)(stored + 1);
+		ret = ERROR_VALUE_IO;
+		if (_FileRead(Reader->File, Entry->Offset, stored + 1, Entry->Size)) {
+			ret = ERROR_VALUE_INVAL;
+			if (h->Signature == REQUEST_LOG_BLOCK_SIGNATURE &&
+				h->HeaderSize >= sizeof(REQUEST_LOG_BLOCK_HEADER) &&
+				h->StoredSize == Entry->Size &&
+				h->HeaderSize <= h->StoredSize &&
+				h->HeaderSize <= h->BlockSize &&
+				h->BlockSize <= REQUEST_LOG_MAX_BLOCK_IMAGE_SIZE) {
+				if (h->Compression == bcmNone) {
+					if (h->BlockSize == h->StoredSize) {
+						ctx = stored;
+						stored = NULL;
+						ret = ERROR_VALUE_SUCCESS;
+					}
+				} else if (h->Compression < bcmMax && BlockCodecSupported((EBlockCodecMethod)h->Compression)) {
+					ret = ERROR_VALUE_NOMEM;
+					ctx = (PREQUEST_LOG_BLOCK_CONTEXT)_LogAlloc(sizeof(REQUEST_LOG_BLOCK_CONTEXT) + h->BlockSize);
+					if (ctx != NULL) {
+						memcpy(ctx + 1, h, h->HeaderSize);
+						ret = BlockCodecDecompress((EBlockCodecMethod)h->Compression, (const unsigned char *)h + h->HeaderSize, h->StoredSize - h->HeaderSize, (unsigned char *)(ctx + 1) + h->HeaderSize, h->BlockSize - h->HeaderSize);
+						if (ret != ERROR_VALUE_SUCCESS)
+							_LogFree(ctx);
+					}
+				}
+			}
+		}
+
+		if (stored != NULL)
+			_LogFree(stored);
+	}
+
+	if (ret == ERROR_VALUE_SUCCESS)
+		*Context = ctx;
+
+	return ret;
+}
+
+
+/** Reads one block into memory. The column arrays are available immediately;
+ *  the records are decoded one by one by RequestLogBlockNext. The block must be
+ *  released by RequestLogBlockFree.
+ */
+ERROR_TYPE RequestLogReaderLoadBlock(PREQUEST_LOG_READER Reader, ULONG Index, PREQUEST_LOG_BLOCK Block)
+{
+	ULONG i = 0;
+	unsigned char *data = NULL;
+	const REQUEST_LOG_BLOCK_HEADER *h = NULL;
+	PREQUEST_LOG_BLOCK_CONTEXT ctx = NULL;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	if (Index < Reader->Footer.EntryCount) {
+		ret = _ReaderReadBlock(Reader, Reader->Index + Index, &ctx);
+		if (ret == ERROR_VALUE_SUCCESS) {
+			memset(ctx, 0, sizeof(REQUEST_LOG_BLOCK_CONTEXT));
+			RequestCodecInit(&ctx->Codec);
+			data = (unsigned char *)(ctx + 1);
+			h = (const REQUEST_LOG_BLOCK_HEADER *)data;
+			ret = ERROR_VALUE_INVAL;
+			if (h->RecordCount == Reader->Index[Index].RecordCount &&
+				h->RecordsOffset <= h->BlockSize &&
+				h->RecordsSize <= h->BlockSize - h->RecordsOffset) {
+				ret = ERROR_VALUE_SUCCESS;
+				for (i = 0; i < rlcMax; ++i) {
+					if (h->ColumnOffsets[i] < h->HeaderSize ||
+						h->ColumnOffsets[i] % _columnWidths[i] != 0 ||
+						h->ColumnOffsets[i] > h->BlockSize ||
+						(ULONG64)h->RecordCount*_columnWidths[i] > h->BlockSize - h->ColumnOffsets[i]) {
+						ret = ERROR_VALUE_INVAL;
+						break;
+					}
+				}
+
+				if (ret == ERROR_VALUE_SUCCESS) {
+					Block->Header = h;
+					Block->RecordCount = h->RecordCount;
+					Block->Drivers = (const ULONG64 *)(data + h->ColumnOffsets[rlcDriver]);
+					Block->Devices = (const ULONG64 *)(data + h->ColumnOffsets[rlcDevice]);
+					Block->ProcessIds = (const ULONG64 *)(data + h->ColumnOffsets[rlcProcessId]);
+					Block->Statuses = (const ULONG *)(data + h->ColumnOffsets[rlcStatus]);
+					Block->Types = data + h->ColumnOffsets[rlcType];
+					Block->Majors = data + h->ColumnOffsets[rlcMajor];
+					Block->Minors = data + h->ColumnOffsets[rlcMinor];
+					Block->Context = ctx;
+				}
+			}
+
+			if (ret != ERROR_VALUE_SUCCESS)
+				_LogFree(ctx);
+		}
+	}
+
+	return ret;
+}
+
+
+/** Decodes the next record of a loaded block.
+ *
+ *  @param Request Receives the request, allocated by RequestMemoryAlloc,
+ *  or NULL when all records of the block have been returned.
+ */
+ERROR_TYPE RequestLogBlockNext(PREQUEST_LOG_BLOCK Block, PREQUEST_HEADER *Request)
+{
+	size_t consumed = 0;
+	const unsigned char *records = NULL;
+	PREQUEST_LOG_BLOCK_CONTEXT ctx = (PREQUEST_LOG_BLOCK_CONTEXT)Block->Context;
+	ERROR_TYPE ret = ERROR_VALUE_SUCCESS;
+
+	*Request = NULL;
+	if (ctx->Decoded < Block->RecordCount) {
+		records = (const unsigned char *)Block->Header + Block->Header->RecordsOffset;
+		ret = RequestCodecDecode(&ctx->Codec, records + ctx->Position, Block->Header->RecordsSize - ctx->Position, &consumed, Request);
+		if (ret == ERROR_VALUE_SUCCESS) {
+			ctx->Position += consumed;
+			++ctx->Decoded;
+		} else ret = ERROR_VALUE_INVAL;
+	}
+
+	return ret;
+}
+
+
+void RequestLogBlockFree(PREQUEST_LOG_BLOCK Block)
+{
+	_LogFree(Block->Context);
+	memset(Block, 0, sizeof(REQUEST_LOG_BLOCK));
+
+	return;
+}
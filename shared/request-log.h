@@ -0,0 +1,172 @@
+
+#ifndef __SHARED_REQUEST_LOG_H__
+#define __SHARED_REQUEST_LOG_H__
+
+/** Chunked binary log (version 2 of the IRPMNLOG format).
+ *
+ *  The file starts with a REQUEST_LOG_HEADER, which begins with the same
+ *  fields as the version 1 header, so older readers reject the file cleanly.
+ *  Blocks of records follow. Each block starts with a REQUEST_LOG_BLOCK_HEADER,
+ *  then contains column arrays of the hot request fields (one value per record)
+ *  and the records themselves in the compact encoding of request-codec.h.
+ *  The codec state is reset at the start of every block, so each block can
+ *  be decoded on its own. Everything following the block header may be
+ *  compressed by one of the block-codec.h methods; the writer compresses
+ *  full blocks on worker threads while new records keep coming. The file ends with an index of all blocks followed by
+ *  a REQUEST_LOG_FOOTER, so a reader can locate any block without scanning
+ *  the file.
+ */
+
+#include "general-types.h"
+#include "request.h"
+#include "block-codec.h"
+
+
+
+#define REQUEST_LOG_SIGNATURE				0x474f4c4e4d505249ULL	// 'IRPMNLOG'
+/** Flat log: each record is preceded by its size (ULONG). */
+#define REQUEST_LOG_VERSION_1				1
+#define REQUEST_LOG_VERSION_2				2
+#define REQUEST_LOG_ARCHITECTURE_X86		1
+#define REQUEST_LOG_ARCHITECTURE_X64		2
+
+#ifdef _WIN64
+#define REQUEST_LOG_ARCHITECTURE			REQUEST_LOG_ARCHITECTURE_X64
+#elif defined(_WIN32)
+#define REQUEST_LOG_ARCHITECTURE			REQUEST_LOG_ARCHITECTURE_X86
+#else
+#define REQUEST_LOG_ARCHITECTURE			((sizeof(void *) == 8) ? REQUEST_LOG_ARCHITECTURE_X64 : REQUEST_LOG_ARCHITECTURE_X86)
+#endif
+
+#define REQUEST_LOG_BLOCK_SIGNATURE			0x4b434c42		// 'BLCK'
+#define REQUEST_LOG_FOOTER_SIGNATURE		0x46584449		// 'IDXF'
+
+/** Default amount of encoded record data collected before a block is written. */
+#define REQUEST_LOG_DEFAULT_BLOCK_SIZE		0x40000
+#define REQUEST_LOG_MIN_BLOCK_SIZE			0x1000
+#define REQUEST_LOG_MAX_BLOCK_SIZE			0x1000000
+#define REQUEST_LOG_MAX_WORKERS				64
+
+/** Columns stored in every block. */
+typedef enum _ERequestLogColumn {
+	/** ULONG64, address of the driver object. */
+	rlcDriver,
+	/** ULONG64, address of the device object. */
+	rlcDevice,
+	/** ULONG64, ID of the process. */
+	rlcProcessId,
+	/** ULONG, NTSTATUS result of the request, zero if not applicable. */
+	rlcStatus,
+	/** UCHAR, type of the request. */
+	rlcType,
+	/** UCHAR, major function of IRPs, type of fast I/O operations. */
+	rlcMajor,
+	/** UCHAR, minor function of IRPs. */
+	rlcMinor,
+	rlcMax,
+} ERequestLogColumn, *PERequestLogColumn;
+
+/** Header of the flat log; also the first fields of REQUEST_LOG_HEADER. */
+typedef struct _REQUEST_LOG_HEADER_V1 {
+	ULONG64 Signature;
+	ULONG Version;
+	ULONG Architecture;
+} REQUEST_LOG_HEADER_V1, *PREQUEST_LOG_HEADER_V1;
+
+typedef struct _REQUEST_LOG_HEADER {
+	ULONG64 Signature;
+	ULONG Version;
+	ULONG Architecture;
+	/** Size of this header; the first block starts at this offset. */
+	ULONG HeaderSize;
+	/** Block size requested when the log was written. */
+	ULONG BlockSize;
+	ULONG Flags;
+	ULONG Reserved;
+} REQUEST_LOG_HEADER, *PREQUEST_LOG_HEADER;
+
+typedef struct _REQUEST_LOG_BLOCK_HEADER {
+	ULONG Signature;
+	ULONG HeaderSize;
+	/** Size of the whole decompressed block including this header. */
+	ULONG BlockSize;
+	ULONG RecordCount;
+	ULONG FirstId;
+	ULONG LastId;
+	LONG64 MinTime;
+	LONG64 MaxTime;
+	/** Offsets of the column arrays from the start of the block. */
+	ULONG ColumnOffsets[rlcMax];
+	/** Offset of the encoded records from the start of the block. */
+	ULONG RecordsOffset;
+	ULONG RecordsSize;
+	/** EBlockCodecMethod used for the data following this header. */
+	ULONG Compression;
+	/** Size of the block as stored in the file, including this header. */
+	ULONG StoredSize;
+} REQUEST_LOG_BLOCK_HEADER, *PREQUEST_LOG_BLOCK_HEADER;
+
+/** Entry of the index at the end of the file, one per block. */
+typedef struct _REQUEST_LOG_INDEX_ENTRY {
+	ULONG64 Offset;
+	/** Size of the block as stored in the file. */
+	ULONG Size;
+	ULONG RecordCount;
+	ULONG FirstId;
+	ULONG LastId;
+	LONG64 MinTime;
+	LONG64 MaxTime;
+} REQUEST_LOG_INDEX_ENTRY, *PREQUEST_LOG_INDEX_ENTRY;
+
+typedef struct _REQUEST_LOG_FOOTER {
+	ULONG Signature;
+	ULONG EntryCount;
+	ULONG64 IndexOffset;
+	ULONG64 RecordCount;
+} REQUEST_LOG_FOOTER, *PREQUEST_LOG_FOOTER;
+
+typedef struct _REQUEST_LOG_WRITER REQUEST_LOG_WRITER, *PREQUEST_LOG_WRITER;
+typedef struct _REQUEST_LOG_READER REQUEST_LOG_READER, *PREQUEST_LOG_READER;
+
+/** One block loaded into memory by RequestLogReaderLoadBlock. */
+typedef struct _REQUEST_LOG_BLOCK {
+	const REQUEST_LOG_BLOCK_HEADER *Header;
+	ULONG RecordCount;
+	const ULONG64 *Drivers;
+	const ULONG64 *Devices;
+	const ULONG64 *ProcessIds;
+	const ULONG *Statuses;
+	const UCHAR *Types;
+	const UCHAR *Majors;
+	const UCHAR *Minors;
+	/** Private to the library. */
+	void *Context;
+} REQUEST_LOG_BLOCK, *PREQUEST_LOG_BLOCK;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ERROR_TYPE RequestLogWriterOpen(const wchar_t *FileName, ULONG BlockSize, EBlockCodecMethod Compression, ULONG WorkerCount, PREQUEST_LOG_WRITER *Writer);
+ERROR_TYPE RequestLogWriterAppend(PREQUEST_LOG_WRITER Writer, const REQUEST_HEADER *Request);
+ERROR_TYPE RequestLogWriterClose(PREQUEST_LOG_WRITER Writer);
+
+ERROR_TYPE RequestLogReaderOpen(const wchar_t *FileName, PREQUEST_LOG_READER *Reader);
+void RequestLogReaderClose(PREQUEST_LOG_READER Reader);
+ULONG RequestLogReaderBlockCount(const REQUEST_LOG_READER *Reader);
+ULONG64 RequestLogReaderRecordCount(const REQUEST_LOG_READER *Reader);
+const REQUEST_LOG_INDEX_ENTRY *RequestLogReaderBlockInfo(const REQUEST_LOG_READER *Reader, ULONG Index);
+ULONG RequestLogReaderFindByTime(const REQUEST_LOG_READER *Reader, LONG64 Time);
+ULONG RequestLogReaderFindById(const REQUEST_LOG_READER *Reader, ULONG Id);
+ERROR_TYPE RequestLogReaderLoadBlock(PREQUEST_LOG_READER Reader, ULONG Index, PREQUEST_LOG_BLOCK Block);
+ERROR_TYPE RequestLogBlockNext(PREQUEST_LOG_BLOCK Block, PREQUEST_HEADER *Request);
+void RequestLogBlockFree(PREQUEST_LOG_BLOCK Block);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
@@ -138,6 +138,76 @@ size_t RequestGetSize(const REQUEST_HEADER *Header)
 			ilr = CONTAINING_RECORD(Header, REQUEST_IMAGE_LOAD, Header);
 			ret = sizeof(REQUEST_IMAGE_LOAD) + ilr->DataSize;
 			break;
+		case ertEventsDropped:
+			ret = sizeof(REQUEST_EVENTS_DROPPED);
+			break;
+	}
+
+	return ret;
+}
+
+
+/** Checks that a buffer holds exactly one well-formed request. Unlike
+ *  RequestGetSize, the routine never reads beyond the buffer, so it may be
+ *  used on untrusted data, such as records of a log file.
+ *
+ *  @param Header The request.
+ *  @param Size Size of the buffer, in bytes.
+ */
+BOOLEAN RequestValidate(const REQUEST_HEADER *Header, size_t Size)
+{
+	size_t fixedSize = 0;
+	BOOLEAN ret = FALSE;
+
+	if (Size >= sizeof(REQUEST_HEADER)) {
+		switch (Header->Type) {
+			case ertIRP:
+				fixedSize = sizeof(REQUEST_IRP);
+				break;
+			case ertIRPCompletion:
+				fixedSize = sizeof(REQUEST_IRP_COMPLETION);
+				break;
+			case ertFastIo:
+				fixedSize = sizeof(REQUEST_FASTIO);
+				break;
+			case ertAddDevice:
+				fixedSize = sizeof(REQUEST_ADDDEVICE);
+				break;
+			case ertDriverUnload:
+				fixedSize = sizeof(REQUEST_UNLOAD);
+				break;
+			case ertStartIo:
+				fixedSize = sizeof(REQUEST_STARTIO);
+				break;
+			case ertDriverDetected:
+				fixedSize = sizeof(REQUEST_DRIVER_DETECTED);
+				break;
+			case ertDeviceDetected:
+				fixedSize = sizeof(REQUEST_DEVICE_DETECTED);
+				break;
+			case ertFileObjectNameAssigned:
+				fixedSize = sizeof(REQUEST_FILE_OBJECT_NAME_ASSIGNED);
+				break;
+			case ertFileObjectNameDeleted:
+				fixedSize = sizeof(REQUEST_FILE_OBJECT_NAME_DELETED);
+				break;
+			case ertProcessCreated:
+				fixedSize = sizeof(REQUEST_PROCESS_CREATED);
+				break;
+			case ertProcessExitted:
+				fixedSize = sizeof(REQUEST_PROCESS_EXITTED);
+				break;
+			case ertImageLoad:
+				fixedSize = sizeof(REQUEST_IMAGE_LOAD);
+				break;
+			case ertEventsDropped:
+				fixedSize = sizeof(REQUEST_EVENTS_DROPPED);
+				break;
+			default:
+				break;
+		}
+
+		ret = (fixedSize > 0 && Size >= fixedSize && RequestGetSize(Header) == Size);
 	}
 
 	return ret;
@@ -290,6 +360,40 @@ ERROR_TYPE RequestEmulateProcessExitted(HANDLE ProcessId, PREQUEST_PROCESS_EXITT
 }
 
 
+#ifdef _KERNEL_MODE
+
+/** Block sizes of the request caches. Most IRP and FastIo records, including
+    data stripped to the default threshold, fit into the smaller classes. */
+static const ULONG _requestSizeClasses[] = {
+	256,
+	512,
+	1024,
+	2048,
+	4096,
+};
+
+/** Request caches, one for nonpaged (index 0) and one for paged memory (index 1). */
+static PSIZE_CLASS_CACHE _requestCaches[2];
+
+/** Number of preallocated record slots reserved for each processor. */
+#define REQUEST_SLOTS_PER_CPU				256
+
+/** Free record slots of one processor. */
+typedef struct _REQUEST_SLOT_CPU {
+	SLIST_HEADER FreeSlots;
+} REQUEST_SLOT_CPU, *PREQUEST_SLOT_CPU;
+
+static PREQUEST_SLOT_CPU _slotCpus = NULL;
+static ULONG _slotCpuCount = 0;
+/** Nonpaged memory holding all slots; slots of one processor are contiguous. */
+static PUCHAR _slotMemory = NULL;
+static SIZE_T _slotMemorySize = 0;
+/** Size of one slot, zero if the slots are not available. */
+static SIZE_T _slotSize = 0;
+
+#endif
+
+
 PREQUEST_HEADER RequestMemoryAlloc(size_t Size)
 {
 	PREQUEST_HEADER ret = NULL;
@@ -297,7 +401,7 @@ PREQUEST_HEADER RequestMemoryAlloc(size_t Size)
 	POOL_TYPE pt;
 
 	pt = (KeGetCurrentIrql() < DISPATCH_LEVEL) ? PagedPool : NonPagedPool;
-	ret = (PREQUEST_HEADER)HeapMemoryAlloc(pt, Size);
+	ret = (PREQUEST_HEADER)SizeClassCacheAlloc(_requestCaches[pt == PagedPool], Size);
 	if (ret != NULL) {
 		memset(ret, 0, Size);
 		switch (pt) {
@@ -321,10 +425,166 @@ PREQUEST_HEADER RequestMemoryAlloc(size_t Size)
 void RequestMemoryFree(PREQUEST_HEADER Request)
 {
 #ifdef _KERNEL_MODE
-	HeapMemoryFree(Request);
+	ULONG cpuIndex = 0;
+
+	if ((PUCHAR)Request >= _slotMemory && (PUCHAR)Request < _slotMemory + _slotMemorySize) {
+		cpuIndex = (ULONG)(((PUCHAR)Request - _slotMemory) / (_slotSize*REQUEST_SLOTS_PER_CPU));
+		InterlockedPushEntrySList(&_slotCpus[cpuIndex].FreeSlots, (PSLIST_ENTRY)Request);
+	} else SizeClassCacheFree(_requestCaches[(Request->Flags & REQUEST_FLAG_PAGED) != 0], Request);
 #else
 	HeapFree(GetProcessHeap(), 0, Request);
 #endif
 
 	return;
 }
+
+
+#ifdef _KERNEL_MODE
+
+/** Allocates a small record from the slots reserved for the current processor.
+ *  The allocation touches neither the pool nor any lock shared between
+ *  processors. When no slot is free, or the record does not fit into one,
+ *  the routine falls back to RequestMemoryAlloc.
+ *
+ *  @param Size Size of the record, in bytes.
+ *
+ *  @return
+ *  Returns address of the zeroed record, or NULL on failure. The record must
+ *  be freed by RequestMemoryFree.
+ */
+PREQUEST_HEADER RequestMemoryAllocSlot(size_t Size)
+{
+	ULONG cpuIndex = 0;
+	PREQUEST_HEADER ret = NULL;
+
+	if (Size <= _slotSize) {
+		cpuIndex = KeGetCurrentProcessorNumberEx(NULL) % _slotCpuCount;
+		ret = (PREQUEST_HEADER)InterlockedPopEntrySList(&_slotCpus[cpuIndex].FreeSlots);
+		if (ret != NULL) {
+			memset(ret, 0, Size);
+			ret->Flags |= REQUEST_FLAG_NONPAGED;
+		}
+	}
+
+	if (ret == NULL)
+		ret = RequestMemoryAlloc(Size);
+
+	return ret;
+}
+
+
+static void _SlotsCreate(SIZE_T SlotSize)
+{
+	ULONG i = 0;
+	ULONG j = 0;
+	PUCHAR slot = NULL;
+	DEBUG_ENTER_FUNCTION("SlotSize=%zu", SlotSize);
+
+	SlotSize = (SlotSize + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~((SIZE_T)MEMORY_ALLOCATION_ALIGNMENT - 1);
+	_slotCpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	_slotCpus = (PREQUEST_SLOT_CPU)HeapMemoryAllocNonPaged(_slotCpuCount*sizeof(REQUEST_SLOT_CPU));
+	if (_slotCpus != NULL) {
+		_slotMemorySize = SlotSize*REQUEST_SLOTS_PER_CPU*_slotCpuCount;
+		_slotMemory = (PUCHAR)HeapMemoryAllocNonPaged(_slotMemorySize);
+		if (_slotMemory != NULL) {
+			slot = _slotMemory;
+			for (i = 0; i < _slotCpuCount; ++i) {
+				InitializeSListHead(&_slotCpus[i].FreeSlots);
+				for (j = 0; j < REQUEST_SLOTS_PER_CPU; ++j) {
+					InterlockedPushEntrySList(&_slotCpus[i].FreeSlots, (PSLIST_ENTRY)slot);
+					slot += SlotSize;
+				}
+			}
+
+			_slotSize = SlotSize;
+		}
+
+		if (_slotMemory == NULL) {
+			_slotMemorySize = 0;
+			HeapMemoryFree(_slotCpus);
+			_slotCpus = NULL;
+		}
+	}
+
+	DEBUG_EXIT_FUNCTION("void, _slotSize=%zu", _slotSize);
+	return;
+}
+
+
+static void _SlotsDestroy(void)
+{
+	DEBUG_ENTER_FUNCTION_NO_ARGS();
+
+	if (_slotMemory != NULL) {
+		_slotSize = 0;
+		HeapMemoryFree(_slotMemory);
+		_slotMemory = NULL;
+		_slotMemorySize = 0;
+		HeapMemoryFree(_slotCpus);
+		_slotCpus = NULL;
+		_slotCpuCount = 0;
+	}
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+
+/** Sums the counters of both request caches.
+ *
+ *  @param Hits Receives number of requests allocated without touching the pool.
+ *  @param Misses Receives number of requests allocated from the pool.
+ *  @param Outstanding Receives number of requests not freed yet.
+ */
+void RequestMemoryQueryStatistics(PULONG64 Hits, PULONG64 Misses, PLONG64 Outstanding)
+{
+	SIZE_CLASS_CACHE_STATISTICS stats[2];
+
+	SizeClassCacheQueryStatistics(_requestCaches[0], stats);
+	SizeClassCacheQueryStatistics(_requestCaches[1], stats + 1);
+	*Hits = stats[0].Hits + stats[1].Hits;
+	*Misses = stats[0].Misses + stats[1].Misses;
+	*Outstanding = stats[0].Outstanding + stats[1].Outstanding;
+
+	return;
+}
+
+
+NTSTATUS RequestMemoryModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context)
+{
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
+
+	status = SizeClassCacheCreate(NonPagedPool, _requestSizeClasses, sizeof(_requestSizeClasses) / sizeof(_requestSizeClasses[0]), &_requestCaches[0]);
+	if (NT_SUCCESS(status)) {
+		status = SizeClassCacheCreate(PagedPool, _requestSizeClasses, sizeof(_requestSizeClasses) / sizeof(_requestSizeClasses[0]), &_requestCaches[1]);
+		if (!NT_SUCCESS(status)) {
+			SizeClassCacheDestroy(_requestCaches[0]);
+			_requestCaches[0] = NULL;
+		}
+	}
+
+	// The slots are an optimization only, the driver can work without them.
+	if (NT_SUCCESS(status))
+		_SlotsCreate(sizeof(REQUEST_FASTIO));
+
+	DEBUG_EXIT_FUNCTION("0x%x", status);
+	return status;
+}
+
+
+VOID RequestMemoryModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context)
+{
+	DEBUG_ENTER_FUNCTION("DriverObject=0x%p; RegistryPath=\"%wZ\"; Context=0x%p", DriverObject, RegistryPath, Context);
+
+	_SlotsDestroy();
+	SizeClassCacheDestroy(_requestCaches[1]);
+	_requestCaches[1] = NULL;
+	SizeClassCacheDestroy(_requestCaches[0]);
+	_requestCaches[0] = NULL;
+
+	DEBUG_EXIT_FUNCTION_VOID();
+	return;
+}
+
+#endif
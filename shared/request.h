@@ -17,6 +17,8 @@
 #define ERROR_VALUE_SUCCESS		STATUS_SUCCESS
 #define ERROR_VALUE_NOMEM		STATUS_INSUFFICIENT_RESOURCES
 #define ERROR_VALUE_INVAL		STATUS_UNSUCCESSFUL
+#define ERROR_VALUE_BUFFER_TOO_SMALL	STATUS_BUFFER_TOO_SMALL
+#define ERROR_VALUE_IO			STATUS_UNEXPECTED_IO_ERROR
 
 #else
 
@@ -24,6 +26,8 @@
 #define ERROR_VALUE_SUCCESS		ERROR_SUCCESS
 #define ERROR_VALUE_NOMEM		ERROR_NOT_ENOUGH_MEMORY
 #define ERROR_VALUE_INVAL		ERROR_GEN_FAILURE
+#define ERROR_VALUE_BUFFER_TOO_SMALL	ERROR_INSUFFICIENT_BUFFER
+#define ERROR_VALUE_IO			ERROR_IO_DEVICE
 
 #endif
 
@@ -33,6 +37,7 @@ extern "C" {
 
 
 size_t RequestGetSize(const REQUEST_HEADER *Header);
+BOOLEAN RequestValidate(const REQUEST_HEADER *Header, size_t Size);
 
 PREQUEST_HEADER RequestCopy(const REQUEST_HEADER *Header);
 
@@ -50,6 +55,13 @@ void _SetRequestFlags(PREQUEST_HEADER Request, const BASIC_CLIENT_INFO *Info);
 PREQUEST_HEADER RequestMemoryAlloc(size_t Size);
 void RequestMemoryFree(PREQUEST_HEADER Request);
 
+#ifdef _KERNEL_MODE
+PREQUEST_HEADER RequestMemoryAllocSlot(size_t Size);
+void RequestMemoryQueryStatistics(PULONG64 Hits, PULONG64 Misses, PLONG64 Outstanding);
+NTSTATUS RequestMemoryModuleInit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
+VOID RequestMemoryModuleFinit(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PVOID Context);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,133 @@
+
+/**
+ * @file
+ *
+ * Size-class caches against malloc. Blocks of random sizes up to 4 kB, the
+ * size classes of the driver's request caches, are freed right after their
+ * allocation or in bursts, as the consumer of the Event Queue frees them;
+ * then 1 to 16 threads on their own processors allocate and free at once.
+ */
+
+#include <ntifs.h>
+#include "allocator.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_THREAD {
+	pthread_t Thread;
+	ULONG Index;
+	BOOLEAN Cache;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+#define OPERATION_COUNT				2000000
+#define THREAD_OPERATION_COUNT		1000000
+#define BURST_LENGTH				256
+
+
+static const ULONG _classSizes[] = { 256, 512, 1024, 2048, 4096 };
+static PSIZE_CLASS_CACHE _cache = NULL;
+
+
+static PVOID _Alloc(BOOLEAN Cache, SIZE_T Size)
+{
+	return (Cache) ? SizeClassCacheAlloc(_cache, Size) : malloc(Size);
+}
+
+static void _Free(BOOLEAN Cache, PVOID Block)
+{
+	if (Cache)
+		SizeClassCacheFree(_cache, Block);
+	else free(Block);
+
+	return;
+}
+
+
+/** Returns nanoseconds per allocation and free. */
+static double _MeasureBursts(BOOLEAN Cache, ULONG BurstLength)
+{
+	double start = 0;
+	unsigned int seed = 1;
+	PVOID blocks[BURST_LENGTH];
+
+	start = BenchNow();
+	for (ULONG i = 0; i < OPERATION_COUNT / BurstLength; ++i) {
+		for (ULONG j = 0; j < BurstLength; ++j) {
+			blocks[j] = _Alloc(Cache, 64 + (ULONG)rand_r(&seed) % 4000);
+			*(PUCHAR)blocks[j] = 1;
+		}
+
+		for (ULONG j = 0; j < BurstLength; ++j)
+			_Free(Cache, blocks[j]);
+	}
+
+	start = BenchNow() - start;
+
+	return start * 1e9 / OPERATION_COUNT;
+}
+
+
+static void *_Worker(void *Context)
+{
+	PVOID block = NULL;
+	PBENCH_THREAD t = (PBENCH_THREAD)Context;
+	unsigned int seed = t->Index + 1;
+
+	ShimProcessor = t->Index;
+	for (ULONG i = 0; i < THREAD_OPERATION_COUNT; ++i) {
+		block = _Alloc(t->Cache, 64 + (ULONG)rand_r(&seed) % 4000);
+		*(PUCHAR)block = 1;
+		_Free(t->Cache, block);
+	}
+
+	return NULL;
+}
+
+
+/** Returns millions of allocations and frees per second. */
+static double _MeasureThreads(BOOLEAN Cache, ULONG ThreadCount)
+{
+	double start = 0;
+	BENCH_THREAD threads[SHIM_PROCESSOR_COUNT];
+
+	start = BenchNow();
+	for (ULONG i = 0; i < ThreadCount; ++i) {
+		threads[i].Index = i;
+		threads[i].Cache = Cache;
+		pthread_create(&threads[i].Thread, NULL, _Worker, threads + i);
+	}
+
+	for (ULONG i = 0; i < ThreadCount; ++i)
+		pthread_join(threads[i].Thread, NULL);
+
+	start = BenchNow() - start;
+
+	return (double)THREAD_OPERATION_COUNT*ThreadCount / start / 1e6;
+}
+
+
+int main(void)
+{
+	SIZE_CLASS_CACHE_STATISTICS stats;
+
+	SizeClassCacheCreate(NonPagedPool, _classSizes, sizeof(_classSizes) / sizeof(_classSizes[0]), &_cache);
+	printf("One thread, 64 to 4063 bytes\n");
+	for (ULONG burst = 1; burst <= BURST_LENGTH; burst *= 16) {
+		printf("  bursts of %3u: cache %6.1f ns, malloc %6.1f ns per allocation and free\n", burst,
+			_MeasureBursts(TRUE, burst), _MeasureBursts(FALSE, burst));
+	}
+
+	printf("Threads on their own processors\n");
+	for (ULONG threadCount = 1; threadCount <= SHIM_PROCESSOR_COUNT; threadCount *= 2) {
+		printf("  %2u threads: cache %7.2f M, malloc %7.2f M allocations and frees/s\n", threadCount,
+			_MeasureThreads(TRUE, threadCount), _MeasureThreads(FALSE, threadCount));
+	}
+
+	ShimProcessor = 0;
+	SizeClassCacheQueryStatistics(_cache, &stats);
+	printf("Cache hits %llu, misses %llu\n", (unsigned long long)stats.Hits, (unsigned long long)stats.Misses);
+	SizeClassCacheDestroy(_cache);
+
+	return 0;
+}
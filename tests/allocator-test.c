@@ -0,0 +1,228 @@
+
+/**
+ * @file
+ *
+ * Tests of size-class caches: the class and processor recorded in the header
+ * of every block, blocks freed on another processor going back to the list
+ * they came from, the statistics, and concurrent threads freeing blocks
+ * allocated by the threads of other processors.
+ */
+
+#include "allocator.c"
+#include "test.h"
+
+
+#define THREAD_COUNT				8
+#define ROUND_COUNT					20000
+#define HANDOFF_LENGTH				64
+
+
+typedef struct _TEST_HANDOFF {
+	PVOID volatile Blocks[HANDOFF_LENGTH];
+} TEST_HANDOFF, *PTEST_HANDOFF;
+
+
+static const ULONG _classSizes[] = { 64, 256, 1024 };
+static PSIZE_CLASS_CACHE _cache = NULL;
+/** Thread t passes its blocks to thread t + 1 through handoff t + 1. */
+static TEST_HANDOFF _handoffs[THREAD_COUNT];
+
+
+static PSIZE_CLASS_BLOCK_HEADER _Header(PVOID Block)
+{
+	return (PSIZE_CLASS_BLOCK_HEADER)Block - 1;
+}
+
+static PSIZE_CLASS_LIST _List(ULONG CpuIndex, ULONG ClassIndex)
+{
+	return &_cache->Lists[CpuIndex*_cache->ClassCount + ClassIndex];
+}
+
+
+/** Every block is aligned and records the class serving its size and the
+ *  processor it was allocated on; too large blocks come from the pool. */
+static void _TestOrigin(void)
+{
+	PVOID block = NULL;
+	static const struct {
+		SIZE_T Size;
+		ULONG ClassIndex;
+	} cases[] = {
+		{ 1, 0 },
+		{ 64, 0 },
+		{ 65, 1 },
+		{ 256, 1 },
+		{ 1024, 2 },
+		{ 1025, SIZE_CLASS_DIRECT },
+		{ 100000, SIZE_CLASS_DIRECT },
+	};
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		ShimProcessor = (ULONG)(i * 5 % SHIM_PROCESSOR_COUNT);
+		block = SizeClassCacheAlloc(_cache, cases[i].Size);
+		TEST_CHECK(block != NULL);
+		TEST_CHECK((ULONG_PTR)block % MEMORY_ALLOCATION_ALIGNMENT == 0);
+		TEST_CHECK(_Header(block)->Origin.ClassIndex == cases[i].ClassIndex);
+		if (cases[i].ClassIndex != SIZE_CLASS_DIRECT)
+			TEST_CHECK(_Header(block)->Origin.CpuIndex == ShimProcessor);
+
+		memset(block, 0xcc, cases[i].Size);
+		SizeClassCacheFree(_cache, block);
+	}
+
+	ShimProcessor = 0;
+
+	return;
+}
+
+
+/** A block freed on another processor returns to the list of the processor
+ *  that allocated it, and is reused by that processor only. */
+static void _TestCrossCpuFree(void)
+{
+	PVOID block = NULL;
+	PVOID other = NULL;
+	LONG64 frees1 = 0;
+	LONG64 frees5 = 0;
+	SIZE_CLASS_CACHE_STATISTICS before;
+	SIZE_CLASS_CACHE_STATISTICS after;
+
+	ShimProcessor = 1;
+	block = SizeClassCacheAlloc(_cache, 200);
+	frees1 = _List(1, 1)->Frees;
+	frees5 = _List(5, 1)->Frees;
+	ShimProcessor = 5;
+	SizeClassCacheFree(_cache, block);
+	TEST_CHECK(_List(1, 1)->Frees == frees1 + 1);
+	TEST_CHECK(_List(5, 1)->Frees == frees5);
+	TEST_CHECK(ExQueryDepthSList(&_List(5, 1)->Lookaside.ListHead) == 0);
+	other = SizeClassCacheAlloc(_cache, 200);
+	TEST_CHECK(other != block);
+	TEST_CHECK(_Header(other)->Origin.CpuIndex == 5);
+	SizeClassCacheFree(_cache, other);
+	// The block waits in the list of processor 1 and is served without a miss.
+	SizeClassCacheQueryStatistics(_cache, &before);
+	ShimProcessor = 1;
+	other = SizeClassCacheAlloc(_cache, 256);
+	TEST_CHECK(other == block);
+	TEST_CHECK(_Header(other)->Origin.CpuIndex == 1);
+	SizeClassCacheQueryStatistics(_cache, &after);
+	TEST_CHECK(after.Hits == before.Hits + 1);
+	TEST_CHECK(after.Misses == before.Misses);
+	TEST_CHECK(after.Outstanding == before.Outstanding + 1);
+	ShimProcessor = 9;
+	SizeClassCacheFree(_cache, other);
+	ShimProcessor = 0;
+
+	return;
+}
+
+
+static void _TestStatistics(void)
+{
+	PVOID blocks[4];
+	SIZE_CLASS_CACHE_STATISTICS stats;
+
+	SizeClassCacheQueryStatistics(_cache, &stats);
+	TEST_CHECK(stats.Outstanding == 0);
+	blocks[0] = SizeClassCacheAlloc(_cache, 10);
+	blocks[1] = SizeClassCacheAlloc(_cache, 2000);
+	blocks[2] = SizeClassCacheAlloc(_cache, 10);
+	blocks[3] = SizeClassCacheAlloc(_cache, 10);
+	SizeClassCacheQueryStatistics(_cache, &stats);
+	TEST_CHECK(stats.Outstanding == 4);
+	for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); ++i)
+		SizeClassCacheFree(_cache, blocks[i]);
+
+	SizeClassCacheQueryStatistics(_cache, &stats);
+	TEST_CHECK(stats.Outstanding == 0);
+	TEST_CHECK(_cache->DirectAllocations == _cache->DirectFrees);
+
+	return;
+}
+
+
+static void *_Worker(void *Context)
+{
+	ULONG_PTR t = (ULONG_PTR)Context;
+	ULONG slot = 0;
+	PVOID block = NULL;
+	SIZE_T size = 0;
+	PTEST_HANDOFF out = &_handoffs[(t + 1) % THREAD_COUNT];
+	PTEST_HANDOFF in = &_handoffs[t];
+	unsigned int seed = (unsigned int)t + 1;
+
+	ShimProcessor = (ULONG)(t * 2);
+	for (ULONG r = 0; r < ROUND_COUNT; ++r) {
+		size = 1 + (ULONG)rand_r(&seed) % 1500;
+		block = SizeClassCacheAlloc(_cache, size);
+		TEST_CHECK(block != NULL);
+		memset(block, (int)t, size);
+		block = InterlockedExchangePointer(&out->Blocks[slot], block);
+		if (block != NULL)
+			SizeClassCacheFree(_cache, block);
+
+		block = InterlockedExchangePointer(&in->Blocks[slot], NULL);
+		if (block != NULL) {
+			TEST_CHECK(*(PUCHAR)block == (t + THREAD_COUNT - 1) % THREAD_COUNT);
+			TEST_CHECK(_Header(block)->Origin.ClassIndex == SIZE_CLASS_DIRECT ||
+				_Header(block)->Origin.CpuIndex == (ULONG)((t + THREAD_COUNT - 1) % THREAD_COUNT * 2));
+			SizeClassCacheFree(_cache, block);
+		}
+
+		slot = (slot + 1) % HANDOFF_LENGTH;
+	}
+
+	return NULL;
+}
+
+
+/** Each thread allocates on its own processor and frees mostly blocks of
+ *  its neighbour; the lists must end balanced. */
+static void _TestConcurrent(void)
+{
+	PVOID block = NULL;
+	pthread_t threads[THREAD_COUNT];
+	SIZE_CLASS_CACHE_STATISTICS stats;
+
+	for (ULONG_PTR t = 0; t < THREAD_COUNT; ++t)
+		pthread_create(threads + t, NULL, _Worker, (void *)t);
+
+	for (ULONG t = 0; t < THREAD_COUNT; ++t)
+		pthread_join(threads[t], NULL);
+
+	ShimProcessor = 0;
+	for (ULONG t = 0; t < THREAD_COUNT; ++t) {
+		for (ULONG i = 0; i < HANDOFF_LENGTH; ++i) {
+			block = _handoffs[t].Blocks[i];
+			if (block != NULL)
+				SizeClassCacheFree(_cache, block);
+		}
+	}
+
+	SizeClassCacheQueryStatistics(_cache, &stats);
+	TEST_CHECK(stats.Outstanding == 0);
+	TEST_CHECK(stats.Hits > 0 && stats.Misses > 0);
+	for (ULONG i = 0; i < _cache->CpuCount*_cache->ClassCount; ++i)
+		TEST_CHECK(_cache->Lists[i].Allocations == _cache->Lists[i].Frees);
+
+	return;
+}
+
+
+int main(void)
+{
+	ULONG sizes[SIZE_CLASS_CACHE_MAX_CLASSES + 1];
+
+	memset(sizes, 0, sizeof(sizes));
+	TEST_CHECK(SizeClassCacheCreate(NonPagedPool, sizes, 0, &_cache) == STATUS_INVALID_PARAMETER);
+	TEST_CHECK(SizeClassCacheCreate(NonPagedPool, sizes, SIZE_CLASS_CACHE_MAX_CLASSES + 1, &_cache) == STATUS_INVALID_PARAMETER);
+	TEST_CHECK(SizeClassCacheCreate(NonPagedPool, _classSizes, sizeof(_classSizes) / sizeof(_classSizes[0]), &_cache) == STATUS_SUCCESS);
+	_TestOrigin();
+	_TestCrossCpuFree();
+	_TestStatistics();
+	_TestConcurrent();
+	SizeClassCacheDestroy(_cache);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,35 @@
+
+/**
+ * @file
+ *
+ * Timing helpers of the benchmarks. Benchmarks are built with the tests but
+ * not run by ctest; they print their results and always succeed.
+ */
+
+#ifndef __TESTS_BENCH_H__
+#define __TESTS_BENCH_H__
+
+#include <stdio.h>
+#include <time.h>
+
+
+/** Returns a monotonic time, in seconds. */
+static inline double BenchNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/** Returns the number of megabytes processed per second. */
+static inline double BenchMBps(double Bytes, double Seconds)
+{
+	return (Seconds > 0) ? Bytes / (1024.0*1024.0) / Seconds : 0;
+}
+
+
+
+#endif
@@ -0,0 +1,100 @@
+
+/**
+ * @file
+ *
+ * Speed and ratio of the fast block compression on log blocks of the default
+ * size. The blocks hold a realistic stream either as raw records or encoded
+ * by the request codec, as the log stores them.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-codec.h"
+#include "block-codec.h"
+#include "request-log.h"
+#include "request-gen.h"
+#include "bench.h"
+
+
+#define BLOCK_SIZE					REQUEST_LOG_DEFAULT_BLOCK_SIZE
+#define BLOCK_COUNT					64
+
+
+static void _Measure(const char *Name, const UCHAR *Data, size_t Size)
+{
+	size_t written = 0;
+	size_t compressed = 0;
+	double start = 0;
+	double compressTime = 0;
+	double decompressTime = 0;
+	PUCHAR dest = NULL;
+	PUCHAR restored = NULL;
+
+	dest = (PUCHAR)malloc(Size + Size / 8);
+	restored = (PUCHAR)malloc(BLOCK_SIZE);
+	for (size_t offset = 0; offset < Size; offset += BLOCK_SIZE) {
+		start = BenchNow();
+		BlockCodecCompress(bcmFast, Data + offset, BLOCK_SIZE, dest + compressed, Size + Size / 8 - compressed, &written);
+		compressTime += BenchNow() - start;
+		start = BenchNow();
+		BlockCodecDecompress(bcmFast, dest + compressed, written, restored, BLOCK_SIZE);
+		decompressTime += BenchNow() - start;
+		compressed += written;
+	}
+
+	printf("%-16s ratio %5.1f %%, compress %7.1f MB/s, decompress %7.1f MB/s\n", Name, 100.0*compressed / Size, BenchMBps((double)Size, compressTime), BenchMBps((double)Size, decompressTime));
+	free(restored);
+	free(dest);
+
+	return;
+}
+
+
+int main(void)
+{
+	size_t len = 0;
+	size_t rawSize = 0;
+	size_t encodedSize = 0;
+	size_t written = 0;
+	PUCHAR raw = NULL;
+	PUCHAR encoded = NULL;
+	PREQUEST_HEADER r = NULL;
+	REQUEST_CODEC_STATE state;
+	TEST_REQUEST_GEN gen;
+
+	raw = (PUCHAR)malloc(BLOCK_SIZE*BLOCK_COUNT);
+	encoded = (PUCHAR)malloc(BLOCK_SIZE*BLOCK_COUNT);
+	TestRequestGenInit(&gen, 42, TRUE);
+	while (rawSize < BLOCK_SIZE*BLOCK_COUNT) {
+		r = TestRequestGenerateNext(&gen);
+		len = RequestGetSize(r);
+		if (len > BLOCK_SIZE*BLOCK_COUNT - rawSize)
+			len = BLOCK_SIZE*BLOCK_COUNT - rawSize;
+
+		memcpy(raw + rawSize, r, len);
+		rawSize += len;
+		RequestMemoryFree(r);
+	}
+
+	// The same stream, encoded; the incomplete last block is left out.
+	TestRequestGenInit(&gen, 42, TRUE);
+	RequestCodecInit(&state);
+	do {
+		r = TestRequestGenerateNext(&gen);
+		if (RequestCodecEncode(&state, r, encoded + encodedSize, BLOCK_SIZE*BLOCK_COUNT - encodedSize, &written) == ERROR_VALUE_SUCCESS)
+			encodedSize += written;
+		else written = 0;
+
+		RequestMemoryFree(r);
+	} while (written > 0);
+
+	encodedSize -= encodedSize % BLOCK_SIZE;
+	printf("%u blocks of %u bytes\n", BLOCK_COUNT, BLOCK_SIZE);
+	_Measure("raw records", raw, rawSize);
+	_Measure("encoded records", encoded, encodedSize);
+	free(encoded);
+	free(raw);
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+
+/**
+ * @file
+ *
+ * Tests of the block compression. The fast method must restore every kind
+ * of data exactly: empty and tiny blocks, incompressible data, long runs,
+ * overlapping matches and blocks longer than the match window. Too small
+ * output buffers and damaged or truncated blocks must be reported, never
+ * overrun. The shim cannot load cabinet.dll, so the high-ratio method must
+ * appear unsupported and fail cleanly.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "block-codec.h"
+#include "request-gen.h"
+#include "test.h"
+
+
+#define MAX_BLOCK_SIZE				0x40000
+#define RANDOM_BLOCK_COUNT			300
+
+
+static UCHAR _source[MAX_BLOCK_SIZE];
+static UCHAR _compressed[MAX_BLOCK_SIZE + MAX_BLOCK_SIZE / 8];
+static UCHAR _restored[MAX_BLOCK_SIZE];
+
+
+typedef enum _EBlockContent {
+	bcZeros,
+	bcRandom,
+	bcPattern,
+	bcRecords,
+	bcMixed,
+	bcMax,
+} EBlockContent, *PEBlockContent;
+
+
+static void _Fill(PTEST_REQUEST_GEN Gen, EBlockContent Content, PUCHAR Buffer, size_t Size)
+{
+	size_t offset = 0;
+	size_t len = 0;
+	size_t period = 0;
+	PREQUEST_HEADER r = NULL;
+
+	switch (Content) {
+		case bcZeros:
+			memset(Buffer, 0, Size);
+			break;
+		case bcRandom:
+			for (size_t i = 0; i < Size; ++i)
+				Buffer[i] = (UCHAR)TestRequestGenRandom(Gen);
+			break;
+		case bcPattern:
+			// Short periods make matches overlap their own output.
+			period = 1 + (size_t)(TestRequestGenRandom(Gen) % 7);
+			for (size_t i = 0; i < Size; ++i)
+				Buffer[i] = (UCHAR)(i % period);
+			break;
+		case bcRecords:
+			while (offset < Size) {
+				r = TestRequestGenerateNext(Gen);
+				len = RequestGetSize(r);
+				if (len > Size - offset)
+					len = Size - offset;
+
+				memcpy(Buffer + offset, r, len);
+				offset += len;
+				RequestMemoryFree(r);
+			}
+			break;
+		default:
+			while (offset < Size) {
+				len = 1 + (size_t)(TestRequestGenRandom(Gen) % 1000);
+				if (len > Size - offset)
+					len = Size - offset;
+
+				_Fill(Gen, (EBlockContent)(TestRequestGenRandom(Gen) % bcMixed), Buffer + offset, len);
+				offset += len;
+			}
+			break;
+	}
+
+	return;
+}
+
+
+/** Compresses and restores a block, returns the compressed size. */
+static size_t _RoundTrip(const UCHAR *Source, size_t Size)
+{
+	size_t written = 0;
+	size_t ret = 0;
+
+	TEST_CHECK(BlockCodecCompress(bcmFast, Source, Size, _compressed, sizeof(_compressed), &written) == ERROR_VALUE_SUCCESS);
+	memset(_restored, 0xcc, sizeof(_restored));
+	TEST_CHECK(BlockCodecDecompress(bcmFast, _compressed, written, _restored, Size) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(memcmp(_restored, Source, Size) == 0);
+	// Nothing is written past the block.
+	TEST_CHECK(Size == sizeof(_restored) || _restored[Size] == 0xcc);
+	ret = written;
+
+	return ret;
+}
+
+
+static void _TestRoundTrip(void)
+{
+	size_t size = 0;
+	size_t written = 0;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 1, TRUE);
+	TEST_CHECK(_RoundTrip(_source, 0) == 1);
+	for (size = 1; size < 64; ++size) {
+		_Fill(&gen, bcRandom, _source, size);
+		_RoundTrip(_source, size);
+		_Fill(&gen, bcZeros, _source, size);
+		_RoundTrip(_source, size);
+	}
+
+	for (ULONG i = 0; i < RANDOM_BLOCK_COUNT; ++i) {
+		size = (size_t)(TestRequestGenRandom(&gen) % (MAX_BLOCK_SIZE + 1));
+		_Fill(&gen, (EBlockContent)(i % bcMax), _source, size);
+		written = _RoundTrip(_source, size);
+		switch (i % bcMax) {
+			case bcZeros:
+			case bcPattern:
+				TEST_CHECK(written < 32 + size / 50);
+				break;
+			case bcRandom:
+				// Incompressible data grow by the length bytes only.
+				TEST_CHECK(written <= size + size / 255 + 16);
+				break;
+		}
+	}
+
+	// Realistic records compress well.
+	_Fill(&gen, bcRecords, _source, MAX_BLOCK_SIZE);
+	TEST_CHECK(_RoundTrip(_source, MAX_BLOCK_SIZE) < MAX_BLOCK_SIZE / 2);
+
+	return;
+}
+
+
+static void _TestBufferTooSmall(void)
+{
+	size_t written = 0;
+	size_t needed = 0;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 2, TRUE);
+	for (ULONG i = 0; i < 50; ++i) {
+		_Fill(&gen, bcMixed, _source, 0x4000);
+		TEST_CHECK(BlockCodecCompress(bcmFast, _source, 0x4000, _compressed, sizeof(_compressed), &needed) == ERROR_VALUE_SUCCESS);
+		memset(_compressed, 0xcc, sizeof(_compressed));
+		TEST_CHECK(BlockCodecCompress(bcmFast, _source, 0x4000, _compressed, needed, &written) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(written == needed && _compressed[needed] == 0xcc);
+		for (size_t j = 0; j < needed; j += 1 + j / 4) {
+			memset(_compressed, 0xcc, needed + 1);
+			TEST_CHECK(BlockCodecCompress(bcmFast, _source, 0x4000, _compressed, j, &written) == ERROR_VALUE_BUFFER_TOO_SMALL);
+			TEST_CHECK(_compressed[j] == 0xcc);
+		}
+
+		TEST_CHECK(BlockCodecCompress(bcmFast, _source, 0x4000, _compressed, needed, &written) == ERROR_VALUE_SUCCESS);
+	}
+
+	TEST_CHECK(BlockCodecCompress(bcmNone, _source, 0x100, _compressed, 0xff, &written) == ERROR_VALUE_BUFFER_TOO_SMALL);
+	TEST_CHECK(BlockCodecCompress(bcmNone, _source, 0x100, _compressed, 0x100, &written) == ERROR_VALUE_SUCCESS && written == 0x100);
+	TEST_CHECK(BlockCodecDecompress(bcmNone, _compressed, 0x100, _restored, 0x100) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(BlockCodecDecompress(bcmNone, _compressed, 0x100, _restored, 0xff) == ERROR_VALUE_INVAL);
+
+	return;
+}
+
+
+/** Damaged blocks either fail or restore exactly the requested size. */
+static void _TestMalformed(void)
+{
+	size_t written = 0;
+	ERROR_TYPE err = ERROR_VALUE_SUCCESS;
+	static UCHAR damaged[sizeof(_compressed)];
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 3, TRUE);
+	_Fill(&gen, bcMixed, _source, 0x2000);
+	TEST_CHECK(BlockCodecCompress(bcmFast, _source, 0x2000, _compressed, sizeof(_compressed), &written) == ERROR_VALUE_SUCCESS);
+	// A wrong size is detected.
+	TEST_CHECK(BlockCodecDecompress(bcmFast, _compressed, written, _restored, 0x2000 - 1) == ERROR_VALUE_INVAL);
+	TEST_CHECK(BlockCodecDecompress(bcmFast, _compressed, written, _restored, 0x2000 + 1) == ERROR_VALUE_INVAL);
+	for (size_t i = 0; i < written; ++i)
+		TEST_CHECK(BlockCodecDecompress(bcmFast, _compressed, i, _restored, 0x2000) == ERROR_VALUE_INVAL);
+
+	for (ULONG i = 0; i < 5000; ++i) {
+		memcpy(damaged, _compressed, written);
+		for (ULONG j = 0; j < 1 + i % 3; ++j)
+			damaged[TestRequestGenRandom(&gen) % written] ^= (UCHAR)(1 + TestRequestGenRandom(&gen) % 255);
+
+		memset(_restored, 0xcc, sizeof(_restored));
+		err = BlockCodecDecompress(bcmFast, damaged, written, _restored, 0x2000);
+		TEST_CHECK(err == ERROR_VALUE_SUCCESS || err == ERROR_VALUE_INVAL);
+		TEST_CHECK(_restored[0x2000] == 0xcc);
+	}
+
+	return;
+}
+
+
+static void _TestMethods(void)
+{
+	size_t written = 0;
+
+	TEST_CHECK(BlockCodecSupported(bcmNone));
+	TEST_CHECK(BlockCodecSupported(bcmFast));
+	TEST_CHECK(!BlockCodecSupported(bcmHigh));
+	TEST_CHECK(!BlockCodecSupported(bcmMax));
+	memset(_source, 0, 0x1000);
+	TEST_CHECK(BlockCodecCompress(bcmHigh, _source, 0x1000, _compressed, sizeof(_compressed), &written) == ERROR_MOD_NOT_FOUND);
+	TEST_CHECK(BlockCodecDecompress(bcmHigh, _compressed, 0x100, _restored, 0x1000) == ERROR_MOD_NOT_FOUND);
+	TEST_CHECK(BlockCodecCompress(bcmMax, _source, 0x1000, _compressed, sizeof(_compressed), &written) == ERROR_VALUE_INVAL);
+	TEST_CHECK(BlockCodecDecompress(bcmMax, _compressed, 0x100, _restored, 0x1000) == ERROR_VALUE_INVAL);
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestRoundTrip();
+	_TestBufferTooSmall();
+	_TestMalformed();
+	_TestMethods();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,306 @@
+
+/**
+ * @file
+ *
+ * Producer/consumer harness of the shared event ring. The ring lives in
+ * memory shared by two processes, as it does between the driver and the
+ * connected application: the child formats it and runs several producer
+ * threads writing records in place, the parent attaches to it and consumes.
+ * Producers notify the consumer through a pipe standing for the event.
+ * The consumer checks that every committed record arrives exactly once,
+ * intact and in the order of its producer, and that discarded records
+ * are never seen.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "event-ring.h"
+#include "test.h"
+
+
+#define DATA_SIZE					EVENT_RING_MIN_DATA_SIZE
+#define WATERMARK					0x1000
+#define PRODUCER_COUNT				4
+#define RECORD_COUNT				100000
+#define MAX_PAYLOAD					200
+
+
+typedef struct _TEST_RECORD {
+	ULONG Producer;
+	ULONG Sequence;
+	ULONG Size;
+} TEST_RECORD, *PTEST_RECORD;
+
+
+static EVENT_RING _producerRing;
+static int _notifyPipe[2];
+static volatile LONG _reserveFailures = 0;
+
+
+static ULONG _RecordSize(ULONG Producer, ULONG Sequence)
+{
+	return sizeof(TEST_RECORD) + (Producer*7 + Sequence*13) % (MAX_PAYLOAD - sizeof(TEST_RECORD));
+}
+
+static BOOLEAN _RecordDiscarded(ULONG Producer, ULONG Sequence)
+{
+	return ((Producer + Sequence) % 11 == 0);
+}
+
+static BOOLEAN _RecordCopied(ULONG Sequence)
+{
+	return (Sequence % 5 == 0);
+}
+
+static void _RecordFill(PTEST_RECORD Record, ULONG Producer, ULONG Sequence, ULONG Size)
+{
+	PUCHAR data = (PUCHAR)(Record + 1);
+
+	Record->Producer = Producer;
+	Record->Sequence = Sequence;
+	Record->Size = Size;
+	for (ULONG i = 0; i < Size - sizeof(TEST_RECORD); ++i)
+		data[i] = (UCHAR)(Sequence*31 + i);
+
+	return;
+}
+
+static BOOLEAN _RecordCheck(const TEST_RECORD *Record, ULONG Size)
+{
+	BOOLEAN ret = FALSE;
+	const UCHAR *data = (const UCHAR *)(Record + 1);
+
+	ret = (Size >= sizeof(TEST_RECORD) && Record->Size <= Size && Record->Size >= sizeof(TEST_RECORD));
+	for (ULONG i = 0; ret && i < Record->Size - sizeof(TEST_RECORD); ++i)
+		ret = (data[i] == (UCHAR)(Record->Sequence*31 + i));
+
+	return ret;
+}
+
+
+static void _Notify(void)
+{
+	char c = 0;
+
+	while (write(_notifyPipe[1], &c, 1) != 1 && errno == EINTR)
+		;
+
+	return;
+}
+
+
+static void *_Producer(void *Context)
+{
+	ULONG size = 0;
+	BOOLEAN notify = FALSE;
+	PTEST_RECORD r = NULL;
+	UCHAR buffer[MAX_PAYLOAD];
+	ULONG producer = (ULONG)(uintptr_t)Context;
+
+	for (ULONG seq = 0; seq < RECORD_COUNT; ++seq) {
+		size = _RecordSize(producer, seq);
+		if (_RecordCopied(seq) && !_RecordDiscarded(producer, seq)) {
+			_RecordFill((PTEST_RECORD)buffer, producer, seq, size);
+			while (!EventRingWrite(&_producerRing, buffer, size, &notify)) {
+				__atomic_add_fetch(&_reserveFailures, 1, __ATOMIC_RELAXED);
+				sched_yield();
+			}
+		} else {
+			while ((r = (PTEST_RECORD)EventRingReserve(&_producerRing, size)) == NULL) {
+				__atomic_add_fetch(&_reserveFailures, 1, __ATOMIC_RELAXED);
+				sched_yield();
+			}
+
+			// The record is built right in the shared memory.
+			_RecordFill(r, producer, seq, size);
+			if (_RecordDiscarded(producer, seq)) {
+				EventRingDiscard(&_producerRing, r);
+				notify = FALSE;
+			} else notify = EventRingCommit(&_producerRing, r);
+		}
+
+		if (notify)
+			_Notify();
+	}
+
+	return NULL;
+}
+
+
+static int _ProducerProcess(void *Memory, ULONG MemorySize)
+{
+	pthread_t threads[PRODUCER_COUNT];
+
+	close(_notifyPipe[0]);
+	TEST_CHECK(EventRingFormat(&_producerRing, Memory, MemorySize, WATERMARK));
+	for (uintptr_t i = 0; i < PRODUCER_COUNT; ++i)
+		pthread_create(threads + i, NULL, _Producer, (void *)i);
+
+	for (ULONG i = 0; i < PRODUCER_COUNT; ++i)
+		pthread_join(threads[i], NULL);
+
+	TEST_CHECK(((PEVENT_RING_HEADER)Memory)->DroppedCount == _reserveFailures);
+	_Notify();
+	close(_notifyPipe[1]);
+
+	return TEST_RESULT();
+}
+
+
+static void _ConsumerProcess(void *Memory, ULONG MemorySize, pid_t Producer)
+{
+	ULONG size = 0;
+	ULONG expected = 0;
+	ULONG received = 0;
+	ULONG nextSequence[PRODUCER_COUNT];
+	char buffer[64];
+	struct pollfd pfd;
+	EVENT_RING ring;
+	const TEST_RECORD *r = NULL;
+	int status = 0;
+
+	close(_notifyPipe[1]);
+	memset(nextSequence, 0, sizeof(nextSequence));
+	for (ULONG p = 0; p < PRODUCER_COUNT; ++p) {
+		for (ULONG seq = 0; seq < RECORD_COUNT; ++seq) {
+			if (!_RecordDiscarded(p, seq))
+				++expected;
+		}
+	}
+
+	while (((PEVENT_RING_HEADER)Memory)->Signature != EVENT_RING_SIGNATURE)
+		sched_yield();
+
+	TEST_CHECK(EventRingAttach(&ring, Memory, MemorySize));
+	pfd.fd = _notifyPipe[0];
+	pfd.events = POLLIN;
+	while (received < expected) {
+		r = (const TEST_RECORD *)EventRingPeek(&ring, &size);
+		if (r == NULL) {
+			if (EventRingWaitPrepare(&ring) && poll(&pfd, 1, 10) > 0 &&
+				read(_notifyPipe[0], buffer, sizeof(buffer)) == 0)
+				break;
+
+			continue;
+		}
+
+		TEST_CHECK(r->Producer < PRODUCER_COUNT);
+		if (r->Producer < PRODUCER_COUNT) {
+			// Skip over discarded records to the next expected one.
+			while (_RecordDiscarded(r->Producer, nextSequence[r->Producer]))
+				++nextSequence[r->Producer];
+
+			TEST_CHECK(r->Sequence == nextSequence[r->Producer]);
+			TEST_CHECK(!_RecordDiscarded(r->Producer, r->Sequence));
+			TEST_CHECK(r->Size == _RecordSize(r->Producer, r->Sequence));
+			TEST_CHECK(size >= r->Size && size - r->Size < EVENT_RING_ALIGNMENT);
+			TEST_CHECK(_RecordCheck(r, size));
+			nextSequence[r->Producer] = r->Sequence + 1;
+		}
+
+		EventRingRelease(&ring);
+		++received;
+	}
+
+	TEST_CHECK(received == expected);
+	TEST_CHECK(waitpid(Producer, &status, 0) == Producer);
+	TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	TEST_CHECK(EventRingPeek(&ring, &size) == NULL);
+	TEST_CHECK(ring.Header->ReadOffset == ring.ReadOffset);
+	close(_notifyPipe[0]);
+
+	return;
+}
+
+
+static void _TestSharedMemory(void)
+{
+	pid_t pid = 0;
+	void *memory = NULL;
+	ULONG memorySize = 0;
+
+	memorySize = EventRingMemorySize(DATA_SIZE);
+	TEST_CHECK(memorySize > DATA_SIZE);
+	memory = mmap(NULL, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	TEST_CHECK(memory != MAP_FAILED);
+	TEST_CHECK(pipe(_notifyPipe) == 0);
+	pid = fork();
+	TEST_CHECK(pid >= 0);
+	if (pid == 0)
+		_exit(_ProducerProcess(memory, memorySize));
+
+	_ConsumerProcess(memory, memorySize, pid);
+	munmap(memory, memorySize);
+
+	return;
+}
+
+
+/** A full ring refuses records and counts them, discarded and wrap records
+ *  are skipped, and the space they occupied is reused.
+ */
+static void _TestFullRing(void)
+{
+	ULONG size = 0;
+	ULONG count = 0;
+	void *payload = NULL;
+	void *memory = NULL;
+	ULONG memorySize = 0;
+	EVENT_RING producer;
+	EVENT_RING consumer;
+	const ULONG *r = NULL;
+
+	memorySize = EventRingMemorySize(DATA_SIZE);
+	memory = calloc(1, memorySize);
+	TEST_CHECK(EventRingFormat(&producer, memory, memorySize, WATERMARK));
+	TEST_CHECK(EventRingAttach(&consumer, memory, memorySize));
+	TEST_CHECK(EventRingReserve(&producer, DATA_SIZE / 2 + 1) == NULL);
+	TEST_CHECK(producer.Header->DroppedCount == 1);
+	while ((payload = EventRingReserve(&producer, 1000)) != NULL) {
+		*(PULONG)payload = count;
+		if (count % 2 == 0)
+			EventRingCommit(&producer, payload);
+		else EventRingDiscard(&producer, payload);
+
+		++count;
+	}
+
+	TEST_CHECK(count == DATA_SIZE / 1008);
+	TEST_CHECK(producer.Header->DroppedCount == 2);
+	for (ULONG i = 0; i < count; i += 2) {
+		r = (const ULONG *)EventRingPeek(&consumer, &size);
+		TEST_CHECK(r != NULL && *r == i && size == 1000);
+		EventRingRelease(&consumer);
+	}
+
+	TEST_CHECK(EventRingPeek(&consumer, &size) == NULL);
+	// The next record does not fit before the end and wraps.
+	payload = EventRingReserve(&producer, 1000);
+	TEST_CHECK(payload == producer.Data + sizeof(EVENT_RING_RECORD));
+	*(PULONG)payload = 0x1234;
+	TEST_CHECK(!EventRingCommit(&producer, payload));
+	TEST_CHECK(EventRingWaitPrepare(&consumer) == FALSE);
+	r = (const ULONG *)EventRingPeek(&consumer, &size);
+	TEST_CHECK(r != NULL && *r == 0x1234);
+	EventRingRelease(&consumer);
+	TEST_CHECK(EventRingWaitPrepare(&consumer));
+	free(memory);
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestFullRing();
+	_TestSharedMemory();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,287 @@
+
+/**
+ * @file
+ *
+ * Fake IRPMon driver behind the DevConn_* routines.
+ */
+
+#include <windows.h>
+#include "device-connector.h"
+#include "fake-driver.h"
+
+
+typedef struct _FAKE_DRIVER_RECORD {
+	struct _FAKE_DRIVER_RECORD *Next;
+	size_t Size;
+	// Request
+} FAKE_DRIVER_RECORD, *PFAKE_DRIVER_RECORD;
+
+
+static CRITICAL_SECTION _lock;
+static PFAKE_DRIVER_RECORD _queueHead = NULL;
+static PFAKE_DRIVER_RECORD _queueTail = NULL;
+static ULONG _queueLength = 0;
+static ULONG _droppedCount = 0;
+static BOOLEAN _connected = FALSE;
+static FAKE_DRIVER_STATISTICS _statistics;
+
+
+/************************************************************************/
+/*                 HELPER FUNCTIONS                                     */
+/************************************************************************/
+
+
+/** Moves requests from the queue into the buffer, the way the driver does. */
+static DWORD _GetRecords(PREQUEST_BATCH_HEADER Buffer, ULONG BufferLength)
+{
+	ULONG available = 0;
+	unsigned char *target = NULL;
+	PREQUEST_HEADER h = NULL;
+	PREQUEST_HEADER last = NULL;
+	PFAKE_DRIVER_RECORD r = NULL;
+	DWORD ret = ERROR_INSUFFICIENT_BUFFER;
+
+	if (BufferLength >= sizeof(REQUEST_BATCH_HEADER) + sizeof(REQUEST_HEADER)) {
+		EnterCriticalSection(&_lock);
+		memset(Buffer, 0, sizeof(REQUEST_BATCH_HEADER));
+		Buffer->Version = REQUEST_BATCH_VERSION_1;
+		Buffer->HeaderSize = sizeof(REQUEST_BATCH_HEADER);
+		target = (unsigned char *)(Buffer + 1);
+		available = BufferLength - sizeof(REQUEST_BATCH_HEADER);
+		while (_queueHead != NULL && _queueHead->Size <= available) {
+			r = _queueHead;
+			h = (PREQUEST_HEADER)target;
+			memcpy(h, r + 1, r->Size);
+			h->Entry.Flink = NULL;
+			h->Entry.Blink = NULL;
+			h->Flags |= REQUEST_FLAG_NEXT_AVAILABLE;
+			if (Buffer->RecordCount == 0)
+				Buffer->FirstId = h->Id;
+
+			Buffer->LastId = h->Id;
+			++Buffer->RecordCount;
+			Buffer->BytesUsed += (ULONG)r->Size;
+			target += r->Size;
+			available -= (ULONG)r->Size;
+			last = h;
+			_queueHead = r->Next;
+			--_queueLength;
+			free(r);
+		}
+
+		if (_queueHead == NULL)
+			_queueTail = NULL;
+
+		if (last != NULL) {
+			last->Flags &= ~REQUEST_FLAG_NEXT_AVAILABLE;
+			Buffer->DroppedCount = _droppedCount;
+			_droppedCount = 0;
+			if (_queueHead != NULL)
+				Buffer->Flags |= REQUEST_BATCH_FLAG_MORE_AVAILABLE;
+
+			++_statistics.BatchCount;
+			ret = ERROR_SUCCESS;
+		} else if (_queueHead == NULL) {
+			++_statistics.EmptyReadCount;
+			ret = ERROR_NO_MORE_ITEMS;
+		}
+
+		LeaveCriticalSection(&_lock);
+	}
+
+	return ret;
+}
+
+
+static DWORD _Echo(const FAKE_DRIVER_ECHO *Input, ULONG InputLength, PFAKE_DRIVER_ECHO Output, ULONG OutputLength)
+{
+	DWORD ret = ERROR_INVALID_PARAMETER;
+
+	if (InputLength == sizeof(FAKE_DRIVER_ECHO)) {
+		ret = ERROR_INSUFFICIENT_BUFFER;
+		if (OutputLength >= sizeof(FAKE_DRIVER_ECHO)) {
+			if (Input->Delay > 0)
+				usleep(Input->Delay);
+
+			*Output = *Input;
+			EnterCriticalSection(&_lock);
+			++_statistics.EchoCount;
+			LeaveCriticalSection(&_lock);
+			ret = ERROR_SUCCESS;
+		}
+	}
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                 PUBLIC FUNCTIONS                                     */
+/************************************************************************/
+
+
+void FakeDriverInit(void)
+{
+	InitializeCriticalSection(&_lock);
+	memset(&_statistics, 0, sizeof(_statistics));
+
+	return;
+}
+
+
+void FakeDriverFinit(void)
+{
+	FakeDriverQueueClear();
+	DeleteCriticalSection(&_lock);
+
+	return;
+}
+
+
+BOOLEAN FakeDriverQueueInsert(const REQUEST_HEADER *Request)
+{
+	size_t size = 0;
+	PFAKE_DRIVER_RECORD r = NULL;
+	BOOLEAN ret = FALSE;
+
+	size = RequestGetSize(Request);
+	r = (PFAKE_DRIVER_RECORD)malloc(sizeof(FAKE_DRIVER_RECORD) + size);
+	if (r != NULL) {
+		r->Next = NULL;
+		r->Size = size;
+		memcpy(r + 1, Request, size);
+		EnterCriticalSection(&_lock);
+		if (_queueTail != NULL)
+			_queueTail->Next = r;
+		else _queueHead = r;
+
+		_queueTail = r;
+		++_queueLength;
+		LeaveCriticalSection(&_lock);
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
+
+void FakeDriverQueueClear(void)
+{
+	PFAKE_DRIVER_RECORD r = NULL;
+
+	EnterCriticalSection(&_lock);
+	while (_queueHead != NULL) {
+		r = _queueHead;
+		_queueHead = r->Next;
+		free(r);
+	}
+
+	_queueTail = NULL;
+	_queueLength = 0;
+	_droppedCount = 0;
+	LeaveCriticalSection(&_lock);
+
+	return;
+}
+
+
+void FakeDriverQueueDrop(ULONG Count)
+{
+	EnterCriticalSection(&_lock);
+	_droppedCount += Count;
+	LeaveCriticalSection(&_lock);
+
+	return;
+}
+
+
+ULONG FakeDriverQueueLength(void)
+{
+	ULONG ret = 0;
+
+	EnterCriticalSection(&_lock);
+	ret = _queueLength;
+	LeaveCriticalSection(&_lock);
+
+	return ret;
+}
+
+
+void FakeDriverQueryStatistics(PFAKE_DRIVER_STATISTICS Statistics)
+{
+	EnterCriticalSection(&_lock);
+	*Statistics = _statistics;
+	LeaveCriticalSection(&_lock);
+
+	return;
+}
+
+
+/************************************************************************/
+/*                 DEVICE CONNECTOR                                     */
+/************************************************************************/
+
+
+DWORD DevConn_SynchronousOtherIOCTL(DWORD Code, PVOID InputBuffer, ULONG InputBufferLength, PVOID OutputBuffer, ULONG OutputBufferLength)
+{
+	DWORD ret = ERROR_NOT_SUPPORTED;
+
+	switch (Code) {
+		case IOCTL_IRPMNDRV_GET_RECORDS:
+			ret = _GetRecords((PREQUEST_BATCH_HEADER)OutputBuffer, OutputBufferLength);
+			break;
+		case FAKE_DRIVER_IOCTL_ECHO:
+			ret = _Echo((PFAKE_DRIVER_ECHO)InputBuffer, InputBufferLength, (PFAKE_DRIVER_ECHO)OutputBuffer, OutputBufferLength);
+			break;
+		default:
+			break;
+	}
+
+	return ret;
+}
+
+
+DWORD DevConn_Connect(const IRPMON_INIT_INFO *Info)
+{
+	DWORD ret = ERROR_INVALID_PARAMETER;
+
+	if (Info->ConnectorType == ictDevice) {
+		EnterCriticalSection(&_lock);
+		ret = ERROR_ALREADY_EXISTS;
+		if (!_connected) {
+			_connected = TRUE;
+			++_statistics.ConnectCount;
+			ret = ERROR_SUCCESS;
+		}
+
+		LeaveCriticalSection(&_lock);
+	}
+
+	return ret;
+}
+
+
+void DevConn_Disconnect(void)
+{
+	EnterCriticalSection(&_lock);
+	if (_connected) {
+		_connected = FALSE;
+		++_statistics.DisconnectCount;
+	}
+
+	LeaveCriticalSection(&_lock);
+
+	return;
+}
+
+
+BOOL DevConn_Active(VOID)
+{
+	BOOL ret = FALSE;
+
+	EnterCriticalSection(&_lock);
+	ret = _connected;
+	LeaveCriticalSection(&_lock);
+
+	return ret;
+}
@@ -0,0 +1,52 @@
+
+/**
+ * @file
+ *
+ * Fake IRPMon driver standing behind the DevConn_* routines of the device
+ * connector, so the server can be tested without the driver. Its Event
+ * Queue holds requests queued by the tests and is read in batches by
+ * IOCTL_IRPMNDRV_GET_RECORDS, like the real queue. FAKE_DRIVER_IOCTL_ECHO
+ * stands for every other IOCTL.
+ */
+
+#ifndef __TESTS_FAKE_DRIVER_H__
+#define __TESTS_FAKE_DRIVER_H__
+
+#include <windows.h>
+#include "general-types.h"
+#include "ioctls.h"
+#include "request.h"
+
+
+/** The input is FAKE_DRIVER_ECHO, which is returned in the output buffer
+    once the delay passes. */
+#define FAKE_DRIVER_IOCTL_ECHO				CTL_CODE(FILE_DEVICE_UNKNOWN, 0x7ff, METHOD_NEITHER, FILE_ANY_ACCESS)
+
+typedef struct _FAKE_DRIVER_ECHO {
+	/** How long the IOCTL takes, in microseconds. */
+	ULONG Delay;
+	ULONG Value;
+} FAKE_DRIVER_ECHO, *PFAKE_DRIVER_ECHO;
+
+typedef struct _FAKE_DRIVER_STATISTICS {
+	ULONG ConnectCount;
+	ULONG DisconnectCount;
+	ULONG BatchCount;
+	ULONG EmptyReadCount;
+	ULONG EchoCount;
+} FAKE_DRIVER_STATISTICS, *PFAKE_DRIVER_STATISTICS;
+
+
+void FakeDriverInit(void);
+void FakeDriverFinit(void);
+/** Copies the request to the end of the Event Queue. */
+BOOLEAN FakeDriverQueueInsert(const REQUEST_HEADER *Request);
+void FakeDriverQueueClear(void);
+/** Reports the requests as dropped in the next batch. */
+void FakeDriverQueueDrop(ULONG Count);
+ULONG FakeDriverQueueLength(void);
+void FakeDriverQueryStatistics(PFAKE_DRIVER_STATISTICS Statistics);
+
+
+
+#endif
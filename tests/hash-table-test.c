@@ -0,0 +1,233 @@
+
+/**
+ * @file
+ *
+ * Tests of general hash tables: concurrent insertions, lookups and deletions
+ * while the table grows, lookups from inside a traversal, and the fixed-size
+ * behavior of no-synchronization tables above DISPATCH_LEVEL.
+ */
+
+#include <ntifs.h>
+#include "hash_table.h"
+#include "test.h"
+
+
+typedef struct _TEST_ITEM {
+	HASH_ITEM HashItem;
+	ULONG_PTR Key;
+} TEST_ITEM, *PTEST_ITEM;
+
+
+#define THREAD_COUNT				8
+#define ITEMS_PER_THREAD			20000
+#define ROUND_COUNT					3
+
+
+static PHASH_TABLE _table = NULL;
+static TEST_ITEM _items[THREAD_COUNT][ITEMS_PER_THREAD];
+static volatile LONG _freeCount = 0;
+
+
+static ULONG32 _HashFunction(PVOID Key)
+{
+	return (ULONG32)((ULONG_PTR)Key * 2654435761u);
+}
+
+static BOOLEAN _CompareFunction(PHASH_ITEM Item, PVOID Key)
+{
+	return (CONTAINING_RECORD(Item, TEST_ITEM, HashItem)->Key == (ULONG_PTR)Key);
+}
+
+static VOID _FreeFunction(PHASH_ITEM Item)
+{
+	UNREFERENCED_PARAMETER(Item);
+	InterlockedIncrement(&_freeCount);
+}
+
+
+static void *_Worker(void *Context)
+{
+	ULONG_PTR t = (ULONG_PTR)Context;
+	ULONG_PTR key = 0;
+	unsigned int seed = (unsigned int)t;
+	PHASH_ITEM h = NULL;
+
+	for (int r = 0; r < ROUND_COUNT; ++r) {
+		for (ULONG i = 0; i < ITEMS_PER_THREAD; ++i) {
+			key = t * ITEMS_PER_THREAD + i;
+			_items[t][i].Key = key;
+			HashTableInsert(_table, &_items[t][i].HashItem, (PVOID)key);
+		}
+
+		for (ULONG i = 0; i < ITEMS_PER_THREAD; ++i) {
+			key = t * ITEMS_PER_THREAD + i;
+			h = HashTableGet(_table, (PVOID)key);
+			TEST_CHECK(h == &_items[t][i].HashItem);
+			HashTableGet(_table, (PVOID)(ULONG_PTR)(rand_r(&seed) % (THREAD_COUNT * ITEMS_PER_THREAD)));
+		}
+
+		for (ULONG i = 0; i < ITEMS_PER_THREAD; i += 2) {
+			key = t * ITEMS_PER_THREAD + i;
+			h = HashTableDelete(_table, (PVOID)key);
+			TEST_CHECK(h == &_items[t][i].HashItem);
+		}
+
+		for (ULONG i = 0; i < ITEMS_PER_THREAD; ++i) {
+			key = t * ITEMS_PER_THREAD + i;
+			h = HashTableGet(_table, (PVOID)key);
+			TEST_CHECK((h != NULL) == ((i & 1) != 0));
+		}
+
+		if (r + 1 < ROUND_COUNT) {
+			for (ULONG i = 1; i < ITEMS_PER_THREAD; i += 2)
+				HashTableDelete(_table, (PVOID)(t * ITEMS_PER_THREAD + i));
+		}
+	}
+
+	return NULL;
+}
+
+
+static void _TestConcurrent(EHashTableType Type)
+{
+	pthread_t threads[THREAD_COUNT];
+	HASH_TABLE_STATISTICS stats;
+	HASH_TABLE_ITERATOR it;
+	ULONG count = 0;
+
+	TEST_CHECK(NT_SUCCESS(HashTableCreate(Type, 37, _HashFunction, _CompareFunction, _FreeFunction, &_table)));
+	for (ULONG_PTR t = 0; t < THREAD_COUNT; ++t)
+		pthread_create(threads + t, NULL, _Worker, (void *)t);
+
+	for (ULONG t = 0; t < THREAD_COUNT; ++t)
+		pthread_join(threads[t], NULL);
+
+	HashTableGetStatistics(_table, &stats);
+	TEST_CHECK(stats.NumberOfItems == THREAD_COUNT * ITEMS_PER_THREAD / 2);
+	TEST_CHECK(stats.NumberOfResizes > 0);
+	if (HashTableGetFirst(_table, &it)) {
+		do {
+			++count;
+		} while (HashTableGetNext(&it));
+
+		HashTableIteratorFinit(&it);
+	}
+
+	TEST_CHECK(count == THREAD_COUNT * ITEMS_PER_THREAD / 2);
+	_freeCount = 0;
+	HashTableDestroy(_table);
+	TEST_CHECK(_freeCount == THREAD_COUNT * ITEMS_PER_THREAD / 2);
+
+	return;
+}
+
+
+#define PERFORM_ITEM_COUNT			8
+#define PERFORM_LOCK_COUNT			7
+
+static ULONG _performGetCount = 0;
+
+static VOID _PerformGetCallback(PHASH_ITEM Item, PVOID Context)
+{
+	ULONG_PTR key = 0;
+	PTEST_ITEM item = CONTAINING_RECORD(Item, TEST_ITEM, HashItem);
+
+	if (((PHASH_TABLE)Context)->Type == httPassiveLevel)
+		TEST_CHECK(HashTableGet(_table, (PVOID)item->Key) == Item);
+
+	for (key = 0; key < PERFORM_ITEM_COUNT; ++key) {
+		if (_HashFunction((PVOID)key) % PERFORM_LOCK_COUNT != Item->Hash % PERFORM_LOCK_COUNT)
+			TEST_CHECK(HashTableGet(_table, (PVOID)key) == &_items[0][key].HashItem);
+	}
+
+	++_performGetCount;
+
+	return;
+}
+
+/** Lookups done from inside a traversal must take only the locks of their keys,
+ *  in shared mode, even while the table is being resized. */
+static void _TestGetInsidePerform(EHashTableType Type)
+{
+	HASH_TABLE_STATISTICS stats;
+
+	_performGetCount = 0;
+	TEST_CHECK(NT_SUCCESS(HashTableCreate(Type, PERFORM_LOCK_COUNT, _HashFunction, _CompareFunction, NULL, &_table)));
+	for (ULONG i = 0; i < PERFORM_ITEM_COUNT; ++i) {
+		_items[0][i].Key = i;
+		HashTableInsert(_table, &_items[0][i].HashItem, (PVOID)(ULONG_PTR)i);
+	}
+
+	HashTableGetStatistics(_table, &stats);
+	TEST_CHECK(stats.ResizeInProgress);
+	HashTablePerform(_table, _PerformGetCallback, _table);
+	TEST_CHECK(_performGetCount == PERFORM_ITEM_COUNT);
+	HashTableGetStatistics(_table, &stats);
+	TEST_CHECK(stats.ResizeInProgress);
+	HashTableDestroy(_table);
+
+	return;
+}
+
+
+/** No-synchronization tables used above DISPATCH_LEVEL must not touch the pool. */
+static void _TestElevatedIrql(void)
+{
+	KIRQL irql;
+	LONG allocations = 0;
+	HASH_TABLE_STATISTICS stats;
+
+	TEST_CHECK(NT_SUCCESS(HashTableCreate(httNoSynchronization, 3, _HashFunction, _CompareFunction, _FreeFunction, &_table)));
+	/* Start a resize at PASSIVE_LEVEL and leave it unfinished. */
+	for (ULONG i = 0; i < 4; ++i) {
+		_items[0][i].Key = i;
+		HashTableInsert(_table, &_items[0][i].HashItem, (PVOID)(ULONG_PTR)i);
+	}
+
+	HashTableGetStatistics(_table, &stats);
+	TEST_CHECK(stats.ResizeInProgress);
+	KeRaiseIrql(HIGH_LEVEL, &irql);
+	allocations = ShimAllocationCount;
+	for (ULONG i = 4; i < 5000; ++i) {
+		_items[0][i].Key = i;
+		HashTableInsert(_table, &_items[0][i].HashItem, (PVOID)(ULONG_PTR)i);
+	}
+
+	for (ULONG i = 0; i < 5000; ++i)
+		TEST_CHECK(HashTableGet(_table, (PVOID)(ULONG_PTR)i) == &_items[0][i].HashItem);
+
+	for (ULONG i = 0; i < 5000; i += 2)
+		TEST_CHECK(HashTableDelete(_table, (PVOID)(ULONG_PTR)i) == &_items[0][i].HashItem);
+
+	TEST_CHECK(ShimAllocationCount == allocations);
+	HashTableGetStatistics(_table, &stats);
+	TEST_CHECK(stats.NumberOfResizes == 1);
+	KeLowerIrql(irql);
+	for (ULONG i = 0; i < 5000; i += 2)
+		HashTableInsert(_table, &_items[0][i].HashItem, (PVOID)(ULONG_PTR)i);
+
+	for (ULONG i = 0; i < 5000; ++i)
+		TEST_CHECK(HashTableGet(_table, (PVOID)(ULONG_PTR)i) == &_items[0][i].HashItem);
+
+	HashTableGetStatistics(_table, &stats);
+	TEST_CHECK(stats.NumberOfResizes > 1);
+	TEST_CHECK(stats.NumberOfItems == 5000);
+	_freeCount = 0;
+	HashTableClear(_table, TRUE);
+	TEST_CHECK(_freeCount == 5000 && HashTableGetItemCount(_table) == 0);
+	HashTableDestroy(_table);
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestConcurrent(httPassiveLevel);
+	_TestConcurrent(httDispatchLevel);
+	_TestGetInsidePerform(httPassiveLevel);
+	_TestGetInsidePerform(httDispatchLevel);
+	_TestElevatedIrql();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,99 @@
+
+/**
+ * @file
+ *
+ * Speed of the hexer data parser rendering dumps with the scalar and the
+ * SSSE3 routines, through the range rendering and through both parser
+ * interfaces. The dumped request carries one megabyte of random data.
+ */
+
+#include "hexer.c"
+#include <stdlib.h>
+#include "bench.h"
+
+
+#define DATA_LENGTH					(1024*1024)
+#define PASS_COUNT					20
+
+
+static void _Measure(const char *Name, HEXER_BYTES_ROUTINE *Routine, PREQUEST_IRP Request, const IRPMON_DATA_PARSER *Parser)
+{
+	double start = 0;
+	double renderTime = 0;
+	double parseTime = 0;
+	double outputTime = 0;
+	size_t lineCount = 0;
+	size_t lineChars = 0;
+	size_t rowCount = 0;
+	wchar_t *buffer = NULL;
+	wchar_t **names = NULL;
+	wchar_t **values = NULL;
+	BOOLEAN handled = FALSE;
+	DP_OUTPUT output;
+
+	_bytesRoutine = Routine;
+	lineCount = HexerLineCount(Request->DataSize);
+	lineChars = HexerLineLength(Request->DataSize);
+	buffer = (wchar_t *)malloc(lineCount*(lineChars + 1)*sizeof(wchar_t));
+	PBaseOutputInit(&output);
+	if (buffer != NULL) {
+		start = BenchNow();
+		for (size_t p = 0; p < PASS_COUNT; ++p)
+			HexerRenderLines(Request + 1, Request->DataSize, 0, lineCount, buffer, lineCount*(lineChars + 1));
+
+		renderTime = BenchNow() - start;
+		start = BenchNow();
+		for (size_t p = 0; p < PASS_COUNT; ++p) {
+			Parser->ParseRoutine(&Request->Header, NULL, &handled, &names, &values, &rowCount);
+			Parser->FreeRoutine(names, values, rowCount);
+		}
+
+		parseTime = BenchNow() - start;
+		start = BenchNow();
+		for (size_t p = 0; p < PASS_COUNT; ++p) {
+			PBaseOutputReset(&output);
+			Parser->ParseOutputRoutine(&Request->Header, NULL, &handled, &output);
+		}
+
+		outputTime = BenchNow() - start;
+		printf("%-6s render %7.1f MB/s, parse %7.1f MB/s, parse output %7.1f MB/s, %.1f M lines/s rendered\n", Name,
+			BenchMBps((double)Request->DataSize*PASS_COUNT, renderTime),
+			BenchMBps((double)Request->DataSize*PASS_COUNT, parseTime),
+			BenchMBps((double)Request->DataSize*PASS_COUNT, outputTime),
+			lineCount*(double)PASS_COUNT / renderTime / 1e6);
+	}
+
+	PBaseOutputFree(&output);
+	free(buffer);
+
+	return;
+}
+
+
+int main(void)
+{
+	unsigned char *data = NULL;
+	PREQUEST_IRP request = NULL;
+	PIRPMON_DATA_PARSER parser = NULL;
+
+	request = (PREQUEST_IRP)calloc(1, sizeof(REQUEST_IRP) + DATA_LENGTH);
+	if (request != NULL && DP_INIT_ROUTINE_NAME(IRPMON_DATA_PARSER_VERSION_3, &parser) == ERROR_SUCCESS) {
+		request->Header.Type = ertIRP;
+		request->DataSize = DATA_LENGTH;
+		data = (unsigned char *)(request + 1);
+		srand(42);
+		for (size_t i = 0; i < DATA_LENGTH; ++i)
+			data[i] = (unsigned char)rand();
+
+		_Measure("scalar", _RenderBytesScalar, request, parser);
+#if defined(_M_X64) || defined(_M_IX86)
+		if (_BytesRoutineSelect() == _RenderBytesSsse3)
+			_Measure("SSSE3", _RenderBytesSsse3, request, parser);
+#endif
+		PBaseDataParserFree(parser);
+	}
+
+	free(request);
+
+	return 0;
+}
@@ -0,0 +1,474 @@
+
+/**
+ * @file
+ *
+ * Tests of the hexer data parser. Dumps of any length, with any of the
+ * display options, must equal the lines the parser rendered one by one
+ * before the vector routine and the range rendering were introduced, with
+ * each routine rendering the full lines. The SSSE3 routine must write
+ * exactly what the scalar one writes. The source is included, so the
+ * routines and the options can be reached directly; it is built with
+ * two-byte wchar_t, as on Windows, so the vector routine is selected.
+ */
+
+#include "hexer.c"
+#include <stdlib.h>
+#include "test.h"
+
+
+#define MAX_SHORT_LENGTH			300
+#define ROUND_COUNT					100000
+#define GUARD_CHAR					((wchar_t)0xabcd)
+
+
+typedef struct _BYTES_ROUTINE_RECORD {
+	const char *Name;
+	HEXER_BYTES_ROUTINE *Routine;
+} BYTES_ROUTINE_RECORD, *PBYTES_ROUTINE_RECORD;
+
+
+static BYTES_ROUTINE_RECORD _routines[2];
+static size_t _routineCount = 0;
+static uint64_t _randomState = 0x9e3779b97f4a7c15ULL;
+
+
+static const size_t _longLengths[] = {
+	4095, 4096, 4097, 65535, 65536, 65537, 1048576 + 5,
+};
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+static uint32_t _Random(void)
+{
+	_randomState ^= _randomState >> 12;
+	_randomState ^= _randomState << 25;
+	_randomState ^= _randomState >> 27;
+
+	return (uint32_t)((_randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+
+/** Bytes around the printable boundary and the extremes come often. */
+static unsigned char _RandomByte(void)
+{
+	static const unsigned char edges[] = {
+		0x00, 0x0f, 0x1f, 0x20, 0x21, 0x7e, 0x7f, 0x80, 0xa0, 0xf0, 0xff,
+	};
+	unsigned char ret = 0;
+
+	if (_Random() % 4 == 0)
+		ret = edges[_Random() % (sizeof(edges) / sizeof(edges[0]))];
+	else ret = (unsigned char)_Random();
+
+	return ret;
+}
+
+
+static void _RandomBytes(unsigned char *Data, size_t Length)
+{
+	for (size_t i = 0; i < Length; ++i)
+		Data[i] = _RandomByte();
+
+	return;
+}
+
+
+/** The layout the parser computed before the range rendering. */
+static void _ModelLayout(size_t DataLength, size_t *LineCount, size_t *AddressSize, size_t *LineChars)
+{
+	size_t lineCount = 0;
+	size_t addressSize = 0;
+	size_t totalLineChars = 0;
+
+	lineCount = (DataLength + 15) / 16;
+	if (_displayAddress) {
+		addressSize = 31;
+		while (addressSize > 0 && ((size_t)1 << addressSize) >= lineCount * 16)
+			--addressSize;
+
+		++addressSize;
+		addressSize = (addressSize + 3) / 4;
+		totalLineChars += (addressSize + 2);
+	}
+
+	totalLineChars += (16 * 3 - 1);
+	if (_displayCharValues)
+		totalLineChars += (16 + 1);
+
+	*LineCount = lineCount;
+	*AddressSize = addressSize;
+	*LineChars = totalLineChars;
+
+	return;
+}
+
+
+/** A line as the parser rendered it before the vector routine. The hex
+ *  column starts right at the line start when the address is hidden, and
+ *  the line is always terminated; the old routine got both wrong when
+ *  some of the options were off.
+ */
+static void _ModelLine(wchar_t *Line, size_t LineChars, size_t AddressSize, size_t Address, const unsigned char *Data, size_t DataLength)
+{
+	const wchar_t *digits = (_displayUpperDigits) ? L"0123456789ABCDEF" : L"0123456789abcdef";
+	size_t hexStart = 0;
+	size_t bytesToDo = 0;
+
+	for (size_t j = 0; j < LineChars; ++j)
+		Line[j] = L' ';
+
+	if (_displayAddress) {
+		hexStart = AddressSize + 2;
+		Line[AddressSize] = L':';
+		Line[AddressSize + 1] = L'\t';
+		for (size_t j = 0; j < AddressSize; ++j)
+			Line[j] = digits[((Address >> ((AddressSize - j - 1) * 4)) & 0xf)];
+	}
+
+	bytesToDo = (DataLength >= 16) ? 16 : DataLength;
+	for (size_t j = 0; j < bytesToDo; ++j) {
+		Line[hexStart + j * 3] = digits[(Data[j] >> 4)];
+		Line[hexStart + j * 3 + 1] = digits[(Data[j] & 0xf)];
+		if (_displayCharValues)
+			Line[hexStart + 16 * 3 + j] = (Data[j] >= L' ') ? Data[j] : L'.';
+	}
+
+	if (_displayCharValues)
+		Line[hexStart + 16 * 3 - 1] = L'\t';
+
+	Line[LineChars] = L'\0';
+
+	return;
+}
+
+
+static void _SetOptions(unsigned int Options)
+{
+	_displayAddress = (Options & 1) != 0;
+	_displayCharValues = (Options & 2) != 0;
+	_displayUpperDigits = (Options & 4) != 0;
+
+	return;
+}
+
+
+/** Checks Count lines of a dump, starting with FirstLine, against the model.
+ *  Returns the number of lines that differ.
+ */
+static size_t _CompareLines(const wchar_t *Lines, const unsigned char *Data, size_t DataLength, size_t FirstLine, size_t Count)
+{
+	size_t ret = 0;
+	size_t lineCount = 0;
+	size_t addressSize = 0;
+	size_t lineChars = 0;
+	wchar_t *model = NULL;
+
+	_ModelLayout(DataLength, &lineCount, &addressSize, &lineChars);
+	model = (wchar_t *)malloc((lineChars + 1)*sizeof(wchar_t));
+	for (size_t i = FirstLine; i < FirstLine + Count; ++i) {
+		_ModelLine(model, lineChars, addressSize, i * 16, Data + i * 16, DataLength - i * 16);
+		if (memcmp(model, Lines + (i - FirstLine)*(lineChars + 1), (lineChars + 1)*sizeof(wchar_t)) != 0)
+			++ret;
+	}
+
+	free(model);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     TESTS                                            */
+/************************************************************************/
+
+
+/** Renders the whole dump and a random range of it, the lines after the
+ *  range must stay untouched.
+ */
+static void _TestDump(const BYTES_ROUTINE_RECORD *Routine, unsigned int Options, const unsigned char *Data, size_t DataLength)
+{
+	size_t lineCount = 0;
+	size_t addressSize = 0;
+	size_t lineChars = 0;
+	size_t first = 0;
+	size_t count = 0;
+	size_t bufferLength = 0;
+	size_t differ = 0;
+	wchar_t *buffer = NULL;
+
+	_ModelLayout(DataLength, &lineCount, &addressSize, &lineChars);
+	TEST_CHECK(HexerLineCount(DataLength) == lineCount);
+	TEST_CHECK(HexerLineLength(DataLength) == lineChars);
+	bufferLength = lineCount*(lineChars + 1);
+	buffer = (wchar_t *)malloc((bufferLength + 1)*sizeof(wchar_t));
+	buffer[bufferLength] = GUARD_CHAR;
+	TEST_CHECK(HexerRenderLines(Data, DataLength, 0, lineCount, buffer, bufferLength) == ERROR_SUCCESS);
+	differ = _CompareLines(buffer, Data, DataLength, 0, lineCount);
+	TEST_CHECK(buffer[bufferLength] == GUARD_CHAR);
+	if (lineCount > 0) {
+		first = _Random() % lineCount;
+		count = _Random() % (lineCount - first + 1);
+		buffer[count*(lineChars + 1)] = GUARD_CHAR;
+		TEST_CHECK(HexerRenderLines(Data, DataLength, first, count, buffer, count*(lineChars + 1)) == ERROR_SUCCESS);
+		differ += _CompareLines(buffer, Data, DataLength, first, count);
+		TEST_CHECK(buffer[count*(lineChars + 1)] == GUARD_CHAR);
+	}
+
+	if (differ > 0)
+		fprintf(stderr, "%s routine, options %u, %zu bytes: %zu lines differ\n", Routine->Name, Options, DataLength, differ);
+
+	TEST_CHECK(differ == 0);
+	free(buffer);
+
+	return;
+}
+
+
+static void _TestDumps(const BYTES_ROUTINE_RECORD *Routine)
+{
+	unsigned char *data = NULL;
+	size_t maxLength = _longLengths[sizeof(_longLengths) / sizeof(_longLengths[0]) - 1];
+
+	_bytesRoutine = Routine->Routine;
+	data = (unsigned char *)malloc(maxLength);
+	_RandomBytes(data, maxLength);
+	for (unsigned int o = 0; o < 8; ++o) {
+		_SetOptions(o);
+		for (size_t l = 0; l <= MAX_SHORT_LENGTH; ++l)
+			_TestDump(Routine, o, data + _Random() % 64, l);
+
+		for (size_t i = 0; i < sizeof(_longLengths) / sizeof(_longLengths[0]); ++i)
+			_TestDump(Routine, o, data, _longLengths[i]);
+	}
+
+	free(data);
+	_SetOptions(3);
+
+	return;
+}
+
+
+static void _TestRanges(void)
+{
+	unsigned char data[1000];
+	wchar_t *buffer = NULL;
+	size_t lineChars = 0;
+	size_t bufferLength = 0;
+
+	_RandomBytes(data, sizeof(data));
+	lineChars = HexerLineLength(sizeof(data));
+	bufferLength = 63*(lineChars + 1);
+	buffer = (wchar_t *)malloc(bufferLength*sizeof(wchar_t));
+	TEST_CHECK(HexerLineCount(sizeof(data)) == 63);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 0, 63, buffer, bufferLength) == ERROR_SUCCESS);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 63, 0, buffer, bufferLength) == ERROR_SUCCESS);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 64, 0, buffer, bufferLength) == ERROR_INVALID_PARAMETER);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 60, 4, buffer, bufferLength) == ERROR_INVALID_PARAMETER);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 0, 64, buffer, bufferLength) == ERROR_INVALID_PARAMETER);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 1, (size_t)-1, buffer, bufferLength) == ERROR_INVALID_PARAMETER);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), (size_t)-1, 1, buffer, bufferLength) == ERROR_INVALID_PARAMETER);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 0, 63, buffer, bufferLength - 1) == ERROR_INSUFFICIENT_BUFFER);
+	TEST_CHECK(HexerRenderLines(data, sizeof(data), 10, 2, buffer, 2*(lineChars + 1) - 1) == ERROR_INSUFFICIENT_BUFFER);
+	TEST_CHECK(HexerRenderLines(data, 0, 0, 0, NULL, 0) == ERROR_SUCCESS);
+	TEST_CHECK(HexerLineCount(0) == 0);
+	free(buffer);
+
+	return;
+}
+
+
+/** Both routines render the same random lines, with both digit tables
+ *  and with or without the character column, and write nothing past the
+ *  line parts.
+ */
+static void _TestBytesRoutines(void)
+{
+	unsigned char data[16];
+	wchar_t hex[2][16 * 3 + 1];
+	wchar_t chars[2][16 + 1];
+	const char *digits = NULL;
+	BOOLEAN withChars = FALSE;
+	size_t differ = 0;
+
+	for (size_t i = 0; i < ROUND_COUNT; ++i) {
+		_RandomBytes(data, sizeof(data));
+		digits = (i % 2 == 0) ? "0123456789abcdef" : "0123456789ABCDEF";
+		withChars = (i % 4 < 2);
+		for (size_t r = 0; r < _routineCount; ++r) {
+			for (size_t j = 0; j < sizeof(hex[r]) / sizeof(hex[r][0]); ++j)
+				hex[r][j] = GUARD_CHAR;
+
+			for (size_t j = 0; j < sizeof(chars[r]) / sizeof(chars[r][0]); ++j)
+				chars[r][j] = GUARD_CHAR;
+
+			_routines[r].Routine(hex[r], (withChars) ? chars[r] : NULL, data, digits);
+			TEST_CHECK(hex[r][16 * 3] == GUARD_CHAR);
+			TEST_CHECK(chars[r][16] == GUARD_CHAR);
+			TEST_CHECK(withChars || chars[r][0] == GUARD_CHAR);
+			if (r > 0 &&
+				(memcmp(hex[0], hex[r], sizeof(hex[0])) != 0 ||
+				memcmp(chars[0], chars[r], sizeof(chars[0])) != 0))
+				++differ;
+		}
+	}
+
+	if (differ > 0)
+		fprintf(stderr, "%zu of %u lines differ between the routines\n", differ, ROUND_COUNT);
+
+	TEST_CHECK(differ == 0);
+
+	return;
+}
+
+
+static PREQUEST_HEADER _RequestCreate(ERequesttype Type, const unsigned char *Data, size_t DataLength)
+{
+	size_t headerSize = 0;
+	PREQUEST_HEADER ret = NULL;
+
+	switch (Type) {
+		case ertIRP: headerSize = sizeof(REQUEST_IRP); break;
+		case ertIRPCompletion: headerSize = sizeof(REQUEST_IRP_COMPLETION); break;
+		case ertStartIo: headerSize = sizeof(REQUEST_STARTIO); break;
+		default: headerSize = sizeof(REQUEST_HEADER); break;
+	}
+
+	ret = (PREQUEST_HEADER)calloc(1, headerSize + DataLength);
+	ret->Type = Type;
+	switch (Type) {
+		case ertIRP:
+			CONTAINING_RECORD(ret, REQUEST_IRP, Header)->DataSize = DataLength;
+			break;
+		case ertIRPCompletion:
+			CONTAINING_RECORD(ret, REQUEST_IRP_COMPLETION, Header)->DataSize = DataLength;
+			break;
+		case ertStartIo:
+			CONTAINING_RECORD(ret, REQUEST_STARTIO, Header)->DataSize = DataLength;
+			break;
+		default:
+			break;
+	}
+
+	memcpy((unsigned char *)ret + headerSize, Data, DataLength);
+
+	return ret;
+}
+
+
+/** Parses requests through both interfaces of the parser. The output ones
+ *  follow a row already present in the output.
+ */
+static void _TestParser(void)
+{
+	static const ERequesttype types[] = {
+		ertIRP,
+		ertIRPCompletion,
+		ertStartIo,
+	};
+	static const size_t lengths[] = {
+		0, 1, 15, 16, 17, 255, 4096, 70000,
+	};
+	unsigned char *data = NULL;
+	PREQUEST_HEADER request = NULL;
+	PIRPMON_DATA_PARSER parser = NULL;
+	BOOLEAN handled = FALSE;
+	wchar_t **names = NULL;
+	wchar_t **values = NULL;
+	wchar_t *value = NULL;
+	size_t rowCount = 0;
+	size_t differ = 0;
+	DP_OUTPUT output;
+
+	TEST_CHECK(DP_INIT_ROUTINE_NAME(0, &parser) == ERROR_NOT_SUPPORTED);
+	TEST_CHECK(DP_INIT_ROUTINE_NAME(IRPMON_DATA_PARSER_VERSION_1, &parser) == ERROR_SUCCESS);
+	TEST_CHECK(parser->Version == IRPMON_DATA_PARSER_VERSION_1);
+	PBaseDataParserFree(parser);
+	TEST_CHECK(DP_INIT_ROUTINE_NAME(IRPMON_DATA_PARSER_VERSION_3, &parser) == ERROR_SUCCESS);
+	TEST_CHECK(parser->Version == IRPMON_DATA_PARSER_VERSION_3);
+	TEST_CHECK(parser->ParseOutputRoutine != NULL);
+	data = (unsigned char *)malloc(lengths[sizeof(lengths) / sizeof(lengths[0]) - 1]);
+	_RandomBytes(data, lengths[sizeof(lengths) / sizeof(lengths[0]) - 1]);
+	PBaseOutputInit(&output);
+	for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t) {
+		for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+			request = _RequestCreate(types[t], data, lengths[l]);
+			handled = FALSE;
+			names = NULL;
+			values = NULL;
+			rowCount = 0;
+			TEST_CHECK(parser->ParseRoutine(request, NULL, &handled, &names, &values, &rowCount) == ERROR_SUCCESS);
+			TEST_CHECK(handled);
+			TEST_CHECK(names == NULL);
+			TEST_CHECK(rowCount == HexerLineCount(lengths[l]));
+			for (size_t i = 0; i < rowCount; ++i)
+				differ += _CompareLines(values[i], data, lengths[l], i, 1);
+
+			if (rowCount > 0)
+				parser->FreeRoutine(names, values, rowCount);
+
+			PBaseOutputReset(&output);
+			TEST_CHECK(PBaseOutputAppend(&output, NULL, 0, 1, &value) == ERROR_SUCCESS);
+			*value = L'x';
+			handled = FALSE;
+			TEST_CHECK(parser->ParseOutputRoutine(request, NULL, &handled, &output) == ERROR_SUCCESS);
+			TEST_CHECK(handled);
+			TEST_CHECK(output.RowCount == 1 + HexerLineCount(lengths[l]));
+			TEST_CHECK(output.Chars[output.Rows[0].ValueOffset] == L'x');
+			for (size_t i = 1; i < output.RowCount; ++i) {
+				TEST_CHECK(output.Rows[i].NameOffset == DP_OUTPUT_NO_NAME);
+				differ += _CompareLines(output.Chars + output.Rows[i].ValueOffset, data, lengths[l], i - 1, 1);
+			}
+
+			free(request);
+		}
+	}
+
+	if (differ > 0)
+		fprintf(stderr, "%zu parsed lines differ\n", differ);
+
+	TEST_CHECK(differ == 0);
+	request = _RequestCreate(ertFastIo, NULL, 0);
+	handled = FALSE;
+	rowCount = 0;
+	TEST_CHECK(parser->ParseRoutine(request, NULL, &handled, &names, &values, &rowCount) == ERROR_SUCCESS);
+	TEST_CHECK(handled && rowCount == 0);
+	PBaseOutputReset(&output);
+	handled = FALSE;
+	TEST_CHECK(parser->ParseOutputRoutine(request, NULL, &handled, &output) == ERROR_SUCCESS);
+	TEST_CHECK(handled && output.RowCount == 0);
+	free(request);
+	PBaseOutputFree(&output);
+	PBaseDataParserFree(parser);
+	free(data);
+
+	return;
+}
+
+
+int main(void)
+{
+	_routines[_routineCount].Name = "scalar";
+	_routines[_routineCount].Routine = _RenderBytesScalar;
+	++_routineCount;
+#if defined(_M_X64) || defined(_M_IX86)
+	if (_BytesRoutineSelect() == _RenderBytesSsse3) {
+		_routines[_routineCount].Name = "SSSE3";
+		_routines[_routineCount].Routine = _RenderBytesSsse3;
+		++_routineCount;
+	} else fprintf(stderr, "SSSE3 not available, its routine is not tested\n");
+#endif
+
+	_TestBytesRoutines();
+	for (size_t r = 0; r < _routineCount; ++r)
+		_TestDumps(_routines + r);
+
+	_bytesRoutine = NULL;
+	_TestRanges();
+	_TestParser();
+
+	return TEST_RESULT();
+}
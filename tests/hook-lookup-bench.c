@@ -0,0 +1,306 @@
+
+/**
+ * @file
+ *
+ * Reader scaling of the driver and device hook record lookups every hooked
+ * request performs. A reader finds the driver record by the driver object
+ * and then the device record in the table of that driver, referencing both.
+ * The lookups through sharded reference tables are compared with the hash
+ * tables guarded by spin locks the hook module used before, on 1 to 16
+ * simulated processors. Requests sent to a proxy device skip both lookups
+ * and take the device record from the proxy device extension, which is
+ * measured as well.
+ */
+
+#include <ntifs.h>
+#include <stdlib.h>
+#include "hash_table.h"
+#include "sharded-ref-table.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_DEVICE {
+	HASH_ITEM HashItem;
+	volatile LONG ReferenceCount;
+	PVOID DeviceObject;
+	PVOID NextRetired;
+	struct _BENCH_DRIVER *DriverRecord;
+} BENCH_DEVICE, *PBENCH_DEVICE;
+
+typedef struct _BENCH_PROXY_EXTENSION {
+	PBENCH_DEVICE DeviceRecord;
+} BENCH_PROXY_EXTENSION, *PBENCH_PROXY_EXTENSION;
+
+typedef struct _BENCH_DRIVER {
+	HASH_ITEM HashItem;
+	volatile LONG ReferenceCount;
+	PVOID DriverObject;
+	PVOID NextRetired;
+	volatile BOOLEAN Unhooked;
+	PHASH_TABLE SelectedDevices;
+	KSPIN_LOCK SelectedDevicesLock;
+	SHARDED_REF_TABLE DeviceLookup;
+	BENCH_DEVICE Devices[64];
+	BENCH_PROXY_EXTENSION Proxies[64];
+} BENCH_DRIVER, *PBENCH_DRIVER;
+
+typedef enum _EBenchLookup {
+	eblSpinLock,
+	eblSharded,
+	eblProxy,
+} EBenchLookup, *PEBenchLookup;
+
+typedef struct _BENCH_THREAD {
+	pthread_t Thread;
+	ULONG Index;
+	EBenchLookup Lookup;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+#define DRIVER_COUNT				16
+#define DEVICES_PER_DRIVER			(sizeof(((PBENCH_DRIVER)NULL)->Devices) / sizeof(BENCH_DEVICE))
+#define LOOKUP_COUNT				1000000
+
+
+static BENCH_DRIVER _drivers[DRIVER_COUNT];
+static PHASH_TABLE _driverTable = NULL;
+static KSPIN_LOCK _driverTableLock;
+static SHARDED_REF_TABLE _driverLookup;
+
+
+static ULONG32 _HashFunction(PVOID Key)
+{
+	return (ULONG32)((ULONG_PTR)Key * 2654435761u);
+}
+
+static BOOLEAN _DriverCompareFunction(PHASH_ITEM Item, PVOID Key)
+{
+	return (CONTAINING_RECORD(Item, BENCH_DRIVER, HashItem)->DriverObject == Key);
+}
+
+static BOOLEAN _DeviceCompareFunction(PHASH_ITEM Item, PVOID Key)
+{
+	return (CONTAINING_RECORD(Item, BENCH_DEVICE, HashItem)->DeviceObject == Key);
+}
+
+static VOID _Reference(PVOID Object)
+{
+	InterlockedIncrement(&((PBENCH_DEVICE)Object)->ReferenceCount);
+}
+
+static VOID _DriverReference(PVOID Object)
+{
+	InterlockedIncrement(&((PBENCH_DRIVER)Object)->ReferenceCount);
+}
+
+static VOID _Dereference(PVOID Object)
+{
+	InterlockedDecrement(&((PBENCH_DEVICE)Object)->ReferenceCount);
+}
+
+static VOID _DriverDereference(PVOID Object)
+{
+	InterlockedDecrement(&((PBENCH_DRIVER)Object)->ReferenceCount);
+}
+
+static PVOID _DriverObject(ULONG Index)
+{
+	return (PVOID)(((ULONG_PTR)Index + 1) * 0x1000);
+}
+
+static PVOID _DeviceObject(ULONG Driver, ULONG Index)
+{
+	return (PVOID)((ULONG_PTR)_DriverObject(Driver) + ((ULONG_PTR)Index + 1) * 0x40);
+}
+
+
+/************************************************************************/
+/*                   LOOKUPS                                            */
+/************************************************************************/
+
+static PBENCH_DRIVER _LockedDriverGet(PVOID DriverObject)
+{
+	KIRQL irql;
+	PHASH_ITEM h = NULL;
+	PBENCH_DRIVER ret = NULL;
+
+	KeAcquireSpinLock(&_driverTableLock, &irql);
+	h = HashTableGet(_driverTable, DriverObject);
+	if (h != NULL) {
+		ret = CONTAINING_RECORD(h, BENCH_DRIVER, HashItem);
+		_DriverReference(ret);
+	}
+
+	KeReleaseSpinLock(&_driverTableLock, irql);
+
+	return ret;
+}
+
+static PBENCH_DEVICE _LockedDeviceGet(PBENCH_DRIVER Driver, PVOID DeviceObject)
+{
+	KIRQL irql;
+	PHASH_ITEM h = NULL;
+	PBENCH_DEVICE ret = NULL;
+
+	KeAcquireSpinLock(&Driver->SelectedDevicesLock, &irql);
+	h = HashTableGet(Driver->SelectedDevices, DeviceObject);
+	if (h != NULL) {
+		ret = CONTAINING_RECORD(h, BENCH_DEVICE, HashItem);
+		_Reference(ret);
+	}
+
+	KeReleaseSpinLock(&Driver->SelectedDevicesLock, irql);
+
+	return ret;
+}
+
+/** Mirrors DeviceHookRecordGetByProxy. */
+static PBENCH_DEVICE _ProxyDeviceGet(PBENCH_PROXY_EXTENSION Extension, PBENCH_DRIVER *DriverRecord)
+{
+	KIRQL irql;
+	PBENCH_DEVICE ret = NULL;
+
+	*DriverRecord = NULL;
+	KeRaiseIrql(DISPATCH_LEVEL, &irql);
+	ret = Extension->DeviceRecord;
+	if (ret != NULL && !ret->DriverRecord->Unhooked) {
+		_Reference(ret);
+		*DriverRecord = ret->DriverRecord;
+		_DriverReference(*DriverRecord);
+	} else ret = NULL;
+
+	KeLowerIrql(irql);
+
+	return ret;
+}
+
+
+static void *_Reader(void *Context)
+{
+	ULONG r = 0;
+	ULONG driverIndex = 0;
+	ULONG deviceIndex = 0;
+	PBENCH_DRIVER driver = NULL;
+	PBENCH_DEVICE device = NULL;
+	PBENCH_THREAD t = (PBENCH_THREAD)Context;
+	unsigned int seed = t->Index + 1;
+
+	ShimProcessor = t->Index;
+	for (ULONG i = 0; i < LOOKUP_COUNT; ++i) {
+		r = (ULONG)rand_r(&seed);
+		driverIndex = r % DRIVER_COUNT;
+		deviceIndex = (r >> 8) % DEVICES_PER_DRIVER;
+		device = NULL;
+		switch (t->Lookup) {
+			case eblSpinLock:
+				driver = _LockedDriverGet(_DriverObject(driverIndex));
+				if (driver != NULL)
+					device = _LockedDeviceGet(driver, _DeviceObject(driverIndex, deviceIndex));
+				break;
+			case eblSharded:
+				driver = (PBENCH_DRIVER)ShardedRefTableGet(&_driverLookup, _DriverObject(driverIndex));
+				if (driver != NULL)
+					device = (PBENCH_DEVICE)ShardedRefTableGet(&driver->DeviceLookup, _DeviceObject(driverIndex, deviceIndex));
+				break;
+			case eblProxy:
+				device = _ProxyDeviceGet(&_drivers[driverIndex].Proxies[deviceIndex], &driver);
+				break;
+			default:
+				break;
+		}
+
+		if (device != NULL)
+			_Dereference(device);
+
+		if (driver != NULL)
+			_DriverDereference(driver);
+	}
+
+	return NULL;
+}
+
+
+static double _Run(EBenchLookup Lookup, ULONG ThreadCount)
+{
+	double start = 0;
+	BENCH_THREAD threads[SHIM_PROCESSOR_COUNT];
+
+	start = BenchNow();
+	for (ULONG i = 0; i < ThreadCount; ++i) {
+		threads[i].Index = i;
+		threads[i].Lookup = Lookup;
+		pthread_create(&threads[i].Thread, NULL, _Reader, threads + i);
+	}
+
+	for (ULONG i = 0; i < ThreadCount; ++i)
+		pthread_join(threads[i].Thread, NULL);
+
+	start = BenchNow() - start;
+
+	return (double)LOOKUP_COUNT*ThreadCount / start / 1e6;
+}
+
+
+int main(void)
+{
+	double lockedBase = 0;
+	double shardedBase = 0;
+	double proxyBase = 0;
+	double locked = 0;
+	double sharded = 0;
+	double proxy = 0;
+	PBENCH_DRIVER d = NULL;
+	PBENCH_DEVICE dev = NULL;
+
+	ShimProcessor = 0;
+	KeInitializeSpinLock(&_driverTableLock);
+	HashTableCreate(httNoSynchronization, 37, _HashFunction, _DriverCompareFunction, NULL, &_driverTable);
+	ShardedRefTableInit(FIELD_OFFSET(BENCH_DRIVER, DriverObject), FIELD_OFFSET(BENCH_DRIVER, NextRetired), _DriverReference, _DriverDereference, &_driverLookup);
+	for (ULONG i = 0; i < DRIVER_COUNT; ++i) {
+		d = _drivers + i;
+		d->ReferenceCount = 1;
+		d->DriverObject = _DriverObject(i);
+		KeInitializeSpinLock(&d->SelectedDevicesLock);
+		HashTableCreate(httNoSynchronization, 37, _HashFunction, _DeviceCompareFunction, NULL, &d->SelectedDevices);
+		ShardedRefTableInit(FIELD_OFFSET(BENCH_DEVICE, DeviceObject), FIELD_OFFSET(BENCH_DEVICE, NextRetired), _Reference, _Dereference, &d->DeviceLookup);
+		for (ULONG j = 0; j < DEVICES_PER_DRIVER; ++j) {
+			dev = d->Devices + j;
+			dev->ReferenceCount = 1;
+			dev->DeviceObject = _DeviceObject(i, j);
+			dev->DriverRecord = d;
+			d->Proxies[j].DeviceRecord = dev;
+			HashTableInsert(d->SelectedDevices, &dev->HashItem, dev->DeviceObject);
+			ShardedRefTableInsert(&d->DeviceLookup, dev);
+		}
+
+		HashTableInsert(_driverTable, &d->HashItem, d->DriverObject);
+		ShardedRefTableInsert(&_driverLookup, d);
+	}
+
+	for (ULONG threadCount = 1; threadCount <= SHIM_PROCESSOR_COUNT; threadCount *= 2) {
+		locked = _Run(eblSpinLock, threadCount);
+		sharded = _Run(eblSharded, threadCount);
+		proxy = _Run(eblProxy, threadCount);
+		if (threadCount == 1) {
+			lockedBase = locked;
+			shardedBase = sharded;
+			proxyBase = proxy;
+		}
+
+		printf("%2u readers: spin locks %7.2f M lookups/s (x%.2f), sharded %7.2f M lookups/s (x%.2f), proxy extension %7.2f M lookups/s (x%.2f)\n", threadCount,
+			locked, locked / lockedBase, sharded, sharded / shardedBase, proxy, proxy / proxyBase);
+	}
+
+	ShimProcessor = 0;
+	for (ULONG i = 0; i < DRIVER_COUNT; ++i) {
+		ShardedRefTableClear(&_drivers[i].DeviceLookup);
+		ShardedRefTableFinit(&_drivers[i].DeviceLookup);
+		HashTableDestroy(_drivers[i].SelectedDevices);
+	}
+
+	ShardedRefTableClear(&_driverLookup);
+	ShardedRefTableFinit(&_driverLookup);
+	HashTableDestroy(_driverTable);
+
+	return 0;
+}
@@ -0,0 +1,199 @@
+
+/**
+ * @file
+ *
+ * Prints records of a log, one line each. Flat (version 1) logs are read
+ * through the memory-mapped view, chunked (version 2) logs through the block
+ * index of the log reader. Large captures can be listed partially without
+ * being loaded: the records are located by the index of the view, or by the
+ * record counts of the blocks.
+ *
+ * Usage: irpmon-logcat [-s stride] [-f first] [-n count] [-c] log
+ *
+ *  -s  index stride of the view of a flat log (default 1)
+ *  -f  index of the first record to print (default 0)
+ *  -n  number of records to print (default all)
+ *  -c  print just the number of records
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-log.h"
+#include "request-log-view.h"
+
+
+static const char *_typeNames[] = {
+	"Undefined",
+	"IRP",
+	"IRPCompletion",
+	"AddDevice",
+	"DriverUnload",
+	"FastIo",
+	"StartIo",
+	"DriverDetected",
+	"DeviceDetected",
+	"FileNameAssigned",
+	"FileNameDeleted",
+	"ProcessCreated",
+	"ProcessExitted",
+	"ImageLoad",
+	"EventsDropped",
+};
+
+
+static void _Usage(void)
+{
+	fprintf(stderr, "Usage: irpmon-logcat [-s stride] [-f first] [-n count] [-c] log\n");
+
+	return;
+}
+
+
+/** Prints the common fields of a record. Records within the view need not be
+ *  aligned, so the header is copied first. */
+static void _PrintRecord(ULONG64 Index, const REQUEST_HEADER *Record)
+{
+	const char *typeName = "?";
+	REQUEST_HEADER h;
+
+	memcpy(&h, Record, sizeof(h));
+	if ((ULONG)h.Type < sizeof(_typeNames) / sizeof(_typeNames[0]))
+		typeName = _typeNames[h.Type];
+
+	printf("%llu\t%u\t%lld\t%-16s\tPID %llu\tTID %llu\tIRQL %u\tDev %p\tDrv %p", (unsigned long long)Index, h.Id, (long long)h.Time.QuadPart, typeName, (unsigned long long)(ULONG_PTR)h.ProcessId, (unsigned long long)(ULONG_PTR)h.ThreadId, h.Irql, h.Device, h.Driver);
+	switch (h.ResultType) {
+		case rrtNTSTATUS:
+			printf("\t0x%x\n", (unsigned int)h.Result.NTSTATUSValue);
+			break;
+		case rrtBOOLEAN:
+			printf("\t%s\n", (h.Result.BOOLEANValue) ? "TRUE" : "FALSE");
+			break;
+		default:
+			printf("\n");
+			break;
+	}
+
+	return;
+}
+
+
+/** Prints records of a chunked log. Blocks preceding the first record to
+ *  print are skipped by their index entries, without being decompressed. */
+static ERROR_TYPE _PrintChunkedLog(const wchar_t *FileName, BOOLEAN CountOnly, ULONG64 First, ULONG64 Count)
+{
+	ULONG i = 0;
+	ULONG64 index = 0;
+	PREQUEST_HEADER r = NULL;
+	const REQUEST_LOG_INDEX_ENTRY *e = NULL;
+	PREQUEST_LOG_READER reader = NULL;
+	REQUEST_LOG_BLOCK block;
+	ERROR_TYPE ret = ERROR_VALUE_INVAL;
+
+	ret = RequestLogReaderOpen(FileName, &reader);
+	if (ret == ERROR_VALUE_SUCCESS) {
+		if (CountOnly)
+			printf("%llu\n", (unsigned long long)RequestLogReaderRecordCount(reader));
+
+		while (!CountOnly && ret == ERROR_VALUE_SUCCESS && Count > 0 && i < RequestLogReaderBlockCount(reader)) {
+			e = RequestLogReaderBlockInfo(reader, i);
+			if (index + e->RecordCount > First) {
+				ret = RequestLogReaderLoadBlock(reader, i, &block);
+				if (ret == ERROR_VALUE_SUCCESS) {
+					while (Count > 0 && (ret = RequestLogBlockNext(&block, &r)) == ERROR_VALUE_SUCCESS && r != NULL) {
+						if (index >= First) {
+							_PrintRecord(index, r);
+							--Count;
+						}
+
+						RequestMemoryFree(r);
+						++index;
+					}
+
+					RequestLogBlockFree(&block);
+				}
+			} else index += e->RecordCount;
+
+			++i;
+		}
+
+		RequestLogReaderClose(reader);
+	}
+
+	return ret;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int opt = 0;
+	int ret = 2;
+	BOOLEAN countOnly = FALSE;
+	BOOLEAN badUsage = FALSE;
+	ULONG stride = 1;
+	ULONG64 first = 0;
+	ULONG64 count = (ULONG64)-1;
+	size_t len = 0;
+	wchar_t *fileName = NULL;
+	const REQUEST_HEADER *r = NULL;
+	PREQUEST_LOG_VIEW view = NULL;
+	REQUEST_LOG_VIEW_CURSOR cursor;
+	ERROR_TYPE err = ERROR_VALUE_INVAL;
+
+	while ((opt = getopt(argc, argv, "s:f:n:c")) != -1) {
+		switch (opt) {
+			case 's':
+				stride = (ULONG)strtoul(optarg, NULL, 0);
+				break;
+			case 'f':
+				first = strtoull(optarg, NULL, 0);
+				break;
+			case 'n':
+				count = strtoull(optarg, NULL, 0);
+				break;
+			case 'c':
+				countOnly = TRUE;
+				break;
+			default:
+				badUsage = TRUE;
+				break;
+		}
+	}
+
+	if (!badUsage && optind + 1 == argc) {
+		len = mbstowcs(NULL, argv[optind], 0);
+		if (len != (size_t)-1) {
+			err = ERROR_VALUE_NOMEM;
+			fileName = (wchar_t *)malloc((len + 1)*sizeof(wchar_t));
+			if (fileName != NULL) {
+				mbstowcs(fileName, argv[optind], len + 1);
+				err = RequestLogViewOpen(fileName, stride, &view);
+				if (err == ERROR_VALUE_SUCCESS) {
+					if (countOnly)
+						printf("%llu\n", (unsigned long long)RequestLogViewCount(view));
+					else if (first < RequestLogViewCount(view)) {
+						RequestLogViewSeek(view, first, &cursor);
+						while (count > 0 && (r = RequestLogViewNext(view, &cursor)) != NULL) {
+							_PrintRecord(cursor.Index - 1, r);
+							--count;
+						}
+					}
+
+					RequestLogViewClose(view);
+				} else if (err == ERROR_VALUE_INVAL)
+					err = _PrintChunkedLog(fileName, countOnly, first, count);
+
+				free(fileName);
+			}
+		}
+
+		ret = 0;
+		if (err != ERROR_VALUE_SUCCESS) {
+			fprintf(stderr, "irpmon-logcat: cannot open %s: error %u\n", argv[optind], (unsigned int)err);
+			ret = 1;
+		}
+	} else _Usage();
+
+	return ret;
+}
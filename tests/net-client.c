@@ -0,0 +1,200 @@
+
+/**
+ * @file
+ *
+ * Raw client of the version 2 remote monitoring protocol.
+ */
+
+#include <winsock2.h>
+#include "block-codec.h"
+#include "network-connector.h"
+#include "test-server.h"
+#include "net-client.h"
+
+
+static DWORD _Receive(SOCKET Socket, void *Buffer, ULONG Length)
+{
+	int n = 0;
+	DWORD ret = ERROR_SUCCESS;
+
+	if (Length > 0) {
+		n = recv(Socket, (char *)Buffer, Length, MSG_WAITALL);
+		if (n != (int)Length) {
+			ret = WSAGetLastError();
+			if (ret == ERROR_SUCCESS)
+				ret = ERROR_CONNECTION_ABORTED;
+		}
+	}
+
+	return ret;
+}
+
+
+SOCKET NetClientOpen(const char *Port)
+{
+	int noDelay = 1;
+	DWORD timeout = 10000;
+	struct sockaddr_in addr;
+	SOCKET ret = INVALID_SOCKET;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((u_short)atoi(Port));
+	inet_pton(AF_INET, TEST_SERVER_ADDRESS, &addr.sin_addr);
+	ret = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (ret != INVALID_SOCKET) {
+		setsockopt(ret, IPPROTO_TCP, TCP_NODELAY, (char *)&noDelay, sizeof(noDelay));
+		setsockopt(ret, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+		if (connect(ret, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			closesocket(ret);
+			ret = INVALID_SOCKET;
+		}
+	}
+
+	return ret;
+}
+
+
+SOCKET NetClientConnect(const char *Port)
+{
+	NETWORK_MSG_IOCTL msg;
+	SOCKET ret = INVALID_SOCKET;
+
+	ret = NetClientOpen(Port);
+	if (ret != INVALID_SOCKET) {
+		if (_Receive(ret, &msg, sizeof(msg)) == ERROR_SUCCESS &&
+			msg.Result == ERROR_SUCCESS && msg.InputBufferSize >= NETWORK_PROTOCOL_VERSION_2) {
+			memset(&msg, 0, sizeof(msg));
+			msg.Result = NETWORK_PROTOCOL_VERSION_2;
+			msg.ControlCode = NETWORK_CONTROL_PROTOCOL;
+			if (send(ret, (char *)&msg, sizeof(msg), 0) != sizeof(msg) ||
+				_Receive(ret, &msg, sizeof(msg)) != ERROR_SUCCESS ||
+				msg.Result != ERROR_SUCCESS) {
+				closesocket(ret);
+				ret = INVALID_SOCKET;
+			}
+		} else {
+			closesocket(ret);
+			ret = INVALID_SOCKET;
+		}
+	}
+
+	return ret;
+}
+
+
+void NetClientClose(SOCKET Socket)
+{
+	shutdown(Socket, SD_BOTH);
+	closesocket(Socket);
+
+	return;
+}
+
+
+DWORD NetClientSend(SOCKET Socket, const NETWORK_MSG_IOCTL_V2 *Msg, const void *Input)
+{
+	WSABUF bufs[2];
+	DWORD bytesSent = 0;
+	DWORD ret = ERROR_SUCCESS;
+
+	bufs[0].buf = (char *)Msg;
+	bufs[0].len = sizeof(NETWORK_MSG_IOCTL_V2);
+	bufs[1].buf = (char *)Input;
+	bufs[1].len = Msg->InputBufferSize;
+	if (WSASend(Socket, bufs, (Msg->InputBufferSize > 0) ? 2 : 1, &bytesSent, 0, NULL, NULL) == 0) {
+		if (bytesSent != sizeof(NETWORK_MSG_IOCTL_V2) + Msg->InputBufferSize)
+			ret = ERROR_CONNECTION_ABORTED;
+	} else ret = WSAGetLastError();
+
+	return ret;
+}
+
+
+DWORD NetClientReceive(SOCKET Socket, PNETWORK_MSG_IOCTL_V2 Msg, void *Buffer, ULONG BufferLength, PULONG DataSize)
+{
+	void *tmp = NULL;
+	ULONG compressedSize = 0;
+	PREQUEST_BATCH_HEADER header = (PREQUEST_BATCH_HEADER)Buffer;
+	DWORD ret = ERROR_SUCCESS;
+
+	*DataSize = 0;
+	ret = _Receive(Socket, Msg, sizeof(NETWORK_MSG_IOCTL_V2));
+	if (ret == ERROR_SUCCESS) {
+		if (Msg->Encoding == bcmNone) {
+			ret = ERROR_INSUFFICIENT_BUFFER;
+			if (Msg->OutputBufferSize <= BufferLength) {
+				ret = _Receive(Socket, Buffer, Msg->OutputBufferSize);
+				*DataSize = Msg->OutputBufferSize;
+			}
+		} else {
+			ret = ERROR_INVALID_MESSAGE;
+			if (Msg->OutputBufferSize >= sizeof(REQUEST_BATCH_HEADER) && BufferLength >= sizeof(REQUEST_BATCH_HEADER))
+				ret = _Receive(Socket, header, sizeof(REQUEST_BATCH_HEADER));
+
+			if (ret == ERROR_SUCCESS) {
+				compressedSize = Msg->OutputBufferSize - sizeof(REQUEST_BATCH_HEADER);
+				tmp = malloc((compressedSize > 0) ? compressedSize : 1);
+				ret = ERROR_NOT_ENOUGH_MEMORY;
+				if (tmp != NULL) {
+					ret = _Receive(Socket, tmp, compressedSize);
+					if (ret == ERROR_SUCCESS) {
+						ret = ERROR_INSUFFICIENT_BUFFER;
+						if (header->HeaderSize >= sizeof(REQUEST_BATCH_HEADER) && header->HeaderSize + header->BytesUsed <= BufferLength) {
+							ret = ERROR_INVALID_MESSAGE;
+							if (BlockCodecDecompress((EBlockCodecMethod)Msg->Encoding, tmp, compressedSize, header + 1, header->HeaderSize + header->BytesUsed - sizeof(REQUEST_BATCH_HEADER)) == ERROR_VALUE_SUCCESS) {
+								*DataSize = header->HeaderSize + header->BytesUsed;
+								ret = ERROR_SUCCESS;
+							}
+						}
+					}
+
+					free(tmp);
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+DWORD NetClientSubscribe(SOCKET Socket, uint32_t RequestId, uint32_t BatchSize, uint32_t Credit, EBlockCodecMethod Compression)
+{
+	ULONG dataSize = 0;
+	NETWORK_MSG_IOCTL_V2 msg;
+	NETWORK_SUBSCRIBE_INPUT input;
+	DWORD ret = ERROR_SUCCESS;
+
+	input.BatchSize = BatchSize;
+	input.Credit = Credit;
+	input.Compression = Compression;
+	memset(&msg, 0, sizeof(msg));
+	msg.ControlCode = NETWORK_CONTROL_SUBSCRIBE;
+	msg.InputBufferSize = sizeof(input);
+	msg.RequestId = RequestId;
+	ret = NetClientSend(Socket, &msg, &input);
+	if (ret == ERROR_SUCCESS)
+		ret = NetClientReceive(Socket, &msg, NULL, 0, &dataSize);
+
+	if (ret == ERROR_SUCCESS) {
+		ret = msg.Result;
+		if (msg.ControlCode != NETWORK_CONTROL_SUBSCRIBE || msg.RequestId != RequestId)
+			ret = ERROR_INVALID_MESSAGE;
+	}
+
+	return ret;
+}
+
+
+DWORD NetClientGrant(SOCKET Socket, uint32_t RequestId, uint32_t Credit)
+{
+	NETWORK_MSG_IOCTL_V2 msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.Result = Credit;
+	msg.ControlCode = NETWORK_CONTROL_CREDIT;
+	msg.RequestId = RequestId;
+
+	return NetClientSend(Socket, &msg, NULL);
+}
@@ -0,0 +1,37 @@
+
+/**
+ * @file
+ *
+ * Raw client of the version 2 remote monitoring protocol, for the tests and
+ * benchmarks that need more control over the connection than the network
+ * connector gives them: several connections at once, chosen credit and
+ * compression, clients that stall or send partial messages.
+ */
+
+#ifndef __TESTS_NET_CLIENT_H__
+#define __TESTS_NET_CLIENT_H__
+
+#include <winsock2.h>
+#include "block-codec.h"
+#include "network-connector.h"
+
+
+/** Connects to the loopback port; receiving times out after ten seconds. */
+SOCKET NetClientOpen(const char *Port);
+/** Connects to the server at the loopback port and switches to the version 2
+ *  protocol. */
+SOCKET NetClientConnect(const char *Port);
+void NetClientClose(SOCKET Socket);
+/** Sends the message followed by its input buffer of InputBufferSize bytes. */
+DWORD NetClientSend(SOCKET Socket, const NETWORK_MSG_IOCTL_V2 *Msg, const void *Input);
+/** Receives a message and its data. Batches are decompressed; DataSize
+ *  receives the size of the data in the buffer, while Msg keeps the size
+ *  sent over the wire. */
+DWORD NetClientReceive(SOCKET Socket, PNETWORK_MSG_IOCTL_V2 Msg, void *Buffer, ULONG BufferLength, PULONG DataSize);
+/** Subscribes to the event stream and waits for the reply. */
+DWORD NetClientSubscribe(SOCKET Socket, uint32_t RequestId, uint32_t BatchSize, uint32_t Credit, EBlockCodecMethod Compression);
+DWORD NetClientGrant(SOCKET Socket, uint32_t RequestId, uint32_t Credit);
+
+
+
+#endif
@@ -0,0 +1,143 @@
+
+/**
+ * @file
+ *
+ * Remote IOCTLs over loopback: the round-trip latency of one caller, and
+ * the throughput of 1 to 32 callers sharing the connection of the network
+ * connector, whose requests are pipelined and executed by the server at
+ * once. IOCTLs of the fake driver take no time or 200 microseconds.
+ */
+
+#include <winsock2.h>
+#include "network-connector.h"
+#include "fake-driver.h"
+#include "test-server.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_THREAD {
+	pthread_t Thread;
+	ULONG Index;
+	ULONG Count;
+	ULONG Delay;
+	ULONG Errors;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+#define LATENCY_COUNT				20000
+#define THREAD_IOCTL_COUNT			4000
+#define MAX_THREADS					32
+#define SLOW_IOCTL_DELAY			200
+
+
+static ULONG _Echo(ULONG Delay, ULONG Value)
+{
+	FAKE_DRIVER_ECHO input;
+	FAKE_DRIVER_ECHO output;
+	ULONG ret = 0;
+
+	input.Delay = Delay;
+	input.Value = Value;
+	memset(&output, 0, sizeof(output));
+	ret = (NetConn_SynchronousOtherIOCTL(FAKE_DRIVER_IOCTL_ECHO, &input, sizeof(input), &output, sizeof(output)) != ERROR_SUCCESS ||
+		output.Value != Value);
+
+	return ret;
+}
+
+
+/** Returns microseconds per IOCTL. */
+static double _MeasureLatency(ULONG Delay, ULONG Count)
+{
+	double start = 0;
+	ULONG errors = 0;
+
+	start = BenchNow();
+	for (ULONG i = 0; i < Count; ++i)
+		errors += _Echo(Delay, i);
+
+	start = BenchNow() - start;
+	if (errors > 0)
+		printf("  %u IOCTLs failed\n", errors);
+
+	return start * 1e6 / Count;
+}
+
+
+static void *_Caller(void *Context)
+{
+	PBENCH_THREAD t = (PBENCH_THREAD)Context;
+
+	for (ULONG i = 0; i < t->Count; ++i)
+		t->Errors += _Echo(t->Delay, t->Index*t->Count + i);
+
+	return NULL;
+}
+
+
+/** Returns thousands of IOCTLs per second. */
+static double _MeasureCallers(ULONG Delay, ULONG ThreadCount, ULONG Count)
+{
+	double start = 0;
+	ULONG errors = 0;
+	BENCH_THREAD threads[MAX_THREADS];
+
+	start = BenchNow();
+	for (ULONG i = 0; i < ThreadCount; ++i) {
+		threads[i].Index = i;
+		threads[i].Count = Count;
+		threads[i].Delay = Delay;
+		threads[i].Errors = 0;
+		pthread_create(&threads[i].Thread, NULL, _Caller, threads + i);
+	}
+
+	for (ULONG i = 0; i < ThreadCount; ++i) {
+		pthread_join(threads[i].Thread, NULL);
+		errors += threads[i].Errors;
+	}
+
+	start = BenchNow() - start;
+	if (errors > 0)
+		printf("  %u IOCTLs failed\n", errors);
+
+	return (double)Count*ThreadCount / start / 1e3;
+}
+
+
+int main(void)
+{
+	char port[16];
+	wchar_t wport[16];
+	IRPMON_INIT_INFO info;
+	static const ULONG delays[] = { 0, SLOW_IOCTL_DELAY };
+
+	FakeDriverInit();
+	if (TestServerStart(port, sizeof(port))) {
+		mbstowcs(wport, port, sizeof(wport) / sizeof(wport[0]));
+		memset(&info, 0, sizeof(info));
+		info.ConnectorType = ictNetwork;
+		info.Data.Network.Address = TEST_SERVER_ADDRESS_W;
+		info.Data.Network.Service = wport;
+		info.Data.Network.AddressFamily = AF_INET;
+		if (NetConn_Connect(&info) == ERROR_SUCCESS) {
+			printf("One caller\n");
+			printf("  %u us IOCTLs: %6.1f us per round trip\n", 0, _MeasureLatency(0, LATENCY_COUNT));
+			printf("  %u us IOCTLs: %6.1f us per round trip\n", SLOW_IOCTL_DELAY, _MeasureLatency(SLOW_IOCTL_DELAY, LATENCY_COUNT / 10));
+			for (size_t d = 0; d < sizeof(delays) / sizeof(delays[0]); ++d) {
+				printf("Callers sharing the connection, %u us IOCTLs\n", delays[d]);
+				for (ULONG threadCount = 1; threadCount <= MAX_THREADS; threadCount *= 2) {
+					printf("  %2u threads: %7.2f k IOCTLs/s\n", threadCount,
+						_MeasureCallers(delays[d], threadCount, (delays[d] == 0) ? THREAD_IOCTL_COUNT : THREAD_IOCTL_COUNT / 10));
+				}
+			}
+
+			NetConn_Disconnect();
+		} else printf("Cannot connect to the server at port %s\n", port);
+
+		TestServerStop();
+	} else printf("Cannot start the server\n");
+
+	FakeDriverFinit();
+
+	return 0;
+}
@@ -0,0 +1,288 @@
+
+/**
+ * @file
+ *
+ * Load test of the server: 24 clients stream the events while 2 more call
+ * IOCTLs, 2 subscribe and never read, and 2 send half a message header and
+ * go silent. Every streaming client must get the requests in order, and
+ * account for each one it missed by the drop counts of its batches. The
+ * stalled clients must not hold back the others.
+ */
+
+#include <winsock2.h>
+#include "request-gen.h"
+#include "fake-driver.h"
+#include "test-server.h"
+#include "net-client.h"
+#include "test.h"
+
+
+typedef enum _ELoadClientType {
+	lctStream,
+	lctIoctl,
+	lctStalled,
+	lctHalfHeader,
+} ELoadClientType, *PELoadClientType;
+
+typedef struct _LOAD_CLIENT {
+	pthread_t Thread;
+	ELoadClientType Type;
+	ULONG Index;
+	SOCKET Socket;
+	volatile LONG Done;
+	ULONG Received;
+	ULONG Dropped;
+	ULONG BatchCount;
+	ULONG IoctlCount;
+} LOAD_CLIENT, *PLOAD_CLIENT;
+
+
+#define STREAM_CLIENT_COUNT			24
+#define IOCTL_CLIENT_COUNT			2
+#define STALLED_CLIENT_COUNT		2
+#define HALF_HEADER_CLIENT_COUNT	2
+#define CLIENT_COUNT				(STREAM_CLIENT_COUNT + IOCTL_CLIENT_COUNT + STALLED_CLIENT_COUNT + HALF_HEADER_CLIENT_COUNT)
+#define REQUEST_COUNT				20000
+#define BATCH_SIZE					(16*1024)
+#define STREAM_ID					1
+#define IOCTLS_IN_FLIGHT			16
+#define LOAD_DEADLINE				30000
+
+
+static char _port[16];
+static LOAD_CLIENT _clients[CLIENT_COUNT];
+/** ID of the last request of the load, later ones only keep the streams
+ *  moving until every client has seen it. */
+static volatile LONG _lastId = MAXLONG;
+static volatile LONG _stop = FALSE;
+
+
+/** Reads batches and grants credit for each; every gap in the request IDs
+ *  must be reported as dropped by the batch that follows it. */
+static void _StreamClient(PLOAD_CLIENT Client)
+{
+	ULONG offset = 0;
+	ULONG dataSize = 0;
+	ULONG previousId = 0;
+	PREQUEST_HEADER h = NULL;
+	NETWORK_MSG_IOCTL_V2 msg;
+	PREQUEST_BATCH_HEADER batch = NULL;
+
+	batch = (PREQUEST_BATCH_HEADER)malloc(BATCH_SIZE);
+	TEST_CHECK(NetClientSubscribe(Client->Socket, STREAM_ID, BATCH_SIZE, NETWORK_STREAM_CREDIT, (Client->Index % 2 == 0) ? bcmFast : bcmNone) == ERROR_SUCCESS);
+	while (!_stop && previousId < (ULONG)_lastId) {
+		if (NetClientReceive(Client->Socket, &msg, batch, BATCH_SIZE, &dataSize) != ERROR_SUCCESS)
+			break;
+
+		TEST_CHECK(msg.ControlCode == NETWORK_CONTROL_RECORDS && msg.RequestId == STREAM_ID);
+		TEST_CHECK(msg.Result == ERROR_SUCCESS);
+		if (msg.Result != ERROR_SUCCESS)
+			break;
+
+		TEST_CHECK(batch->FirstId > previousId);
+		TEST_CHECK(batch->DroppedCount == batch->FirstId - previousId - 1);
+		Client->Dropped += batch->DroppedCount;
+		offset = batch->HeaderSize;
+		while (offset < batch->HeaderSize + batch->BytesUsed) {
+			h = (PREQUEST_HEADER)((unsigned char *)batch + offset);
+			TEST_CHECK(h->Id == previousId + 1 || offset == batch->HeaderSize);
+			previousId = h->Id;
+			++Client->Received;
+			offset += (ULONG)RequestGetSize(h);
+		}
+
+		TEST_CHECK(previousId == batch->LastId);
+		++Client->BatchCount;
+		TEST_CHECK(NetClientGrant(Client->Socket, STREAM_ID, 1) == ERROR_SUCCESS);
+	}
+
+	TEST_CHECK(previousId >= (ULONG)_lastId);
+	free(batch);
+
+	return;
+}
+
+
+/** Keeps several echo IOCTLs in flight, matching replies by their IDs. */
+static void _IoctlClient(PLOAD_CLIENT Client)
+{
+	ULONG dataSize = 0;
+	uint32_t nextId = 1;
+	ULONG inFlight = 0;
+	NETWORK_MSG_IOCTL_V2 msg;
+	FAKE_DRIVER_ECHO echo;
+	DWORD err = ERROR_SUCCESS;
+
+	while (err == ERROR_SUCCESS && !_stop) {
+		while (err == ERROR_SUCCESS && inFlight < IOCTLS_IN_FLIGHT) {
+			memset(&msg, 0, sizeof(msg));
+			msg.ControlCode = FAKE_DRIVER_IOCTL_ECHO;
+			msg.InputBufferSize = sizeof(echo);
+			msg.OutputBufferSize = sizeof(echo);
+			msg.RequestId = nextId;
+			echo.Delay = nextId % 100;
+			echo.Value = nextId * 3;
+			err = NetClientSend(Client->Socket, &msg, &echo);
+			++nextId;
+			++inFlight;
+		}
+
+		if (err == ERROR_SUCCESS)
+			err = NetClientReceive(Client->Socket, &msg, &echo, sizeof(echo), &dataSize);
+
+		if (err == ERROR_SUCCESS) {
+			TEST_CHECK(msg.Result == ERROR_SUCCESS && msg.ControlCode == FAKE_DRIVER_IOCTL_ECHO);
+			TEST_CHECK(dataSize == sizeof(echo) && echo.Value == msg.RequestId * 3);
+			++Client->IoctlCount;
+			--inFlight;
+		}
+	}
+
+	TEST_CHECK(err == ERROR_SUCCESS);
+
+	return;
+}
+
+
+static void *_ClientThread(void *Context)
+{
+	PLOAD_CLIENT c = (PLOAD_CLIENT)Context;
+	NETWORK_MSG_IOCTL_V2 msg;
+
+	switch (c->Type) {
+		case lctStream:
+			_StreamClient(c);
+			break;
+		case lctIoctl:
+			_IoctlClient(c);
+			break;
+		case lctStalled:
+			TEST_CHECK(NetClientSubscribe(c->Socket, STREAM_ID, BATCH_SIZE, 64, bcmNone) == ERROR_SUCCESS);
+			break;
+		case lctHalfHeader:
+			memset(&msg, 0, sizeof(msg));
+			TEST_CHECK(send(c->Socket, (char *)&msg, sizeof(msg) / 2, 0) == sizeof(msg) / 2);
+			break;
+		default:
+			break;
+	}
+
+	InterlockedExchange(&c->Done, TRUE);
+
+	return NULL;
+}
+
+
+static BOOLEAN _StreamsDone(void)
+{
+	BOOLEAN ret = TRUE;
+
+	for (ULONG i = 0; i < CLIENT_COUNT; ++i) {
+		if (_clients[i].Type == lctStream && !_clients[i].Done) {
+			ret = FALSE;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+
+int main(void)
+{
+	ULONG elapsed = 0;
+	ULONG start = 0;
+	ULONG index = 0;
+	ULONG received = 0;
+	PREQUEST_HEADER r = NULL;
+	TEST_REQUEST_GEN gen;
+	SOCKET s = INVALID_SOCKET;
+
+	FakeDriverInit();
+	TEST_CHECK(TestServerStart(_port, sizeof(_port)));
+	if (TestFailures == 0) {
+		for (ULONG i = 0; i < CLIENT_COUNT; ++i) {
+			_clients[i].Index = i;
+			_clients[i].Type = lctStream;
+			if (i >= STREAM_CLIENT_COUNT)
+				_clients[i].Type = lctIoctl;
+
+			if (i >= STREAM_CLIENT_COUNT + IOCTL_CLIENT_COUNT)
+				_clients[i].Type = lctStalled;
+
+			if (i >= STREAM_CLIENT_COUNT + IOCTL_CLIENT_COUNT + STALLED_CLIENT_COUNT)
+				_clients[i].Type = lctHalfHeader;
+
+			_clients[i].Socket = NetClientConnect(_port);
+			TEST_CHECK(_clients[i].Socket != INVALID_SOCKET);
+		}
+
+		for (ULONG i = 0; i < CLIENT_COUNT; ++i)
+			pthread_create(&_clients[i].Thread, NULL, _ClientThread, _clients + i);
+
+		// Let all the streams subscribe before the first request comes.
+		Sleep(200);
+		TestRequestGenInit(&gen, 5, TRUE);
+		start = GetTickCount();
+		while (!_StreamsDone() && elapsed < LOAD_DEADLINE) {
+			if (index < REQUEST_COUNT) {
+				for (ULONG i = 0; i < 100; ++i) {
+					r = TestRequestGenerateNext(&gen);
+					TEST_CHECK(FakeDriverQueueInsert(r));
+					RequestMemoryFree(r);
+				}
+
+				index += 100;
+				if (index == REQUEST_COUNT)
+					InterlockedExchange(&_lastId, gen.Id);
+
+				Sleep(1);
+			} else {
+				r = TestRequestGenerateNext(&gen);
+				TEST_CHECK(FakeDriverQueueInsert(r));
+				RequestMemoryFree(r);
+				Sleep(10);
+			}
+
+			elapsed = GetTickCount() - start;
+		}
+
+		TEST_CHECK(_StreamsDone());
+		// The server still accepts clients and serves them.
+		s = NetClientConnect(_port);
+		TEST_CHECK(s != INVALID_SOCKET);
+		if (s != INVALID_SOCKET)
+			NetClientClose(s);
+
+		InterlockedExchange(&_stop, TRUE);
+		for (ULONG i = 0; i < CLIENT_COUNT; ++i) {
+			if (_clients[i].Type == lctIoctl)
+				pthread_join(_clients[i].Thread, NULL);
+		}
+
+		for (ULONG i = 0; i < CLIENT_COUNT; ++i) {
+			NetClientClose(_clients[i].Socket);
+			if (_clients[i].Type != lctIoctl)
+				pthread_join(_clients[i].Thread, NULL);
+
+			switch (_clients[i].Type) {
+				case lctStream:
+					TEST_CHECK(_clients[i].Received > 0);
+					received += _clients[i].Received;
+					break;
+				case lctIoctl:
+					TEST_CHECK(_clients[i].IoctlCount > 0);
+					break;
+				default:
+					break;
+			}
+		}
+
+		printf("%u ms, %u requests received by %u streams\n", elapsed, received, STREAM_CLIENT_COUNT);
+		TestServerStop();
+	}
+
+	FakeDriverFinit();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,364 @@
+
+/**
+ * @file
+ *
+ * Tests of the server and the network connector against the fake driver:
+ * pipelined IOCTLs of several threads getting their own replies, a fast
+ * IOCTL overtaking a slow one, the event stream delivering every request
+ * with the drops the driver reported, a client that does not read keeping
+ * the requests in the driver's queue, the clamp of granted credit, and the
+ * device connection following the clients.
+ */
+
+#include <winsock2.h>
+#include "network-connector.h"
+#include "device-connector.h"
+#include "request-gen.h"
+#include "fake-driver.h"
+#include "test-server.h"
+#include "net-client.h"
+#include "test.h"
+
+
+#define THREAD_COUNT				8
+#define THREAD_IOCTL_COUNT			250
+#define SLOW_IOCTL_DELAY			500000
+#define STREAM_BUFFER_SIZE			(64*1024)
+#define STREAM_REQUEST_COUNT		5000
+#define STREAM_DROPPED_COUNT		7
+#define RAW_BATCH_SIZE				(16*1024)
+#define RAW_STREAM_ID				7
+/** Must match the limit of the server, LS_MAX_STREAM_CREDIT. */
+#define SERVER_MAX_CREDIT			64
+
+
+static char _port[16];
+static volatile LONG _slowDone = FALSE;
+
+
+static BOOLEAN _Echo(ULONG Delay, ULONG Value)
+{
+	FAKE_DRIVER_ECHO input;
+	FAKE_DRIVER_ECHO output;
+
+	input.Delay = Delay;
+	input.Value = Value;
+	memset(&output, 0, sizeof(output));
+
+	return (NetConn_SynchronousOtherIOCTL(FAKE_DRIVER_IOCTL_ECHO, &input, sizeof(input), &output, sizeof(output)) == ERROR_SUCCESS &&
+		output.Value == Value);
+}
+
+
+/** Queues requests of the generator until their count or total size is
+ *  reached; returns their number. */
+static ULONG _Insert(PTEST_REQUEST_GEN Gen, ULONG Count, size_t Size)
+{
+	size_t total = 0;
+	PREQUEST_HEADER r = NULL;
+	ULONG ret = 0;
+
+	while (ret < Count || total < Size) {
+		r = TestRequestGenerateNext(Gen);
+		TEST_CHECK(FakeDriverQueueInsert(r));
+		total += RequestGetSize(r);
+		RequestMemoryFree(r);
+		++ret;
+	}
+
+	return ret;
+}
+
+
+/** Compares the requests of a batch with the ones the generator produces
+ *  again; returns their number. */
+static ULONG _CheckBatch(PREQUEST_BATCH_HEADER Batch, PTEST_REQUEST_GEN Gen)
+{
+	size_t size = 0;
+	ULONG offset = 0;
+	PREQUEST_HEADER h = NULL;
+	PREQUEST_HEADER expected = NULL;
+	ULONG ret = 0;
+
+	TEST_CHECK(Batch->Version == REQUEST_BATCH_VERSION_1);
+	TEST_CHECK(Batch->HeaderSize == sizeof(REQUEST_BATCH_HEADER));
+	offset = Batch->HeaderSize;
+	while (offset < Batch->HeaderSize + Batch->BytesUsed) {
+		h = (PREQUEST_HEADER)((unsigned char *)Batch + offset);
+		size = RequestGetSize(h);
+		expected = TestRequestGenerateNext(Gen);
+		if (ret == 0)
+			TEST_CHECK(h->Id == Batch->FirstId);
+
+		TEST_CHECK((h->Flags & REQUEST_FLAG_NEXT_AVAILABLE) != 0 || offset + size == Batch->HeaderSize + Batch->BytesUsed);
+		h->Flags &= ~REQUEST_FLAG_NEXT_AVAILABLE;
+		memset(&h->Entry, 0, sizeof(h->Entry));
+		memset(&expected->Entry, 0, sizeof(expected->Entry));
+		TEST_CHECK(size == RequestGetSize(expected));
+		TEST_CHECK(memcmp(h, expected, size) == 0);
+		RequestMemoryFree(expected);
+		offset += (ULONG)size;
+		++ret;
+	}
+
+	TEST_CHECK(offset == Batch->HeaderSize + Batch->BytesUsed);
+	TEST_CHECK(ret == Batch->RecordCount);
+	TEST_CHECK(ret == 0 || h->Id == Batch->LastId);
+
+	return ret;
+}
+
+
+/** Reads the requests through the connector, the way IRPMon does, and checks
+ *  them; returns the number of requests reported as dropped. */
+static ULONG _ReceiveStream(PTEST_REQUEST_GEN Gen, ULONG Count)
+{
+	ULONG received = 0;
+	double deadline = 0;
+	DWORD err = ERROR_SUCCESS;
+	PREQUEST_BATCH_HEADER batch = NULL;
+	ULONG ret = 0;
+
+	batch = (PREQUEST_BATCH_HEADER)malloc(STREAM_BUFFER_SIZE);
+	deadline = GetTickCount() + 10000.0;
+	while (received < Count && GetTickCount() < deadline) {
+		err = NetConn_SynchronousOtherIOCTL(IOCTL_IRPMNDRV_GET_RECORDS, NULL, 0, batch, STREAM_BUFFER_SIZE);
+		if (err == ERROR_SUCCESS) {
+			received += _CheckBatch(batch, Gen);
+			ret += batch->DroppedCount;
+		} else if (err == ERROR_NO_MORE_ITEMS)
+			Sleep(1);
+		else break;
+	}
+
+	TEST_CHECK(err == ERROR_SUCCESS || err == ERROR_NO_MORE_ITEMS);
+	TEST_CHECK(received == Count);
+	free(batch);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                           IOCTLS                                     */
+/************************************************************************/
+
+
+static void *_Caller(void *Context)
+{
+	ULONG t = (ULONG)(ULONG_PTR)Context;
+	unsigned int seed = t + 1;
+
+	for (ULONG i = 0; i < THREAD_IOCTL_COUNT; ++i)
+		TEST_CHECK(_Echo((ULONG)rand_r(&seed) % 300, t*THREAD_IOCTL_COUNT + i));
+
+	return NULL;
+}
+
+
+/** Requests of all threads share the connection and complete in any order,
+ *  every thread must get its own replies. */
+static void _TestPipelinedIOCTLs(void)
+{
+	pthread_t threads[THREAD_COUNT];
+	FAKE_DRIVER_STATISTICS before;
+	FAKE_DRIVER_STATISTICS after;
+
+	FakeDriverQueryStatistics(&before);
+	for (ULONG_PTR t = 0; t < THREAD_COUNT; ++t)
+		pthread_create(threads + t, NULL, _Caller, (void *)t);
+
+	for (ULONG t = 0; t < THREAD_COUNT; ++t)
+		pthread_join(threads[t], NULL);
+
+	FakeDriverQueryStatistics(&after);
+	TEST_CHECK(after.EchoCount - before.EchoCount == THREAD_COUNT*THREAD_IOCTL_COUNT);
+
+	return;
+}
+
+
+static void *_SlowCaller(void *Context)
+{
+	TEST_CHECK(_Echo(SLOW_IOCTL_DELAY, 12345));
+	InterlockedExchange(&_slowDone, TRUE);
+
+	return NULL;
+}
+
+
+/** Quick IOCTLs complete while a slow one is still running. */
+static void _TestOutOfOrder(void)
+{
+	pthread_t thread;
+
+	_slowDone = FALSE;
+	pthread_create(&thread, NULL, _SlowCaller, NULL);
+	Sleep(50);
+	for (ULONG i = 0; i < 20; ++i)
+		TEST_CHECK(_Echo(0, i));
+
+	TEST_CHECK(!_slowDone);
+	pthread_join(thread, NULL);
+	TEST_CHECK(_slowDone);
+
+	return;
+}
+
+
+/************************************************************************/
+/*                         EVENT STREAM                                 */
+/************************************************************************/
+
+
+/** A huge grant must not wrap the credit of the subscription; the server
+ *  pushes as many batches as its limit allows and then stops. */
+static void _TestCreditClamp(void)
+{
+	SOCKET s = INVALID_SOCKET;
+	ULONG batchCount = 0;
+	ULONG dataSize = 0;
+	WSAPOLLFD pfd;
+	TEST_REQUEST_GEN gen;
+	NETWORK_MSG_IOCTL_V2 msg;
+	PREQUEST_BATCH_HEADER batch = NULL;
+
+	FakeDriverQueueClear();
+	s = NetClientConnect(_port);
+	TEST_CHECK(s != INVALID_SOCKET);
+	if (s != INVALID_SOCKET) {
+		batch = (PREQUEST_BATCH_HEADER)malloc(RAW_BATCH_SIZE);
+		TEST_CHECK(NetClientSubscribe(s, RAW_STREAM_ID, RAW_BATCH_SIZE, 0, bcmNone) == ERROR_SUCCESS);
+		TEST_CHECK(NetClientGrant(s, RAW_STREAM_ID, 1) == ERROR_SUCCESS);
+		TEST_CHECK(NetClientGrant(s, RAW_STREAM_ID, 0xffffffff) == ERROR_SUCCESS);
+		// The server handles messages of a client in order, the reply to
+		// the ping means the grants are in effect.
+		memset(&msg, 0, sizeof(msg));
+		TEST_CHECK(NetClientSend(s, &msg, NULL) == ERROR_SUCCESS);
+		TEST_CHECK(NetClientReceive(s, &msg, batch, RAW_BATCH_SIZE, &dataSize) == ERROR_SUCCESS);
+		TEST_CHECK(msg.ControlCode == NETWORK_CONTROL_PING);
+		TestRequestGenInit(&gen, 2, TRUE);
+		_Insert(&gen, 0, 4 * SERVER_MAX_CREDIT * RAW_BATCH_SIZE);
+		TestRequestGenInit(&gen, 2, TRUE);
+		for (ULONG i = 0; i < SERVER_MAX_CREDIT; ++i) {
+			if (NetClientReceive(s, &msg, batch, RAW_BATCH_SIZE, &dataSize) != ERROR_SUCCESS)
+				break;
+
+			TEST_CHECK(msg.ControlCode == NETWORK_CONTROL_RECORDS && msg.RequestId == RAW_STREAM_ID);
+			TEST_CHECK(msg.Result == ERROR_SUCCESS && dataSize == msg.OutputBufferSize);
+			if (msg.Result != ERROR_SUCCESS)
+				break;
+
+			_CheckBatch(batch, &gen);
+			++batchCount;
+		}
+
+		TEST_CHECK(batchCount == SERVER_MAX_CREDIT);
+		pfd.fd = s;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		TEST_CHECK(WSAPoll(&pfd, 1, 300) == 0);
+		TEST_CHECK(FakeDriverQueueLength() > 0);
+		NetClientClose(s);
+		free(batch);
+	}
+
+	FakeDriverQueueClear();
+
+	return;
+}
+
+
+/** Every request reaches the connector, together with the number of the
+ *  requests the driver dropped. */
+static void _TestStream(void)
+{
+	TEST_REQUEST_GEN gen;
+
+	FakeDriverQueueDrop(STREAM_DROPPED_COUNT);
+	TestRequestGenInit(&gen, 3, TRUE);
+	_Insert(&gen, STREAM_REQUEST_COUNT, 0);
+	TestRequestGenInit(&gen, 3, TRUE);
+	TEST_CHECK(_ReceiveStream(&gen, STREAM_REQUEST_COUNT) == STREAM_DROPPED_COUNT);
+	TEST_CHECK(FakeDriverQueueLength() == 0);
+
+	return;
+}
+
+
+/** While the connector does not read the stream, its credit runs out and
+ *  the server stops draining the driver's queue; nothing is lost. */
+static void _TestBackPressure(void)
+{
+	ULONG count = 0;
+	ULONG length = 0;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 4, TRUE);
+	count = _Insert(&gen, 0, 4 * NETWORK_STREAM_CREDIT * STREAM_BUFFER_SIZE);
+	Sleep(300);
+	length = FakeDriverQueueLength();
+	TEST_CHECK(length > 0 && length < count);
+	Sleep(300);
+	TEST_CHECK(FakeDriverQueueLength() == length);
+	TestRequestGenInit(&gen, 4, TRUE);
+	TEST_CHECK(_ReceiveStream(&gen, count) == 0);
+
+	return;
+}
+
+
+/** The server connects to the driver for its clients and disconnects when
+ *  the last of them leaves. */
+static void _TestDeviceConnection(void)
+{
+	ULONG waited = 0;
+	FAKE_DRIVER_STATISTICS stats;
+
+	TEST_CHECK(DevConn_Active());
+	NetConn_Disconnect();
+	while (DevConn_Active() && waited < 5000) {
+		Sleep(10);
+		waited += 10;
+	}
+
+	TEST_CHECK(!DevConn_Active());
+	FakeDriverQueryStatistics(&stats);
+	TEST_CHECK(stats.ConnectCount > 0);
+	TEST_CHECK(stats.ConnectCount == stats.DisconnectCount);
+
+	return;
+}
+
+
+int main(void)
+{
+	wchar_t port[16];
+	IRPMON_INIT_INFO info;
+
+	FakeDriverInit();
+	TEST_CHECK(TestServerStart(_port, sizeof(_port)));
+	if (TestFailures == 0) {
+		mbstowcs(port, _port, sizeof(port) / sizeof(port[0]));
+		memset(&info, 0, sizeof(info));
+		info.ConnectorType = ictNetwork;
+		info.Data.Network.Address = TEST_SERVER_ADDRESS_W;
+		info.Data.Network.Service = port;
+		info.Data.Network.AddressFamily = AF_INET;
+		TEST_CHECK(NetConn_Connect(&info) == ERROR_SUCCESS);
+		if (NetConn_Active()) {
+			_TestPipelinedIOCTLs();
+			_TestOutOfOrder();
+			_TestCreditClamp();
+			_TestStream();
+			_TestBackPressure();
+			_TestDeviceConnection();
+		}
+
+		TestServerStop();
+	}
+
+	FakeDriverFinit();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,275 @@
+
+/**
+ * @file
+ *
+ * Event streaming over a throttled link: a proxy limits the data the server
+ * sends to 1, 10 and 100 Mbit/s by a token bucket, and a client subscribed
+ * with and without compression counts the events it receives, while the
+ * fake driver's queue is kept full of realistic requests.
+ */
+
+#include <winsock2.h>
+#include "request-gen.h"
+#include "fake-driver.h"
+#include "test-server.h"
+#include "net-client.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_PROXY {
+	pthread_t Thread;
+	SOCKET Listen;
+	char Port[16];
+	/** Bytes per second. */
+	double Rate;
+	volatile LONG64 Bytes;
+} BENCH_PROXY, *PBENCH_PROXY;
+
+
+#define POOL_SIZE					2048
+#define BATCH_SIZE					(64*1024)
+#define STREAM_ID					1
+#define WARMUP_TIME					0.5
+#define MEASURE_TIME				3.0
+/** The bucket holds the data of this many seconds. */
+#define BUCKET_TIME					0.005
+
+
+static char _serverPort[16];
+static PREQUEST_HEADER _pool[POOL_SIZE];
+static volatile LONG _producerStop = FALSE;
+
+
+static BOOLEAN _SendAll(SOCKET Socket, const char *Buffer, int Length)
+{
+	int n = 0;
+	BOOLEAN ret = TRUE;
+
+	while (ret && Length > 0) {
+		n = send(Socket, Buffer, Length, 0);
+		ret = (n > 0);
+		if (ret) {
+			Buffer += n;
+			Length -= n;
+		}
+	}
+
+	return ret;
+}
+
+
+/** Forwards the client's data as they come and the server's data at
+ *  the rate of the proxy, until either side closes the connection. */
+static void *_ProxyThread(void *Context)
+{
+	int n = 0;
+	double now = 0;
+	double last = 0;
+	double tokens = 0;
+	double bucket = 0;
+	BOOLEAN ok = TRUE;
+	SOCKET client = INVALID_SOCKET;
+	SOCKET server = INVALID_SOCKET;
+	WSAPOLLFD fds[2];
+	static char buffer[64*1024];
+	PBENCH_PROXY p = (PBENCH_PROXY)Context;
+
+	bucket = p->Rate*BUCKET_TIME;
+	if (bucket < 1500)
+		bucket = 1500;
+
+	client = accept(p->Listen, NULL, NULL);
+	server = NetClientOpen(_serverPort);
+	ok = (client != INVALID_SOCKET && server != INVALID_SOCKET);
+	last = BenchNow();
+	while (ok) {
+		now = BenchNow();
+		tokens += (now - last)*p->Rate;
+		if (tokens > bucket)
+			tokens = bucket;
+
+		last = now;
+		fds[0].fd = client;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = server;
+		fds[1].events = (tokens >= 1) ? POLLIN : 0;
+		fds[1].revents = 0;
+		if (WSAPoll(fds, 2, 1) < 0)
+			break;
+
+		if (fds[0].revents != 0) {
+			n = recv(client, buffer, sizeof(buffer), 0);
+			ok = (n > 0 && _SendAll(server, buffer, n));
+		}
+
+		if (ok && fds[1].revents != 0) {
+			n = recv(server, buffer, ((size_t)tokens < sizeof(buffer)) ? (int)tokens : (int)sizeof(buffer), 0);
+			ok = (n > 0 && _SendAll(client, buffer, n));
+			if (ok) {
+				tokens -= n;
+				InterlockedExchangeAdd64(&p->Bytes, n);
+			}
+		}
+	}
+
+	if (server != INVALID_SOCKET)
+		NetClientClose(server);
+
+	if (client != INVALID_SOCKET)
+		NetClientClose(client);
+
+	return NULL;
+}
+
+
+static BOOLEAN _ProxyStart(PBENCH_PROXY Proxy, double Rate)
+{
+	int addrLen = 0;
+	struct sockaddr_in addr;
+	BOOLEAN ret = FALSE;
+
+	memset(Proxy, 0, sizeof(BENCH_PROXY));
+	Proxy->Rate = Rate;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addrLen = sizeof(addr);
+	Proxy->Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (Proxy->Listen != INVALID_SOCKET) {
+		if (bind(Proxy->Listen, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+			getsockname(Proxy->Listen, (struct sockaddr *)&addr, &addrLen) == 0 &&
+			listen(Proxy->Listen, 1) == 0) {
+			snprintf(Proxy->Port, sizeof(Proxy->Port), "%u", ntohs(addr.sin_port));
+			ret = (pthread_create(&Proxy->Thread, NULL, _ProxyThread, Proxy) == 0);
+		}
+
+		if (!ret)
+			closesocket(Proxy->Listen);
+	}
+
+	return ret;
+}
+
+
+static void _ProxyStop(PBENCH_PROXY Proxy)
+{
+	pthread_join(Proxy->Thread, NULL);
+	closesocket(Proxy->Listen);
+
+	return;
+}
+
+
+/** Keeps the queue of the fake driver from running dry. */
+static void *_ProducerThread(void *Context)
+{
+	ULONG index = 0;
+
+	while (!_producerStop) {
+		while (FakeDriverQueueLength() < POOL_SIZE) {
+			FakeDriverQueueInsert(_pool[index]);
+			index = (index + 1) % POOL_SIZE;
+		}
+
+		Sleep(1);
+	}
+
+	return NULL;
+}
+
+
+/** Returns events per second received by the client; WireRate receives
+ *  kilobytes per second passed through the proxy. */
+static double _Measure(double Rate, EBlockCodecMethod Compression, double *WireRate)
+{
+	double now = 0;
+	double start = 0;
+	double measureStart = 0;
+	LONG64 bytes = 0;
+	ULONG dataSize = 0;
+	ULONG events = 0;
+	SOCKET s = INVALID_SOCKET;
+	pthread_t producer;
+	BENCH_PROXY proxy;
+	NETWORK_MSG_IOCTL_V2 msg;
+	PREQUEST_BATCH_HEADER batch = NULL;
+	double ret = 0;
+
+	*WireRate = 0;
+	FakeDriverQueueClear();
+	batch = (PREQUEST_BATCH_HEADER)malloc(BATCH_SIZE);
+	if (batch != NULL && _ProxyStart(&proxy, Rate)) {
+		s = NetClientConnect(proxy.Port);
+		if (s != INVALID_SOCKET) {
+			if (NetClientSubscribe(s, STREAM_ID, BATCH_SIZE, NETWORK_STREAM_CREDIT, Compression) == ERROR_SUCCESS) {
+				_producerStop = FALSE;
+				pthread_create(&producer, NULL, _ProducerThread, NULL);
+				start = BenchNow();
+				now = start;
+				while (now - start < WARMUP_TIME + MEASURE_TIME &&
+					NetClientReceive(s, &msg, batch, BATCH_SIZE, &dataSize) == ERROR_SUCCESS &&
+					msg.Result == ERROR_SUCCESS) {
+					now = BenchNow();
+					if (measureStart == 0 && now - start >= WARMUP_TIME) {
+						measureStart = now;
+						bytes = proxy.Bytes;
+					} else if (measureStart != 0)
+						events += batch->RecordCount;
+
+					NetClientGrant(s, STREAM_ID, 1);
+				}
+
+				if (measureStart != 0 && now > measureStart) {
+					ret = events / (now - measureStart);
+					*WireRate = (proxy.Bytes - bytes) / 1024.0 / (now - measureStart);
+				}
+
+				InterlockedExchange(&_producerStop, TRUE);
+				pthread_join(producer, NULL);
+			}
+
+			NetClientClose(s);
+		}
+
+		_ProxyStop(&proxy);
+	}
+
+	free(batch);
+
+	return ret;
+}
+
+
+int main(void)
+{
+	double wireNone = 0;
+	double wireFast = 0;
+	double eventsNone = 0;
+	double eventsFast = 0;
+	TEST_REQUEST_GEN gen;
+	static const ULONG rates[] = { 1, 10, 100 };
+
+	TestRequestGenInit(&gen, 1, TRUE);
+	for (ULONG i = 0; i < POOL_SIZE; ++i)
+		_pool[i] = TestRequestGenerateNext(&gen);
+
+	FakeDriverInit();
+	if (TestServerStart(_serverPort, sizeof(_serverPort))) {
+		printf("Events streamed through a throttled link, %u kB batches\n", BATCH_SIZE / 1024);
+		for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); ++r) {
+			eventsNone = _Measure(rates[r]*1e6 / 8, bcmNone, &wireNone);
+			eventsFast = _Measure(rates[r]*1e6 / 8, bcmFast, &wireFast);
+			printf("  %3u Mbit/s: uncompressed %9.0f events/s (%7.1f kB/s), fast %9.0f events/s (%7.1f kB/s)\n", rates[r],
+				eventsNone, wireNone, eventsFast, wireFast);
+		}
+
+		TestServerStop();
+	} else printf("Cannot start the server\n");
+
+	FakeDriverFinit();
+	for (ULONG i = 0; i < POOL_SIZE; ++i)
+		RequestMemoryFree(_pool[i]);
+
+	return 0;
+}
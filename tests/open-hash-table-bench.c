@@ -0,0 +1,184 @@
+
+/**
+ * @file
+ *
+ * Open hash tables against general hash tables: lookup latency of keys
+ * present and missing at several load factors of the open table, and
+ * lookup throughput of 1 to 16 concurrent readers of dispatch IRQL tables.
+ */
+
+#include <ntifs.h>
+#include <stdlib.h>
+#include "hash_table.h"
+#include "open-hash-table.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_OBJECT {
+	HASH_ITEM HashItem;
+	ULONG_PTR Key;
+} BENCH_OBJECT, *PBENCH_OBJECT;
+
+typedef struct _BENCH_THREAD {
+	pthread_t Thread;
+	ULONG Index;
+	ULONG Count;
+	BOOLEAN Open;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+#define TABLE_SIZE					65536
+#define LOOKUP_COUNT				2000000
+#define THREAD_LOOKUP_COUNT			1000000
+
+
+static PBENCH_OBJECT _objects = NULL;
+static POPEN_HASH_TABLE _openTable = NULL;
+static PHASH_TABLE _hashTable = NULL;
+
+
+static ULONG32 _HashFunction(PVOID Key)
+{
+	return (ULONG32)((ULONG_PTR)Key / 4);
+}
+
+static BOOLEAN _OpenCompareFunction(PVOID Object, PVOID Key)
+{
+	return (((PBENCH_OBJECT)Object)->Key == (ULONG_PTR)Key);
+}
+
+static BOOLEAN _CompareFunction(PHASH_ITEM Item, PVOID Key)
+{
+	return (CONTAINING_RECORD(Item, BENCH_OBJECT, HashItem)->Key == (ULONG_PTR)Key);
+}
+
+/** Keys of the objects are pointer-like, present keys are multiples of 16,
+ *  missing ones lie between them.
+ */
+static PVOID _Key(ULONG Index, BOOLEAN Present)
+{
+	return (PVOID)(((ULONG_PTR)Index + 1) * 16 + (Present ? 0 : 8));
+}
+
+
+static void _TablesFill(EHashTableType Type, ULONG Count)
+{
+	OpenHashTableCreate(Type, TABLE_SIZE, _HashFunction, _OpenCompareFunction, NULL, &_openTable);
+	HashTableCreate(Type, 37, _HashFunction, _CompareFunction, NULL, &_hashTable);
+	for (ULONG i = 0; i < Count; ++i) {
+		_objects[i].Key = (ULONG_PTR)_Key(i, TRUE);
+		OpenHashTableInsert(_openTable, _objects + i, (PVOID)_objects[i].Key);
+		HashTableInsert(_hashTable, &_objects[i].HashItem, (PVOID)_objects[i].Key);
+	}
+
+	return;
+}
+
+static void _TablesFree(void)
+{
+	OpenHashTableDestroy(_openTable);
+	HashTableDestroy(_hashTable);
+
+	return;
+}
+
+
+/** Returns nanoseconds per lookup. */
+static double _MeasureLatency(BOOLEAN Open, ULONG Count, BOOLEAN Present)
+{
+	double start = 0;
+	ULONG found = 0;
+	unsigned int seed = 1;
+
+	start = BenchNow();
+	for (ULONG i = 0; i < LOOKUP_COUNT; ++i) {
+		if (Open)
+			found += (OpenHashTableGet(_openTable, _Key((ULONG)rand_r(&seed) % Count, Present)) != NULL);
+		else found += (HashTableGet(_hashTable, _Key((ULONG)rand_r(&seed) % Count, Present)) != NULL);
+	}
+
+	start = BenchNow() - start;
+	if (found != (Present ? LOOKUP_COUNT : 0))
+		printf("  unexpected number of keys found: %u\n", found);
+
+	return start * 1e9 / LOOKUP_COUNT;
+}
+
+
+static void *_Reader(void *Context)
+{
+	PBENCH_THREAD t = (PBENCH_THREAD)Context;
+	unsigned int seed = t->Index + 1;
+
+	ShimProcessor = t->Index;
+	for (ULONG i = 0; i < THREAD_LOOKUP_COUNT; ++i) {
+		if (t->Open)
+			OpenHashTableGet(_openTable, _Key((ULONG)rand_r(&seed) % t->Count, TRUE));
+		else HashTableGet(_hashTable, _Key((ULONG)rand_r(&seed) % t->Count, TRUE));
+	}
+
+	return NULL;
+}
+
+
+/** Returns millions of lookups per second. */
+static double _MeasureReaders(BOOLEAN Open, ULONG Count, ULONG ThreadCount)
+{
+	double start = 0;
+	BENCH_THREAD threads[SHIM_PROCESSOR_COUNT];
+
+	start = BenchNow();
+	for (ULONG i = 0; i < ThreadCount; ++i) {
+		threads[i].Index = i;
+		threads[i].Count = Count;
+		threads[i].Open = Open;
+		pthread_create(&threads[i].Thread, NULL, _Reader, threads + i);
+	}
+
+	for (ULONG i = 0; i < ThreadCount; ++i)
+		pthread_join(threads[i].Thread, NULL);
+
+	start = BenchNow() - start;
+
+	return (double)THREAD_LOOKUP_COUNT*ThreadCount / start / 1e6;
+}
+
+
+int main(void)
+{
+	ULONG count = 0;
+	ULONG capacity = 0;
+	static const ULONG loads[] = { 25, 50, 70 };
+
+	// The number of slots an open table sized for TABLE_SIZE objects has
+	OpenHashTableCreate(httNoSynchronization, TABLE_SIZE, _HashFunction, _OpenCompareFunction, NULL, &_openTable);
+	capacity = _openTable->Array->BucketCount*OPEN_HASH_BUCKET_SLOTS;
+	OpenHashTableDestroy(_openTable);
+	_objects = (PBENCH_OBJECT)calloc(capacity, sizeof(BENCH_OBJECT));
+	if (_objects != NULL) {
+		printf("Lookup latency, %u slots in the open table\n", capacity);
+		for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); ++l) {
+			count = capacity / 100 * loads[l];
+			_TablesFill(httNoSynchronization, count);
+			printf("  load %2u %% (%6u objects): open hit %6.1f ns, miss %6.1f ns; general hit %6.1f ns, miss %6.1f ns\n",
+				loads[l], count,
+				_MeasureLatency(TRUE, count, TRUE), _MeasureLatency(TRUE, count, FALSE),
+				_MeasureLatency(FALSE, count, TRUE), _MeasureLatency(FALSE, count, FALSE));
+			_TablesFree();
+		}
+
+		count = capacity / 2;
+		printf("Concurrent readers of dispatch IRQL tables, %u objects\n", count);
+		_TablesFill(httDispatchLevel, count);
+		for (ULONG threadCount = 1; threadCount <= SHIM_PROCESSOR_COUNT; threadCount *= 2) {
+			printf("  %2u threads: open %7.2f M lookups/s, general %7.2f M lookups/s\n", threadCount,
+				_MeasureReaders(TRUE, count, threadCount), _MeasureReaders(FALSE, count, threadCount));
+		}
+
+		ShimProcessor = 0;
+		_TablesFree();
+		free(_objects);
+	}
+
+	return 0;
+}
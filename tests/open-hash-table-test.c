@@ -0,0 +1,190 @@
+
+/**
+ * @file
+ *
+ * Tests of open hash tables: lookups and deletions while the bucket array
+ * grows, deletions within long probe sequences of colliding hashes,
+ * traversals and clearing, and concurrent insertions, lookups and deletions
+ * over the stripe locks of passive and dispatch IRQL tables.
+ */
+
+#include <ntifs.h>
+#include "open-hash-table.h"
+#include "test.h"
+
+
+typedef struct _TEST_OBJECT {
+	ULONG_PTR Key;
+	volatile LONG Present;
+} TEST_OBJECT, *PTEST_OBJECT;
+
+
+#define OBJECT_COUNT				20000
+#define THREAD_COUNT				8
+#define OBJECTS_PER_THREAD			(OBJECT_COUNT / THREAD_COUNT)
+#define ROUND_COUNT					3
+
+
+static TEST_OBJECT _objects[OBJECT_COUNT];
+static POPEN_HASH_TABLE _table = NULL;
+static volatile LONG _freeCount = 0;
+
+
+static ULONG32 _HashFunction(PVOID Key)
+{
+	return (ULONG32)((ULONG_PTR)Key / 4);
+}
+
+/** Sends every key to the same few home buckets. */
+static ULONG32 _CollidingHashFunction(PVOID Key)
+{
+	return (ULONG32)((ULONG_PTR)Key % 3);
+}
+
+static BOOLEAN _CompareFunction(PVOID Object, PVOID Key)
+{
+	return (((PTEST_OBJECT)Object)->Key == (ULONG_PTR)Key);
+}
+
+static VOID _FreeFunction(PVOID Object)
+{
+	TEST_CHECK(((PTEST_OBJECT)Object)->Present);
+	InterlockedIncrement(&_freeCount);
+}
+
+static VOID _CountCallback(PVOID Object, PVOID Context)
+{
+	TEST_CHECK(((PTEST_OBJECT)Object)->Present);
+	++*(PULONG)Context;
+}
+
+static BOOLEAN _StopCallback(PVOID Object, PVOID Context)
+{
+	UNREFERENCED_PARAMETER(Object);
+
+	return (--*(PULONG)Context > 0);
+}
+
+
+/** Inserts objects one by one while the table grows, deletes every other
+ *  one and checks all lookups against the expected presence.
+ */
+static void _TestSequential(EHashTableType Type, HASH_FUNCTION HashFunction, ULONG Count)
+{
+	ULONG seen = 0;
+	PTEST_OBJECT o = NULL;
+
+	TEST_CHECK(NT_SUCCESS(OpenHashTableCreate(Type, 1, HashFunction, _CompareFunction, _FreeFunction, &_table)));
+	for (ULONG i = 0; i < Count; ++i) {
+		o = _objects + i;
+		o->Key = (i + 1) * 8;
+		o->Present = TRUE;
+		TEST_CHECK(OpenHashTableInsert(_table, o, (PVOID)o->Key) == STATUS_SUCCESS);
+		TEST_CHECK(OpenHashTableGet(_table, (PVOID)o->Key) == o);
+	}
+
+	TEST_CHECK(OpenHashTableGetItemCount(_table) == Count);
+	for (ULONG i = 0; i < Count; i += 2) {
+		o = _objects + i;
+		TEST_CHECK(OpenHashTableDelete(_table, (PVOID)o->Key) == o);
+		TEST_CHECK(OpenHashTableDelete(_table, (PVOID)o->Key) == NULL);
+		o->Present = FALSE;
+	}
+
+	for (ULONG i = 0; i < Count; ++i) {
+		o = _objects + i;
+		TEST_CHECK(OpenHashTableGet(_table, (PVOID)o->Key) == (o->Present ? o : NULL));
+	}
+
+	TEST_CHECK(OpenHashTableGet(_table, (PVOID)(((ULONG_PTR)Count + 1) * 8)) == NULL);
+	OpenHashTablePerform(_table, _CountCallback, &seen);
+	TEST_CHECK(seen == Count / 2);
+	seen = 3;
+	OpenHashTablePerformWithFeedback(_table, _StopCallback, &seen);
+	TEST_CHECK(seen == 0);
+	_freeCount = 0;
+	OpenHashTableClear(_table, TRUE);
+	TEST_CHECK(_freeCount == (LONG)(Count / 2));
+	TEST_CHECK(OpenHashTableGetItemCount(_table) == 0);
+	for (ULONG i = 1; i < Count; i += 2)
+		TEST_CHECK(OpenHashTableGet(_table, (PVOID)_objects[i].Key) == NULL);
+
+	TEST_CHECK(OpenHashTableInsert(_table, _objects + 1, (PVOID)_objects[1].Key) == STATUS_SUCCESS);
+	_freeCount = 0;
+	OpenHashTableDestroy(_table);
+	TEST_CHECK(_freeCount == 1);
+
+	return;
+}
+
+
+static void *_Worker(void *Context)
+{
+	ULONG_PTR t = (ULONG_PTR)Context;
+	PTEST_OBJECT o = NULL;
+
+	ShimProcessor = (ULONG)t;
+	for (int r = 0; r < ROUND_COUNT; ++r) {
+		for (ULONG i = 0; i < OBJECTS_PER_THREAD; ++i) {
+			o = _objects + t*OBJECTS_PER_THREAD + i;
+			o->Key = (t*OBJECTS_PER_THREAD + i + 1) * 8;
+			o->Present = TRUE;
+			TEST_CHECK(OpenHashTableInsert(_table, o, (PVOID)o->Key) == STATUS_SUCCESS);
+		}
+
+		for (ULONG i = 0; i < OBJECTS_PER_THREAD; ++i) {
+			o = _objects + t*OBJECTS_PER_THREAD + i;
+			TEST_CHECK(OpenHashTableGet(_table, (PVOID)o->Key) == o);
+			// Objects of the other threads come and go, but never under a wrong key.
+			o = (PTEST_OBJECT)OpenHashTableGet(_table, (PVOID)(((t + 1) % THREAD_COUNT*OBJECTS_PER_THREAD + i + 1) * 8));
+			TEST_CHECK(o == NULL || o->Key == ((t + 1) % THREAD_COUNT*OBJECTS_PER_THREAD + i + 1) * 8);
+		}
+
+		for (ULONG i = 0; i < OBJECTS_PER_THREAD; ++i) {
+			o = _objects + t*OBJECTS_PER_THREAD + i;
+			TEST_CHECK(OpenHashTableDelete(_table, (PVOID)o->Key) == o);
+			o->Present = FALSE;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void _TestConcurrent(EHashTableType Type)
+{
+	pthread_t threads[THREAD_COUNT];
+
+	TEST_CHECK(NT_SUCCESS(OpenHashTableCreate(Type, 16, _HashFunction, _CompareFunction, _FreeFunction, &_table)));
+	for (ULONG_PTR t = 0; t < THREAD_COUNT; ++t)
+		pthread_create(threads + t, NULL, _Worker, (void *)t);
+
+	for (ULONG t = 0; t < THREAD_COUNT; ++t)
+		pthread_join(threads[t], NULL);
+
+	ShimProcessor = 0;
+	TEST_CHECK(OpenHashTableGetItemCount(_table) == 0);
+	_freeCount = 0;
+	OpenHashTableDestroy(_table);
+	TEST_CHECK(_freeCount == 0);
+
+	return;
+}
+
+
+int main(void)
+{
+	static const EHashTableType types[] = { httPassiveLevel, httDispatchLevel, httNoSynchronization };
+
+	TEST_CHECK(OpenHashTableCreate(httNoSynchronization, 0, _HashFunction, _CompareFunction, NULL, &_table) == STATUS_INVALID_PARAMETER_2);
+	TEST_CHECK(OpenHashTableCreate(httNoSynchronization, 1, _HashFunction, NULL, NULL, &_table) == STATUS_INVALID_PARAMETER_4);
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+		_TestSequential(types[i], _HashFunction, OBJECT_COUNT);
+		_TestSequential(types[i], _CollidingHashFunction, 300);
+	}
+
+	_TestConcurrent(httPassiveLevel);
+	_TestConcurrent(httDispatchLevel);
+
+	return TEST_RESULT();
+}
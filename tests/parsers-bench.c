@@ -0,0 +1,432 @@
+
+/**
+ * @file
+ *
+ * Speed of every bundled data parser through both parser interfaces: the
+ * version 1 one, allocating each name and value and freeing them by the
+ * free routine, the version 3 one, appending rows to an output kept for the
+ * next request, and version 1 parsers run into an output by the adapter of
+ * pbase. Each parser gets a request it handles; both interfaces must give
+ * it the same rows.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "data-parser-types.h"
+#include "parser-base.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_PARSER {
+	const char *Name;
+	DP_INIT_ROUTINE *Init;
+	PREQUEST_HEADER Request;
+	DP_REQUEST_EXTRA_INFO ExtraInfo;
+} BENCH_PARSER, *PBENCH_PARSER;
+
+typedef enum _EBenchInterface {
+	biNameValue,
+	biOutput,
+	biAdapter,
+	biMax,
+} EBenchInterface, *PEBenchInterface;
+
+
+#define MEASURE_TIME				0.5
+#define BATCH_COUNT					64
+#define HEXER_DATA_LENGTH			4096
+#define EA_COUNT					8
+#define KEY_COUNT					16
+#define MOUSE_MOVE_COUNT			16
+
+#define IRP_MJ_READ					0x03
+#define IRP_MJ_WRITE				0x04
+#define IRP_MJ_SET_EA				0x08
+#define IRP_MJ_SET_SECURITY			0x15
+#define IRP_MJ_PNP					0x1b
+#define IRP_MN_QUERY_INTERFACE		0x08
+#define IRP_MN_QUERY_CAPABILITIES	0x09
+#define IRP_MN_QUERY_ID				0x13
+
+
+/** The parsers, built with names of their own into test-parsers. */
+DWORD cdecl HexerDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+DWORD cdecl EaDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+DWORD cdecl KeyboardDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+DWORD cdecl MouseDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+DWORD cdecl PnPDevCapsDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+DWORD cdecl PnPIdsDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+DWORD cdecl PnPInterfaceDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+DWORD cdecl SecDescDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+
+
+/************************************************************************/
+/*                 REQUESTS                                             */
+/************************************************************************/
+
+static PREQUEST_HEADER _IrpCreate(UCHAR Major, UCHAR Minor, const void *Data, size_t DataSize)
+{
+	PREQUEST_IRP ret = NULL;
+
+	ret = (PREQUEST_IRP)calloc(1, sizeof(REQUEST_IRP) + DataSize);
+	if (ret != NULL) {
+		ret->Header.Type = ertIRP;
+		ret->MajorFunction = Major;
+		ret->MinorFunction = Minor;
+		ret->DataSize = DataSize;
+		memcpy(ret + 1, Data, DataSize);
+	}
+
+	return (ret != NULL) ? &ret->Header : NULL;
+}
+
+
+static PREQUEST_HEADER _IrpCompletionCreate(ULONG Major, ULONG Minor, ULONG_PTR Argument, const void *Data, size_t DataSize)
+{
+	PREQUEST_IRP_COMPLETION ret = NULL;
+
+	ret = (PREQUEST_IRP_COMPLETION)calloc(1, sizeof(REQUEST_IRP_COMPLETION) + DataSize);
+	if (ret != NULL) {
+		ret->Header.Type = ertIRPCompletion;
+		ret->MajorFunction = Major;
+		ret->MinorFunction = Minor;
+		ret->Arguments[0] = (PVOID)Argument;
+		ret->DataSize = DataSize;
+		memcpy(ret + 1, Data, DataSize);
+	}
+
+	return (ret != NULL) ? &ret->Header : NULL;
+}
+
+
+/** Extended attributes being set, each with a name and 16 bytes of value. */
+static PREQUEST_HEADER _EaRequest(void)
+{
+	size_t offset = 0;
+	size_t entrySize = 0;
+	unsigned char *e = NULL;
+	unsigned char data[EA_COUNT*64];
+	static const char name[] = "$KERNEL.PURGE.APPID.HASHINFO";
+
+	memset(data, 0, sizeof(data));
+	for (ULONG i = 0; i < EA_COUNT; ++i) {
+		e = data + offset;
+		entrySize = (8 + sizeof(name) + 16 + 3) & ~3;
+		if (i + 1 < EA_COUNT)
+			*(ULONG *)e = (ULONG)entrySize;
+
+		e[4] = (UCHAR)(i % 2);
+		e[5] = (UCHAR)(sizeof(name) - 1);
+		*(USHORT *)(e + 6) = 16;
+		memcpy(e + 8, name, sizeof(name));
+		offset += entrySize;
+	}
+
+	return _IrpCreate(IRP_MJ_SET_EA, 0, data, offset);
+}
+
+
+/** Key strokes read from the keyboard class driver. */
+static PREQUEST_HEADER _KeyboardRequest(void)
+{
+	USHORT data[KEY_COUNT][6];
+
+	memset(data, 0, sizeof(data));
+	for (ULONG i = 0; i < KEY_COUNT; ++i) {
+		data[i][1] = (USHORT)(0x1e + i / 2);
+		data[i][2] = (USHORT)(i % 2);
+	}
+
+	return _IrpCompletionCreate(IRP_MJ_READ, 0, 0, data, sizeof(data));
+}
+
+
+/** Moves of the mouse with a click, read from the mouse class driver. */
+static PREQUEST_HEADER _MouseRequest(void)
+{
+	ULONG data[MOUSE_MOVE_COUNT][6];
+
+	memset(data, 0, sizeof(data));
+	for (ULONG i = 0; i < MOUSE_MOVE_COUNT; ++i) {
+		data[i][1] = (i == 0) ? 0x1 : 0;
+		data[i][3] = (ULONG)(LONG)(i % 5) - 2;
+		data[i][4] = i % 3;
+	}
+
+	return _IrpCompletionCreate(IRP_MJ_READ, 0, 0, data, sizeof(data));
+}
+
+
+/** Capabilities of a removable device able to wake the system. */
+static PREQUEST_HEADER _DevCapsRequest(void)
+{
+	ULONG data[16];
+
+	memset(data, 0, sizeof(data));
+	*(USHORT *)data = sizeof(data);
+	*((USHORT *)data + 1) = 1;
+	data[1] = 0x1 | 0x2 | 0x10 | 0x40 | 0x200 | 0x800;
+	data[2] = 0x10;
+	data[3] = 1;
+	data[4] = PowerDeviceUnspecified;
+	data[5] = PowerDeviceD0;
+	data[6] = PowerDeviceD2;
+	data[7] = PowerDeviceD3;
+	data[8] = PowerDeviceD3;
+	data[9] = PowerDeviceD3;
+	data[10] = PowerDeviceD3;
+	data[11] = PowerSystemSleeping3;
+	data[12] = PowerDeviceD2;
+	data[13] = 10;
+	data[14] = 100;
+	data[15] = 1000;
+
+	return _IrpCompletionCreate(IRP_MJ_PNP, IRP_MN_QUERY_CAPABILITIES, 0, data, sizeof(data));
+}
+
+
+/** Hardware IDs of a USB device. */
+static PREQUEST_HEADER _IdsRequest(void)
+{
+	static const wchar_t data[] = L"USB\\VID_046D&PID_C52B&REV_2400\0USB\\VID_046D&PID_C52B\0USB\\Class_03&SubClass_01\0USB\\Class_03\0";
+
+	return _IrpCompletionCreate(IRP_MJ_PNP, IRP_MN_QUERY_ID, 1, data, sizeof(data));
+}
+
+
+/** Query for the standard interface of a PCI bus. */
+static PREQUEST_HEADER _InterfaceRequest(void)
+{
+	static const GUID data = { 0x496B8281L, 0x6F25, 0x11D0, { 0xBE, 0xAF, 0x08, 0x00, 0x2B, 0xE2, 0x09, 0x2F } };
+
+	return _IrpCreate(IRP_MJ_PNP, IRP_MN_QUERY_INTERFACE, &data, sizeof(data));
+}
+
+
+static size_t _SidWrite(unsigned char *Buffer, BYTE Authority, BYTE SubAuthorityCount, DWORD SubAuthority1, DWORD SubAuthority2)
+{
+	PISID s = (PISID)Buffer;
+
+	memset(s, 0, sizeof(SID));
+	s->Revision = 1;
+	s->SubAuthorityCount = SubAuthorityCount;
+	s->IdentifierAuthority.Value[5] = Authority;
+	s->SubAuthority[0] = SubAuthority1;
+	if (SubAuthorityCount > 1)
+		s->SubAuthority[1] = SubAuthority2;
+
+	return 8 + SubAuthorityCount*sizeof(DWORD);
+}
+
+
+/** Self-relative descriptor being set, owned by the local system, with the
+ *  administrators as its group and a DACL of three ACEs. */
+static PREQUEST_HEADER _SecDescRequest(void)
+{
+	size_t offset = 0;
+	PACL acl = NULL;
+	ACCESS_ALLOWED_ACE *ace = NULL;
+	PISECURITY_DESCRIPTOR_RELATIVE sd = NULL;
+	unsigned char data[256];
+	static const ACCESS_MASK masks[] = { 0x1f01ff, 0x1f01ff, 0x1200a9 };
+
+	memset(data, 0, sizeof(data));
+	sd = (PISECURITY_DESCRIPTOR_RELATIVE)data;
+	sd->Revision = SECURITY_DESCRIPTOR_REVISION;
+	sd->Control = SE_SELF_RELATIVE | SE_DACL_PRESENT;
+	offset = sizeof(SECURITY_DESCRIPTOR_RELATIVE);
+	sd->Owner = (DWORD)offset;
+	offset += _SidWrite(data + offset, 5, 1, 18, 0);
+	sd->Group = (DWORD)offset;
+	offset += _SidWrite(data + offset, 5, 2, 32, 544);
+	sd->Dacl = (DWORD)offset;
+	acl = (PACL)(data + offset);
+	acl->AclRevision = 2;
+	acl->AceCount = 3;
+	offset += sizeof(ACL);
+	for (ULONG i = 0; i < acl->AceCount; ++i) {
+		ace = (ACCESS_ALLOWED_ACE *)(data + offset);
+		ace->Header.AceType = ACCESS_ALLOWED_ACE_TYPE;
+		ace->Header.AceFlags = (i == 2) ? 0x3 : 0;
+		ace->Mask = masks[i];
+		switch (i) {
+			case 0:
+				ace->Header.AceSize = (WORD)(8 + _SidWrite((unsigned char *)&ace->SidStart, 5, 1, 18, 0));
+				break;
+			case 1:
+				ace->Header.AceSize = (WORD)(8 + _SidWrite((unsigned char *)&ace->SidStart, 5, 2, 32, 544));
+				break;
+			default:
+				ace->Header.AceSize = (WORD)(8 + _SidWrite((unsigned char *)&ace->SidStart, 1, 1, 0, 0));
+				break;
+		}
+
+		offset += ace->Header.AceSize;
+	}
+
+	acl->AclSize = (WORD)((unsigned char *)(data + offset) - (unsigned char *)acl);
+
+	return _IrpCreate(IRP_MJ_SET_SECURITY, 0, data, offset);
+}
+
+
+/** Random data written to a file. */
+static PREQUEST_HEADER _HexerRequest(void)
+{
+	unsigned char data[HEXER_DATA_LENGTH];
+
+	srand(42);
+	for (size_t i = 0; i < sizeof(data); ++i)
+		data[i] = (unsigned char)rand();
+
+	return _IrpCreate(IRP_MJ_WRITE, 0, data, sizeof(data));
+}
+
+
+/************************************************************************/
+/*                 MEASUREMENT                                          */
+/************************************************************************/
+
+static BOOLEAN _SameString(const wchar_t *A, const wchar_t *B)
+{
+	while (*A != L'\0' && *A == *B) {
+		++A;
+		++B;
+	}
+
+	return (*A == *B);
+}
+
+
+/** Parses the request through both interfaces and compares the rows;
+ *  returns their number, or zero if they differ or the request is not
+ *  handled. */
+static size_t _Check(const IRPMON_DATA_PARSER *Parser, const BENCH_PARSER *Bench, PDP_OUTPUT Output)
+{
+	size_t rowCount = 0;
+	wchar_t **names = NULL;
+	wchar_t **values = NULL;
+	const wchar_t *name = NULL;
+	BOOLEAN handled = FALSE;
+	BOOLEAN outputHandled = FALSE;
+	size_t ret = 0;
+
+	PBaseOutputReset(Output);
+	if (Parser->ParseRoutine(Bench->Request, &Bench->ExtraInfo, &handled, &names, &values, &rowCount) == ERROR_SUCCESS && handled) {
+		if (Parser->ParseOutputRoutine(Bench->Request, &Bench->ExtraInfo, &outputHandled, Output) == ERROR_SUCCESS && outputHandled &&
+			Output->RowCount == rowCount) {
+			ret = rowCount;
+			for (size_t i = 0; i < rowCount; ++i) {
+				name = (Output->Rows[i].NameOffset != DP_OUTPUT_NO_NAME) ? Output->Chars + Output->Rows[i].NameOffset : NULL;
+				if ((names != NULL && names[i] != NULL) != (name != NULL) ||
+					(name != NULL && !_SameString(names[i], name)) ||
+					!_SameString(values[i], Output->Chars + Output->Rows[i].ValueOffset)) {
+					ret = 0;
+					break;
+				}
+			}
+		}
+
+		Parser->FreeRoutine(names, values, rowCount);
+	}
+
+	return ret;
+}
+
+
+/** Returns thousands of requests per second; Allocations receives the heap
+ *  allocations per request. */
+static double _Measure(const IRPMON_DATA_PARSER *Parser, const BENCH_PARSER *Bench, EBenchInterface Interface, PDP_OUTPUT Output, double *Allocations)
+{
+	double start = 0;
+	double elapsed = 0;
+	size_t count = 0;
+	size_t rowCount = 0;
+	LONG allocations = 0;
+	wchar_t **names = NULL;
+	wchar_t **values = NULL;
+	BOOLEAN handled = FALSE;
+
+	allocations = ShimAllocationCount;
+	start = BenchNow();
+	do {
+		for (size_t i = 0; i < BATCH_COUNT; ++i) {
+			switch (Interface) {
+				case biNameValue:
+					Parser->ParseRoutine(Bench->Request, &Bench->ExtraInfo, &handled, &names, &values, &rowCount);
+					Parser->FreeRoutine(names, values, rowCount);
+					break;
+				case biOutput:
+					PBaseOutputReset(Output);
+					Parser->ParseOutputRoutine(Bench->Request, &Bench->ExtraInfo, &handled, Output);
+					break;
+				default:
+					PBaseOutputReset(Output);
+					PBaseDataParserRun(Parser, Bench->Request, &Bench->ExtraInfo, &handled, Output);
+					break;
+			}
+		}
+
+		count += BATCH_COUNT;
+		elapsed = BenchNow() - start;
+	} while (elapsed < MEASURE_TIME);
+
+	*Allocations = (double)(ShimAllocationCount - allocations) / count;
+
+	return count / elapsed / 1e3;
+}
+
+
+int main(void)
+{
+	size_t rowCount = 0;
+	double rates[biMax];
+	double allocations[biMax];
+	DP_OUTPUT output;
+	PIRPMON_DATA_PARSER parser = NULL;
+	PIRPMON_DATA_PARSER parserV1 = NULL;
+	BENCH_PARSER parsers[] = {
+		{ "hexer", HexerDataParserInit, _HexerRequest() },
+		{ "ea", EaDataParserInit, _EaRequest() },
+		// The names the parsers look for.
+		{ "keyboard", KeyboardDataParserInit, _KeyboardRequest(), { L"\\Driver\\kbdclass", L"\\Device\\KeyboardClass00" } },
+		{ "mouse", MouseDataParserInit, _MouseRequest(), { L"\\Driver\\mouclass", L"\\Device\\PointerdClass00" } },
+		{ "pnp-devcaps", PnPDevCapsDataParserInit, _DevCapsRequest() },
+		{ "pnp-ids", PnPIdsDataParserInit, _IdsRequest() },
+		{ "pnp-interface", PnPInterfaceDataParserInit, _InterfaceRequest() },
+		{ "secdesc", SecDescDataParserInit, _SecDescRequest() },
+	};
+
+	PBaseOutputInit(&output);
+	printf("Requests parsed through the version 1 interface, the version 3 one, and by version 1 parsers run by the adapter\n");
+	printf("  %-14s %5s %22s %22s %22s\n", "parser", "rows", "v1 k/s (allocs)", "v3 k/s (allocs)", "adapter k/s (allocs)");
+	for (size_t i = 0; i < sizeof(parsers) / sizeof(parsers[0]); ++i) {
+		parser = NULL;
+		parserV1 = NULL;
+		if (parsers[i].Request != NULL &&
+			parsers[i].Init(IRPMON_DATA_PARSER_VERSION_3, &parser) == ERROR_SUCCESS &&
+			parsers[i].Init(IRPMON_DATA_PARSER_VERSION_1, &parserV1) == ERROR_SUCCESS) {
+			rowCount = _Check(parser, parsers + i, &output);
+			if (rowCount > 0) {
+				rates[biNameValue] = _Measure(parser, parsers + i, biNameValue, &output, allocations + biNameValue);
+				rates[biOutput] = _Measure(parser, parsers + i, biOutput, &output, allocations + biOutput);
+				rates[biAdapter] = _Measure(parserV1, parsers + i, biAdapter, &output, allocations + biAdapter);
+				printf("  %-14s %5zu %12.1f (%7.1f) %12.1f (%7.1f) %12.1f (%7.1f)\n", parsers[i].Name, rowCount,
+					rates[biNameValue], allocations[biNameValue], rates[biOutput], allocations[biOutput],
+					rates[biAdapter], allocations[biAdapter]);
+			} else printf("  %-14s the request is not handled, or the interfaces give different rows\n", parsers[i].Name);
+		} else printf("  %-14s cannot be initialized\n", parsers[i].Name);
+
+		if (parserV1 != NULL)
+			PBaseDataParserFree(parserV1);
+
+		if (parser != NULL)
+			PBaseDataParserFree(parser);
+
+		free(parsers[i].Request);
+	}
+
+	PBaseOutputFree(&output);
+
+	return 0;
+}
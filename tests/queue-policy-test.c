@@ -0,0 +1,212 @@
+
+/**
+ * @file
+ *
+ * Tests of the overflow policy of the Event Queue. Besides checking single
+ * decisions at the limits, the policies drive a simulated queue filled by
+ * a producer faster than a consumer empties it, the way the driver uses
+ * them, and the queue must stay within the bounds each policy promises.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "queue-policy.h"
+#include "test.h"
+
+
+#define MAX_LENGTH					1000
+#define MAX_SIZE					0x10000
+#define EVENT_COUNT					200000
+
+
+typedef struct _SIM_QUEUE {
+	ULONG Sizes[4*MAX_LENGTH];
+	ULONG Head;
+	LONG Length;
+	LONG Size;
+	ULONG Accepted;
+	ULONG AcceptedOverLimit;
+	ULONG Dropped;
+	LONG MaxLength;
+	LONG MaxSize;
+} SIM_QUEUE, *PSIM_QUEUE;
+
+
+static void _SettingsInit(PIRPMNDRV_SETTINGS Settings, ULONG MaxLength, ULONG MaxSize, EReqQueueOverflowPolicy Policy, ULONG SampleRate)
+{
+	memset(Settings, 0, sizeof(IRPMNDRV_SETTINGS));
+	Settings->ReqQueueMaxLength = MaxLength;
+	Settings->ReqQueueMaxSize = MaxSize;
+	Settings->ReqQueueOverflowPolicy = Policy;
+	Settings->ReqQueueSampleRate = SampleRate;
+
+	return;
+}
+
+
+static void _SimPush(PSIM_QUEUE Queue, ULONG Size)
+{
+	Queue->Sizes[(Queue->Head + Queue->Length) % (sizeof(Queue->Sizes) / sizeof(Queue->Sizes[0]))] = Size;
+	++Queue->Length;
+	Queue->Size += Size;
+	if (Queue->Length > Queue->MaxLength)
+		Queue->MaxLength = Queue->Length;
+
+	if (Queue->Size > Queue->MaxSize)
+		Queue->MaxSize = Queue->Size;
+
+	return;
+}
+
+
+static void _SimPop(PSIM_QUEUE Queue)
+{
+	--Queue->Length;
+	Queue->Size -= Queue->Sizes[Queue->Head];
+	Queue->Head = (Queue->Head + 1) % (sizeof(Queue->Sizes) / sizeof(Queue->Sizes[0]));
+
+	return;
+}
+
+
+/** Produces three events for every one consumed, trimming as the driver does. */
+static void _Simulate(const IRPMNDRV_SETTINGS *Settings, PSIM_QUEUE Queue)
+{
+	ULONG size = 0;
+	volatile LONG sampleCounter = 0;
+	unsigned int seed = 7;
+
+	memset(Queue, 0, sizeof(SIM_QUEUE));
+	for (ULONG i = 0; i < EVENT_COUNT; ++i) {
+		size = 16 + (ULONG)rand_r(&seed) % 256;
+		switch (QueuePolicyDecide(Settings, Queue->Length, Queue->Size, size, &sampleCounter)) {
+			case qpdAccept:
+				_SimPush(Queue, size);
+				++Queue->Accepted;
+				break;
+			case qpdAcceptOverLimit:
+				_SimPush(Queue, size);
+				++Queue->AcceptedOverLimit;
+				break;
+			case qpdAcceptTrim:
+				_SimPush(Queue, size);
+				++Queue->Accepted;
+				while (Queue->Length > 0 && QueuePolicyOverLimit(Settings, Queue->Length, Queue->Size))
+					_SimPop(Queue);
+				break;
+			case qpdDrop:
+				++Queue->Dropped;
+				break;
+		}
+
+		if (i % 3 == 0 && Queue->Length > 0)
+			_SimPop(Queue);
+	}
+
+	return;
+}
+
+
+static void _TestLimits(void)
+{
+	IRPMNDRV_SETTINGS s;
+	volatile LONG counter = 0;
+
+	// No limits, everything is accepted.
+	_SettingsInit(&s, 0, 0, rqopDropNewest, 0);
+	TEST_CHECK(!QueuePolicyOverLimit(&s, 0x7fffffff, 0x7fffffff));
+	TEST_CHECK(QueuePolicyDecide(&s, 0x7fffffff, 0x7fffffff, 0xffffffff, &counter) == qpdAccept);
+
+	// Each limit counts on its own, an event reaching it exactly fits.
+	_SettingsInit(&s, 10, 0, rqopDropNewest, 0);
+	TEST_CHECK(QueuePolicyDecide(&s, 9, 0x7fffffff, 100, &counter) == qpdAccept);
+	TEST_CHECK(QueuePolicyDecide(&s, 10, 0, 100, &counter) == qpdDrop);
+	TEST_CHECK(!QueuePolicyOverLimit(&s, 10, 0x7fffffff));
+	TEST_CHECK(QueuePolicyOverLimit(&s, 11, 0));
+	_SettingsInit(&s, 0, 1000, rqopDropNewest, 0);
+	TEST_CHECK(QueuePolicyDecide(&s, 0x7fffffff, 900, 100, &counter) == qpdAccept);
+	TEST_CHECK(QueuePolicyDecide(&s, 0, 900, 101, &counter) == qpdDrop);
+	// Sizes near the range of the counters do not wrap around.
+	TEST_CHECK(QueuePolicyDecide(&s, 0, 900, 0xffffffff, &counter) == qpdDrop);
+	TEST_CHECK(QueuePolicyDecide(&s, 0, 0x7fffffff, 1, &counter) == qpdDrop);
+
+	// Over-limit events are kept only up to twice the limit.
+	_SettingsInit(&s, 10, 0, rqopDropOldest, 0);
+	TEST_CHECK(QueuePolicyDecide(&s, 10, 0, 1, &counter) == qpdAcceptTrim);
+	TEST_CHECK(QueuePolicyDecide(&s, 19, 0, 1, &counter) == qpdAcceptTrim);
+	TEST_CHECK(QueuePolicyDecide(&s, 20, 0, 1, &counter) == qpdDrop);
+	_SettingsInit(&s, 10, 0, rqopSample, 1);
+	TEST_CHECK(QueuePolicyDecide(&s, 15, 0, 1, &counter) == qpdAcceptOverLimit);
+	TEST_CHECK(QueuePolicyDecide(&s, 20, 0, 1, &counter) == qpdDrop);
+
+	// Unknown policies drop.
+	_SettingsInit(&s, 10, 0, rqopMax, 0);
+	TEST_CHECK(QueuePolicyDecide(&s, 10, 0, 1, &counter) == qpdDrop);
+
+	return;
+}
+
+
+static void _TestSampleRate(void)
+{
+	ULONG kept = 0;
+	IRPMNDRV_SETTINGS s;
+	volatile LONG counter = 0;
+
+	_SettingsInit(&s, 10, 0, rqopSample, 4);
+	for (ULONG i = 0; i < 400; ++i) {
+		if (QueuePolicyDecide(&s, 12, 0, 1, &counter) == qpdAcceptOverLimit)
+			++kept;
+	}
+
+	TEST_CHECK(kept == 100);
+	TEST_CHECK(counter == 400);
+	// Rate 0 behaves as 1, everything is kept.
+	_SettingsInit(&s, 10, 0, rqopSample, 0);
+	TEST_CHECK(QueuePolicyDecide(&s, 12, 0, 1, &counter) == qpdAcceptOverLimit);
+
+	return;
+}
+
+
+static void _TestSimulation(void)
+{
+	IRPMNDRV_SETTINGS s;
+	static SIM_QUEUE q;
+
+	// Dropping new events keeps the queue within its limits.
+	_SettingsInit(&s, MAX_LENGTH, MAX_SIZE, rqopDropNewest, 0);
+	_Simulate(&s, &q);
+	TEST_CHECK(q.MaxLength <= MAX_LENGTH && q.MaxSize <= MAX_SIZE);
+	TEST_CHECK(q.Dropped > 0 && q.AcceptedOverLimit == 0);
+	TEST_CHECK(q.Accepted + q.Dropped == EVENT_COUNT);
+
+	// Dropping old events stores every new one and exceeds the limits by
+	// one event at most before trimming.
+	_SettingsInit(&s, MAX_LENGTH, MAX_SIZE, rqopDropOldest, 0);
+	_Simulate(&s, &q);
+	TEST_CHECK(q.Dropped == 0 && q.Accepted == EVENT_COUNT);
+	TEST_CHECK(q.MaxLength <= MAX_LENGTH + 1 && q.MaxSize <= MAX_SIZE + 16 + 256);
+	TEST_CHECK(!QueuePolicyOverLimit(&s, q.Length, q.Size));
+
+	// Sampling keeps one of every N events over the limits, never more than
+	// twice the limits in total.
+	_SettingsInit(&s, MAX_LENGTH, MAX_SIZE, rqopSample, 8);
+	_Simulate(&s, &q);
+	TEST_CHECK(q.MaxLength <= 2*MAX_LENGTH && q.MaxSize <= 2*MAX_SIZE);
+	TEST_CHECK(q.AcceptedOverLimit > 0);
+	TEST_CHECK(q.Accepted + q.AcceptedOverLimit + q.Dropped == EVENT_COUNT);
+	TEST_CHECK(q.Dropped >= 6*q.AcceptedOverLimit);
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestLimits();
+	_TestSampleRate();
+	_TestSimulation();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,136 @@
+
+/**
+ * @file
+ *
+ * Scaling of IRPMonDllReprocess from 1 to 32 threads over generated
+ * requests: a compiled filter alone, and the filter with a decider and the
+ * hexer parser, both reentrant and serialized as plugins without the
+ * reentrant flags are.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+#include "request-filter-program.h"
+#include "data-parser-types.h"
+#include "dll-decider-types.h"
+#include "parser-base.h"
+#include "irpmondll-types.h"
+#include "reprocess.h"
+#include "request-gen.h"
+#include "bench.h"
+
+
+#define RECORD_COUNT				100000
+#define MAX_THREADS					32
+
+
+/** The hexer parser, built with its own name into test-parsers. */
+DWORD cdecl HexerDataParserInit(uint32_t RequestedVersion, PIRPMON_DATA_PARSER *Parser);
+
+
+static PREQUEST_HEADER _requests[RECORD_COUNT];
+static IRPMON_REPROCESS_RESULT _results[RECORD_COUNT];
+
+
+/** Highlights reads and writes of the system process. */
+static ULONG cdecl _Decide(PREQUEST_GENERAL Request, PDP_REQUEST_EXTRA_INFO ExtraInfo, PDLL_DECIDER_DECISION Decision)
+{
+	const REQUEST_HEADER *h = &Request->RequestTypes.Other;
+
+	(void)ExtraInfo;
+	if (h->Type == ertIRP && h->ProcessId == (HANDLE)4 &&
+		(Request->RequestTypes.Irp.MajorFunction == 3 || Request->RequestTypes.Irp.MajorFunction == 4)) {
+		Decision->Decided = TRUE;
+		Decision->OverrideFilter = TRUE;
+		Decision->Action = ffaHighlight;
+		Decision->HighlightColor = 0xff;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+
+/** Returns millions of requests per second; Selected receives the number of
+ *  the requests selected. */
+static double _Measure(PIRPMON_REPROCESS_SETTINGS Settings, ULONG ThreadCount, PULONG Selected)
+{
+	double start = 0;
+
+	Settings->ThreadCount = ThreadCount;
+	start = BenchNow();
+	ReprocessRun(Settings, (const REQUEST_HEADER * const *)_requests, RECORD_COUNT, _results, NULL, Selected);
+	start = BenchNow() - start;
+	ReprocessFree(Settings, _results, RECORD_COUNT);
+
+	return RECORD_COUNT / start / 1e6;
+}
+
+
+static void _MeasureThreads(const char *Description, PIRPMON_REPROCESS_SETTINGS Settings)
+{
+	ULONG selected = 0;
+	ULONG expected = 0;
+	double rate = 0;
+
+	printf("%s\n", Description);
+	for (ULONG threadCount = 1; threadCount <= MAX_THREADS; threadCount *= 2) {
+		rate = _Measure(Settings, threadCount, &selected);
+		if (threadCount == 1)
+			expected = selected;
+
+		printf("  %2u threads: %7.3f M requests/s, %u selected%s\n", threadCount, rate, selected,
+			(selected == expected) ? "" : " MISMATCH");
+	}
+
+	return;
+}
+
+
+int main(void)
+{
+	IRPMON_REPROCESS_SETTINGS settings;
+	TEST_REQUEST_GEN gen;
+	PREQUEST_FILTER_HEADER filter = NULL;
+	PREQUEST_FILTER_PROGRAM program = NULL;
+	PIRPMON_DATA_PARSER hexer = NULL;
+
+	TestRequestGenInit(&gen, 42, TRUE);
+	for (ULONG i = 0; i < RECORD_COUNT; ++i)
+		_requests[i] = TestRequestGenerateNext(&gen);
+
+	RequestFilterCreate(&filter);
+	RequestFilterAddCondition(&filter, erpUndefined, rffType, rfoEquals, ertFastIo, 0, NULL, rfaExclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffProcessId, rfoInRange, 4, 8, NULL, rfaExclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffMajor, rfoEquals, 14, 0, NULL, rfaPass, REQUEST_FILTER_CONDITION_NEGATE);
+	RequestFilterAddCondition(&filter, erpUndefined, rffResult, rfoEquals, 0, 0, NULL, rfaExclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffAdmin, rfoEquals, 1, 0, NULL, rfaInclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffIrql, rfoGreater, 0, 0, NULL, rfaInclude, 0);
+	if (RequestFilterProgramCompile(filter, NULL, NULL, &program) == ERROR_VALUE_SUCCESS &&
+		HexerDataParserInit(IRPMON_DATA_PARSER_VERSION_3, &hexer) == ERROR_SUCCESS) {
+		printf("Reprocessing %u requests\n", RECORD_COUNT);
+		memset(&settings, 0, sizeof(settings));
+		settings.Filter = program;
+		_MeasureThreads("Filter", &settings);
+		settings.Decider = _Decide;
+		settings.DeciderFlags = DLL_DECIDER_FLAG_REENTRANT;
+		settings.DeciderAction = ffaInclude;
+		settings.Parsers = &hexer;
+		settings.ParserCount = 1;
+		_MeasureThreads("Filter, decider and hexer, all reentrant", &settings);
+		settings.DeciderFlags = 0;
+		hexer->Flags &= ~DP_FLAG_REENTRANT;
+		_MeasureThreads("Filter, decider and hexer, plugins serialized", &settings);
+		PBaseDataParserFree(hexer);
+	}
+
+	if (program != NULL)
+		RequestFilterProgramFree(program);
+
+	RequestFilterFree(filter);
+	for (ULONG i = 0; i < RECORD_COUNT; ++i)
+		RequestMemoryFree(_requests[i]);
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+
+/**
+ * @file
+ *
+ * Costs of the driver's Event Queue: draining a queue filled through the
+ * lists of 1 to 16 processors one request at a time and in batches, and
+ * the throughput of 1 to 16 producers inserting while a consumer drains
+ * the queue in batches.
+ */
+
+#include "req-queue.c"
+#include "bench.h"
+
+
+#define FILL_COUNT					200000
+#define REQUESTS_PER_PRODUCER		200000
+#define BATCH_LENGTH				(64*1024)
+
+
+static IRPMNDRV_SETTINGS _settings;
+static volatile LONG _producersRunning = 0;
+
+
+PIRPMNDRV_SETTINGS DriverSettingsGet(void)
+{
+	return &_settings;
+}
+
+NTSTATUS ListProcessesByEvents(PLIST_ENTRY EventListHead)
+{
+	UNREFERENCED_PARAMETER(EventListHead);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS _GetObjectName(PVOID Object, PUNICODE_STRING Name)
+{
+	UNREFERENCED_PARAMETER(Object);
+	UNREFERENCED_PARAMETER(Name);
+
+	return STATUS_NOT_IMPLEMENTED;
+}
+
+NTSTATUS _GetDriversInDirectory(PUNICODE_STRING Directory, PDRIVER_OBJECT **DriverArray, PSIZE_T DriverCount)
+{
+	UNREFERENCED_PARAMETER(Directory);
+	UNREFERENCED_PARAMETER(DriverArray);
+	UNREFERENCED_PARAMETER(DriverCount);
+
+	return STATUS_NOT_IMPLEMENTED;
+}
+
+NTSTATUS _EnumDriverDevices(PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT **DeviceArray, PULONG DeviceArrayLength)
+{
+	UNREFERENCED_PARAMETER(DriverObject);
+	UNREFERENCED_PARAMETER(DeviceArray);
+	UNREFERENCED_PARAMETER(DeviceArrayLength);
+
+	return STATUS_NOT_IMPLEMENTED;
+}
+
+VOID _ReleaseDriverArray(PDRIVER_OBJECT *DriverArray, SIZE_T DriverCount)
+{
+	UNREFERENCED_PARAMETER(DriverArray);
+	UNREFERENCED_PARAMETER(DriverCount);
+}
+
+VOID _ReleaseDeviceArray(PDEVICE_OBJECT *DeviceArray, SIZE_T ArrayLength)
+{
+	UNREFERENCED_PARAMETER(DeviceArray);
+	UNREFERENCED_PARAMETER(ArrayLength);
+}
+
+
+static void _Insert(void)
+{
+	PREQUEST_IRP r = NULL;
+
+	r = (PREQUEST_IRP)RequestMemoryAlloc(sizeof(REQUEST_IRP));
+	if (r != NULL) {
+		RequestHeaderInit(&r->Header, NULL, NULL, ertIRP);
+		RequestQueueInsert(&r->Header);
+	}
+
+	return;
+}
+
+
+/** Drains the queue in batches; returns the number of requests removed. */
+static ULONG _DrainBatches(void)
+{
+	ULONG ret = 0;
+	ULONG count = 0;
+	ULONG dropped = 0;
+	SIZE_T length = 0;
+	BOOLEAN more = FALSE;
+	LIST_ENTRY batch;
+
+	InitializeListHead(&batch);
+	while (RequestQueueGetBatch(&batch, BATCH_LENGTH, &length, &count, &dropped, &more) == STATUS_SUCCESS) {
+		ret += count;
+		while (!IsListEmpty(&batch))
+			RequestMemoryFree(CONTAINING_RECORD(RemoveHeadList(&batch), REQUEST_HEADER, Entry));
+	}
+
+	return ret;
+}
+
+
+/** Returns nanoseconds per drained request. */
+static double _MeasureDrain(ULONG ProcessorCount, BOOLEAN Batches)
+{
+	double start = 0;
+	ULONG count = 0;
+	SIZE_T length = 0;
+	PREQUEST_HEADER h = NULL;
+
+	for (ULONG i = 0; i < FILL_COUNT; ++i) {
+		ShimProcessor = i % ProcessorCount;
+		_Insert();
+	}
+
+	ShimProcessor = 0;
+	start = BenchNow();
+	if (!Batches) {
+		length = sizeof(REQUEST_IRP);
+		while (RequestQueueGet(&h, &length) == STATUS_SUCCESS) {
+			RequestMemoryFree(h);
+			++count;
+		}
+	} else count = _DrainBatches();
+
+	start = BenchNow() - start;
+	if (count != FILL_COUNT)
+		printf("  unexpected number of requests drained: %u\n", count);
+
+	return start * 1e9 / FILL_COUNT;
+}
+
+
+static void *_ProducerThread(void *Context)
+{
+	ShimProcessor = (ULONG)(ULONG_PTR)Context;
+	for (ULONG i = 0; i < REQUESTS_PER_PRODUCER; ++i)
+		_Insert();
+
+	InterlockedDecrement(&_producersRunning);
+
+	return NULL;
+}
+
+
+/** Returns millions of requests per second passing through the queue. */
+static double _MeasureProducers(ULONG ThreadCount)
+{
+	double start = 0;
+	ULONG count = 0;
+	BOOLEAN done = FALSE;
+	pthread_t threads[SHIM_PROCESSOR_COUNT];
+
+	_producersRunning = ThreadCount;
+	start = BenchNow();
+	for (ULONG_PTR i = 0; i < ThreadCount; ++i)
+		pthread_create(threads + i, NULL, _ProducerThread, (void *)i);
+
+	while (!done) {
+		done = (_producersRunning == 0);
+		count += _DrainBatches();
+		sched_yield();
+	}
+
+	for (ULONG i = 0; i < ThreadCount; ++i)
+		pthread_join(threads[i], NULL);
+
+	start = BenchNow() - start;
+	if (count != REQUESTS_PER_PRODUCER*ThreadCount)
+		printf("  unexpected number of requests drained: %u\n", count);
+
+	return (double)count / start / 1e6;
+}
+
+
+int main(void)
+{
+	RequestMemoryModuleInit(NULL, NULL, NULL);
+	RequestQueueModuleInit(NULL, NULL, NULL);
+	RequestQueueConnect();
+	printf("Draining %u requests\n", FILL_COUNT);
+	for (ULONG processorCount = 1; processorCount <= SHIM_PROCESSOR_COUNT; processorCount *= 4) {
+		printf("  %2u processors: one by one %6.1f ns/request, batches %6.1f ns/request\n", processorCount,
+			_MeasureDrain(processorCount, FALSE), _MeasureDrain(processorCount, TRUE));
+	}
+
+	printf("Producers and a batch consumer\n");
+	for (ULONG threadCount = 1; threadCount <= SHIM_PROCESSOR_COUNT; threadCount *= 2)
+		printf("  %2u producers: %6.2f M requests/s\n", threadCount, _MeasureProducers(threadCount));
+
+	ShimProcessor = 0;
+	RequestQueueDisconnect();
+	RequestQueueModuleFinit(NULL, NULL, NULL);
+	RequestMemoryModuleFinit(NULL, NULL, NULL);
+
+	return 0;
+}
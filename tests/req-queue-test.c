@@ -0,0 +1,355 @@
+
+/**
+ * @file
+ *
+ * Tests of the driver's Event Queue: requests pushed to the lists of
+ * different processors leave the queue merged by their IDs, batches returned
+ * by RequestQueueReturnBatch go back before the rest of the queue, also when
+ * a request with a lower ID is pushed while the batch is out, and concurrent
+ * producers and a consumer returning some of its batches lose nothing.
+ */
+
+#include "req-queue.c"
+#include "test.h"
+
+
+#define THREAD_COUNT				8
+#define REQUESTS_PER_THREAD			20000
+#define BATCH_LENGTH				(16*sizeof(REQUEST_IRP))
+
+
+static IRPMNDRV_SETTINGS _settings;
+static volatile LONG _producersRunning = 0;
+static ULONG _consumed[THREAD_COUNT];
+
+
+/************************************************************************/
+/*                   DRIVER ROUTINES THE QUEUE CALLS                    */
+/************************************************************************/
+
+PIRPMNDRV_SETTINGS DriverSettingsGet(void)
+{
+	return &_settings;
+}
+
+NTSTATUS ListProcessesByEvents(PLIST_ENTRY EventListHead)
+{
+	UNREFERENCED_PARAMETER(EventListHead);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS _GetObjectName(PVOID Object, PUNICODE_STRING Name)
+{
+	UNREFERENCED_PARAMETER(Object);
+	UNREFERENCED_PARAMETER(Name);
+
+	return STATUS_NOT_IMPLEMENTED;
+}
+
+NTSTATUS _GetDriversInDirectory(PUNICODE_STRING Directory, PDRIVER_OBJECT **DriverArray, PSIZE_T DriverCount)
+{
+	UNREFERENCED_PARAMETER(Directory);
+	UNREFERENCED_PARAMETER(DriverArray);
+	UNREFERENCED_PARAMETER(DriverCount);
+
+	return STATUS_NOT_IMPLEMENTED;
+}
+
+NTSTATUS _EnumDriverDevices(PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT **DeviceArray, PULONG DeviceArrayLength)
+{
+	UNREFERENCED_PARAMETER(DriverObject);
+	UNREFERENCED_PARAMETER(DeviceArray);
+	UNREFERENCED_PARAMETER(DeviceArrayLength);
+
+	return STATUS_NOT_IMPLEMENTED;
+}
+
+VOID _ReleaseDriverArray(PDRIVER_OBJECT *DriverArray, SIZE_T DriverCount)
+{
+	UNREFERENCED_PARAMETER(DriverArray);
+	UNREFERENCED_PARAMETER(DriverCount);
+}
+
+VOID _ReleaseDeviceArray(PDEVICE_OBJECT *DeviceArray, SIZE_T ArrayLength)
+{
+	UNREFERENCED_PARAMETER(DeviceArray);
+	UNREFERENCED_PARAMETER(ArrayLength);
+}
+
+
+/************************************************************************/
+/*                   HELPERS                                            */
+/************************************************************************/
+
+/** Creates a request tagged by its producer and sequence number. The ID is
+ *  assigned when the request enters the queue. */
+static PREQUEST_HEADER _RequestCreate(ULONG Producer, ULONG Sequence)
+{
+	PREQUEST_IRP ret = NULL;
+
+	ret = (PREQUEST_IRP)RequestMemoryAlloc(sizeof(REQUEST_IRP));
+	if (ret != NULL)
+		RequestHeaderInit(&ret->Header, (PDRIVER_OBJECT)((ULONG_PTR)Producer + 1), (PDEVICE_OBJECT)(ULONG_PTR)Sequence, ertIRP);
+
+	return &ret->Header;
+}
+
+static ULONG _Producer(const REQUEST_HEADER *Header)
+{
+	return (ULONG)((ULONG_PTR)Header->Driver - 1);
+}
+
+static ULONG _Sequence(const REQUEST_HEADER *Header)
+{
+	return (ULONG)(ULONG_PTR)Header->Device;
+}
+
+/** Inserts a request on a given processor; returns its ID. */
+static ULONG _Insert(ULONG Processor, ULONG Sequence)
+{
+	PREQUEST_HEADER h = NULL;
+
+	ShimProcessor = Processor;
+	h = _RequestCreate(Processor, Sequence);
+	RequestQueueInsert(h);
+	ShimProcessor = 0;
+
+	return h->Id;
+}
+
+/** Takes a batch and checks its IDs are increasing and its length right. */
+static NTSTATUS _BatchGet(PLIST_ENTRY ListHead, SIZE_T MaxLength, PULONG Count, PULONG DroppedCount, PBOOLEAN MoreAvailable)
+{
+	ULONG n = 0;
+	ULONG lastId = 0;
+	SIZE_T length = 0;
+	PLIST_ENTRY e = NULL;
+	PREQUEST_HEADER h = NULL;
+	NTSTATUS ret = STATUS_UNSUCCESSFUL;
+
+	InitializeListHead(ListHead);
+	ret = RequestQueueGetBatch(ListHead, MaxLength, &length, Count, DroppedCount, MoreAvailable);
+	if (ret == STATUS_SUCCESS) {
+		for (e = ListHead->Flink; e != ListHead; e = e->Flink) {
+			h = CONTAINING_RECORD(e, REQUEST_HEADER, Entry);
+			TEST_CHECK(n == 0 || h->Id > lastId);
+			lastId = h->Id;
+			++n;
+		}
+
+		TEST_CHECK(n == *Count);
+		TEST_CHECK(length == n*sizeof(REQUEST_IRP) && length <= MaxLength);
+	} else TEST_CHECK(*Count == 0 && *DroppedCount == 0 && IsListEmpty(ListHead));
+
+	return ret;
+}
+
+/** Drains the queue and checks the requests come with the given IDs, and
+ *  that the drops are reported with the first batch. */
+static void _DrainExpect(const ULONG *Ids, ULONG Count, ULONG DroppedCount)
+{
+	ULONG n = 0;
+	ULONG count = 0;
+	ULONG dropped = 0;
+	BOOLEAN more = FALSE;
+	LIST_ENTRY batch;
+	PREQUEST_HEADER h = NULL;
+
+	while (_BatchGet(&batch, BATCH_LENGTH, &count, &dropped, &more) == STATUS_SUCCESS) {
+		TEST_CHECK(dropped == ((n == 0) ? DroppedCount : 0));
+		while (!IsListEmpty(&batch)) {
+			h = CONTAINING_RECORD(RemoveHeadList(&batch), REQUEST_HEADER, Entry);
+			TEST_CHECK(n < Count && h->Id == Ids[n]);
+			++n;
+			RequestMemoryFree(h);
+		}
+
+		TEST_CHECK(more == (n < Count));
+	}
+
+	TEST_CHECK(n == Count);
+	TEST_CHECK(_settings.ReqQueueLength == 0 && _settings.ReqQueueSize == 0);
+	TEST_CHECK(_settings.ReqQueuePagedLength == 0 && _settings.ReqQueueNonPagedLength == 0);
+
+	return;
+}
+
+
+/************************************************************************/
+/*                   TESTS                                              */
+/************************************************************************/
+
+/** Requests spread over all processors in a scrambled order come out
+ *  merged by their IDs; the size limit splits them into batches. */
+static void _TestMerge(void)
+{
+	ULONG count = 0;
+	SIZE_T length = 0;
+	ULONG dropped = 0;
+	BOOLEAN more = FALSE;
+	LIST_ENTRY batch;
+	ULONG ids[10 * SHIM_PROCESSOR_COUNT];
+
+	for (ULONG i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i)
+		ids[i] = _Insert((i * 7) % SHIM_PROCESSOR_COUNT, i);
+
+	TEST_CHECK(_settings.ReqQueueLength == (LONG)(sizeof(ids) / sizeof(ids[0])));
+	InitializeListHead(&batch);
+	TEST_CHECK(RequestQueueGetBatch(&batch, sizeof(REQUEST_IRP) - 1, &length, &count, &dropped, &more) == STATUS_BUFFER_TOO_SMALL);
+	TEST_CHECK(length == sizeof(REQUEST_IRP) && count == 0 && more);
+	_DrainExpect(ids, sizeof(ids) / sizeof(ids[0]), 0);
+	TEST_CHECK(_BatchGet(&batch, BATCH_LENGTH, &count, &dropped, &more) == STATUS_NO_MORE_ENTRIES);
+	TEST_CHECK(!more);
+
+	return;
+}
+
+
+/** A returned batch goes before the requests left in the queue, although
+ *  none of them was taken from the list of processor 0. */
+static void _TestReturnBatch(void)
+{
+	ULONG count = 0;
+	ULONG dropped = 0;
+	BOOLEAN more = FALSE;
+	LIST_ENTRY batch;
+	ULONG ids[40];
+
+	for (ULONG i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i)
+		ids[i] = _Insert(1 + i % (SHIM_PROCESSOR_COUNT - 1), i);
+
+	TEST_CHECK(_BatchGet(&batch, BATCH_LENGTH, &count, &dropped, &more) == STATUS_SUCCESS);
+	TEST_CHECK(count == 16 && more);
+	TEST_CHECK(CONTAINING_RECORD(batch.Flink, REQUEST_HEADER, Entry)->Id == ids[0]);
+	TEST_CHECK(_settings.ReqQueueLength == (LONG)(sizeof(ids) / sizeof(ids[0]) - count));
+	RequestQueueReturnBatch(&batch, 0);
+	TEST_CHECK(IsListEmpty(&batch));
+	TEST_CHECK(_settings.ReqQueueLength == (LONG)(sizeof(ids) / sizeof(ids[0])));
+	TEST_CHECK(_settings.ReqQueueSize == (LONG)(sizeof(ids) / sizeof(ids[0])*sizeof(REQUEST_IRP)));
+	// Take and return the batch again, now from the list of processor 0.
+	TEST_CHECK(_BatchGet(&batch, BATCH_LENGTH, &count, &dropped, &more) == STATUS_SUCCESS);
+	TEST_CHECK(count == 16 && CONTAINING_RECORD(batch.Flink, REQUEST_HEADER, Entry)->Id == ids[0]);
+	RequestQueueReturnBatch(&batch, 3);
+	_DrainExpect(ids, sizeof(ids) / sizeof(ids[0]), 3);
+
+	return;
+}
+
+
+/** A producer takes its ID before the consumer takes a batch with higher
+ *  IDs, but pushes the request to the list of processor 0 only after it.
+ *  Once the batch is returned, the request must go between its requests.
+ */
+static void _TestReturnBatchLatePush(void)
+{
+	ULONG count = 0;
+	ULONG dropped = 0;
+	BOOLEAN more = FALSE;
+	LIST_ENTRY batch;
+	PREQUEST_HEADER late = NULL;
+	ULONG ids[21];
+
+	for (ULONG i = 0; i < 5; ++i)
+		ids[i] = _Insert(2 + i % 3, i);
+
+	late = _RequestCreate(0, 5);
+	late->Id = InterlockedIncrement(&_settings.ReqQueueLastRequestId);
+	ids[5] = late->Id;
+	for (ULONG i = 6; i < sizeof(ids) / sizeof(ids[0]); ++i)
+		ids[i] = _Insert((i % 2 == 0) ? 0 : 3, i);
+
+	TEST_CHECK(_BatchGet(&batch, 10*sizeof(REQUEST_IRP), &count, &dropped, &more) == STATUS_SUCCESS);
+	TEST_CHECK(count == 10 && more);
+	TEST_CHECK(CONTAINING_RECORD(batch.Blink, REQUEST_HEADER, Entry)->Id > late->Id);
+	_RequestInsert(late);
+	RequestQueueReturnBatch(&batch, 0);
+	_DrainExpect(ids, sizeof(ids) / sizeof(ids[0]), 0);
+
+	return;
+}
+
+
+static void *_ProducerThread(void *Context)
+{
+	ULONG_PTR t = (ULONG_PTR)Context;
+
+	ShimProcessor = (ULONG)(t * 2 % SHIM_PROCESSOR_COUNT);
+	for (ULONG i = 0; i < REQUESTS_PER_THREAD; ++i)
+		RequestQueueInsert(_RequestCreate((ULONG)t, i));
+
+	InterlockedDecrement(&_producersRunning);
+
+	return NULL;
+}
+
+
+/** Producers on different processors insert while the consumer drains the
+ *  queue and returns every third batch. Every request must arrive exactly
+ *  once, and the requests of each producer in the order they were inserted.
+ */
+static void _TestConcurrent(void)
+{
+	ULONG count = 0;
+	ULONG dropped = 0;
+	ULONG batchIndex = 0;
+	BOOLEAN more = FALSE;
+	BOOLEAN done = FALSE;
+	LIST_ENTRY batch;
+	PREQUEST_HEADER h = NULL;
+	pthread_t threads[THREAD_COUNT];
+
+	memset(_consumed, 0, sizeof(_consumed));
+	_producersRunning = THREAD_COUNT;
+	for (ULONG_PTR t = 0; t < THREAD_COUNT; ++t)
+		pthread_create(threads + t, NULL, _ProducerThread, (void *)t);
+
+	while (!done) {
+		// Read the flag first, so no request can be pushed after the final empty batch.
+		done = (_producersRunning == 0);
+		while (_BatchGet(&batch, BATCH_LENGTH, &count, &dropped, &more) == STATUS_SUCCESS) {
+			TEST_CHECK(dropped == 0);
+			if (++batchIndex % 3 == 0) {
+				RequestQueueReturnBatch(&batch, 0);
+				continue;
+			}
+
+			while (!IsListEmpty(&batch)) {
+				h = CONTAINING_RECORD(RemoveHeadList(&batch), REQUEST_HEADER, Entry);
+				TEST_CHECK(_Producer(h) < THREAD_COUNT);
+				TEST_CHECK(_Sequence(h) == _consumed[_Producer(h)]);
+				++_consumed[_Producer(h)];
+				RequestMemoryFree(h);
+			}
+		}
+
+		sched_yield();
+	}
+
+	for (ULONG t = 0; t < THREAD_COUNT; ++t) {
+		pthread_join(threads[t], NULL);
+		TEST_CHECK(_consumed[t] == REQUESTS_PER_THREAD);
+	}
+
+	TEST_CHECK(_settings.ReqQueueLength == 0 && _settings.ReqQueueSize == 0);
+
+	return;
+}
+
+
+int main(void)
+{
+	TEST_CHECK(RequestMemoryModuleInit(NULL, NULL, NULL) == STATUS_SUCCESS);
+	TEST_CHECK(RequestQueueModuleInit(NULL, NULL, NULL) == STATUS_SUCCESS);
+	TEST_CHECK(RequestQueueConnect() == STATUS_SUCCESS);
+	TEST_CHECK(RequestQueueConnect() == STATUS_ALREADY_REGISTERED);
+	_TestMerge();
+	_TestReturnBatch();
+	_TestReturnBatchLatePush();
+	_TestConcurrent();
+	TEST_CHECK(RequestQueueDisconnect() == STATUS_SUCCESS);
+	RequestQueueModuleFinit(NULL, NULL, NULL);
+	RequestMemoryModuleFinit(NULL, NULL, NULL);
+
+	return TEST_RESULT();
+}
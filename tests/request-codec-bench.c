@@ -0,0 +1,83 @@
+
+/**
+ * @file
+ *
+ * Size and speed of the compact request encoding on a realistic stream,
+ * compared with the raw records the log stored before.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-codec.h"
+#include "request-gen.h"
+#include "bench.h"
+
+
+#define RECORD_COUNT				200000
+#define ROUND_COUNT					5
+
+
+int main(void)
+{
+	size_t rawSize = 0;
+	size_t encodedSize = 0;
+	size_t written = 0;
+	size_t consumed = 0;
+	size_t offset = 0;
+	size_t capacity = 0;
+	double start = 0;
+	double encodeTime = 0;
+	double decodeTime = 0;
+	PUCHAR buffer = NULL;
+	PREQUEST_HEADER r = NULL;
+	PREQUEST_HEADER *requests = NULL;
+	REQUEST_CODEC_STATE state;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 42, TRUE);
+	requests = (PREQUEST_HEADER *)calloc(RECORD_COUNT, sizeof(PREQUEST_HEADER));
+	for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+		requests[i] = TestRequestGenerateNext(&gen);
+		rawSize += RequestGetSize(requests[i]);
+		capacity += RequestCodecEncodedSizeMax(requests[i]);
+	}
+
+	buffer = (PUCHAR)malloc(capacity);
+	for (ULONG round = 0; round < ROUND_COUNT; ++round) {
+		start = BenchNow();
+		RequestCodecInit(&state);
+		encodedSize = 0;
+		for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+			RequestCodecEncode(&state, requests[i], buffer + encodedSize, capacity - encodedSize, &written);
+			encodedSize += written;
+		}
+
+		encodeTime += BenchNow() - start;
+		start = BenchNow();
+		RequestCodecInit(&state);
+		offset = 0;
+		for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+			if (RequestCodecDecode(&state, buffer + offset, encodedSize - offset, &consumed, &r) != ERROR_VALUE_SUCCESS)
+				break;
+
+			offset += consumed;
+			RequestMemoryFree(r);
+		}
+
+		decodeTime += BenchNow() - start;
+	}
+
+	printf("records:          %u\n", RECORD_COUNT);
+	printf("raw size:         %zu bytes (%.1f per record)\n", rawSize, (double)rawSize / RECORD_COUNT);
+	printf("encoded size:     %zu bytes (%.1f per record, %.1f %% of raw)\n", encodedSize, (double)encodedSize / RECORD_COUNT, 100.0*encodedSize / rawSize);
+	printf("encode:           %.0f records/s, %.1f MB/s of raw records\n", ROUND_COUNT*RECORD_COUNT / encodeTime, BenchMBps((double)ROUND_COUNT*rawSize, encodeTime));
+	printf("decode:           %.0f records/s, %.1f MB/s of raw records\n", ROUND_COUNT*RECORD_COUNT / decodeTime, BenchMBps((double)ROUND_COUNT*rawSize, decodeTime));
+	for (ULONG i = 0; i < RECORD_COUNT; ++i)
+		RequestMemoryFree(requests[i]);
+
+	free(requests);
+	free(buffer);
+
+	return 0;
+}
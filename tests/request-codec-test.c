@@ -0,0 +1,248 @@
+
+/**
+ * @file
+ *
+ * Tests of the compact request encoding. Streams of generated requests of
+ * every type must decode to the exact records that were encoded, truncated
+ * records must be reported as incomplete without touching the state, and
+ * corrupted streams must be rejected or decode to well-formed records,
+ * never read or write out of bounds.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-codec.h"
+#include "request-gen.h"
+#include "test.h"
+
+
+#define RECORD_COUNT				20000
+#define CORRUPTION_COUNT			2000
+
+
+typedef struct _ENCODED_STREAM {
+	PUCHAR Data;
+	size_t Size;
+	ULONG Count;
+	PREQUEST_HEADER Requests[RECORD_COUNT];
+	size_t Offsets[RECORD_COUNT + 1];
+} ENCODED_STREAM, *PENCODED_STREAM;
+
+
+static ENCODED_STREAM _stream;
+
+
+static void _StreamBuild(PENCODED_STREAM Stream, ULONG64 Seed, BOOLEAN Realistic)
+{
+	size_t capacity = 0;
+	size_t written = 0;
+	PREQUEST_HEADER r = NULL;
+	REQUEST_CODEC_STATE state;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, Seed, Realistic);
+	RequestCodecInit(&state);
+	Stream->Size = 0;
+	Stream->Count = RECORD_COUNT;
+	capacity = 0x10000;
+	Stream->Data = (PUCHAR)malloc(capacity);
+	for (ULONG i = 0; i < Stream->Count; ++i) {
+		// Every type at least once, then at random.
+		if (i < REQUEST_TYPE_COUNT - ertIRP)
+			r = TestRequestGenerate(&gen, (ERequesttype)(ertIRP + i));
+		else r = TestRequestGenerateNext(&gen);
+
+		TEST_CHECK(r != NULL && RequestValidate(r, RequestGetSize(r)));
+		if (capacity - Stream->Size < RequestCodecEncodedSizeMax(r)) {
+			capacity *= 2;
+			Stream->Data = (PUCHAR)realloc(Stream->Data, capacity);
+		}
+
+		Stream->Requests[i] = r;
+		Stream->Offsets[i] = Stream->Size;
+		TEST_CHECK(RequestCodecEncode(&state, r, Stream->Data + Stream->Size, capacity - Stream->Size, &written) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(written <= RequestCodecEncodedSizeMax(r));
+		Stream->Size += written;
+	}
+
+	Stream->Offsets[Stream->Count] = Stream->Size;
+
+	return;
+}
+
+
+static void _StreamFree(PENCODED_STREAM Stream)
+{
+	for (ULONG i = 0; i < Stream->Count; ++i)
+		RequestMemoryFree(Stream->Requests[i]);
+
+	free(Stream->Data);
+	memset(Stream, 0, sizeof(ENCODED_STREAM));
+
+	return;
+}
+
+
+static void _TestRoundTrip(BOOLEAN Realistic)
+{
+	size_t offset = 0;
+	size_t consumed = 0;
+	size_t rawSize = 0;
+	PREQUEST_HEADER r = NULL;
+	REQUEST_CODEC_STATE state;
+
+	_StreamBuild(&_stream, 0x1234, Realistic);
+	RequestCodecInit(&state);
+	for (ULONG i = 0; i < _stream.Count; ++i) {
+		TEST_CHECK(offset == _stream.Offsets[i]);
+		TEST_CHECK(RequestCodecDecode(&state, _stream.Data + offset, _stream.Size - offset, &consumed, &r) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(consumed == _stream.Offsets[i + 1] - _stream.Offsets[i]);
+		TEST_CHECK(RequestGetSize(r) == RequestGetSize(_stream.Requests[i]));
+		TEST_CHECK(memcmp(r, _stream.Requests[i], RequestGetSize(r)) == 0);
+		rawSize += RequestGetSize(r);
+		offset += consumed;
+		RequestMemoryFree(r);
+	}
+
+	TEST_CHECK(offset == _stream.Size);
+	TEST_CHECK(RequestCodecDecode(&state, _stream.Data + offset, 0, &consumed, &r) == ERROR_VALUE_BUFFER_TOO_SMALL);
+	// Headers and repeated addresses of a realistic stream shrink, the data do not.
+	if (Realistic)
+		TEST_CHECK(_stream.Size < rawSize*2 / 3);
+
+	_StreamFree(&_stream);
+
+	return;
+}
+
+
+/** Incomplete records neither succeed nor change the state. */
+static void _TestTruncation(void)
+{
+	size_t consumed = 0;
+	size_t written = 0;
+	size_t length = 0;
+	PREQUEST_HEADER r = NULL;
+	REQUEST_CODEC_STATE state;
+	REQUEST_CODEC_STATE saved;
+	UCHAR buffer[0x1000];
+
+	_StreamBuild(&_stream, 0x5678, FALSE);
+	RequestCodecInit(&state);
+	for (ULONG i = 0; i < 500; ++i) {
+		length = _stream.Offsets[i + 1] - _stream.Offsets[i];
+		memcpy(&saved, &state, sizeof(state));
+		for (size_t j = 0; j < length; ++j) {
+			TEST_CHECK(RequestCodecDecode(&state, _stream.Data + _stream.Offsets[i], j, &consumed, &r) == ERROR_VALUE_BUFFER_TOO_SMALL);
+			TEST_CHECK(memcmp(&saved, &state, sizeof(state)) == 0);
+		}
+
+		TEST_CHECK(RequestCodecDecode(&state, _stream.Data + _stream.Offsets[i], length, &consumed, &r) == ERROR_VALUE_SUCCESS);
+		RequestMemoryFree(r);
+	}
+
+	// The same for the encoder and small buffers.
+	RequestCodecInit(&state);
+	for (ULONG i = 0; i < 500; ++i) {
+		length = _stream.Offsets[i + 1] - _stream.Offsets[i];
+		memcpy(&saved, &state, sizeof(state));
+		for (size_t j = 0; j < length; ++j) {
+			TEST_CHECK(RequestCodecEncode(&state, _stream.Requests[i], buffer, j, &written) == ERROR_VALUE_BUFFER_TOO_SMALL);
+			TEST_CHECK(memcmp(&saved, &state, sizeof(state)) == 0);
+		}
+
+		TEST_CHECK(RequestCodecEncode(&state, _stream.Requests[i], buffer, sizeof(buffer), &written) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(written == length && memcmp(buffer, _stream.Data + _stream.Offsets[i], length) == 0);
+	}
+
+	_StreamFree(&_stream);
+
+	return;
+}
+
+
+/** Random bytes of a stream are damaged; every decoded record must still be
+ *  well-formed and the decoder must stop within the stream. */
+static void _TestCorruption(void)
+{
+	size_t offset = 0;
+	size_t consumed = 0;
+	ULONG decoded = 0;
+	PUCHAR copy = NULL;
+	PREQUEST_HEADER r = NULL;
+	REQUEST_CODEC_STATE state;
+	TEST_REQUEST_GEN gen;
+	ERROR_TYPE err = ERROR_VALUE_SUCCESS;
+
+	_StreamBuild(&_stream, 0x9abc, FALSE);
+	TestRequestGenInit(&gen, 0xdef0, FALSE);
+	copy = (PUCHAR)malloc(_stream.Size);
+	for (ULONG i = 0; i < CORRUPTION_COUNT; ++i) {
+		memcpy(copy, _stream.Data, _stream.Size);
+		for (ULONG j = 0; j < 1 + i % 4; ++j)
+			copy[TestRequestGenRandom(&gen) % _stream.Size] ^= (UCHAR)(1 + TestRequestGenRandom(&gen) % 255);
+
+		offset = 0;
+		decoded = 0;
+		RequestCodecInit(&state);
+		do {
+			err = RequestCodecDecode(&state, copy + offset, _stream.Size - offset, &consumed, &r);
+			if (err == ERROR_VALUE_SUCCESS) {
+				TEST_CHECK(consumed > 0 && consumed <= _stream.Size - offset);
+				TEST_CHECK(RequestValidate(r, RequestGetSize(r)));
+				offset += consumed;
+				++decoded;
+				RequestMemoryFree(r);
+			}
+		} while (err == ERROR_VALUE_SUCCESS && decoded < 64);
+
+		TEST_CHECK(err == ERROR_VALUE_SUCCESS || err == ERROR_VALUE_INVAL || err == ERROR_VALUE_BUFFER_TOO_SMALL);
+	}
+
+	free(copy);
+	_StreamFree(&_stream);
+
+	return;
+}
+
+
+static void _TestInvalid(void)
+{
+	size_t consumed = 0;
+	size_t written = 0;
+	UCHAR buffer[0x100];
+	PREQUEST_HEADER r = NULL;
+	REQUEST_CODEC_STATE state;
+	REQUEST_HEADER h;
+
+	RequestCodecInit(&state);
+	memset(&h, 0, sizeof(h));
+	h.Type = erpUndefined;
+	TEST_CHECK(RequestCodecEncodedSizeMax(&h) == 0);
+	TEST_CHECK(RequestCodecEncode(&state, &h, buffer, sizeof(buffer), &written) == ERROR_VALUE_INVAL);
+	h.Type = (ERequesttype)REQUEST_TYPE_COUNT;
+	TEST_CHECK(RequestCodecEncode(&state, &h, buffer, sizeof(buffer), &written) == ERROR_VALUE_INVAL);
+	memset(buffer, 0, sizeof(buffer));
+	TEST_CHECK(RequestCodecDecode(&state, buffer, sizeof(buffer), &consumed, &r) == ERROR_VALUE_INVAL);
+	buffer[0] = REQUEST_TYPE_COUNT;
+	TEST_CHECK(RequestCodecDecode(&state, buffer, sizeof(buffer), &consumed, &r) == ERROR_VALUE_INVAL);
+	// An overlong varint
+	buffer[0] = ertAddDevice;
+	memset(buffer + 1, 0xff, 11);
+	TEST_CHECK(RequestCodecDecode(&state, buffer, sizeof(buffer), &consumed, &r) == ERROR_VALUE_INVAL);
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestRoundTrip(FALSE);
+	_TestRoundTrip(TRUE);
+	_TestTruncation();
+	_TestCorruption();
+	_TestInvalid();
+
+	return TEST_RESULT();
+}
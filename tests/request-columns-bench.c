@@ -0,0 +1,117 @@
+
+/**
+ * @file
+ *
+ * Speed of filtering columns with the scalar, SSE2 and AVX2 scans. The
+ * columns are filled from a pool of generated requests, repeated up to
+ * the row count given on the command line (ten million by default; one
+ * hundred million rows need about 3.6 GB).
+ */
+
+#include "request-columns.c"
+#include <locale.h>
+#include <stdlib.h>
+#include "request-gen.h"
+#include "bench.h"
+
+
+#define POOL_SIZE					65536
+#define DEFAULT_ROW_COUNT			10000000
+
+
+static void _Measure(const REQUEST_COLUMNS *Columns, const char *Description, const REQUEST_FILTER_HEADER *Filter, PULONG64 Bitmap)
+{
+	size_t rows = 0;
+	size_t selected = 0;
+	double start = 0;
+	double elapsed = 0;
+	REQUEST_COLUMNS_SCAN_ROUTINE *routines[3];
+	const char *names[3];
+	size_t count = 0;
+
+	routines[count] = _ScanScalar;
+	names[count] = "scalar";
+	++count;
+#if defined(_M_X64) || defined(_M_IX86)
+	routines[count] = _ScanSse2;
+	names[count] = "SSE2";
+	++count;
+	if (_ScanSelect() == _ScanAvx2) {
+		routines[count] = _ScanAvx2;
+		names[count] = "AVX2";
+		++count;
+	}
+#endif
+
+	rows = RequestColumnsCount(Columns);
+	printf("%s\n", Description);
+	for (size_t i = 0; i < count; ++i) {
+		_scanRoutine = routines[i];
+		start = BenchNow();
+		RequestColumnsFilter(Columns, Filter, 0, rows, Bitmap, &selected);
+		elapsed = BenchNow() - start;
+		printf("  %-6s %8.1f M rows/s, %5.1f %% selected\n", names[i], rows / elapsed / 1e6, 100.0*selected / rows);
+	}
+
+	return;
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t rowCount = DEFAULT_ROW_COUNT;
+	double start = 0;
+	ULONG64 *bitmap = NULL;
+	PREQUEST_HEADER *pool = NULL;
+	PREQUEST_COLUMNS columns = NULL;
+	PREQUEST_FILTER_HEADER filter = NULL;
+	TEST_REQUEST_GEN gen;
+
+	setlocale(LC_CTYPE, "C.UTF-8");
+	if (argc > 1)
+		rowCount = (size_t)strtoull(argv[1], NULL, 0);
+
+	TestRequestGenInit(&gen, 42, TRUE);
+	pool = (PREQUEST_HEADER *)calloc(POOL_SIZE, sizeof(PREQUEST_HEADER));
+	for (ULONG i = 0; i < POOL_SIZE; ++i)
+		pool[i] = TestRequestGenerateNext(&gen);
+
+	bitmap = (ULONG64 *)malloc((rowCount / 64 + 1)*sizeof(ULONG64));
+	if (bitmap != NULL && RequestColumnsCreate(rowCount, &columns) == ERROR_VALUE_SUCCESS) {
+		start = BenchNow();
+		for (size_t i = 0; i < rowCount; ++i)
+			RequestColumnsAppend(columns, pool[i % POOL_SIZE]);
+
+		printf("%zu rows appended: %.1f M rows/s\n", rowCount, rowCount / (BenchNow() - start) / 1e6);
+		RequestFilterCreate(&filter);
+		RequestFilterAddCondition(&filter, erpUndefined, rffProcessId, rfoEquals, 4, 0, NULL, rfaExclude, 0);
+		_Measure(columns, "exclude one process", filter, bitmap);
+		RequestFilterFree(filter);
+
+		RequestFilterCreate(&filter);
+		RequestFilterAddCondition(&filter, ertIRP, rffMajor, rfoEquals, 3, 0, NULL, rfaPass, 0);
+		RequestFilterAddCondition(&filter, erpUndefined, rffResult, rfoEquals, 0, 0, NULL, rfaInclude, REQUEST_FILTER_CONDITION_NEGATE);
+		_Measure(columns, "failed IRP reads", filter, bitmap);
+		RequestFilterFree(filter);
+
+		RequestFilterCreate(&filter);
+		RequestFilterAddCondition(&filter, erpUndefined, rffType, rfoEquals, ertFastIo, 0, NULL, rfaExclude, 0);
+		RequestFilterAddCondition(&filter, erpUndefined, rffProcessId, rfoInRange, 4, 8, NULL, rfaExclude, 0);
+		RequestFilterAddCondition(&filter, erpUndefined, rffMajor, rfoEquals, 14, 0, NULL, rfaPass, REQUEST_FILTER_CONDITION_NEGATE);
+		RequestFilterAddCondition(&filter, erpUndefined, rffResult, rfoEquals, 0, 0, NULL, rfaExclude, 0);
+		RequestFilterAddCondition(&filter, erpUndefined, rffThreadId, rfoGreater, 1000, 0, NULL, rfaInclude, 0);
+		RequestFilterAddCondition(&filter, erpUndefined, rffMinor, rfoLowerEquals, 2, 0, NULL, rfaInclude, 0);
+		_Measure(columns, "six conditions, mixed", filter, bitmap);
+		RequestFilterFree(filter);
+
+		RequestColumnsFree(columns);
+	}
+
+	free(bitmap);
+	for (ULONG i = 0; i < POOL_SIZE; ++i)
+		RequestMemoryFree(pool[i]);
+
+	free(pool);
+
+	return 0;
+}
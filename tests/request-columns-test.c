@@ -0,0 +1,377 @@
+
+/**
+ * @file
+ *
+ * Tests of the columnar filter evaluation. The SSE2 and AVX2 scans must set
+ * exactly the bits the scalar scan sets, for any length, alignment, range
+ * and mask, and the scalar scan must agree with a plain comparison. Random
+ * filters evaluated over the columns with each of the scans must select
+ * the rows RequestFilterMatch accepts, or be refused when they test what
+ * the columns do not store. The source is included, so the scans can be
+ * called directly.
+ */
+
+#include "request-columns.c"
+#include <locale.h>
+#include "request-gen.h"
+#include "test.h"
+
+
+#define MAX_VALUES					300
+#define POOL_SIZE					5000
+#define ROUND_COUNT					2000
+#define MAX_CONDITIONS				7
+
+
+typedef struct _SCAN_ROUTINE_RECORD {
+	const char *Name;
+	REQUEST_COLUMNS_SCAN_ROUTINE *Routine;
+} SCAN_ROUTINE_RECORD, *PSCAN_ROUTINE_RECORD;
+
+
+static SCAN_ROUTINE_RECORD _scans[3];
+static size_t _scanCount = 0;
+static PREQUEST_HEADER _pool[POOL_SIZE];
+static ULONG64 _bitmap[POOL_SIZE / 64 + 1];
+
+
+static const ERequestFilterField _columnFields[] = {
+	rffType,
+	rffMajor,
+	rffMinor,
+	rffProcessId,
+	rffThreadId,
+	rffResult,
+	rffDriver,
+	rffDevice,
+};
+
+
+/** Values the range tests fail on most easily. */
+static ULONG _EdgeValue(PTEST_REQUEST_GEN Gen)
+{
+	static const ULONG edges[] = {
+		0, 1, 0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, MAXULONG,
+	};
+	ULONG ret = 0;
+
+	if (TestRequestGenRandom(Gen) % 2 == 0)
+		ret = edges[TestRequestGenRandom(Gen) % (sizeof(edges) / sizeof(edges[0]))];
+	else ret = (ULONG)TestRequestGenRandom(Gen);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     SCANS                                            */
+/************************************************************************/
+
+
+static void _TestScans(void)
+{
+	size_t count = 0;
+	size_t offset = 0;
+	ULONG lower = 0;
+	ULONG range = 0;
+	ULONG mask = 0;
+	BOOLEAN expected = FALSE;
+	static ULONG values[MAX_VALUES + 8];
+	static ULONG64 scalar[MAX_VALUES / 64 + 2];
+	static ULONG64 bits[MAX_VALUES / 64 + 2];
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 0x17, FALSE);
+	for (ULONG round = 0; round < 20000; ++round) {
+		count = (size_t)(TestRequestGenRandom(&gen) % (MAX_VALUES + 1));
+		// Columns are scanned from any row, so from any alignment.
+		offset = (size_t)(TestRequestGenRandom(&gen) % 8);
+		for (size_t i = 0; i < count; ++i) {
+			switch (TestRequestGenRandom(&gen) % 3) {
+				case 0:
+					values[offset + i] = (ULONG)(TestRequestGenRandom(&gen) % 8);
+					break;
+				case 1:
+					values[offset + i] = _EdgeValue(&gen);
+					break;
+				default:
+					values[offset + i] = (ULONG)TestRequestGenRandom(&gen);
+					break;
+			}
+		}
+
+		lower = (TestRequestGenRandom(&gen) % 2 == 0) ? (ULONG)(TestRequestGenRandom(&gen) % 8) : _EdgeValue(&gen);
+		range = (TestRequestGenRandom(&gen) % 2 == 0) ? (ULONG)(TestRequestGenRandom(&gen) % 4) : _EdgeValue(&gen);
+		mask = (TestRequestGenRandom(&gen) % 2 == 0) ? MAXULONG : _EdgeValue(&gen);
+		memset(scalar, 0xcc, sizeof(scalar));
+		_ScanScalar(values + offset, count, lower, range, mask, scalar);
+		for (size_t i = 0; i < count; ++i) {
+			expected = ((ULONG)((values[offset + i] & mask) - lower) <= range);
+			TEST_CHECK(((scalar[i / 64] >> (i % 64)) & 1) == expected);
+		}
+
+		// Bits past the last value are clear, words past it untouched.
+		if (count % 64 != 0)
+			TEST_CHECK((scalar[count / 64] >> (count % 64)) == 0);
+
+		TEST_CHECK(scalar[(count + 63) / 64] == 0xccccccccccccccccULL);
+		for (size_t s = 1; s < _scanCount; ++s) {
+			memset(bits, 0xcc, sizeof(bits));
+			_scans[s].Routine(values + offset, count, lower, range, mask, bits);
+			TEST_CHECK(memcmp(bits, scalar, sizeof(bits)) == 0);
+		}
+	}
+
+	return;
+}
+
+
+/************************************************************************/
+/*                     FILTERS                                          */
+/************************************************************************/
+
+
+static BOOLEAN _FieldValue(const REQUEST_HEADER *Request, ERequestFilterField Field, PULONG64 Value)
+{
+	ULONG v = 0;
+	BOOLEAN ret = TRUE;
+
+	*Value = 0;
+	switch (Field) {
+		case rffType:
+			*Value = Request->Type;
+			break;
+		case rffProcessId:
+			*Value = (ULONG_PTR)Request->ProcessId;
+			break;
+		case rffThreadId:
+			*Value = (ULONG_PTR)Request->ThreadId;
+			break;
+		case rffDriver:
+			*Value = (ULONG_PTR)Request->Driver;
+			break;
+		case rffDevice:
+			*Value = (ULONG_PTR)Request->Device;
+			break;
+		case rffResult:
+			*Value = (ULONG)Request->Result.NTSTATUSValue;
+			break;
+		default:
+			ret = _TypedField(Request, Field, &v);
+			*Value = v;
+			break;
+	}
+
+	return ret;
+}
+
+
+/** Returns TRUE if the columns cannot evaluate the condition. */
+static BOOLEAN _AddRandomCondition(PTEST_REQUEST_GEN Gen, PREQUEST_FILTER_HEADER *Filter)
+{
+	ULONG64 value = 0;
+	ULONG64 valueHigh = 0;
+	ULONG flags = 0;
+	const REQUEST_HEADER *sample = NULL;
+	ERequesttype type = erpUndefined;
+	ERequestFilterField field = rffType;
+	ERequestFilterOperator op = rfoEquals;
+	ERequestFilterAction action = rfaInclude;
+	BOOLEAN ret = FALSE;
+
+	sample = _pool[TestRequestGenRandom(Gen) % POOL_SIZE];
+	if (TestRequestGenRandom(Gen) % 30 == 0)
+		field = rffIrql;
+	else field = _columnFields[TestRequestGenRandom(Gen) % (sizeof(_columnFields) / sizeof(_columnFields[0]))];
+
+	do {
+		op = (ERequestFilterOperator)(TestRequestGenRandom(Gen) % rfoMax);
+	} while (op == rfoDLLDecider);
+
+	// Addresses are mostly tested for equality.
+	if ((field == rffDriver || field == rffDevice) && TestRequestGenRandom(Gen) % 4 != 0)
+		op = (TestRequestGenRandom(Gen) % 4 == 0) ? rfoAlwaysTrue : rfoEquals;
+
+	action = (ERequestFilterAction)(TestRequestGenRandom(Gen) % 6);
+	if (action >= rfaMax)
+		action = rfaPass;
+
+	if (TestRequestGenRandom(Gen) % 3 == 0)
+		type = (TestRequestGenRandom(Gen) % 4 == 0) ? (ERequesttype)(TestRequestGenRandom(Gen) % REQUEST_TYPE_COUNT) : sample->Type;
+
+	if (TestRequestGenRandom(Gen) % 4 == 0)
+		flags |= REQUEST_FILTER_CONDITION_NEGATE;
+
+	if (TestRequestGenRandom(Gen) % 10 == 0)
+		flags |= REQUEST_FILTER_CONDITION_DISABLED;
+
+	_FieldValue(sample, field, &value);
+	if (field != rffDriver && field != rffDevice) {
+		value += TestRequestGenRandom(Gen) % 3 - 1;
+		switch (TestRequestGenRandom(Gen) % 8) {
+			case 0:
+				value = _EdgeValue(Gen);
+				break;
+			case 1:
+				// Beyond the 32 bits of the columns
+				value = 0x100000000ULL + TestRequestGenRandom(Gen) % 2;
+				break;
+		}
+	} else if (TestRequestGenRandom(Gen) % 5 == 0)
+		value = TestRequestGenRandom(Gen);
+
+	valueHigh = value + TestRequestGenRandom(Gen) % 3;
+	if (TestRequestGenRandom(Gen) % 8 == 0)
+		valueHigh = 0x100000000ULL;
+
+	TEST_CHECK(RequestFilterAddCondition(Filter, type, field, op, value, valueHigh, NULL, action, flags) == ERROR_VALUE_SUCCESS);
+	if ((flags & REQUEST_FILTER_CONDITION_DISABLED) == 0) {
+		if (field == rffIrql)
+			ret = TRUE;
+		else if (field == rffDriver || field == rffDevice)
+			ret = (op == rfoLowerEquals || op == rfoGreaterEquals || op == rfoLower || op == rfoGreater || op == rfoInRange);
+	}
+
+	return ret;
+}
+
+
+static void _TestFilters(PREQUEST_COLUMNS Columns, const SCAN_ROUTINE_RECORD *Scan)
+{
+	size_t count = 0;
+	size_t start = 0;
+	size_t rows = 0;
+	size_t selected = 0;
+	size_t passed = 0;
+	BOOLEAN unsupported = FALSE;
+	BOOLEAN match = FALSE;
+	PREQUEST_FILTER_HEADER filter = NULL;
+	TEST_REQUEST_GEN gen;
+	ERROR_TYPE err = ERROR_VALUE_SUCCESS;
+
+	_scanRoutine = Scan->Routine;
+	TestRequestGenInit(&gen, 0x27, FALSE);
+	for (ULONG round = 0; round < ROUND_COUNT; ++round) {
+		TEST_CHECK(RequestFilterCreate(&filter) == ERROR_VALUE_SUCCESS);
+		unsupported = FALSE;
+		count = (size_t)(TestRequestGenRandom(&gen) % (MAX_CONDITIONS + 1));
+		for (size_t i = 0; i < count; ++i)
+			unsupported |= _AddRandomCondition(&gen, &filter);
+
+		// Ranges cross the chunks and start inside words.
+		start = (size_t)(TestRequestGenRandom(&gen) % 200);
+		rows = POOL_SIZE - start - (size_t)(TestRequestGenRandom(&gen) % 200);
+		memset(_bitmap, 0xcc, sizeof(_bitmap));
+		err = RequestColumnsFilter(Columns, filter, start, rows, _bitmap, &selected);
+		if (unsupported)
+			TEST_CHECK(err == ERROR_NOT_SUPPORTED);
+		else {
+			TEST_CHECK(err == ERROR_VALUE_SUCCESS);
+			if (err == ERROR_VALUE_SUCCESS) {
+				passed = 0;
+				for (size_t i = 0; i < rows; ++i) {
+					match = RequestFilterMatch(filter, _pool[start + i], NULL, NULL);
+					if (((_bitmap[i / 64] >> (i % 64)) & 1) != match) {
+						fprintf(stderr, "%s: filter %u, row %zu\n", Scan->Name, round, start + i);
+						TEST_CHECK(FALSE);
+					}
+
+					passed += match;
+				}
+
+				TEST_CHECK(selected == passed);
+				if (rows % 64 != 0)
+					TEST_CHECK((_bitmap[rows / 64] >> (rows % 64)) == 0);
+			}
+		}
+
+		RequestFilterFree(filter);
+	}
+
+	TEST_CHECK(RequestFilterCreate(&filter) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestColumnsFilter(Columns, filter, POOL_SIZE, 1, _bitmap, NULL) == ERROR_VALUE_INVAL);
+	TEST_CHECK(RequestColumnsFilter(Columns, filter, POOL_SIZE, 0, _bitmap, &selected) == ERROR_VALUE_SUCCESS && selected == 0);
+	RequestFilterFree(filter);
+
+	return;
+}
+
+
+/** Columns filled from a view of a flat log equal the ones filled request
+ *  by request. */
+static void _TestAppendView(const REQUEST_COLUMNS *Columns)
+{
+	ULONG recordSize = 0;
+	FILE *f = NULL;
+	PREQUEST_COLUMNS viewColumns = NULL;
+	PREQUEST_LOG_VIEW view = NULL;
+
+	f = fopen("request-columns-test.log", "wb");
+	TEST_CHECK(f != NULL);
+	if (f != NULL) {
+		for (ULONG i = 0; i < POOL_SIZE; ++i) {
+			recordSize = (ULONG)RequestGetSize(_pool[i]);
+			fwrite(&recordSize, sizeof(recordSize), 1, f);
+			fwrite(_pool[i], recordSize, 1, f);
+		}
+
+		fclose(f);
+		TEST_CHECK(RequestLogViewOpen(L"request-columns-test.log", 16, &view) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(RequestColumnsCreate(0, &viewColumns) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(RequestColumnsAppendView(viewColumns, view) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(RequestColumnsCount(viewColumns) == POOL_SIZE);
+		for (int c = 0; c < rcMax; ++c)
+			TEST_CHECK(memcmp(RequestColumnsData(viewColumns, (ERequestColumn)c), RequestColumnsData(Columns, (ERequestColumn)c), POOL_SIZE*sizeof(ULONG)) == 0);
+
+		RequestColumnsFree(viewColumns);
+		RequestLogViewClose(view);
+		remove("request-columns-test.log");
+	}
+
+	return;
+}
+
+
+int main(void)
+{
+	PREQUEST_COLUMNS columns = NULL;
+	TEST_REQUEST_GEN gen;
+
+	setlocale(LC_CTYPE, "C.UTF-8");
+	_scans[_scanCount].Name = "scalar";
+	_scans[_scanCount].Routine = _ScanScalar;
+	++_scanCount;
+#if defined(_M_X64) || defined(_M_IX86)
+	_scans[_scanCount].Name = "SSE2";
+	_scans[_scanCount].Routine = _ScanSse2;
+	++_scanCount;
+	if (_ScanSelect() == _ScanAvx2) {
+		_scans[_scanCount].Name = "AVX2";
+		_scans[_scanCount].Routine = _ScanAvx2;
+		++_scanCount;
+	} else fprintf(stderr, "AVX2 not available, its scan is not tested\n");
+#endif
+
+	_TestScans();
+	// Realistic requests, so that addresses and IDs repeat and fit in 32 bits.
+	TestRequestGenInit(&gen, 0x37, TRUE);
+	TEST_CHECK(RequestColumnsCreate(16, &columns) == ERROR_VALUE_SUCCESS);
+	for (ULONG i = 0; i < POOL_SIZE; ++i) {
+		if (i < REQUEST_TYPE_COUNT - ertIRP)
+			_pool[i] = TestRequestGenerate(&gen, (ERequesttype)(ertIRP + i));
+		else _pool[i] = TestRequestGenerateNext(&gen);
+
+		TEST_CHECK(RequestColumnsAppend(columns, _pool[i]) == ERROR_VALUE_SUCCESS);
+	}
+
+	TEST_CHECK(RequestColumnsCount(columns) == POOL_SIZE);
+	for (size_t s = 0; s < _scanCount; ++s)
+		_TestFilters(columns, _scans + s);
+
+	_TestAppendView(columns);
+	RequestColumnsFree(columns);
+	for (ULONG i = 0; i < POOL_SIZE; ++i)
+		RequestMemoryFree(_pool[i]);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,111 @@
+
+/**
+ * @file
+ *
+ * Speed of deciding generated requests by compiled filters compared with
+ * matching them against the serialized filters, for a few typical filters.
+ */
+
+#include <windows.h>
+#include <locale.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+#include "request-filter-program.h"
+#include "request-gen.h"
+#include "bench.h"
+
+
+#define RECORD_COUNT				500000
+#define PASS_COUNT					5
+
+
+static PREQUEST_HEADER _requests[RECORD_COUNT];
+static BOOLEAN _results[RECORD_COUNT];
+
+
+static BOOLEAN _NameRoutine(void *Context, const void *FileObject, const wchar_t **Name, size_t *Length)
+{
+	(void)Context;
+	(void)FileObject;
+	*Name = L"\\Windows\\System32\\config\\SOFTWARE";
+	*Length = wcslen(*Name);
+
+	return TRUE;
+}
+
+
+static void _Measure(const char *Description, const REQUEST_FILTER_HEADER *Filter)
+{
+	size_t matched = 0;
+	size_t passed = 0;
+	double start = 0;
+	double matchTime = 0;
+	double programTime = 0;
+	PREQUEST_FILTER_PROGRAM program = NULL;
+
+	start = BenchNow();
+	for (ULONG p = 0; p < PASS_COUNT; ++p) {
+		matched = 0;
+		for (ULONG i = 0; i < RECORD_COUNT; ++i)
+			matched += RequestFilterMatch(Filter, _requests[i], _NameRoutine, NULL);
+	}
+
+	matchTime = BenchNow() - start;
+	if (RequestFilterProgramCompile(Filter, _NameRoutine, NULL, &program) == ERROR_VALUE_SUCCESS) {
+		start = BenchNow();
+		for (ULONG p = 0; p < PASS_COUNT; ++p)
+			passed = RequestFilterProgramRunBatch(program, (const REQUEST_HEADER * const *)_requests, RECORD_COUNT, _results);
+
+		programTime = BenchNow() - start;
+		printf("%-28s match %7.2f M/s, program %7.2f M/s, %5.1f %% pass%s\n", Description,
+			RECORD_COUNT*(double)PASS_COUNT / matchTime / 1e6, RECORD_COUNT*(double)PASS_COUNT / programTime / 1e6,
+			100.0*passed / RECORD_COUNT, (passed == matched) ? "" : " MISMATCH");
+		RequestFilterProgramFree(program);
+	}
+
+	return;
+}
+
+
+int main(void)
+{
+	PREQUEST_FILTER_HEADER filter = NULL;
+	TEST_REQUEST_GEN gen;
+
+	setlocale(LC_CTYPE, "C.UTF-8");
+	TestRequestGenInit(&gen, 42, TRUE);
+	for (ULONG i = 0; i < RECORD_COUNT; ++i)
+		_requests[i] = TestRequestGenerateNext(&gen);
+
+	RequestFilterCreate(&filter);
+	RequestFilterAddCondition(&filter, erpUndefined, rffProcessId, rfoEquals, 4, 0, NULL, rfaExclude, 0);
+	_Measure("exclude one process", filter);
+	RequestFilterFree(filter);
+
+	RequestFilterCreate(&filter);
+	RequestFilterAddCondition(&filter, ertIRP, rffMajor, rfoEquals, 3, 0, NULL, rfaPass, 0);
+	RequestFilterAddCondition(&filter, ertIRP, rffIrql, rfoLowerEquals, 1, 0, NULL, rfaInclude, 0);
+	_Measure("IRP chain of two", filter);
+	RequestFilterFree(filter);
+
+	RequestFilterCreate(&filter);
+	RequestFilterAddCondition(&filter, erpUndefined, rffFileName, rfoContains, 0, 0, L"config", rfaInclude, 0);
+	_Measure("file name contains", filter);
+	RequestFilterFree(filter);
+
+	RequestFilterCreate(&filter);
+	RequestFilterAddCondition(&filter, erpUndefined, rffType, rfoEquals, ertFastIo, 0, NULL, rfaExclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffProcessId, rfoInRange, 4, 8, NULL, rfaExclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffMajor, rfoEquals, 14, 0, NULL, rfaPass, REQUEST_FILTER_CONDITION_NEGATE);
+	RequestFilterAddCondition(&filter, erpUndefined, rffResult, rfoEquals, 0, 0, NULL, rfaExclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffAdmin, rfoEquals, 1, 0, NULL, rfaInclude, 0);
+	RequestFilterAddCondition(&filter, erpUndefined, rffIrql, rfoGreater, 0, 0, NULL, rfaInclude, 0);
+	_Measure("six conditions, mixed", filter);
+	RequestFilterFree(filter);
+
+	for (ULONG i = 0; i < RECORD_COUNT; ++i)
+		RequestMemoryFree(_requests[i]);
+
+	return 0;
+}
@@ -0,0 +1,248 @@
+
+/**
+ * @file
+ *
+ * Differential tests of compiled request filters. Random filters over every
+ * field, operator and action are compiled and run against generated
+ * requests of every type; the program must decide exactly as
+ * RequestFilterMatch does with the filter itself, both for single requests
+ * and for batches. Condition values are taken from the requests, so that
+ * comparisons and chains both match and fail.
+ */
+
+#include <windows.h>
+#include <locale.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+#include "request-filter-program.h"
+#include "request-gen.h"
+#include "test.h"
+
+
+#define POOL_SIZE					4000
+#define ROUND_COUNT					3000
+#define MAX_CONDITIONS				8
+
+
+/** Names returned by the name routine, by the file object. */
+static const wchar_t *_names[] = {
+	L"\\Device\\HarddiskVolume3\\Windows\\notepad.exe",
+	L"C:\\pagefile.sys",
+	L"\\Windows\\System32\\config\\SYSTEM",
+	L"",
+};
+
+/** Patterns of file name conditions; their case is changed at random. */
+static const wchar_t *_patterns[] = {
+	L"windows",
+	L"SYSTEM32",
+	L".exe",
+	L"\\device\\",
+	L"config\\file",
+	L"ntdll",
+	L"sys",
+	L"svchost",
+	L"c:\\pagefile.sys",
+	L"",
+};
+
+static PREQUEST_HEADER _pool[POOL_SIZE];
+
+
+static BOOLEAN _NameRoutine(void *Context, const void *FileObject, const wchar_t **Name, size_t *Length)
+{
+	size_t index = 0;
+	BOOLEAN ret = FALSE;
+
+	(void)Context;
+	// Some file objects have no known name.
+	index = ((ULONG_PTR)FileObject >> 4) % (sizeof(_names) / sizeof(_names[0]) + 1);
+	ret = (index < sizeof(_names) / sizeof(_names[0]));
+	if (ret) {
+		*Name = _names[index];
+		*Length = wcslen(_names[index]);
+	}
+
+	return ret;
+}
+
+
+/** Reads a field of a request the way the filters see it. */
+static BOOLEAN _FieldValue(const REQUEST_HEADER *Request, ERequestFilterField Field, PULONG64 Value)
+{
+	USHORT flags = 0;
+	REQUEST_FILTER_FIELD_LOCATION l;
+	BOOLEAN ret = FALSE;
+
+	*Value = 0;
+	if (Field == rffResult) {
+		ret = (Request->ResultType == rrtNTSTATUS || Request->ResultType == rrtBOOLEAN);
+		if (Request->ResultType == rrtNTSTATUS)
+			*Value = (ULONG)Request->Result.NTSTATUSValue;
+		else if (Request->ResultType == rrtBOOLEAN)
+			*Value = Request->Result.BOOLEANValue;
+	} else if (RequestFilterFieldLocation(Request->Type, Field, &l)) {
+		if (l.Mask != 0) {
+			memcpy(&flags, (const UCHAR *)Request + l.Offset, sizeof(flags));
+			*Value = ((flags & l.Mask) != 0);
+		} else memcpy(Value, (const UCHAR *)Request + l.Offset, l.Size);
+
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
+
+static void _AddRandomCondition(PTEST_REQUEST_GEN Gen, PREQUEST_FILTER_HEADER *Filter)
+{
+	ULONG64 value = 0;
+	ULONG64 valueHigh = 0;
+	ULONG flags = 0;
+	wchar_t pattern[32];
+	const wchar_t *string = NULL;
+	const REQUEST_HEADER *sample = NULL;
+	ERequesttype type = erpUndefined;
+	ERequestFilterField field = rffType;
+	ERequestFilterOperator op = rfoEquals;
+	ERequestFilterAction action = rfaInclude;
+
+	sample = _pool[TestRequestGenRandom(Gen) % POOL_SIZE];
+	field = (ERequestFilterField)(TestRequestGenRandom(Gen) % rffMax);
+	do {
+		op = (ERequestFilterOperator)(TestRequestGenRandom(Gen) % rfoMax);
+	} while (op == rfoDLLDecider);
+
+	// Chains are common, undecided conditions are not.
+	action = (ERequestFilterAction)(TestRequestGenRandom(Gen) % 7);
+	if (action >= rfaMax)
+		action = rfaPass;
+
+	if (TestRequestGenRandom(Gen) % 3 == 0)
+		type = sample->Type;
+
+	if (TestRequestGenRandom(Gen) % 4 == 0)
+		flags |= REQUEST_FILTER_CONDITION_NEGATE;
+
+	if (TestRequestGenRandom(Gen) % 12 == 0)
+		flags |= REQUEST_FILTER_CONDITION_DISABLED;
+
+	if (field == rffFileName) {
+		string = _patterns[TestRequestGenRandom(Gen) % (sizeof(_patterns) / sizeof(_patterns[0]))];
+		for (size_t i = 0; i <= wcslen(string); ++i)
+			pattern[i] = (TestRequestGenRandom(Gen) % 2 == 0) ? (wchar_t)towupper(string[i]) : string[i];
+
+		string = pattern;
+	} else {
+		_FieldValue(sample, field, &value);
+		value += TestRequestGenRandom(Gen) % 3 - 1;
+		valueHigh = value + TestRequestGenRandom(Gen) % 3;
+		if (TestRequestGenRandom(Gen) % 8 == 0)
+			value = TestRequestGenRandom(Gen);
+	}
+
+	TEST_CHECK(RequestFilterAddCondition(Filter, type, field, op, value, valueHigh, string, action, flags) == ERROR_VALUE_SUCCESS);
+
+	return;
+}
+
+
+/************************************************************************/
+/*                     TESTS                                            */
+/************************************************************************/
+
+
+static void _TestAgainstMatch(BOOLEAN NameRoutine)
+{
+	size_t count = 0;
+	size_t passed = 0;
+	REQUEST_FILTER_NAME_ROUTINE *nameRoutine = NULL;
+	PREQUEST_FILTER_HEADER filter = NULL;
+	PREQUEST_FILTER_PROGRAM program = NULL;
+	static BOOLEAN results[POOL_SIZE];
+	TEST_REQUEST_GEN gen;
+
+	nameRoutine = (NameRoutine) ? _NameRoutine : NULL;
+	TestRequestGenInit(&gen, 0x1f, FALSE);
+	for (ULONG round = 0; round < ROUND_COUNT; ++round) {
+		TEST_CHECK(RequestFilterCreate(&filter) == ERROR_VALUE_SUCCESS);
+		count = (size_t)(TestRequestGenRandom(&gen) % (MAX_CONDITIONS + 1));
+		for (size_t i = 0; i < count; ++i)
+			_AddRandomCondition(&gen, &filter);
+
+		TEST_CHECK(RequestFilterProgramCompile(filter, nameRoutine, NULL, &program) == ERROR_VALUE_SUCCESS);
+		passed = 0;
+		for (size_t i = 0; i < POOL_SIZE; i += 1 + round % 7) {
+			results[i] = RequestFilterMatch(filter, _pool[i], nameRoutine, NULL);
+			TEST_CHECK(RequestFilterProgramRun(program, _pool[i]) == results[i]);
+		}
+
+		// Batches decide the same as single runs.
+		for (size_t i = 0; i < POOL_SIZE; ++i)
+			passed += RequestFilterProgramRun(program, _pool[i]);
+
+		memset(results, 0xcc, sizeof(results));
+		TEST_CHECK(RequestFilterProgramRunBatch(program, (const REQUEST_HEADER * const *)_pool, POOL_SIZE, results) == passed);
+		for (size_t i = 0; i < POOL_SIZE; i += 1 + round % 13)
+			TEST_CHECK(results[i] == RequestFilterProgramRun(program, _pool[i]));
+
+		RequestFilterProgramFree(program);
+		RequestFilterFree(filter);
+	}
+
+	return;
+}
+
+
+/** Default decisions of filters whose conditions never decide. */
+static void _TestDefaults(void)
+{
+	PREQUEST_FILTER_HEADER filter = NULL;
+	PREQUEST_FILTER_PROGRAM program = NULL;
+
+	// No conditions: everything passes.
+	TEST_CHECK(RequestFilterCreate(&filter) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestFilterProgramCompile(filter, NULL, NULL, &program) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestFilterProgramRun(program, _pool[0]));
+	RequestFilterProgramFree(program);
+	// A disabled Include condition still makes undecided requests fail.
+	TEST_CHECK(RequestFilterAddCondition(&filter, erpUndefined, rffType, rfoAlwaysTrue, 0, 0, NULL, rfaInclude, REQUEST_FILTER_CONDITION_DISABLED) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestFilterProgramCompile(filter, NULL, NULL, &program) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(!RequestFilterProgramRun(program, _pool[0]));
+	RequestFilterProgramFree(program);
+	// An unconditional Exclude hides everything after it.
+	TEST_CHECK(RequestFilterAddCondition(&filter, erpUndefined, rffId, rfoAlwaysTrue, 0, 0, NULL, rfaExclude, 0) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestFilterAddCondition(&filter, erpUndefined, rffId, rfoAlwaysTrue, 0, 0, NULL, rfaInclude, 0) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestFilterProgramCompile(filter, NULL, NULL, &program) == ERROR_VALUE_SUCCESS);
+	for (size_t i = 0; i < POOL_SIZE; ++i)
+		TEST_CHECK(!RequestFilterProgramRun(program, _pool[i]));
+
+	RequestFilterProgramFree(program);
+	RequestFilterFree(filter);
+
+	return;
+}
+
+
+int main(void)
+{
+	TEST_REQUEST_GEN gen;
+
+	TEST_CHECK(setlocale(LC_CTYPE, "C.UTF-8") != NULL);
+	// Mostly realistic requests, so values repeat, with every type present.
+	TestRequestGenInit(&gen, 0x2f, TRUE);
+	for (ULONG i = 0; i < POOL_SIZE; ++i) {
+		if (i < REQUEST_TYPE_COUNT - ertIRP)
+			_pool[i] = TestRequestGenerate(&gen, (ERequesttype)(ertIRP + i));
+		else _pool[i] = TestRequestGenerateNext(&gen);
+	}
+
+	_TestDefaults();
+	_TestAgainstMatch(FALSE);
+	_TestAgainstMatch(TRUE);
+	for (ULONG i = 0; i < POOL_SIZE; ++i)
+		RequestMemoryFree(_pool[i]);
+
+	return TEST_RESULT();
+}
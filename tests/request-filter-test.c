@@ -0,0 +1,547 @@
+
+/**
+ * @file
+ *
+ * Property tests of serialized request filters. Random filters are matched
+ * against random requests and the result is compared with a straightforward
+ * model of the rules documented in request-filter.h. String operators are
+ * compared with a model that upcases both sides character by character.
+ * The test is built twice, once as user-mode code and once as kernel-mode
+ * code, where matching uses the nonpaged upcase table instead of calling
+ * RtlUpcaseUnicodeChar.
+ */
+
+#ifdef _KERNEL_MODE
+#include <ntifs.h>
+#else
+#include <windows.h>
+#endif
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-filter.h"
+#include "test.h"
+
+
+#define ROUND_COUNT					20000
+#define MAX_CONDITIONS				6
+#define MAX_NAME					12
+#define FILTER_BUFFER_SIZE			0x1000
+
+#ifdef _KERNEL_MODE
+#define _ModelUpcase(aChar)			RtlUpcaseUnicodeChar(aChar)
+#else
+#define _ModelUpcase(aChar)			((wchar_t)towupper(aChar))
+#endif
+
+
+/** Characters names and patterns are made of, with their case variants. */
+static const wchar_t _alphabet[] = {
+	L'a', L'A', L'b', L'B', L'\\', L'.',
+	0xe9, 0xc9,			// e with acute
+	0x434, 0x414,		// Cyrillic de
+	0x3c3, 0x3a3,		// Greek sigma
+};
+
+/** Integer fields stored in the header of every request. */
+static const ERequestFilterField _headerIntFields[] = {
+	rffProcessId,
+	rffThreadId,
+	rffIrql,
+	rffEmulated,
+	rffAdmin,
+};
+
+
+typedef struct _TEST_CONDITION {
+	ULONG RequestType;
+	ERequestFilterField Field;
+	ERequestFilterOperator Operator;
+	ERequestFilterAction Action;
+	ULONG Flags;
+	ULONG64 Value;
+	ULONG64 ValueHigh;
+	size_t StringLength;
+	wchar_t String[MAX_NAME];
+} TEST_CONDITION, *PTEST_CONDITION;
+
+typedef struct _TEST_REQUEST {
+	ERequesttype Type;
+	ULONG64 ProcessId;
+	ULONG64 ThreadId;
+	UCHAR Irql;
+	USHORT Flags;
+	UCHAR Major;
+	BOOLEAN HasResult;
+	NTSTATUS Result;
+	size_t NameLength;
+	wchar_t Name[MAX_NAME];
+} TEST_REQUEST, *PTEST_REQUEST;
+
+
+static unsigned int _seed = 1;
+
+static ULONG _Random(ULONG Limit)
+{
+	return (ULONG)rand_r(&_seed) % Limit;
+}
+
+
+static size_t _RandomString(wchar_t *Buffer, size_t MaxLength)
+{
+	size_t ret = 0;
+
+	ret = _Random((ULONG)MaxLength + 1);
+	for (size_t i = 0; i < ret; ++i)
+		Buffer[i] = _alphabet[_Random(sizeof(_alphabet) / sizeof(_alphabet[0]))];
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     MODEL                                            */
+/************************************************************************/
+
+
+static BOOLEAN _ModelEqual(const wchar_t *A, const wchar_t *B, size_t Length)
+{
+	BOOLEAN ret = TRUE;
+
+	for (size_t i = 0; ret && i < Length; ++i)
+		ret = (_ModelUpcase(A[i]) == _ModelUpcase(B[i]));
+
+	return ret;
+}
+
+
+static BOOLEAN _ModelStringMatch(ERequestFilterOperator Operator, const wchar_t *Name, size_t Length, const wchar_t *Pattern, size_t PatternLength)
+{
+	BOOLEAN ret = FALSE;
+
+	switch (Operator) {
+		case rfoEquals:
+			ret = (Length == PatternLength && _ModelEqual(Name, Pattern, Length));
+			break;
+		case rfoBegins:
+			ret = (PatternLength > 0 && Length >= PatternLength && _ModelEqual(Name, Pattern, PatternLength));
+			break;
+		case rfoEnds:
+			ret = (PatternLength > 0 && Length >= PatternLength && _ModelEqual(Name + Length - PatternLength, Pattern, PatternLength));
+			break;
+		case rfoContains:
+			for (size_t i = 0; !ret && PatternLength > 0 && i + PatternLength <= Length; ++i)
+				ret = _ModelEqual(Name + i, Pattern, PatternLength);
+			break;
+		case rfoAlwaysTrue:
+			ret = TRUE;
+			break;
+		default:
+			break;
+	}
+
+	return ret;
+}
+
+
+static BOOLEAN _ModelIntField(const TEST_REQUEST *Request, ERequestFilterField Field, PULONG64 Value)
+{
+	BOOLEAN ret = TRUE;
+
+	switch (Field) {
+		case rffType:
+			*Value = Request->Type;
+			break;
+		case rffProcessId:
+			*Value = Request->ProcessId;
+			break;
+		case rffThreadId:
+			*Value = Request->ThreadId;
+			break;
+		case rffIrql:
+			*Value = Request->Irql;
+			break;
+		case rffEmulated:
+			*Value = ((Request->Flags & REQUEST_FLAG_EMULATED) != 0);
+			break;
+		case rffAdmin:
+			*Value = ((Request->Flags & REQUEST_FLAG_ADMIN) != 0);
+			break;
+		case rffMajor:
+			*Value = Request->Major;
+			ret = (Request->Type == ertIRP);
+			break;
+		case rffResult:
+			*Value = (ULONG)Request->Result;
+			ret = Request->HasResult;
+			break;
+		default:
+			ret = FALSE;
+			break;
+	}
+
+	return ret;
+}
+
+
+static BOOLEAN _ModelCondition(const TEST_CONDITION *Condition, const TEST_REQUEST *Request)
+{
+	ULONG64 v = 0;
+	BOOLEAN ret = FALSE;
+
+	if ((Condition->Flags & REQUEST_FILTER_CONDITION_DISABLED) == 0 &&
+		(Condition->RequestType == erpUndefined || Condition->RequestType == (ULONG)Request->Type)) {
+		if (Condition->Field == rffFileName) {
+			if (Request->Type == ertFileObjectNameAssigned) {
+				ret = _ModelStringMatch(Condition->Operator, Request->Name, Request->NameLength, Condition->String, Condition->StringLength);
+				if (Condition->Flags & REQUEST_FILTER_CONDITION_NEGATE)
+					ret = !ret;
+			}
+		} else if (_ModelIntField(Request, Condition->Field, &v)) {
+			switch (Condition->Operator) {
+				case rfoEquals: ret = (v == Condition->Value); break;
+				case rfoLowerEquals: ret = (v <= Condition->Value); break;
+				case rfoGreaterEquals: ret = (v >= Condition->Value); break;
+				case rfoLower: ret = (v < Condition->Value); break;
+				case rfoGreater: ret = (v > Condition->Value); break;
+				case rfoInRange: ret = (v >= Condition->Value && v <= Condition->ValueHigh); break;
+				case rfoAlwaysTrue: ret = TRUE; break;
+				default: break;
+			}
+
+			if (Condition->Flags & REQUEST_FILTER_CONDITION_NEGATE)
+				ret = !ret;
+		}
+	}
+
+	return ret;
+}
+
+
+/** Evaluates the filter chain by chain, each chain fully. */
+static BOOLEAN _ModelFilter(const TEST_CONDITION *Conditions, size_t Count, const TEST_REQUEST *Request)
+{
+	BOOLEAN anyInclude = FALSE;
+	BOOLEAN chainMatch = FALSE;
+	size_t start = 0;
+	size_t end = 0;
+	ERequestFilterAction action = rfaHighlight;
+
+	// Undecided requests pass unless there is an Include condition.
+	for (size_t i = 0; i < Count; ++i)
+		anyInclude |= (Conditions[i].Action == rfaInclude);
+
+	for (start = 0; start < Count; start = end + 1) {
+		end = start;
+		while (end + 1 < Count && Conditions[end].Action == rfaPass)
+			++end;
+
+		chainMatch = TRUE;
+		for (size_t i = start; i <= end; ++i)
+			chainMatch &= _ModelCondition(Conditions + i, Request);
+
+		action = Conditions[end].Action;
+		if (chainMatch && (action == rfaInclude || action == rfaExclude))
+			return (action == rfaInclude);
+	}
+
+	return !anyInclude;
+}
+
+
+/************************************************************************/
+/*                     SERIALIZATION                                    */
+/************************************************************************/
+
+
+/** Writes the filter the way a client would send it, strings in mixed case. */
+static ULONG _FilterBuild(const TEST_CONDITION *Conditions, size_t Count, PREQUEST_FILTER_HEADER Filter)
+{
+	PREQUEST_FILTER_CONDITION c = NULL;
+
+	memset(Filter, 0, FILTER_BUFFER_SIZE);
+	Filter->Signature = REQUEST_FILTER_SIGNATURE;
+	Filter->Version = REQUEST_FILTER_VERSION_1;
+	Filter->Size = sizeof(REQUEST_FILTER_HEADER);
+	Filter->ConditionCount = (ULONG)Count;
+	c = (PREQUEST_FILTER_CONDITION)(Filter + 1);
+	for (size_t i = 0; i < Count; ++i) {
+		c->Size = (ULONG)((sizeof(REQUEST_FILTER_CONDITION) + Conditions[i].StringLength*sizeof(wchar_t) + 7) & ~(size_t)7);
+		c->RequestType = Conditions[i].RequestType;
+		c->Field = Conditions[i].Field;
+		c->Operator = Conditions[i].Operator;
+		c->Action = Conditions[i].Action;
+		c->Flags = Conditions[i].Flags;
+		c->Value = Conditions[i].Value;
+		c->ValueHigh = Conditions[i].ValueHigh;
+		c->StringLength = (ULONG)Conditions[i].StringLength;
+		memcpy(c + 1, Conditions[i].String, Conditions[i].StringLength*sizeof(wchar_t));
+		Filter->Size += c->Size;
+		c = (PREQUEST_FILTER_CONDITION)((PUCHAR)c + c->Size);
+	}
+
+	return Filter->Size;
+}
+
+
+static PREQUEST_HEADER _RequestBuild(const TEST_REQUEST *Request, void *Buffer)
+{
+	PREQUEST_HEADER ret = (PREQUEST_HEADER)Buffer;
+	PREQUEST_IRP irp = (PREQUEST_IRP)Buffer;
+	PREQUEST_FILE_OBJECT_NAME_ASSIGNED na = (PREQUEST_FILE_OBJECT_NAME_ASSIGNED)Buffer;
+
+	memset(Buffer, 0, sizeof(REQUEST_IRP) + sizeof(REQUEST_FILE_OBJECT_NAME_ASSIGNED) + MAX_NAME*sizeof(wchar_t));
+	ret->Type = Request->Type;
+	ret->ProcessId = (HANDLE)(ULONG_PTR)Request->ProcessId;
+	ret->ThreadId = (HANDLE)(ULONG_PTR)Request->ThreadId;
+	ret->Irql = Request->Irql;
+	ret->Flags = Request->Flags;
+	ret->ResultType = rrtUndefined;
+	if (Request->HasResult) {
+		ret->ResultType = rrtNTSTATUS;
+		ret->Result.NTSTATUSValue = Request->Result;
+	}
+
+	switch (Request->Type) {
+		case ertIRP:
+			irp->MajorFunction = Request->Major;
+			break;
+		case ertFileObjectNameAssigned:
+			na->NameLength = (ULONG)(Request->NameLength*sizeof(wchar_t));
+			memcpy(na + 1, Request->Name, na->NameLength);
+			break;
+		default:
+			break;
+	}
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     RANDOM INPUTS                                    */
+/************************************************************************/
+
+
+static void _RandomCondition(PTEST_CONDITION Condition)
+{
+	static const ERequestFilterOperator intOperators[] = {
+		rfoEquals, rfoLowerEquals, rfoGreaterEquals, rfoLower, rfoGreater, rfoInRange, rfoAlwaysTrue,
+	};
+	static const ERequestFilterOperator stringOperators[] = {
+		rfoEquals, rfoContains, rfoBegins, rfoEnds, rfoAlwaysTrue,
+	};
+	static const ULONG types[] = {
+		erpUndefined, ertIRP, ertDriverUnload, ertFileObjectNameAssigned,
+	};
+
+	memset(Condition, 0, sizeof(TEST_CONDITION));
+	Condition->RequestType = (_Random(3) == 0) ? types[_Random(4)] : erpUndefined;
+	Condition->Action = (ERequestFilterAction)_Random(rfaMax);
+	Condition->Flags = (_Random(4) == 0 ? REQUEST_FILTER_CONDITION_NEGATE : 0) |
+		(_Random(10) == 0 ? REQUEST_FILTER_CONDITION_DISABLED : 0);
+	switch (_Random(4)) {
+		case 0:
+			Condition->Field = rffFileName;
+			Condition->Operator = stringOperators[_Random(sizeof(stringOperators) / sizeof(stringOperators[0]))];
+			Condition->StringLength = _RandomString(Condition->String, 4);
+			break;
+		case 1:
+			Condition->Field = (_Random(2) == 0) ? rffMajor : rffResult;
+			Condition->Operator = intOperators[_Random(sizeof(intOperators) / sizeof(intOperators[0]))];
+			Condition->Value = _Random(4);
+			Condition->ValueHigh = Condition->Value + _Random(3);
+			break;
+		default:
+			Condition->Field = _headerIntFields[_Random(sizeof(_headerIntFields) / sizeof(_headerIntFields[0]))];
+			Condition->Operator = intOperators[_Random(sizeof(intOperators) / sizeof(intOperators[0]))];
+			Condition->Value = _Random(4);
+			Condition->ValueHigh = Condition->Value + _Random(3);
+			break;
+	}
+
+	return;
+}
+
+
+static void _RandomRequest(PTEST_REQUEST Request)
+{
+	static const ERequesttype types[] = {
+		ertIRP, ertDriverUnload, ertFileObjectNameAssigned,
+	};
+
+	memset(Request, 0, sizeof(TEST_REQUEST));
+	Request->Type = types[_Random(3)];
+	Request->ProcessId = _Random(4);
+	Request->ThreadId = _Random(4);
+	Request->Irql = (UCHAR)_Random(3);
+	Request->Flags = (_Random(2) ? REQUEST_FLAG_EMULATED : 0) | (_Random(2) ? REQUEST_FLAG_ADMIN : 0);
+	Request->Major = (UCHAR)_Random(4);
+	Request->HasResult = (Request->Type != ertDriverUnload);
+	Request->Result = (NTSTATUS)_Random(4);
+	if (Request->Type == ertFileObjectNameAssigned)
+		Request->NameLength = _RandomString(Request->Name, MAX_NAME);
+
+	return;
+}
+
+
+/************************************************************************/
+/*                     TESTS                                            */
+/************************************************************************/
+
+
+/** The filter decides as the model of the documented rules does. */
+static void _TestFilterModel(void)
+{
+	ULONG size = 0;
+	size_t count = 0;
+	TEST_REQUEST tr;
+	PREQUEST_HEADER request = NULL;
+	TEST_CONDITION conditions[MAX_CONDITIONS];
+	PREQUEST_FILTER_HEADER filter = NULL;
+	void *requestBuffer = NULL;
+
+	filter = (PREQUEST_FILTER_HEADER)malloc(FILTER_BUFFER_SIZE);
+	requestBuffer = malloc(sizeof(REQUEST_IRP) + sizeof(REQUEST_FILE_OBJECT_NAME_ASSIGNED) + MAX_NAME*sizeof(wchar_t));
+	for (ULONG round = 0; round < ROUND_COUNT; ++round) {
+		count = _Random(MAX_CONDITIONS + 1);
+		for (size_t i = 0; i < count; ++i)
+			_RandomCondition(conditions + i);
+
+		size = _FilterBuild(conditions, count, filter);
+		TEST_CHECK(RequestFilterPrepare(filter, size) == ERROR_VALUE_SUCCESS);
+		for (ULONG i = 0; i < 8; ++i) {
+			_RandomRequest(&tr);
+			request = _RequestBuild(&tr, requestBuffer);
+			TEST_CHECK(RequestFilterMatch(filter, request, NULL, NULL) == _ModelFilter(conditions, count, &tr));
+		}
+
+		// Preparing twice must not change anything.
+		TEST_CHECK(RequestFilterPrepare(filter, size) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(RequestFilterMatch(filter, request, NULL, NULL) == _ModelFilter(conditions, count, &tr));
+	}
+
+	free(requestBuffer);
+	free(filter);
+
+	return;
+}
+
+
+/** Patterns upcased by RequestFilterPrepare match names of any case. */
+static void _TestStringMatch(void)
+{
+	size_t length = 0;
+	size_t patternLength = 0;
+	wchar_t name[MAX_NAME];
+	wchar_t pattern[MAX_NAME];
+	ERequestFilterOperator op = rfoEquals;
+	TEST_CONDITION c;
+	PREQUEST_FILTER_HEADER filter = NULL;
+	PREQUEST_FILTER_CONDITION fc = NULL;
+	static const ERequestFilterOperator operators[] = {
+		rfoEquals, rfoContains, rfoBegins, rfoEnds,
+	};
+
+	filter = (PREQUEST_FILTER_HEADER)malloc(FILTER_BUFFER_SIZE);
+	for (ULONG round = 0; round < ROUND_COUNT*5; ++round) {
+		length = _RandomString(name, MAX_NAME);
+		if (_Random(2) == 0 && length > 0) {
+			// A pattern taken from the name with its case changed.
+			size_t start = _Random((ULONG)length);
+
+			patternLength = 1 + _Random((ULONG)(length - start));
+			for (size_t i = 0; i < patternLength; ++i)
+				pattern[i] = (_Random(2) == 0) ? _ModelUpcase(name[start + i]) : name[start + i];
+		} else patternLength = _RandomString(pattern, 4);
+
+		memset(&c, 0, sizeof(c));
+		c.Field = rffFileName;
+		c.Action = rfaInclude;
+		c.StringLength = patternLength;
+		memcpy(c.String, pattern, patternLength*sizeof(wchar_t));
+		TEST_CHECK(RequestFilterPrepare(filter, _FilterBuild(&c, 1, filter)) == ERROR_VALUE_SUCCESS);
+		fc = (PREQUEST_FILTER_CONDITION)(filter + 1);
+		for (size_t i = 0; i < patternLength; ++i)
+			TEST_CHECK(((wchar_t *)(fc + 1))[i] == _ModelUpcase(pattern[i]));
+
+		op = operators[_Random(sizeof(operators) / sizeof(operators[0]))];
+		TEST_CHECK(RequestFilterStringMatch(op, name, length, (const wchar_t *)(fc + 1), patternLength) ==
+			_ModelStringMatch(op, name, length, pattern, patternLength));
+	}
+
+	free(filter);
+
+	return;
+}
+
+
+/** Every truncation or size corruption of a valid filter is rejected. */
+static void _TestMalformed(void)
+{
+	ULONG size = 0;
+	size_t count = 0;
+	TEST_CONDITION conditions[MAX_CONDITIONS];
+	PREQUEST_FILTER_HEADER filter = NULL;
+	PREQUEST_FILTER_CONDITION c = NULL;
+
+	filter = (PREQUEST_FILTER_HEADER)malloc(FILTER_BUFFER_SIZE);
+	for (ULONG round = 0; round < ROUND_COUNT / 10; ++round) {
+		count = 1 + _Random(MAX_CONDITIONS);
+		for (size_t i = 0; i < count; ++i)
+			_RandomCondition(conditions + i);
+
+		size = _FilterBuild(conditions, count, filter);
+		for (ULONG s = 0; s < size; ++s) {
+			filter->Size = s;
+			TEST_CHECK(RequestFilterPrepare(filter, s) != ERROR_VALUE_SUCCESS);
+		}
+
+		size = _FilterBuild(conditions, count, filter);
+		c = (PREQUEST_FILTER_CONDITION)(filter + 1);
+		switch (_Random(4)) {
+			case 0:
+				c->Size += 8;
+				break;
+			case 1:
+				c->StringLength += (ULONG)(c->Size - sizeof(REQUEST_FILTER_CONDITION)) / sizeof(wchar_t) + 1;
+				break;
+			case 2:
+				c->Operator = rfoDLLDecider;
+				break;
+			default:
+				c->Field = rffMax;
+				break;
+		}
+
+		TEST_CHECK(RequestFilterPrepare(filter, size) != ERROR_VALUE_SUCCESS);
+	}
+
+	free(filter);
+
+	return;
+}
+
+
+int main(void)
+{
+	// Upper-case forms of characters beyond ASCII come from the locale.
+	TEST_CHECK(setlocale(LC_CTYPE, "C.UTF-8") != NULL);
+#ifdef _KERNEL_MODE
+	TEST_CHECK(NT_SUCCESS(RequestFilterModuleInit(NULL, NULL, NULL)));
+	// Matching runs at DISPATCH_LEVEL in the driver.
+	ShimIrql = DISPATCH_LEVEL;
+#endif
+	_TestStringMatch();
+	_TestFilterModel();
+	_TestMalformed();
+#ifdef _KERNEL_MODE
+	ShimIrql = PASSIVE_LEVEL;
+	RequestFilterModuleFinit(NULL, NULL, NULL);
+#endif
+
+	return TEST_RESULT();
+}
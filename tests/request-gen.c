@@ -0,0 +1,389 @@
+
+#include <windows.h>
+#include <stdio.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-gen.h"
+
+
+#define GEN_DEVICE_BASE				0xffffa00000001000ULL
+#define GEN_DRIVER_BASE				0xffffa00000800000ULL
+#define GEN_FILE_OBJECT_BASE		0xffffa00001000000ULL
+#define GEN_IRP_BASE				0xffffa00002000000ULL
+#define GEN_IMAGE_BASE				0x00007ff600000000ULL
+
+#define GEN_DATA_MAX				512
+#define GEN_NAME_MAX				96
+
+
+/************************************************************************/
+/*                     HELPER FUNCTIONS                                 */
+/************************************************************************/
+
+
+/** A value of random magnitude in the wild mode, a small one in the realistic mode. */
+static ULONG64 _Value(PTEST_REQUEST_GEN Gen)
+{
+	ULONG bits = 0;
+	ULONG64 ret = 0;
+
+	ret = TestRequestGenRandom(Gen);
+	if (!Gen->Realistic) {
+		bits = (ULONG)(TestRequestGenRandom(Gen) % 65);
+		if (bits < 64)
+			ret &= ((1ULL << bits) - 1);
+	} else ret %= 0x100;
+
+	return ret;
+}
+
+
+/** An address from a pool of the given size; the wild mode often repeats a recent one. */
+static PVOID _Pointer(PTEST_REQUEST_GEN Gen, ULONG64 Base, ULONG Count)
+{
+	ULONG index = 0;
+	ULONG_PTR ret = 0;
+
+	if (!Gen->Realistic) {
+		index = (ULONG)(TestRequestGenRandom(Gen) % (2*sizeof(Gen->Recent) / sizeof(Gen->Recent[0])));
+		if (index < sizeof(Gen->Recent) / sizeof(Gen->Recent[0]))
+			ret = Gen->Recent[index];
+		else {
+			ret = (ULONG_PTR)_Value(Gen);
+			Gen->Recent[TestRequestGenRandom(Gen) % (sizeof(Gen->Recent) / sizeof(Gen->Recent[0]))] = ret;
+		}
+	} else ret = (ULONG_PTR)(Base + (TestRequestGenRandom(Gen) % Count)*0x40);
+
+	return (PVOID)ret;
+}
+
+
+/** Fills data the way a hexdump of an IRP buffer usually looks: runs of
+ *  zeros, small integers, text and a few random bytes. */
+static void _Data(PTEST_REQUEST_GEN Gen, PUCHAR Buffer, size_t Size)
+{
+	size_t i = 0;
+	size_t run = 0;
+	ULONG kind = 0;
+	static const char text[] = "\\Device\\HarddiskVolume3\\Windows\\System32\\drivers\\etc\\hosts MZ This program cannot be run in DOS mode. ";
+
+	while (i < Size) {
+		run = 1 + (size_t)(TestRequestGenRandom(Gen) % 32);
+		if (run > Size - i)
+			run = Size - i;
+
+		kind = (ULONG)(Gen->Realistic ? TestRequestGenRandom(Gen) % 4 : 3);
+		for (size_t j = 0; j < run; ++j) {
+			switch (kind) {
+				case 0:
+					Buffer[i + j] = 0;
+					break;
+				case 1:
+					Buffer[i + j] = ((i + j) % 4 == 0) ? (UCHAR)(TestRequestGenRandom(Gen) % 16) : 0;
+					break;
+				case 2:
+					Buffer[i + j] = (UCHAR)text[(i + j) % (sizeof(text) - 1)];
+					break;
+				default:
+					Buffer[i + j] = (UCHAR)TestRequestGenRandom(Gen);
+					break;
+			}
+		}
+
+		i += run;
+	}
+
+	return;
+}
+
+
+/** Fills a name made of wide characters, returns its length in bytes. */
+static ULONG _Name(PTEST_REQUEST_GEN Gen, const char *Prefix, PUCHAR Buffer, ULONG MaxLength)
+{
+	ULONG ret = 0;
+	ULONG length = 0;
+	char name[GEN_NAME_MAX];
+	USHORT c = 0;
+
+	if (Gen->Realistic) {
+		length = (ULONG)snprintf(name, sizeof(name), "%s%u", Prefix, (unsigned int)(TestRequestGenRandom(Gen) % 100));
+		for (ULONG i = 0; i < length && (i + 1)*sizeof(c) <= MaxLength; ++i) {
+			c = (UCHAR)name[i];
+			memcpy(Buffer + ret, &c, sizeof(c));
+			ret += sizeof(c);
+		}
+	} else {
+		ret = (ULONG)(TestRequestGenRandom(Gen) % (MaxLength / sizeof(c) + 1))*sizeof(c);
+		_Data(Gen, Buffer, ret);
+	}
+
+	return ret;
+}
+
+
+static void _HeaderFill(PTEST_REQUEST_GEN Gen, PREQUEST_HEADER Header, ERequesttype Type)
+{
+	Header->Type = Type;
+	if (Gen->Realistic) {
+		Gen->Id += 1;
+		Gen->Time += (LONG64)(TestRequestGenRandom(Gen) % 2000);
+		Header->ProcessId = (HANDLE)(ULONG_PTR)(4 + (TestRequestGenRandom(Gen) % 8)*4);
+		Header->ThreadId = (HANDLE)(ULONG_PTR)((ULONG_PTR)Header->ProcessId*0x100 + (TestRequestGenRandom(Gen) % 4)*4);
+		Header->Irql = (UCHAR)(TestRequestGenRandom(Gen) % 3);
+		Header->Flags = (USHORT)((TestRequestGenRandom(Gen) % 2)*REQUEST_FLAG_ADMIN);
+	} else {
+		Gen->Id += (ULONG)_Value(Gen);
+		Gen->Time = (LONG64)(TestRequestGenRandom(Gen) % 2 ? _Value(Gen) : (ULONG64)Gen->Time + _Value(Gen));
+		Header->ProcessId = (HANDLE)(ULONG_PTR)_Value(Gen);
+		Header->ThreadId = (HANDLE)(ULONG_PTR)_Value(Gen);
+		Header->Irql = (UCHAR)_Value(Gen);
+		Header->Flags = (USHORT)_Value(Gen);
+	}
+
+	Header->Id = Gen->Id;
+	Header->Time.QuadPart = Gen->Time;
+	Header->Device = _Pointer(Gen, GEN_DEVICE_BASE, 16);
+	Header->Driver = _Pointer(Gen, GEN_DRIVER_BASE, 4);
+	Header->ResultType = (ERequestResultType)(TestRequestGenRandom(Gen) % 3);
+	switch (Header->ResultType) {
+		case rrtNTSTATUS:
+			Header->Result.NTSTATUSValue = (NTSTATUS)(Gen->Realistic ? ((TestRequestGenRandom(Gen) % 4 == 0) ? 0xC0000034 : 0) : _Value(Gen));
+			break;
+		case rrtBOOLEAN:
+			Header->Result.BOOLEANValue = (BOOLEAN)_Value(Gen);
+			break;
+		default:
+			Header->Result.Other = (PVOID)(ULONG_PTR)(Gen->Realistic ? 0 : _Value(Gen));
+			break;
+	}
+
+	return;
+}
+
+
+static size_t _DataSize(PTEST_REQUEST_GEN Gen)
+{
+	size_t ret = 0;
+
+	ret = (size_t)(TestRequestGenRandom(Gen) % (GEN_DATA_MAX + 1));
+	if (Gen->Realistic && TestRequestGenRandom(Gen) % 2 == 0)
+		ret = 0;
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                     PUBLIC FUNCTIONS                                 */
+/************************************************************************/
+
+
+void TestRequestGenInit(PTEST_REQUEST_GEN Gen, ULONG64 Seed, BOOLEAN Realistic)
+{
+	memset(Gen, 0, sizeof(TEST_REQUEST_GEN));
+	Gen->Seed = Seed | 1;
+	Gen->Realistic = Realistic;
+	Gen->Time = 0x01d9000000000000LL;
+
+	return;
+}
+
+
+/** xorshift64*, fast and good enough for the tests. */
+ULONG64 TestRequestGenRandom(PTEST_REQUEST_GEN Gen)
+{
+	Gen->Seed ^= Gen->Seed >> 12;
+	Gen->Seed ^= Gen->Seed << 25;
+	Gen->Seed ^= Gen->Seed >> 27;
+
+	return Gen->Seed * 0x2545F4914F6CDD1DULL;
+}
+
+
+/** Generates a request of the given type.
+ *
+ *  @return
+ *  Returns the request allocated by RequestMemoryAlloc, or NULL if the type
+ *  is not valid.
+ */
+PREQUEST_HEADER TestRequestGenerate(PTEST_REQUEST_GEN Gen, ERequesttype Type)
+{
+	size_t dataSize = 0;
+	ULONG nameLength = 0;
+	REQUEST_GENERAL r;
+	UCHAR data[2*GEN_DATA_MAX];
+	size_t fixedSize = 0;
+	PREQUEST_HEADER ret = NULL;
+
+	memset(&r, 0, sizeof(r));
+	_HeaderFill(Gen, &r.RequestTypes.Other, Type);
+	switch (Type) {
+		case ertIRP:
+			fixedSize = sizeof(REQUEST_IRP);
+			r.RequestTypes.Irp.MajorFunction = (UCHAR)(Gen->Realistic ? TestRequestGenRandom(Gen) % 28 : _Value(Gen));
+			r.RequestTypes.Irp.MinorFunction = (UCHAR)_Value(Gen);
+			r.RequestTypes.Irp.PreviousMode = (UCHAR)(TestRequestGenRandom(Gen) % 2);
+			r.RequestTypes.Irp.RequestorMode = (UCHAR)(TestRequestGenRandom(Gen) % 2);
+			r.RequestTypes.Irp.IRPAddress = _Pointer(Gen, GEN_IRP_BASE, 64);
+			r.RequestTypes.Irp.IrpFlags = (ULONG)_Value(Gen);
+			r.RequestTypes.Irp.FileObject = _Pointer(Gen, GEN_FILE_OBJECT_BASE, 32);
+			r.RequestTypes.Irp.Arg1 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.Irp.Arg2 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.Irp.Arg3 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.Irp.Arg4 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.Irp.IOSBStatus = (NTSTATUS)_Value(Gen);
+			r.RequestTypes.Irp.IOSBInformation = (ULONG_PTR)_Value(Gen);
+			r.RequestTypes.Irp.RequestorProcessId = (ULONG_PTR)r.RequestTypes.Other.ProcessId;
+			dataSize = _DataSize(Gen);
+			r.RequestTypes.Irp.DataSize = dataSize;
+			break;
+		case ertIRPCompletion:
+			fixedSize = sizeof(REQUEST_IRP_COMPLETION);
+			r.RequestTypes.IrpComplete.IRPAddress = _Pointer(Gen, GEN_IRP_BASE, 64);
+			r.RequestTypes.IrpComplete.CompletionStatus = (NTSTATUS)_Value(Gen);
+			r.RequestTypes.IrpComplete.CompletionInformation = (ULONG_PTR)_Value(Gen);
+			r.RequestTypes.IrpComplete.MajorFunction = (ULONG)(Gen->Realistic ? TestRequestGenRandom(Gen) % 28 : _Value(Gen));
+			r.RequestTypes.IrpComplete.MinorFunction = (ULONG)_Value(Gen);
+			for (size_t i = 0; i < sizeof(r.RequestTypes.IrpComplete.Arguments) / sizeof(r.RequestTypes.IrpComplete.Arguments[0]); ++i)
+				r.RequestTypes.IrpComplete.Arguments[i] = (PVOID)(ULONG_PTR)_Value(Gen);
+
+			r.RequestTypes.IrpComplete.FileObject = _Pointer(Gen, GEN_FILE_OBJECT_BASE, 32);
+			r.RequestTypes.IrpComplete.RequestorProcessId = (ULONG_PTR)r.RequestTypes.Other.ProcessId;
+			r.RequestTypes.IrpComplete.PreviousMode = (UCHAR)(TestRequestGenRandom(Gen) % 2);
+			r.RequestTypes.IrpComplete.RequestorMode = (UCHAR)(TestRequestGenRandom(Gen) % 2);
+			dataSize = _DataSize(Gen);
+			r.RequestTypes.IrpComplete.DataSize = dataSize;
+			break;
+		case ertFastIo:
+			fixedSize = sizeof(REQUEST_FASTIO);
+			r.RequestTypes.FastIo.FastIoType = (EFastIoOperationType)(Gen->Realistic ? TestRequestGenRandom(Gen) % FastIoMax : (ULONG)_Value(Gen));
+			r.RequestTypes.FastIo.PreviousMode = (UCHAR)(TestRequestGenRandom(Gen) % 2);
+			r.RequestTypes.FastIo.Arg1 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg2 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg3 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg4 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg5 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg6 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg7 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg8 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.Arg9 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.FastIo.FileObject = _Pointer(Gen, GEN_FILE_OBJECT_BASE, 32);
+			r.RequestTypes.FastIo.IOSBStatus = (LONG)_Value(Gen);
+			r.RequestTypes.FastIo.IOSBInformation = (ULONG_PTR)_Value(Gen);
+			break;
+		case ertAddDevice:
+			fixedSize = sizeof(REQUEST_ADDDEVICE);
+			break;
+		case ertDriverUnload:
+			fixedSize = sizeof(REQUEST_UNLOAD);
+			break;
+		case ertStartIo:
+			fixedSize = sizeof(REQUEST_STARTIO);
+			r.RequestTypes.StartIo.IRPAddress = _Pointer(Gen, GEN_IRP_BASE, 64);
+			r.RequestTypes.StartIo.MajorFunction = (UCHAR)_Value(Gen);
+			r.RequestTypes.StartIo.MinorFunction = (UCHAR)_Value(Gen);
+			r.RequestTypes.StartIo.Arg1 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.StartIo.Arg2 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.StartIo.Arg3 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.StartIo.Arg4 = (PVOID)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.StartIo.IrpFlags = (ULONG)_Value(Gen);
+			r.RequestTypes.StartIo.FileObject = _Pointer(Gen, GEN_FILE_OBJECT_BASE, 32);
+			r.RequestTypes.StartIo.Information = (ULONG_PTR)_Value(Gen);
+			r.RequestTypes.StartIo.Status = (LONG)_Value(Gen);
+			dataSize = _DataSize(Gen);
+			r.RequestTypes.StartIo.DataSize = dataSize;
+			break;
+		case ertDriverDetected:
+			fixedSize = sizeof(REQUEST_DRIVER_DETECTED);
+			nameLength = _Name(Gen, "\\Driver\\Disk", data, GEN_NAME_MAX*2);
+			r.RequestTypes.DriverDetected.DriverNameLength = nameLength;
+			break;
+		case ertDeviceDetected:
+			fixedSize = sizeof(REQUEST_DEVICE_DETECTED);
+			nameLength = _Name(Gen, "\\Device\\HarddiskVolume", data, GEN_NAME_MAX*2);
+			r.RequestTypes.DeviceDetected.DeviceNameLength = nameLength;
+			break;
+		case ertFileObjectNameAssigned:
+			fixedSize = sizeof(REQUEST_FILE_OBJECT_NAME_ASSIGNED);
+			r.RequestTypes.FileObjectNameAssigned.FileObject = _Pointer(Gen, GEN_FILE_OBJECT_BASE, 32);
+			nameLength = _Name(Gen, "\\Windows\\System32\\config\\file", data, GEN_NAME_MAX*2);
+			r.RequestTypes.FileObjectNameAssigned.NameLength = nameLength;
+			break;
+		case ertFileObjectNameDeleted:
+			fixedSize = sizeof(REQUEST_FILE_OBJECT_NAME_DELETED);
+			r.RequestTypes.FileObjectNameDeleted.FileObject = _Pointer(Gen, GEN_FILE_OBJECT_BASE, 32);
+			break;
+		case ertProcessCreated:
+			fixedSize = sizeof(REQUEST_PROCESS_CREATED);
+			r.RequestTypes.ProcessCreated.ProcessId = (HANDLE)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.ProcessCreated.ParentId = (HANDLE)(ULONG_PTR)_Value(Gen);
+			r.RequestTypes.ProcessCreated.CreatorId = (HANDLE)(ULONG_PTR)_Value(Gen);
+			nameLength = _Name(Gen, "\\Windows\\System32\\svchost", data, GEN_NAME_MAX*2);
+			r.RequestTypes.ProcessCreated.ImageNameLength = nameLength;
+			r.RequestTypes.ProcessCreated.CommandLineLength = _Name(Gen, "svchost.exe -k netsvcs -p -s Schedule", data + nameLength, GEN_NAME_MAX*2);
+			nameLength += r.RequestTypes.ProcessCreated.CommandLineLength;
+			break;
+		case ertProcessExitted:
+			fixedSize = sizeof(REQUEST_PROCESS_EXITTED);
+			r.RequestTypes.ProcessExitted.ProcessId = (HANDLE)(ULONG_PTR)_Value(Gen);
+			break;
+		case ertImageLoad:
+			fixedSize = sizeof(REQUEST_IMAGE_LOAD);
+			r.RequestTypes.ImageLoad.ImageBase = _Pointer(Gen, GEN_IMAGE_BASE, 16);
+			r.RequestTypes.ImageLoad.ImageSize = (size_t)_Value(Gen);
+			r.RequestTypes.ImageLoad.FileObject = _Pointer(Gen, GEN_FILE_OBJECT_BASE, 32);
+			r.RequestTypes.ImageLoad.SignatureLevel = (EImageSigningLevel)(ULONG)_Value(Gen);
+			r.RequestTypes.ImageLoad.SignatureType = (EImageSignatureType)(ULONG)_Value(Gen);
+			r.RequestTypes.ImageLoad.KernelDriver = (BOOLEAN)_Value(Gen);
+			r.RequestTypes.ImageLoad.MappedToAllPids = (BOOLEAN)_Value(Gen);
+			r.RequestTypes.ImageLoad.ExtraInfo = (BOOLEAN)_Value(Gen);
+			r.RequestTypes.ImageLoad.PartialMap = (BOOLEAN)_Value(Gen);
+			nameLength = _Name(Gen, "\\Windows\\System32\\ntdll", data, GEN_NAME_MAX*2);
+			r.RequestTypes.ImageLoad.DataSize = nameLength;
+			break;
+		case ertEventsDropped:
+			fixedSize = sizeof(REQUEST_EVENTS_DROPPED);
+			r.RequestTypes.EventsDropped.DroppedCount = (ULONG)_Value(Gen);
+			for (size_t i = 0; i < REQUEST_TYPE_COUNT; ++i)
+				r.RequestTypes.EventsDropped.DroppedByType[i] = (ULONG)_Value(Gen);
+			break;
+		default:
+			break;
+	}
+
+	if (fixedSize > 0) {
+		if (dataSize > 0)
+			_Data(Gen, data, dataSize);
+		else dataSize = nameLength;
+
+		ret = RequestMemoryAlloc(fixedSize + dataSize);
+		if (ret != NULL) {
+			memcpy(ret, &r, fixedSize);
+			memcpy((PUCHAR)ret + fixedSize, data, dataSize);
+		}
+	}
+
+	return ret;
+}
+
+
+/** Generates a request of a random type; the realistic mode prefers IRPs,
+ *  their completions and fast I/O, as real captures do. */
+PREQUEST_HEADER TestRequestGenerateNext(PTEST_REQUEST_GEN Gen)
+{
+	ULONG r = 0;
+	ERequesttype type = erpUndefined;
+
+	r = (ULONG)(TestRequestGenRandom(Gen) % 100);
+	if (Gen->Realistic) {
+		if (r < 40)
+			type = ertIRP;
+		else if (r < 75)
+			type = ertIRPCompletion;
+		else if (r < 90)
+			type = ertFastIo;
+		else type = (ERequesttype)(ertAddDevice + r % (REQUEST_TYPE_COUNT - ertAddDevice));
+	} else type = (ERequesttype)(ertIRP + r % (REQUEST_TYPE_COUNT - ertIRP));
+
+	return TestRequestGenerate(Gen, type);
+}
@@ -0,0 +1,36 @@
+
+/**
+ * @file
+ *
+ * Generator of request records for the tests and benchmarks of the codecs,
+ * logs and views. A realistic generator produces streams resembling a real
+ * capture: mostly IRPs and their completions of a few devices and file
+ * objects, with hexdump-like data. A wild generator fills every field with
+ * values of random magnitude, so the corner cases of the encodings are hit.
+ */
+
+#ifndef __TESTS_REQUEST_GEN_H__
+#define __TESTS_REQUEST_GEN_H__
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+
+
+typedef struct _TEST_REQUEST_GEN {
+	ULONG64 Seed;
+	BOOLEAN Realistic;
+	ULONG Id;
+	LONG64 Time;
+	ULONG_PTR Recent[8];
+} TEST_REQUEST_GEN, *PTEST_REQUEST_GEN;
+
+
+void TestRequestGenInit(PTEST_REQUEST_GEN Gen, ULONG64 Seed, BOOLEAN Realistic);
+ULONG64 TestRequestGenRandom(PTEST_REQUEST_GEN Gen);
+PREQUEST_HEADER TestRequestGenerate(PTEST_REQUEST_GEN Gen, ERequesttype Type);
+PREQUEST_HEADER TestRequestGenerateNext(PTEST_REQUEST_GEN Gen);
+
+
+
+#endif
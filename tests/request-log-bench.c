@@ -0,0 +1,126 @@
+
+/**
+ * @file
+ *
+ * Speed of writing the chunked log with and without compression workers,
+ * and cost of opening it and reaching a random record by its ID.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-log.h"
+#include "request-gen.h"
+#include "bench.h"
+
+
+#define RECORD_COUNT				500000
+#define LOOKUP_COUNT				2000
+#define LOG_FILE					L"request-log-bench.log"
+#define LOG_FILE_NAME				"request-log-bench.log"
+
+
+static PREQUEST_HEADER *_requests = NULL;
+static size_t _rawSize = 0;
+
+
+static void _Write(EBlockCodecMethod Compression, ULONG WorkerCount)
+{
+	double start = 0;
+	double elapsed = 0;
+	long fileSize = 0;
+	FILE *f = NULL;
+	PREQUEST_LOG_WRITER w = NULL;
+
+	start = BenchNow();
+	if (RequestLogWriterOpen(LOG_FILE, 0, Compression, WorkerCount, &w) == ERROR_VALUE_SUCCESS) {
+		for (ULONG i = 0; i < RECORD_COUNT; ++i)
+			RequestLogWriterAppend(w, _requests[i]);
+
+		RequestLogWriterClose(w);
+	}
+
+	elapsed = BenchNow() - start;
+	f = fopen(LOG_FILE_NAME, "rb");
+	if (f != NULL) {
+		fseek(f, 0, SEEK_END);
+		fileSize = ftell(f);
+		fclose(f);
+	}
+
+	printf("write %-4s %u workers: %8.1f MB/s of raw records, file %5.1f %% of raw\n", (Compression == bcmFast) ? "fast" : "none", WorkerCount, BenchMBps((double)_rawSize, elapsed), 100.0*fileSize / _rawSize);
+
+	return;
+}
+
+
+static void _Lookup(void)
+{
+	ULONG id = 0;
+	ULONG b = 0;
+	ULONG firstId = 0;
+	ULONG lastId = 0;
+	double start = 0;
+	double openTime = 0;
+	double lookupTime = 0;
+	REQUEST_LOG_BLOCK block;
+	PREQUEST_HEADER r = NULL;
+	PREQUEST_LOG_READER reader = NULL;
+	TEST_REQUEST_GEN gen;
+
+	start = BenchNow();
+	if (RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_SUCCESS) {
+		openTime = BenchNow() - start;
+		firstId = RequestLogReaderBlockInfo(reader, 0)->FirstId;
+		lastId = RequestLogReaderBlockInfo(reader, RequestLogReaderBlockCount(reader) - 1)->LastId;
+		TestRequestGenInit(&gen, 3, TRUE);
+		start = BenchNow();
+		for (ULONG i = 0; i < LOOKUP_COUNT; ++i) {
+			id = firstId + (ULONG)(TestRequestGenRandom(&gen) % (lastId - firstId + 1));
+			b = RequestLogReaderFindById(reader, id);
+			if (RequestLogReaderLoadBlock(reader, b, &block) == ERROR_VALUE_SUCCESS) {
+				while (RequestLogBlockNext(&block, &r) == ERROR_VALUE_SUCCESS && r != NULL) {
+					id = (r->Id == id) ? 0 : id;
+					RequestMemoryFree(r);
+					if (id == 0)
+						break;
+				}
+
+				RequestLogBlockFree(&block);
+			}
+		}
+
+		lookupTime = BenchNow() - start;
+		printf("open: %.3f ms, %u blocks; random record by ID: %.1f us\n", openTime*1000, RequestLogReaderBlockCount(reader), lookupTime*1e6 / LOOKUP_COUNT);
+		RequestLogReaderClose(reader);
+	}
+
+	return;
+}
+
+
+int main(void)
+{
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 42, TRUE);
+	_requests = (PREQUEST_HEADER *)calloc(RECORD_COUNT, sizeof(PREQUEST_HEADER));
+	for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+		_requests[i] = TestRequestGenerateNext(&gen);
+		_rawSize += RequestGetSize(_requests[i]);
+	}
+
+	_Write(bcmNone, 0);
+	_Lookup();
+	_Write(bcmFast, 0);
+	_Write(bcmFast, 1);
+	_Write(bcmFast, 4);
+	_Lookup();
+	remove(LOG_FILE_NAME);
+	for (ULONG i = 0; i < RECORD_COUNT; ++i)
+		RequestMemoryFree(_requests[i]);
+
+	free(_requests);
+
+	return 0;
+}
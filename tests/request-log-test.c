@@ -0,0 +1,258 @@
+
+/**
+ * @file
+ *
+ * Tests of the chunked log. Logs written with every compression method,
+ * with and without worker threads and with block sizes from the smallest
+ * one, must read back record by record, with the columns and the block
+ * index agreeing with the records. Searches by ID and by time must find the
+ * right blocks even when times of neighbouring blocks overlap. Damaged
+ * files must be rejected.
+ */
+
+#include <windows.h>
+#include <unistd.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-log.h"
+#include "request-gen.h"
+#include "test.h"
+
+
+#define RECORD_COUNT				30000
+#define LOG_FILE					L"request-log-test.log"
+#define LOG_FILE_NAME				"request-log-test.log"
+
+
+/** Generates the next record; its time may go back a little, as times of
+ *  records coming from different processors do. */
+static PREQUEST_HEADER _Record(PTEST_REQUEST_GEN Gen)
+{
+	PREQUEST_HEADER ret = NULL;
+
+	ret = TestRequestGenerateNext(Gen);
+	ret->Time.QuadPart -= (LONG64)(TestRequestGenRandom(Gen) % 5000);
+
+	return ret;
+}
+
+
+static void _Write(ULONG BlockSize, EBlockCodecMethod Compression, ULONG WorkerCount)
+{
+	PREQUEST_HEADER r = NULL;
+	PREQUEST_LOG_WRITER w = NULL;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 7, TRUE);
+	TEST_CHECK(RequestLogWriterOpen(LOG_FILE, BlockSize, Compression, WorkerCount, &w) == ERROR_VALUE_SUCCESS);
+	for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+		r = _Record(&gen);
+		TEST_CHECK(RequestLogWriterAppend(w, r) == ERROR_VALUE_SUCCESS);
+		RequestMemoryFree(r);
+	}
+
+	TEST_CHECK(RequestLogWriterClose(w) == ERROR_VALUE_SUCCESS);
+
+	return;
+}
+
+
+static void _CheckBlock(PREQUEST_LOG_BLOCK Block, const REQUEST_LOG_INDEX_ENTRY *Entry, PTEST_REQUEST_GEN Gen)
+{
+	PREQUEST_HEADER r = NULL;
+	PREQUEST_HEADER expected = NULL;
+	LONG64 minTime = 0;
+	LONG64 maxTime = 0;
+
+	for (ULONG i = 0; i < Block->RecordCount; ++i) {
+		TEST_CHECK(RequestLogBlockNext(Block, &r) == ERROR_VALUE_SUCCESS && r != NULL);
+		expected = _Record(Gen);
+		TEST_CHECK(RequestGetSize(r) == RequestGetSize(expected));
+		TEST_CHECK(memcmp(r, expected, RequestGetSize(r)) == 0);
+		TEST_CHECK(Block->Types[i] == r->Type);
+		TEST_CHECK(Block->Drivers[i] == (ULONG_PTR)r->Driver);
+		TEST_CHECK(Block->Devices[i] == (ULONG_PTR)r->Device);
+		TEST_CHECK(Block->ProcessIds[i] == (ULONG_PTR)r->ProcessId);
+		if (r->Type == ertIRP)
+			TEST_CHECK(Block->Majors[i] == ((PREQUEST_IRP)r)->MajorFunction);
+
+		if (i == 0 || r->Time.QuadPart < minTime)
+			minTime = r->Time.QuadPart;
+
+		if (i == 0 || r->Time.QuadPart > maxTime)
+			maxTime = r->Time.QuadPart;
+
+		TEST_CHECK(i != 0 || r->Id == Entry->FirstId);
+		TEST_CHECK(i + 1 != Block->RecordCount || r->Id == Entry->LastId);
+		RequestMemoryFree(expected);
+		RequestMemoryFree(r);
+	}
+
+	TEST_CHECK(minTime == Entry->MinTime && maxTime == Entry->MaxTime);
+	TEST_CHECK(RequestLogBlockNext(Block, &r) == ERROR_VALUE_SUCCESS && r == NULL);
+
+	return;
+}
+
+
+static void _TestWriteRead(ULONG BlockSize, EBlockCodecMethod Compression, ULONG WorkerCount)
+{
+	ULONG blockCount = 0;
+	ULONG64 recordCount = 0;
+	REQUEST_LOG_BLOCK block;
+	const REQUEST_LOG_INDEX_ENTRY *e = NULL;
+	PREQUEST_LOG_READER reader = NULL;
+	TEST_REQUEST_GEN gen;
+
+	_Write(BlockSize, Compression, WorkerCount);
+	TEST_CHECK(RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestLogReaderRecordCount(reader) == RECORD_COUNT);
+	blockCount = RequestLogReaderBlockCount(reader);
+	TEST_CHECK(blockCount > 0);
+	if (BlockSize == REQUEST_LOG_MIN_BLOCK_SIZE)
+		TEST_CHECK(blockCount > 100);
+
+	TestRequestGenInit(&gen, 7, TRUE);
+	for (ULONG i = 0; i < blockCount; ++i) {
+		e = RequestLogReaderBlockInfo(reader, i);
+		TEST_CHECK(e != NULL && e->RecordCount > 0);
+		TEST_CHECK(i == 0 || e->FirstId > RequestLogReaderBlockInfo(reader, i - 1)->LastId);
+		TEST_CHECK(RequestLogReaderLoadBlock(reader, i, &block) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(block.RecordCount == e->RecordCount);
+		// Compression pays off for every block of realistic records.
+		TEST_CHECK(Compression == bcmNone || block.Header->Compression == (ULONG)Compression);
+		_CheckBlock(&block, e, &gen);
+		RequestLogBlockFree(&block);
+		recordCount += e->RecordCount;
+	}
+
+	TEST_CHECK(recordCount == RECORD_COUNT);
+	TEST_CHECK(RequestLogReaderBlockInfo(reader, blockCount) == NULL);
+	TEST_CHECK(RequestLogReaderLoadBlock(reader, blockCount, &block) == ERROR_VALUE_INVAL);
+	RequestLogReaderClose(reader);
+
+	return;
+}
+
+
+static void _TestFind(void)
+{
+	ULONG b = 0;
+	ULONG blockCount = 0;
+	LONG64 time = 0;
+	const REQUEST_LOG_INDEX_ENTRY *e = NULL;
+	const REQUEST_LOG_INDEX_ENTRY *first = NULL;
+	const REQUEST_LOG_INDEX_ENTRY *last = NULL;
+	PREQUEST_LOG_READER reader = NULL;
+	TEST_REQUEST_GEN gen;
+
+	_Write(REQUEST_LOG_MIN_BLOCK_SIZE, bcmFast, 2);
+	TEST_CHECK(RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_SUCCESS);
+	blockCount = RequestLogReaderBlockCount(reader);
+	first = RequestLogReaderBlockInfo(reader, 0);
+	last = RequestLogReaderBlockInfo(reader, blockCount - 1);
+	for (ULONG id = first->FirstId; id <= last->LastId; ++id) {
+		b = RequestLogReaderFindById(reader, id);
+		TEST_CHECK(b < blockCount);
+		e = RequestLogReaderBlockInfo(reader, b);
+		TEST_CHECK(e->FirstId <= id && id <= e->LastId);
+	}
+
+	TEST_CHECK(RequestLogReaderFindById(reader, last->LastId + 1) == blockCount);
+	TEST_CHECK(RequestLogReaderFindById(reader, 0) == 0);
+	// The first block found may hold records at or after the time, none of
+	// the blocks before it does.
+	TestRequestGenInit(&gen, 8, TRUE);
+	for (ULONG i = 0; i < 2000; ++i) {
+		time = first->MinTime - 10 + (LONG64)(TestRequestGenRandom(&gen) % (ULONG64)(last->MaxTime - first->MinTime + 20));
+		b = RequestLogReaderFindByTime(reader, time);
+		for (ULONG j = 0; j < b; ++j) {
+			e = RequestLogReaderBlockInfo(reader, j);
+			TEST_CHECK(e->MaxTime < time);
+		}
+
+		TEST_CHECK(b == blockCount || RequestLogReaderBlockInfo(reader, b)->MaxTime >= time);
+	}
+
+	TEST_CHECK(RequestLogReaderFindByTime(reader, first->MinTime) == 0);
+	TEST_CHECK(RequestLogReaderFindByTime(reader, last->MaxTime + 1) == blockCount);
+	RequestLogReaderClose(reader);
+
+	return;
+}
+
+
+static void _Damage(long Offset, const void *Data, size_t Size)
+{
+	FILE *f = NULL;
+
+	f = fopen(LOG_FILE_NAME, "r+b");
+	TEST_CHECK(f != NULL && fseek(f, Offset, SEEK_SET) == 0);
+	TEST_CHECK(fwrite(Data, 1, Size, f) == Size);
+	fclose(f);
+
+	return;
+}
+
+
+static void _TestMalformed(void)
+{
+	ULONG zero = 0;
+	long fileSize = 0;
+	ULONG64 blockOffset = 0;
+	REQUEST_LOG_BLOCK block;
+	PREQUEST_LOG_WRITER w = NULL;
+	PREQUEST_LOG_READER reader = NULL;
+	FILE *f = NULL;
+
+	TEST_CHECK(RequestLogReaderOpen(L"request-log-test-missing.log", &reader) == ERROR_VALUE_IO);
+	TEST_CHECK(RequestLogWriterOpen(LOG_FILE, REQUEST_LOG_MIN_BLOCK_SIZE - 1, bcmNone, 0, &w) == ERROR_VALUE_INVAL);
+	TEST_CHECK(RequestLogWriterOpen(LOG_FILE, 0, bcmHigh, 0, &w) == ERROR_VALUE_INVAL);
+	TEST_CHECK(RequestLogWriterOpen(LOG_FILE, 0, bcmFast, REQUEST_LOG_MAX_WORKERS + 1, &w) == ERROR_VALUE_INVAL);
+
+	// A damaged block is rejected, the others remain readable.
+	_Write(REQUEST_LOG_MIN_BLOCK_SIZE, bcmFast, 0);
+	TEST_CHECK(RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_SUCCESS);
+	blockOffset = RequestLogReaderBlockInfo(reader, 1)->Offset;
+	RequestLogReaderClose(reader);
+	_Damage((long)blockOffset, &zero, sizeof(zero));
+	TEST_CHECK(RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestLogReaderLoadBlock(reader, 1, &block) == ERROR_VALUE_INVAL);
+	TEST_CHECK(RequestLogReaderLoadBlock(reader, 0, &block) == ERROR_VALUE_SUCCESS);
+	RequestLogBlockFree(&block);
+	RequestLogReaderClose(reader);
+
+	// Compressed data that decompress to something else
+	_Write(REQUEST_LOG_MIN_BLOCK_SIZE, bcmFast, 0);
+	_Damage((long)blockOffset + sizeof(REQUEST_LOG_BLOCK_HEADER), &zero, sizeof(zero));
+	TEST_CHECK(RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_SUCCESS);
+	TEST_CHECK(RequestLogReaderLoadBlock(reader, 1, &block) != ERROR_VALUE_SUCCESS);
+	RequestLogReaderClose(reader);
+
+	// A file without its footer, e.g. of a writer that crashed
+	f = fopen(LOG_FILE_NAME, "rb");
+	fseek(f, 0, SEEK_END);
+	fileSize = ftell(f);
+	fclose(f);
+	TEST_CHECK(truncate(LOG_FILE_NAME, fileSize - 1) == 0);
+	TEST_CHECK(RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_INVAL);
+	TEST_CHECK(truncate(LOG_FILE_NAME, 16) == 0);
+	TEST_CHECK(RequestLogReaderOpen(LOG_FILE, &reader) == ERROR_VALUE_IO);
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestWriteRead(0, bcmNone, 0);
+	_TestWriteRead(0, bcmFast, 0);
+	_TestWriteRead(REQUEST_LOG_MIN_BLOCK_SIZE, bcmNone, 0);
+	_TestWriteRead(REQUEST_LOG_MIN_BLOCK_SIZE, bcmFast, 1);
+	_TestWriteRead(REQUEST_LOG_MIN_BLOCK_SIZE, bcmFast, 4);
+	_TestFind();
+	_TestMalformed();
+	remove(LOG_FILE_NAME);
+
+	return TEST_RESULT();
+}
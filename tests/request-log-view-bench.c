@@ -0,0 +1,111 @@
+
+/**
+ * @file
+ *
+ * Cost of opening a flat log through the memory-mapped view, i.e. of
+ * building its index, and latency of reaching a random record, for several
+ * index strides.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-log.h"
+#include "request-log-view.h"
+#include "request-gen.h"
+#include "bench.h"
+
+
+#define RECORD_COUNT				1000000
+#define LOOKUP_COUNT				200000
+#define LOG_FILE					L"request-log-view-bench.log"
+#define LOG_FILE_NAME				"request-log-view-bench.log"
+
+
+static size_t _Write(void)
+{
+	ULONG recordSize = 0;
+	size_t ret = 0;
+	FILE *f = NULL;
+	PREQUEST_HEADER r = NULL;
+	REQUEST_LOG_HEADER_V1 hdr;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 42, TRUE);
+	f = fopen(LOG_FILE_NAME, "wb");
+	if (f != NULL) {
+		hdr.Signature = REQUEST_LOG_SIGNATURE;
+		hdr.Version = REQUEST_LOG_VERSION_1;
+		hdr.Architecture = REQUEST_LOG_ARCHITECTURE;
+		fwrite(&hdr, sizeof(hdr), 1, f);
+		ret = sizeof(hdr);
+		for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+			r = TestRequestGenerateNext(&gen);
+			recordSize = (ULONG)RequestGetSize(r);
+			fwrite(&recordSize, sizeof(recordSize), 1, f);
+			fwrite(r, recordSize, 1, f);
+			ret += sizeof(recordSize) + recordSize;
+			RequestMemoryFree(r);
+		}
+
+		fclose(f);
+	}
+
+	return ret;
+}
+
+
+static void _Measure(ULONG Stride, size_t FileSize)
+{
+	ULONG64 index = 0;
+	ULONG64 sum = 0;
+	double start = 0;
+	double openTime = 0;
+	double lookupTime = 0;
+	double scanTime = 0;
+	const REQUEST_HEADER *r = NULL;
+	PREQUEST_LOG_VIEW view = NULL;
+	REQUEST_LOG_VIEW_CURSOR cursor;
+	TEST_REQUEST_GEN gen;
+
+	start = BenchNow();
+	if (RequestLogViewOpen(LOG_FILE, Stride, &view) == ERROR_VALUE_SUCCESS) {
+		openTime = BenchNow() - start;
+		TestRequestGenInit(&gen, 3, FALSE);
+		start = BenchNow();
+		for (ULONG i = 0; i < LOOKUP_COUNT; ++i) {
+			index = TestRequestGenRandom(&gen) % RequestLogViewCount(view);
+			r = RequestLogViewGet(view, index);
+			sum += ((const UCHAR *)r)[sizeof(LIST_ENTRY)];
+		}
+
+		lookupTime = BenchNow() - start;
+		start = BenchNow();
+		RequestLogViewSeek(view, 0, &cursor);
+		while ((r = RequestLogViewNext(view, &cursor)) != NULL)
+			sum += ((const UCHAR *)r)[sizeof(LIST_ENTRY)];
+
+		scanTime = BenchNow() - start;
+		printf("stride %4u: index %7.1f ms (%6.1f MB/s), %8.1f KB; random record %6.3f us; scan %8.1f MB/s [%llu]\n",
+			Stride, openTime*1000, BenchMBps((double)FileSize, openTime), (RequestLogViewCount(view) + Stride - 1) / Stride*8.0 / 1024,
+			lookupTime*1e6 / LOOKUP_COUNT, BenchMBps((double)FileSize, scanTime), (unsigned long long)sum);
+		RequestLogViewClose(view);
+	}
+
+	return;
+}
+
+
+int main(void)
+{
+	size_t fileSize = 0;
+
+	fileSize = _Write();
+	printf("%u records, %.1f MB\n", RECORD_COUNT, fileSize / (1024.0*1024.0));
+	_Measure(1, fileSize);
+	_Measure(16, fileSize);
+	_Measure(256, fileSize);
+	remove(LOG_FILE_NAME);
+
+	return 0;
+}
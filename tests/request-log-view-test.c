@@ -0,0 +1,271 @@
+
+/**
+ * @file
+ *
+ * Tests of the memory-mapped view of flat logs. Logs with and without the
+ * header must be indexed with any stride so that every record is reached
+ * both by its index and by walking a cursor, and the records must equal
+ * the ones written. Truncated files, damaged sizes and foreign headers must
+ * be rejected when the view is opened, not when a record is accessed.
+ */
+
+#include <windows.h>
+#include "general-types.h"
+#include "request.h"
+#include "request-log.h"
+#include "request-log-view.h"
+#include "request-gen.h"
+#include "test.h"
+
+
+#define RECORD_COUNT				5000
+#define LOG_FILE					L"request-log-view-test.log"
+#define LOG_FILE_NAME				"request-log-view-test.log"
+
+
+typedef struct _LOG_IMAGE {
+	PUCHAR Data;
+	size_t Size;
+	size_t HeaderSize;
+	PREQUEST_HEADER Requests[RECORD_COUNT];
+	/** Offsets of the size fields of the records. */
+	size_t Offsets[RECORD_COUNT + 1];
+} LOG_IMAGE, *PLOG_IMAGE;
+
+
+static LOG_IMAGE _image;
+
+
+/** Builds the file contents in memory, so damaged copies can be written. */
+static void _ImageBuild(PLOG_IMAGE Image, BOOLEAN Header)
+{
+	ULONG recordSize = 0;
+	size_t capacity = 0;
+	REQUEST_LOG_HEADER_V1 hdr;
+	TEST_REQUEST_GEN gen;
+
+	TestRequestGenInit(&gen, 11, TRUE);
+	capacity = 0x10000;
+	Image->Data = (PUCHAR)malloc(capacity);
+	Image->Size = 0;
+	if (Header) {
+		hdr.Signature = REQUEST_LOG_SIGNATURE;
+		hdr.Version = REQUEST_LOG_VERSION_1;
+		hdr.Architecture = REQUEST_LOG_ARCHITECTURE;
+		memcpy(Image->Data, &hdr, sizeof(hdr));
+		Image->Size = sizeof(hdr);
+	}
+
+	Image->HeaderSize = Image->Size;
+	for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+		Image->Requests[i] = TestRequestGenerateNext(&gen);
+		recordSize = (ULONG)RequestGetSize(Image->Requests[i]);
+		while (capacity - Image->Size < sizeof(recordSize) + recordSize) {
+			capacity *= 2;
+			Image->Data = (PUCHAR)realloc(Image->Data, capacity);
+		}
+
+		Image->Offsets[i] = Image->Size;
+		memcpy(Image->Data + Image->Size, &recordSize, sizeof(recordSize));
+		Image->Size += sizeof(recordSize);
+		memcpy(Image->Data + Image->Size, Image->Requests[i], recordSize);
+		Image->Size += recordSize;
+	}
+
+	Image->Offsets[RECORD_COUNT] = Image->Size;
+
+	return;
+}
+
+
+static void _ImageFree(PLOG_IMAGE Image)
+{
+	for (ULONG i = 0; i < RECORD_COUNT; ++i)
+		RequestMemoryFree(Image->Requests[i]);
+
+	free(Image->Data);
+	memset(Image, 0, sizeof(LOG_IMAGE));
+
+	return;
+}
+
+
+static void _FileWrite(const void *Data, size_t Size)
+{
+	FILE *f = NULL;
+
+	f = fopen(LOG_FILE_NAME, "wb");
+	TEST_CHECK(f != NULL);
+	if (f != NULL) {
+		TEST_CHECK(Size == 0 || fwrite(Data, Size, 1, f) == 1);
+		fclose(f);
+	}
+
+	return;
+}
+
+
+static BOOLEAN _Equal(const REQUEST_HEADER *Record, ULONG Index)
+{
+	size_t size = 0;
+	BOOLEAN ret = FALSE;
+
+	size = _image.Offsets[Index + 1] - _image.Offsets[Index] - sizeof(ULONG);
+	ret = (Record != NULL && memcmp(Record, _image.Requests[Index], size) == 0);
+
+	return ret;
+}
+
+
+static void _TestRead(BOOLEAN Header)
+{
+	static const ULONG strides[] = {0, 1, 3, 64, RECORD_COUNT + 1};
+	ULONG index = 0;
+	const REQUEST_HEADER *r = NULL;
+	PREQUEST_LOG_VIEW view = NULL;
+	REQUEST_LOG_VIEW_CURSOR cursor;
+	TEST_REQUEST_GEN gen;
+
+	_ImageBuild(&_image, Header);
+	_FileWrite(_image.Data, _image.Size);
+	TestRequestGenInit(&gen, 12, FALSE);
+	for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); ++s) {
+		TEST_CHECK(RequestLogViewOpen(LOG_FILE, strides[s], &view) == ERROR_VALUE_SUCCESS);
+		TEST_CHECK(RequestLogViewCount(view) == RECORD_COUNT);
+		// A cursor walks the whole log.
+		TEST_CHECK(RequestLogViewSeek(view, 0, &cursor) == ERROR_VALUE_SUCCESS);
+		for (ULONG i = 0; i < RECORD_COUNT; ++i) {
+			TEST_CHECK(cursor.Index == i && cursor.Offset == _image.Offsets[i]);
+			r = RequestLogViewNext(view, &cursor);
+			TEST_CHECK(_Equal(r, i));
+			TEST_CHECK(RequestValidate(r, _image.Offsets[i + 1] - _image.Offsets[i] - sizeof(ULONG)));
+		}
+
+		TEST_CHECK(RequestLogViewNext(view, &cursor) == NULL);
+		// Random records, and short walks from them
+		for (ULONG i = 0; i < 1000; ++i) {
+			index = (ULONG)(TestRequestGenRandom(&gen) % RECORD_COUNT);
+			TEST_CHECK(_Equal(RequestLogViewGet(view, index), index));
+			TEST_CHECK(RequestLogViewSeek(view, index, &cursor) == ERROR_VALUE_SUCCESS);
+			for (ULONG j = index; j < index + 3 && j < RECORD_COUNT; ++j)
+				TEST_CHECK(_Equal(RequestLogViewNext(view, &cursor), j));
+		}
+
+		TEST_CHECK(RequestLogViewGet(view, RECORD_COUNT) == NULL);
+		TEST_CHECK(RequestLogViewSeek(view, RECORD_COUNT, &cursor) == ERROR_VALUE_INVAL);
+		RequestLogViewClose(view);
+	}
+
+	_ImageFree(&_image);
+
+	return;
+}
+
+
+/** Only cuts at record boundaries give a valid (shorter) log. */
+static void _TestTruncated(void)
+{
+	ULONG boundary = 0;
+	PREQUEST_LOG_VIEW view = NULL;
+	ERROR_TYPE err = ERROR_VALUE_SUCCESS;
+
+	_ImageBuild(&_image, TRUE);
+	for (size_t size = 1; size < _image.Offsets[40]; ++size) {
+		_FileWrite(_image.Data, size);
+		err = RequestLogViewOpen(LOG_FILE, 4, &view);
+		while (_image.Offsets[boundary] < size)
+			++boundary;
+
+		if (size == _image.HeaderSize || size == _image.Offsets[boundary]) {
+			TEST_CHECK(err == ERROR_VALUE_SUCCESS);
+			if (err == ERROR_VALUE_SUCCESS) {
+				TEST_CHECK(RequestLogViewCount(view) == boundary);
+				RequestLogViewClose(view);
+			}
+		} else TEST_CHECK(err == ERROR_VALUE_INVAL);
+	}
+
+	_ImageFree(&_image);
+
+	return;
+}
+
+
+static void _TestDamaged(void)
+{
+	ULONG recordSize = 0;
+	PUCHAR copy = NULL;
+	PREQUEST_LOG_VIEW view = NULL;
+	REQUEST_LOG_HEADER_V1 hdr;
+	TEST_REQUEST_GEN gen;
+	ERROR_TYPE err = ERROR_VALUE_SUCCESS;
+
+	_ImageBuild(&_image, TRUE);
+	copy = (PUCHAR)malloc(_image.Size);
+	TestRequestGenInit(&gen, 13, FALSE);
+	// Sizes pointing past the file or into the next record
+	for (ULONG i = 0; i < 200; ++i) {
+		memcpy(copy, _image.Data, _image.Size);
+		recordSize = (ULONG)TestRequestGenRandom(&gen);
+		if (i % 2 == 0)
+			recordSize %= 64;
+
+		memcpy(copy + _image.Offsets[i], &recordSize, sizeof(recordSize));
+		if (recordSize == _image.Offsets[i + 1] - _image.Offsets[i] - sizeof(recordSize))
+			continue;
+
+		_FileWrite(copy, _image.Size);
+		TEST_CHECK(RequestLogViewOpen(LOG_FILE, 1, &view) == ERROR_VALUE_INVAL);
+	}
+
+	// Damaged record contents never crash the view.
+	for (ULONG i = 0; i < 200; ++i) {
+		memcpy(copy, _image.Data, _image.Size);
+		for (ULONG j = 0; j < 4; ++j)
+			copy[_image.HeaderSize + TestRequestGenRandom(&gen) % (_image.Size - _image.HeaderSize)] ^= (UCHAR)(1 + TestRequestGenRandom(&gen) % 255);
+
+		_FileWrite(copy, _image.Size);
+		err = RequestLogViewOpen(LOG_FILE, 1, &view);
+		TEST_CHECK(err == ERROR_VALUE_SUCCESS || err == ERROR_VALUE_INVAL);
+		if (err == ERROR_VALUE_SUCCESS) {
+			for (ULONG64 k = 0; k < RequestLogViewCount(view); ++k)
+				TEST_CHECK(RequestLogViewGet(view, k) != NULL);
+
+			RequestLogViewClose(view);
+		}
+	}
+
+	// Headers of other versions and architectures
+	memcpy(copy, _image.Data, _image.Size);
+	memcpy(&hdr, copy, sizeof(hdr));
+	hdr.Version = REQUEST_LOG_VERSION_2;
+	memcpy(copy, &hdr, sizeof(hdr));
+	_FileWrite(copy, _image.Size);
+	TEST_CHECK(RequestLogViewOpen(LOG_FILE, 1, &view) == ERROR_VALUE_INVAL);
+	hdr.Version = REQUEST_LOG_VERSION_1;
+	hdr.Architecture = (REQUEST_LOG_ARCHITECTURE == REQUEST_LOG_ARCHITECTURE_X64) ? REQUEST_LOG_ARCHITECTURE_X86 : REQUEST_LOG_ARCHITECTURE_X64;
+	memcpy(copy, &hdr, sizeof(hdr));
+	_FileWrite(copy, _image.Size);
+	TEST_CHECK(RequestLogViewOpen(LOG_FILE, 1, &view) == ERROR_VALUE_INVAL);
+	// Empty and missing files
+	_FileWrite(NULL, 0);
+	TEST_CHECK(RequestLogViewOpen(LOG_FILE, 1, &view) == ERROR_VALUE_INVAL);
+	remove(LOG_FILE_NAME);
+	TEST_CHECK(RequestLogViewOpen(LOG_FILE, 1, &view) != ERROR_VALUE_SUCCESS);
+	free(copy);
+	_ImageFree(&_image);
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestRead(TRUE);
+	_TestRead(FALSE);
+	_TestTruncated();
+	_TestDamaged();
+	remove(LOG_FILE_NAME);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,116 @@
+
+/**
+ * @file
+ *
+ * FastIo record slots against the request caches. Records of the FastIo size
+ * come from the slots of the current processor or from the size-class cache
+ * RequestMemoryAlloc uses when FASTIO_RECORD_SLOTS is undefined; they are
+ * freed right after the allocation or in bursts shorter and longer than the
+ * slots of one processor, then 1 to 16 threads on their own processors
+ * allocate and free at once.
+ */
+
+#include <ntifs.h>
+#include "request.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_THREAD {
+	pthread_t Thread;
+	ULONG Index;
+	BOOLEAN Slots;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+#define OPERATION_COUNT				2000000
+#define THREAD_OPERATION_COUNT		1000000
+#define BURST_LENGTH				1024
+
+
+static PREQUEST_HEADER _Alloc(BOOLEAN Slots)
+{
+	return (Slots) ? RequestMemoryAllocSlot(sizeof(REQUEST_FASTIO)) : RequestMemoryAlloc(sizeof(REQUEST_FASTIO));
+}
+
+
+/** Returns nanoseconds per allocation and free. */
+static double _MeasureBursts(BOOLEAN Slots, ULONG BurstLength)
+{
+	double start = 0;
+	PREQUEST_HEADER records[BURST_LENGTH];
+
+	start = BenchNow();
+	for (ULONG i = 0; i < OPERATION_COUNT / BurstLength; ++i) {
+		for (ULONG j = 0; j < BurstLength; ++j)
+			records[j] = _Alloc(Slots);
+
+		for (ULONG j = 0; j < BurstLength; ++j)
+			RequestMemoryFree(records[j]);
+	}
+
+	start = BenchNow() - start;
+
+	return start * 1e9 / OPERATION_COUNT;
+}
+
+
+static void *_Worker(void *Context)
+{
+	PBENCH_THREAD t = (PBENCH_THREAD)Context;
+
+	ShimProcessor = t->Index;
+	for (ULONG i = 0; i < THREAD_OPERATION_COUNT; ++i)
+		RequestMemoryFree(_Alloc(t->Slots));
+
+	return NULL;
+}
+
+
+/** Returns millions of allocations and frees per second. */
+static double _MeasureThreads(BOOLEAN Slots, ULONG ThreadCount)
+{
+	double start = 0;
+	BENCH_THREAD threads[SHIM_PROCESSOR_COUNT];
+
+	start = BenchNow();
+	for (ULONG i = 0; i < ThreadCount; ++i) {
+		threads[i].Index = i;
+		threads[i].Slots = Slots;
+		pthread_create(&threads[i].Thread, NULL, _Worker, threads + i);
+	}
+
+	for (ULONG i = 0; i < ThreadCount; ++i)
+		pthread_join(threads[i].Thread, NULL);
+
+	start = BenchNow() - start;
+
+	return (double)THREAD_OPERATION_COUNT*ThreadCount / start / 1e6;
+}
+
+
+int main(void)
+{
+	ULONG64 hits = 0;
+	ULONG64 misses = 0;
+	LONG64 outstanding = 0;
+
+	RequestMemoryModuleInit(NULL, NULL, NULL);
+	printf("One thread, %u-byte FastIo records\n", (ULONG)sizeof(REQUEST_FASTIO));
+	for (ULONG burst = 1; burst <= BURST_LENGTH; burst *= 4) {
+		printf("  bursts of %4u: slots %6.1f ns, request cache %6.1f ns per allocation and free\n", burst,
+			_MeasureBursts(TRUE, burst), _MeasureBursts(FALSE, burst));
+	}
+
+	printf("Threads on their own processors\n");
+	for (ULONG threadCount = 1; threadCount <= SHIM_PROCESSOR_COUNT; threadCount *= 2) {
+		printf("  %2u threads: slots %7.2f M, request cache %7.2f M allocations and frees/s\n", threadCount,
+			_MeasureThreads(TRUE, threadCount), _MeasureThreads(FALSE, threadCount));
+	}
+
+	ShimProcessor = 0;
+	RequestMemoryQueryStatistics(&hits, &misses, &outstanding);
+	printf("Request cache hits %llu, misses %llu, outstanding %lld\n", (unsigned long long)hits, (unsigned long long)misses, (long long)outstanding);
+	RequestMemoryModuleFinit(NULL, NULL, NULL);
+
+	return 0;
+}
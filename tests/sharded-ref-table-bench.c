@@ -0,0 +1,220 @@
+
+/**
+ * @file
+ *
+ * Throughput of sharded reference tables against a general hash table
+ * guarded by a spin lock, the way the file object and process context
+ * tables were kept before. Threads pretending to run on different
+ * processors look objects up and reference them; a part of the operations
+ * replaces an object by a new one, as closing and opening files does.
+ */
+
+#include <ntifs.h>
+#include <stdlib.h>
+#include "hash_table.h"
+#include "sharded-ref-table.h"
+#include "bench.h"
+
+
+typedef struct _BENCH_OBJECT {
+	HASH_ITEM HashItem;
+	volatile LONG ReferenceCount;
+	PVOID Key;
+	PVOID NextRetired;
+} BENCH_OBJECT, *PBENCH_OBJECT;
+
+typedef struct _BENCH_THREAD {
+	pthread_t Thread;
+	ULONG Index;
+	ULONG WritePercent;
+	BOOLEAN Sharded;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+#define KEY_COUNT					4096
+#define OPERATION_COUNT				1000000
+
+
+static SHARDED_REF_TABLE _shardedTable;
+static PHASH_TABLE _hashTable = NULL;
+static KSPIN_LOCK _hashTableLock;
+
+
+static ULONG32 _HashFunction(PVOID Key)
+{
+	return (ULONG32)((ULONG_PTR)Key * 2654435761u);
+}
+
+static BOOLEAN _CompareFunction(PHASH_ITEM Item, PVOID Key)
+{
+	return (CONTAINING_RECORD(Item, BENCH_OBJECT, HashItem)->Key == Key);
+}
+
+static VOID _FreeFunction(PHASH_ITEM Item)
+{
+	free(CONTAINING_RECORD(Item, BENCH_OBJECT, HashItem));
+}
+
+static VOID _Reference(PVOID Object)
+{
+	InterlockedIncrement(&((PBENCH_OBJECT)Object)->ReferenceCount);
+}
+
+static VOID _Dereference(PVOID Object)
+{
+	if (InterlockedDecrement(&((PBENCH_OBJECT)Object)->ReferenceCount) == 0)
+		free(Object);
+}
+
+static PBENCH_OBJECT _ObjectAlloc(PVOID Key)
+{
+	PBENCH_OBJECT ret = NULL;
+
+	ret = (PBENCH_OBJECT)calloc(1, sizeof(BENCH_OBJECT));
+	ret->ReferenceCount = 1;
+	ret->Key = Key;
+
+	return ret;
+}
+
+static PVOID _Key(ULONG Index)
+{
+	return (PVOID)(((ULONG_PTR)Index + 1) * 0x40);
+}
+
+
+/************************************************************************/
+/*                   SPIN LOCK AND HASH TABLE                           */
+/************************************************************************/
+
+static PBENCH_OBJECT _HashGet(PVOID Key)
+{
+	KIRQL irql;
+	PHASH_ITEM h = NULL;
+	PBENCH_OBJECT ret = NULL;
+
+	KeAcquireSpinLock(&_hashTableLock, &irql);
+	h = HashTableGet(_hashTable, Key);
+	if (h != NULL) {
+		ret = CONTAINING_RECORD(h, BENCH_OBJECT, HashItem);
+		_Reference(ret);
+	}
+
+	KeReleaseSpinLock(&_hashTableLock, irql);
+
+	return ret;
+}
+
+static void _HashReplace(PVOID Key)
+{
+	KIRQL irql;
+	PHASH_ITEM h = NULL;
+	PBENCH_OBJECT o = NULL;
+
+	o = _ObjectAlloc(Key);
+	KeAcquireSpinLock(&_hashTableLock, &irql);
+	h = HashTableDelete(_hashTable, Key);
+	HashTableInsert(_hashTable, &o->HashItem, Key);
+	KeReleaseSpinLock(&_hashTableLock, irql);
+	if (h != NULL)
+		_Dereference(CONTAINING_RECORD(h, BENCH_OBJECT, HashItem));
+
+	return;
+}
+
+
+/************************************************************************/
+/*                   BENCHMARK                                          */
+/************************************************************************/
+
+static void *_Worker(void *Context)
+{
+	ULONG r = 0;
+	PVOID key = NULL;
+	PBENCH_OBJECT o = NULL;
+	PBENCH_THREAD t = (PBENCH_THREAD)Context;
+	unsigned int seed = t->Index + 1;
+
+	ShimProcessor = t->Index;
+	for (ULONG i = 0; i < OPERATION_COUNT; ++i) {
+		r = (ULONG)rand_r(&seed);
+		key = _Key(r % KEY_COUNT);
+		if ((r >> 16) % 100 < t->WritePercent) {
+			if (t->Sharded) {
+				ShardedRefTableDeleteDereference(&_shardedTable, key);
+				o = _ObjectAlloc(key);
+				ShardedRefTableInsert(&_shardedTable, o);
+				_Dereference(o);
+			} else _HashReplace(key);
+		} else {
+			o = (t->Sharded) ?
+				(PBENCH_OBJECT)ShardedRefTableGet(&_shardedTable, key) :
+				_HashGet(key);
+			if (o != NULL)
+				_Dereference(o);
+		}
+	}
+
+	return NULL;
+}
+
+
+static double _Run(BOOLEAN Sharded, ULONG ThreadCount, ULONG WritePercent)
+{
+	double start = 0;
+	PBENCH_OBJECT o = NULL;
+	BENCH_THREAD threads[SHIM_PROCESSOR_COUNT];
+
+	ShimProcessor = 0;
+	if (Sharded)
+		ShardedRefTableInit(FIELD_OFFSET(BENCH_OBJECT, Key), FIELD_OFFSET(BENCH_OBJECT, NextRetired), _Reference, _Dereference, &_shardedTable);
+	else {
+		KeInitializeSpinLock(&_hashTableLock);
+		HashTableCreate(httNoSynchronization, 37, _HashFunction, _CompareFunction, _FreeFunction, &_hashTable);
+	}
+
+	for (ULONG i = 0; i < KEY_COUNT; ++i) {
+		o = _ObjectAlloc(_Key(i));
+		if (Sharded) {
+			ShardedRefTableInsert(&_shardedTable, o);
+			_Dereference(o);
+		} else HashTableInsert(_hashTable, &o->HashItem, o->Key);
+	}
+
+	start = BenchNow();
+	for (ULONG i = 0; i < ThreadCount; ++i) {
+		threads[i].Index = i;
+		threads[i].WritePercent = WritePercent;
+		threads[i].Sharded = Sharded;
+		pthread_create(&threads[i].Thread, NULL, _Worker, threads + i);
+	}
+
+	for (ULONG i = 0; i < ThreadCount; ++i)
+		pthread_join(threads[i].Thread, NULL);
+
+	start = BenchNow() - start;
+	ShimProcessor = 0;
+	if (Sharded) {
+		ShardedRefTableClear(&_shardedTable);
+		ShardedRefTableFinit(&_shardedTable);
+	} else HashTableDestroy(_hashTable);
+
+	return (double)OPERATION_COUNT*ThreadCount / start / 1e6;
+}
+
+
+int main(void)
+{
+	static const ULONG writePercents[] = { 0, 1, 10 };
+
+	for (size_t w = 0; w < sizeof(writePercents) / sizeof(writePercents[0]); ++w) {
+		printf("%u %% replacements\n", writePercents[w]);
+		for (ULONG threadCount = 1; threadCount <= SHIM_PROCESSOR_COUNT; threadCount *= 2) {
+			printf("  %2u threads: spin lock %7.2f M ops/s, sharded %7.2f M ops/s\n", threadCount,
+				_Run(FALSE, threadCount, writePercents[w]),
+				_Run(TRUE, threadCount, writePercents[w]));
+		}
+	}
+
+	return 0;
+}
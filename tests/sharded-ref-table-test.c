@@ -0,0 +1,216 @@
+
+/**
+ * @file
+ *
+ * Stress test of sharded reference tables. Threads pretending to run on
+ * different processors insert, delete, look up and enumerate objects of
+ * a small key space at once. An object whose last reference is dropped
+ * is marked dead instead of being freed, so a reader reaching it through
+ * memory released too early is detected. The test also checks that memory
+ * retired by the writers is released by lookups and enumerations alone,
+ * and that clearing the table releases everything at once.
+ */
+
+#include <ntifs.h>
+#include "sharded-ref-table.h"
+#include "test.h"
+
+
+typedef struct _TEST_OBJECT {
+	volatile LONG ReferenceCount;
+	volatile LONG Dead;
+	PVOID Key;
+	PVOID NextRetired;
+	struct _TEST_OBJECT *NextAllocated;
+} TEST_OBJECT, *PTEST_OBJECT;
+
+
+#define THREAD_COUNT				8
+#define KEY_COUNT					512
+#define OPERATION_COUNT				200000
+
+
+static SHARDED_REF_TABLE _table;
+static PTEST_OBJECT volatile _allocated = NULL;
+static volatile LONG _liveCount = 0;
+
+
+static VOID _Reference(PVOID Object)
+{
+	PTEST_OBJECT o = (PTEST_OBJECT)Object;
+
+	TEST_CHECK(!o->Dead);
+	TEST_CHECK(InterlockedIncrement(&o->ReferenceCount) > 1);
+
+	return;
+}
+
+static VOID _Dereference(PVOID Object)
+{
+	PTEST_OBJECT o = (PTEST_OBJECT)Object;
+
+	TEST_CHECK(!o->Dead);
+	if (InterlockedDecrement(&o->ReferenceCount) == 0) {
+		o->Dead = TRUE;
+		InterlockedDecrement(&_liveCount);
+	}
+
+	return;
+}
+
+static PTEST_OBJECT _ObjectAlloc(PVOID Key)
+{
+	PTEST_OBJECT ret = NULL;
+	PTEST_OBJECT head = NULL;
+
+	ret = (PTEST_OBJECT)calloc(1, sizeof(TEST_OBJECT));
+	ret->ReferenceCount = 1;
+	ret->Key = Key;
+	InterlockedIncrement(&_liveCount);
+	do {
+		head = _allocated;
+		ret->NextAllocated = head;
+	} while (InterlockedCompareExchangePointer((PVOID volatile *)&_allocated, ret, head) != head);
+
+	return ret;
+}
+
+static void _ObjectsFree(void)
+{
+	PTEST_OBJECT o = NULL;
+
+	while (_allocated != NULL) {
+		o = _allocated;
+		_allocated = o->NextAllocated;
+		TEST_CHECK(o->Dead);
+		free(o);
+	}
+
+	return;
+}
+
+static PVOID _Key(ULONG Index)
+{
+	return (PVOID)(((ULONG_PTR)Index + 1) * 0x40);
+}
+
+
+static void *_Worker(void *Context)
+{
+	ULONG r = 0;
+	ULONG count = 0;
+	PVOID key = NULL;
+	PVOID *objects = NULL;
+	PTEST_OBJECT o = NULL;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	unsigned int seed = (unsigned int)(ULONG_PTR)Context;
+
+	ShimProcessor = (ULONG)(ULONG_PTR)Context;
+	for (ULONG i = 0; i < OPERATION_COUNT; ++i) {
+		r = (ULONG)rand_r(&seed);
+		key = _Key(r % KEY_COUNT);
+		switch ((r >> 16) % 16) {
+			case 0:
+			case 1:
+			case 2:
+				o = _ObjectAlloc(key);
+				status = ShardedRefTableInsert(&_table, o);
+				TEST_CHECK(status == STATUS_SUCCESS || status == STATUS_OBJECT_NAME_COLLISION);
+				_Dereference(o);
+				break;
+			case 3:
+			case 4:
+			case 5:
+				ShardedRefTableDeleteDereference(&_table, key);
+				break;
+			case 6:
+				if (i % 64 == 0 && NT_SUCCESS(ShardedRefTableEnum(&_table, &objects, &count))) {
+					for (ULONG j = 0; j < count; ++j)
+						_Dereference(objects[j]);
+
+					if (objects != NULL)
+						free(objects);
+				}
+				break;
+			default:
+				o = (PTEST_OBJECT)ShardedRefTableGet(&_table, key);
+				if (o != NULL) {
+					TEST_CHECK(o->Key == key);
+					_Dereference(o);
+				}
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void _TestStress(void)
+{
+	pthread_t threads[THREAD_COUNT];
+
+	TEST_CHECK(NT_SUCCESS(ShardedRefTableInit(FIELD_OFFSET(TEST_OBJECT, Key), FIELD_OFFSET(TEST_OBJECT, NextRetired), _Reference, _Dereference, &_table)));
+	for (ULONG_PTR t = 0; t < THREAD_COUNT; ++t)
+		pthread_create(threads + t, NULL, _Worker, (void *)t);
+
+	for (ULONG t = 0; t < THREAD_COUNT; ++t)
+		pthread_join(threads[t], NULL);
+
+	ShimProcessor = 0;
+	TEST_CHECK(_liveCount <= KEY_COUNT*SHARDED_REF_EPOCHS + KEY_COUNT);
+	ShardedRefTableClear(&_table);
+	TEST_CHECK(_liveCount == 0);
+	ShardedRefTableFinit(&_table);
+	TEST_CHECK(_liveCount == 0);
+	_ObjectsFree();
+
+	return;
+}
+
+
+/** Memory retired by the writers must be released even if no writer comes later. */
+static void _TestReclaimWithoutWriters(BOOLEAN UseEnum)
+{
+	ULONG count = 0;
+	PVOID *objects = NULL;
+	PTEST_OBJECT o = NULL;
+
+	ShimProcessor = 0;
+	TEST_CHECK(NT_SUCCESS(ShardedRefTableInit(FIELD_OFFSET(TEST_OBJECT, Key), FIELD_OFFSET(TEST_OBJECT, NextRetired), _Reference, _Dereference, &_table)));
+	for (ULONG i = 0; i < KEY_COUNT; ++i) {
+		o = _ObjectAlloc(_Key(i));
+		TEST_CHECK(ShardedRefTableInsert(&_table, o) == STATUS_SUCCESS);
+		_Dereference(o);
+	}
+
+	for (ULONG i = 0; i < KEY_COUNT; ++i)
+		ShardedRefTableDeleteDereference(&_table, _Key(i));
+
+	TEST_CHECK(_liveCount > 0);
+	for (ULONG round = 0; round < 16 && _liveCount > 0; ++round) {
+		if (UseEnum) {
+			TEST_CHECK(NT_SUCCESS(ShardedRefTableEnum(&_table, &objects, &count)));
+			TEST_CHECK(count == 0 && objects == NULL);
+		} else {
+			for (ULONG i = 0; i < KEY_COUNT; ++i)
+				TEST_CHECK(ShardedRefTableGet(&_table, _Key(i)) == NULL);
+		}
+	}
+
+	TEST_CHECK(_liveCount == 0);
+	ShardedRefTableFinit(&_table);
+	_ObjectsFree();
+
+	return;
+}
+
+
+int main(void)
+{
+	_TestStress();
+	_TestReclaimWithoutWriters(FALSE);
+	_TestReclaimWithoutWriters(TRUE);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,58 @@
+
+/**
+ * @file
+ *
+ * Stand-in for the Windows Compression API. Its library is never loaded
+ * by the shim, so the routines exist only to satisfy the compiler and fail.
+ */
+
+#ifndef __TESTS_SHIM_COMPRESSAPI_H__
+#define __TESTS_SHIM_COMPRESSAPI_H__
+
+#include <windows.h>
+
+
+typedef void *COMPRESSOR_HANDLE, *DECOMPRESSOR_HANDLE;
+
+#define COMPRESS_ALGORITHM_XPRESS_HUFF	4
+#define COMPRESS_RAW					(1UL << 29)
+
+
+static inline BOOL CreateCompressor(DWORD Algorithm, PVOID AllocationRoutines, COMPRESSOR_HANDLE *Handle)
+{
+	(void)Algorithm;
+	(void)AllocationRoutines;
+	*Handle = NULL;
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return FALSE;
+}
+
+static inline BOOL Compress(COMPRESSOR_HANDLE Handle, LPCVOID Data, SIZE_T DataSize, PVOID Buffer, SIZE_T BufferSize, SIZE_T *Written)
+{
+	(void)Handle;
+	(void)Data;
+	(void)DataSize;
+	(void)Buffer;
+	(void)BufferSize;
+	*Written = 0;
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return FALSE;
+}
+
+static inline BOOL CloseCompressor(COMPRESSOR_HANDLE Handle) { (void)Handle; return TRUE; }
+
+static inline BOOL CreateDecompressor(DWORD Algorithm, PVOID AllocationRoutines, DECOMPRESSOR_HANDLE *Handle)
+{
+	return CreateCompressor(Algorithm, AllocationRoutines, Handle);
+}
+
+static inline BOOL Decompress(DECOMPRESSOR_HANDLE Handle, LPCVOID Data, SIZE_T DataSize, PVOID Buffer, SIZE_T BufferSize, SIZE_T *Written)
+{
+	return Compress(Handle, Data, DataSize, Buffer, BufferSize, Written);
+}
+
+static inline BOOL CloseDecompressor(DECOMPRESSOR_HANDLE Handle) { (void)Handle; return TRUE; }
+
+
+
+#endif
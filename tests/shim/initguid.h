@@ -0,0 +1,19 @@
+/**
+ * @file
+ *
+ * Stand-in for initguid.h: DEFINE_GUID defines each GUID within its
+ * translation unit.
+ */
+
+#ifndef __TESTS_SHIM_INITGUID_H__
+#define __TESTS_SHIM_INITGUID_H__
+
+#include <windows.h>
+
+
+#define DEFINE_GUID(aName, aL, aW1, aW2, aB1, aB2, aB3, aB4, aB5, aB6, aB7, aB8)		\
+	static const GUID aName = { aL, aW1, aW2, { aB1, aB2, aB3, aB4, aB5, aB6, aB7, aB8 } }
+
+
+
+#endif
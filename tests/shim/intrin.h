@@ -0,0 +1,44 @@
+
+/**
+ * @file
+ *
+ * Stand-in for the CPU identification intrinsics of the Microsoft compiler,
+ * for code built with _M_X64 defined on x86-64 hosts. The compiler headers
+ * declaring routines of the same names come first, the names are then
+ * mapped to the routines below.
+ */
+
+#ifndef __TESTS_SHIM_INTRIN_H__
+#define __TESTS_SHIM_INTRIN_H__
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+
+static inline void _ShimCpuidEx(int Info[4], int Function, int SubFunction)
+{
+	__cpuid_count(Function, SubFunction, Info[0], Info[1], Info[2], Info[3]);
+}
+
+
+static inline unsigned long long _ShimXgetbv(unsigned int Register)
+{
+	unsigned int eax = 0;
+	unsigned int edx = 0;
+
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(Register));
+
+	return ((unsigned long long)edx << 32) | eax;
+}
+
+
+#undef __cpuid
+#undef __cpuidex
+#undef _xgetbv
+#define __cpuid(aInfo, aFunction)					_ShimCpuidEx((aInfo), (aFunction), 0)
+#define __cpuidex(aInfo, aFunction, aSubFunction)	_ShimCpuidEx((aInfo), (aFunction), (aSubFunction))
+#define _xgetbv(aRegister)							_ShimXgetbv(aRegister)
+
+
+
+#endif
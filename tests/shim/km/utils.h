@@ -0,0 +1,34 @@
+
+/**
+ * @file
+ *
+ * Stand-in for km-shared/utils.h. The shared request code includes it in
+ * kernel mode only for the client information type. Tests building driver
+ * sources define the object routines those sources call.
+ */
+
+#ifndef __TESTS_SHIM_UTILS_H__
+#define __TESTS_SHIM_UTILS_H__
+
+#include <ntifs.h>
+
+
+typedef struct _BASIC_CLIENT_INFO {
+	BOOLEAN Admin;
+	BOOLEAN Impersonated;
+	BOOLEAN ImpersonatedAdmin;
+	SECURITY_IMPERSONATION_LEVEL ImpersonationLevel;
+	BOOLEAN CopyOnOpen;
+	BOOLEAN EffectiveOnly;
+} BASIC_CLIENT_INFO, *PBASIC_CLIENT_INFO;
+
+
+VOID _ReleaseDriverArray(PDRIVER_OBJECT *DriverArray, SIZE_T DriverCount);
+VOID _ReleaseDeviceArray(PDEVICE_OBJECT *DeviceArray, SIZE_T ArrayLength);
+NTSTATUS _GetObjectName(PVOID Object, PUNICODE_STRING Name);
+NTSTATUS _GetDriversInDirectory(PUNICODE_STRING Directory, PDRIVER_OBJECT **DriverArray, PSIZE_T DriverCount);
+NTSTATUS _EnumDriverDevices(PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT **DeviceArray, PULONG DeviceArrayLength);
+
+
+
+#endif
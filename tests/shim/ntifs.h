@@ -0,0 +1,800 @@
+
+/**
+ * @file
+ *
+ * Minimal user-mode stand-in for the kernel headers, allowing the portable
+ * km-shared and shared sources, and parts of the driver, to be compiled and
+ * tested outside the WDK. Spin locks and executive resources are emulated by
+ * atomics and pthreads, the IRQL and the processor number are kept per thread
+ * and set by tests.
+ */
+
+#ifndef __TESTS_SHIM_NTIFS_H__
+#define __TESTS_SHIM_NTIFS_H__
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <time.h>
+
+
+#if __SIZEOF_WCHAR_T__ == 2
+/** The C library counts wide characters of four bytes; sources built with
+ *  the two-byte wchar_t of Windows get their lengths counted by hand. */
+static inline size_t ShimWcsLen(const wchar_t *String)
+{
+	size_t ret = 0;
+
+	while (String[ret] != L'\0')
+		++ret;
+
+	return ret;
+}
+
+#define wcslen							ShimWcsLen
+#endif
+
+
+typedef void VOID;
+typedef void *PVOID, *HANDLE;
+typedef unsigned char UCHAR, *PUCHAR, BOOLEAN, *PBOOLEAN, KIRQL, *PKIRQL;
+typedef char CHAR, *PCHAR;
+typedef short SHORT;
+typedef unsigned short USHORT, *PUSHORT;
+typedef int32_t LONG, *PLONG, NTSTATUS;
+typedef uint32_t ULONG, *PULONG, ULONG32, *PULONG32;
+typedef int64_t LONG64, *PLONG64, LONGLONG;
+typedef uint64_t ULONG64, *PULONG64;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR, KAFFINITY;
+typedef size_t SIZE_T, *PSIZE_T;
+typedef int POOL_TYPE;
+/** Wider than in the kernel, tests keep characters within the BMP. */
+typedef wchar_t WCHAR, *PWCHAR, *PWSTR;
+
+typedef union _LARGE_INTEGER {
+	struct {
+		ULONG LowPart;
+		LONG HighPart;
+	};
+	LONG64 QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER, PHYSICAL_ADDRESS;
+
+typedef struct _GUID {
+	ULONG Data1;
+	USHORT Data2;
+	USHORT Data3;
+	UCHAR Data4[8];
+} GUID;
+
+typedef enum _MODE {
+	KernelMode,
+	UserMode,
+} MODE;
+
+typedef CHAR KPROCESSOR_MODE;
+
+typedef enum _SECURITY_IMPERSONATION_LEVEL {
+	SecurityAnonymous,
+	SecurityIdentification,
+	SecurityImpersonation,
+	SecurityDelegation,
+} SECURITY_IMPERSONATION_LEVEL, *PSECURITY_IMPERSONATION_LEVEL;
+
+typedef struct _UNICODE_STRING {
+	USHORT Length;
+	USHORT MaximumLength;
+	PWSTR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+/** Only addresses of these objects are used by the tested code. */
+typedef struct _DRIVER_OBJECT *PDRIVER_OBJECT;
+typedef struct _DEVICE_OBJECT *PDEVICE_OBJECT;
+typedef struct _KPROCESS *PEPROCESS;
+typedef struct _KEVENT *PKEVENT;
+typedef struct _OBJECT_TYPE *POBJECT_TYPE;
+
+typedef struct _LIST_ENTRY {
+	struct _LIST_ENTRY *Flink;
+	struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+
+#define IN
+#define OUT
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define TRUE						1
+#define FALSE						0
+#define ASSERT						assert
+#define C_ASSERT(e)					_Static_assert(e, #e)
+#define FIELD_OFFSET(t, f)			offsetof(t, f)
+#define CONTAINING_RECORD(a, t, f)	((t *)((PUCHAR)(a) - offsetof(t, f)))
+#define UNREFERENCED_PARAMETER(x)	(void)(x)
+#define DECLSPEC_CACHEALIGN			__attribute__((aligned(64)))
+#define MEMORY_ALLOCATION_ALIGNMENT	16
+#define __debugbreak()				abort()
+
+#define NT_SUCCESS(s)							((NTSTATUS)(s) >= 0)
+#define STATUS_SUCCESS							((NTSTATUS)0x00000000)
+#define STATUS_UNSUCCESSFUL						((NTSTATUS)0xC0000001)
+#define STATUS_INVALID_PARAMETER				((NTSTATUS)0xC000000D)
+#define STATUS_INSUFFICIENT_RESOURCES			((NTSTATUS)0xC000009A)
+#define STATUS_OBJECT_NAME_COLLISION			((NTSTATUS)0xC0000035)
+#define STATUS_BUFFER_TOO_SMALL					((NTSTATUS)0xC0000023)
+#define STATUS_UNEXPECTED_IO_ERROR				((NTSTATUS)0xC00000E9)
+#define STATUS_INVALID_PARAMETER_1				((NTSTATUS)0xC00000EF)
+#define STATUS_INVALID_PARAMETER_2				((NTSTATUS)0xC00000F0)
+#define STATUS_INVALID_PARAMETER_3				((NTSTATUS)0xC00000F1)
+#define STATUS_INVALID_PARAMETER_4				((NTSTATUS)0xC00000F2)
+#define STATUS_NO_MORE_ENTRIES					((NTSTATUS)0x8000001A)
+#define STATUS_ACCESS_DENIED					((NTSTATUS)0xC0000022)
+#define STATUS_DELETE_PENDING					((NTSTATUS)0xC0000056)
+#define STATUS_QUOTA_EXCEEDED					((NTSTATUS)0xC0000044)
+#define STATUS_NOT_IMPLEMENTED					((NTSTATUS)0xC0000002)
+#define STATUS_ALREADY_REGISTERED				((NTSTATUS)0xC0000718)
+#define STATUS_CONNECTION_DISCONNECTED			((NTSTATUS)0xC000020C)
+#define STATUS_REQUEST_NOT_ACCEPTED				((NTSTATUS)0xC00000D0)
+
+#define PASSIVE_LEVEL				0
+#define APC_LEVEL					1
+#define DISPATCH_LEVEL				2
+#define HIGH_LEVEL					31
+#define ALL_PROCESSOR_GROUPS		0xffff
+
+#define NonPagedPool				0
+#define PagedPool					1
+
+#define DPFLTR_DEFAULT_ID			0
+#define DPFLTR_ERROR_LEVEL			0
+#define DPFLTR_TRACE_LEVEL			3
+#define DbgPrintEx(...)				((void)0)
+#define KeBugCheck(x)				abort()
+
+#define RtlZeroMemory(d, n)			memset((d), 0, (n))
+#define RtlCopyMemory(d, s, n)		memcpy((d), (s), (n))
+#define RtlSecureZeroMemory(d, n)	memset((d), 0, (n))
+
+static inline WCHAR RtlUpcaseUnicodeChar(WCHAR SourceCharacter) { return (WCHAR)towupper(SourceCharacter); }
+
+static inline ULONG RtlRandom(PULONG Seed)
+{
+	*Seed = *Seed*1103515245 + 12345;
+	return (*Seed >> 1) & 0x7fffffff;
+}
+
+static inline void RtlInitUnicodeString(PUNICODE_STRING DestinationString, const WCHAR *SourceString)
+{
+	DestinationString->Buffer = (PWSTR)SourceString;
+	DestinationString->Length = (SourceString != NULL) ? (USHORT)(wcslen(SourceString)*sizeof(WCHAR)) : 0;
+	DestinationString->MaximumLength = (SourceString != NULL) ? DestinationString->Length + sizeof(WCHAR) : 0;
+}
+
+
+/************************************************************************/
+/*                 LISTS                                                */
+/************************************************************************/
+
+static inline void InitializeListHead(PLIST_ENTRY ListHead) { ListHead->Flink = ListHead->Blink = ListHead; }
+static inline BOOLEAN IsListEmpty(const LIST_ENTRY *ListHead) { return (ListHead->Flink == ListHead); }
+
+static inline BOOLEAN RemoveEntryList(PLIST_ENTRY Entry)
+{
+	PLIST_ENTRY next = Entry->Flink;
+	PLIST_ENTRY prev = Entry->Blink;
+
+	prev->Flink = next;
+	next->Blink = prev;
+	return (next == prev);
+}
+
+static inline PLIST_ENTRY RemoveHeadList(PLIST_ENTRY ListHead)
+{
+	PLIST_ENTRY ret = ListHead->Flink;
+
+	RemoveEntryList(ret);
+	return ret;
+}
+
+static inline PLIST_ENTRY RemoveTailList(PLIST_ENTRY ListHead)
+{
+	PLIST_ENTRY ret = ListHead->Blink;
+
+	RemoveEntryList(ret);
+	return ret;
+}
+
+static inline void InsertHeadList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+	Entry->Flink = ListHead->Flink;
+	Entry->Blink = ListHead;
+	ListHead->Flink->Blink = Entry;
+	ListHead->Flink = Entry;
+}
+
+static inline void InsertTailList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+	Entry->Flink = ListHead;
+	Entry->Blink = ListHead->Blink;
+	ListHead->Blink->Flink = Entry;
+	ListHead->Blink = Entry;
+}
+
+
+/************************************************************************/
+/*                 IRQL AND PROCESSORS                                  */
+/************************************************************************/
+
+/** Number of processors the tests pretend to have. */
+#define SHIM_PROCESSOR_COUNT		16
+
+/** IRQL of the current thread. */
+extern __thread KIRQL ShimIrql;
+/** Processor the current thread pretends to run on. Tests running readers
+ *  of per-processor structures in parallel give each thread its own one. */
+extern __thread ULONG ShimProcessor;
+/** Number of pool allocations done so far. */
+extern volatile LONG ShimAllocationCount;
+
+static inline KIRQL KeGetCurrentIrql(void) { return ShimIrql; }
+static inline void KeRaiseIrql(KIRQL NewIrql, PKIRQL OldIrql) { *OldIrql = ShimIrql; ShimIrql = NewIrql; }
+static inline void KeLowerIrql(KIRQL NewIrql) { ShimIrql = NewIrql; }
+static inline ULONG KeGetCurrentProcessorNumberEx(PVOID Number) { (void)Number; return ShimProcessor; }
+static inline ULONG KeQueryActiveProcessorCountEx(USHORT Group) { (void)Group; return SHIM_PROCESSOR_COUNT; }
+static inline ULONG KeQueryMaximumProcessorCountEx(USHORT Group) { (void)Group; return SHIM_PROCESSOR_COUNT; }
+
+
+/************************************************************************/
+/*                 POOL                                                 */
+/************************************************************************/
+
+static inline PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag)
+{
+	(void)PoolType;
+	(void)Tag;
+	__atomic_add_fetch(&ShimAllocationCount, 1, __ATOMIC_RELAXED);
+	return malloc(NumberOfBytes);
+}
+
+static inline void ExFreePoolWithTag(PVOID Buffer, ULONG Tag)
+{
+	(void)Tag;
+	free(Buffer);
+}
+
+static inline void ExFreePool(PVOID Buffer) { free(Buffer); }
+
+
+/************************************************************************/
+/*                 INTERLOCKED OPERATIONS                               */
+/************************************************************************/
+
+static inline LONG InterlockedIncrement(volatile LONG *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedDecrement(volatile LONG *p) { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedExchange(volatile LONG *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedExchangeAdd(volatile LONG *p, LONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedCompareExchange(volatile LONG *p, LONG v, LONG c) { __atomic_compare_exchange_n(p, &c, v, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); return c; }
+static inline LONG64 InterlockedIncrement64(volatile LONG64 *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG64 InterlockedExchangeAdd64(volatile LONG64 *p, LONG64 v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG64 InterlockedCompareExchange64(volatile LONG64 *p, LONG64 v, LONG64 c) { __atomic_compare_exchange_n(p, &c, v, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); return c; }
+static inline PVOID InterlockedExchangePointer(PVOID volatile *p, PVOID v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline PVOID InterlockedCompareExchangePointer(PVOID volatile *p, PVOID v, PVOID c) { __atomic_compare_exchange_n(p, &c, v, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); return c; }
+static inline LONG ReadAcquire(const volatile LONG *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+#define KeMemoryBarrier()			__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define YieldProcessor()			sched_yield()
+
+
+/************************************************************************/
+/*                 SPIN LOCKS                                           */
+/************************************************************************/
+
+typedef ULONG_PTR KSPIN_LOCK, *PKSPIN_LOCK;
+
+static inline void KeInitializeSpinLock(PKSPIN_LOCK Lock) { __atomic_store_n(Lock, 0, __ATOMIC_RELEASE); }
+
+static inline void KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK Lock)
+{
+	while (__atomic_exchange_n(Lock, 1, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+static inline BOOLEAN KeTryToAcquireSpinLockAtDpcLevel(PKSPIN_LOCK Lock) { return !__atomic_exchange_n(Lock, 1, __ATOMIC_ACQUIRE); }
+static inline void KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK Lock) { __atomic_store_n(Lock, 0, __ATOMIC_RELEASE); }
+
+static inline void KeAcquireSpinLock(PKSPIN_LOCK Lock, PKIRQL OldIrql)
+{
+	KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+	KeAcquireSpinLockAtDpcLevel(Lock);
+}
+
+static inline void KeReleaseSpinLock(PKSPIN_LOCK Lock, KIRQL OldIrql)
+{
+	KeReleaseSpinLockFromDpcLevel(Lock);
+	KeLowerIrql(OldIrql);
+}
+
+
+/************************************************************************/
+/*                 READER-WRITER SPIN LOCKS                             */
+/************************************************************************/
+
+typedef volatile LONG EX_SPIN_LOCK, *PEX_SPIN_LOCK;
+
+#define SHIM_EX_SPIN_LOCK_EXCLUSIVE		((LONG)0x80000000)
+
+static inline void ExAcquireSpinLockExclusiveAtDpcLevel(PEX_SPIN_LOCK Lock)
+{
+	LONG v = 0;
+
+	while (!__atomic_compare_exchange_n(Lock, &v, SHIM_EX_SPIN_LOCK_EXCLUSIVE, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		v = 0;
+		sched_yield();
+	}
+}
+
+static inline void ExAcquireSpinLockSharedAtDpcLevel(PEX_SPIN_LOCK Lock)
+{
+	LONG v = 0;
+
+	for (;;) {
+		v = __atomic_load_n(Lock, __ATOMIC_RELAXED);
+		if ((v & SHIM_EX_SPIN_LOCK_EXCLUSIVE) == 0 &&
+			__atomic_compare_exchange_n(Lock, &v, v + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+
+		sched_yield();
+	}
+}
+
+static inline void ExReleaseSpinLockExclusiveFromDpcLevel(PEX_SPIN_LOCK Lock) { __atomic_store_n(Lock, 0, __ATOMIC_RELEASE); }
+static inline void ExReleaseSpinLockSharedFromDpcLevel(PEX_SPIN_LOCK Lock) { __atomic_sub_fetch(Lock, 1, __ATOMIC_RELEASE); }
+
+static inline KIRQL ExAcquireSpinLockExclusive(PEX_SPIN_LOCK Lock)
+{
+	KIRQL ret;
+
+	KeRaiseIrql(DISPATCH_LEVEL, &ret);
+	ExAcquireSpinLockExclusiveAtDpcLevel(Lock);
+	return ret;
+}
+
+static inline KIRQL ExAcquireSpinLockShared(PEX_SPIN_LOCK Lock)
+{
+	KIRQL ret;
+
+	KeRaiseIrql(DISPATCH_LEVEL, &ret);
+	ExAcquireSpinLockSharedAtDpcLevel(Lock);
+	return ret;
+}
+
+static inline void ExReleaseSpinLockExclusive(PEX_SPIN_LOCK Lock, KIRQL OldIrql)
+{
+	ExReleaseSpinLockExclusiveFromDpcLevel(Lock);
+	KeLowerIrql(OldIrql);
+}
+
+static inline void ExReleaseSpinLockShared(PEX_SPIN_LOCK Lock, KIRQL OldIrql)
+{
+	ExReleaseSpinLockSharedFromDpcLevel(Lock);
+	KeLowerIrql(OldIrql);
+}
+
+
+/************************************************************************/
+/*                 EXECUTIVE RESOURCES                                  */
+/************************************************************************/
+
+/** Like the real one, the resource can be acquired shared by its exclusive owner. */
+typedef struct _ERESOURCE {
+	pthread_mutex_t Mutex;
+	pthread_cond_t Released;
+	LONG SharedCount;
+	LONG ExclusiveCount;
+	pthread_t Owner;
+} ERESOURCE, *PERESOURCE;
+
+static inline NTSTATUS ExInitializeResourceLite(PERESOURCE Resource)
+{
+	memset(Resource, 0, sizeof(ERESOURCE));
+	pthread_mutex_init(&Resource->Mutex, NULL);
+	pthread_cond_init(&Resource->Released, NULL);
+	return STATUS_SUCCESS;
+}
+
+static inline void ExDeleteResourceLite(PERESOURCE Resource)
+{
+	pthread_cond_destroy(&Resource->Released);
+	pthread_mutex_destroy(&Resource->Mutex);
+}
+
+static inline BOOLEAN ExAcquireResourceExclusiveLite(PERESOURCE Resource, BOOLEAN Wait)
+{
+	(void)Wait;
+	pthread_mutex_lock(&Resource->Mutex);
+	if (Resource->ExclusiveCount == 0 || !pthread_equal(Resource->Owner, pthread_self())) {
+		while (Resource->ExclusiveCount > 0 || Resource->SharedCount > 0)
+			pthread_cond_wait(&Resource->Released, &Resource->Mutex);
+
+		Resource->Owner = pthread_self();
+	}
+
+	++Resource->ExclusiveCount;
+	pthread_mutex_unlock(&Resource->Mutex);
+	return TRUE;
+}
+
+static inline BOOLEAN ExAcquireResourceSharedLite(PERESOURCE Resource, BOOLEAN Wait)
+{
+	(void)Wait;
+	pthread_mutex_lock(&Resource->Mutex);
+	if (Resource->ExclusiveCount > 0 && pthread_equal(Resource->Owner, pthread_self()))
+		++Resource->ExclusiveCount;
+	else {
+		while (Resource->ExclusiveCount > 0)
+			pthread_cond_wait(&Resource->Released, &Resource->Mutex);
+
+		++Resource->SharedCount;
+	}
+
+	pthread_mutex_unlock(&Resource->Mutex);
+	return TRUE;
+}
+
+static inline void ExReleaseResourceLite(PERESOURCE Resource)
+{
+	pthread_mutex_lock(&Resource->Mutex);
+	if (Resource->ExclusiveCount > 0 && pthread_equal(Resource->Owner, pthread_self()))
+		--Resource->ExclusiveCount;
+	else --Resource->SharedCount;
+
+	pthread_cond_broadcast(&Resource->Released);
+	pthread_mutex_unlock(&Resource->Mutex);
+}
+
+static inline void KeEnterCriticalRegion(void) { }
+static inline void KeLeaveCriticalRegion(void) { }
+
+
+
+/************************************************************************/
+/*                 INTERLOCKED SINGLY LINKED LISTS                      */
+/************************************************************************/
+
+typedef struct _SLIST_ENTRY {
+	struct _SLIST_ENTRY *Next;
+} SLIST_ENTRY, *PSLIST_ENTRY;
+
+/** Operations are serialized by a spin lock instead of the double-width
+ *  compare-exchange of the real header, which keeps pops free of ABA. */
+typedef struct _SLIST_HEADER {
+	PSLIST_ENTRY Next;
+	USHORT Depth;
+	KSPIN_LOCK Lock;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+static inline void InitializeSListHead(PSLIST_HEADER ListHead)
+{
+	ListHead->Next = NULL;
+	ListHead->Depth = 0;
+	KeInitializeSpinLock(&ListHead->Lock);
+}
+
+static inline USHORT ExQueryDepthSList(PSLIST_HEADER ListHead) { return __atomic_load_n(&ListHead->Depth, __ATOMIC_RELAXED); }
+
+static inline PSLIST_ENTRY InterlockedPushEntrySList(PSLIST_HEADER ListHead, PSLIST_ENTRY ListEntry)
+{
+	PSLIST_ENTRY ret = NULL;
+
+	KeAcquireSpinLockAtDpcLevel(&ListHead->Lock);
+	ret = ListHead->Next;
+	ListEntry->Next = ret;
+	ListHead->Next = ListEntry;
+	__atomic_store_n(&ListHead->Depth, ListHead->Depth + 1, __ATOMIC_RELAXED);
+	KeReleaseSpinLockFromDpcLevel(&ListHead->Lock);
+	return ret;
+}
+
+static inline PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER ListHead)
+{
+	PSLIST_ENTRY ret = NULL;
+
+	KeAcquireSpinLockAtDpcLevel(&ListHead->Lock);
+	ret = ListHead->Next;
+	if (ret != NULL) {
+		ListHead->Next = ret->Next;
+		__atomic_store_n(&ListHead->Depth, ListHead->Depth - 1, __ATOMIC_RELAXED);
+	}
+
+	KeReleaseSpinLockFromDpcLevel(&ListHead->Lock);
+	return ret;
+}
+
+static inline PSLIST_ENTRY InterlockedFlushSList(PSLIST_HEADER ListHead)
+{
+	PSLIST_ENTRY ret = NULL;
+
+	KeAcquireSpinLockAtDpcLevel(&ListHead->Lock);
+	ret = ListHead->Next;
+	ListHead->Next = NULL;
+	__atomic_store_n(&ListHead->Depth, 0, __ATOMIC_RELAXED);
+	KeReleaseSpinLockFromDpcLevel(&ListHead->Lock);
+	return ret;
+}
+
+
+
+/************************************************************************/
+/*                 LOOKASIDE LISTS                                      */
+/************************************************************************/
+
+/** Number of free blocks a lookaside list keeps; the real lists tune it. */
+#define SHIM_LOOKASIDE_DEPTH		256
+
+typedef struct _LOOKASIDE_LIST_EX *PLOOKASIDE_LIST_EX;
+
+typedef PVOID ALLOCATE_FUNCTION_EX(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag, PLOOKASIDE_LIST_EX Lookaside);
+typedef ALLOCATE_FUNCTION_EX *PALLOCATE_FUNCTION_EX;
+typedef VOID FREE_FUNCTION_EX(PVOID Buffer, PLOOKASIDE_LIST_EX Lookaside);
+typedef FREE_FUNCTION_EX *PFREE_FUNCTION_EX;
+
+typedef struct _LOOKASIDE_LIST_EX {
+	SLIST_HEADER ListHead;
+	POOL_TYPE PoolType;
+	SIZE_T Size;
+	ULONG Tag;
+	PALLOCATE_FUNCTION_EX Allocate;
+	PFREE_FUNCTION_EX Free;
+} LOOKASIDE_LIST_EX;
+
+static inline NTSTATUS ExInitializeLookasideListEx(PLOOKASIDE_LIST_EX Lookaside, PALLOCATE_FUNCTION_EX Allocate, PFREE_FUNCTION_EX Free, POOL_TYPE PoolType, ULONG Flags, SIZE_T Size, ULONG Tag, USHORT Depth)
+{
+	(void)Flags;
+	(void)Depth;
+	InitializeSListHead(&Lookaside->ListHead);
+	Lookaside->PoolType = PoolType;
+	Lookaside->Size = Size;
+	Lookaside->Tag = Tag;
+	Lookaside->Allocate = Allocate;
+	Lookaside->Free = Free;
+	return STATUS_SUCCESS;
+}
+
+static inline PVOID ExAllocateFromLookasideListEx(PLOOKASIDE_LIST_EX Lookaside)
+{
+	PVOID ret = NULL;
+
+	ret = InterlockedPopEntrySList(&Lookaside->ListHead);
+	if (ret == NULL) {
+		ret = (Lookaside->Allocate != NULL) ?
+			Lookaside->Allocate(Lookaside->PoolType, Lookaside->Size, Lookaside->Tag, Lookaside) :
+			ExAllocatePoolWithTag(Lookaside->PoolType, Lookaside->Size, Lookaside->Tag);
+	}
+
+	return ret;
+}
+
+static inline void ExFreeToLookasideListEx(PLOOKASIDE_LIST_EX Lookaside, PVOID Entry)
+{
+	if (ExQueryDepthSList(&Lookaside->ListHead) >= SHIM_LOOKASIDE_DEPTH) {
+		if (Lookaside->Free != NULL)
+			Lookaside->Free(Entry, Lookaside);
+		else ExFreePoolWithTag(Entry, Lookaside->Tag);
+	} else InterlockedPushEntrySList(&Lookaside->ListHead, (PSLIST_ENTRY)Entry);
+}
+
+static inline void ExDeleteLookasideListEx(PLOOKASIDE_LIST_EX Lookaside)
+{
+	PVOID entry = NULL;
+
+	while ((entry = InterlockedPopEntrySList(&Lookaside->ListHead)) != NULL) {
+		if (Lookaside->Free != NULL)
+			Lookaside->Free(entry, Lookaside);
+		else ExFreePoolWithTag(entry, Lookaside->Tag);
+	}
+}
+
+/************************************************************************/
+/*                 REMOVE LOCKS AND WORK ITEMS                          */
+/************************************************************************/
+
+typedef struct _IO_REMOVE_LOCK {
+	volatile LONG IoCount;
+	volatile LONG Removed;
+} IO_REMOVE_LOCK, *PIO_REMOVE_LOCK;
+
+static inline void IoInitializeRemoveLock(PIO_REMOVE_LOCK Lock, ULONG AllocateTag, ULONG MaxLockedMinutes, ULONG HighWatermark)
+{
+	(void)AllocateTag;
+	(void)MaxLockedMinutes;
+	(void)HighWatermark;
+	Lock->IoCount = 1;
+	Lock->Removed = FALSE;
+}
+
+static inline NTSTATUS IoAcquireRemoveLock(PIO_REMOVE_LOCK Lock, PVOID Tag)
+{
+	NTSTATUS ret = STATUS_SUCCESS;
+
+	(void)Tag;
+	InterlockedIncrement(&Lock->IoCount);
+	if (__atomic_load_n(&Lock->Removed, __ATOMIC_SEQ_CST)) {
+		InterlockedDecrement(&Lock->IoCount);
+		ret = STATUS_DELETE_PENDING;
+	}
+
+	return ret;
+}
+
+static inline void IoReleaseRemoveLock(PIO_REMOVE_LOCK Lock, PVOID Tag)
+{
+	(void)Tag;
+	InterlockedDecrement(&Lock->IoCount);
+}
+
+/** Drops the reference of the caller and the initial one, then waits for the others. */
+static inline void IoReleaseRemoveLockAndWait(PIO_REMOVE_LOCK Lock, PVOID Tag)
+{
+	(void)Tag;
+	InterlockedExchange(&Lock->Removed, TRUE);
+	InterlockedDecrement(&Lock->IoCount);
+	InterlockedDecrement(&Lock->IoCount);
+	while (__atomic_load_n(&Lock->IoCount, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+}
+
+typedef enum _WORK_QUEUE_TYPE {
+	CriticalWorkQueue,
+	DelayedWorkQueue,
+} WORK_QUEUE_TYPE;
+
+typedef struct _IO_WORKITEM {
+	PVOID IoObject;
+} IO_WORKITEM, *PIO_WORKITEM;
+
+typedef void IO_WORKITEM_ROUTINE_EX(PVOID IoObject, PVOID Context, PIO_WORKITEM IoWorkItem);
+typedef IO_WORKITEM_ROUTINE_EX *PIO_WORKITEM_ROUTINE_EX;
+
+static inline ULONG IoSizeofWorkItem(void) { return sizeof(IO_WORKITEM); }
+static inline void IoInitializeWorkItem(PVOID IoObject, PIO_WORKITEM IoWorkItem) { IoWorkItem->IoObject = IoObject; }
+static inline void IoUninitializeWorkItem(PIO_WORKITEM IoWorkItem) { (void)IoWorkItem; }
+
+/** Runs the routine at once, in the thread queuing it. */
+static inline void IoQueueWorkItemEx(PIO_WORKITEM IoWorkItem, PIO_WORKITEM_ROUTINE_EX WorkerRoutine, WORK_QUEUE_TYPE QueueType, PVOID Context)
+{
+	KIRQL irql = ShimIrql;
+
+	(void)QueueType;
+	ShimIrql = PASSIVE_LEVEL;
+	WorkerRoutine(IoWorkItem->IoObject, Context, IoWorkItem);
+	ShimIrql = irql;
+}
+
+
+/************************************************************************/
+/*                 PROCESSES, OBJECTS AND MEMORY DESCRIPTORS            */
+/************************************************************************/
+
+/** Handles given to ObReferenceObjectByHandle are the objects themselves,
+ *  and the memory described by an MDL is mapped at the same address in
+ *  both address spaces. */
+typedef struct _MDL {
+	PVOID Buffer;
+} MDL, *PMDL;
+
+typedef struct _KAPC_STATE {
+	PEPROCESS Process;
+} KAPC_STATE, *PKAPC_STATE;
+
+typedef enum _MEMORY_CACHING_TYPE {
+	MmNonCached,
+	MmCached,
+} MEMORY_CACHING_TYPE;
+
+#define NormalPagePriority			16
+#define MdlMappingNoExecute			0x40000000
+#define MM_ALLOCATE_FULLY_REQUIRED	0x00000004
+#define EVENT_MODIFY_STATE			0x0002
+#define IO_NO_INCREMENT				0
+#define EXCEPTION_EXECUTE_HANDLER	1
+/** Nothing the tested code does inside the guarded blocks raises exceptions. */
+#define __try						if (1)
+#define __except(x)					else if (0)
+#define GetExceptionCode()			STATUS_UNSUCCESSFUL
+
+/** Number of times KeSetEvent was called so far. */
+extern volatile LONG ShimEventSetCount;
+extern POBJECT_TYPE *ExEventObjectType;
+
+static inline PEPROCESS PsGetCurrentProcess(void) { return (PEPROCESS)(ULONG_PTR)0x1000; }
+static inline HANDLE PsGetCurrentProcessId(void) { return (HANDLE)(ULONG_PTR)4; }
+static inline HANDLE PsGetCurrentThreadId(void) { return (HANDLE)(ULONG_PTR)(ShimProcessor*4 + 8); }
+static inline void KeStackAttachProcess(PEPROCESS Process, PKAPC_STATE ApcState) { ApcState->Process = Process; }
+static inline void KeUnstackDetachProcess(PKAPC_STATE ApcState) { (void)ApcState; }
+static inline void ObReferenceObject(PVOID Object) { (void)Object; }
+static inline void ObDereferenceObject(PVOID Object) { (void)Object; }
+
+static inline NTSTATUS ObReferenceObjectByHandle(HANDLE Handle, ULONG DesiredAccess, POBJECT_TYPE ObjectType, KPROCESSOR_MODE AccessMode, PVOID *Object, PVOID HandleInformation)
+{
+	(void)DesiredAccess;
+	(void)ObjectType;
+	(void)AccessMode;
+	(void)HandleInformation;
+	*Object = Handle;
+	return (Handle != NULL) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+static inline LONG KeSetEvent(PKEVENT Event, LONG Increment, BOOLEAN Wait)
+{
+	(void)Event;
+	(void)Increment;
+	(void)Wait;
+	return InterlockedIncrement(&ShimEventSetCount);
+}
+
+static inline void KeQuerySystemTime(PLARGE_INTEGER CurrentTime)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	CurrentTime->QuadPart = (LONG64)ts.tv_sec * 10000000 + ts.tv_nsec / 100;
+}
+
+static inline NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval)
+{
+	(void)WaitMode;
+	(void)Alertable;
+	(void)Interval;
+	sched_yield();
+	return STATUS_SUCCESS;
+}
+
+static inline PMDL MmAllocatePagesForMdlEx(PHYSICAL_ADDRESS LowAddress, PHYSICAL_ADDRESS HighAddress, PHYSICAL_ADDRESS SkipBytes, SIZE_T TotalBytes, MEMORY_CACHING_TYPE CacheType, ULONG Flags)
+{
+	PMDL ret = NULL;
+
+	(void)LowAddress;
+	(void)HighAddress;
+	(void)SkipBytes;
+	(void)CacheType;
+	(void)Flags;
+	ret = (PMDL)malloc(sizeof(MDL));
+	if (ret != NULL) {
+		ret->Buffer = calloc(1, TotalBytes);
+		if (ret->Buffer == NULL) {
+			free(ret);
+			ret = NULL;
+		}
+	}
+
+	return ret;
+}
+
+static inline void MmFreePagesFromMdl(PMDL Mdl) { free(Mdl->Buffer); }
+static inline PVOID MmGetSystemAddressForMdlSafe(PMDL Mdl, ULONG Priority) { (void)Priority; return Mdl->Buffer; }
+
+static inline PVOID MmMapLockedPagesSpecifyCache(PMDL Mdl, KPROCESSOR_MODE AccessMode, MEMORY_CACHING_TYPE CacheType, PVOID RequestedAddress, ULONG BugCheckOnFailure, ULONG Priority)
+{
+	(void)AccessMode;
+	(void)CacheType;
+	(void)RequestedAddress;
+	(void)BugCheckOnFailure;
+	(void)Priority;
+	return Mdl->Buffer;
+}
+
+static inline void MmUnmapLockedPages(PVOID BaseAddress, PMDL Mdl) { (void)BaseAddress; (void)Mdl; }
+
+
+
+#endif
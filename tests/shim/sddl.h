@@ -0,0 +1,49 @@
+/**
+ * @file
+ *
+ * Stand-in for sddl.h. Strings are built in the wchar_t of the caller and
+ * freed by LocalFree.
+ */
+
+#ifndef __TESTS_SHIM_SDDL_H__
+#define __TESTS_SHIM_SDDL_H__
+
+#include <windows.h>
+
+
+static inline BOOL ConvertSidToStringSidW(PSID Sid, LPWSTR *StringSid)
+{
+	int len = 0;
+	char text[16 + 20 + 11*15];
+	unsigned long long authority = 0;
+	const SID *s = (const SID *)Sid;
+	BOOL ret = FALSE;
+
+	SetLastError(ERROR_INVALID_PARAMETER);
+	if (s->Revision == 1 && s->SubAuthorityCount <= 15) {
+		for (size_t i = 0; i < sizeof(s->IdentifierAuthority.Value); ++i)
+			authority = (authority << 8) | s->IdentifierAuthority.Value[i];
+
+		if (authority >= 0x100000000ULL)
+			len = snprintf(text, sizeof(text), "S-%u-0x%012llX", s->Revision, authority);
+		else len = snprintf(text, sizeof(text), "S-%u-%llu", s->Revision, authority);
+
+		for (BYTE i = 0; i < s->SubAuthorityCount; ++i)
+			len += snprintf(text + len, sizeof(text) - len, "-%u", s->SubAuthority[i]);
+
+		*StringSid = (LPWSTR)malloc((len + 1)*sizeof(wchar_t));
+		ret = (*StringSid != NULL);
+		if (ret) {
+			for (int i = 0; i <= len; ++i)
+				(*StringSid)[i] = (wchar_t)text[i];
+		} else SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+	}
+
+	return ret;
+}
+
+#define ConvertSidToStringSid			ConvertSidToStringSidW
+
+
+
+#endif
@@ -0,0 +1,638 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <windows.h>
+
+
+__thread KIRQL ShimIrql = PASSIVE_LEVEL;
+__thread ULONG ShimProcessor = 0;
+volatile LONG ShimAllocationCount = 0;
+volatile LONG ShimEventSetCount = 0;
+static POBJECT_TYPE _eventObjectType = NULL;
+POBJECT_TYPE *ExEventObjectType = &_eventObjectType;
+__thread DWORD ShimLastError = ERROR_SUCCESS;
+
+
+/************************************************************************/
+/*                 HANDLES                                              */
+/************************************************************************/
+
+typedef enum _EShimHandleType {
+	shtThread,
+	shtEvent,
+	shtFile,
+	shtMapping,
+} EShimHandleType, *PEShimHandleType;
+
+typedef struct _SHIM_HANDLE {
+	EShimHandleType Type;
+	pthread_t Thread;
+	BOOLEAN Joined;
+	LPTHREAD_START_ROUTINE Routine;
+	PVOID Parameter;
+	pthread_mutex_t Lock;
+	pthread_cond_t Signalled;
+	BOOLEAN ManualReset;
+	BOOLEAN State;
+	/** Descriptor of a file; mappings own a duplicate of it. */
+	int Fd;
+	off_t Size;
+} SHIM_HANDLE, *PSHIM_HANDLE;
+
+
+static void *_ThreadRoutine(void *Context)
+{
+	PSHIM_HANDLE h = (PSHIM_HANDLE)Context;
+
+	h->Routine(h->Parameter);
+
+	return NULL;
+}
+
+
+HANDLE CreateThread(PVOID Attributes, SIZE_T StackSize, LPTHREAD_START_ROUTINE Routine, PVOID Parameter, DWORD Flags, PDWORD ThreadId)
+{
+	PSHIM_HANDLE ret = NULL;
+
+	(void)Attributes;
+	(void)StackSize;
+	(void)Flags;
+	ret = (PSHIM_HANDLE)calloc(1, sizeof(SHIM_HANDLE));
+	if (ret != NULL) {
+		ret->Type = shtThread;
+		ret->Routine = Routine;
+		ret->Parameter = Parameter;
+		if (pthread_create(&ret->Thread, NULL, _ThreadRoutine, ret) == 0) {
+			if (ThreadId != NULL)
+				*ThreadId = (DWORD)(uintptr_t)ret->Thread;
+		} else {
+			free(ret);
+			ret = NULL;
+		}
+	}
+
+	if (ret == NULL)
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+
+	return ret;
+}
+
+
+/** Converts a relative timeout to an absolute time of the realtime clock. */
+static void _Deadline(DWORD Milliseconds, struct timespec *Deadline)
+{
+	clock_gettime(CLOCK_REALTIME, Deadline);
+	Deadline->tv_sec += Milliseconds / 1000;
+	Deadline->tv_nsec += (long)(Milliseconds % 1000)*1000000;
+	if (Deadline->tv_nsec >= 1000000000) {
+		++Deadline->tv_sec;
+		Deadline->tv_nsec -= 1000000000;
+	}
+
+	return;
+}
+
+
+static DWORD _EventWait(PSHIM_HANDLE Event, DWORD Milliseconds)
+{
+	int err = 0;
+	struct timespec ts;
+	DWORD ret = WAIT_OBJECT_0;
+
+	if (Milliseconds != INFINITE)
+		_Deadline(Milliseconds, &ts);
+
+	pthread_mutex_lock(&Event->Lock);
+	while (err == 0 && !Event->State) {
+		if (Milliseconds != INFINITE)
+			err = pthread_cond_timedwait(&Event->Signalled, &Event->Lock, &ts);
+		else err = pthread_cond_wait(&Event->Signalled, &Event->Lock);
+	}
+
+	if (Event->State) {
+		if (!Event->ManualReset)
+			Event->State = FALSE;
+	} else ret = WAIT_TIMEOUT;
+
+	pthread_mutex_unlock(&Event->Lock);
+
+	return ret;
+}
+
+
+DWORD WaitForSingleObject(HANDLE Handle, DWORD Milliseconds)
+{
+	PSHIM_HANDLE h = (PSHIM_HANDLE)Handle;
+	DWORD ret = WAIT_FAILED;
+
+	switch (h->Type) {
+		case shtThread:
+			if (Milliseconds == INFINITE) {
+				if (!h->Joined) {
+					pthread_join(h->Thread, NULL);
+					h->Joined = TRUE;
+				}
+
+				ret = WAIT_OBJECT_0;
+			}
+			break;
+		case shtEvent:
+			ret = _EventWait(h, Milliseconds);
+			break;
+		default:
+			break;
+	}
+
+	return ret;
+}
+
+
+DWORD WaitForMultipleObjects(DWORD Count, const HANDLE *Handles, BOOL WaitAll, DWORD Milliseconds)
+{
+	DWORD ret = WAIT_FAILED;
+
+	if (WaitAll && Milliseconds == INFINITE) {
+		ret = WAIT_OBJECT_0;
+		for (DWORD i = 0; i < Count; ++i) {
+			if (WaitForSingleObject(Handles[i], INFINITE) != WAIT_OBJECT_0)
+				ret = WAIT_FAILED;
+		}
+	}
+
+	return ret;
+}
+
+
+BOOL CloseHandle(HANDLE Handle)
+{
+	PSHIM_HANDLE h = (PSHIM_HANDLE)Handle;
+
+	switch (h->Type) {
+		case shtThread:
+			if (!h->Joined)
+				pthread_detach(h->Thread);
+			break;
+		case shtEvent:
+			pthread_cond_destroy(&h->Signalled);
+			pthread_mutex_destroy(&h->Lock);
+			break;
+		case shtFile:
+		case shtMapping:
+			close(h->Fd);
+			break;
+	}
+
+	free(h);
+
+	return TRUE;
+}
+
+
+HANDLE CreateEventW(PVOID Attributes, BOOL ManualReset, BOOL InitialState, LPCWSTR Name)
+{
+	PSHIM_HANDLE ret = NULL;
+
+	(void)Attributes;
+	(void)Name;
+	ret = (PSHIM_HANDLE)calloc(1, sizeof(SHIM_HANDLE));
+	if (ret != NULL) {
+		ret->Type = shtEvent;
+		ret->ManualReset = (ManualReset != FALSE);
+		ret->State = (InitialState != FALSE);
+		pthread_mutex_init(&ret->Lock, NULL);
+		pthread_cond_init(&ret->Signalled, NULL);
+	} else SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+
+	return ret;
+}
+
+
+BOOL SetEvent(HANDLE Event)
+{
+	PSHIM_HANDLE h = (PSHIM_HANDLE)Event;
+
+	pthread_mutex_lock(&h->Lock);
+	h->State = TRUE;
+	if (h->ManualReset)
+		pthread_cond_broadcast(&h->Signalled);
+	else pthread_cond_signal(&h->Signalled);
+
+	pthread_mutex_unlock(&h->Lock);
+
+	return TRUE;
+}
+
+
+BOOL ResetEvent(HANDLE Event)
+{
+	PSHIM_HANDLE h = (PSHIM_HANDLE)Event;
+
+	pthread_mutex_lock(&h->Lock);
+	h->State = FALSE;
+	pthread_mutex_unlock(&h->Lock);
+
+	return TRUE;
+}
+
+
+/** Thread pool work, a thread is created for every callback. */
+typedef struct _SHIM_WORK {
+	PTP_SIMPLE_CALLBACK Callback;
+	PVOID Context;
+} SHIM_WORK, *PSHIM_WORK;
+
+
+static void *_WorkRoutine(void *Context)
+{
+	PSHIM_WORK w = (PSHIM_WORK)Context;
+
+	w->Callback(NULL, w->Context);
+	free(w);
+
+	return NULL;
+}
+
+
+BOOL TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK Callback, PVOID Context, PTP_CALLBACK_ENVIRON Environment)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	PSHIM_WORK w = NULL;
+	BOOL ret = FALSE;
+
+	(void)Environment;
+	w = (PSHIM_WORK)malloc(sizeof(SHIM_WORK));
+	if (w != NULL) {
+		w->Callback = Callback;
+		w->Context = Context;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		ret = (pthread_create(&thread, &attr, _WorkRoutine, w) == 0);
+		pthread_attr_destroy(&attr);
+		if (!ret)
+			free(w);
+	}
+
+	if (!ret)
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+
+	return ret;
+}
+
+
+BOOL SleepConditionVariableCS(PCONDITION_VARIABLE Variable, PCRITICAL_SECTION Section, DWORD Milliseconds)
+{
+	struct timespec ts;
+	BOOL ret = TRUE;
+
+	if (Milliseconds != INFINITE) {
+		_Deadline(Milliseconds, &ts);
+		if (pthread_cond_timedwait(Variable, Section, &ts) == ETIMEDOUT) {
+			SetLastError(WAIT_TIMEOUT);
+			ret = FALSE;
+		}
+	} else pthread_cond_wait(Variable, Section);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                 FILES                                                */
+/************************************************************************/
+
+/** Converts a wide string to the multibyte encoding of the C library. */
+static char *_ToMultiByte(const wchar_t *String)
+{
+	size_t len = 0;
+	char *ret = NULL;
+
+	len = wcstombs(NULL, String, 0);
+	if (len != (size_t)-1) {
+		ret = (char *)malloc(len + 1);
+		if (ret != NULL)
+			wcstombs(ret, String, len + 1);
+	}
+
+	return ret;
+}
+
+
+FILE *_wfopen(const wchar_t *FileName, const wchar_t *Mode)
+{
+	char *name = NULL;
+	char *mode = NULL;
+	FILE *ret = NULL;
+
+	name = _ToMultiByte(FileName);
+	mode = _ToMultiByte(Mode);
+	if (name != NULL && mode != NULL)
+		ret = fopen(name, mode);
+
+	free(mode);
+	free(name);
+
+	return ret;
+}
+
+
+/** Views are unmapped by their address only, so their sizes are kept here. */
+typedef struct _SHIM_VIEW {
+	struct _SHIM_VIEW *Next;
+	void *Address;
+	size_t Size;
+} SHIM_VIEW, *PSHIM_VIEW;
+
+static PSHIM_VIEW _views = NULL;
+static pthread_mutex_t _viewLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static PSHIM_HANDLE _FileHandleCreate(EShimHandleType Type, int Fd)
+{
+	struct stat st;
+	PSHIM_HANDLE ret = NULL;
+
+	if (fstat(Fd, &st) == 0) {
+		ret = (PSHIM_HANDLE)calloc(1, sizeof(SHIM_HANDLE));
+		if (ret != NULL) {
+			ret->Type = Type;
+			ret->Fd = Fd;
+			ret->Size = st.st_size;
+		} else SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+	} else SetLastError(ERROR_IO_DEVICE);
+
+	return ret;
+}
+
+
+HANDLE CreateFileW(LPCWSTR FileName, DWORD Access, DWORD ShareMode, PVOID SecurityAttributes, DWORD Disposition, DWORD Flags, HANDLE Template)
+{
+	int fd = -1;
+	char *name = NULL;
+	PSHIM_HANDLE h = NULL;
+	HANDLE ret = INVALID_HANDLE_VALUE;
+
+	(void)ShareMode;
+	(void)SecurityAttributes;
+	(void)Flags;
+	(void)Template;
+	SetLastError(ERROR_NOT_SUPPORTED);
+	if (Access == GENERIC_READ && Disposition == OPEN_EXISTING) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		name = _ToMultiByte(FileName);
+		if (name != NULL) {
+			SetLastError(ERROR_FILE_NOT_FOUND);
+			fd = open(name, O_RDONLY);
+			if (fd != -1) {
+				h = _FileHandleCreate(shtFile, fd);
+				if (h != NULL)
+					ret = h;
+				else close(fd);
+			}
+
+			free(name);
+		}
+	}
+
+	return ret;
+}
+
+
+BOOL GetFileSizeEx(HANDLE File, PLARGE_INTEGER Size)
+{
+	PSHIM_HANDLE h = (PSHIM_HANDLE)File;
+
+	Size->QuadPart = h->Size;
+
+	return TRUE;
+}
+
+
+HANDLE CreateFileMappingW(HANDLE File, PVOID Attributes, DWORD Protect, DWORD MaximumSizeHigh, DWORD MaximumSizeLow, LPCWSTR Name)
+{
+	int fd = -1;
+	PSHIM_HANDLE f = (PSHIM_HANDLE)File;
+	PSHIM_HANDLE ret = NULL;
+
+	(void)Attributes;
+	(void)Name;
+	SetLastError(ERROR_NOT_SUPPORTED);
+	if (f->Type == shtFile && Protect == PAGE_READONLY && MaximumSizeHigh == 0 && MaximumSizeLow == 0) {
+		SetLastError(ERROR_IO_DEVICE);
+		fd = dup(f->Fd);
+		if (fd != -1) {
+			ret = _FileHandleCreate(shtMapping, fd);
+			if (ret == NULL)
+				close(fd);
+		}
+	}
+
+	return ret;
+}
+
+
+LPVOID MapViewOfFile(HANDLE Mapping, DWORD Access, DWORD OffsetHigh, DWORD OffsetLow, SIZE_T Size)
+{
+	void *data = NULL;
+	PSHIM_VIEW v = NULL;
+	PSHIM_HANDLE h = (PSHIM_HANDLE)Mapping;
+	LPVOID ret = NULL;
+
+	SetLastError(ERROR_NOT_SUPPORTED);
+	if (h->Type == shtMapping && Access == FILE_MAP_READ && OffsetHigh == 0 && OffsetLow == 0 && Size == 0) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		v = (PSHIM_VIEW)malloc(sizeof(SHIM_VIEW));
+		if (v != NULL) {
+			SetLastError(ERROR_IO_DEVICE);
+			data = mmap(NULL, (size_t)h->Size, PROT_READ, MAP_PRIVATE, h->Fd, 0);
+			if (data != MAP_FAILED) {
+				v->Address = data;
+				v->Size = (size_t)h->Size;
+				pthread_mutex_lock(&_viewLock);
+				v->Next = _views;
+				_views = v;
+				pthread_mutex_unlock(&_viewLock);
+				ret = data;
+			}
+
+			if (ret == NULL)
+				free(v);
+		}
+	}
+
+	return ret;
+}
+
+
+BOOL UnmapViewOfFile(LPCVOID Address)
+{
+	PSHIM_VIEW *prev = NULL;
+	PSHIM_VIEW v = NULL;
+	BOOL ret = FALSE;
+
+	pthread_mutex_lock(&_viewLock);
+	prev = &_views;
+	while (*prev != NULL && (*prev)->Address != Address)
+		prev = &(*prev)->Next;
+
+	v = *prev;
+	if (v != NULL)
+		*prev = v->Next;
+
+	pthread_mutex_unlock(&_viewLock);
+	if (v != NULL) {
+		munmap(v->Address, v->Size);
+		free(v);
+		ret = TRUE;
+	} else SetLastError(ERROR_INVALID_PARAMETER);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                 SECURITY                                             */
+/************************************************************************/
+
+BOOL IsValidSecurityDescriptor(PSECURITY_DESCRIPTOR SecurityDescriptor)
+{
+	return (((PISECURITY_DESCRIPTOR)SecurityDescriptor)->Revision == SECURITY_DESCRIPTOR_REVISION);
+}
+
+
+/** Returns one of the SIDs or ACLs of both absolute and self-relative
+ *  descriptors; Field is the offset of its member in the relative one. */
+static PVOID _SecurityDescriptorPart(PSECURITY_DESCRIPTOR SecurityDescriptor, size_t Field)
+{
+	DWORD offset = 0;
+	PVOID ret = NULL;
+	const SECURITY_DESCRIPTOR *sd = (PISECURITY_DESCRIPTOR)SecurityDescriptor;
+
+	if (sd->Control & SE_SELF_RELATIVE) {
+		offset = *(const DWORD *)((const unsigned char *)sd + Field);
+		if (offset != 0)
+			ret = (unsigned char *)sd + offset;
+	} else if (Field == offsetof(SECURITY_DESCRIPTOR_RELATIVE, Owner))
+		ret = sd->Owner;
+	else if (Field == offsetof(SECURITY_DESCRIPTOR_RELATIVE, Group))
+		ret = sd->Group;
+	else if (Field == offsetof(SECURITY_DESCRIPTOR_RELATIVE, Sacl))
+		ret = sd->Sacl;
+	else ret = sd->Dacl;
+
+	return ret;
+}
+
+
+BOOL GetSecurityDescriptorOwner(PSECURITY_DESCRIPTOR SecurityDescriptor, PSID *Owner, BOOL *Defaulted)
+{
+	*Owner = _SecurityDescriptorPart(SecurityDescriptor, offsetof(SECURITY_DESCRIPTOR_RELATIVE, Owner));
+	*Defaulted = ((((PISECURITY_DESCRIPTOR)SecurityDescriptor)->Control & SE_OWNER_DEFAULTED) != 0);
+
+	return TRUE;
+}
+
+
+BOOL GetSecurityDescriptorGroup(PSECURITY_DESCRIPTOR SecurityDescriptor, PSID *Group, BOOL *Defaulted)
+{
+	*Group = _SecurityDescriptorPart(SecurityDescriptor, offsetof(SECURITY_DESCRIPTOR_RELATIVE, Group));
+	*Defaulted = ((((PISECURITY_DESCRIPTOR)SecurityDescriptor)->Control & SE_GROUP_DEFAULTED) != 0);
+
+	return TRUE;
+}
+
+
+BOOL GetSecurityDescriptorDacl(PSECURITY_DESCRIPTOR SecurityDescriptor, BOOL *Present, PACL *Dacl, BOOL *Defaulted)
+{
+	SECURITY_DESCRIPTOR_CONTROL control = ((PISECURITY_DESCRIPTOR)SecurityDescriptor)->Control;
+
+	*Present = ((control & SE_DACL_PRESENT) != 0);
+	if (*Present) {
+		*Dacl = _SecurityDescriptorPart(SecurityDescriptor, offsetof(SECURITY_DESCRIPTOR_RELATIVE, Dacl));
+		*Defaulted = ((control & SE_DACL_DEFAULTED) != 0);
+	}
+
+	return TRUE;
+}
+
+
+BOOL GetSecurityDescriptorSacl(PSECURITY_DESCRIPTOR SecurityDescriptor, BOOL *Present, PACL *Sacl, BOOL *Defaulted)
+{
+	SECURITY_DESCRIPTOR_CONTROL control = ((PISECURITY_DESCRIPTOR)SecurityDescriptor)->Control;
+
+	*Present = ((control & SE_SACL_PRESENT) != 0);
+	if (*Present) {
+		*Sacl = _SecurityDescriptorPart(SecurityDescriptor, offsetof(SECURITY_DESCRIPTOR_RELATIVE, Sacl));
+		*Defaulted = ((control & SE_SACL_DEFAULTED) != 0);
+	}
+
+	return TRUE;
+}
+
+
+BOOL GetAce(PACL Acl, DWORD Index, LPVOID *Ace)
+{
+	PACE_HEADER h = NULL;
+	BOOL ret = FALSE;
+
+	ret = (Index < Acl->AceCount);
+	if (ret) {
+		h = (PACE_HEADER)(Acl + 1);
+		for (DWORD i = 0; i < Index; ++i)
+			h = (PACE_HEADER)((unsigned char *)h + h->AceSize);
+
+		*Ace = h;
+	} else SetLastError(ERROR_INVALID_PARAMETER);
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                 PRIVATE PROFILES                                     */
+/************************************************************************/
+
+
+DWORD GetPrivateProfileSectionNamesW(LPWSTR Buffer, DWORD Size, LPCWSTR FileName)
+{
+	(void)FileName;
+	if (Size > 0)
+		Buffer[0] = L'\0';
+
+	return 0;
+}
+
+
+DWORD GetPrivateProfileIntW(LPCWSTR Section, LPCWSTR Key, int Default, LPCWSTR FileName)
+{
+	(void)Section;
+	(void)Key;
+	(void)FileName;
+
+	return (DWORD)Default;
+}
+
+
+DWORD GetPrivateProfileStringW(LPCWSTR Section, LPCWSTR Key, LPCWSTR Default, LPWSTR Buffer, DWORD Size, LPCWSTR FileName)
+{
+	DWORD ret = 0;
+
+	(void)Section;
+	(void)Key;
+	(void)FileName;
+	if (Size > 0) {
+		if (Default != NULL) {
+			while (ret + 1 < Size && Default[ret] != L'\0') {
+				Buffer[ret] = Default[ret];
+				++ret;
+			}
+		}
+
+		Buffer[ret] = L'\0';
+	}
+
+	return ret;
+}
@@ -0,0 +1,246 @@
+/**
+ * @file
+ *
+ * Stand-in for strsafe.h. Wide strings are handled character by character,
+ * so they work with any size of wchar_t. Formatting follows the wide
+ * functions of the Microsoft C library, where %s takes a wide and %S a
+ * narrow string; flags, widths and precisions must be given as digits,
+ * '*' is not supported.
+ */
+
+#ifndef __TESTS_SHIM_STRSAFE_H__
+#define __TESTS_SHIM_STRSAFE_H__
+
+#include <stdarg.h>
+#include <windows.h>
+
+
+typedef LONG HRESULT;
+
+#define S_OK							0
+#define STRSAFE_E_INSUFFICIENT_BUFFER	((HRESULT)0x8007007A)
+#define STRSAFE_E_INVALID_PARAMETER		((HRESULT)0x80070057)
+#define STRSAFE_MAX_CCH					2147483647
+/** Widths and precisions above this one are refused. */
+#define STRSAFE_SHIM_MAX_WIDTH			64
+
+
+static inline HRESULT StringCchLengthW(const wchar_t *String, size_t MaxCount, size_t *Length)
+{
+	size_t len = 0;
+	HRESULT ret = STRSAFE_E_INVALID_PARAMETER;
+
+	if (String != NULL) {
+		while (len < MaxCount && String[len] != L'\0')
+			++len;
+
+		if (len < MaxCount) {
+			*Length = len;
+			ret = S_OK;
+		}
+	}
+
+	return ret;
+}
+
+
+static inline BOOLEAN _StrSafePut(wchar_t *Buffer, size_t Capacity, size_t *Index, wchar_t Character)
+{
+	BOOLEAN ret = FALSE;
+
+	ret = (*Index + 1 < Capacity);
+	if (ret) {
+		Buffer[*Index] = Character;
+		++(*Index);
+	}
+
+	return ret;
+}
+
+
+/** Appends a narrow or wide string, cut at Precision and padded to Width
+ *  when they are not negative. */
+static inline BOOLEAN _StrSafePutString(wchar_t *Buffer, size_t Capacity, size_t *Index, const void *String, BOOLEAN Narrow, int Width, int Precision, BOOLEAN Left)
+{
+	size_t len = 0;
+	size_t pad = 0;
+	BOOLEAN ret = TRUE;
+
+	if (String == NULL) {
+		String = "(null)";
+		Narrow = TRUE;
+	}
+
+	while ((Precision < 0 || len < (size_t)Precision) &&
+		(Narrow ? ((const char *)String)[len] != '\0' : ((const wchar_t *)String)[len] != L'\0'))
+		++len;
+
+	if (Width > 0 && (size_t)Width > len)
+		pad = Width - len;
+
+	for (size_t i = 0; ret && !Left && i < pad; ++i)
+		ret = _StrSafePut(Buffer, Capacity, Index, L' ');
+
+	for (size_t i = 0; ret && i < len; ++i)
+		ret = _StrSafePut(Buffer, Capacity, Index, Narrow ? (wchar_t)(unsigned char)((const char *)String)[i] : ((const wchar_t *)String)[i]);
+
+	for (size_t i = 0; ret && Left && i < pad; ++i)
+		ret = _StrSafePut(Buffer, Capacity, Index, L' ');
+
+	return ret;
+}
+
+
+static inline HRESULT StringCbVPrintfW(wchar_t *Buffer, size_t BufferSize, const wchar_t *Format, va_list Args)
+{
+	char spec[32];
+	char text[STRSAFE_SHIM_MAX_WIDTH + 32];
+	size_t specLen = 0;
+	size_t index = 0;
+	size_t capacity = 0;
+	int width = -1;
+	int precision = -1;
+	int size = 0;
+	wchar_t character[2];
+	BOOLEAN left = FALSE;
+	BOOLEAN ok = TRUE;
+	HRESULT ret = STRSAFE_E_INVALID_PARAMETER;
+
+	capacity = BufferSize / sizeof(wchar_t);
+	if (Buffer != NULL && capacity > 0 && Format != NULL) {
+		ret = S_OK;
+		while (ok && ret == S_OK && *Format != L'\0') {
+			if (*Format != L'%' || Format[1] == L'%') {
+				ok = _StrSafePut(Buffer, capacity, &index, *Format);
+				Format += (*Format == L'%') ? 2 : 1;
+			} else {
+				++Format;
+				spec[0] = '%';
+				specLen = 1;
+				left = FALSE;
+				while (specLen < 8 && (*Format == L'-' || *Format == L'+' || *Format == L' ' || *Format == L'#' || *Format == L'0')) {
+					left |= (*Format == L'-');
+					spec[specLen++] = (char)*Format++;
+				}
+
+				width = -1;
+				while (*Format >= L'0' && *Format <= L'9' && width <= STRSAFE_SHIM_MAX_WIDTH)
+					width = ((width < 0) ? 0 : width*10) + (*Format++ - L'0');
+
+				precision = -1;
+				if (*Format == L'.') {
+					++Format;
+					precision = 0;
+					while (*Format >= L'0' && *Format <= L'9' && precision <= STRSAFE_SHIM_MAX_WIDTH)
+						precision = precision*10 + (*Format++ - L'0');
+				}
+
+				if (width > STRSAFE_SHIM_MAX_WIDTH || precision > STRSAFE_SHIM_MAX_WIDTH)
+					ret = STRSAFE_E_INVALID_PARAMETER;
+
+				if (width >= 0)
+					specLen += snprintf(spec + specLen, sizeof(spec) - specLen, "%d", width);
+
+				if (precision >= 0)
+					specLen += snprintf(spec + specLen, sizeof(spec) - specLen, ".%d", precision);
+
+				// 0 stands for int, 1 for long, 2 for long long, 3 for size_t and
+				// -1 for the h prefix, which makes strings and characters narrow.
+				size = 0;
+				if (*Format == L'h') {
+					size = -1;
+					++Format;
+					if (*Format == L'h')
+						++Format;
+				} else if (*Format == L'l' || *Format == L'w') {
+					size = 1;
+					++Format;
+					if (*Format == L'l') {
+						size = 2;
+						++Format;
+					}
+				} else if (*Format == L'z') {
+					size = 3;
+					++Format;
+				} else if (*Format == L'I') {
+					size = 3;
+					++Format;
+					if (Format[0] == L'6' && Format[1] == L'4') {
+						size = 2;
+						Format += 2;
+					} else if (Format[0] == L'3' && Format[1] == L'2') {
+						size = 0;
+						Format += 2;
+					}
+				}
+
+				if (ret == S_OK) {
+					switch (*Format) {
+						case L'd':
+						case L'i':
+							memcpy(spec + specLen, "lld", 4);
+							if (size == 2)
+								snprintf(text, sizeof(text), spec, va_arg(Args, long long));
+							else if (size == 3)
+								snprintf(text, sizeof(text), spec, (long long)va_arg(Args, ptrdiff_t));
+							else if (size == 1)
+								snprintf(text, sizeof(text), spec, (long long)va_arg(Args, long));
+							else snprintf(text, sizeof(text), spec, (long long)va_arg(Args, int));
+							ok = _StrSafePutString(Buffer, capacity, &index, text, TRUE, -1, -1, FALSE);
+							break;
+						case L'u':
+						case L'o':
+						case L'x':
+						case L'X':
+							spec[specLen] = 'l';
+							spec[specLen + 1] = 'l';
+							spec[specLen + 2] = (char)*Format;
+							spec[specLen + 3] = '\0';
+							if (size == 2)
+								snprintf(text, sizeof(text), spec, va_arg(Args, unsigned long long));
+							else if (size == 3)
+								snprintf(text, sizeof(text), spec, (unsigned long long)va_arg(Args, size_t));
+							else if (size == 1)
+								snprintf(text, sizeof(text), spec, (unsigned long long)va_arg(Args, unsigned long));
+							else snprintf(text, sizeof(text), spec, (unsigned long long)va_arg(Args, unsigned int));
+							ok = _StrSafePutString(Buffer, capacity, &index, text, TRUE, -1, -1, FALSE);
+							break;
+						case L'p':
+							snprintf(text, sizeof(text), "%0*llX", (int)(2*sizeof(void *)), (unsigned long long)(uintptr_t)va_arg(Args, void *));
+							ok = _StrSafePutString(Buffer, capacity, &index, text, TRUE, width, -1, left);
+							break;
+						case L'c':
+						case L'C':
+							character[0] = (wchar_t)va_arg(Args, int);
+							character[1] = L'\0';
+							ok = _StrSafePutString(Buffer, capacity, &index, character, FALSE, width, -1, left);
+							break;
+						case L's':
+							ok = _StrSafePutString(Buffer, capacity, &index, va_arg(Args, const void *), size < 0, width, precision, left);
+							break;
+						case L'S':
+							ok = _StrSafePutString(Buffer, capacity, &index, va_arg(Args, const void *), size <= 0, width, precision, left);
+							break;
+						default:
+							ret = STRSAFE_E_INVALID_PARAMETER;
+							break;
+					}
+
+					++Format;
+				}
+			}
+		}
+
+		Buffer[index] = L'\0';
+		if (ret == S_OK && !ok)
+			ret = STRSAFE_E_INSUFFICIENT_BUFFER;
+	}
+
+	return ret;
+}
+
+#define StringCbVPrintf					StringCbVPrintfW
+
+
+
+#endif
@@ -0,0 +1,475 @@
+/**
+ * @file
+ *
+ * Minimal user-mode stand-in for the Win32 headers, built on the types of
+ * the kernel shim. Heaps are backed by the C library, private profiles
+ * (INI files) are not supported and always appear empty, and no DLL can
+ * be loaded. Threads, events and their locks are backed by pthreads, files
+ * and their mappings by file descriptors and mmap; handles are objects of
+ * shim.c. Thread pool callbacks run on threads of their own.
+ */
+
+#ifndef __TESTS_SHIM_WINDOWS_H__
+#define __TESTS_SHIM_WINDOWS_H__
+
+#include <unistd.h>
+#include <ntifs.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef int BOOL;
+typedef uint32_t DWORD, *PDWORD, *LPDWORD;
+typedef uint16_t WORD;
+typedef uint8_t BYTE;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG, DWORD64;
+typedef const wchar_t *PCWSTR, *LPCWSTR;
+typedef wchar_t *LPWSTR;
+typedef const char *PCSTR, *LPCSTR;
+typedef void *LPVOID;
+typedef const void *LPCVOID;
+typedef void *HMODULE;
+typedef uintptr_t UINT_PTR;
+
+#define WINAPI
+#define CALLBACK
+#define cdecl
+#define __declspec(aAttribute)
+#define MAX_PATH						260
+#define INFINITE						0xffffffff
+#define MAXULONG						0xffffffffUL
+#define MAXLONG							0x7fffffffL
+#define _wcstoui64					wcstoull
+#define _fseeki64					fseeko
+#define _ftelli64					ftello
+
+#define ERROR_SUCCESS					0
+#define ERROR_FILE_NOT_FOUND			2
+#define ERROR_NOT_ENOUGH_MEMORY			8
+#define ERROR_INVALID_DATA				13
+#define ERROR_GEN_FAILURE				31
+#define ERROR_HANDLE_EOF				38
+#define ERROR_NOT_SUPPORTED				50
+#define ERROR_INVALID_PARAMETER			87
+#define ERROR_INSUFFICIENT_BUFFER		122
+#define ERROR_MOD_NOT_FOUND				126
+#define ERROR_ALREADY_EXISTS			183
+#define ERROR_NO_MORE_ITEMS				259
+#define WAIT_TIMEOUT					258
+#define ERROR_IO_PENDING				997
+#define ERROR_INVALID_MESSAGE			1010
+#define ERROR_IO_DEVICE					1117
+#define ERROR_GRACEFUL_DISCONNECT		1226
+#define ERROR_CONNECTION_ABORTED		1236
+#define ERROR_NONE_MAPPED				1332
+
+#define MAKEWORD(aLow, aHigh)			((WORD)(((BYTE)(aLow)) | ((WORD)((BYTE)(aHigh))) << 8))
+
+
+extern __thread DWORD ShimLastError;
+
+static inline DWORD GetLastError(void) { return ShimLastError; }
+static inline void SetLastError(DWORD Error) { ShimLastError = Error; }
+
+
+/************************************************************************/
+/*                 HEAPS                                                */
+/************************************************************************/
+
+#define HEAP_ZERO_MEMORY				0x8
+#define CopyMemory						RtlCopyMemory
+
+static inline HANDLE GetProcessHeap(void) { return (HANDLE)1; }
+
+static inline LPVOID HeapAlloc(HANDLE Heap, DWORD Flags, SIZE_T Bytes)
+{
+	(void)Heap;
+	__atomic_add_fetch(&ShimAllocationCount, 1, __ATOMIC_RELAXED);
+	return (Flags & HEAP_ZERO_MEMORY) ? calloc(1, Bytes) : malloc(Bytes);
+}
+
+static inline LPVOID HeapReAlloc(HANDLE Heap, DWORD Flags, LPVOID Memory, SIZE_T Bytes)
+{
+	(void)Heap;
+	(void)Flags;
+	return realloc(Memory, Bytes);
+}
+
+static inline BOOL HeapFree(HANDLE Heap, DWORD Flags, LPVOID Memory)
+{
+	(void)Heap;
+	(void)Flags;
+	free(Memory);
+	return TRUE;
+}
+
+
+/************************************************************************/
+/*                 PROCESSES AND THREADS                                */
+/************************************************************************/
+
+#define WAIT_OBJECT_0					0
+#define WAIT_FAILED						0xffffffff
+#define MAXIMUM_WAIT_OBJECTS			64
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(PVOID Parameter);
+
+static inline DWORD GetCurrentProcessId(void) { return (DWORD)getpid(); }
+static inline DWORD GetCurrentThreadId(void) { return (DWORD)(uintptr_t)pthread_self(); }
+
+/** Only INFINITE waits are supported for threads. */
+HANDLE CreateThread(PVOID Attributes, SIZE_T StackSize, LPTHREAD_START_ROUTINE Routine, PVOID Parameter, DWORD Flags, PDWORD ThreadId);
+/** Threads can be waited for with INFINITE timeouts only, events with any. */
+DWORD WaitForSingleObject(HANDLE Handle, DWORD Milliseconds);
+/** Only waits for all the objects with an INFINITE timeout are supported. */
+DWORD WaitForMultipleObjects(DWORD Count, const HANDLE *Handles, BOOL WaitAll, DWORD Milliseconds);
+BOOL CloseHandle(HANDLE Handle);
+
+typedef struct _SYSTEM_INFO {
+	DWORD dwPageSize;
+	DWORD dwNumberOfProcessors;
+} SYSTEM_INFO, *LPSYSTEM_INFO;
+
+static inline void GetSystemInfo(LPSYSTEM_INFO Info)
+{
+	memset(Info, 0, sizeof(SYSTEM_INFO));
+	Info->dwPageSize = (DWORD)sysconf(_SC_PAGESIZE);
+	Info->dwNumberOfProcessors = (DWORD)sysconf(_SC_NPROCESSORS_ONLN);
+
+	return;
+}
+
+HANDLE CreateEventW(PVOID Attributes, BOOL ManualReset, BOOL InitialState, LPCWSTR Name);
+BOOL SetEvent(HANDLE Event);
+BOOL ResetEvent(HANDLE Event);
+
+typedef struct _TP_CALLBACK_INSTANCE *PTP_CALLBACK_INSTANCE;
+typedef struct _TP_CALLBACK_ENVIRON *PTP_CALLBACK_ENVIRON;
+typedef VOID (CALLBACK *PTP_SIMPLE_CALLBACK)(PTP_CALLBACK_INSTANCE Instance, PVOID Context);
+
+BOOL TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK Callback, PVOID Context, PTP_CALLBACK_ENVIRON Environment);
+
+
+/************************************************************************/
+/*                 TIME                                                 */
+/************************************************************************/
+
+static inline void Sleep(DWORD Milliseconds) { usleep((useconds_t)Milliseconds*1000); }
+
+static inline DWORD GetTickCount(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (DWORD)(ts.tv_sec*1000 + ts.tv_nsec / 1000000);
+}
+
+/** The counter runs in nanoseconds. */
+static inline BOOL QueryPerformanceCounter(PLARGE_INTEGER Counter)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	Counter->QuadPart = (LONG64)ts.tv_sec*1000000000 + ts.tv_nsec;
+	return TRUE;
+}
+
+static inline BOOL QueryPerformanceFrequency(PLARGE_INTEGER Frequency)
+{
+	Frequency->QuadPart = 1000000000;
+	return TRUE;
+}
+
+
+/************************************************************************/
+/*                 CRITICAL SECTIONS AND CONDITION VARIABLES            */
+/************************************************************************/
+
+typedef pthread_mutex_t CRITICAL_SECTION, *PCRITICAL_SECTION;
+typedef pthread_cond_t CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+static inline void InitializeCriticalSection(PCRITICAL_SECTION Section)
+{
+	pthread_mutexattr_t attr;
+
+	// Critical sections may be entered recursively.
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(Section, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static inline BOOL InitializeCriticalSectionAndSpinCount(PCRITICAL_SECTION Section, DWORD SpinCount)
+{
+	(void)SpinCount;
+	InitializeCriticalSection(Section);
+	return TRUE;
+}
+
+static inline void DeleteCriticalSection(PCRITICAL_SECTION Section) { pthread_mutex_destroy(Section); }
+static inline void EnterCriticalSection(PCRITICAL_SECTION Section) { pthread_mutex_lock(Section); }
+static inline void LeaveCriticalSection(PCRITICAL_SECTION Section) { pthread_mutex_unlock(Section); }
+
+static inline void InitializeConditionVariable(PCONDITION_VARIABLE Variable) { pthread_cond_init(Variable, NULL); }
+static inline void WakeConditionVariable(PCONDITION_VARIABLE Variable) { pthread_cond_signal(Variable); }
+static inline void WakeAllConditionVariable(PCONDITION_VARIABLE Variable) { pthread_cond_broadcast(Variable); }
+BOOL SleepConditionVariableCS(PCONDITION_VARIABLE Variable, PCRITICAL_SECTION Section, DWORD Milliseconds);
+
+
+/************************************************************************/
+/*                 DEVICE I/O CONTROL CODES                             */
+/************************************************************************/
+
+#define FILE_DEVICE_UNKNOWN				0x22
+#define METHOD_NEITHER					3
+#define FILE_ANY_ACCESS					0
+#define FILE_READ_ACCESS				1
+#define FILE_WRITE_ACCESS				2
+
+#define CTL_CODE(aDeviceType, aFunction, aMethod, aAccess)		\
+	(((aDeviceType) << 16) | ((aAccess) << 14) | ((aFunction) << 2) | (aMethod))
+
+
+/************************************************************************/
+/*                 FILES                                                */
+/************************************************************************/
+
+#define GENERIC_READ					0x80000000
+#define FILE_SHARE_READ					0x1
+#define OPEN_EXISTING					3
+#define FILE_ATTRIBUTE_NORMAL			0x80
+#define PAGE_READONLY					0x2
+#define FILE_MAP_READ					0x4
+#define INVALID_HANDLE_VALUE			((HANDLE)(intptr_t)-1)
+
+FILE *_wfopen(const wchar_t *FileName, const wchar_t *Mode);
+
+/** Only opening existing files for reading is supported. */
+HANDLE CreateFileW(LPCWSTR FileName, DWORD Access, DWORD ShareMode, PVOID SecurityAttributes, DWORD Disposition, DWORD Flags, HANDLE Template);
+BOOL GetFileSizeEx(HANDLE File, PLARGE_INTEGER Size);
+/** Read-only mappings of whole files only. */
+HANDLE CreateFileMappingW(HANDLE File, PVOID Attributes, DWORD Protect, DWORD MaximumSizeHigh, DWORD MaximumSizeLow, LPCWSTR Name);
+LPVOID MapViewOfFile(HANDLE Mapping, DWORD Access, DWORD OffsetHigh, DWORD OffsetLow, SIZE_T Size);
+BOOL UnmapViewOfFile(LPCVOID Address);
+
+
+/************************************************************************/
+/*                 LIBRARIES                                            */
+/************************************************************************/
+
+#define LOAD_LIBRARY_SEARCH_SYSTEM32	0x800
+
+static inline HMODULE LoadLibraryExW(LPCWSTR FileName, HANDLE File, DWORD Flags)
+{
+	(void)FileName;
+	(void)File;
+	(void)Flags;
+	SetLastError(ERROR_MOD_NOT_FOUND);
+	return NULL;
+}
+
+
+/************************************************************************/
+/*                 STRINGS AND GUIDS                                    */
+/************************************************************************/
+
+/** Case is folded for ASCII letters only. */
+static inline int _wcsicmp(const wchar_t *String1, const wchar_t *String2)
+{
+	wchar_t c1 = L'\0';
+	wchar_t c2 = L'\0';
+
+	do {
+		c1 = *String1++;
+		c2 = *String2++;
+		if (c1 >= L'A' && c1 <= L'Z')
+			c1 += (L'a' - L'A');
+
+		if (c2 >= L'A' && c2 <= L'Z')
+			c2 += (L'a' - L'A');
+	} while (c1 == c2 && c1 != L'\0');
+
+	return (int)c1 - (int)c2;
+}
+
+static inline int StringFromGUID2(const GUID *Guid, LPWSTR String, int Max)
+{
+	char text[40];
+	int ret = 0;
+
+	ret = snprintf(text, sizeof(text), "{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}",
+		Guid->Data1, Guid->Data2, Guid->Data3, Guid->Data4[0], Guid->Data4[1], Guid->Data4[2],
+		Guid->Data4[3], Guid->Data4[4], Guid->Data4[5], Guid->Data4[6], Guid->Data4[7]) + 1;
+	if (ret <= Max) {
+		for (int i = 0; i < ret; ++i)
+			String[i] = (wchar_t)text[i];
+	} else ret = 0;
+
+	return ret;
+}
+
+
+/************************************************************************/
+/*                 POWER STATES                                         */
+/************************************************************************/
+
+typedef enum _SYSTEM_POWER_STATE {
+	PowerSystemUnspecified,
+	PowerSystemWorking,
+	PowerSystemSleeping1,
+	PowerSystemSleeping2,
+	PowerSystemSleeping3,
+	PowerSystemHibernate,
+	PowerSystemShutdown,
+	PowerSystemMaximum,
+} SYSTEM_POWER_STATE, *PSYSTEM_POWER_STATE;
+
+#define POWER_SYSTEM_MAXIMUM			7
+
+typedef enum _DEVICE_POWER_STATE {
+	PowerDeviceUnspecified,
+	PowerDeviceD0,
+	PowerDeviceD1,
+	PowerDeviceD2,
+	PowerDeviceD3,
+	PowerDeviceMaximum,
+} DEVICE_POWER_STATE, *PDEVICE_POWER_STATE;
+
+
+/************************************************************************/
+/*                 SECURITY                                             */
+/************************************************************************/
+
+#define SECURITY_DESCRIPTOR_REVISION	1
+#define SE_OWNER_DEFAULTED				0x1
+#define SE_GROUP_DEFAULTED				0x2
+#define SE_DACL_PRESENT					0x4
+#define SE_DACL_DEFAULTED				0x8
+#define SE_SACL_PRESENT					0x10
+#define SE_SACL_DEFAULTED				0x20
+#define SE_SELF_RELATIVE				0x8000
+
+#define ACCESS_ALLOWED_ACE_TYPE			0x0
+#define ACCESS_DENIED_ACE_TYPE			0x1
+#define SYSTEM_AUDIT_ACE_TYPE			0x2
+#define SYSTEM_ALARM_ACE_TYPE			0x3
+#define SYSTEM_MANDATORY_LABEL_ACE_TYPE	0x11
+
+typedef DWORD ACCESS_MASK, SECURITY_INFORMATION;
+typedef WORD SECURITY_DESCRIPTOR_CONTROL;
+typedef void *PSID, *PSECURITY_DESCRIPTOR;
+
+typedef struct _SID_IDENTIFIER_AUTHORITY {
+	BYTE Value[6];
+} SID_IDENTIFIER_AUTHORITY, *PSID_IDENTIFIER_AUTHORITY;
+
+typedef struct _SID {
+	BYTE Revision;
+	BYTE SubAuthorityCount;
+	SID_IDENTIFIER_AUTHORITY IdentifierAuthority;
+	DWORD SubAuthority[1];
+} SID, *PISID;
+
+typedef enum _SID_NAME_USE {
+	SidTypeUser = 1,
+	SidTypeGroup,
+	SidTypeDomain,
+	SidTypeAlias,
+	SidTypeWellKnownGroup,
+	SidTypeDeletedAccount,
+	SidTypeInvalid,
+	SidTypeUnknown,
+	SidTypeComputer,
+	SidTypeLabel,
+} SID_NAME_USE, *PSID_NAME_USE;
+
+typedef struct _ACL {
+	BYTE AclRevision;
+	BYTE Sbz1;
+	WORD AclSize;
+	WORD AceCount;
+	WORD Sbz2;
+} ACL, *PACL;
+
+typedef struct _ACE_HEADER {
+	BYTE AceType;
+	BYTE AceFlags;
+	WORD AceSize;
+} ACE_HEADER, *PACE_HEADER;
+
+typedef struct _ACCESS_ALLOWED_ACE {
+	ACE_HEADER Header;
+	ACCESS_MASK Mask;
+	DWORD SidStart;
+} ACCESS_ALLOWED_ACE, ACCESS_DENIED_ACE, SYSTEM_AUDIT_ACE, SYSTEM_ALARM_ACE, SYSTEM_MANDATORY_LABEL_ACE;
+
+typedef struct _SECURITY_DESCRIPTOR {
+	BYTE Revision;
+	BYTE Sbz1;
+	SECURITY_DESCRIPTOR_CONTROL Control;
+	PSID Owner;
+	PSID Group;
+	PACL Sacl;
+	PACL Dacl;
+} SECURITY_DESCRIPTOR, *PISECURITY_DESCRIPTOR;
+
+typedef struct _SECURITY_DESCRIPTOR_RELATIVE {
+	BYTE Revision;
+	BYTE Sbz1;
+	SECURITY_DESCRIPTOR_CONTROL Control;
+	DWORD Owner;
+	DWORD Group;
+	DWORD Sacl;
+	DWORD Dacl;
+} SECURITY_DESCRIPTOR_RELATIVE, *PISECURITY_DESCRIPTOR_RELATIVE;
+
+/** Only the revision is checked. */
+BOOL IsValidSecurityDescriptor(PSECURITY_DESCRIPTOR SecurityDescriptor);
+BOOL GetSecurityDescriptorOwner(PSECURITY_DESCRIPTOR SecurityDescriptor, PSID *Owner, BOOL *Defaulted);
+BOOL GetSecurityDescriptorGroup(PSECURITY_DESCRIPTOR SecurityDescriptor, PSID *Group, BOOL *Defaulted);
+BOOL GetSecurityDescriptorDacl(PSECURITY_DESCRIPTOR SecurityDescriptor, BOOL *Present, PACL *Dacl, BOOL *Defaulted);
+BOOL GetSecurityDescriptorSacl(PSECURITY_DESCRIPTOR SecurityDescriptor, BOOL *Present, PACL *Sacl, BOOL *Defaulted);
+BOOL GetAce(PACL Acl, DWORD Index, LPVOID *Ace);
+
+/** No accounts are known, every lookup fails. */
+static inline BOOL LookupAccountSidW(LPCWSTR SystemName, PSID Sid, LPWSTR Name, LPDWORD NameLength, LPWSTR DomainName, LPDWORD DomainNameLength, PSID_NAME_USE Use)
+{
+	(void)SystemName;
+	(void)Sid;
+	(void)Name;
+	(void)NameLength;
+	(void)DomainName;
+	(void)DomainNameLength;
+	(void)Use;
+	SetLastError(ERROR_NONE_MAPPED);
+	return FALSE;
+}
+
+static inline HANDLE LocalFree(HANDLE Memory)
+{
+	free(Memory);
+	return NULL;
+}
+
+
+/************************************************************************/
+/*                 PRIVATE PROFILES                                     */
+/************************************************************************/
+
+DWORD GetPrivateProfileSectionNamesW(LPWSTR Buffer, DWORD Size, LPCWSTR FileName);
+DWORD GetPrivateProfileIntW(LPCWSTR Section, LPCWSTR Key, int Default, LPCWSTR FileName);
+DWORD GetPrivateProfileStringW(LPCWSTR Section, LPCWSTR Key, LPCWSTR Default, LPWSTR Buffer, DWORD Size, LPCWSTR FileName);
+
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+
+#endif
@@ -0,0 +1,176 @@
+/**
+ * @file
+ *
+ * Minimal user-mode stand-in for the Windows Sockets headers, built on BSD
+ * sockets. Sockets are file descriptors; errors are taken from errno, and
+ * those the tested code checks for are translated to their WSA codes.
+ * Sending to a closed connection fails instead of raising SIGPIPE.
+ */
+
+#ifndef __TESTS_SHIM_WINSOCK2_H__
+#define __TESTS_SHIM_WINSOCK2_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <windows.h>
+
+
+typedef uintptr_t SOCKET;
+typedef struct pollfd WSAPOLLFD, *PWSAPOLLFD;
+typedef struct addrinfo ADDRINFOA, *PADDRINFOA;
+
+typedef struct _WSABUF {
+	ULONG len;
+	char *buf;
+} WSABUF, *LPWSABUF;
+
+typedef struct _WSADATA {
+	WORD wVersion;
+	WORD wHighVersion;
+} WSADATA, *LPWSADATA;
+
+#define INVALID_SOCKET					((SOCKET)~0)
+#define SOCKET_ERROR					(-1)
+#define SD_BOTH							SHUT_RDWR
+#define WSABASEERR						10000
+#define WSAEWOULDBLOCK					10035
+#define WSAECONNRESET					10054
+#define WSA_MAX_BUFFERS					64
+
+
+static inline int WSAStartup(WORD Version, LPWSADATA Data)
+{
+	Data->wVersion = Version;
+	Data->wHighVersion = Version;
+	return 0;
+}
+
+static inline int WSACleanup(void) { return 0; }
+
+static inline int WSAGetLastError(void)
+{
+	int ret = 0;
+
+	switch (errno) {
+		case 0:
+			break;
+		case EAGAIN:
+			ret = WSAEWOULDBLOCK;
+			break;
+		case EPIPE:
+		case ECONNRESET:
+			ret = WSAECONNRESET;
+			break;
+		default:
+			ret = WSABASEERR + errno;
+			break;
+	}
+
+	return ret;
+}
+
+static inline int closesocket(SOCKET Socket) { return close((int)Socket); }
+
+/** Only FIONBIO is supported. */
+static inline int ioctlsocket(SOCKET Socket, long Command, u_long *Argument)
+{
+	int flags = 0;
+
+	if (Command != FIONBIO) {
+		errno = EINVAL;
+		return SOCKET_ERROR;
+	}
+
+	flags = fcntl((int)Socket, F_GETFL);
+	flags = (*Argument != 0) ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl((int)Socket, F_SETFL, flags);
+}
+
+/** Receive timeouts are given in milliseconds, as a DWORD. */
+static inline int ShimSetSockOpt(SOCKET Socket, int Level, int Name, const char *Value, int Length)
+{
+	struct timeval tv;
+	DWORD ms = 0;
+
+	if (Level == SOL_SOCKET && (Name == SO_RCVTIMEO || Name == SO_SNDTIMEO) && Length == sizeof(DWORD)) {
+		memcpy(&ms, Value, sizeof(ms));
+		tv.tv_sec = ms / 1000;
+		tv.tv_usec = (ms % 1000)*1000;
+		return setsockopt((int)Socket, Level, Name, &tv, sizeof(tv));
+	}
+
+	return setsockopt((int)Socket, Level, Name, Value, (socklen_t)Length);
+}
+
+static inline int ShimGetSockName(SOCKET Socket, struct sockaddr *Address, int *Length)
+{
+	int ret = 0;
+	socklen_t len = (socklen_t)*Length;
+
+	ret = getsockname((int)Socket, Address, &len);
+	*Length = (int)len;
+	return ret;
+}
+
+/** Clears errno, so a closed connection reports no error, as with Winsock. */
+static inline int ShimRecv(SOCKET Socket, char *Buffer, int Length, int Flags)
+{
+	errno = 0;
+	return (int)recv((int)Socket, Buffer, (size_t)Length, Flags);
+}
+
+static inline int ShimSend(SOCKET Socket, const char *Buffer, int Length, int Flags)
+{
+	errno = 0;
+	return (int)send((int)Socket, Buffer, (size_t)Length, Flags | MSG_NOSIGNAL);
+}
+
+#define setsockopt						ShimSetSockOpt
+#define getsockname						ShimGetSockName
+#define recv							ShimRecv
+#define send							ShimSend
+
+/** Overlapped sends are not supported. */
+static inline int WSASend(SOCKET Socket, LPWSABUF Buffers, DWORD BufferCount, LPDWORD BytesSent, DWORD Flags, PVOID Overlapped, PVOID CompletionRoutine)
+{
+	ssize_t n = 0;
+	struct msghdr msg;
+	struct iovec iov[WSA_MAX_BUFFERS];
+
+	(void)Overlapped;
+	(void)CompletionRoutine;
+	if (BufferCount > WSA_MAX_BUFFERS) {
+		errno = EINVAL;
+		return SOCKET_ERROR;
+	}
+
+	for (DWORD i = 0; i < BufferCount; ++i) {
+		iov[i].iov_base = Buffers[i].buf;
+		iov[i].iov_len = Buffers[i].len;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = BufferCount;
+	errno = 0;
+	n = sendmsg((int)Socket, &msg, (int)Flags | MSG_NOSIGNAL);
+	if (n == -1)
+		return SOCKET_ERROR;
+
+	*BytesSent = (DWORD)n;
+	return 0;
+}
+
+static inline int WSAPoll(PWSAPOLLFD Fds, ULONG Count, int Timeout) { return poll(Fds, Count, Timeout); }
+
+
+
+#endif
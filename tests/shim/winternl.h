@@ -0,0 +1,15 @@
+/**
+ * @file
+ *
+ * Stand-in for the Windows internal definitions header; the tested code
+ * needs nothing from it.
+ */
+
+#ifndef __TESTS_SHIM_WINTERNL_H__
+#define __TESTS_SHIM_WINTERNL_H__
+
+#include <windows.h>
+
+
+
+#endif
@@ -0,0 +1,33 @@
+/**
+ * @file
+ *
+ * Minimal user-mode stand-in for the TCP/IP extensions of Windows Sockets.
+ * Wide names are converted to the multibyte encoding of the C library.
+ */
+
+#ifndef __TESTS_SHIM_WS2TCPIP_H__
+#define __TESTS_SHIM_WS2TCPIP_H__
+
+#include <winsock2.h>
+
+
+typedef struct addrinfo ADDRINFOW, *PADDRINFOW;
+
+
+static inline int GetAddrInfoW(PCWSTR NodeName, PCWSTR ServiceName, const ADDRINFOW *Hints, PADDRINFOW *Result)
+{
+	char node[256];
+	char service[64];
+
+	if (wcstombs(node, NodeName, sizeof(node)) >= sizeof(node) ||
+		wcstombs(service, ServiceName, sizeof(service)) >= sizeof(service))
+		return EAI_NONAME;
+
+	return getaddrinfo(node, service, Hints, Result);
+}
+
+static inline void FreeAddrInfoW(PADDRINFOW AddressInfo) { freeaddrinfo(AddressInfo); }
+
+
+
+#endif
@@ -0,0 +1,102 @@
+
+/**
+ * @file
+ *
+ * Background server of the tests of remote monitoring.
+ */
+
+#include <winsock2.h>
+#include "libserver.h"
+#include "test-server.h"
+
+
+static char _port[16];
+static HANDLE _exitEvent = NULL;
+static HANDLE _thread = NULL;
+static volatile LONG _running = FALSE;
+
+
+static DWORD WINAPI _ServerThread(PVOID Context)
+{
+	DWORD ret = ERROR_SUCCESS;
+
+	ret = IRPMonServerStart(TEST_SERVER_ADDRESS, _port, _exitEvent);
+	if (ret != ERROR_SUCCESS)
+		fprintf(stderr, "server failed: %u\n", ret);
+
+	InterlockedExchange(&_running, FALSE);
+
+	return ret;
+}
+
+
+/** Connects to the port; the server closes the probe once it notices. */
+static BOOLEAN _Probe(const struct sockaddr_in *Address)
+{
+	SOCKET s = INVALID_SOCKET;
+	BOOLEAN ret = FALSE;
+
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s != INVALID_SOCKET) {
+		ret = (connect(s, (const struct sockaddr *)Address, sizeof(*Address)) == 0);
+		closesocket(s);
+	}
+
+	return ret;
+}
+
+
+BOOLEAN TestServerStart(char *Port, size_t PortLength)
+{
+	int addrLen = 0;
+	SOCKET s = INVALID_SOCKET;
+	struct sockaddr_in addr;
+	BOOLEAN ret = FALSE;
+
+	// Let the system choose a free port.
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addrLen = sizeof(addr);
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s != INVALID_SOCKET) {
+		if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+			getsockname(s, (struct sockaddr *)&addr, &addrLen) == 0) {
+			snprintf(_port, sizeof(_port), "%u", ntohs(addr.sin_port));
+			ret = TRUE;
+		}
+
+		closesocket(s);
+	}
+
+	if (ret) {
+		ret = FALSE;
+		_exitEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+		_running = TRUE;
+		_thread = CreateThread(NULL, 0, _ServerThread, NULL, 0, NULL);
+		while (_running && !ret) {
+			ret = _Probe(&addr);
+			if (!ret)
+				Sleep(10);
+		}
+
+		if (ret)
+			snprintf(Port, PortLength, "%s", _port);
+		else TestServerStop();
+	}
+
+	return ret;
+}
+
+
+void TestServerStop(void)
+{
+	SetEvent(_exitEvent);
+	WaitForSingleObject(_thread, INFINITE);
+	CloseHandle(_thread);
+	_thread = NULL;
+	CloseHandle(_exitEvent);
+	_exitEvent = NULL;
+
+	return;
+}
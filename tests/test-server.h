@@ -0,0 +1,28 @@
+
+/**
+ * @file
+ *
+ * Runs the server of libserver on a loopback port in the background, with
+ * the fake driver (fake-driver.h) behind it, for the tests and benchmarks of
+ * remote monitoring.
+ */
+
+#ifndef __TESTS_TEST_SERVER_H__
+#define __TESTS_TEST_SERVER_H__
+
+#include <windows.h>
+
+
+#define TEST_SERVER_ADDRESS					"127.0.0.1"
+#define TEST_SERVER_ADDRESS_W				L"127.0.0.1"
+
+
+/** Starts the server on a free port and waits until it accepts connections.
+ *  Port receives the port number in its string form. */
+BOOLEAN TestServerStart(char *Port, size_t PortLength);
+/** Stops the server; its clients are disconnected. */
+void TestServerStop(void);
+
+
+
+#endif
@@ -0,0 +1,5 @@
+
+#include "test.h"
+
+
+volatile long TestFailures = 0;
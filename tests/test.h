@@ -0,0 +1,29 @@
+
+/**
+ * @file
+ *
+ * Assertion macros shared by the portable tests. A failed check is reported
+ * and counted, the test continues and exits with a nonzero code at the end.
+ */
+
+#ifndef __TESTS_TEST_H__
+#define __TESTS_TEST_H__
+
+#include <stdio.h>
+
+
+extern volatile long TestFailures;
+
+#define TEST_CHECK(aCondition)													\
+	do {																		\
+		if (!(aCondition)) {													\
+			__atomic_add_fetch(&TestFailures, 1, __ATOMIC_RELAXED);				\
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #aCondition);	\
+		}																		\
+	} while (0)
+
+#define TEST_RESULT()		((TestFailures == 0) ? 0 : 1)
+
+
+
+#endif